@@ -3,6 +3,7 @@
 #include "ModbeeMpptDebug.h"
 #include "ModbeeMpptWebServer.h"
 #include "ModbeeMpptLog.h"
+#include "ModbeeMpptEventLog.h"
 
 ModbeeMPPT::ModbeeMPPT()
   : _bq25798(&_i2c),
@@ -10,6 +11,17 @@ ModbeeMPPT::ModbeeMPPT()
     config(),
     statsLog(&api),
     powerSave(*this),
+    tracker(*this),
+    curveTracer(*this),
+    vocTuner(*this),
+    chargeProfile(*this),
+    socEstimator(*this),
+    sourceArbiter(*this),
+    selfTest(*this),
+    modbus(*this),
+    station(*this),
+    mqtt(*this),
+    ble(*this),
     _webServer(nullptr),
     _webServerEnabled(false),
   _lowPowerBootMode(false),
@@ -20,7 +32,8 @@ ModbeeMPPT::ModbeeMPPT()
     _ledsInitialized(false),
     _lastErrorBlink(0),
     _errorBlinkState(false),
-    _batteryPresent(false)
+    _batteryPresent(false),
+    _serialCommandLen(0)
 {
   // Load default intervals (will be overridden when config loads)
   _batteryCheckInterval = 30000;
@@ -46,9 +59,7 @@ bool ModbeeMPPT::begin(const char* configFile) {
   }
   
   // Load intervals from configuration
-  const auto& configData = config.data;
-  _batteryCheckInterval = configData.battery_check_interval;
-  _socCheckInterval = configData.soc_check_interval;
+  reloadIntervals();
   _ledUpdateInterval = 1000;  // Hardcoded 1 second LED update interval
 
   // Apply critical non-user-configurable settings (ADC, watchdog, HIZ)
@@ -61,6 +72,8 @@ bool ModbeeMPPT::begin(const char* configFile) {
   
   // Perform battery detection before enabling charging
   _batteryPresent = api.detectBatteryConnected();
+  // OCV curve SOC: the estimator has no state yet, and no telemetry frame
+  // exists, so the curve is read at 25 °C
   float bootSoc = api.getActualBatterySOC();
   _cachedSOC = bootSoc; // seed cached SOC at boot
   bool flatOrMissing = (!_batteryPresent) || (bootSoc < _lowPowerSocThreshold);
@@ -81,6 +94,12 @@ bool ModbeeMPPT::begin(const char* configFile) {
   
   statsLog.begin();
   statsLog.loadStatsToAPI();
+  history.begin();
+  socEstimator.begin();
+  curveTracer.begin();
+  modbus.begin();
+  station.begin();
+  mqtt.begin();
 
   powerSave.begin();
   
@@ -114,13 +133,46 @@ void ModbeeMPPT::loop() {
   static unsigned long lastStatsUpdate = 0;
   static unsigned long lastStatsSave = 0;
   unsigned long currentTime = millis();
+  unsigned long loopStartUs = micros();
 
   // Update API state machines (including true battery voltage)
   if (currentTime - lastStatsUpdate >= 1000) { // 1 second interval
     lastStatsUpdate = currentTime;
     api.updateStats();
+    history.sample(api.getTelemetry(), _cachedSOC);
+    vocTuner.sample(api.getTelemetry());
+    chargeProfile.update(api.getTelemetry());
+    sourceArbiter.update(api.getTelemetry());
+    socEstimator.sample(api.getTelemetry());
+    daily.sample(api.getTelemetry(), _cachedSOC);
   }
   api.update();
+
+  // Apply settings changed over HTTP/WebSocket (register writes stay on this task);
+  // held back during a curve trace, which restores VINDPM and MPPT when it ends
+  if (!curveTracer.isBusy() && config.applyPendingChanges(api)) {
+    reloadIntervals();
+  }
+
+  // Firmware MPPT (no-op unless selected in config)
+  tracker.loop();
+  curveTracer.loop();
+  
+  // Serial commands, and a self-test requested there or over WebSocket
+  pollSerialCommands();
+  selfTest.loop();
+  
+  // Reopen the RS485 UART after Modbus settings changed; poll peers in master mode
+  modbus.loop();
+
+  // Follow the station join for its users (MQTT, web UI in station mode)
+  station.loop();
+
+  // Batch telemetry and publish it over station WiFi when a batch is due
+  mqtt.loop();
+
+  // Answer BLE requests, notify telemetry and send history while the service runs
+  ble.loop();
   
   // Battery connection and charge enable logic (using configurable interval)
   if (currentTime - lastBatteryCheck >= _batteryCheckInterval) {
@@ -140,16 +192,16 @@ void ModbeeMPPT::loop() {
   // SOC measurement optimization (using configurable interval)
   // - Only perform complex true battery voltage measurement when charging
   // - When not charging, getTrueBatteryVoltage() returns current VBAT directly
-  // - Reduced frequency to minimize charge interruptions
+  // - Skipped while the SOC estimator is confident, so harvest is not interrupted
   if (currentTime - lastSOCCheck >= _socCheckInterval) {
     lastSOCCheck = currentTime;
     
     // Only update true battery voltage measurement if we are actually charging
-    if (api.isCharging()) {
+    if (api.isCharging() && !socEstimator.isConfident() && !curveTracer.isBusy() && !tracker.isSweeping()) {
       api.updateTrueBatteryVoltage();
     }
-  // Update cached SOC using latest available measurements
-  _cachedSOC = api.getActualBatterySOC();
+  // Update cached SOC: coulomb-counted estimate, voltage mapping until it is seeded
+  _cachedSOC = socEstimator.isValid() ? socEstimator.getSoc() : api.getActualBatterySOC();
     // If not charging, the true battery voltage will just return the current VBAT reading
   }
   
@@ -178,15 +230,17 @@ void ModbeeMPPT::loop() {
   
   // Re-apply critical settings periodically (watchdog, HIZ, ADC)
   // This ensures the BQ25798 stays properly configured even if it resets itself
-  if (currentTime - lastCriticalSettingsUpdate >= _criticalSettingsUpdateInterval) {
+  // (not while a curve trace, MPP sweep or true battery voltage measurement has the ADC)
+  if (currentTime - lastCriticalSettingsUpdate >= _criticalSettingsUpdateInterval && !adcBorrowed()) {
     lastCriticalSettingsUpdate = currentTime;
     applyCriticalSettings();
   }
   
-  // Periodically re-apply config settings to BQ25798
-  if (currentTime - lastConfigApply >= _configApplyInterval) {
+  // Periodically re-apply config settings to BQ25798 (not over a curve trace's VINDPM and MPPT)
+  if (currentTime - lastConfigApply >= _configApplyInterval && !curveTracer.isBusy()) {
     lastConfigApply = currentTime;
     config.applyToMPPT(api);
+    chargeProfile.reassert();
   }
   
   // Save stats to JSON every 5 minutes
@@ -202,6 +256,53 @@ void ModbeeMPPT::loop() {
 
   // Power management
   powerSave.loop();
+
+  // Write queued log lines to Serial, only as much as fits without blocking
+  ModbeeEventLog.drain();
+
+  metrics.recordLoopTime(micros() - loopStartUs);
+}
+
+void ModbeeMPPT::pollSerialCommands() {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c < 0) break;
+    if (c != '\n' && c != '\r') {
+      // Overlong lines are dropped rather than cut into a different command
+      if (_serialCommandLen < MODBEE_SERIAL_COMMAND_LEN) {
+        _serialCommand[_serialCommandLen] = (char)c;
+      }
+      if (_serialCommandLen < 255) _serialCommandLen++;
+      continue;
+    }
+    if (_serialCommandLen == 0) continue;
+    bool valid = _serialCommandLen < MODBEE_SERIAL_COMMAND_LEN;
+    if (valid) _serialCommand[_serialCommandLen] = '\0';
+    _serialCommandLen = 0;
+
+    if (valid && !strcmp(_serialCommand, "selftest")) {
+      if (!selfTest.requestRun(true)) {
+        Serial.println("Self-test already requested");
+      }
+    } else if (valid && !strcmp(_serialCommand, "fleet")) {
+      modbus.master.printFleet();
+    } else if (valid && !strcmp(_serialCommand, "mqtt")) {
+      mqtt.printStatus();
+    } else if (valid && !strcmp(_serialCommand, "ble")) {
+      ble.printStatus();
+    } else if (valid && !strcmp(_serialCommand, "wifi")) {
+      station.printStatus();
+    } else {
+      Serial.println("Commands: selftest, fleet, mqtt, ble, wifi");
+    }
+  }
+}
+
+void ModbeeMPPT::reloadIntervals() {
+  const auto& configData = config.data;
+  _batteryCheckInterval = configData.battery_check_interval;
+  _socCheckInterval = configData.soc_check_interval;
+  _configApplyInterval = configData.config_apply_interval;
 }
 
 void ModbeeMPPT::printStatus() {
@@ -350,6 +451,10 @@ bool ModbeeMPPT::isWebServerEnabled() {
   return _webServerEnabled;
 }
 
+bool ModbeeMPPT::adcBorrowed() const {
+  return curveTracer.isBusy() || tracker.isSweeping() || api.isTrueBatteryVoltageBusy();
+}
+
 void ModbeeMPPT::applyCriticalSettings() {
   // **CRITICAL SYSTEM SETTINGS - NOT USER CONFIGURABLE**
   // These settings must be periodically re-applied because the BQ25798
@@ -365,4 +470,6 @@ void ModbeeMPPT::applyCriticalSettings() {
   api.setICOEnable(false);
   // Configure system settings (not user-configurable)
   api.setBatteryDischargeSenseEnable(true);  // Always enable discharge current sensing
+  // The charge profile's VREG, ICHG and timer are lost with the rest
+  chargeProfile.reassert();
 }
@@ -8,6 +8,20 @@
 #include "ModbeeMpptConfig.h"
 #include "ModbeeMpptLog.h" // Include for ModbeeMpptLog
 #include "ModbeeMpptPowerSave.h" // Include for ModbeeMpptPowerSave
+#include "ModbeeMpptHistory.h" // Include for ModbeeMpptHistory
+#include "ModbeeMpptMetrics.h" // Include for ModbeeMpptMetrics
+#include "ModbeeMpptTracker.h" // Include for ModbeeMpptTracker
+#include "ModbeeMpptCurveTracer.h" // Include for ModbeeMpptCurveTracer
+#include "ModbeeMpptVocTuner.h" // Include for ModbeeMpptVocTuner
+#include "ModbeeMpptChargeProfile.h" // Include for ModbeeMpptChargeProfile
+#include "ModbeeMpptSocEstimator.h" // Include for ModbeeMpptSocEstimator
+#include "ModbeeMpptSourceArbiter.h" // Include for ModbeeMpptSourceArbiter
+#include "ModbeeMpptSelfTest.h" // Include for ModbeeMpptSelfTest
+#include "ModbeeMpptModbus.h" // Include for ModbeeMpptModbus
+#include "ModbeeMpptDaily.h" // Include for ModbeeMpptDaily
+#include "ModbeeMpptStation.h" // Include for ModbeeMpptStation
+#include "ModbeeMpptMqtt.h" // Include for ModbeeMpptMqtt
+#include "ModbeeMpptBle.h" // Include for ModbeeMpptBle
 
 // Forward declaration to avoid circular dependency
 class ModbeeMpptWebServer;
@@ -16,6 +30,9 @@ class ModbeeMpptWebServer;
 #define SDA_PIN 3
 #define SCL_PIN 2
 
+// Longest command line accepted on Serial
+#define MODBEE_SERIAL_COMMAND_LEN 32
+
 class ModbeeMPPT {
 public:
   ModbeeMPPT();
@@ -64,6 +81,20 @@ public:
   ModbeeMpptConfig config;  // Configuration manager - public for easy access
   ModbeeMpptLog statsLog;   // Persistent stats manager - public for easy access
   ModbeeMpptPowerSave powerSave; // Power management module - public for easy access
+  ModbeeMpptHistory history; // Telemetry history: 1-minute RAM ring and hourly LittleFS rollup - public for easy access
+  ModbeeMpptMetrics metrics; // Loop timing for /metrics - public for easy access
+  ModbeeMpptTracker tracker; // Firmware P&O MPPT - public for easy access
+  ModbeeMpptCurveTracer curveTracer; // On-demand I-V curve tracer - public for easy access
+  ModbeeMpptVocTuner vocTuner; // Adaptive VOC rate/delay - public for easy access
+  ModbeeMpptChargeProfile chargeProfile; // Multi-stage charge profile - public for easy access
+  ModbeeMpptSocEstimator socEstimator; // Coulomb-counting SOC - public for easy access
+  ModbeeMpptSourceArbiter sourceArbiter; // VAC1/VAC2 input selection - public for easy access
+  ModbeeMpptSelfTest selfTest; // On-target timing self-test - public for easy access
+  ModbeeMpptModbus modbus; // Modbus RTU slave on RS485 - public for easy access
+  ModbeeMpptDaily daily; // Daily energy rollup - public for easy access
+  ModbeeMpptStation station; // Station-mode WiFi shared by MQTT and the web UI - public for easy access
+  ModbeeMpptMqtt mqtt; // MQTT telemetry publisher - public for easy access
+  ModbeeMpptBle ble; // BLE GATT service - public for easy access
   ModbeeMpptWebServer* _webServer; // Web server instance - public for easy access
 
   // LED management (made public for direct access by power save)
@@ -73,7 +104,7 @@ public:
   bool _ledsInitialized;
   unsigned long _lastErrorBlink;
   bool _errorBlinkState;
-  float _cachedSOC = 0.0f;  // updated on SOC interval only
+  float _cachedSOC = 0.0f;  // updated on SOC interval only (estimator once seeded)
 private:
   SoftWire _i2c;
 
@@ -86,6 +117,9 @@ private:
   unsigned long _ledUpdateInterval;
   unsigned long _criticalSettingsUpdateInterval;  // Interval to re-apply critical settings (hardcoded)
   unsigned long _configApplyInterval;  // Interval to re-apply config settings (user-configurable)
+  // Serial command line being typed
+  char _serialCommand[MODBEE_SERIAL_COMMAND_LEN];
+  uint8_t _serialCommandLen;
   // Low-power boot controls
   bool _lowPowerBootMode;
   float _lowPowerSocThreshold = 5.0f;   // % SOC considered "flat" at boot
@@ -93,6 +127,9 @@ private:
   
   // Helper functions
   void applyCriticalSettings();  // Re-apply watchdog, HIZ, ADC settings (not user-configurable)
+  bool adcBorrowed() const;      // A curve trace, MPP sweep or true battery voltage measurement owns the ADC setup
+  void reloadIntervals();        // Copy loop intervals from config.data
+  void pollSerialCommands();     // Read and run Serial commands ("selftest", "fleet", "mqtt", "ble", "wifi")
 };
 
 #endif
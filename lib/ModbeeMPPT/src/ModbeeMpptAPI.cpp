@@ -7,6 +7,7 @@
 #include "ModbeeMpptGlobal.h"
 #include "ModbeeMPPT.h"
 #include "ModbeeMpptAPI.h"
+#include "ModbeeMpptEventLog.h"
 
 ModbeeMpptAPI::ModbeeMpptAPI(ModbeeMPPT& mppt) : 
   _mppt(mppt),
@@ -17,10 +18,13 @@ ModbeeMpptAPI::ModbeeMpptAPI(ModbeeMPPT& mppt) :
   _battery_cell_count(4),
   _tbv_state(TBVS_IDLE),
   _tbv_timer(0),
+  _tbv_start(0),
   _tbv_original_charge_state(false),
   _tbv_original_discharge_state(false),
   _tbv_last_reading(0.0f),
-  _tbv_reading_valid(false)
+  _tbv_reading_valid(false),
+  _tbv_sample_count(0),
+  _tbv_stable(false)
 {
   // Initialize peak power and total energy tracking variables
   _vin1PeakPower = 0.0f;
@@ -40,29 +44,93 @@ ModbeeMpptAPI::ModbeeMpptAPI(ModbeeMPPT& mppt) :
 // PEAK POWER AND TOTAL ENERGY TRACKING
 // ========================================================================
 
+// Derive an input source's current from VBUS power (see getVAC1Power)
+static modbee_power_data_t inputPowerFromBus(float voltage, float vbus_voltage, float ibus_current) {
+  modbee_power_data_t data = {voltage, 0.0f, 0.0f, voltage > 0.1f};
+  if (data.valid && vbus_voltage > 0.1f && ibus_current > 0.001f) {
+    data.current = ibus_current * (voltage / vbus_voltage);
+    data.power = data.voltage * data.current;
+  }
+  return data;
+}
+
+void ModbeeMpptAPI::captureTelemetry() {
+  modbee_telemetry_t t = {};
+  t.timestamp_ms = millis();
+
+  // Read every ADC channel exactly once per capture
+  float vbus_voltage = _mppt._bq25798.getADCVBUS();
+  float ibus_current = _mppt._bq25798.getADCIBUS();
+  float vbat_voltage = _mppt._bq25798.getADCVBAT();
+  float ibat_current = _mppt._bq25798.getADCIBAT();
+  float vsys_voltage = _mppt._bq25798.getADCVSYS();
+
+  t.vbus = {vbus_voltage, ibus_current, vbus_voltage * ibus_current, vbus_voltage > 0.1f};
+  t.battery = {vbat_voltage, ibat_current, vbat_voltage * ibat_current, vbat_voltage > 0.1f};
+
+  // System current from the power balance, as in getSystemPower()
+  t.system = {vsys_voltage, 0.0f, 0.0f, vsys_voltage > 0.1f};
+  if (t.system.valid) {
+    float sys_current = (t.vbus.power - t.battery.power) / vsys_voltage;
+    if (sys_current > 0.0f) {
+      t.system.current = sys_current;
+      t.system.power = sys_current * vsys_voltage;
+    }
+  }
+
+  t.vac1 = inputPowerFromBus(_mppt._bq25798.getADCVAC1(), vbus_voltage, ibus_current);
+  t.vac2 = inputPowerFromBus(_mppt._bq25798.getADCVAC2(), vbus_voltage, ibus_current);
+  // With a known active input the other one carries no current
+  uint8_t active = _activeInput;
+  if (active == 1) t.vac2.current = t.vac2.power = 0.0f;
+  if (active == 2) t.vac1.current = t.vac1.power = 0.0f;
+
+  t.die_temperature = _mppt._bq25798.getADCTDIE();
+  t.battery_temperature = getBatteryTemperature();
+  t.charge_state = getStatus1().charge_state;
+  t.fault_status0 = _mppt._bq25798.getFaultStatus0();
+  t.fault_status1 = _mppt._bq25798.getFaultStatus1();
+  t.valid = true;
+
+  portENTER_CRITICAL(&_telemetryMux);
+  t.sequence = _telemetry.sequence + 1;
+  _telemetry = t;
+  portEXIT_CRITICAL(&_telemetryMux);
+}
+
+modbee_telemetry_t ModbeeMpptAPI::getTelemetry() const {
+  portENTER_CRITICAL(&_telemetryMux);
+  modbee_telemetry_t t = _telemetry;
+  portEXIT_CRITICAL(&_telemetryMux);
+  return t;
+}
+
 void ModbeeMpptAPI::updateStats() {
   unsigned long now = millis();
   float dt_hours = (now - _lastStatsUpdateMs) / 3600000.0f; // ms to hours
   _lastStatsUpdateMs = now;
 
+  captureTelemetry();
+  const modbee_telemetry_t& t = _telemetry;
+
   // VIN1
-  float vin1_power = getVAC1Power().power;
+  float vin1_power = t.vac1.power;
   if (vin1_power > _vin1PeakPower) _vin1PeakPower = vin1_power;
   _vin1TotalEnergyWh += vin1_power * dt_hours;
 
   // VIN2
-  float vin2_power = getVAC2Power().power;
+  float vin2_power = t.vac2.power;
   if (vin2_power > _vin2PeakPower) _vin2PeakPower = vin2_power;
   _vin2TotalEnergyWh += vin2_power * dt_hours;
 
   // VBUS
-  float vbus_power = getVbusPower().power;
+  float vbus_power = t.vbus.power;
   if (vbus_power > _vbusPeakPower) _vbusPeakPower = vbus_power;
   _vbusTotalEnergyWh += vbus_power * dt_hours;
 
   // BAT
-  float bat_power = getBatteryPower().power;
-  float bat_current = getBatteryPower().current;
+  float bat_power = t.battery.power;
+  float bat_current = t.battery.current;
   if (bat_power > _batteryPeakPower) _batteryPeakPower = bat_power;
   // Only accumulate charge energy when charging
   if (bat_current > 0.0f) {
@@ -75,7 +143,7 @@ void ModbeeMpptAPI::updateStats() {
   }
 
   // SYS (VSYS) - debounce peak power
-  float sys_power = getSystemPower().power;
+  float sys_power = t.system.power;
   static int sysPeakDebounce = 0;
   if (sys_power > _systemPeakPower) {
     sysPeakDebounce++;
@@ -100,10 +168,8 @@ void ModbeeMpptAPI::updateStats() {
     _batteryAmpHoursDischarge += abs_current * dt_hours;
   }
   // Battery discharge power tracking
-  float bat_power_discharge = getBatteryPower().power;
-  float bat_current_discharge = getBatteryPower().current;
-  if (bat_current_discharge < 0.0f) {
-    float abs_power = -bat_power_discharge;
+  if (bat_current < 0.0f) {
+    float abs_power = -bat_power;
     if (abs_power > _batteryPeakDischargePower) _batteryPeakDischargePower = abs_power;
     // _batteryWattHoursDischarge already accumulated above
   }
@@ -255,7 +321,7 @@ modbee_power_data_t ModbeeMpptAPI::getVAC1Power() {
   data.voltage = _mppt._bq25798.getADCVAC1();
   data.valid = (data.voltage > 0.1f);
   
-  if (!data.valid) return data;
+  if (!data.valid || _activeInput == 2) return data;
   
   // Calculate VAC1 current based on power conservation
   // VAC1 power should be proportional to VBUS power based on voltage ratio
@@ -282,7 +348,7 @@ modbee_power_data_t ModbeeMpptAPI::getVAC2Power() {
   data.voltage = _mppt._bq25798.getADCVAC2();
   data.valid = (data.voltage > 0.1f);
   
-  if (!data.valid) return data;
+  if (!data.valid || _activeInput == 1) return data;
   
   // Calculate VAC2 current based on power conservation
   // VAC2 power should be proportional to VBUS power based on voltage ratio
@@ -422,8 +488,13 @@ float ModbeeMpptAPI::getBatteryTemperature() {
 bool ModbeeMpptAPI::setBatteryType(modbee_battery_type_t type, uint8_t cell_count) {
   if (cell_count == 0 || cell_count > 4) return false;  // BQ25798 supports max 4S
   
+  // SOC lookups follow the type even when a custom battery has no curve yet
+  _battery_type = type;
+  _battery_cell_count = cell_count;
+  
   // Set voltage limits based on battery type
   float cell_min, cell_max;
+  const modbee_ocv_curve_t* curve = _mppt.config.ocvCurve(type);
   
   switch (type) {
     case MODBEE_BATTERY_LIFEPO4:
@@ -438,6 +509,12 @@ bool ModbeeMpptAPI::setBatteryType(modbee_battery_type_t type, uint8_t cell_coun
       cell_min = MODBEE_LEAD_ACID_MIN_VOLTAGE;
       cell_max = MODBEE_LEAD_ACID_MAX_VOLTAGE;
       break;
+    case MODBEE_BATTERY_CUSTOM:
+      // Custom batteries need an uploaded OCV curve; its ends are the range
+      if (!curve) return false;
+      cell_min = curve->mv[0] / 1000.0f;
+      cell_max = curve->mv[MODBEE_OCV_POINTS - 1] / 1000.0f;
+      break;
     default:
       return false;
   }
@@ -475,14 +552,15 @@ bool ModbeeMpptAPI::setBatteryType(modbee_battery_type_t type, uint8_t cell_coun
  * @brief Update true battery voltage measurement (start measurement process)
  * 
  * This function initiates the true battery voltage measurement process if one
- * is not already in progress. The measurement temporarily disables charging 
- * and forces a small discharge current to measure the true no-load battery voltage.
+ * is not already in progress. The measurement forces a small discharge current,
+ * samples VBAT every MODBEE_TBV_SAMPLE_MS until dV/dt settles, and extrapolates
+ * the remaining exponential decay to the no-load battery voltage.
  */
 void ModbeeMpptAPI::updateTrueBatteryVoltage() {
   // Start a new measurement if not currently in progress
   if (_tbv_state == TBVS_IDLE) {
     _tbv_reading_valid = false; // Invalidate old reading to get fresh measurement
-    _tbv_state = TBVS_DISABLE_CHARGING;
+    _tbv_state = TBVS_FORCE_DISCHARGE;
     _tbv_timer = millis();
   }
 }
@@ -505,6 +583,44 @@ float ModbeeMpptAPI::getTrueBatteryVoltage() {
   }
 }
 
+modbee_tbv_status_t ModbeeMpptAPI::getTrueBatteryVoltageStatus() const {
+  portENTER_CRITICAL(&_tbvMux);
+  modbee_tbv_status_t copy = _tbv_status;
+  portEXIT_CRITICAL(&_tbvMux);
+  return copy;
+}
+
+float ModbeeMpptAPI::extrapolateRelaxation(const float* samples, uint8_t count) {
+  if (count < MODBEE_TBV_MIN_SAMPLES) return count ? samples[count - 1] : 0.0f;
+
+  // For V(t) = OCV + A * exp(-t / tau) sampled every dt, each step is
+  // d = (r - 1) * (V - OCV) with r = exp(-dt / tau): a straight line in V.
+  // Least squares d = a + b * V over all steps averages out ADC noise;
+  // voltages are taken relative to the first sample to keep float precision
+  uint8_t steps = count - 1;
+  float sumV = 0.0f, sumD = 0.0f, sumVV = 0.0f, sumVD = 0.0f;
+  for (uint8_t k = 0; k < steps; k++) {
+    float v = samples[k] - samples[0];
+    float d = samples[k + 1] - samples[k];
+    sumV += v;
+    sumD += d;
+    sumVV += v * v;
+    sumVD += v * d;
+  }
+  float last = samples[count - 1];
+  float denominator = steps * sumVV - sumV * sumV;
+  if (denominator <= 0.0f) return last;  // Flat: already relaxed
+  float b = (steps * sumVD - sumV * sumD) / denominator;
+  float a = (sumD - b * sumV) / steps;
+  float r = 1.0f + b;
+  if (r <= 0.0f || r >= 1.0f) return last;  // Not a decay (noise or a load step)
+
+  // The tail still to come is next * (1 + r + r^2 + ...) = next / (1 - r)
+  r = min(r, MODBEE_TBV_MAX_DECAY_RATIO);
+  float next = a + b * (last - samples[0]);
+  return last + next / (1.0f - r);
+}
+
 void ModbeeMpptAPI::update() {
   // Update true battery voltage state machine
   unsigned long currentTime = millis();
@@ -514,55 +630,59 @@ void ModbeeMpptAPI::update() {
       // Nothing to do
       break;
       
-    case TBVS_DISABLE_CHARGING:
-      // Store original states and disable charging
-      //_tbv_original_charge_state = getChargeEnable();
-      _tbv_original_discharge_state = _mppt._bq25798.getForceBattDischarge();
-      //setChargeEnable(false);
-      _tbv_state = TBVS_WAIT_CHARGE_STOP;
-      _tbv_timer = currentTime;
-      break;
-      
-    case TBVS_WAIT_CHARGE_STOP:
-      if (currentTime - _tbv_timer >= 50) { // Wait 50ms
-        _tbv_state = TBVS_FORCE_DISCHARGE;
-        _tbv_timer = currentTime;
-      }
-      break;
-      
     case TBVS_FORCE_DISCHARGE:
-      // Force small discharge current
+      // Force small discharge current; faster ADC conversions for the burst
+      _tbv_original_discharge_state = _mppt._bq25798.getForceBattDischarge();
       _mppt._bq25798.setForceBattDischarge(true);
-      _tbv_state = TBVS_WAIT_STABILIZE;
+      configureADC(MODBEE_TBV_ADC_RES, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);
+      _tbv_sample_count = 0;
+      _tbv_stable = false;
+      _tbv_start = currentTime;
       _tbv_timer = currentTime;
+      _tbv_state = TBVS_SAMPLE;
       break;
       
-    case TBVS_WAIT_STABILIZE:
-      if (currentTime - _tbv_timer >= 400) { // Wait 400ms
-        _tbv_state = TBVS_READ_VOLTAGE;
-      }
-      break;
-      
-    case TBVS_READ_VOLTAGE:
-      // Read the true battery voltage
-      _tbv_last_reading = _mppt._bq25798.getADCVBAT();
-      _tbv_reading_valid = true;
-      _tbv_state = TBVS_WAIT_BEFORE_RESTORE;
+    case TBVS_SAMPLE: {
+      // First sample one sweep after the step, so it is not a conversion from before it
+      if (currentTime - _tbv_timer < MODBEE_TBV_SAMPLE_MS) break;
       _tbv_timer = currentTime;
-      break;
+      float vbat = _mppt._bq25798.getADCVBAT();
+      _tbv_samples[_tbv_sample_count++] = vbat;
       
-    case TBVS_WAIT_BEFORE_RESTORE:
-      if (currentTime - _tbv_timer >= 50) { // Wait 50ms before restoring charging
+      // Stop as soon as the relaxation has flattened out
+      if (_tbv_sample_count >= MODBEE_TBV_MIN_SAMPLES) {
+        float step = fabsf(vbat - _tbv_samples[_tbv_sample_count - 2]);
+        float stableStep = MODBEE_TBV_STABLE_MV_S / 1000.0f * _battery_cell_count * MODBEE_TBV_SAMPLE_MS / 1000.0f;
+        _tbv_stable = step <= stableStep;
+      }
+      if (_tbv_stable || _tbv_sample_count >= MODBEE_TBV_MAX_SAMPLES) {
         _tbv_state = TBVS_RESTORE;
       }
       break;
+    }
       
-    case TBVS_RESTORE:
-      // Restore original states
+    case TBVS_RESTORE: {
+      // Restore original states first, then the estimate
       _mppt._bq25798.setForceBattDischarge(_tbv_original_discharge_state);
-      //setChargeEnable(_tbv_original_charge_state);
+      configureADC(MODBEE_ADC_RES_15BIT, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);  // As applyCriticalSettings()
+      unsigned long duration = currentTime - _tbv_start;
+      
+      _tbv_last_reading = extrapolateRelaxation(_tbv_samples, _tbv_sample_count);
+      _tbv_reading_valid = true;
       _tbv_state = TBVS_IDLE;
+      
+      portENTER_CRITICAL(&_tbvMux);
+      _tbv_status.voltage = _tbv_last_reading;
+      _tbv_status.measured = _tbv_samples[_tbv_sample_count - 1];
+      _tbv_status.duration_ms = (uint16_t)min(duration, 65535UL);
+      _tbv_status.samples = _tbv_sample_count;
+      _tbv_status.stable = _tbv_stable;
+      _tbv_status.count++;
+      portEXIT_CRITICAL(&_tbvMux);
+      MODBEE_LOGD("True VBAT %.3fV (last sample %.3fV, %u samples, %lums)", _tbv_last_reading,
+                  _tbv_samples[_tbv_sample_count - 1], _tbv_sample_count, duration);
       break;
+    }
   }
 }
 
@@ -579,11 +699,11 @@ float ModbeeMpptAPI::getBatteryChargingVoltage() {
 }
 
 /*!
- * @brief Get actual battery state of charge based on full battery voltage range
+ * @brief Get actual battery state of charge from the chemistry's OCV curve
  * 
- * This SOC is calculated using the true battery voltage and the full voltage range
- * of the configured battery chemistry (e.g., 2.5V to 4.2V for Li-Ion per cell).
- * This represents the absolute battery charge state.
+ * This SOC is calculated by looking the true battery voltage up in the
+ * open-circuit voltage curve of the configured battery chemistry, corrected
+ * for the battery temperature. This represents the absolute battery charge state.
  * 
  * @return Actual battery SOC percentage (0.0 - 100.0)
  */
@@ -595,8 +715,8 @@ float ModbeeMpptAPI::getActualBatterySOC() {
 /*!
  * @brief Get usable battery state of charge based on system operating range
  * 
- * This SOC is calculated using the true battery voltage but limited to the
- * system's usable voltage range (min system voltage to charge voltage).
+ * This SOC is the charge between the OCV-curve SOCs of the minimum system
+ * voltage and the charge voltage, as a share of that span.
  * This represents the practically usable energy in the system.
  * 
  * @return Usable battery SOC percentage (0.0 - 100.0)
@@ -606,14 +726,15 @@ float ModbeeMpptAPI::getUsableBatterySOC() {
   float min_system_voltage = _mppt._bq25798.getMinSystemV();
   float charge_voltage = _mppt._bq25798.getChargeLimitV();
   
-  // Calculate SOC based on usable voltage range
-  if (true_voltage < min_system_voltage) return 0.0f;
-  if (true_voltage > charge_voltage) return 100.0f;
+  // Map both limits through the same curve so the span is in charge, not volts
+  float soc = calculateBatterySOC(true_voltage);
+  float empty_soc = calculateBatterySOC(min_system_voltage);
+  float full_soc = calculateBatterySOC(charge_voltage);
   
-  float usable_range = charge_voltage - min_system_voltage;
-  float usable_position = true_voltage - min_system_voltage;
+  float usable_range = full_soc - empty_soc;
+  if (usable_range < 0.01f) return soc >= full_soc ? 100.0f : 0.0f;
   
-  return (usable_position / usable_range) * 100.0f;
+  return clampValue((soc - empty_soc) / usable_range * 100.0f, 0.0f, 100.0f);
 }
 
 /*!
@@ -673,6 +794,10 @@ bool ModbeeMpptAPI::setTerminationCurrent(float current) {
   return _mppt._bq25798.setTerminationA(clamped);
 }
 
+bool ModbeeMpptAPI::setTerminationEnable(bool enable) {
+  return _mppt._bq25798.setTerminationEnable(enable);
+}
+
 float ModbeeMpptAPI::getRechargeThreshold() {
   return _mppt._bq25798.getRechargeThreshOffsetV();
 }
@@ -886,6 +1011,12 @@ bool ModbeeMpptAPI::getMPPTEnable() {
   return _mppt._bq25798.getMPPTenable();
 }
 
+bool ModbeeMpptAPI::sampleInputPower(modbee_power_data_t& sample) {
+  sample.valid = _mppt._bq25798.getADCInputSample(&sample.voltage, &sample.current);
+  sample.power = sample.valid ? sample.voltage * sample.current : 0.0f;
+  return sample.valid;
+}
+
 // ========================================================================
 // SYSTEM CONTROL FUNCTIONS
 // ========================================================================
@@ -1309,6 +1440,16 @@ float ModbeeMpptAPI::clampValue(float value, float min_val, float max_val) {
 }
 
 float ModbeeMpptAPI::calculateBatterySOC(float voltage) {
+  const modbee_ocv_curve_t* curve = _mppt.config.ocvCurve(_battery_type);
+  if (curve) {
+    // Temperature from the last telemetry frame; no extra ADC read
+    portENTER_CRITICAL(&_telemetryMux);
+    float temperature = _telemetry.valid ? _telemetry.battery_temperature : NAN;
+    portEXIT_CRITICAL(&_telemetryMux);
+    return ModbeeMpptOcv::socFromVoltage(*curve, voltage / _battery_cell_count, temperature) * 100.0f;
+  }
+  
+  // Custom battery without an uploaded curve: linear over its voltage range
   if (voltage < _battery_min_voltage) return 0.0f;
   if (voltage > _battery_max_voltage) return 100.0f;
   
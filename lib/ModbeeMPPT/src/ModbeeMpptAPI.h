@@ -39,6 +39,15 @@ class ModbeeMPPT;
 #define MODBEE_LEAD_ACID_MIN_VOLTAGE  1.8f     // Lead acid minimum cell voltage
 #define MODBEE_LEAD_ACID_MAX_VOLTAGE  2.4f     // Lead acid maximum cell voltage
 
+// True battery voltage burst: VBAT is sampled while the discharge is forced
+// until it stops relaxing, then the remaining decay is extrapolated
+#define MODBEE_TBV_ADC_RES            MODBEE_ADC_RES_13BIT  // ~6 ms per channel while sampling
+#define MODBEE_TBV_SAMPLE_MS          70       // VBAT sample period: one ADC sweep at 13 bit (11 channels, ~66 ms)
+#define MODBEE_TBV_MIN_SAMPLES        3        // Needed for the exponential fit
+#define MODBEE_TBV_MAX_SAMPLES        8        // Time limit: 560 ms after the first sample
+#define MODBEE_TBV_STABLE_MV_S        25.0f    // Stable below this |dV/dt| per cell (mV/s)
+#define MODBEE_TBV_MAX_DECAY_RATIO    0.8f     // Caps the extrapolated tail at 5x the next step
+
 // Battery chemistry types
 typedef enum {
   MODBEE_BATTERY_LIFEPO4 = 0,
@@ -120,6 +129,21 @@ typedef enum {
   MODBEE_VOC_RATE_30MIN = 3        // 30 minute measurement rate
 } modbee_voc_rate_t;
 
+// MPPT algorithm selection
+typedef enum {
+  MODBEE_MPPT_MODE_VOC = 0,        // BQ25798 fractional-VOC sampling (default)
+  MODBEE_MPPT_MODE_PO = 1          // Firmware perturb & observe driving VINDPM
+} modbee_mppt_mode_t;
+
+// VAC1/VAC2 input selection policy (see ModbeeMpptSourceArbiter)
+typedef enum {
+  MODBEE_SOURCE_POLICY_OFF = 0,          // ACDRV left to the chip (default)
+  MODBEE_SOURCE_POLICY_PREFER_SOLAR = 1, // Primary input while it delivers power
+  MODBEE_SOURCE_POLICY_MAX_POWER = 2,    // Whichever input delivers more power
+  MODBEE_SOURCE_POLICY_CHEAPEST = 3,     // Lowest configured cost per kWh
+  MODBEE_SOURCE_POLICY_FAILOVER = 4      // Primary input, the other only while it is lost
+} modbee_source_policy_t;
+
 // Power measurement structure
 typedef struct {
   float voltage;      // Voltage (V)
@@ -151,6 +175,33 @@ typedef enum {
   MODBEE_CHARGE_DONE = 7
 } modbee_charge_state_t;
 
+// Telemetry frame captured once per stats update (see ModbeeMpptAPI::updateStats)
+typedef struct {
+  uint32_t sequence;                  // Incremented on every capture
+  unsigned long timestamp_ms;         // millis() at capture
+  modbee_power_data_t vbus;           // VBUS input
+  modbee_power_data_t battery;        // Battery (positive current = charging)
+  modbee_power_data_t system;         // VSYS (current derived from power balance)
+  modbee_power_data_t vac1;           // VAC1 input
+  modbee_power_data_t vac2;           // VAC2 input
+  float die_temperature;              // BQ25798 die temperature (°C)
+  float battery_temperature;          // Battery NTC temperature (°C)
+  modbee_charge_state_t charge_state; // Charge state at capture
+  uint8_t fault_status0;              // Raw FAULT_Status_0 register
+  uint8_t fault_status1;              // Raw FAULT_Status_1 register
+  bool valid;                         // False until the first capture
+} modbee_telemetry_t;
+
+// Last true battery voltage measurement
+typedef struct {
+  float voltage;                      // Open-circuit voltage, extrapolated (V)
+  float measured;                     // Last VBAT sample (V)
+  uint16_t duration_ms;               // Time the battery discharge was forced
+  uint8_t samples;                    // VBAT samples taken
+  bool stable;                        // Ended on dV/dt rather than the time limit
+  uint32_t count;                     // Measurements since boot
+} modbee_tbv_status_t;
+
 // VBUS status enumeration (Status 1 bits 4:1)
 typedef enum {
   MODBEE_VBUS_NO_INPUT = 0x0,
@@ -297,6 +348,15 @@ public:
   // Stats update function
   void updateStats();
 
+  /*!
+   * @brief Get the telemetry frame captured by the last updateStats() call
+   *
+   * Safe to call from the web server task; never touches the I2C bus.
+   *
+   * @return Copy of the cached telemetry frame
+   */
+  modbee_telemetry_t getTelemetry() const;
+
   // Constructor - takes reference to existing ModbeeMPPT instance
   ModbeeMpptAPI(ModbeeMPPT& mppt);
   
@@ -338,6 +398,21 @@ public:
    */
   modbee_power_data_t getVAC2Power();
   
+  /*!
+   * @brief Tell the power split which input's ACFET is on
+   *
+   * With an input selected, all of IBUS is attributed to it and the other
+   * input reports its voltage only. 0 (default) splits IBUS by voltage.
+   *
+   * @param source 0 = unknown, 1 = VAC1, 2 = VAC2
+   */
+  void setActiveInput(uint8_t source) { _activeInput = source; }
+  
+  /*!
+   * @brief Input set by setActiveInput() (0 = unknown)
+   */
+  uint8_t getActiveInput() const { return _activeInput; }
+  
   /*!
    * @brief Get overall system efficiency (output power / input power)
    * @return Efficiency as percentage (0.0 - 100.0)
@@ -421,13 +496,40 @@ public:
    * @brief Update true battery voltage measurement (start measurement process)
    * 
    * This function initiates the true battery voltage measurement process if one
-   * is not already in progress. The measurement temporarily disables charging 
-   * and forces a small discharge current to measure the true no-load battery voltage.
+   * is not already in progress. The measurement forces a small discharge current
+   * and samples VBAT until the relaxation settles, then extrapolates the rest of
+   * the decay to estimate the true no-load battery voltage.
    * 
-   * This is typically called from the main loop every 10 seconds to keep
-   * the true battery voltage reading fresh.
+   * This is called from the main loop every soc_check_interval while charging,
+   * unless the SOC estimator is confident enough not to need it.
    */
   void updateTrueBatteryVoltage();
+  
+  /*!
+   * @brief True while a true battery voltage measurement is in progress
+   * 
+   * It forces battery discharge and runs the ADC at MODBEE_TBV_ADC_RES
+   * until it restores both.
+   */
+  bool isTrueBatteryVoltageBusy() const { return _tbv_state != TBVS_IDLE; }
+  
+  /*!
+   * @brief Details of the last true battery voltage measurement
+   */
+  modbee_tbv_status_t getTrueBatteryVoltageStatus() const;
+  
+  /*!
+   * @brief Open-circuit voltage from a relaxing voltage
+   * 
+   * Fits a decaying exponential to the equally spaced samples (least squares
+   * on step size vs voltage) and returns its asymptote. Samples that do not
+   * look like a decay return the last sample.
+   * 
+   * @param samples VBAT samples, oldest first, equally spaced in time
+   * @param count Number of samples
+   * @return Estimated open-circuit voltage (V)
+   */
+  static float extrapolateRelaxation(const float* samples, uint8_t count);
 
    /*!
    * @brief Get true battery voltage (non-blocking)
@@ -458,11 +560,11 @@ public:
   float getBatteryChargingVoltage();
   
   /*!
-   * @brief Get actual battery state of charge based on full battery voltage range
+   * @brief Get actual battery state of charge from the chemistry's OCV curve
    * 
-   * This SOC is calculated using the true battery voltage and the full voltage range
-   * of the configured battery chemistry (e.g., 2.5V to 4.2V for Li-Ion per cell).
-   * This represents the absolute battery charge state.
+   * This SOC is calculated by looking the true battery voltage up in the
+   * open-circuit voltage curve of the configured battery chemistry (ModbeeMpptOcv),
+   * corrected for the battery temperature. This represents the absolute battery charge state.
    * 
    * @return Actual battery SOC percentage (0.0 - 100.0)
    */
@@ -471,8 +573,8 @@ public:
   /*!
    * @brief Get usable battery state of charge based on system operating range
    * 
-   * This SOC is calculated using the true battery voltage but limited to the
-   * system's usable voltage range (min system voltage to charge voltage).
+   * This SOC is the charge between the OCV-curve SOCs of the minimum system
+   * voltage and the charge voltage, as a share of that span.
    * This represents the practically usable energy in the system.
    * 
    * @return Usable battery SOC percentage (0.0 - 100.0)
@@ -536,6 +638,13 @@ public:
    */
   bool setTerminationCurrent(float current);
   
+  /*!
+   * @brief Enable or disable charge termination (EN_TERM)
+   * @param enable False keeps the charger in CV at the charge voltage (float)
+   * @return True if successful
+   */
+  bool setTerminationEnable(bool enable);
+  
   /*!
    * @brief Get recharge threshold voltage offset (VRECHG)
    * @return Recharge threshold offset in volts (below charge voltage)
@@ -921,6 +1030,13 @@ public:
    */
   bool getMPPTEnable();
   
+  /*!
+   * @brief Read VBUS and IBUS as one pair (single burst I2C read)
+   * @param sample Receives voltage, current and power; valid is false on bus error
+   * @return True if successful
+   */
+  bool sampleInputPower(modbee_power_data_t& sample);
+  
   // ========================================================================
   // SYSTEM CONTROL FUNCTIONS
   // ========================================================================
@@ -1313,21 +1429,23 @@ private:
   // True battery voltage state machine
   enum TrueBatteryVoltageState {
     TBVS_IDLE,
-    TBVS_DISABLE_CHARGING,
-    TBVS_WAIT_CHARGE_STOP,
     TBVS_FORCE_DISCHARGE,
-    TBVS_WAIT_STABILIZE,
-    TBVS_READ_VOLTAGE,
-    TBVS_WAIT_BEFORE_RESTORE,
+    TBVS_SAMPLE,
     TBVS_RESTORE
   };
   
   TrueBatteryVoltageState _tbv_state;
   unsigned long _tbv_timer;
+  unsigned long _tbv_start;
   bool _tbv_original_charge_state;
   bool _tbv_original_discharge_state;
   float _tbv_last_reading;
   bool _tbv_reading_valid;
+  float _tbv_samples[MODBEE_TBV_MAX_SAMPLES];
+  uint8_t _tbv_sample_count;
+  bool _tbv_stable;
+  modbee_tbv_status_t _tbv_status = {};
+  mutable portMUX_TYPE _tbvMux = portMUX_INITIALIZER_UNLOCKED;
   
   // Stats tracking
   float _vin1PeakPower = 0, _vin1TotalEnergyWh = 0;
@@ -1336,8 +1454,14 @@ private:
   float _batteryPeakPower = 0, _batteryTotalEnergyWh = 0;
   float _systemPeakPower = 0, _systemTotalEnergyWh = 0;
   unsigned long _lastStatsUpdateMs = 0;
+  volatile uint8_t _activeInput = 0;   // Input whose ACFET is on, 0 = unknown
+
+  // Cached telemetry frame (written by loop task, read by web server task)
+  modbee_telemetry_t _telemetry = {};
+  mutable portMUX_TYPE _telemetryMux = portMUX_INITIALIZER_UNLOCKED;
   
   // Helper functions
+  void captureTelemetry();
   float clampValue(float value, float min_val, float max_val);
   float calculateBatterySOC(float voltage);
 };
@@ -0,0 +1,145 @@
+/*!
+ * @file ModbeeMpptBeacon.h
+ *
+ * @brief Bit layout of the BLE beacon (bleMode beacon) manufacturer data
+ *
+ * In beacon mode the unit does not accept connections; it broadcasts its
+ * key values in the manufacturer-specific data of a non-connectable
+ * advertisement: the company ID (little-endian), then the fields of FIELDS
+ * packed back to back, least significant bit first, each quantised to
+ * value = raw * step + offset (signed fields two's complement).
+ *
+ * The schema is constexpr and free of Arduino dependencies so the firmware
+ * (ModbeeMpptBleCodec::packBeacon) and the host decoder
+ * (tools/beacondecode) share this one definition. Fields are only ever
+ * appended; a change to an existing field bumps VERSION.
+ */
+
+#ifndef MODBEE_MPPT_BEACON_H
+#define MODBEE_MPPT_BEACON_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ModbeeMpptBeacon {
+
+constexpr uint16_t COMPANY_ID = 0xFFFF;    // Bluetooth SIG ID reserved for testing
+constexpr uint8_t VERSION = 1;
+
+struct Field {
+  const char* name;
+  const char* unit;
+  uint8_t bits;
+  bool isSigned;
+  float step;                              // Value of one LSB
+  float offset;                            // Value of raw 0
+};
+
+typedef enum {
+  FIELD_VERSION,
+  FIELD_SEQUENCE,
+  FIELD_VBAT,
+  FIELD_IBAT,
+  FIELD_VBUS,
+  FIELD_SOC,
+  FIELD_CHARGE_STATE,
+  FIELD_FAULTS,
+  FIELD_TODAY_WH,
+  FIELD_DIE_TEMP,
+  FIELD_BAT_TEMP,
+  FIELD_FLAGS,
+  FIELD_COUNT
+} FieldId;
+
+constexpr Field FIELDS[] = {
+  {"version", "", 4, false, 1.0f, 0.0f},
+  {"sequence", "", 8, false, 1.0f, 0.0f},       // Burst counter, for duplicate scans
+  {"vbat", "V", 11, false, 0.01f, 0.0f},        // 0 to 20.47 V
+  {"ibat", "A", 12, true, 0.01f, 0.0f},         // -20.48 to 20.47 A, positive = charging
+  {"vbus", "V", 11, false, 0.02f, 0.0f},        // 0 to 40.94 V
+  {"soc", "%", 10, false, 0.1f, 0.0f},          // 0 to 102.3 %
+  {"chargeState", "", 3, false, 1.0f, 0.0f},    // modbee_charge_state_t
+  {"faults", "", 16, false, 1.0f, 0.0f},        // FAULT_Status_0 << 8 | FAULT_Status_1
+  {"todayWh", "Wh", 18, false, 0.1f, 0.0f},     // 0 to 26214.3 Wh harvested today
+  {"dieTemp", "C", 8, false, 1.0f, -64.0f},     // -64 to 191 C
+  {"batTemp", "C", 8, false, 1.0f, -64.0f},
+  {"flags", "", 3, false, 1.0f, 0.0f}           // MODBEE_BLE_FLAG_*
+};
+
+static_assert(sizeof(FIELDS) / sizeof(FIELDS[0]) == FIELD_COUNT, "One FIELDS entry per FieldId");
+
+/*!
+ * @brief Bits ahead of a field (or all bits, for FIELD_COUNT)
+ */
+constexpr unsigned bitOffset(size_t index) {
+  return index == 0 ? 0 : bitOffset(index - 1) + FIELDS[index - 1].bits;
+}
+
+constexpr size_t PAYLOAD_BYTES = (bitOffset(FIELD_COUNT) + 7) / 8;
+constexpr size_t MANUFACTURER_BYTES = 2 + PAYLOAD_BYTES;   // Company ID and payload
+
+// Flags AD structure (3 bytes) and manufacturer AD header (2 bytes) share
+// the 31-byte legacy advertising payload with the manufacturer data
+static_assert(3 + 2 + MANUFACTURER_BYTES <= 31, "Beacon must fit a legacy advertisement");
+
+/*!
+ * @brief Raw field value of a reading, saturated to the field range
+ */
+inline uint32_t quantize(FieldId id, float value) {
+  const Field& f = FIELDS[id];
+  long raw = lroundf((value - f.offset) / f.step);
+  long lo = f.isSigned ? -(1L << (f.bits - 1)) : 0;
+  long hi = f.isSigned ? (1L << (f.bits - 1)) - 1 : (1L << f.bits) - 1;
+  if (isnan(value) || raw < lo) raw = lo;
+  if (raw > hi) raw = hi;
+  return (uint32_t)raw & ((1UL << f.bits) - 1);
+}
+
+/*!
+ * @brief Reading of a raw field value
+ */
+inline float dequantize(FieldId id, uint32_t raw) {
+  const Field& f = FIELDS[id];
+  long value = (long)raw;
+  if (f.isSigned && (raw & (1UL << (f.bits - 1)))) value -= 1L << f.bits;
+  return value * f.step + f.offset;
+}
+
+/*!
+ * @brief Write a raw field value into the payload (PAYLOAD_BYTES, zeroed first)
+ */
+inline void put(uint8_t* payload, FieldId id, uint32_t raw) {
+  unsigned offset = bitOffset(id);
+  for (unsigned i = 0; i < FIELDS[id].bits; i++, offset++) {
+    if (raw & (1UL << i)) payload[offset / 8] |= (uint8_t)(1 << (offset % 8));
+  }
+}
+
+/*!
+ * @brief Read a raw field value from the payload
+ */
+inline uint32_t get(const uint8_t* payload, FieldId id) {
+  unsigned offset = bitOffset(id);
+  uint32_t raw = 0;
+  for (unsigned i = 0; i < FIELDS[id].bits; i++, offset++) {
+    if (payload[offset / 8] & (1 << (offset % 8))) raw |= 1UL << i;
+  }
+  return raw;
+}
+
+/*!
+ * @brief Decode manufacturer data (company ID first) into FIELD_COUNT readings
+ * @return False for another company ID, a short payload or another version
+ */
+inline bool decode(const uint8_t* data, size_t length, float* values) {
+  if (length < MANUFACTURER_BYTES || (uint16_t)(data[0] | data[1] << 8) != COMPANY_ID) return false;
+  const uint8_t* payload = data + 2;
+  if (get(payload, FIELD_VERSION) != VERSION) return false;
+  for (size_t i = 0; i < FIELD_COUNT; i++) values[i] = dequantize((FieldId)i, get(payload, (FieldId)i));
+  return true;
+}
+
+} // namespace ModbeeMpptBeacon
+
+#endif // MODBEE_MPPT_BEACON_H
@@ -0,0 +1,575 @@
+/*!
+ * @file ModbeeMpptBle.cpp
+ *
+ * @brief Implementation of the BLE GATT service
+ */
+
+#include "ModbeeMpptBle.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include <memory>
+
+static_assert(MODBEE_BLE_BEACON_PERIOD_MS + 1000 <= MODBEE_DAILY_GAP_MS,
+              "A beacon sleep must not break the daily energy integration");
+
+// The core's BLE library takes std::string before 3.0 and String from 3.0
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+typedef String BleBytes;
+#else
+typedef std::string BleBytes;
+#endif
+
+ModbeeMpptBle::ModbeeMpptBle(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _serverCallbacks(*this),
+  _configCallbacks(*this, false),
+  _historyCallbacks(*this, true),
+  _server(nullptr),
+  _telemetry(nullptr),
+  _config(nullptr),
+  _history(nullptr),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _running(false),
+  _connected(false),
+  _connId(0),
+  _lastTelemetrySequence(0),
+  _passkeyKnown(false),
+  _securityDue(false),
+  _bondsStale(false),
+  _beacon(false),
+  _advertising(false),
+  _burstDue(false),
+  _burstStart(0),
+  _beaconSequence(0),
+  _beaconWindow(false),
+  _windowStart(0),
+  _windowSleepStart(0),
+  _chunkLength(0),
+  _indicateFailures(0),
+  _indicated(false),
+  _eventConnected(false),
+  _eventDisconnected(false),
+  _eventConnId(0),
+  _eventMtu(0)
+{
+  memset(&_status, 0, sizeof(_status));
+  memset(&_counters, 0, sizeof(_counters));
+  memset(_peer, 0, sizeof(_peer));
+  memset(_passkey, 0, sizeof(_passkey));
+  memset(_eventPeer, 0, sizeof(_eventPeer));
+  memset(&_configRequest, 0, sizeof(_configRequest));
+  memset(&_historyRequest, 0, sizeof(_historyRequest));
+  memset(_beaconData, 0, sizeof(_beaconData));
+  _counters.mtu = MODBEE_BLE_ATT_MTU_DEFAULT;
+  _status = _counters;
+}
+
+// ========================================================================
+// BLUEDROID CALLBACKS
+// ========================================================================
+
+void ModbeeMpptBle::ServerCallbacks::onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+  (void)server;
+  portENTER_CRITICAL(&_ble._mux);
+  _ble._eventConnected = true;
+  _ble._eventConnId = param->connect.conn_id;
+  memcpy(_ble._eventPeer, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+  _ble._eventMtu = MODBEE_BLE_ATT_MTU_DEFAULT;
+  portEXIT_CRITICAL(&_ble._mux);
+}
+
+void ModbeeMpptBle::ServerCallbacks::onDisconnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+  (void)server;
+  (void)param;
+  portENTER_CRITICAL(&_ble._mux);
+  _ble._eventDisconnected = true;
+  portEXIT_CRITICAL(&_ble._mux);
+}
+
+void ModbeeMpptBle::ServerCallbacks::onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+  (void)server;
+  portENTER_CRITICAL(&_ble._mux);
+  _ble._eventMtu = param->mtu.mtu;
+  portEXIT_CRITICAL(&_ble._mux);
+}
+
+void ModbeeMpptBle::RequestCallbacks::onWrite(BLECharacteristic* characteristic, esp_ble_gatts_cb_param_t* param) {
+  (void)characteristic;
+  Request& request = _history ? _ble._historyRequest : _ble._configRequest;
+  size_t length = min((size_t)param->write.len, sizeof(request.data));
+  portENTER_CRITICAL(&_ble._mux);
+  memcpy(request.data, param->write.value, length);
+  // An overlong write is kept one byte too long, so the codec rejects it
+  request.length = param->write.len > sizeof(request.data) ? sizeof(request.data) + 1 : length;
+  request.pending = true;
+  portEXIT_CRITICAL(&_ble._mux);
+}
+
+void ModbeeMpptBle::RequestCallbacks::onStatus(BLECharacteristic* characteristic, Status status, uint32_t code) {
+  (void)characteristic;
+  (void)code;
+  // Called from indicate() on the main loop once the client confirmed or it failed
+  if (_history) _ble._indicated = status == SUCCESS_INDICATE;
+}
+
+// ========================================================================
+// START AND STOP
+// ========================================================================
+
+bool ModbeeMpptBle::setup() {
+  BLEDevice::init(MODBEE_BLE_DEVICE_NAME);
+  BLEDevice::setMTU(MODBEE_BLE_MTU);
+  _server = BLEDevice::createServer();
+  if (!_server) return false;
+  _server->setCallbacks(&_serverCallbacks);
+
+  BLEService* service = _server->createService(MODBEE_BLE_SERVICE_UUID);
+  _telemetry = service->createCharacteristic(MODBEE_BLE_TELEMETRY_UUID,
+                                             BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+  _telemetry->addDescriptor(new BLE2902());
+  _config = service->createCharacteristic(MODBEE_BLE_CONFIG_UUID,
+                                          BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+                                          BLECharacteristic::PROPERTY_NOTIFY);
+  // Settings only for a client that paired with the passkey
+  _config->setAccessPermissions(ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM);
+  _config->addDescriptor(new BLE2902());
+  _config->setCallbacks(&_configCallbacks);
+  _history = service->createCharacteristic(MODBEE_BLE_HISTORY_UUID,
+                                           BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_INDICATE);
+  _history->addDescriptor(new BLE2902());
+  _history->setCallbacks(&_historyCallbacks);
+  service->start();
+  return true;
+}
+
+void ModbeeMpptBle::advertiseService() {
+  // Set in full every time, the beacon replaces the advertisement
+  BLEAdvertisementData data;
+  data.setFlags(ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
+  data.setCompleteServices(BLEUUID(MODBEE_BLE_SERVICE_UUID));
+  BLEAdvertisementData scanResponse;
+  scanResponse.setName(MODBEE_BLE_DEVICE_NAME);
+
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  advertising->setAdvertisementType(ADV_TYPE_IND);
+  advertising->setAdvertisementData(data);
+  advertising->setScanResponseData(scanResponse);
+  advertising->setMinInterval(MODBEE_BLE_ADV_INTERVAL);
+  advertising->setMaxInterval(MODBEE_BLE_ADV_INTERVAL);
+  BLEDevice::startAdvertising();
+}
+
+bool ModbeeMpptBle::start() {
+  bool beacon = _mppt.config.data.ble_mode == MODBEE_BLE_BEACON;
+  if (_running && _beacon == beacon) return true;
+  if (_running) stop();
+  if (!_server && !setup()) {
+    MODBEE_LOGE("BLE stack failed to start");
+    return false;
+  }
+  checkPasskey();
+  applySecurity();
+  _beacon = beacon;
+  _running = true;
+  _counters.running = true;
+  _counters.beacon = beacon;
+  if (beacon) {
+    // Started again after every light sleep, with a burst straight away
+    _burstDue = true;
+    if (!_beaconWindow) {
+      _beaconWindow = true;
+      _windowStart = millis();
+      _windowSleepStart = _mppt.powerSave.getSleepMs();
+      _counters.beaconBursts = 0;
+      _counters.beaconAwakeMs = 0;
+      _counters.beaconSleepMs = 0;
+      _counters.beaconCurrentMa = 0;
+      MODBEE_LOGI("BLE beacon every %u ms", (unsigned)MODBEE_BLE_BEACON_PERIOD_MS);
+    }
+  } else {
+    _beaconWindow = false;
+    advertiseService();
+    MODBEE_LOGI("BLE advertising as %s", MODBEE_BLE_DEVICE_NAME);
+  }
+  updateStatus();
+  return true;
+}
+
+void ModbeeMpptBle::stop() {
+  if (!_running) return;
+  BLEDevice::stopAdvertising();
+  if (_connected) _server->disconnect(_connId);
+  if (_chunker.active() || _chunkLength) endDownload(true);
+  _running = false;
+  _connected = false;
+  _advertising = false;
+  _counters.running = false;
+  _counters.connected = false;
+  // A beacon stopped for a light sleep keeps its accounting and stays quiet
+  if (_beacon && _mppt.config.data.ble_mode == MODBEE_BLE_BEACON) {
+    updateStatus();
+    return;
+  }
+  _beaconWindow = false;
+  updateStatus();
+  MODBEE_LOGI("BLE stopped");
+}
+
+// ========================================================================
+// MAIN LOOP
+// ========================================================================
+
+void ModbeeMpptBle::loop() {
+  checkPasskey();
+  if (!_running) return;
+  applySecurity();
+  if (_beacon) {
+    beaconLoop();
+    updateStatus();
+    return;
+  }
+  handleEvents();
+  if (!_running) return;
+
+  // Requests written since the last pass
+  Request config;
+  Request history;
+  portENTER_CRITICAL(&_mux);
+  config = _configRequest;
+  history = _historyRequest;
+  _configRequest.pending = false;
+  _historyRequest.pending = false;
+  portEXIT_CRITICAL(&_mux);
+  if (config.pending) answerConfig(config.data, config.length);
+  if (history.pending) startDownload(history.data, history.length);
+
+  notifyTelemetry();
+  if (_connected && (_chunker.active() || _chunkLength)) sendChunk();
+  updateStatus();
+}
+
+void ModbeeMpptBle::handleEvents() {
+  portENTER_CRITICAL(&_mux);
+  bool connected = _eventConnected;
+  bool disconnected = _eventDisconnected;
+  uint16_t connId = _eventConnId;
+  esp_bd_addr_t peer;
+  memcpy(peer, _eventPeer, sizeof(peer));
+  uint16_t mtu = _eventMtu;
+  _eventConnected = false;
+  _eventDisconnected = false;
+  portEXIT_CRITICAL(&_mux);
+
+  if (disconnected && _connected) {
+    _connected = false;
+    _counters.connected = false;
+    if (_chunker.active() || _chunkLength) endDownload(true);
+    // Bluedroid stops advertising when a client connects
+    BLEDevice::startAdvertising();
+    MODBEE_LOGI("BLE client disconnected");
+  }
+  if (connected) {
+    _connected = true;
+    _connId = connId;
+    memcpy(_peer, peer, sizeof(_peer));
+    _counters.connected = true;
+    _counters.connections++;
+    setFastConnection(false);
+    MODBEE_LOGI("BLE client %02x:%02x:%02x:%02x:%02x:%02x connected", peer[0], peer[1], peer[2], peer[3],
+                peer[4], peer[5]);
+  }
+  if (mtu) _counters.mtu = min(mtu, (uint16_t)MODBEE_BLE_MTU);
+}
+
+void ModbeeMpptBle::setFastConnection(bool fast) {
+  if (!_connected) return;
+  if (fast) {
+    _server->updateConnParams(_peer, MODBEE_BLE_FAST_INTERVAL_MIN, MODBEE_BLE_FAST_INTERVAL_MAX, 0,
+                              MODBEE_BLE_FAST_TIMEOUT);
+  } else {
+    _server->updateConnParams(_peer, MODBEE_BLE_IDLE_INTERVAL_MIN, MODBEE_BLE_IDLE_INTERVAL_MAX,
+                              MODBEE_BLE_IDLE_LATENCY, MODBEE_BLE_IDLE_TIMEOUT);
+  }
+}
+
+void ModbeeMpptBle::notifyTelemetry() {
+  modbee_telemetry_t t = _mppt.api.getTelemetry();
+  if (!t.valid || t.sequence == _lastTelemetrySequence) return;
+  _lastTelemetrySequence = t.sequence;
+
+  // Kept current for reads even with nobody subscribed
+  ModbeeMpptBleTelemetry record;
+  ModbeeMpptBleCodec::packTelemetry(t, _mppt._cachedSOC,
+                                    _mppt.powerSave.isSaving() ? MODBEE_BLE_FLAG_POWER_SAVE : 0, record);
+  _telemetry->setValue((uint8_t*)&record, sizeof(record));
+  if (!_connected) return;
+  _telemetry->notify();
+  _counters.notifications++;
+}
+
+// ========================================================================
+// BEACON
+// ========================================================================
+
+void ModbeeMpptBle::beaconLoop() {
+  unsigned long now = millis();
+  if (_advertising) {
+    if (now - _burstStart < MODBEE_BLE_BEACON_BURST_MS) return;
+    BLEDevice::stopAdvertising();
+    _advertising = false;
+    updateEstimate();
+    return;
+  }
+  if (_burstDue || now - _burstStart >= MODBEE_BLE_BEACON_PERIOD_MS) startBurst();
+}
+
+void ModbeeMpptBle::startBurst() {
+  // The frame captured on this pass, after a light sleep too: the stats
+  // block runs ahead of loop(). Nothing goes out before the first frame.
+  modbee_telemetry_t t = _mppt.api.getTelemetry();
+  if (!t.valid) return;
+  size_t length = ModbeeMpptBleCodec::packBeacon(t, _mppt._cachedSOC,
+                                                 _mppt.daily.today().inputWh, _beaconSequence++,
+                                                 _mppt.powerSave.isSaving() ? MODBEE_BLE_FLAG_POWER_SAVE : 0,
+                                                 _beaconData);
+  BLEAdvertisementData data;
+  data.setFlags(ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
+  data.setManufacturerData(BleBytes((const char*)_beaconData, length));
+
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  advertising->setAdvertisementType(ADV_TYPE_NONCONN_IND);
+  advertising->setAdvertisementData(data);
+  advertising->setMinInterval(MODBEE_BLE_BEACON_INTERVAL);
+  advertising->setMaxInterval(MODBEE_BLE_BEACON_INTERVAL);
+  BLEDevice::startAdvertising();
+  _advertising = true;
+  _burstDue = false;
+  _burstStart = millis();
+  _counters.beaconBursts++;
+}
+
+uint32_t ModbeeMpptBle::beaconIdleMs() const {
+  if (!_running || !_beacon || _advertising || _burstDue) return 0;
+  unsigned long elapsed = millis() - _burstStart;
+  return elapsed >= MODBEE_BLE_BEACON_PERIOD_MS ? 0 : MODBEE_BLE_BEACON_PERIOD_MS - elapsed;
+}
+
+void ModbeeMpptBle::updateEstimate() {
+  // mA * ms = uC; advertising events are counted on top of the awake current
+  uint32_t elapsed = millis() - _windowStart;
+  uint32_t slept = _mppt.powerSave.getSleepMs() - _windowSleepStart;
+  if (!elapsed) return;
+  uint32_t awake = elapsed > slept ? elapsed - slept : 0;
+  const float eventsPerBurst = MODBEE_BLE_BEACON_BURST_MS / (MODBEE_BLE_BEACON_INTERVAL * 0.625f) + 1;
+  float charge = awake * MODBEE_BLE_AWAKE_MA + slept * MODBEE_BLE_SLEEP_MA +
+                 _counters.beaconBursts * eventsPerBurst * MODBEE_BLE_ADV_EVENT_UC;
+  _counters.beaconAwakeMs = awake;
+  _counters.beaconSleepMs = slept;
+  _counters.beaconCurrentMa = charge / elapsed;
+}
+
+// ========================================================================
+// PAIRING
+// ========================================================================
+
+void ModbeeMpptBle::checkPasskey() {
+  // Also while stopped, so a change before the next start() still counts
+  const char* passkey = _mppt.config.data.ble_passkey;
+  if (_passkeyKnown && strcmp(passkey, _passkey) == 0) return;
+  if (_passkeyKnown) _bondsStale = true;
+  size_t length = strnlen(passkey, sizeof(_passkey) - 1);
+  memcpy(_passkey, passkey, length);
+  _passkey[length] = '\0';
+  _passkeyKnown = true;
+  _securityDue = true;
+}
+
+void ModbeeMpptBle::applySecurity() {
+  if (!_securityDue || !_server) return;
+  _securityDue = false;
+
+  // The unit has no display, so the passkey it would show is fixed and the
+  // phone asks for it; without one only Just Works pairing is possible,
+  // which the config characteristic refuses
+  BLESecurity security;
+  if (_passkey[0]) {
+    security.setStaticPIN((uint32_t)strtoul(_passkey, nullptr, 10));
+    security.setAuthenticationMode(ESP_LE_AUTH_REQ_SC_MITM_BOND);
+  } else {
+    security.setCapability(ESP_IO_CAP_NONE);
+    security.setAuthenticationMode(ESP_LE_AUTH_REQ_SC_BOND);
+  }
+  if (!_bondsStale) return;
+  _bondsStale = false;
+
+  // A phone bonded with the old passkey keeps its keys otherwise
+  int count = esp_ble_get_bond_device_num();
+  if (count > 0) {
+    std::unique_ptr<esp_ble_bond_dev_t[]> bonds(new esp_ble_bond_dev_t[count]);
+    if (esp_ble_get_bond_device_list(&count, bonds.get()) == ESP_OK) {
+      for (int i = 0; i < count; i++) esp_ble_remove_bond_device(bonds[i].bd_addr);
+    }
+  }
+  if (_connected) _server->disconnect(_connId);
+  MODBEE_LOGI("BLE passkey changed, %d bonds removed", count);
+}
+
+// ========================================================================
+// CONFIG
+// ========================================================================
+
+void ModbeeMpptBle::answerConfig(const uint8_t* data, size_t length) {
+  size_t fieldCount;
+  const ModbeeMpptConfigField* fields = ModbeeMpptConfig::getFields(fieldCount);
+  modbee_ble_config_request_t request;
+  ModbeeMpptBleConfigResponse response;
+  memset(&response, 0, sizeof(response));
+  response.op = length > 0 ? data[0] : 0;
+  response.index = length > 1 ? data[1] : 0;
+
+  if (!ModbeeMpptBleCodec::parseConfigRequest(data, length, request)) {
+    response.status = MODBEE_BLE_CONFIG_BAD_REQUEST;
+  } else if (request.index >= fieldCount) {
+    response.status = MODBEE_BLE_CONFIG_BAD_INDEX;
+  } else {
+    // Only a bonded client gets here: the stack refuses the write otherwise
+    if (request.op == MODBEE_BLE_CONFIG_WRITE) response.status = writeField(request.index, request.value);
+    response.type = fields[request.index].type;
+    response.value = ModbeeMpptBleCodec::encodeConfigValue(_mppt.config.getFieldValue(request.index),
+                                                           fields[request.index].type);
+  }
+
+  _counters.configRequests++;
+  if (response.status != MODBEE_BLE_CONFIG_OK) _counters.configErrors++;
+  _config->setValue((uint8_t*)&response, sizeof(response));
+  if (_connected) _config->notify();
+}
+
+uint8_t ModbeeMpptBle::writeField(size_t index, int32_t value) {
+  size_t fieldCount;
+  const ModbeeMpptConfigField& field = ModbeeMpptConfig::getFields(fieldCount)[index];
+
+  // Same path as the web UI and Modbus: validated, saved, applied on the main loop
+  JsonDocument doc;
+  JsonObject patch = doc["patch"].to<JsonObject>();
+  switch (field.type) {
+    case MODBEE_CONFIG_FLOAT:
+      patch[field.key] = ModbeeMpptBleCodec::decodeConfigValue(value, field.type);
+      break;
+    case MODBEE_CONFIG_BOOL:
+      if (value != 0 && value != 1) return MODBEE_BLE_CONFIG_BAD_VALUE;
+      patch[field.key] = value == 1;
+      break;
+    default:
+      patch[field.key] = (long)value;
+      break;
+  }
+
+  JsonObject errors = doc["errors"].to<JsonObject>();
+  JsonArray changed = doc["changed"].to<JsonArray>();
+  if (_mppt.config.applyPatch(patch, errors, changed)) return MODBEE_BLE_CONFIG_OK;
+  return errors["_"].isNull() ? MODBEE_BLE_CONFIG_BAD_VALUE : MODBEE_BLE_CONFIG_SAVE_FAILED;
+}
+
+// ========================================================================
+// HISTORY DOWNLOAD
+// ========================================================================
+
+void ModbeeMpptBle::startDownload(const uint8_t* data, size_t length) {
+  bool downloading = _chunker.active() || _chunkLength;
+  uint32_t from;
+  uint32_t to;
+  if (!ModbeeMpptBleCodec::parseHistoryRequest(data, length, from, to)) {
+    if (downloading) endDownload(true);
+    return;
+  }
+  if (downloading) endDownload(true);
+
+  // The stream lives in the source until the last chunk has been taken
+  std::shared_ptr<ModbeeMpptHistoryStream> stream =
+      std::make_shared<ModbeeMpptHistoryStream>(_mppt.history, MODBEE_HISTORY_BIN, from, to);
+  _chunker.begin(stream->binaryLength(), sizeof(ModbeeMpptHistoryRecord),
+                 [stream](uint8_t* buffer, size_t max) { return stream->fill(buffer, max); });
+  _chunkLength = 0;
+  _indicateFailures = 0;
+  _counters.downloads++;
+  setFastConnection(true);
+  MODBEE_LOGI("BLE history download: %lu records", (unsigned long)stream->recordCount());
+}
+
+void ModbeeMpptBle::sendChunk() {
+  // One indication per pass: indicate() waits for the client's confirmation
+  if (!_chunkLength) {
+    size_t size = min((size_t)(_counters.mtu - MODBEE_BLE_ATT_HEADER), sizeof(_chunk));
+    _chunkLength = _chunker.next(_chunk, size);
+    if (!_chunkLength) return;
+  }
+  _history->setValue(_chunk, _chunkLength);
+  _indicated = false;
+  _history->indicate();
+
+  if (!_indicated) {
+    // Resent on the next pass, unless the client keeps failing to confirm
+    if (++_indicateFailures >= MODBEE_BLE_INDICATE_RETRIES) endDownload(true);
+    return;
+  }
+  _indicateFailures = 0;
+  _chunkLength = 0;
+  _counters.chunks++;
+  if (!_chunker.active()) endDownload(false);
+}
+
+void ModbeeMpptBle::endDownload(bool failed) {
+  _chunker.cancel();
+  _chunkLength = 0;
+  _indicateFailures = 0;
+  if (failed) {
+    _counters.downloadsFailed++;
+    MODBEE_LOGW("BLE history download cancelled");
+  }
+  setFastConnection(false);
+}
+
+// ========================================================================
+// STATUS
+// ========================================================================
+
+void ModbeeMpptBle::updateStatus() {
+  _counters.downloadRemaining = _chunker.remaining();
+  portENTER_CRITICAL(&_mux);
+  _status = _counters;
+  portEXIT_CRITICAL(&_mux);
+}
+
+modbee_ble_status_t ModbeeMpptBle::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_ble_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+void ModbeeMpptBle::printStatus() const {
+  static const char* const MODE_NAMES[] = {"off", "low SOC", "always", "beacon"};
+  modbee_ble_status_t s = getStatus();
+  uint8_t mode = _mppt.config.data.ble_mode;
+  Serial.printf("=== BLE (%s, mode %s) ===\n", s.connected ? "connected" : s.running ? "advertising" : "off",
+                mode <= MODBEE_BLE_BEACON ? MODE_NAMES[mode] : "?");
+  if (s.beacon) {
+    uint32_t total = s.beaconAwakeMs + s.beaconSleepMs;
+    Serial.printf("Beacon: %lu bursts, awake %lu ms, asleep %lu ms (%.1f%%)\n", (unsigned long)s.beaconBursts,
+                  (unsigned long)s.beaconAwakeMs, (unsigned long)s.beaconSleepMs,
+                  total ? 100.0f * s.beaconSleepMs / total : 0.0f);
+    Serial.printf("Estimated average current: %.2f mA\n", s.beaconCurrentMa);
+    Serial.print("Last beacon: ");
+    for (size_t i = 0; i < sizeof(_beaconData); i++) Serial.printf("%02X", _beaconData[i]);
+    Serial.println();
+    return;
+  }
+  Serial.printf("Connections: %lu, MTU %u\n", (unsigned long)s.connections, s.mtu);
+  Serial.printf("Telemetry notifications: %lu\n", (unsigned long)s.notifications);
+  Serial.printf("Config requests: %lu (%lu rejected)\n", (unsigned long)s.configRequests,
+                (unsigned long)s.configErrors);
+  Serial.printf("History downloads: %lu (%lu cancelled), %lu chunks, %lu bytes left\n",
+                (unsigned long)s.downloads, (unsigned long)s.downloadsFailed, (unsigned long)s.chunks,
+                (unsigned long)s.downloadRemaining);
+}
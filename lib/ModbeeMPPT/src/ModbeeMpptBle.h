@@ -0,0 +1,264 @@
+/*!
+ * @file ModbeeMpptBle.h
+ *
+ * @brief BLE GATT service for ModbeeMPPT: telemetry, settings and history
+ *
+ * A low-power alternative to the WiFi AP for looking at a unit from a
+ * phone. One primary service with three characteristics, encoded by
+ * ModbeeMpptBleCodec:
+ * - telemetry (read, notify): the last telemetry frame as a 20-byte
+ *   record, notified once per new frame while a client is connected;
+ * - config (read, write, notify): write [op, index(, value)] to read or
+ *   change one settings field (ModbeeMpptConfig::getFields() order, as the
+ *   Modbus holding registers); the response is notified and stays readable.
+ *   Only a client bonded with the blePasskey setting can read or write it
+ *   (an encrypted, MITM protected link); with no passkey set nothing can;
+ * - history (write, indicate): write [from, to] to download the binary
+ *   history records in that range as chunked indications, anything else
+ *   cancels a download.
+ *
+ * The link runs at a slow connection interval with slave latency, so an
+ * idle connection costs little more than advertising; a history download
+ * switches to a short interval until it ends. Advertising is slow too
+ * (1 s) because the service is for a person nearby, not for discovery.
+ *
+ * Bluedroid callbacks run in its own task and only copy requests and
+ * record events; requests are answered, telemetry notified and chunks
+ * indicated in loop() on the main loop. ModbeeMpptPowerSave decides when
+ * the service runs (bleMode).
+ *
+ * In beacon mode (bleMode beacon) there is no connectable service: every
+ * MODBEE_BLE_BEACON_PERIOD_MS a short burst of non-connectable
+ * advertisements carries the key values as manufacturer data
+ * (ModbeeMpptBeacon), and between bursts ModbeeMpptPowerSave puts the CPU
+ * in light sleep when nothing else needs it (beaconIdleMs()). The status
+ * keeps the awake and sleep time since beacon mode started and an
+ * estimate of the average supply current from them.
+ *
+ * Changing blePasskey removes every bond and drops a connected client, so
+ * phones paired with the old passkey have to pair again.
+ *
+ * The stack is initialised on the first start() and then kept: stop()
+ * ends advertising and any connection, but Bluedroid cannot be torn down
+ * and brought up again without leaking its GATT database.
+ */
+
+#ifndef MODBEE_MPPT_BLE_H
+#define MODBEE_MPPT_BLE_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptBleCodec.h"
+#include <BLEDevice.h>
+#include <BLE2902.h>
+#include <BLESecurity.h>
+
+#define MODBEE_BLE_DEVICE_NAME "ModbeeMPPT"
+#define MODBEE_BLE_SERVICE_UUID "4d4f4442-0001-4d50-5054-000000000000"
+#define MODBEE_BLE_TELEMETRY_UUID "4d4f4442-0002-4d50-5054-000000000000"
+#define MODBEE_BLE_CONFIG_UUID "4d4f4442-0003-4d50-5054-000000000000"
+#define MODBEE_BLE_HISTORY_UUID "4d4f4442-0004-4d50-5054-000000000000"
+
+// Connection parameters (interval in 1.25 ms units, timeout in 10 ms units)
+#ifndef MODBEE_BLE_IDLE_INTERVAL_MIN
+#define MODBEE_BLE_IDLE_INTERVAL_MIN 320       // 400 ms
+#endif
+#ifndef MODBEE_BLE_IDLE_INTERVAL_MAX
+#define MODBEE_BLE_IDLE_INTERVAL_MAX 400       // 500 ms
+#endif
+#ifndef MODBEE_BLE_IDLE_LATENCY
+#define MODBEE_BLE_IDLE_LATENCY 2              // Intervals the unit may skip with nothing to send
+#endif
+#define MODBEE_BLE_IDLE_TIMEOUT 600            // 6 s, above (1 + latency) * interval * 2
+#define MODBEE_BLE_FAST_INTERVAL_MIN 12        // 15 ms, during a history download
+#define MODBEE_BLE_FAST_INTERVAL_MAX 24        // 30 ms
+#define MODBEE_BLE_FAST_TIMEOUT 400            // 4 s
+#ifndef MODBEE_BLE_ADV_INTERVAL
+#define MODBEE_BLE_ADV_INTERVAL 1600           // 1 s (0.625 ms units)
+#endif
+
+// Beacon mode. The period stays below MODBEE_DAILY_GAP_MS so today's
+// harvest keeps integrating across the sleeps.
+#ifndef MODBEE_BLE_BEACON_PERIOD_MS
+#define MODBEE_BLE_BEACON_PERIOD_MS 8000       // From one burst to the next
+#endif
+#ifndef MODBEE_BLE_BEACON_BURST_MS
+#define MODBEE_BLE_BEACON_BURST_MS 500         // Advertising per burst
+#endif
+#define MODBEE_BLE_BEACON_INTERVAL 160         // 100 ms, shortest for non-connectable advertising
+#define MODBEE_BLE_BEACON_MIN_SLEEP_MS 1000    // Shorter gaps are not worth a light sleep
+
+// Average current estimate in beacon mode (ESP32-C3 typical figures; a
+// board with its LED, regulator and BQ25798 quiescent current draws more)
+#define MODBEE_BLE_AWAKE_MA 20.0f              // CPU at 80 MHz, radio idle
+#define MODBEE_BLE_SLEEP_MA 0.13f              // Light sleep
+#define MODBEE_BLE_ADV_EVENT_UC 150.0f         // One advertising event on three channels, above awake
+
+#define MODBEE_BLE_INDICATE_RETRIES 3          // Failed indications in a row that cancel a download
+#define MODBEE_BLE_REQUEST_MAX 8               // Longest config or history request
+
+typedef struct {
+  bool running;                 // Advertising or connected
+  bool connected;
+  uint16_t mtu;                 // ATT MTU of the connection
+  uint32_t connections;         // Since boot
+  uint32_t notifications;       // Telemetry notifications sent
+  uint32_t configRequests;
+  uint32_t configErrors;        // Requests answered with a status other than OK
+  uint32_t downloads;           // History downloads started
+  uint32_t downloadsFailed;     // Cancelled by the client or after failed indications
+  uint32_t chunks;              // History chunks confirmed
+  uint32_t downloadRemaining;   // Bytes left in the current download, 0 = none
+  bool beacon;                  // Running as a beacon rather than the service
+  uint32_t beaconBursts;        // Since beacon mode started
+  uint32_t beaconAwakeMs;       // Since beacon mode started, at the last burst
+  uint32_t beaconSleepMs;       // Light sleep over the same time
+  float beaconCurrentMa;        // Estimated average supply current over the same time
+} modbee_ble_status_t;
+
+class ModbeeMpptBle {
+public:
+  ModbeeMpptBle(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Start advertising (initialising the stack the first time)
+   *
+   * Runs the service or the beacon as bleMode says; a running instance
+   * in the other role is stopped first.
+   * @return False if the stack could not be brought up
+   */
+  bool start();
+
+  /*!
+   * @brief Stop advertising and drop any connection
+   */
+  void stop();
+
+  /*!
+   * @brief Answer requests, notify telemetry, send history; call every loop pass
+   */
+  void loop();
+
+  bool isRunning() const { return _running; }
+
+  /*!
+   * @brief Time until the next beacon burst, 0 during a burst or when not a beacon (main loop)
+   */
+  uint32_t beaconIdleMs() const;
+
+  /*!
+   * @brief True while a client is connected (main loop)
+   */
+  bool isConnected() const { return _connected; }
+
+  /*!
+   * @brief Copy of the status and counters (any task)
+   */
+  modbee_ble_status_t getStatus() const;
+
+  /*!
+   * @brief Print the status to Serial
+   */
+  void printStatus() const;
+
+private:
+  // Bluedroid callbacks, forwarded to the service
+  class ServerCallbacks : public BLEServerCallbacks {
+  public:
+    ServerCallbacks(ModbeeMpptBle& ble) : _ble(ble) {}
+    using BLEServerCallbacks::onConnect;
+    using BLEServerCallbacks::onDisconnect;
+    void onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) override;
+    void onDisconnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) override;
+    void onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param) override;
+  private:
+    ModbeeMpptBle& _ble;
+  };
+
+  class RequestCallbacks : public BLECharacteristicCallbacks {
+  public:
+    RequestCallbacks(ModbeeMpptBle& ble, bool history) : _ble(ble), _history(history) {}
+    using BLECharacteristicCallbacks::onWrite;
+    void onWrite(BLECharacteristic* characteristic, esp_ble_gatts_cb_param_t* param) override;
+    void onStatus(BLECharacteristic* characteristic, Status status, uint32_t code) override;
+  private:
+    ModbeeMpptBle& _ble;
+    bool _history;
+  };
+
+  struct Request {
+    uint8_t data[MODBEE_BLE_REQUEST_MAX];
+    uint8_t length;             // 0 = none; longer requests are kept as invalid
+    bool pending;
+  };
+
+  class ModbeeMPPT& _mppt;
+  ServerCallbacks _serverCallbacks;
+  RequestCallbacks _configCallbacks;
+  RequestCallbacks _historyCallbacks;
+  BLEServer* _server;
+  BLECharacteristic* _telemetry;
+  BLECharacteristic* _config;
+  BLECharacteristic* _history;
+  mutable portMUX_TYPE _mux;
+  modbee_ble_status_t _status;
+
+  bool _running;
+  bool _connected;
+  uint16_t _connId;
+  esp_bd_addr_t _peer;
+  uint32_t _lastTelemetrySequence;
+
+  // Pairing
+  char _passkey[sizeof(ModbeeMpptConfigData::ble_passkey)];  // blePasskey last seen
+  bool _passkeyKnown;
+  bool _securityDue;            // _passkey not yet given to the stack
+  bool _bondsStale;             // Bonds were made with an older passkey
+
+  // Beacon
+  bool _beacon;
+  bool _advertising;            // Beacon burst in progress
+  bool _burstDue;               // Burst at the next pass, after start()
+  unsigned long _burstStart;
+  uint8_t _beaconSequence;
+  uint8_t _beaconData[ModbeeMpptBeacon::MANUFACTURER_BYTES];  // Last burst, for printStatus()
+  bool _beaconWindow;           // Awake/sleep accounting running
+  unsigned long _windowStart;
+  uint32_t _windowSleepStart;   // ModbeeMpptPowerSave::getSleepMs() when the window started
+
+  // History download
+  ModbeeMpptBleChunker _chunker;
+  uint8_t _chunk[MODBEE_BLE_CHUNK_MAX];
+  size_t _chunkLength;          // Chunk waiting for confirmation, 0 = none
+  uint8_t _indicateFailures;
+  bool _indicated;              // Set by onStatus() during indicate()
+
+  modbee_ble_status_t _counters; // Main loop copy of the status, published by updateStatus()
+
+  // Written by the Bluedroid callbacks, taken by loop()
+  bool _eventConnected;
+  bool _eventDisconnected;
+  uint16_t _eventConnId;
+  esp_bd_addr_t _eventPeer;
+  uint16_t _eventMtu;
+  Request _configRequest;
+  Request _historyRequest;
+
+  bool setup();
+  void advertiseService();
+  void beaconLoop();
+  void startBurst();
+  void updateEstimate();
+  void handleEvents();
+  void notifyTelemetry();
+  void checkPasskey();
+  void applySecurity();
+  void answerConfig(const uint8_t* data, size_t length);
+  uint8_t writeField(size_t index, int32_t value);
+  void startDownload(const uint8_t* data, size_t length);
+  void sendChunk();
+  void endDownload(bool failed);
+  void setFastConnection(bool fast);
+  void updateStatus();
+};
+
+#endif // MODBEE_MPPT_BLE_H
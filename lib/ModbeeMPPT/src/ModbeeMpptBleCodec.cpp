@@ -0,0 +1,160 @@
+/*!
+ * @file ModbeeMpptBleCodec.cpp
+ *
+ * @brief Implementation of the BLE wire formats and chunker
+ */
+
+#include "ModbeeMpptBleCodec.h"
+
+// Scaled values, saturated to the field range
+static uint16_t scaled(float value, float scale) {
+  return (uint16_t)constrain(lroundf(value * scale), 0L, 65535L);
+}
+
+static int16_t scaledSigned(float value, float scale) {
+  return (int16_t)constrain(lroundf(value * scale), -32768L, 32767L);
+}
+
+static int8_t degrees(float value) {
+  return (int8_t)constrain(lroundf(value), -128L, 127L);
+}
+
+static int32_t getLong(const uint8_t* p) {
+  return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+// ========================================================================
+// TELEMETRY AND REQUESTS
+// ========================================================================
+
+void ModbeeMpptBleCodec::packTelemetry(const modbee_telemetry_t& telemetry, float soc, uint8_t flags,
+                                       ModbeeMpptBleTelemetry& out) {
+  out.sequence = (uint16_t)telemetry.sequence;
+  out.vbus_mv = scaled(telemetry.vbus.voltage, 1000.0f);
+  out.ibus_ma = scaledSigned(telemetry.vbus.current, 1000.0f);
+  out.vbat_mv = scaled(telemetry.battery.voltage, 1000.0f);
+  out.ibat_ma = scaledSigned(telemetry.battery.current, 1000.0f);
+  out.vsys_mv = scaled(telemetry.system.voltage, 1000.0f);
+  out.soc_dpct = scaled(soc, 10.0f);
+  out.faults = (uint16_t)(telemetry.fault_status0 << 8 | telemetry.fault_status1);
+  out.die_temp_c = degrees(telemetry.die_temperature);
+  out.bat_temp_c = degrees(telemetry.battery_temperature);
+  out.charge_state = (uint8_t)telemetry.charge_state;
+  out.flags = (flags & ~MODBEE_BLE_FLAG_VALID) | (telemetry.valid ? MODBEE_BLE_FLAG_VALID : 0);
+}
+
+size_t ModbeeMpptBleCodec::packBeacon(const modbee_telemetry_t& telemetry, float soc, float todayWh,
+                                      uint8_t sequence, uint8_t flags, uint8_t* out) {
+  using namespace ModbeeMpptBeacon;
+  out[0] = COMPANY_ID & 0xFF;
+  out[1] = COMPANY_ID >> 8;
+  uint8_t* payload = out + 2;
+  memset(payload, 0, PAYLOAD_BYTES);
+  flags = (flags & ~MODBEE_BLE_FLAG_VALID) | (telemetry.valid ? MODBEE_BLE_FLAG_VALID : 0);
+  put(payload, FIELD_VERSION, VERSION);
+  put(payload, FIELD_SEQUENCE, sequence);
+  put(payload, FIELD_VBAT, quantize(FIELD_VBAT, telemetry.battery.voltage));
+  put(payload, FIELD_IBAT, quantize(FIELD_IBAT, telemetry.battery.current));
+  put(payload, FIELD_VBUS, quantize(FIELD_VBUS, telemetry.vbus.voltage));
+  put(payload, FIELD_SOC, quantize(FIELD_SOC, soc));
+  put(payload, FIELD_CHARGE_STATE, quantize(FIELD_CHARGE_STATE, telemetry.charge_state));
+  put(payload, FIELD_FAULTS, (uint32_t)(telemetry.fault_status0 << 8 | telemetry.fault_status1));
+  put(payload, FIELD_TODAY_WH, quantize(FIELD_TODAY_WH, todayWh));
+  put(payload, FIELD_DIE_TEMP, quantize(FIELD_DIE_TEMP, telemetry.die_temperature));
+  put(payload, FIELD_BAT_TEMP, quantize(FIELD_BAT_TEMP, telemetry.battery_temperature));
+  put(payload, FIELD_FLAGS, quantize(FIELD_FLAGS, flags));
+  return MANUFACTURER_BYTES;
+}
+
+bool ModbeeMpptBleCodec::parseConfigRequest(const uint8_t* data, size_t length,
+                                            modbee_ble_config_request_t& request) {
+  if (length < 2) return false;
+  request.op = data[0];
+  request.index = data[1];
+  request.value = 0;
+  switch (request.op) {
+    case MODBEE_BLE_CONFIG_READ:
+      return length == 2;
+    case MODBEE_BLE_CONFIG_WRITE:
+      if (length != 6) return false;
+      request.value = getLong(data + 2);
+      return true;
+    default:
+      return false;
+  }
+}
+
+int32_t ModbeeMpptBleCodec::encodeConfigValue(float value, modbee_config_field_type_t type) {
+  if (type == MODBEE_CONFIG_FLOAT) value *= MODBEE_BLE_FLOAT_SCALE;
+  return (int32_t)lroundf(value);
+}
+
+float ModbeeMpptBleCodec::decodeConfigValue(int32_t value, modbee_config_field_type_t type) {
+  return type == MODBEE_CONFIG_FLOAT ? value / MODBEE_BLE_FLOAT_SCALE : (float)value;
+}
+
+bool ModbeeMpptBleCodec::parseHistoryRequest(const uint8_t* data, size_t length, uint32_t& from, uint32_t& to) {
+  if (length != 8) return false;
+  from = (uint32_t)getLong(data);
+  to = (uint32_t)getLong(data + 4);
+  return from <= to;
+}
+
+// ========================================================================
+// CHUNKER
+// ========================================================================
+
+ModbeeMpptBleChunker::ModbeeMpptBleChunker() :
+  _length(0),
+  _remaining(0),
+  _sequence(0),
+  _recordSize(0),
+  _active(false)
+{
+}
+
+void ModbeeMpptBleChunker::begin(uint32_t length, uint8_t recordSize, Source source) {
+  _source = source;
+  _length = length;
+  _remaining = length;
+  _sequence = 0;
+  _recordSize = recordSize;
+  _active = true;
+}
+
+void ModbeeMpptBleChunker::cancel() {
+  _source = nullptr;
+  _remaining = 0;
+  _active = false;
+}
+
+size_t ModbeeMpptBleChunker::next(uint8_t* chunk, size_t size) {
+  size_t header = MODBEE_BLE_CHUNK_HEADER + (_sequence == 0 ? sizeof(ModbeeMpptBleTransferHeader) : 0);
+  if (!_active || size <= header) return 0;
+
+  size_t length = header;
+  uint8_t flags = 0;
+  if (_sequence == 0) {
+    ModbeeMpptBleTransferHeader transfer = {_length, _recordSize};
+    memcpy(chunk + MODBEE_BLE_CHUNK_HEADER, &transfer, sizeof(transfer));
+    flags |= MODBEE_BLE_CHUNK_FIRST;
+  }
+
+  // A source that ends early ends the transfer: the receiver sees the
+  // shortfall against the header
+  size_t want = min((size_t)_remaining, size - header);
+  size_t got = want ? _source(chunk + length, want) : 0;
+  length += got;
+  _remaining = got < want ? 0 : _remaining - got;
+  if (_remaining == 0) {
+    flags |= MODBEE_BLE_CHUNK_LAST;
+    _source = nullptr;
+    _active = false;
+  }
+
+  chunk[0] = _sequence & 0xFF;
+  chunk[1] = _sequence >> 8;
+  chunk[2] = flags;
+  _sequence++;
+  return length;
+}
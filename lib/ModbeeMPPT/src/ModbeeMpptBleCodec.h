@@ -0,0 +1,201 @@
+/*!
+ * @file ModbeeMpptBleCodec.h
+ *
+ * @brief Wire formats of the ModbeeMPPT BLE GATT service
+ *
+ * Everything the service puts on the air is encoded here, without the BLE
+ * stack, so the formats build and run on the host like the rest of the
+ * native build:
+ * - the telemetry characteristic: one 20-byte record that fits a
+ *   notification at the default ATT MTU of 23;
+ * - the config characteristic: a 2- or 6-byte request (read or write one
+ *   settings field by index) and an 8-byte response;
+ * - the history characteristic: an 8-byte range request, and
+ *   ModbeeMpptBleChunker, which cuts a byte stream (binary history records)
+ *   into indications of at most MTU - 3 bytes;
+ * - the beacon manufacturer data, laid out by ModbeeMpptBeacon.
+ *
+ * All multi-byte values are little-endian.
+ */
+
+#ifndef MODBEE_MPPT_BLE_CODEC_H
+#define MODBEE_MPPT_BLE_CODEC_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+#include "ModbeeMpptConfig.h"
+#include "ModbeeMpptBeacon.h"
+#include <functional>
+
+#define MODBEE_BLE_ATT_MTU_DEFAULT 23      // Before the client negotiates a larger one
+#define MODBEE_BLE_ATT_HEADER 3            // Opcode and handle ahead of a notified value
+#define MODBEE_BLE_CHUNK_HEADER 3          // Chunk sequence and flags
+#define MODBEE_BLE_MTU 247                 // Largest ATT MTU accepted from a client
+#define MODBEE_BLE_CHUNK_MAX (MODBEE_BLE_MTU - MODBEE_BLE_ATT_HEADER)  // Largest chunk
+#define MODBEE_BLE_FLOAT_SCALE 1000.0f     // Config value of a float field, as in the holding registers
+
+// Telemetry record flags
+#define MODBEE_BLE_FLAG_VALID 0x01         // A telemetry frame has been captured
+#define MODBEE_BLE_FLAG_POWER_SAVE 0x02    // SOC is below the power-save setpoint
+
+// Chunk flags
+#define MODBEE_BLE_CHUNK_FIRST 0x01        // Payload starts with the transfer header
+#define MODBEE_BLE_CHUNK_LAST 0x80         // No chunks follow
+
+// Telemetry characteristic value (read and notify)
+struct __attribute__((packed)) ModbeeMpptBleTelemetry {
+  uint16_t sequence;      // Telemetry frame counter, low 16 bits
+  uint16_t vbus_mv;
+  int16_t ibus_ma;
+  uint16_t vbat_mv;
+  int16_t ibat_ma;        // Positive = charging
+  uint16_t vsys_mv;
+  uint16_t soc_dpct;      // 0.1 %
+  uint16_t faults;        // FAULT_Status_0 << 8 | FAULT_Status_1
+  int8_t die_temp_c;
+  int8_t bat_temp_c;
+  uint8_t charge_state;   // modbee_charge_state_t
+  uint8_t flags;          // MODBEE_BLE_FLAG_*
+};
+
+static_assert(sizeof(ModbeeMpptBleTelemetry) == MODBEE_BLE_ATT_MTU_DEFAULT - MODBEE_BLE_ATT_HEADER,
+              "Telemetry must fit one notification at the default MTU");
+
+// Config requests (first byte written to the config characteristic)
+typedef enum {
+  MODBEE_BLE_CONFIG_READ = 0x01,     // [op, index]
+  MODBEE_BLE_CONFIG_WRITE = 0x02     // [op, index, value (int32)]
+} modbee_ble_config_op_t;
+
+// Config response status
+typedef enum {
+  MODBEE_BLE_CONFIG_OK = 0,
+  MODBEE_BLE_CONFIG_BAD_REQUEST = 1, // Unknown op or wrong length
+  MODBEE_BLE_CONFIG_BAD_INDEX = 2,   // No field at that index
+  MODBEE_BLE_CONFIG_BAD_VALUE = 3,   // Out of range, or not 0/1 for a bool
+  MODBEE_BLE_CONFIG_SAVE_FAILED = 4
+} modbee_ble_config_status_t;
+
+typedef struct {
+  uint8_t op;
+  uint8_t index;          // Field index in ModbeeMpptConfig::getFields()
+  int32_t value;          // Write only
+} modbee_ble_config_request_t;
+
+// Config characteristic value after a request (read and notify)
+struct __attribute__((packed)) ModbeeMpptBleConfigResponse {
+  uint8_t op;
+  uint8_t index;
+  uint8_t status;         // modbee_ble_config_status_t
+  uint8_t type;           // modbee_config_field_type_t
+  int32_t value;          // Current value, floats scaled by MODBEE_BLE_FLOAT_SCALE
+};
+
+// Header at the start of the first history chunk
+struct __attribute__((packed)) ModbeeMpptBleTransferHeader {
+  uint32_t length;        // Bytes that follow over all chunks
+  uint8_t recordSize;     // Bytes per record (sizeof(ModbeeMpptHistoryRecord))
+};
+
+namespace ModbeeMpptBleCodec {
+
+/*!
+ * @brief Encode a telemetry frame for the telemetry characteristic
+ * @param flags MODBEE_BLE_FLAG_* other than VALID
+ */
+void packTelemetry(const modbee_telemetry_t& telemetry, float soc, uint8_t flags,
+                   ModbeeMpptBleTelemetry& out);
+
+/*!
+ * @brief Encode the beacon manufacturer data
+ * @param todayWh Energy harvested today
+ * @param sequence Burst counter
+ * @param flags MODBEE_BLE_FLAG_* other than VALID
+ * @param out At least ModbeeMpptBeacon::MANUFACTURER_BYTES
+ * @return Bytes written
+ */
+size_t packBeacon(const modbee_telemetry_t& telemetry, float soc, float todayWh, uint8_t sequence,
+                  uint8_t flags, uint8_t* out);
+
+/*!
+ * @brief Decode a write to the config characteristic
+ * @return False if the op or the length is wrong
+ */
+bool parseConfigRequest(const uint8_t* data, size_t length, modbee_ble_config_request_t& request);
+
+/*!
+ * @brief Config value of a field as sent over BLE (floats scaled)
+ */
+int32_t encodeConfigValue(float value, modbee_config_field_type_t type);
+
+/*!
+ * @brief Settings value of a received config value
+ */
+float decodeConfigValue(int32_t value, modbee_config_field_type_t type);
+
+/*!
+ * @brief Decode a write to the history characteristic
+ * @param from First timestamp (seconds since boot, inclusive)
+ * @param to Last timestamp (inclusive)
+ * @return False for anything but an 8-byte [from, to] request
+ */
+bool parseHistoryRequest(const uint8_t* data, size_t length, uint32_t& from, uint32_t& to);
+
+} // namespace ModbeeMpptBleCodec
+
+/*!
+ * @brief Cuts a byte stream into indication-sized chunks
+ *
+ * A chunk is [sequence (uint16), flags, payload]. The first chunk carries
+ * MODBEE_BLE_CHUNK_FIRST and starts with a ModbeeMpptBleTransferHeader;
+ * the last carries MODBEE_BLE_CHUNK_LAST (both for an empty transfer).
+ * The stream is pulled from the source as chunks are taken, so memory use
+ * does not depend on the transfer length.
+ */
+class ModbeeMpptBleChunker {
+public:
+  /*!
+   * @brief Source of the stream: fill up to max bytes, return the count
+   */
+  typedef std::function<size_t(uint8_t* buffer, size_t max)> Source;
+
+  ModbeeMpptBleChunker();
+
+  /*!
+   * @brief Start a transfer
+   * @param length Bytes the source will deliver
+   * @param recordSize Bytes per record, for the receiver
+   */
+  void begin(uint32_t length, uint8_t recordSize, Source source);
+
+  /*!
+   * @brief Drop the transfer (and the source)
+   */
+  void cancel();
+
+  /*!
+   * @brief True until the last chunk has been taken
+   */
+  bool active() const { return _active; }
+
+  /*!
+   * @brief Encode the next chunk
+   * @param chunk Destination
+   * @param size Largest chunk, normally MTU - MODBEE_BLE_ATT_HEADER
+   * @return Chunk length, 0 if no transfer is active
+   */
+  size_t next(uint8_t* chunk, size_t size);
+
+  uint16_t sequence() const { return _sequence; }
+  uint32_t remaining() const { return _remaining; }
+
+private:
+  Source _source;
+  uint32_t _length;
+  uint32_t _remaining;
+  uint16_t _sequence;
+  uint8_t _recordSize;
+  bool _active;
+};
+
+#endif // MODBEE_MPPT_BLE_CODEC_H
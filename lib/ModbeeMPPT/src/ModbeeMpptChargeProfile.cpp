@@ -0,0 +1,256 @@
+/*!
+ * @file ModbeeMpptChargeProfile.cpp
+ *
+ * @brief Implementation of the multi-stage charge profile engine
+ */
+
+#include "ModbeeMpptChargeProfile.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+
+// absorption, float, rebulk, equalize (V/cell), equalize min, tail ratio, mV/°C/cell
+static const modbee_charge_preset_t PRESET_LIFEPO4 = {3.55f, 3.375f, 3.30f, 0.0f, 0, 0.05f, 0.0f};
+static const modbee_charge_preset_t PRESET_LIPO = {4.20f, 0.0f, 0.0f, 0.0f, 0, 0.05f, 0.0f};
+static const modbee_charge_preset_t PRESET_LEAD_ACID = {2.40f, 2.25f, 2.10f, 2.50f, 120, 0.15f, -3.0f};
+
+static const unsigned long MS_PER_DAY = 86400000UL;
+
+ModbeeMpptChargeProfile::ModbeeMpptChargeProfile(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _preset(nullptr),
+  _configVoltage(0.0f),
+  _configType(MODBEE_BATTERY_CUSTOM),
+  _stageStart(0),
+  _lastEqualize(0),
+  _confirm(0),
+  _appliedVoltage(0.0f),
+  _appliedCurrent(0.0f),
+  _appliedTermination(-1),
+  _appliedTimer(-1)
+{
+  memset(&_status, 0, sizeof(_status));
+}
+
+const modbee_charge_preset_t* ModbeeMpptChargeProfile::getPreset(modbee_battery_type_t type) {
+  switch (type) {
+    case MODBEE_BATTERY_LIFEPO4: return &PRESET_LIFEPO4;
+    case MODBEE_BATTERY_LIPO: return &PRESET_LIPO;
+    case MODBEE_BATTERY_LEAD_ACID: return &PRESET_LEAD_ACID;
+    default: return nullptr;
+  }
+}
+
+const char* ModbeeMpptChargeProfile::stageName(modbee_charge_stage_t stage) {
+  switch (stage) {
+    case MODBEE_STAGE_BULK: return "bulk";
+    case MODBEE_STAGE_ABSORPTION: return "absorption";
+    case MODBEE_STAGE_EQUALIZE: return "equalize";
+    case MODBEE_STAGE_FLOAT: return "float";
+    case MODBEE_STAGE_DONE: return "done";
+    default: return "off";
+  }
+}
+
+bool ModbeeMpptChargeProfile::isActive() const {
+  return _mppt.config.chargeProfileActive();
+}
+
+void ModbeeMpptChargeProfile::reassert() {
+  _appliedVoltage = _appliedCurrent = 0.0f;
+  _appliedTermination = _appliedTimer = -1;
+}
+
+modbee_charge_profile_status_t ModbeeMpptChargeProfile::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_charge_profile_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+// ========================================================================
+// ENABLE / DISABLE
+// ========================================================================
+
+void ModbeeMpptChargeProfile::start() {
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  _preset = getPreset(config.battery_type);
+  _configVoltage = config.charge_voltage;
+  _configType = config.battery_type;
+  _lastEqualize = millis();
+  reassert();
+
+  portENTER_CRITICAL(&_mux);
+  _status.cells = (uint8_t)max(1.0f, roundf(config.charge_voltage / _preset->absorption_v));
+  portEXIT_CRITICAL(&_mux);
+
+  MODBEE_LOGI("Charge profile started: %u cells, absorption %.2fV", _status.cells, config.charge_voltage);
+  enterStage(MODBEE_STAGE_BULK);
+}
+
+void ModbeeMpptChargeProfile::stop() {
+  // Hand the registers back to the static config values
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  _mppt.api.setChargeVoltage(config.charge_voltage);
+  _mppt.api.setChargeCurrent(config.charge_current);
+  _mppt.api.setTerminationEnable(true);
+  _mppt.api.setFastChargeTimerEnable(config.fast_charge_timer_enable);
+  _preset = nullptr;
+
+  portENTER_CRITICAL(&_mux);
+  memset(&_status, 0, sizeof(_status));
+  portEXIT_CRITICAL(&_mux);
+  MODBEE_LOGI("Charge profile stopped");
+}
+
+void ModbeeMpptChargeProfile::enterStage(modbee_charge_stage_t stage) {
+  if (stage != _status.stage) {
+    MODBEE_LOGI("Charge stage %s -> %s", stageName(_status.stage), stageName(stage));
+  }
+  _stageStart = millis();
+  _confirm = 0;
+  if (stage == MODBEE_STAGE_EQUALIZE) _lastEqualize = _stageStart;
+
+  portENTER_CRITICAL(&_mux);
+  _status.stage = stage;
+  _status.stageSeconds = 0;
+  portEXIT_CRITICAL(&_mux);
+}
+
+bool ModbeeMpptChargeProfile::confirmed(bool condition) {
+  // Debounce: ADC noise and passing clouds must not flip stages
+  _confirm = condition ? _confirm + 1 : 0;
+  return _confirm >= MODBEE_PROFILE_CONFIRM_S;
+}
+
+void ModbeeMpptChargeProfile::apply(float voltage, float current, bool termination, bool timer) {
+  // VREG/ICHG resolution is 10 mA / 10 mV; skip writes that change nothing
+  if (fabsf(voltage - _appliedVoltage) >= 0.01f) {
+    _mppt.api.setChargeVoltage(voltage);
+    _appliedVoltage = voltage;
+  }
+  if (fabsf(current - _appliedCurrent) >= 0.01f) {
+    _mppt.api.setChargeCurrent(current);
+    _appliedCurrent = current;
+  }
+  if (_appliedTermination != (int8_t)termination) {
+    _mppt.api.setTerminationEnable(termination);
+    _appliedTermination = termination;
+  }
+  if (_appliedTimer != (int8_t)timer) {
+    _mppt.api.setFastChargeTimerEnable(timer);
+    _appliedTimer = timer;
+  }
+}
+
+// ========================================================================
+// STAGE MACHINE
+// ========================================================================
+
+void ModbeeMpptChargeProfile::update(const modbee_telemetry_t& telemetry) {
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  bool active = isActive();
+  if (active && _preset &&
+      (config.battery_type != _configType || fabsf(config.charge_voltage - _configVoltage) > 0.001f)) {
+    // Chemistry or absorption voltage changed: start over from bulk
+    start();
+  }
+  if (active != (_preset != nullptr)) {
+    if (active) {
+      start();
+    } else {
+      stop();
+    }
+  }
+  if (!active || !telemetry.valid) return;
+
+  const modbee_charge_preset_t& preset = *_preset;
+  unsigned long now = millis();
+  uint8_t cells = _status.cells;
+  float vbat = telemetry.battery.voltage;
+  float ibat = telemetry.battery.current;
+  bool regulating = telemetry.charge_state == MODBEE_CHARGE_TAPER_CV;
+
+  // Temperature compensation; sentinel readings (no NTC fitted) count as 25 °C
+  float temperature = telemetry.battery_temperature;
+  if (temperature <= -40.0f || temperature >= 150.0f) temperature = MODBEE_PROFILE_TEMP_REFERENCE;
+  temperature = constrain(temperature, MODBEE_PROFILE_TEMP_MIN, MODBEE_PROFILE_TEMP_MAX);
+  float compensation = cells * preset.temp_comp_mv / 1000.0f * (temperature - MODBEE_PROFILE_TEMP_REFERENCE);
+
+  float absorption = config.charge_voltage + compensation;
+  float floatVoltage = min(cells * preset.float_v + compensation, absorption);
+  float equalize = min(cells * preset.equalize_v + compensation, MODBEE_MAX_CHARGE_VOLTAGE);
+  float tail = max(config.termination_current, config.charge_current * preset.tail_ratio);
+  uint32_t stageSeconds = (now - _stageStart) / 1000;
+
+  bool equalizeEnabled = preset.equalize_v > 0.0f && config.equalize_days > 0;
+  unsigned long equalizePeriod = (unsigned long)config.equalize_days * MS_PER_DAY;
+  bool equalizeDue = equalizeEnabled && now - _lastEqualize >= equalizePeriod;
+
+  // Where to go once absorption is complete
+  modbee_charge_stage_t afterAbsorption = equalizeDue ? MODBEE_STAGE_EQUALIZE :
+    (preset.float_v > 0.0f ? MODBEE_STAGE_FLOAT : MODBEE_STAGE_DONE);
+
+  switch (_status.stage) {
+    case MODBEE_STAGE_BULK:
+      // The chip switches from CC to CV when VBAT reaches the charge voltage
+      if (confirmed(regulating)) enterStage(MODBEE_STAGE_ABSORPTION);
+      break;
+
+    case MODBEE_STAGE_ABSORPTION:
+      // Tail current only counts while regulating; at dusk the current
+      // falls because the input is gone, not because the battery is full
+      if (confirmed(regulating && ibat < tail) ||
+          (config.absorption_minutes > 0 && stageSeconds >= (uint32_t)config.absorption_minutes * 60)) {
+        enterStage(afterAbsorption);
+      }
+      break;
+
+    case MODBEE_STAGE_EQUALIZE:
+      if (stageSeconds >= (uint32_t)preset.equalize_minutes * 60) {
+        enterStage(MODBEE_STAGE_FLOAT);
+      }
+      break;
+
+    case MODBEE_STAGE_FLOAT:
+      if (confirmed(vbat < cells * preset.rebulk_v + compensation)) {
+        enterStage(MODBEE_STAGE_BULK);
+      }
+      break;
+
+    case MODBEE_STAGE_DONE:
+      // The chip restarts charging below its recharge threshold
+      if (confirmed(telemetry.charge_state == MODBEE_CHARGE_FAST_CC || regulating)) {
+        enterStage(MODBEE_STAGE_BULK);
+      }
+      break;
+
+    default:
+      enterStage(MODBEE_STAGE_BULK);
+      break;
+  }
+
+  // Registers for the (possibly new) stage. Float chemistries never let
+  // the chip terminate; the safety timer is off while floating
+  float voltage = absorption;
+  float current = config.charge_current;
+  bool termination = preset.float_v <= 0.0f;
+  bool timer = config.fast_charge_timer_enable;
+  if (_status.stage == MODBEE_STAGE_EQUALIZE) {
+    voltage = equalize;
+    timer = false;
+  } else if (_status.stage == MODBEE_STAGE_FLOAT) {
+    voltage = floatVoltage;
+    timer = false;
+  }
+  apply(voltage, current, termination, timer);
+
+  portENTER_CRITICAL(&_mux);
+  _status.voltage = voltage;
+  _status.current = current;
+  _status.compensation = compensation;
+  _status.stageSeconds = (now - _stageStart) / 1000;
+  _status.equalizeDueSeconds = (equalizeEnabled && !equalizeDue) ?
+    (equalizePeriod - (now - _lastEqualize)) / 1000 : 0;
+  portEXIT_CRITICAL(&_mux);
+}
@@ -0,0 +1,123 @@
+/*!
+ * @file ModbeeMpptChargeProfile.h
+ *
+ * @brief Multi-stage charge profile engine for ModbeeMPPT
+ *
+ * The BQ25798 charges CC/CV to a single voltage and terminates. When the
+ * profile is enabled, this engine moves the charge voltage and current
+ * through bulk, absorption, optional equalization and float (or done, for
+ * chemistries that must not float) using a per-chemistry preset, and
+ * compensates the voltage for battery temperature. config.charge_voltage is
+ * the absorption voltage; float, re-bulk and equalize voltages scale from
+ * it with the preset's per-cell values.
+ */
+
+#ifndef MODBEE_MPPT_CHARGE_PROFILE_H
+#define MODBEE_MPPT_CHARGE_PROFILE_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+
+// Conditions must hold this long before a stage change (s)
+#define MODBEE_PROFILE_CONFIRM_S 60
+
+// Temperature compensation reference and clamp (°C)
+#define MODBEE_PROFILE_TEMP_REFERENCE 25.0f
+#define MODBEE_PROFILE_TEMP_MIN -20.0f
+#define MODBEE_PROFILE_TEMP_MAX 50.0f
+
+typedef enum {
+  MODBEE_STAGE_OFF = 0,         // Profile disabled, config values apply
+  MODBEE_STAGE_BULK = 1,        // Constant current up to the absorption voltage
+  MODBEE_STAGE_ABSORPTION = 2,  // Held at the absorption voltage until time or tail current
+  MODBEE_STAGE_EQUALIZE = 3,    // Periodic controlled overcharge (flooded lead-acid)
+  MODBEE_STAGE_FLOAT = 4,       // Held at the float voltage, termination off
+  MODBEE_STAGE_DONE = 5         // Terminated; the chip's recharge threshold restarts bulk
+} modbee_charge_stage_t;
+
+// Per-chemistry preset; voltages are per cell
+typedef struct {
+  float absorption_v;           // Nominal absorption voltage (sets the cell count)
+  float float_v;                // 0 = no float, terminate instead
+  float rebulk_v;               // Float -> bulk below this
+  float equalize_v;             // 0 = never equalize
+  uint16_t equalize_minutes;
+  float tail_ratio;             // Absorption ends below charge_current x this
+  float temp_comp_mv;           // mV per °C per cell (negative = lower when warm)
+} modbee_charge_preset_t;
+
+typedef struct {
+  modbee_charge_stage_t stage;
+  float voltage;                // Charge voltage written (V)
+  float current;                // Charge current written (A)
+  float compensation;           // Temperature compensation applied (V)
+  uint8_t cells;                // Cells derived from charge_voltage / preset
+  uint32_t stageSeconds;        // Time in the current stage
+  uint32_t equalizeDueSeconds;  // Until the next equalization (0 = off or due)
+} modbee_charge_profile_status_t;
+
+class ModbeeMpptChargeProfile {
+public:
+  ModbeeMpptChargeProfile(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Advance the stage machine with one 1 Hz telemetry frame
+   * @param telemetry Frame from ModbeeMpptAPI::getTelemetry()
+   */
+  void update(const modbee_telemetry_t& telemetry);
+
+  /*!
+   * @brief True while the engine owns the charge voltage/current registers
+   */
+  bool isActive() const;
+
+  /*!
+   * @brief Write every register again on the next update()
+   *
+   * Called whenever the charger settings are re-applied, since a charger
+   * reset puts back its own VREG, ICHG and timer defaults.
+   */
+  void reassert();
+
+  /*!
+   * @brief Copy of the engine state for the web UI
+   */
+  modbee_charge_profile_status_t getStatus() const;
+
+  /*!
+   * @brief Preset for a chemistry
+   * @return nullptr for MODBEE_BATTERY_CUSTOM
+   */
+  static const modbee_charge_preset_t* getPreset(modbee_battery_type_t type);
+
+  /*!
+   * @brief Short name of a stage ("bulk", "float", ...)
+   */
+  static const char* stageName(modbee_charge_stage_t stage);
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_charge_profile_status_t _status;
+  mutable portMUX_TYPE _mux;
+
+  const modbee_charge_preset_t* _preset;
+  float _configVoltage;         // Config values the engine started from
+  modbee_battery_type_t _configType;
+  unsigned long _stageStart;
+  unsigned long _lastEqualize;
+  uint16_t _confirm;            // Seconds an exit condition has held
+
+  // Last register values, written again only on change
+  float _appliedVoltage;
+  float _appliedCurrent;
+  int8_t _appliedTermination;
+  int8_t _appliedTimer;
+
+  void start();
+  void stop();
+  void enterStage(modbee_charge_stage_t stage);
+  bool confirmed(bool condition);
+  void apply(float voltage, float current, bool termination, bool timer);
+};
+
+#endif // MODBEE_MPPT_CHARGE_PROFILE_H
@@ -5,12 +5,167 @@
  */
 
 #include "ModbeeMpptConfig.h"
+#include "ModbeeMpptEventLog.h"
+#include <stddef.h>
 
-ModbeeMpptConfig::ModbeeMpptConfig() : _initialized(false) {
+// Validation groups (one per validate*Config() helper)
+enum {
+  CONFIG_GROUP_BATTERY,
+  CONFIG_GROUP_CHARGING,
+  CONFIG_GROUP_INPUT,
+  CONFIG_GROUP_TIMER,
+  CONFIG_GROUP_MPPT,
+  CONFIG_GROUP_INTERVAL,
+  CONFIG_GROUP_MODBUS,
+  CONFIG_GROUP_MQTT,
+  CONFIG_GROUP_BLE,
+  CONFIG_GROUP_WIFI
+};
+
+#define CONFIG_FIELD(key, member, apply, type, group, min, max) \
+  { key, apply, type, group, offsetof(ModbeeMpptConfigData, member), \
+    sizeof(ModbeeMpptConfigData::member), min, max }
+
+// Single source of truth for settings keys, ranges and apply actions.
+// Modbus holding registers follow this order: append new fields only.
+static const ModbeeMpptConfigField CONFIG_FIELDS[] = {
+  CONFIG_FIELD("batteryType", battery_type, MODBEE_APPLY_BATTERY_TYPE, MODBEE_CONFIG_INT, CONFIG_GROUP_BATTERY, 0, 3),
+  CONFIG_FIELD("cellCount", battery_cell_count, MODBEE_APPLY_BATTERY_TYPE, MODBEE_CONFIG_INT, CONFIG_GROUP_BATTERY, 1, 4),
+  CONFIG_FIELD("chargeVoltage", charge_voltage, MODBEE_APPLY_CHARGE_VOLTAGE, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_BATTERY, 3.0f, 18.8f),
+  CONFIG_FIELD("chargeCurrent", charge_current, MODBEE_APPLY_CHARGE_CURRENT, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_BATTERY, 0.1f, 5.0f),
+  CONFIG_FIELD("systemVoltage", min_system_voltage, MODBEE_APPLY_MIN_SYSTEM_VOLTAGE, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_BATTERY, 2.0f, 18.8f),
+  CONFIG_FIELD("capacityAh", battery_capacity_ah, MODBEE_APPLY_SOC_ESTIMATOR, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_BATTERY, 0.1f, 1000.0f),
+  CONFIG_FIELD("socEkf", soc_ekf, MODBEE_APPLY_SOC_ESTIMATOR, MODBEE_CONFIG_BOOL, CONFIG_GROUP_BATTERY, 0, 1),
+  CONFIG_FIELD("termCurrent", termination_current, MODBEE_APPLY_TERMINATION_CURRENT, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_CHARGING, 0.04f, 1.0f),
+  CONFIG_FIELD("rechargeThreshold", recharge_threshold, MODBEE_APPLY_RECHARGE_THRESHOLD, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_CHARGING, 0.05f, 0.8f),
+  CONFIG_FIELD("prechargeCurrent", precharge_current, MODBEE_APPLY_PRECHARGE_CURRENT, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_CHARGING, 0.04f, 2.0f),
+  CONFIG_FIELD("prechargeVoltageThreshold", precharge_voltage_threshold, MODBEE_APPLY_PRECHARGE_VOLTAGE, MODBEE_CONFIG_INT, CONFIG_GROUP_CHARGING, 0, 3),
+  CONFIG_FIELD("profileEnable", profile_enable, MODBEE_APPLY_CHARGE_PROFILE, MODBEE_CONFIG_BOOL, CONFIG_GROUP_CHARGING, 0, 1),
+  CONFIG_FIELD("absorptionTime", absorption_minutes, MODBEE_APPLY_CHARGE_PROFILE, MODBEE_CONFIG_INT, CONFIG_GROUP_CHARGING, 0, 480),
+  CONFIG_FIELD("equalizeDays", equalize_days, MODBEE_APPLY_CHARGE_PROFILE, MODBEE_CONFIG_INT, CONFIG_GROUP_CHARGING, 0, 45),
+  CONFIG_FIELD("inputVoltage", input_voltage_limit, MODBEE_APPLY_INPUT_VOLTAGE, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 3.6f, 22.0f),
+  CONFIG_FIELD("inputCurrent", input_current_limit, MODBEE_APPLY_INPUT_CURRENT, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.1f, 3.25f),
+  CONFIG_FIELD("vacOvp", vac_ovp_threshold, MODBEE_APPLY_VAC_OVP, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 6.0f, 26.0f),
+  CONFIG_FIELD("sourcePolicy", source_policy, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_INT, CONFIG_GROUP_INPUT, 0, 4),
+  CONFIG_FIELD("sourcePrimary", source_primary, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_INT, CONFIG_GROUP_INPUT, 1, 2),
+  CONFIG_FIELD("sourceDwell", source_dwell_s, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_INT, CONFIG_GROUP_INPUT, 5, 3600),
+  CONFIG_FIELD("vac1VoltageLimit", vac1_voltage_limit, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.0f, 22.0f),
+  CONFIG_FIELD("vac1CurrentLimit", vac1_current_limit, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.0f, 3.25f),
+  CONFIG_FIELD("vac2VoltageLimit", vac2_voltage_limit, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.0f, 22.0f),
+  CONFIG_FIELD("vac2CurrentLimit", vac2_current_limit, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.0f, 3.25f),
+  CONFIG_FIELD("vac1Cost", vac1_cost, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.0f, 1000.0f),
+  CONFIG_FIELD("vac2Cost", vac2_cost, MODBEE_APPLY_SOURCE_ARBITER, MODBEE_CONFIG_FLOAT, CONFIG_GROUP_INPUT, 0.0f, 1000.0f),
+  CONFIG_FIELD("chargeTimerEnable", fast_charge_timer_enable, MODBEE_APPLY_FAST_TIMER_ENABLE, MODBEE_CONFIG_BOOL, CONFIG_GROUP_TIMER, 0, 1),
+  CONFIG_FIELD("chargeTimer", fast_charge_timer, MODBEE_APPLY_FAST_TIMER, MODBEE_CONFIG_INT, CONFIG_GROUP_TIMER, 0, 3),
+  CONFIG_FIELD("prechargeTimerEnable", precharge_timer_enable, MODBEE_APPLY_PRECHARGE_TIMER_ENABLE, MODBEE_CONFIG_BOOL, CONFIG_GROUP_TIMER, 0, 1),
+  CONFIG_FIELD("prechargeTimer", precharge_timer, MODBEE_APPLY_PRECHARGE_TIMER, MODBEE_CONFIG_INT, CONFIG_GROUP_TIMER, 0, 1),
+  CONFIG_FIELD("topoffTimer", topoff_timer, MODBEE_APPLY_TOPOFF_TIMER, MODBEE_CONFIG_INT, CONFIG_GROUP_TIMER, 0, 3),
+  CONFIG_FIELD("vocPercent", mppt_voc_percent, MODBEE_APPLY_VOC_PERCENT, MODBEE_CONFIG_INT, CONFIG_GROUP_MPPT, 0, 7),
+  CONFIG_FIELD("vocDelay", mppt_voc_delay, MODBEE_APPLY_VOC_DELAY, MODBEE_CONFIG_INT, CONFIG_GROUP_MPPT, 0, 3),
+  CONFIG_FIELD("vocRate", mppt_voc_rate, MODBEE_APPLY_VOC_RATE, MODBEE_CONFIG_INT, CONFIG_GROUP_MPPT, 0, 3),
+  CONFIG_FIELD("mpptEnable", mppt_enable, MODBEE_APPLY_MPPT, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MPPT, 0, 1),
+  CONFIG_FIELD("mpptMode", mppt_mode, MODBEE_APPLY_MPPT, MODBEE_CONFIG_INT, CONFIG_GROUP_MPPT, 0, 1),
+  CONFIG_FIELD("vocAdaptive", mppt_voc_adaptive, MODBEE_APPLY_VOC_TUNER, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MPPT, 0, 1),
+  CONFIG_FIELD("pfmForwardEnable", pfm_forward_enable, MODBEE_APPLY_PFM_FORWARD, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MPPT, 0, 1),
+  CONFIG_FIELD("ooaForwardEnable", ooa_forward_enable, MODBEE_APPLY_OOA_FORWARD, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MPPT, 0, 1),
+  CONFIG_FIELD("batteryCheckInterval", battery_check_interval, MODBEE_APPLY_NONE, MODBEE_CONFIG_ULONG, CONFIG_GROUP_INTERVAL, 1000, 300000),
+  CONFIG_FIELD("socCheckInterval", soc_check_interval, MODBEE_APPLY_NONE, MODBEE_CONFIG_ULONG, CONFIG_GROUP_INTERVAL, 5000, 600000),
+  CONFIG_FIELD("configApplyInterval", config_apply_interval, MODBEE_APPLY_NONE, MODBEE_CONFIG_ULONG, CONFIG_GROUP_INTERVAL, 1000, 600000),
+  CONFIG_FIELD("modbusEnable", modbus_enable, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MODBUS, 0, 1),
+  CONFIG_FIELD("modbusAddress", modbus_address, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_INT, CONFIG_GROUP_MODBUS, 1, 247),
+  CONFIG_FIELD("modbusBaud", modbus_baud, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_ULONG, CONFIG_GROUP_MODBUS, 1200, 115200),
+  CONFIG_FIELD("modbusParity", modbus_parity, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_INT, CONFIG_GROUP_MODBUS, 0, 2),
+  CONFIG_FIELD("modbusMaster", modbus_master, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MODBUS, 0, 1),
+  CONFIG_FIELD("modbusPeerFirst", modbus_peer_first, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_INT, CONFIG_GROUP_MODBUS, 1, 247),
+  CONFIG_FIELD("modbusPeerCount", modbus_peer_count, MODBEE_APPLY_MODBUS, MODBEE_CONFIG_INT, CONFIG_GROUP_MODBUS, 0, MODBEE_MODBUS_MAX_PEERS),
+  CONFIG_FIELD("mqttEnable", mqtt_enable, MODBEE_APPLY_MQTT, MODBEE_CONFIG_BOOL, CONFIG_GROUP_MQTT, 0, 1),
+  CONFIG_FIELD("mqttPort", mqtt_port, MODBEE_APPLY_MQTT, MODBEE_CONFIG_INT, CONFIG_GROUP_MQTT, 1, 65535),
+  CONFIG_FIELD("mqttInterval", mqtt_interval_s, MODBEE_APPLY_MQTT, MODBEE_CONFIG_INT, CONFIG_GROUP_MQTT, 1, 3600),
+  CONFIG_FIELD("mqttBatch", mqtt_batch, MODBEE_APPLY_MQTT, MODBEE_CONFIG_INT, CONFIG_GROUP_MQTT, 1, MODBEE_MQTT_MAX_BATCH),
+  CONFIG_FIELD("mqttKeepalive", mqtt_keepalive_s, MODBEE_APPLY_MQTT, MODBEE_CONFIG_INT, CONFIG_GROUP_MQTT, 10, 3600),
+  CONFIG_FIELD("bleMode", ble_mode, MODBEE_APPLY_BLE, MODBEE_CONFIG_INT, CONFIG_GROUP_BLE, MODBEE_BLE_OFF, MODBEE_BLE_BEACON),
+  CONFIG_FIELD("wifiMode", wifi_mode, MODBEE_APPLY_WIFI, MODBEE_CONFIG_INT, CONFIG_GROUP_WIFI, MODBEE_WIFI_AP, MODBEE_WIFI_STATION),
+};
+
+static const size_t CONFIG_FIELD_COUNT = sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]);
+static_assert(sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]) <= 64, "Pending field mask is 64 bits");
+static_assert(MODBEE_APPLY_COUNT <= 32, "Pending action mask is 32 bits");
+
+#define CONFIG_TEXT(key, member, secret) \
+  { key, offsetof(ModbeeMpptConfigData, member), sizeof(ModbeeMpptConfigData::member), secret }
+
+// Text fields: settings keys only, so the holding register map is unchanged
+static const ModbeeMpptConfigText CONFIG_TEXTS[] = {
+  CONFIG_TEXT("wifiSsid", wifi_ssid, false),
+  CONFIG_TEXT("wifiPassword", wifi_password, true),
+  CONFIG_TEXT("mqttHost", mqtt_host, false),
+  CONFIG_TEXT("mqttUser", mqtt_user, false),
+  CONFIG_TEXT("mqttPassword", mqtt_password, true),
+  CONFIG_TEXT("mqttTopic", mqtt_topic, false),
+  CONFIG_TEXT("blePasskey", ble_passkey, true),
+};
+
+static const size_t CONFIG_TEXT_COUNT = sizeof(CONFIG_TEXTS) / sizeof(CONFIG_TEXTS[0]);
+
+static char* textField(ModbeeMpptConfigData& config, const ModbeeMpptConfigText& text) {
+  return reinterpret_cast<char*>(&config) + text.offset;
+}
+
+static const char* textField(const ModbeeMpptConfigData& config, const ModbeeMpptConfigText& text) {
+  return reinterpret_cast<const char*>(&config) + text.offset;
+}
+
+// Copy into a char array member, truncated to fit
+static void copyText(char* dest, const char* text, size_t size) {
+  size_t length = strnlen(text, size - 1);
+  memcpy(dest, text, length);
+  dest[length] = '\0';
+}
+
+static void loadText(char* dest, size_t size, JsonVariantConst value, const char* fallback) {
+  copyText(dest, value.is<const char*>() ? value.as<const char*>() : fallback, size);
+}
+
+// Read a field as a float (all ranges fit a float exactly)
+static float readField(const ModbeeMpptConfigData& config, const ModbeeMpptConfigField& field) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&config) + field.offset;
+  switch (field.type) {
+    case MODBEE_CONFIG_FLOAT: { float v; memcpy(&v, p, sizeof(v)); return v; }
+    case MODBEE_CONFIG_BOOL: { bool v; memcpy(&v, p, sizeof(v)); return v ? 1.0f : 0.0f; }
+    case MODBEE_CONFIG_ULONG: { unsigned long v; memcpy(&v, p, sizeof(v)); return (float)v; }
+    default:
+      if (field.size == sizeof(uint8_t)) return (float)*p;
+      { int v; memcpy(&v, p, sizeof(v)); return (float)v; }
+  }
+}
+
+static void writeField(ModbeeMpptConfigData& config, const ModbeeMpptConfigField& field, float value) {
+  uint8_t* p = reinterpret_cast<uint8_t*>(&config) + field.offset;
+  switch (field.type) {
+    case MODBEE_CONFIG_FLOAT: memcpy(p, &value, sizeof(value)); break;
+    case MODBEE_CONFIG_BOOL: { bool v = value != 0.0f; memcpy(p, &v, sizeof(v)); break; }
+    case MODBEE_CONFIG_ULONG: { unsigned long v = (unsigned long)value; memcpy(p, &v, sizeof(v)); break; }
+    default:
+      if (field.size == sizeof(uint8_t)) { *p = (uint8_t)value; break; }
+      { int v = (int)value; memcpy(p, &v, sizeof(v)); break; }
+  }
+}
+
+ModbeeMpptConfig::ModbeeMpptConfig() :
+  _initialized(false),
+  _staged(false),
+  _pendingFields(0),
+  _pendingOcvCurve(false),
+  _pendingMux(portMUX_INITIALIZER_UNLOCKED),
+  _lock(nullptr)
+{
   setDefaults();
 }
 
 bool ModbeeMpptConfig::begin() {
+  if (!_lock) _lock = xSemaphoreCreateMutex();
+  if (!_lock) return false;
+
   if (!LittleFS.begin()) {
     Serial.println("Failed to initialize LittleFS");
     return false;
@@ -68,21 +223,31 @@ bool ModbeeMpptConfig::loadConfig() {
 
 bool ModbeeMpptConfig::saveConfig() {
   if (!_initialized) return false;
-  
-  if (!validateConfig()) {
-    Serial.println("Cannot save invalid configuration");
-    return false;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  // A patch not yet committed is newer than data and must not be lost
+  bool saved = writeConfig(latest());
+  xSemaphoreGive(_lock);
+  return saved;
+}
+
+bool ModbeeMpptConfig::writeConfig(const ModbeeMpptConfigData& source) {
+  if (!_initialized) return false;
+  for (uint8_t group = CONFIG_GROUP_BATTERY; group <= CONFIG_GROUP_WIFI; group++) {
+    if (!validateFields(source, group, JsonObject())) {
+      MODBEE_LOGE("Cannot save invalid configuration");
+      return false;
+    }
   }
   
   JsonDocument doc;
-  if (!saveToJson(doc)) {
-    Serial.println("Failed to create JSON document");
+  if (!saveToJson(doc, source)) {
+    MODBEE_LOGE("Failed to create JSON document");
     return false;
   }
   
   File file = LittleFS.open(MODBEE_CONFIG_FILE, "w");
   if (!file) {
-    Serial.println("Failed to open config file for writing");
+    MODBEE_LOGE("Failed to open config file for writing");
     return false;
   }
   
@@ -90,17 +255,26 @@ bool ModbeeMpptConfig::saveConfig() {
   file.close();
   
   if (bytesWritten == 0) {
-    Serial.println("Failed to write config file");
+    MODBEE_LOGE("Failed to write config file");
     return false;
   }
   
-  Serial.printf("Configuration saved (%d bytes)\n", bytesWritten);
+  MODBEE_LOGI("Configuration saved (%u bytes)", (unsigned)bytesWritten);
   return true;
 }
 
 bool ModbeeMpptConfig::resetToDefaults() {
+  if (!_initialized) {
+    setDefaults();
+    return false;
+  }
+  // Defaults replace any patch still staged
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  _staged = false;
   setDefaults();
-  return saveConfig();
+  bool saved = writeConfig(data);
+  xSemaphoreGive(_lock);
+  return saved;
 }
 
 bool ModbeeMpptConfig::applyToMPPT(ModbeeMpptAPI& api) {
@@ -108,8 +282,10 @@ bool ModbeeMpptConfig::applyToMPPT(ModbeeMpptAPI& api) {
   
   // Battery configuration
   api.setBatteryType(data.battery_type, data.battery_cell_count);
-  api.setChargeVoltage(data.charge_voltage);
-  api.setChargeCurrent(data.charge_current);
+  if (!chargeProfileActive()) {
+    api.setChargeVoltage(data.charge_voltage);
+    api.setChargeCurrent(data.charge_current);
+  }
   api.setMinSystemVoltage(data.min_system_voltage);
   
   // Charging control
@@ -118,13 +294,22 @@ bool ModbeeMpptConfig::applyToMPPT(ModbeeMpptAPI& api) {
   api.setPrechargeCurrent(data.precharge_current);
   api.setPrechargeVoltageThreshold(data.precharge_voltage_threshold);
   
-  // Input limits & protection
-  api.setInputVoltageLimit(data.input_voltage_limit);
-  api.setInputCurrentLimit(data.input_current_limit);
+  // Input limits & protection (VINDPM belongs to the firmware tracker or the
+  // built-in MPPT while either runs: a write here would hold the input at the
+  // limit until the next VOC sample; both limits belong to the source
+  // arbiter, which applies per-input values)
+  if (!firmwareMpptActive() && !builtInMpptActive() && !sourceArbiterActive()) {
+    api.setInputVoltageLimit(data.input_voltage_limit);
+  }
+  if (!sourceArbiterActive()) {
+    api.setInputCurrentLimit(data.input_current_limit);
+  }
   api.setVACOVP(data.vac_ovp_threshold);
   
-  // Timer configuration
-  api.setFastChargeTimerEnable(data.fast_charge_timer_enable);
+  // Timer configuration (the charge profile disables the timer while floating)
+  if (!chargeProfileActive()) {
+    api.setFastChargeTimerEnable(data.fast_charge_timer_enable);
+  }
   api.setFastChargeTimer(data.fast_charge_timer);
   api.setPrechargeTimerEnable(data.precharge_timer_enable);
   api.setPrechargeTimer(data.precharge_timer);
@@ -132,15 +317,17 @@ bool ModbeeMpptConfig::applyToMPPT(ModbeeMpptAPI& api) {
   
   // MPPT configuration
   api.setMPPTVOCPercent(data.mppt_voc_percent);
-  api.setMPPTVOCDelay(data.mppt_voc_delay);
-  api.setMPPTVOCRate(data.mppt_voc_rate);
-  api.setMPPTEnable(data.mppt_enable);
+  if (!vocTunerActive()) {
+    api.setMPPTVOCDelay(data.mppt_voc_delay);
+    api.setMPPTVOCRate(data.mppt_voc_rate);
+  }
+  api.setMPPTEnable(data.mppt_enable && data.mppt_mode == MODBEE_MPPT_MODE_VOC);
   
   // Power Management & Noise Control
   api.setForwardPFM(data.pfm_forward_enable);
   api.setForwardOOA(data.ooa_forward_enable);
   
-  Serial.println("Configuration applied to MPPT successfully");
+  MODBEE_LOGD("Configuration applied to MPPT successfully");
   return true;
 }
 
@@ -151,18 +338,35 @@ void ModbeeMpptConfig::setDefaults() {
   data.charge_voltage = 12.6f;
   data.charge_current = 1.0f;
   data.min_system_voltage = 10.0f;
+  data.battery_capacity_ah = 10.0f;
+  data.soc_ekf = false;              // Coulomb counting with OCV recalibration
+  memset(&data.ocv_custom, 0, sizeof(data.ocv_custom));  // Custom batteries read linearly
   
   // Charging Control - Optimized for old batteries to prevent flickering
   data.termination_current = 0.12f;  // 120mA actual (compensated for library bug)
   data.recharge_threshold = 0.4f;    // 400mV for better hysteresis
   data.precharge_current = 0.2f;     // 200mA
   data.precharge_voltage_threshold = MODBEE_VBAT_LOWV_71_4_PERCENT;
+  data.profile_enable = false;       // Plain CC/CV charging by the chip
+  data.absorption_minutes = 120;
+  data.equalize_days = 0;
   
   // Input Limits & Protection
   data.input_voltage_limit = 22.0f;
   data.input_current_limit = 3.0f;
   data.vac_ovp_threshold = 26.0f;
   
+  // Input Source Selection
+  data.source_policy = MODBEE_SOURCE_POLICY_OFF;      // Chip picks the input
+  data.source_primary = 1;                            // VAC1 is the solar input
+  data.source_dwell_s = 60;
+  data.vac1_voltage_limit = 0.0f;                     // 0 = input limits above
+  data.vac1_current_limit = 0.0f;
+  data.vac2_voltage_limit = 0.0f;
+  data.vac2_current_limit = 0.0f;
+  data.vac1_cost = 0.0f;
+  data.vac2_cost = 0.0f;
+  
   // Timer Configuration
   data.fast_charge_timer_enable = true;
   data.fast_charge_timer = MODBEE_TIMER_12HR;
@@ -175,6 +379,8 @@ void ModbeeMpptConfig::setDefaults() {
   data.mppt_voc_delay = MODBEE_VOC_DELAY_300MS;       // 300ms delay (default)
   data.mppt_voc_rate = MODBEE_VOC_RATE_30S;           // Check VOC every 30 seconds
   data.mppt_enable = true;                            // Enable MPPT
+  data.mppt_mode = MODBEE_MPPT_MODE_VOC;              // BQ25798 built-in VOC sampling
+  data.mppt_voc_adaptive = false;                     // Static VOC rate/delay
   
   // Power Management & Noise Control
   data.pfm_forward_enable = false;                    // Disable PFM for quiet operation
@@ -184,6 +390,33 @@ void ModbeeMpptConfig::setDefaults() {
   data.battery_check_interval = 30000;  // 30 seconds
   data.soc_check_interval = 60000;      // 60 seconds
   data.config_apply_interval = 300000;  // 5 minutes default for config re-apply
+  
+  // Modbus RTU (off: the RS485 port stays free for other uses)
+  data.modbus_enable = false;
+  data.modbus_address = 1;
+  data.modbus_baud = 9600;
+  data.modbus_parity = 0;               // 8N1
+  data.modbus_master = false;
+  data.modbus_peer_first = 2;
+  data.modbus_peer_count = 0;
+  
+  // Station WiFi and MQTT (off until a broker is configured)
+  data.wifi_ssid[0] = '\0';
+  data.wifi_password[0] = '\0';
+  data.wifi_mode = MODBEE_WIFI_AP;
+  data.mqtt_enable = false;
+  data.mqtt_host[0] = '\0';
+  data.mqtt_port = 1883;
+  data.mqtt_user[0] = '\0';
+  data.mqtt_password[0] = '\0';
+  copyText(data.mqtt_topic, "modbee", sizeof(data.mqtt_topic));
+  data.mqtt_interval_s = 10;
+  data.mqtt_batch = 6;                  // One publish a minute
+  data.mqtt_keepalive_s = 60;
+  
+  // BLE in place of the WiFi AP while the battery is low
+  data.ble_mode = MODBEE_BLE_LOW_SOC;
+  data.ble_passkey[0] = '\0';          // Settings over BLE stay off until one is set
 }
 
 bool ModbeeMpptConfig::loadFromJson(const JsonDocument& doc) {
@@ -193,17 +426,37 @@ bool ModbeeMpptConfig::loadFromJson(const JsonDocument& doc) {
   data.charge_voltage = doc["battery"]["charge_voltage"] | 12.6f;
   data.charge_current = doc["battery"]["charge_current"] | 1.0f;
   data.min_system_voltage = doc["battery"]["min_system_voltage"] | 9.0f;
+  data.battery_capacity_ah = doc["battery"]["capacity_ah"] | 10.0f;
+  data.soc_ekf = doc["battery"]["soc_ekf"] | false;
+  memset(&data.ocv_custom, 0, sizeof(data.ocv_custom));
+  JsonArrayConst ocvCurve = doc["battery"]["ocv_curve"];
+  if (ocvCurve.size() == MODBEE_OCV_POINTS) {
+    for (uint8_t i = 0; i < MODBEE_OCV_POINTS; i++) data.ocv_custom.mv[i] = ocvCurve[i] | 0;
+    data.ocv_custom.tempco_uv = doc["battery"]["ocv_tempco_uv"] | 0;
+  }
   
   // Charging Control
   data.termination_current = doc["charging"]["termination_current"] | 0.12f;
   data.recharge_threshold = doc["charging"]["recharge_threshold"] | 0.4f;
   data.precharge_current = doc["charging"]["precharge_current"] | 0.8f;
   data.precharge_voltage_threshold = static_cast<modbee_vbat_lowv_t>(doc["charging"]["precharge_voltage_threshold"] | MODBEE_VBAT_LOWV_71_4_PERCENT);
+  data.profile_enable = doc["charging"]["profile_enable"] | false;
+  data.absorption_minutes = doc["charging"]["absorption_minutes"] | 120;
+  data.equalize_days = doc["charging"]["equalize_days"] | 0;
   
   // Input Limits & Protection
   data.input_voltage_limit = doc["input"]["voltage_limit"] | 22.0f;
   data.input_current_limit = doc["input"]["current_limit"] | 3.0f;
   data.vac_ovp_threshold = doc["input"]["vac_ovp_threshold"] | 26.0f;
+  data.source_policy = static_cast<modbee_source_policy_t>(doc["input"]["source_policy"] | MODBEE_SOURCE_POLICY_OFF);
+  data.source_primary = doc["input"]["source_primary"] | 1;
+  data.source_dwell_s = doc["input"]["source_dwell_s"] | 60;
+  data.vac1_voltage_limit = doc["input"]["vac1_voltage_limit"] | 0.0f;
+  data.vac1_current_limit = doc["input"]["vac1_current_limit"] | 0.0f;
+  data.vac2_voltage_limit = doc["input"]["vac2_voltage_limit"] | 0.0f;
+  data.vac2_current_limit = doc["input"]["vac2_current_limit"] | 0.0f;
+  data.vac1_cost = doc["input"]["vac1_cost"] | 0.0f;
+  data.vac2_cost = doc["input"]["vac2_cost"] | 0.0f;
   
   // Timer Configuration
   data.fast_charge_timer_enable = doc["timers"]["fast_charge_enable"] | true;
@@ -217,6 +470,8 @@ bool ModbeeMpptConfig::loadFromJson(const JsonDocument& doc) {
   data.mppt_voc_delay = static_cast<modbee_voc_delay_t>(doc["mppt"]["voc_delay"] | MODBEE_VOC_DELAY_300MS);
   data.mppt_voc_rate = static_cast<modbee_voc_rate_t>(doc["mppt"]["voc_rate"] | MODBEE_VOC_RATE_30S);
   data.mppt_enable = doc["mppt"]["enable"] | true;
+  data.mppt_mode = static_cast<modbee_mppt_mode_t>(doc["mppt"]["mode"] | MODBEE_MPPT_MODE_VOC);
+  data.mppt_voc_adaptive = doc["mppt"]["voc_adaptive"] | false;
   
   // Power Management & Noise Control
   data.pfm_forward_enable = doc["power"]["pfm_forward_enable"] | false;  // Default: disable PFM for quiet operation
@@ -227,49 +482,124 @@ bool ModbeeMpptConfig::loadFromJson(const JsonDocument& doc) {
   data.soc_check_interval = doc["intervals"]["soc_check"] | 60000UL;
   data.config_apply_interval = doc["intervals"]["config_apply"] | 60000UL;
   
+  // Modbus RTU
+  data.modbus_enable = doc["modbus"]["enable"] | false;
+  data.modbus_address = doc["modbus"]["address"] | 1;
+  data.modbus_baud = doc["modbus"]["baud"] | 9600UL;
+  data.modbus_parity = doc["modbus"]["parity"] | 0;
+  data.modbus_master = doc["modbus"]["master"] | false;
+  data.modbus_peer_first = doc["modbus"]["peerFirst"] | 2;
+  data.modbus_peer_count = doc["modbus"]["peerCount"] | 0;
+  
+  // Station WiFi and MQTT
+  loadText(data.wifi_ssid, sizeof(data.wifi_ssid), doc["wifi"]["ssid"], "");
+  loadText(data.wifi_password, sizeof(data.wifi_password), doc["wifi"]["password"], "");
+  data.wifi_mode = doc["wifi"]["mode"] | (uint8_t)MODBEE_WIFI_AP;
+  data.mqtt_enable = doc["mqtt"]["enable"] | false;
+  loadText(data.mqtt_host, sizeof(data.mqtt_host), doc["mqtt"]["host"], "");
+  data.mqtt_port = doc["mqtt"]["port"] | 1883;
+  loadText(data.mqtt_user, sizeof(data.mqtt_user), doc["mqtt"]["user"], "");
+  loadText(data.mqtt_password, sizeof(data.mqtt_password), doc["mqtt"]["password"], "");
+  loadText(data.mqtt_topic, sizeof(data.mqtt_topic), doc["mqtt"]["topic"], "modbee");
+  data.mqtt_interval_s = doc["mqtt"]["interval_s"] | 10;
+  data.mqtt_batch = doc["mqtt"]["batch"] | 6;
+  data.mqtt_keepalive_s = doc["mqtt"]["keepalive_s"] | 60;
+  
+  // BLE GATT service
+  data.ble_mode = doc["ble"]["mode"] | (uint8_t)MODBEE_BLE_LOW_SOC;
+  loadText(data.ble_passkey, sizeof(data.ble_passkey), doc["ble"]["passkey"], "");
+  
   return true;
 }
 
-bool ModbeeMpptConfig::saveToJson(JsonDocument& doc) const {
+bool ModbeeMpptConfig::saveToJson(JsonDocument& doc, const ModbeeMpptConfigData& source) const {
   // Battery Configuration
-  doc["battery"]["type"] = data.battery_type;
-  doc["battery"]["cell_count"] = data.battery_cell_count;
-  doc["battery"]["charge_voltage"] = data.charge_voltage;
-  doc["battery"]["charge_current"] = data.charge_current;
-  doc["battery"]["min_system_voltage"] = data.min_system_voltage;
+  doc["battery"]["type"] = source.battery_type;
+  doc["battery"]["cell_count"] = source.battery_cell_count;
+  doc["battery"]["charge_voltage"] = source.charge_voltage;
+  doc["battery"]["charge_current"] = source.charge_current;
+  doc["battery"]["min_system_voltage"] = source.min_system_voltage;
+  doc["battery"]["capacity_ah"] = source.battery_capacity_ah;
+  doc["battery"]["soc_ekf"] = source.soc_ekf;
+  if (ModbeeMpptOcv::isValid(source.ocv_custom)) {
+    JsonArray ocvCurve = doc["battery"]["ocv_curve"].to<JsonArray>();
+    for (uint8_t i = 0; i < MODBEE_OCV_POINTS; i++) ocvCurve.add(source.ocv_custom.mv[i]);
+    doc["battery"]["ocv_tempco_uv"] = source.ocv_custom.tempco_uv;
+  }
   
   // Charging Control
-  doc["charging"]["termination_current"] = data.termination_current;
-  doc["charging"]["recharge_threshold"] = data.recharge_threshold;
-  doc["charging"]["precharge_current"] = data.precharge_current;
-  doc["charging"]["precharge_voltage_threshold"] = data.precharge_voltage_threshold;
+  doc["charging"]["termination_current"] = source.termination_current;
+  doc["charging"]["recharge_threshold"] = source.recharge_threshold;
+  doc["charging"]["precharge_current"] = source.precharge_current;
+  doc["charging"]["precharge_voltage_threshold"] = source.precharge_voltage_threshold;
+  doc["charging"]["profile_enable"] = source.profile_enable;
+  doc["charging"]["absorption_minutes"] = source.absorption_minutes;
+  doc["charging"]["equalize_days"] = source.equalize_days;
   
   // Input Limits & Protection
-  doc["input"]["voltage_limit"] = data.input_voltage_limit;
-  doc["input"]["current_limit"] = data.input_current_limit;
-  doc["input"]["vac_ovp_threshold"] = data.vac_ovp_threshold;
+  doc["input"]["voltage_limit"] = source.input_voltage_limit;
+  doc["input"]["current_limit"] = source.input_current_limit;
+  doc["input"]["vac_ovp_threshold"] = source.vac_ovp_threshold;
+  doc["input"]["source_policy"] = source.source_policy;
+  doc["input"]["source_primary"] = source.source_primary;
+  doc["input"]["source_dwell_s"] = source.source_dwell_s;
+  doc["input"]["vac1_voltage_limit"] = source.vac1_voltage_limit;
+  doc["input"]["vac1_current_limit"] = source.vac1_current_limit;
+  doc["input"]["vac2_voltage_limit"] = source.vac2_voltage_limit;
+  doc["input"]["vac2_current_limit"] = source.vac2_current_limit;
+  doc["input"]["vac1_cost"] = source.vac1_cost;
+  doc["input"]["vac2_cost"] = source.vac2_cost;
   
   // Timer Configuration
-  doc["timers"]["fast_charge_enable"] = data.fast_charge_timer_enable;
-  doc["timers"]["fast_charge_timer"] = data.fast_charge_timer;
-  doc["timers"]["precharge_enable"] = data.precharge_timer_enable;
-  doc["timers"]["precharge_timer"] = data.precharge_timer;
-  doc["timers"]["topoff_timer"] = data.topoff_timer;
+  doc["timers"]["fast_charge_enable"] = source.fast_charge_timer_enable;
+  doc["timers"]["fast_charge_timer"] = source.fast_charge_timer;
+  doc["timers"]["precharge_enable"] = source.precharge_timer_enable;
+  doc["timers"]["precharge_timer"] = source.precharge_timer;
+  doc["timers"]["topoff_timer"] = source.topoff_timer;
   
   // MPPT Configuration
-  doc["mppt"]["voc_percent"] = data.mppt_voc_percent;
-  doc["mppt"]["voc_delay"] = data.mppt_voc_delay;
-  doc["mppt"]["voc_rate"] = data.mppt_voc_rate;
-  doc["mppt"]["enable"] = data.mppt_enable;
+  doc["mppt"]["voc_percent"] = source.mppt_voc_percent;
+  doc["mppt"]["voc_delay"] = source.mppt_voc_delay;
+  doc["mppt"]["voc_rate"] = source.mppt_voc_rate;
+  doc["mppt"]["enable"] = source.mppt_enable;
+  doc["mppt"]["mode"] = source.mppt_mode;
+  doc["mppt"]["voc_adaptive"] = source.mppt_voc_adaptive;
   
   // Power Management & Noise Control
-  doc["power"]["pfm_forward_enable"] = data.pfm_forward_enable;
-  doc["power"]["ooa_forward_enable"] = data.ooa_forward_enable;
+  doc["power"]["pfm_forward_enable"] = source.pfm_forward_enable;
+  doc["power"]["ooa_forward_enable"] = source.ooa_forward_enable;
   
   // Loop Intervals
-  doc["intervals"]["battery_check"] = data.battery_check_interval;
-  doc["intervals"]["soc_check"] = data.soc_check_interval;
-  doc["intervals"]["config_apply"] = data.config_apply_interval;
+  doc["intervals"]["battery_check"] = source.battery_check_interval;
+  doc["intervals"]["soc_check"] = source.soc_check_interval;
+  doc["intervals"]["config_apply"] = source.config_apply_interval;
+  
+  // Modbus RTU
+  doc["modbus"]["enable"] = source.modbus_enable;
+  doc["modbus"]["address"] = source.modbus_address;
+  doc["modbus"]["baud"] = source.modbus_baud;
+  doc["modbus"]["parity"] = source.modbus_parity;
+  doc["modbus"]["master"] = source.modbus_master;
+  doc["modbus"]["peerFirst"] = source.modbus_peer_first;
+  doc["modbus"]["peerCount"] = source.modbus_peer_count;
+  
+  // Station WiFi and MQTT
+  doc["wifi"]["ssid"] = source.wifi_ssid;
+  doc["wifi"]["password"] = source.wifi_password;
+  doc["wifi"]["mode"] = source.wifi_mode;
+  doc["mqtt"]["enable"] = source.mqtt_enable;
+  doc["mqtt"]["host"] = source.mqtt_host;
+  doc["mqtt"]["port"] = source.mqtt_port;
+  doc["mqtt"]["user"] = source.mqtt_user;
+  doc["mqtt"]["password"] = source.mqtt_password;
+  doc["mqtt"]["topic"] = source.mqtt_topic;
+  doc["mqtt"]["interval_s"] = source.mqtt_interval_s;
+  doc["mqtt"]["batch"] = source.mqtt_batch;
+  doc["mqtt"]["keepalive_s"] = source.mqtt_keepalive_s;
+  
+  // BLE GATT service
+  doc["ble"]["mode"] = source.ble_mode;
+  doc["ble"]["passkey"] = source.ble_passkey;
   
   // Add metadata
   doc["version"] = "1.0";
@@ -291,42 +621,97 @@ bool ModbeeMpptConfig::validateConfig() const {
          validateChargingConfig() && 
          validateInputConfig() && 
          validateTimerConfig() && 
-         validateIntervalConfig();
+         validateMPPTConfig() && 
+         validateIntervalConfig() &&
+         validateModbusConfig() &&
+         validateMqttConfig() &&
+         validateBleConfig() &&
+         validateWifiConfig();
 }
 
 bool ModbeeMpptConfig::validateBatteryConfig() const {
-  if (data.battery_cell_count < 1 || data.battery_cell_count > 4) return false;
-  if (data.charge_voltage < 3.0f || data.charge_voltage > 18.8f) return false;
-  if (data.charge_current < 0.1f || data.charge_current > 5.0f) return false;
-  if (data.min_system_voltage < 2.0f || data.min_system_voltage > 18.8f) return false;
-  return true;
+  return validateFields(data, CONFIG_GROUP_BATTERY, JsonObject());
 }
 
 bool ModbeeMpptConfig::validateChargingConfig() const {
-  if (data.termination_current < 0.04f || data.termination_current > 1.0f) return false;
-  if (data.recharge_threshold < 0.05f || data.recharge_threshold > 0.8f) return false;
-  if (data.precharge_current < 0.04f || data.precharge_current > 2.0f) return false;
-  return true;
+  return validateFields(data, CONFIG_GROUP_CHARGING, JsonObject());
 }
 
 bool ModbeeMpptConfig::validateInputConfig() const {
-  if (data.input_voltage_limit < 3.6f || data.input_voltage_limit > 22.0f) return false;
-  if (data.input_current_limit < 0.1f || data.input_current_limit > 3.25f) return false;
-  if (data.vac_ovp_threshold < 6.0f || data.vac_ovp_threshold > 26.0f) return false;
-  return true;
+  return validateFields(data, CONFIG_GROUP_INPUT, JsonObject());
 }
 
 bool ModbeeMpptConfig::validateTimerConfig() const {
-  // Enum values are inherently valid if within defined range
-  return true;
+  return validateFields(data, CONFIG_GROUP_TIMER, JsonObject());
+}
+
+bool ModbeeMpptConfig::validateMPPTConfig() const {
+  return validateFields(data, CONFIG_GROUP_MPPT, JsonObject());
 }
 
 bool ModbeeMpptConfig::validateIntervalConfig() const {
-  if (data.battery_check_interval < 1000 || data.battery_check_interval > 300000) return false;  // 1s to 5min
-  if (data.soc_check_interval < 5000 || data.soc_check_interval > 600000) return false;         // 5s to 10min
-  if (data.config_apply_interval < 1000 || data.config_apply_interval > 600000) return false;   // 1s to 10min
-  return true;
+  return validateFields(data, CONFIG_GROUP_INTERVAL, JsonObject());  // 1s..10min
+}
+
+bool ModbeeMpptConfig::validateModbusConfig() const {
+  return validateFields(data, CONFIG_GROUP_MODBUS, JsonObject());
+}
+
+bool ModbeeMpptConfig::validateMqttConfig() const {
+  return validateFields(data, CONFIG_GROUP_MQTT, JsonObject());
 }
+
+bool ModbeeMpptConfig::validateBleConfig() const {
+  return validateFields(data, CONFIG_GROUP_BLE, JsonObject());
+}
+
+bool ModbeeMpptConfig::validateWifiConfig() const {
+  return validateFields(data, CONFIG_GROUP_WIFI, JsonObject());
+}
+
+bool ModbeeMpptConfig::validateFields(const ModbeeMpptConfigData& config, uint8_t group, JsonObject errors) const {
+  bool valid = true;
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const ModbeeMpptConfigField& field = CONFIG_FIELDS[i];
+    if (field.group != group) continue;
+    float value = readField(config, field);
+    if (value < field.min || value > field.max) {
+      valid = false;
+      if (errors.isNull()) return false;
+      errors[field.key] = String("out of range (") + String(field.min, 3) + ".." + String(field.max, 3) + ")";
+    }
+  }
+  // The publisher needs somewhere to connect to
+  if (group == CONFIG_GROUP_MQTT && config.mqtt_enable) {
+    const char* missing = !config.wifi_ssid[0] ? "wifiSsid" : !config.mqtt_host[0] ? "mqttHost" : nullptr;
+    if (missing) {
+      valid = false;
+      if (errors.isNull()) return false;
+      errors[missing] = "required when MQTT is enabled";
+    }
+  }
+  // Station mode needs a network to join
+  if (group == CONFIG_GROUP_WIFI && config.wifi_mode == MODBEE_WIFI_STATION && !config.wifi_ssid[0]) {
+    valid = false;
+    if (errors.isNull()) return false;
+    errors["wifiSsid"] = "required in station mode";
+  }
+  // Wildcards are only valid in subscriptions
+  if (group == CONFIG_GROUP_MQTT && (!config.mqtt_topic[0] || strpbrk(config.mqtt_topic, "+#"))) {
+    valid = false;
+    if (errors.isNull()) return false;
+    errors["mqttTopic"] = "must be non-empty, without + or #";
+  }
+  // A BLE passkey is what the pairing dialog shows: six digits
+  if (group == CONFIG_GROUP_BLE && config.ble_passkey[0] &&
+      (strlen(config.ble_passkey) != 6 || strspn(config.ble_passkey, "0123456789") != 6)) {
+    valid = false;
+    if (errors.isNull()) return false;
+    errors["blePasskey"] = "must be empty or six digits";
+  }
+  return valid;
+}
+
 bool ModbeeMpptConfig::updateConfigApplyInterval(unsigned long interval) {
   if (interval < 1000 || interval > 600000) return false;
   data.config_apply_interval = interval;
@@ -345,7 +730,7 @@ void ModbeeMpptConfig::printConfig() const {
 
 String ModbeeMpptConfig::getConfigAsString() const {
   JsonDocument doc;
-  saveToJson(doc);
+  saveToJson(doc, data);
   String output;
   serializeJsonPretty(doc, output);
   return output;
@@ -475,25 +860,311 @@ bool ModbeeMpptConfig::updateSOCCheckInterval(unsigned long interval) {
   return saveConfig();
 }
 
-bool ModbeeMpptConfig::applySingleChange(ModbeeMpptAPI& api, const String& parameter) {
-  // Apply individual parameter changes to MPPT hardware
-  if (parameter == "charge_voltage") {
-    return api.setChargeVoltage(data.charge_voltage);
-  } else if (parameter == "charge_current") {
-    return api.setChargeCurrent(data.charge_current);
-  } else if (parameter == "termination_current") {
-    return api.setTerminationCurrent(data.termination_current);
-  } else if (parameter == "input_current_limit") {
-    return api.setInputCurrentLimit(data.input_current_limit);
-  } else if (parameter == "recharge_threshold") {
-    return api.setRechargeThreshold(data.recharge_threshold);
-  } else if (parameter == "input_voltage_limit") {
-    return api.setInputVoltageLimit(data.input_voltage_limit);
-  } else if (parameter == "mppt_voc_percent") {
-    return api.setMPPTVOCPercent(data.mppt_voc_percent);
-  } else if (parameter == "mppt_enable") {
-    return api.setMPPTEnable(data.mppt_enable);
-  }
-  // Add more parameters as needed
-  return false; // Unknown parameter
+bool ModbeeMpptConfig::applySingleChange(ModbeeMpptAPI& api, modbee_config_apply_t action) {
+  switch (action) {
+    case MODBEE_APPLY_BATTERY_TYPE:
+      return api.setBatteryType(data.battery_type, data.battery_cell_count);
+    case MODBEE_APPLY_CHARGE_VOLTAGE:
+      if (chargeProfileActive()) return true;  // Profile restarts from bulk on its next frame
+      return api.setChargeVoltage(data.charge_voltage);
+    case MODBEE_APPLY_CHARGE_CURRENT:
+      if (chargeProfileActive()) return true;
+      return api.setChargeCurrent(data.charge_current);
+    case MODBEE_APPLY_MIN_SYSTEM_VOLTAGE:
+      return api.setMinSystemVoltage(data.min_system_voltage);
+    case MODBEE_APPLY_TERMINATION_CURRENT:
+      return api.setTerminationCurrent(data.termination_current);
+    case MODBEE_APPLY_RECHARGE_THRESHOLD:
+      return api.setRechargeThreshold(data.recharge_threshold);
+    case MODBEE_APPLY_PRECHARGE_CURRENT:
+      return api.setPrechargeCurrent(data.precharge_current);
+    case MODBEE_APPLY_PRECHARGE_VOLTAGE:
+      return api.setPrechargeVoltageThreshold(data.precharge_voltage_threshold);
+    case MODBEE_APPLY_INPUT_VOLTAGE:
+      if (firmwareMpptActive()) return true;  // Tracker ceiling, used from its next step
+      if (builtInMpptActive()) return true;   // Used again when the built-in MPPT stops
+      if (sourceArbiterActive()) return true;  // Arbiter fallback, applied on its next frame
+      return api.setInputVoltageLimit(data.input_voltage_limit);
+    case MODBEE_APPLY_INPUT_CURRENT:
+      if (sourceArbiterActive()) return true;
+      return api.setInputCurrentLimit(data.input_current_limit);
+    case MODBEE_APPLY_VAC_OVP:
+      return api.setVACOVP(data.vac_ovp_threshold);
+    case MODBEE_APPLY_FAST_TIMER_ENABLE:
+      if (chargeProfileActive()) return true;
+      return api.setFastChargeTimerEnable(data.fast_charge_timer_enable);
+    case MODBEE_APPLY_FAST_TIMER:
+      return api.setFastChargeTimer(data.fast_charge_timer);
+    case MODBEE_APPLY_PRECHARGE_TIMER_ENABLE:
+      return api.setPrechargeTimerEnable(data.precharge_timer_enable);
+    case MODBEE_APPLY_PRECHARGE_TIMER:
+      return api.setPrechargeTimer(data.precharge_timer);
+    case MODBEE_APPLY_TOPOFF_TIMER:
+      return api.setTopOffTimer(data.topoff_timer);
+    case MODBEE_APPLY_VOC_PERCENT:
+      return api.setMPPTVOCPercent(data.mppt_voc_percent);
+    case MODBEE_APPLY_VOC_DELAY:
+      if (vocTunerActive()) return true;  // Used again when the tuner stops
+      return api.setMPPTVOCDelay(data.mppt_voc_delay);
+    case MODBEE_APPLY_VOC_RATE:
+      if (vocTunerActive()) return true;
+      return api.setMPPTVOCRate(data.mppt_voc_rate);
+    case MODBEE_APPLY_MPPT: {
+      // Hand VINDPM back to the config when the tracker or built-in MPPT stops
+      bool ok = api.setMPPTEnable(builtInMpptActive());
+      if (!firmwareMpptActive() && !builtInMpptActive() && !sourceArbiterActive()) {
+        ok = api.setInputVoltageLimit(data.input_voltage_limit) && ok;
+      }
+      return ok;
+    }
+    case MODBEE_APPLY_PFM_FORWARD:
+      return api.setForwardPFM(data.pfm_forward_enable);
+    case MODBEE_APPLY_OOA_FORWARD:
+      return api.setForwardOOA(data.ooa_forward_enable);
+    case MODBEE_APPLY_NONE:
+    case MODBEE_APPLY_SOC_ESTIMATOR:
+    case MODBEE_APPLY_CHARGE_PROFILE:
+    case MODBEE_APPLY_SOURCE_ARBITER:
+    case MODBEE_APPLY_VOC_TUNER:
+    case MODBEE_APPLY_MODBUS:
+    case MODBEE_APPLY_MQTT:
+    case MODBEE_APPLY_BLE:
+    case MODBEE_APPLY_WIFI:
+      return true;  // The module reads the field itself (see modbee_config_apply_t)
+    default:
+      return false;
+  }
+}
+
+const ModbeeMpptConfigField* ModbeeMpptConfig::getFields(size_t& count) {
+  count = CONFIG_FIELD_COUNT;
+  return CONFIG_FIELDS;
+}
+
+float ModbeeMpptConfig::getFieldValue(size_t index) const {
+  if (index >= CONFIG_FIELD_COUNT) return 0.0f;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  float value = readField(latest(), CONFIG_FIELDS[index]);
+  xSemaphoreGive(_lock);
+  return value;
+}
+
+const ModbeeMpptConfigText* ModbeeMpptConfig::getTexts(size_t& count) {
+  count = CONFIG_TEXT_COUNT;
+  return CONFIG_TEXTS;
+}
+
+void ModbeeMpptConfig::toSettingsJson(JsonObject settings) const {
+  // Called from the web server task right after a patch: report it even
+  // before the main loop has committed it
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  const ModbeeMpptConfigData& source = latest();
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    const ModbeeMpptConfigField& field = CONFIG_FIELDS[i];
+    float value = readField(source, field);
+    switch (field.type) {
+      case MODBEE_CONFIG_FLOAT: settings[field.key] = value; break;
+      case MODBEE_CONFIG_BOOL: settings[field.key] = value != 0.0f; break;
+      case MODBEE_CONFIG_ULONG: settings[field.key] = (unsigned long)value; break;
+      default: settings[field.key] = (int)value; break;
+    }
+  }
+  for (size_t i = 0; i < CONFIG_TEXT_COUNT; i++) {
+    const ModbeeMpptConfigText& text = CONFIG_TEXTS[i];
+    settings[text.key] = text.secret ? "" : textField(source, text);
+  }
+  xSemaphoreGive(_lock);
+}
+
+bool ModbeeMpptConfig::applyPatch(JsonVariantConst patch, JsonObject errors, JsonArray changed) {
+  if (!patch.is<JsonObjectConst>()) {
+    errors["_"] = "expected a JSON object";
+    return false;
+  }
+  // Patches come from the web server, Modbus and BLE tasks: each one is
+  // validated against, and saved over, the result of the one before, and
+  // only the main loop writes data
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  bool applied = patchLocked(patch, errors, changed);
+  xSemaphoreGive(_lock);
+  return applied;
+}
+
+bool ModbeeMpptConfig::patchLocked(JsonVariantConst patch, JsonObject errors, JsonArray changed) {
+  // Build the candidate on a copy so a rejected patch changes nothing; a
+  // staged patch the main loop has not committed yet is the starting point
+  const ModbeeMpptConfigData& base = latest();
+  ModbeeMpptConfigData candidate = base;
+  bool valid = true;
+
+  for (JsonPairConst kv : patch.as<JsonObjectConst>()) {
+    const ModbeeMpptConfigText* text = nullptr;
+    for (size_t i = 0; i < CONFIG_TEXT_COUNT; i++) {
+      if (strcmp(CONFIG_TEXTS[i].key, kv.key().c_str()) == 0) {
+        text = &CONFIG_TEXTS[i];
+        break;
+      }
+    }
+    if (text) {
+      if (kv.value().isNull()) continue;
+      if (!kv.value().is<const char*>()) {
+        errors[text->key] = "expected string";
+        valid = false;
+      } else if (strlen(kv.value().as<const char*>()) >= text->size) {
+        errors[text->key] = String("too long (max ") + String((int)text->size - 1) + ")";
+        valid = false;
+      } else {
+        copyText(textField(candidate, *text), kv.value().as<const char*>(), text->size);
+      }
+      continue;
+    }
+
+    const ModbeeMpptConfigField* field = nullptr;
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+      if (strcmp(CONFIG_FIELDS[i].key, kv.key().c_str()) == 0) {
+        field = &CONFIG_FIELDS[i];
+        break;
+      }
+    }
+    if (!field) {
+      errors[kv.key()] = "unknown field";
+      valid = false;
+      continue;
+    }
+
+    JsonVariantConst value = kv.value();
+    if (value.isNull()) continue;  // Treat null as "leave unchanged"
+    if (field->type == MODBEE_CONFIG_BOOL) {
+      if (!value.is<bool>()) {
+        errors[field->key] = "expected boolean";
+        valid = false;
+        continue;
+      }
+      writeField(candidate, *field, value.as<bool>() ? 1.0f : 0.0f);
+    } else if (field->type == MODBEE_CONFIG_FLOAT) {
+      if (!value.is<float>()) {
+        errors[field->key] = "expected number";
+        valid = false;
+        continue;
+      }
+      writeField(candidate, *field, value.as<float>());
+    } else {
+      if (!value.is<long>()) {
+        errors[field->key] = "expected integer";
+        valid = false;
+        continue;
+      }
+      long v = value.as<long>();
+      if (v < field->min || v > field->max) {
+        // Reject here, before the narrowing store can wrap the value
+        errors[field->key] = String("out of range (") + String((long)field->min) + ".." + String((long)field->max) + ")";
+        valid = false;
+        continue;
+      }
+      writeField(candidate, *field, (float)v);
+    }
+  }
+
+  // Range-check the whole candidate, reporting each offending field
+  for (uint8_t group = CONFIG_GROUP_BATTERY; group <= CONFIG_GROUP_WIFI; group++) {
+    if (!validateFields(candidate, group, errors)) valid = false;
+  }
+  if (!valid) return false;
+
+  // Commit and queue only the fields whose value actually changed
+  uint64_t changedMask = 0;
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (readField(candidate, CONFIG_FIELDS[i]) != readField(base, CONFIG_FIELDS[i])) {
+      changedMask |= (uint64_t)1 << i;
+      changed.add(CONFIG_FIELDS[i].key);
+    }
+  }
+  bool textChanged = false;
+  for (size_t i = 0; i < CONFIG_TEXT_COUNT; i++) {
+    if (strcmp(textField(candidate, CONFIG_TEXTS[i]), textField(base, CONFIG_TEXTS[i])) != 0) {
+      textChanged = true;
+      changed.add(CONFIG_TEXTS[i].key);
+    }
+  }
+  if (changedMask == 0 && !textChanged) return true;
+
+  // The main loop reads data without a lock, so the copy into it waits for
+  // commitPatch() there
+  _staging = candidate;
+  _staged = true;
+  portENTER_CRITICAL(&_pendingMux);
+  _pendingFields |= changedMask;
+  portEXIT_CRITICAL(&_pendingMux);
+
+  if (!writeConfig(_staging)) {
+    errors["_"] = "failed to save configuration";
+    return false;
+  }
+  return true;
+}
+
+bool ModbeeMpptConfig::setCustomOcvCurve(const modbee_ocv_curve_t& curve) {
+  // All zeros clears the curve
+  if (curve.mv[0] != 0 && !ModbeeMpptOcv::isValid(curve)) return false;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  if (!_staged) _staging = data;
+  _staging.ocv_custom = curve;
+  _staged = true;
+  portENTER_CRITICAL(&_pendingMux);
+  _pendingOcvCurve = true;
+  portEXIT_CRITICAL(&_pendingMux);
+  bool saved = writeConfig(_staging);
+  xSemaphoreGive(_lock);
+  return saved;
+}
+
+bool ModbeeMpptConfig::commitPatch() {
+  // Never wait on a patch in progress: the next pass commits it
+  if (!_lock || xSemaphoreTake(_lock, 0) != pdTRUE) return false;
+  bool committed = commitLocked();
+  xSemaphoreGive(_lock);
+  return committed;
+}
+
+bool ModbeeMpptConfig::commitLocked() {
+  if (!_staged) return false;
+  data = _staging;
+  _staged = false;
+  return true;
+}
+
+bool ModbeeMpptConfig::applyPendingChanges(ModbeeMpptAPI& api) {
+  // Take the queued fields together with the patch that changed them
+  if (!_lock || xSemaphoreTake(_lock, 0) != pdTRUE) return false;
+  commitLocked();
+  portENTER_CRITICAL(&_pendingMux);
+  uint64_t pending = _pendingFields;
+  bool ocvCurve = _pendingOcvCurve;
+  _pendingFields = 0;
+  _pendingOcvCurve = false;
+  portEXIT_CRITICAL(&_pendingMux);
+  xSemaphoreGive(_lock);
+
+  // A new curve moves a custom battery's voltage range
+  if (ocvCurve && data.battery_type == MODBEE_BATTERY_CUSTOM) {
+    api.setBatteryType(data.battery_type, data.battery_cell_count);
+  }
+  if (pending == 0) return ocvCurve;
+
+  // Each action once, in action order, however many of its fields changed
+  uint32_t actions = 0;
+  const char* keys[MODBEE_APPLY_COUNT] = {};
+  for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (!(pending & ((uint64_t)1 << i))) continue;
+    modbee_config_apply_t action = CONFIG_FIELDS[i].apply;
+    if (!(actions & (1UL << action))) keys[action] = CONFIG_FIELDS[i].key;
+    actions |= 1UL << action;
+  }
+  for (int action = MODBEE_APPLY_NONE + 1; action < MODBEE_APPLY_COUNT; action++) {
+    if (!(actions & (1UL << action))) continue;
+    if (!applySingleChange(api, (modbee_config_apply_t)action)) {
+      MODBEE_LOGE("Failed to apply %s", keys[action]);
+    }
+  }
+  return true;
 }
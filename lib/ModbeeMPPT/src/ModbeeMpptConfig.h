@@ -12,12 +12,33 @@
 
 #include "ModbeeMpptGlobal.h"
 #include "ModbeeMpptAPI.h"
+#include "ModbeeMpptOcv.h"
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 
 // Configuration file path
 #define MODBEE_CONFIG_FILE "/config/mppt_config.json"
 
+// Most units a Modbus master polls (fleet table size)
+#define MODBEE_MODBUS_MAX_PEERS 16
+
+// Most telemetry samples in one MQTT publish
+#define MODBEE_MQTT_MAX_BATCH 12
+
+// When the BLE GATT service or the beacon runs (ble_mode)
+typedef enum {
+  MODBEE_BLE_OFF = 0,
+  MODBEE_BLE_LOW_SOC = 1,       // Instead of the WiFi AP while SOC is below the power-save setpoint
+  MODBEE_BLE_ALWAYS = 2,
+  MODBEE_BLE_BEACON = 3         // No service: broadcast telemetry, light sleep between bursts
+} modbee_ble_mode_t;
+
+// How the web UI is reached (wifi_mode)
+typedef enum {
+  MODBEE_WIFI_AP = 0,           // Open soft AP with a captive portal
+  MODBEE_WIFI_STATION = 1       // Joins wifi_ssid, falling back to the AP if the join fails
+} modbee_wifi_mode_t;
+
 // Configuration structure for all user-adjustable parameters
 struct ModbeeMpptConfigData {
   // Battery Configuration
@@ -26,18 +47,35 @@ struct ModbeeMpptConfigData {
   float charge_voltage;
   float charge_current;
   float min_system_voltage;
+  float battery_capacity_ah;     // Nominal capacity, SOC estimator starting point
+  bool soc_ekf;                  // Kalman filter SOC instead of coulomb counting
+  modbee_ocv_curve_t ocv_custom; // Uploaded OCV curve for MODBEE_BATTERY_CUSTOM, zeros = none
   
   // Charging Control
   float termination_current;
   float recharge_threshold;
   float precharge_current;
   modbee_vbat_lowv_t precharge_voltage_threshold;
+  bool profile_enable;           // Multi-stage charge profile owns voltage/current
+  int absorption_minutes;        // Absorption time limit (0 = tail current only)
+  int equalize_days;             // Days between equalizations (0 = never)
   
   // Input Limits & Protection
   float input_voltage_limit;
   float input_current_limit;
   float vac_ovp_threshold;
   
+  // Input Source Selection (VAC1/VAC2)
+  modbee_source_policy_t source_policy;
+  uint8_t source_primary;        // Solar / primary input (1 or 2)
+  int source_dwell_s;            // Minimum time on an input before a voluntary switch
+  float vac1_voltage_limit;      // Per-input VINDPM/IINDPM, 0 = the input limits above
+  float vac1_current_limit;
+  float vac2_voltage_limit;
+  float vac2_current_limit;
+  float vac1_cost;               // Cost per kWh (any unit) for the cheapest policy
+  float vac2_cost;
+  
   // Timer Configuration
   bool fast_charge_timer_enable;
   modbee_charge_timer_t fast_charge_timer;
@@ -50,6 +88,8 @@ struct ModbeeMpptConfigData {
   modbee_voc_delay_t mppt_voc_delay;
   modbee_voc_rate_t mppt_voc_rate;
   bool mppt_enable;
+  modbee_mppt_mode_t mppt_mode;  // Chip VOC sampling or firmware P&O on VINDPM
+  bool mppt_voc_adaptive;        // Retune VOC rate/delay from input power variability
   
   // Power Management & Noise Control
   bool pfm_forward_enable;      // PFM mode for efficiency (may cause noise at light loads)
@@ -59,6 +99,101 @@ struct ModbeeMpptConfigData {
   unsigned long battery_check_interval;
   unsigned long soc_check_interval;
   unsigned long config_apply_interval; // Interval for periodic config re-application
+  
+  // Modbus RTU slave on RS485
+  bool modbus_enable;
+  uint8_t modbus_address;        // Slave address (1..247)
+  unsigned long modbus_baud;
+  uint8_t modbus_parity;         // 0 = none, 1 = even, 2 = odd
+  bool modbus_master;            // Poll the peers below instead of answering requests
+  uint8_t modbus_peer_first;     // Address of the first peer
+  uint8_t modbus_peer_count;     // Peers at consecutive addresses (0..MODBEE_MODBUS_MAX_PEERS)
+  
+  // Station-mode WiFi (MQTT uplink, and the web UI in station mode)
+  char wifi_ssid[33];
+  char wifi_password[65];
+  uint8_t wifi_mode;             // modbee_wifi_mode_t
+  
+  // MQTT telemetry publisher
+  bool mqtt_enable;
+  char mqtt_host[65];            // Broker host name or IP address
+  int mqtt_port;
+  char mqtt_user[33];            // Empty = no authentication
+  char mqtt_password[65];
+  char mqtt_topic[49];           // Topic prefix, the unit's client id is appended
+  int mqtt_interval_s;           // Seconds between telemetry samples
+  uint8_t mqtt_batch;            // Samples per publish (1..MODBEE_MQTT_MAX_BATCH)
+  int mqtt_keepalive_s;          // MQTT keep-alive, also the longest idle session
+  
+  // BLE GATT service
+  uint8_t ble_mode;              // modbee_ble_mode_t
+  char ble_passkey[7];           // Six digits to pair for the config characteristic, empty = no pairing
+};
+
+// Storage type of a configuration field
+typedef enum {
+  MODBEE_CONFIG_FLOAT = 0,
+  MODBEE_CONFIG_INT = 1,        // uint8_t or enum member
+  MODBEE_CONFIG_BOOL = 2,
+  MODBEE_CONFIG_ULONG = 3
+} modbee_config_field_type_t;
+
+// What a changed field takes to apply. applyPendingChanges() runs each
+// action once, in this order: battery type before charge voltage, so the
+// voltage is clamped against the new chemistry.
+typedef enum {
+  MODBEE_APPLY_NONE = 0,                // Read where it is used on every pass (loop intervals)
+  MODBEE_APPLY_BATTERY_TYPE,            // Type and cell count share one register write
+  MODBEE_APPLY_CHARGE_VOLTAGE,
+  MODBEE_APPLY_CHARGE_CURRENT,
+  MODBEE_APPLY_MIN_SYSTEM_VOLTAGE,
+  MODBEE_APPLY_SOC_ESTIMATOR,           // Picked up by the SOC estimator on its next frame
+  MODBEE_APPLY_TERMINATION_CURRENT,
+  MODBEE_APPLY_RECHARGE_THRESHOLD,
+  MODBEE_APPLY_PRECHARGE_CURRENT,
+  MODBEE_APPLY_PRECHARGE_VOLTAGE,
+  MODBEE_APPLY_CHARGE_PROFILE,          // Picked up by the profile engine on its next frame
+  MODBEE_APPLY_INPUT_VOLTAGE,
+  MODBEE_APPLY_INPUT_CURRENT,
+  MODBEE_APPLY_VAC_OVP,
+  MODBEE_APPLY_SOURCE_ARBITER,          // Picked up by the source arbiter on its next frame
+  MODBEE_APPLY_FAST_TIMER_ENABLE,
+  MODBEE_APPLY_FAST_TIMER,
+  MODBEE_APPLY_PRECHARGE_TIMER_ENABLE,
+  MODBEE_APPLY_PRECHARGE_TIMER,
+  MODBEE_APPLY_TOPOFF_TIMER,
+  MODBEE_APPLY_VOC_PERCENT,
+  MODBEE_APPLY_VOC_DELAY,
+  MODBEE_APPLY_VOC_RATE,
+  MODBEE_APPLY_MPPT,                    // Chip MPPT on or off, and VINDPM back to the config
+  MODBEE_APPLY_VOC_TUNER,               // Picked up by the VOC tuner on its next frame
+  MODBEE_APPLY_PFM_FORWARD,
+  MODBEE_APPLY_OOA_FORWARD,
+  MODBEE_APPLY_MODBUS,                  // The Modbus port reopens its UART on the next loop pass
+  MODBEE_APPLY_MQTT,                    // The publisher restarts its session on the next loop pass
+  MODBEE_APPLY_BLE,                     // Power save starts or stops the service on its next pass
+  MODBEE_APPLY_WIFI,                    // Used the next time the web UI starts WiFi
+  MODBEE_APPLY_COUNT
+} modbee_config_apply_t;
+
+// Describes one user-adjustable field: its settings key, range and apply action
+struct ModbeeMpptConfigField {
+  const char* key;              // Settings key (REST /api/config and web UI)
+  modbee_config_apply_t apply;  // What a change takes to apply
+  modbee_config_field_type_t type;
+  uint8_t group;                // Validation group
+  size_t offset;                // offsetof(ModbeeMpptConfigData, member)
+  size_t size;                  // sizeof(member)
+  float min;                    // Inclusive range
+  float max;
+};
+
+// Describes one text field: settings key and char array (no Modbus register)
+struct ModbeeMpptConfigText {
+  const char* key;              // Settings key (REST /api/config and web UI)
+  size_t offset;                // offsetof(ModbeeMpptConfigData, member)
+  size_t size;                  // sizeof(member), terminator included
+  bool secret;                  // Write-only: reported as "" by toSettingsJson()
 };
 
 class ModbeeMpptConfig {
@@ -72,13 +207,51 @@ public:
   bool resetToDefaults();
   
   // Direct access to config data
+  // Written only on the main loop; patches from other tasks are staged and
+  // land here in commitPatch()
   ModbeeMpptConfigData data;  // Public direct access - simple!
   
   // Apply configuration to MPPT API
   bool applyToMPPT(class ModbeeMpptAPI& api);
   
-  // Apply single configuration change to MPPT hardware
-  bool applySingleChange(class ModbeeMpptAPI& api, const String& parameter);
+  // Apply one action of changed fields to MPPT hardware (or leave it to the
+  // module that reads the field); true if it needed nothing or succeeded
+  bool applySingleChange(class ModbeeMpptAPI& api, modbee_config_apply_t action);
+  
+  // Partial update from a settings object (keys as in getSettings)
+  // Validates the whole patch before changing anything; on failure fills
+  // errors with one message per rejected key and leaves data untouched.
+  // The accepted patch is saved and staged, and reaches data on the main
+  // loop (commitPatch()); changed fields are queued for
+  // applyPendingChanges(). A null value leaves a field unchanged, which is
+  // how the web UI keeps a secret.
+  // Safe from any task: patches are applied and saved one at a time.
+  bool applyPatch(JsonVariantConst patch, JsonObject errors, JsonArray changed);
+  
+  // Copy a staged patch or OCV curve into data (main loop only); skipped,
+  // returning false, while another task is patching
+  bool commitPatch();
+  
+  // Commit, then run the apply actions of fields changed by applyPatch()
+  // (main loop only). Returns true if any field was applied
+  bool applyPendingChanges(class ModbeeMpptAPI& api);
+  
+  // Export all fields using the settings keys, staged patch included (any task)
+  void toSettingsJson(JsonObject settings) const;
+  
+  // Replace the custom battery OCV curve (validated, saved, applied by
+  // applyPendingChanges() on the main loop); all zeros clears it
+  bool setCustomOcvCurve(const modbee_ocv_curve_t& curve);
+  
+  // Field table (for protocol mappings)
+  static const ModbeeMpptConfigField* getFields(size_t& count);
+  
+  // Current value of the field at index in getFields(), as a float, staged
+  // patch included (any task)
+  float getFieldValue(size_t index) const;
+  
+  // Text field table (settings only, not mapped to registers)
+  static const ModbeeMpptConfigText* getTexts(size_t& count);
   
   // Individual parameter setters with validation
   bool setBatteryType(modbee_battery_type_t type, uint8_t cell_count);
@@ -109,6 +282,44 @@ public:
   // Configuration validation
   bool validateConfig() const;
   
+  /*!
+   * @brief True when the firmware P&O tracker owns VINDPM
+   */
+  bool firmwareMpptActive() const { return data.mppt_mode == MODBEE_MPPT_MODE_PO && data.mppt_enable; }
+  
+  /*!
+   * @brief True when the charger's built-in MPPT owns VINDPM (set from each VOC sample)
+   */
+  bool builtInMpptActive() const { return data.mppt_mode == MODBEE_MPPT_MODE_VOC && data.mppt_enable; }
+  
+  /*!
+   * @brief True when the adaptive VOC tuner owns the VOC rate/delay registers
+   */
+  bool vocTunerActive() const {
+    return data.mppt_voc_adaptive && data.mppt_enable && data.mppt_mode == MODBEE_MPPT_MODE_VOC;
+  }
+  
+  /*!
+   * @brief OCV curve for a battery type: built-in, or the uploaded custom one
+   * @return nullptr for a custom battery without a valid curve
+   */
+  const modbee_ocv_curve_t* ocvCurve(modbee_battery_type_t type) const {
+    if (type != MODBEE_BATTERY_CUSTOM) return ModbeeMpptOcv::getCurve(type);
+    return ModbeeMpptOcv::isValid(data.ocv_custom) ? &data.ocv_custom : nullptr;
+  }
+  
+  /*!
+   * @brief True when the charge profile engine owns the charge voltage/current
+   */
+  bool chargeProfileActive() const {
+    return data.profile_enable && data.battery_type != MODBEE_BATTERY_CUSTOM;
+  }
+  
+  /*!
+   * @brief True when the source arbiter owns ACDRV and the input limits
+   */
+  bool sourceArbiterActive() const { return data.source_policy != MODBEE_SOURCE_POLICY_OFF; }
+  
   // Debug and status
   void printConfig() const;
   String getConfigAsString() const;
@@ -119,7 +330,11 @@ private:
   // Internal helpers
   void setDefaults();
   bool loadFromJson(const JsonDocument& doc);
-  bool saveToJson(JsonDocument& doc) const;
+  bool saveToJson(JsonDocument& doc, const ModbeeMpptConfigData& source) const;
+  bool writeConfig(const ModbeeMpptConfigData& source); // saveConfig() with _lock held
+  bool commitLocked();          // commitPatch() with _lock held
+  const ModbeeMpptConfigData& latest() const { return _staged ? _staging : data; } // _lock held
+  bool patchLocked(JsonVariantConst patch, JsonObject errors, JsonArray changed);
   bool ensureConfigDirectory();
   
   // Validation helpers
@@ -128,6 +343,22 @@ private:
   bool validateInputConfig() const;
   bool validateTimerConfig() const;
   bool validateIntervalConfig() const;
+  bool validateMPPTConfig() const;
+  bool validateModbusConfig() const;
+  bool validateMqttConfig() const;
+  bool validateBleConfig() const;
+  bool validateWifiConfig() const;
+  bool validateFields(const ModbeeMpptConfigData& config, uint8_t group, JsonObject errors) const;
+  
+  // Patch accepted on another task, awaiting commitPatch(); guarded by _lock
+  ModbeeMpptConfigData _staging;
+  bool _staged;
+  
+  // Fields changed by applyPatch() awaiting applyPendingChanges()
+  uint64_t _pendingFields;
+  bool _pendingOcvCurve;        // setCustomOcvCurve() awaiting applyPendingChanges()
+  portMUX_TYPE _pendingMux;
+  SemaphoreHandle_t _lock;      // One patch or file write at a time, across tasks
 };
 
 #endif // MODBEE_MPPT_CONFIG_H
@@ -0,0 +1,315 @@
+/*!
+ * @file ModbeeMpptCurveTracer.cpp
+ *
+ * @brief Implementation of the I-V curve tracer and its LittleFS store
+ */
+
+#include "ModbeeMpptCurveTracer.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include <LittleFS.h>
+
+static const char* const RESULT_NONE = "none";
+static const char* const RESULT_OK = "ok";
+static const char* const RESULT_NO_INPUT = "no input";
+static const char* const RESULT_NO_LOAD = "no load";
+static const char* const RESULT_STORE_FAILED = "store failed";
+
+ModbeeMpptCurveTracer::ModbeeMpptCurveTracer(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _state(MODBEE_CURVE_IDLE),
+  _requested(false),
+  _lastResult(RESULT_NONE),
+  _savedVindpm(0.0f),
+  _savedMppt(false),
+  _stepTime(0),
+  _lastSampleTime(0),
+  _samples(0),
+  _sumV(0.0f),
+  _sumI(0.0f),
+  _vref(0.0f),
+  _step(0.0f),
+  _voc(0.0f),
+  _count(0),
+  _limited(false),
+  _nextSequence(0),
+  _mux(portMUX_INITIALIZER_UNLOCKED)
+{
+  memset(&_latest, 0, sizeof(_latest));
+}
+
+bool ModbeeMpptCurveTracer::requestTrace() {
+  if (isPending()) return false;
+  _requested = true;
+  return true;
+}
+
+uint32_t ModbeeMpptCurveTracer::firstSequence() const {
+  return _nextSequence > MODBEE_CURVE_STORE_COUNT ? _nextSequence - MODBEE_CURVE_STORE_COUNT : 0;
+}
+
+// ========================================================================
+// TRACE STATE MACHINE
+// ========================================================================
+
+void ModbeeMpptCurveTracer::loop() {
+  if (_state == MODBEE_CURVE_IDLE) {
+    if (!_requested) return;
+    // Let a firmware MPPT sweep finish first, both drive VINDPM
+    if (_mppt.tracker.getStatus().state == MODBEE_TRACKER_SWEEPING) return;
+    // And a true battery voltage measurement, which sets the ADC back to 15 bit when done
+    if (_mppt.api.isTrueBatteryVoltageBusy()) return;
+    _requested = false;
+    start();
+    return;
+  }
+
+  unsigned long now = millis();
+  unsigned long settle = (_state == MODBEE_CURVE_MEASURE_VOC) ? MODBEE_CURVE_VOC_SETTLE_MS : MODBEE_CURVE_SETTLE_MS;
+  if (now - _stepTime < settle) return;
+  if (_samples > 0 && now - _lastSampleTime < MODBEE_CURVE_SAMPLE_SPACING_MS) return;
+
+  modbee_power_data_t sample;
+  if (!_mppt.api.sampleInputPower(sample)) return;
+  _lastSampleTime = now;
+  _sumV += sample.voltage;
+  _sumI += sample.current;
+  if (++_samples < MODBEE_CURVE_SAMPLES) return;
+
+  float voltage = _sumV / _samples;
+  float current = _sumI / _samples;
+  _samples = 0;
+  _sumV = _sumI = 0.0f;
+
+  if (_state == MODBEE_CURVE_MEASURE_VOC) {
+    _voc = voltage;
+    if (voltage < MODBEE_MIN_INPUT_VOLTAGE + MODBEE_TRACKER_MIN_STEP) {
+      finish(RESULT_NO_INPUT);
+      return;
+    }
+    // Spread the points evenly from just below Voc to the minimum
+    float span = voltage - MODBEE_MIN_INPUT_VOLTAGE;
+    _step = max(MODBEE_TRACKER_MIN_STEP, ceilf(span * 10.0f / (MODBEE_CURVE_MAX_POINTS - 1)) / 10.0f);
+    _state = MODBEE_CURVE_SWEEP;
+    setVref(roundf(voltage * 10.0f) / 10.0f - _step);
+    return;
+  }
+
+  record(voltage, current);
+}
+
+void ModbeeMpptCurveTracer::start() {
+  _savedVindpm = _mppt.api.getInputVoltageLimit();
+  _savedMppt = _mppt.api.getMPPTEnable();
+  _mppt.api.setMPPTEnable(false);
+
+  // 15-bit conversions take ~24 ms per channel; 12-bit keeps the trace short
+  _mppt.api.configureADC(MODBEE_ADC_RES_12BIT, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);
+
+  _count = 0;
+  _limited = false;
+  _samples = 0;
+  _sumV = _sumI = 0.0f;
+  _state = MODBEE_CURVE_MEASURE_VOC;
+  MODBEE_LOGI("I-V trace started");
+
+  // VINDPM above any panel's Voc stops the converter drawing current
+  setVref(MODBEE_MAX_INPUT_VOLTAGE);
+}
+
+void ModbeeMpptCurveTracer::setVref(float vref) {
+  _vref = roundf(constrain(vref, MODBEE_MIN_INPUT_VOLTAGE, MODBEE_MAX_INPUT_VOLTAGE) * 10.0f) / 10.0f;
+  _mppt.api.setInputVoltageLimit(_vref);
+  _stepTime = millis();
+}
+
+void ModbeeMpptCurveTracer::record(float voltage, float current) {
+  _voltage[_count] = voltage;
+  _current[_count] = current;
+  _count++;
+
+  if (voltage > _vref + MODBEE_CURVE_LIMIT_MARGIN) {
+    // The charger's current limit holds VBUS above VINDPM; lower points
+    // would all read the same
+    _limited = true;
+    finish(RESULT_OK);
+    return;
+  }
+
+  float next = _vref - _step;
+  if (_count >= MODBEE_CURVE_MAX_POINTS || next < MODBEE_MIN_INPUT_VOLTAGE - 0.05f) {
+    finish(RESULT_OK);
+    return;
+  }
+  setVref(next);
+}
+
+void ModbeeMpptCurveTracer::finish(const char* result) {
+  _mppt.api.configureADC(MODBEE_ADC_RES_15BIT, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);
+  _mppt.api.setInputVoltageLimit(_savedVindpm);
+  _mppt.api.setMPPTEnable(_savedMppt);
+  _state = MODBEE_CURVE_IDLE;
+
+  // A charger that draws nothing (battery full, charging off) gives no curve
+  if (result == RESULT_OK && _count < 3) result = RESULT_NO_LOAD;
+  if (result != RESULT_OK) {
+    _lastResult = result;
+    MODBEE_LOGW("I-V trace failed: %s", result);
+    return;
+  }
+
+  ModbeeMpptCurveRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = MODBEE_CURVE_MAGIC;
+  record.version = MODBEE_CURVE_VERSION;
+  record.count = _count;
+  record.sequence = _nextSequence;
+  record.uptime = millis() / 1000;
+  for (uint8_t i = 0; i < _count; i++) {
+    record.points[i].voltage_mv = (uint16_t)constrain(_voltage[i] * 1000.0f, 0.0f, 65535.0f);
+    record.points[i].current_ma = (uint16_t)constrain(_current[i] * 1000.0f, 0.0f, 65535.0f);
+  }
+  fit(record);
+
+  bool stored = store(record);
+  portENTER_CRITICAL(&_mux);
+  _latest = record;
+  _nextSequence++;
+  portEXIT_CRITICAL(&_mux);
+  _lastResult = stored ? RESULT_OK : RESULT_STORE_FAILED;
+
+  MODBEE_LOGI("I-V trace %lu: Voc %.2fV Isc %.3fA Vmp %.2fV Imp %.3fA FF %.3f",
+              (unsigned long)record.sequence, record.voc_mv / 1000.0f, record.isc_ma / 1000.0f,
+              record.vmp_mv / 1000.0f, record.imp_ma / 1000.0f, record.ff_permille / 1000.0f);
+}
+
+// ========================================================================
+// PARAMETER FIT
+// ========================================================================
+
+void ModbeeMpptCurveTracer::fit(ModbeeMpptCurveRecord& record) const {
+  uint8_t best = 0;
+  for (uint8_t i = 1; i < _count; i++) {
+    if (_voltage[i] * _current[i] > _voltage[best] * _current[best]) best = i;
+  }
+  float vmp = _voltage[best];
+  float pmp = _voltage[best] * _current[best];
+
+  // Parabola through the best point and its neighbours: the sweep step is
+  // coarse, the true maximum usually lies between two points
+  if (best > 0 && best < _count - 1) {
+    float x0 = _voltage[best - 1], x1 = _voltage[best], x2 = _voltage[best + 1];
+    float p0 = x0 * _current[best - 1], p1 = pmp, p2 = x2 * _current[best + 1];
+    float denom = (x0 - x1) * (x0 - x2) * (x1 - x2);
+    if (fabsf(denom) > 1e-6f) {
+      float a = (x2 * (p1 - p0) + x1 * (p0 - p2) + x0 * (p2 - p1)) / denom;
+      float b = (x2 * x2 * (p0 - p1) + x1 * x1 * (p2 - p0) + x0 * x0 * (p1 - p2)) / denom;
+      float c = (x1 * x2 * (x1 - x2) * p0 + x2 * x0 * (x2 - x0) * p1 + x0 * x1 * (x0 - x1) * p2) / denom;
+      if (a < 0.0f) {
+        float vertex = constrain(-b / (2.0f * a), min(x0, x2), max(x0, x2));
+        float peak = (a * vertex + b) * vertex + c;
+        if (peak >= pmp) {
+          vmp = vertex;
+          pmp = peak;
+        }
+      }
+    }
+  }
+
+  // Isc: straight line through the lowest points below Voc/2, extrapolated
+  // to 0 V (the panel behaves as a current source there)
+  float isc = 0.0f;
+  for (uint8_t i = 0; i < _count; i++) isc = max(isc, _current[i]);
+  uint8_t n = 0;
+  float sumV = 0.0f, sumI = 0.0f, sumVV = 0.0f, sumVI = 0.0f;
+  for (int i = _count - 1; i >= 0 && n < 4; i--) {
+    if (_voltage[i] >= _voc * 0.5f) break;
+    sumV += _voltage[i];
+    sumI += _current[i];
+    sumVV += _voltage[i] * _voltage[i];
+    sumVI += _voltage[i] * _current[i];
+    n++;
+  }
+  float det = n * sumVV - sumV * sumV;
+  if (n >= 2 && fabsf(det) > 1e-6f) {
+    float intercept = (sumVV * sumI - sumV * sumVI) / det;
+    isc = max(isc, intercept);
+    record.flags |= MODBEE_CURVE_FLAG_ISC_FITTED;
+  }
+  if (_limited) record.flags |= MODBEE_CURVE_FLAG_CURRENT_LIMITED;
+
+  record.voc_mv = (uint16_t)(_voc * 1000.0f);
+  record.isc_ma = (uint16_t)min(isc * 1000.0f, 65535.0f);
+  record.vmp_mv = (uint16_t)(vmp * 1000.0f);
+  record.imp_ma = (uint16_t)(vmp > 0.0f ? pmp / vmp * 1000.0f : 0.0f);
+  if ((record.flags & MODBEE_CURVE_FLAG_ISC_FITTED) && isc > 0.0f) {
+    record.ff_permille = (uint16_t)constrain(pmp / (_voc * isc) * 1000.0f, 0.0f, 1000.0f);
+  }
+}
+
+// ========================================================================
+// LITTLEFS STORE
+// ========================================================================
+
+bool ModbeeMpptCurveTracer::begin() {
+  if (!LittleFS.exists(MODBEE_CURVE_FILE)) return true;
+  File file = LittleFS.open(MODBEE_CURVE_FILE, "r");
+  if (!file) return false;
+
+  // Sequence numbers survive reboots: continue after the newest slot
+  ModbeeMpptCurveRecord record;
+  bool found = false;
+  for (uint8_t slot = 0; slot < MODBEE_CURVE_STORE_COUNT; slot++) {
+    if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) break;
+    if (record.magic != MODBEE_CURVE_MAGIC || record.version != MODBEE_CURVE_VERSION) continue;
+    if (!found || record.sequence >= _latest.sequence) {
+      _latest = record;
+      found = true;
+    }
+  }
+  file.close();
+  if (found) _nextSequence = _latest.sequence + 1;
+  return true;
+}
+
+bool ModbeeMpptCurveTracer::store(const ModbeeMpptCurveRecord& record) {
+  if (!LittleFS.exists(MODBEE_CURVE_FILE)) {
+    // Allocate every slot once so later writes are in place
+    File create = LittleFS.open(MODBEE_CURVE_FILE, "w");
+    if (!create) return false;
+    ModbeeMpptCurveRecord empty;
+    memset(&empty, 0, sizeof(empty));
+    for (uint8_t slot = 0; slot < MODBEE_CURVE_STORE_COUNT; slot++) {
+      create.write((const uint8_t*)&empty, sizeof(empty));
+    }
+    create.close();
+  }
+
+  File file = LittleFS.open(MODBEE_CURVE_FILE, "r+");
+  if (!file) return false;
+  size_t offset = (record.sequence % MODBEE_CURVE_STORE_COUNT) * sizeof(record);
+  bool ok = file.seek(offset) && file.write((const uint8_t*)&record, sizeof(record)) == sizeof(record);
+  file.close();
+  return ok;
+}
+
+bool ModbeeMpptCurveTracer::readCurve(uint32_t sequence, ModbeeMpptCurveRecord& record) const {
+  if (sequence < firstSequence() || sequence >= _nextSequence) return false;
+
+  bool latest = false;
+  portENTER_CRITICAL(&_mux);
+  if (_latest.magic == MODBEE_CURVE_MAGIC && _latest.sequence == sequence) {
+    record = _latest;
+    latest = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+  if (latest) return true;
+
+  File file = LittleFS.open(MODBEE_CURVE_FILE, "r");
+  if (!file) return false;
+  bool ok = file.seek((sequence % MODBEE_CURVE_STORE_COUNT) * sizeof(record)) &&
+            file.read((uint8_t*)&record, sizeof(record)) == sizeof(record);
+  file.close();
+  return ok && record.magic == MODBEE_CURVE_MAGIC && record.version == MODBEE_CURVE_VERSION &&
+         record.sequence == sequence;
+}
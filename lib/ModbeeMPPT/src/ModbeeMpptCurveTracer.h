@@ -0,0 +1,162 @@
+/*!
+ * @file ModbeeMpptCurveTracer.h
+ *
+ * @brief On-demand PV I-V curve tracer for ModbeeMPPT
+ *
+ * A trace takes VINDPM away from the BQ25798's VOC tracking (or the
+ * firmware tracker), measures the open-circuit voltage and then steps
+ * VINDPM down until the charger's current limit takes over or the minimum
+ * input voltage is reached. The points are fitted for Isc, Voc, Vmp, Imp
+ * and fill factor, and the last MODBEE_CURVE_STORE_COUNT traces are kept in
+ * a fixed-slot binary file on LittleFS so they survive a reboot.
+ */
+
+#ifndef MODBEE_MPPT_CURVE_TRACER_H
+#define MODBEE_MPPT_CURVE_TRACER_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+
+// Points per trace and timing (ADC runs at 12 bits during a trace)
+#define MODBEE_CURVE_MAX_POINTS 48
+#define MODBEE_CURVE_SETTLE_MS 35             // About one 12-bit ADC cycle over all channels
+#define MODBEE_CURVE_VOC_SETTLE_MS 150        // VINDPM at the maximum, converter idle
+#define MODBEE_CURVE_SAMPLES 2                // Burst reads averaged per point
+#define MODBEE_CURVE_SAMPLE_SPACING_MS 30
+
+// VBUS this far above VINDPM means a current limit, not VINDPM, is regulating
+#define MODBEE_CURVE_LIMIT_MARGIN 0.3f
+
+// Stored traces (fixed slots, 216 bytes each)
+#ifndef MODBEE_CURVE_STORE_COUNT
+#define MODBEE_CURVE_STORE_COUNT 8
+#endif
+#define MODBEE_CURVE_FILE "/data/curves.bin"
+#define MODBEE_CURVE_MAGIC 0x5643             // "CV" little-endian
+#define MODBEE_CURVE_VERSION 1
+
+// Record flags
+#define MODBEE_CURVE_FLAG_CURRENT_LIMITED 0x01  // Ended at the charger's current limit
+#define MODBEE_CURVE_FLAG_ISC_FITTED 0x02       // Isc extrapolated from points below Voc/2
+
+struct __attribute__((packed)) ModbeeMpptCurvePoint {
+  uint16_t voltage_mv;
+  uint16_t current_ma;
+};
+
+// One stored trace; this is also the slot layout of MODBEE_CURVE_FILE
+// (little-endian, points from Voc downwards, unused points zero)
+struct __attribute__((packed)) ModbeeMpptCurveRecord {
+  uint16_t magic;         // MODBEE_CURVE_MAGIC
+  uint8_t version;        // MODBEE_CURVE_VERSION
+  uint8_t count;          // Valid points
+  uint32_t sequence;      // Trace number, increases across reboots
+  uint32_t uptime;        // Seconds since boot when the trace finished
+  uint16_t voc_mv;        // Open-circuit voltage
+  uint16_t isc_ma;        // Short-circuit current (largest measured if not fitted)
+  uint16_t vmp_mv;        // Maximum power point voltage
+  uint16_t imp_ma;        // Maximum power point current
+  uint16_t ff_permille;   // Fill factor x1000 (0 if Isc was not fitted)
+  uint8_t flags;          // MODBEE_CURVE_FLAG_*
+  uint8_t reserved;
+  ModbeeMpptCurvePoint points[MODBEE_CURVE_MAX_POINTS];
+};
+
+static_assert(sizeof(ModbeeMpptCurveRecord) == 24 + 4 * MODBEE_CURVE_MAX_POINTS,
+              "Curve record layout is stored on flash");
+
+typedef enum {
+  MODBEE_CURVE_IDLE = 0,
+  MODBEE_CURVE_MEASURE_VOC = 1,
+  MODBEE_CURVE_SWEEP = 2
+} modbee_curve_state_t;
+
+class ModbeeMpptCurveTracer {
+public:
+  ModbeeMpptCurveTracer(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Find the newest stored trace; call after LittleFS is mounted
+   * @return False if the store could not be read
+   */
+  bool begin();
+
+  /*!
+   * @brief Run the trace state machine; call every loop pass (non-blocking)
+   */
+  void loop();
+
+  /*!
+   * @brief Start a trace at the next loop pass
+   * @return False if a trace is already running or requested
+   */
+  bool requestTrace();
+
+  /*!
+   * @brief True while a trace is running (it owns VINDPM)
+   */
+  bool isBusy() const { return _state != MODBEE_CURVE_IDLE; }
+
+  /*!
+   * @brief True while a trace is requested or running
+   */
+  bool isPending() const { return _requested || isBusy(); }
+
+  /*!
+   * @brief Sequence number one past the newest stored trace
+   */
+  uint32_t endSequence() const { return _nextSequence; }
+
+  /*!
+   * @brief Sequence number of the oldest trace that can still be stored
+   */
+  uint32_t firstSequence() const;
+
+  /*!
+   * @brief Load a stored trace
+   * @param sequence Trace sequence number
+   * @param record Destination
+   * @return False if the trace was overwritten, never written or unreadable
+   */
+  bool readCurve(uint32_t sequence, ModbeeMpptCurveRecord& record) const;
+
+  /*!
+   * @brief Result text of the last trace ("ok", "no input", ...)
+   */
+  const char* getLastResult() const { return _lastResult; }
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_curve_state_t _state;
+  volatile bool _requested;
+  const char* _lastResult;
+
+  // Registers restored after the trace
+  float _savedVindpm;
+  bool _savedMppt;
+
+  // Working sweep
+  unsigned long _stepTime;
+  unsigned long _lastSampleTime;
+  uint8_t _samples;
+  float _sumV, _sumI;
+  float _vref, _step, _voc;
+  uint8_t _count;
+  bool _limited;
+  float _voltage[MODBEE_CURVE_MAX_POINTS];
+  float _current[MODBEE_CURVE_MAX_POINTS];
+
+  // Store
+  uint32_t _nextSequence;
+  ModbeeMpptCurveRecord _latest;        // Newest trace, served without touching flash
+  mutable portMUX_TYPE _mux;
+
+  void start();
+  void setVref(float vref);
+  void record(float voltage, float current);
+  void finish(const char* result);
+  void fit(ModbeeMpptCurveRecord& record) const;
+  bool store(const ModbeeMpptCurveRecord& record);
+};
+
+#endif // MODBEE_MPPT_CURVE_TRACER_H
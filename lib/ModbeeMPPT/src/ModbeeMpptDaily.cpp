@@ -0,0 +1,111 @@
+/*!
+ * @file ModbeeMpptDaily.cpp
+ *
+ * @brief Implementation of the daily energy rollup
+ */
+
+#include "ModbeeMpptDaily.h"
+
+ModbeeMpptDaily::ModbeeMpptDaily() :
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _completedCount(0),
+  _lastSequence(0),
+  _lastFrameMs(0),
+  _started(false)
+{
+  memset(&_completed, 0, sizeof(_completed));
+  startDay(0, false);
+}
+
+uint32_t ModbeeMpptDaily::epochNow() {
+  time_t now = time(nullptr);
+  return (unsigned long)now >= MODBEE_DAILY_EPOCH_VALID ? (uint32_t)now : 0;
+}
+
+// A day without frames reports its ranges as zero
+static void clearEmptyRanges(modbee_daily_t& day) {
+  if (day.vbatMin > day.vbatMax) day.vbatMin = day.vbatMax = 0.0f;
+  if (day.socMin > day.socMax) day.socMin = day.socMax = 0.0f;
+}
+
+void ModbeeMpptDaily::startDay(uint32_t day, bool wallClock) {
+  memset(&_today, 0, sizeof(_today));
+  _today.day = day;
+  _today.wallClock = wallClock;
+  _today.vbatMin = _today.socMin = INFINITY;
+  _today.vbatMax = _today.socMax = -INFINITY;
+}
+
+void ModbeeMpptDaily::sample(const modbee_telemetry_t& telemetry, float soc) {
+  if (!telemetry.valid || telemetry.sequence == _lastSequence) return;
+  _lastSequence = telemetry.sequence;
+
+  uint32_t epoch = epochNow();
+  bool wallClock = epoch != 0;
+  uint32_t day = wallClock ? epoch / 86400 : telemetry.timestamp_ms / 86400000UL;
+
+  portENTER_CRITICAL(&_mux);
+  if (!_started) {
+    _started = true;
+    _today.day = day;
+    _today.wallClock = wallClock;
+  } else if (wallClock && !_today.wallClock) {
+    // The clock was just set: the day so far belongs to today's date
+    _today.day = day;
+    _today.wallClock = true;
+  } else if (day != _today.day && wallClock == _today.wallClock) {
+    _completed = _today;
+    _completedCount++;
+    startDay(day, wallClock);
+  }
+
+  // Rectangle rule over the frame interval; a gap (light sleep) is skipped
+  uint32_t dtMs = _lastFrameMs ? telemetry.timestamp_ms - _lastFrameMs : 0;
+  if (dtMs > 0 && dtMs <= MODBEE_DAILY_GAP_MS) {
+    float hours = dtMs / 3600000.0f;
+    float batteryPower = telemetry.battery.power;
+    _today.seconds += (dtMs + 500) / 1000;
+    _today.inputWh += max(telemetry.vbus.power, 0.0f) * hours;
+    if (batteryPower >= 0.0f) {
+      _today.chargeWh += batteryPower * hours;
+    } else {
+      _today.dischargeWh -= batteryPower * hours;
+    }
+    _today.systemWh += max(telemetry.system.power, 0.0f) * hours;
+    if (telemetry.fault_status0 || telemetry.fault_status1) {
+      _today.faultSeconds += (dtMs + 500) / 1000;
+    }
+  }
+  _lastFrameMs = telemetry.timestamp_ms;
+
+  _today.peakInputW = max(_today.peakInputW, telemetry.vbus.power);
+  _today.vbatMin = min(_today.vbatMin, telemetry.battery.voltage);
+  _today.vbatMax = max(_today.vbatMax, telemetry.battery.voltage);
+  _today.socMin = min(_today.socMin, soc);
+  _today.socMax = max(_today.socMax, soc);
+  portEXIT_CRITICAL(&_mux);
+}
+
+modbee_daily_t ModbeeMpptDaily::today() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_daily_t copy = _today;
+  portEXIT_CRITICAL(&_mux);
+  clearEmptyRanges(copy);
+  return copy;
+}
+
+bool ModbeeMpptDaily::lastCompleted(modbee_daily_t& day) const {
+  portENTER_CRITICAL(&_mux);
+  day = _completed;
+  uint32_t count = _completedCount;
+  portEXIT_CRITICAL(&_mux);
+  clearEmptyRanges(day);
+  return count > 0;
+}
+
+uint32_t ModbeeMpptDaily::completedCount() const {
+  portENTER_CRITICAL(&_mux);
+  uint32_t count = _completedCount;
+  portEXIT_CRITICAL(&_mux);
+  return count;
+}
@@ -0,0 +1,88 @@
+/*!
+ * @file ModbeeMpptDaily.h
+ *
+ * @brief Daily energy and extremes rollup for ModbeeMPPT
+ *
+ * Integrates the 1 Hz telemetry frames into per-day totals: input, charge,
+ * discharge and system energy, peak input power, battery voltage and SOC
+ * range, and the time spent with a fault bit set. Days are UTC calendar
+ * days once the clock has been set (SNTP over the station link), 24-hour
+ * spans since boot before that; a day in progress is moved onto the
+ * calendar when the clock appears rather than cut short.
+ *
+ * The day in progress and the last completed one can be read from any
+ * task. Consumers that publish days (the MQTT client) compare
+ * completedCount() with the count they last handled.
+ */
+
+#ifndef MODBEE_MPPT_DAILY_H
+#define MODBEE_MPPT_DAILY_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+#include <time.h>
+
+#define MODBEE_DAILY_EPOCH_VALID 1700000000UL  // time() below this is not a wall clock
+#define MODBEE_DAILY_GAP_MS 10000              // Longer gaps between frames are not integrated
+
+typedef struct {
+  uint32_t day;                 // Days since 1970-01-01 UTC, or since boot without a wall clock
+  bool wallClock;               // day counts calendar days
+  uint32_t seconds;             // Time integrated
+  float inputWh;                // VBUS energy in
+  float chargeWh;               // Into the battery
+  float dischargeWh;            // Out of the battery
+  float systemWh;               // VSYS load
+  float peakInputW;
+  float vbatMin;
+  float vbatMax;
+  float socMin;                 // %
+  float socMax;
+  uint32_t faultSeconds;        // Time with a FAULT_Status bit set
+} modbee_daily_t;
+
+class ModbeeMpptDaily {
+public:
+  ModbeeMpptDaily();
+
+  /*!
+   * @brief Integrate one telemetry frame; closes the day at its boundary
+   * @param telemetry Frame from ModbeeMpptAPI::getTelemetry()
+   * @param soc Current battery SOC (%)
+   */
+  void sample(const modbee_telemetry_t& telemetry, float soc);
+
+  /*!
+   * @brief Copy of the day in progress
+   */
+  modbee_daily_t today() const;
+
+  /*!
+   * @brief Copy of the last completed day
+   * @return False if no day has completed since boot
+   */
+  bool lastCompleted(modbee_daily_t& day) const;
+
+  /*!
+   * @brief Days completed since boot
+   */
+  uint32_t completedCount() const;
+
+  /*!
+   * @brief Seconds since 1970 if the clock has been set, else 0
+   */
+  static uint32_t epochNow();
+
+private:
+  mutable portMUX_TYPE _mux;
+  modbee_daily_t _today;
+  modbee_daily_t _completed;
+  uint32_t _completedCount;
+  uint32_t _lastSequence;
+  unsigned long _lastFrameMs;
+  bool _started;
+
+  void startDay(uint32_t day, bool wallClock);
+};
+
+#endif // MODBEE_MPPT_DAILY_H
@@ -0,0 +1,164 @@
+/*!
+ * @file ModbeeMpptEventLog.cpp
+ *
+ * @brief Implementation of the leveled RAM event log
+ */
+
+#include "ModbeeMpptEventLog.h"
+#include <stdarg.h>
+
+ModbeeMpptEventLog ModbeeEventLog;
+
+static const uint32_t TOKENS_PER_LINE = 1000;
+
+ModbeeMpptEventLog::ModbeeMpptEventLog() :
+  _written(0),
+  _drained(0),
+  _level(MODBEE_LOG_LEVEL >= MODBEE_LOG_LEVEL_INFO ? MODBEE_LOG_LEVEL_INFO : MODBEE_LOG_LEVEL),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _tokens(MODBEE_LOG_BURST * TOKENS_PER_LINE),
+  _lastRefillMs(0),
+  _suppressed(0),
+  _suppressedTotal(0),
+  _overruns(0),
+  _lineLen(0),
+  _linePos(0)
+{
+  memset(_entries, 0, sizeof(_entries));
+}
+
+const char* ModbeeMpptEventLog::levelTag(uint8_t level) {
+  switch (level) {
+    case MODBEE_LOG_LEVEL_ERROR: return "E";
+    case MODBEE_LOG_LEVEL_WARN: return "W";
+    case MODBEE_LOG_LEVEL_INFO: return "I";
+    default: return "D";
+  }
+}
+
+void ModbeeMpptEventLog::setLevel(uint8_t level) {
+  _level = min(level, (uint8_t)MODBEE_LOG_LEVEL);
+}
+
+// ========================================================================
+// WRITING
+// ========================================================================
+
+void ModbeeMpptEventLog::log(uint8_t level, const char* format, ...) {
+  if (level > _level || level == MODBEE_LOG_LEVEL_NONE) return;
+
+  uint32_t now = millis();
+  uint32_t suppressed = 0;
+
+  // Token bucket; errors always get through
+  portENTER_CRITICAL(&_mux);
+  uint32_t elapsed = min(now - _lastRefillMs, (uint32_t)10000);  // Bucket is full after 2 s anyway
+  _lastRefillMs = now;
+  _tokens = min(_tokens + elapsed * MODBEE_LOG_RATE_PER_SEC, (uint32_t)MODBEE_LOG_BURST * TOKENS_PER_LINE);
+  bool allowed = level == MODBEE_LOG_LEVEL_ERROR || _tokens >= TOKENS_PER_LINE;
+  if (allowed) {
+    if (_tokens >= TOKENS_PER_LINE) _tokens -= TOKENS_PER_LINE;
+    suppressed = _suppressed;
+    _suppressed = 0;
+  } else {
+    _suppressed++;
+    _suppressedTotal++;
+  }
+  portEXIT_CRITICAL(&_mux);
+  if (!allowed) return;
+
+  char text[MODBEE_LOG_LINE_LEN];
+  if (suppressed > 0) {
+    snprintf(text, sizeof(text), "%lu messages suppressed", (unsigned long)suppressed);
+    store(MODBEE_LOG_LEVEL_WARN, now, text);
+  }
+
+  // Format outside the critical section; only the copy is locked
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  store(level, now, text);
+}
+
+void ModbeeMpptEventLog::store(uint8_t level, uint32_t timestamp, const char* text) {
+  portENTER_CRITICAL(&_mux);
+  modbee_log_entry_t& entry = _entries[_written % MODBEE_LOG_CAPACITY];
+  entry.timestamp_ms = timestamp;
+  entry.level = level;
+  size_t length = strnlen(text, sizeof(entry.text) - 1);
+  memcpy(entry.text, text, length);
+  entry.text[length] = '\0';
+  _written++;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ========================================================================
+// SERIAL DRAIN
+// ========================================================================
+
+void ModbeeMpptEventLog::drain() {
+  while (true) {
+    if (_linePos >= _lineLen) {
+      modbee_log_entry_t entry;
+      bool haveEntry = false;
+      portENTER_CRITICAL(&_mux);
+      if (_written - _drained > MODBEE_LOG_CAPACITY) {
+        // Serial fell a whole ring behind; skip to the oldest line left
+        _overruns += _written - _drained - MODBEE_LOG_CAPACITY;
+        _drained = _written - MODBEE_LOG_CAPACITY;
+      }
+      if (_drained != _written) {
+        entry = _entries[_drained % MODBEE_LOG_CAPACITY];
+        _drained++;
+        haveEntry = true;
+      }
+      portEXIT_CRITICAL(&_mux);
+      if (!haveEntry) return;
+
+      int len = snprintf(_line, sizeof(_line), "[%lu.%03lu] %s %s\n",
+                         (unsigned long)(entry.timestamp_ms / 1000),
+                         (unsigned long)(entry.timestamp_ms % 1000),
+                         levelTag(entry.level), entry.text);
+      _lineLen = (len > 0) ? min((size_t)len, sizeof(_line) - 1) : 0;
+      _linePos = 0;
+      continue;
+    }
+
+    // Write only what fits in the TX buffer right now
+    int space = Serial.availableForWrite();
+    if (space <= 0) return;
+    size_t n = min((size_t)space, (size_t)(_lineLen - _linePos));
+    _linePos += Serial.write((const uint8_t*)_line + _linePos, n);
+  }
+}
+
+// ========================================================================
+// READING
+// ========================================================================
+
+uint32_t ModbeeMpptEventLog::firstSequence() const {
+  portENTER_CRITICAL(&_mux);
+  uint32_t written = _written;
+  portEXIT_CRITICAL(&_mux);
+  return written > MODBEE_LOG_CAPACITY ? written - MODBEE_LOG_CAPACITY : 0;
+}
+
+uint32_t ModbeeMpptEventLog::endSequence() const {
+  portENTER_CRITICAL(&_mux);
+  uint32_t written = _written;
+  portEXIT_CRITICAL(&_mux);
+  return written;
+}
+
+bool ModbeeMpptEventLog::read(uint32_t sequence, modbee_log_entry_t& entry) const {
+  bool ok = false;
+  portENTER_CRITICAL(&_mux);
+  uint32_t first = _written > MODBEE_LOG_CAPACITY ? _written - MODBEE_LOG_CAPACITY : 0;
+  if (sequence >= first && sequence < _written) {
+    entry = _entries[sequence % MODBEE_LOG_CAPACITY];
+    ok = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return ok;
+}
@@ -0,0 +1,154 @@
+/*!
+ * @file ModbeeMpptEventLog.h
+ *
+ * @brief Leveled, rate-limited RAM log for ModbeeMPPT
+ *
+ * Messages are formatted by the caller into a fixed-size ring and written
+ * to Serial later from the main loop, only as far as the Serial TX buffer
+ * has room. Logging therefore never waits on the UART/USB link, from either
+ * the loop task or the async_tcp task. The web debug page reads the same
+ * ring over the WebSocket.
+ */
+
+#ifndef MODBEE_MPPT_EVENT_LOG_H
+#define MODBEE_MPPT_EVENT_LOG_H
+
+#include "ModbeeMpptGlobal.h"
+
+// Log levels (lower = more severe)
+#define MODBEE_LOG_LEVEL_NONE  0
+#define MODBEE_LOG_LEVEL_ERROR 1
+#define MODBEE_LOG_LEVEL_WARN  2
+#define MODBEE_LOG_LEVEL_INFO  3
+#define MODBEE_LOG_LEVEL_DEBUG 4
+
+// Compile-time filter: calls above this level compile to nothing
+#ifndef MODBEE_LOG_LEVEL
+#define MODBEE_LOG_LEVEL MODBEE_LOG_LEVEL_DEBUG
+#endif
+
+// Ring size in lines and maximum line length (including terminator)
+#ifndef MODBEE_LOG_CAPACITY
+#define MODBEE_LOG_CAPACITY 64
+#endif
+#define MODBEE_LOG_LINE_LEN 96
+
+// Rate limit: sustained lines per second and burst size (errors are exempt)
+#ifndef MODBEE_LOG_RATE_PER_SEC
+#define MODBEE_LOG_RATE_PER_SEC 20
+#endif
+#define MODBEE_LOG_BURST 40
+
+// One log line as stored in the ring
+typedef struct {
+  uint32_t timestamp_ms;
+  uint8_t level;
+  char text[MODBEE_LOG_LINE_LEN];
+} modbee_log_entry_t;
+
+class ModbeeMpptEventLog {
+public:
+  ModbeeMpptEventLog();
+
+  /*!
+   * @brief Format a message into the ring (never blocks on Serial)
+   * @param level MODBEE_LOG_LEVEL_* of the message
+   * @param format printf-style format
+   */
+  void log(uint8_t level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+  /*!
+   * @brief Write pending lines to Serial without blocking; call from loop()
+   */
+  void drain();
+
+  /*!
+   * @brief Set the runtime level (cannot exceed MODBEE_LOG_LEVEL)
+   * @param level MODBEE_LOG_LEVEL_* value
+   */
+  void setLevel(uint8_t level);
+  uint8_t getLevel() const { return _level; }
+
+  /*!
+   * @brief Sequence number of the oldest line still in the ring
+   */
+  uint32_t firstSequence() const;
+
+  /*!
+   * @brief Sequence number one past the newest line
+   */
+  uint32_t endSequence() const;
+
+  /*!
+   * @brief Copy a line out of the ring
+   * @param sequence Line sequence number
+   * @param entry Destination
+   * @return False if the line was overwritten or not yet written
+   */
+  bool read(uint32_t sequence, modbee_log_entry_t& entry) const;
+
+  /*!
+   * @brief Lines dropped by the rate limiter since boot
+   */
+  uint32_t getSuppressedCount() const { return _suppressedTotal; }
+
+  /*!
+   * @brief Lines overwritten before they could be written to Serial
+   */
+  uint32_t getOverrunCount() const { return _overruns; }
+
+  /*!
+   * @brief Single-letter tag for a level ("E", "W", "I", "D")
+   */
+  static const char* levelTag(uint8_t level);
+
+private:
+  modbee_log_entry_t _entries[MODBEE_LOG_CAPACITY];
+  uint32_t _written;                  // Total lines ever stored
+  uint32_t _drained;                  // Next line to write to Serial
+  volatile uint8_t _level;
+  mutable portMUX_TYPE _mux;
+
+  // Token bucket for rate limiting
+  uint32_t _tokens;                   // Fixed point, 1000 per line
+  uint32_t _lastRefillMs;
+  uint32_t _suppressed;               // Suppressed since the last notice
+  uint32_t _suppressedTotal;
+  uint32_t _overruns;
+
+  // Serial line currently being written
+  char _line[MODBEE_LOG_LINE_LEN + 24];
+  uint8_t _lineLen;
+  uint8_t _linePos;
+
+  void store(uint8_t level, uint32_t timestamp, const char* text);
+};
+
+// Shared event log instance (like Serial)
+extern ModbeeMpptEventLog ModbeeEventLog;
+
+#if MODBEE_LOG_LEVEL >= MODBEE_LOG_LEVEL_ERROR
+#define MODBEE_LOGE(...) ModbeeEventLog.log(MODBEE_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define MODBEE_LOGE(...) do {} while (0)
+#endif
+
+#if MODBEE_LOG_LEVEL >= MODBEE_LOG_LEVEL_WARN
+#define MODBEE_LOGW(...) ModbeeEventLog.log(MODBEE_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define MODBEE_LOGW(...) do {} while (0)
+#endif
+
+#if MODBEE_LOG_LEVEL >= MODBEE_LOG_LEVEL_INFO
+#define MODBEE_LOGI(...) ModbeeEventLog.log(MODBEE_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define MODBEE_LOGI(...) do {} while (0)
+#endif
+
+#if MODBEE_LOG_LEVEL >= MODBEE_LOG_LEVEL_DEBUG
+#define MODBEE_LOGD(...) ModbeeEventLog.log(MODBEE_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define MODBEE_LOGD(...) do {} while (0)
+#endif
+
+#endif // MODBEE_MPPT_EVENT_LOG_H
@@ -0,0 +1,37 @@
+/*!
+ * @file ModbeeMpptHash.h
+ *
+ * @brief FNV-1a hash of settings text
+ *
+ * The station and the MQTT publisher keep a hash of the credentials and
+ * host names they last used, to notice a change on the next pass and to
+ * match the station's RTC cache to its network. Not a cryptographic hash.
+ */
+
+#ifndef MODBEE_MPPT_HASH_H
+#define MODBEE_MPPT_HASH_H
+
+#include <stdint.h>
+
+namespace ModbeeMpptHash {
+
+constexpr uint32_t SEED = 2166136261UL;    // FNV-1a offset basis
+constexpr uint32_t PRIME = 16777619UL;
+
+/*!
+ * @brief Continue a hash over text, including its terminator
+ *
+ * The terminator separates chained strings, so "ab" then "c" hashes
+ * differently from "a" then "bc".
+ */
+inline uint32_t text(uint32_t hash, const char* text) {
+  do {
+    hash ^= (uint8_t)*text;
+    hash *= PRIME;
+  } while (*text++);
+  return hash;
+}
+
+} // namespace ModbeeMpptHash
+
+#endif // MODBEE_MPPT_HASH_H
@@ -0,0 +1,443 @@
+/*!
+ * @file ModbeeMpptHistory.cpp
+ *
+ * @brief Implementation of the telemetry history tiers and their stream encoder
+ */
+
+#include "ModbeeMpptHistory.h"
+#include "ModbeeMpptEventLog.h"
+
+#define ROLLUP_MAGIC 0x48524C31  // "1LRH"
+
+// Seconds since boot from the 64-bit timer, which unlike millis() does not wrap
+static uint32_t uptimeSeconds() {
+  return (uint32_t)(esp_timer_get_time() / 1000000LL);
+}
+
+static uint16_t toMilliUnsigned(float value) {
+  float scaled = value * 1000.0f;
+  if (scaled <= 0.0f) return 0;
+  if (scaled >= 65535.0f) return 65535;
+  return (uint16_t)lroundf(scaled);
+}
+
+static int16_t toMilliSigned(float value) {
+  float scaled = value * 1000.0f;
+  if (scaled <= -32768.0f) return -32768;
+  if (scaled >= 32767.0f) return 32767;
+  return (int16_t)lroundf(scaled);
+}
+
+// ========================================================================
+// SOURCE
+// ========================================================================
+
+size_t ModbeeMpptHistorySource::readBlock(uint32_t sequence, ModbeeMpptHistoryRecord* records,
+                                          size_t count) const {
+  size_t n = 0;
+  while (n < count && read(sequence + n, records[n])) n++;
+  return n;
+}
+
+uint32_t ModbeeMpptHistorySource::findSequence(uint32_t timestamp) const {
+  // Records are committed in time order, so binary search the live window
+  uint32_t lo = firstSequence();
+  uint32_t hi = endSequence();
+  ModbeeMpptHistoryRecord record;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (read(mid, record) && record.timestamp >= timestamp) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// ========================================================================
+// HOURLY ROLLUP
+// ========================================================================
+
+ModbeeMpptHistoryRollup::ModbeeMpptHistoryRollup() :
+  _base(0),
+  _ready(false),
+  _lock(nullptr),
+  _sumVbus(0), _sumIbus(0), _sumVbat(0), _sumIbat(0), _sumVsys(0),
+  _records(0)
+{
+  _header.magic = ROLLUP_MAGIC;
+  _header.written = 0;
+}
+
+bool ModbeeMpptHistoryRollup::begin() {
+  if (!_lock) _lock = xSemaphoreCreateMutex();
+  if (!_lock) return false;
+  _ready = true;
+  if (!LittleFS.exists(MODBEE_HISTORY_ROLLUP_FILE)) return true;  // Created by the first rollup
+
+  File file = LittleFS.open(MODBEE_HISTORY_ROLLUP_FILE, "r");
+  Header header;
+  bool valid = file && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+               header.magic == ROLLUP_MAGIC &&
+               file.size() >= sizeof(Header) + (size_t)min(header.written, (uint32_t)MODBEE_HISTORY_ROLLUP_CAPACITY) *
+                                                   sizeof(ModbeeMpptHistoryRecord);
+  file.close();
+  if (!valid) {
+    MODBEE_LOGW("History rollup file invalid, starting empty");
+    LittleFS.remove(MODBEE_HISTORY_ROLLUP_FILE);
+    return false;
+  }
+  _header = header;
+
+  // This boot's timeline continues from the newest record
+  ModbeeMpptHistoryRecord newest;
+  if (_header.written && read(_header.written - 1, newest)) _base = newest.timestamp;
+  MODBEE_LOGI("History rollup: %lu hourly records", (unsigned long)(endSequence() - firstSequence()));
+  return true;
+}
+
+File ModbeeMpptHistoryRollup::open() {
+  if (LittleFS.exists(MODBEE_HISTORY_ROLLUP_FILE)) return LittleFS.open(MODBEE_HISTORY_ROLLUP_FILE, "r+");
+  if (!LittleFS.exists("/history")) LittleFS.mkdir("/history");
+  File file = LittleFS.open(MODBEE_HISTORY_ROLLUP_FILE, "w+");
+  if (file) saveHeader(file);
+  return file;
+}
+
+bool ModbeeMpptHistoryRollup::saveHeader(File& file) {
+  return file.seek(0) && file.write((const uint8_t*)&_header, sizeof(_header)) == sizeof(_header);
+}
+
+void ModbeeMpptHistoryRollup::clear() {
+  _records = 0;
+  if (!_ready) return;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  _header.written = 0;
+  LittleFS.remove(MODBEE_HISTORY_ROLLUP_FILE);
+  xSemaphoreGive(_lock);
+}
+
+uint32_t ModbeeMpptHistoryRollup::clock() const {
+  return _base + uptimeSeconds();
+}
+
+void ModbeeMpptHistoryRollup::add(const ModbeeMpptHistoryRecord& minute) {
+  if (_records == 0) _sumVbus = _sumIbus = _sumVbat = _sumIbat = _sumVsys = 0;
+  _sumVbus += minute.vbus_mv;
+  _sumIbus += minute.ibus_ma;
+  _sumVbat += minute.vbat_mv;
+  _sumIbat += minute.ibat_ma;
+  _sumVsys += minute.vsys_mv;
+  if (++_records >= MODBEE_HISTORY_ROLLUP_RECORDS) {
+    commit(minute);
+    _records = 0;
+  }
+}
+
+void ModbeeMpptHistoryRollup::commit(const ModbeeMpptHistoryRecord& last) {
+  ModbeeMpptHistoryRecord record;
+  record.timestamp = _base + last.timestamp;
+  record.vbus_mv = (uint16_t)(_sumVbus / _records);
+  record.ibus_ma = (int16_t)(_sumIbus / _records);
+  record.vbat_mv = (uint16_t)(_sumVbat / _records);
+  record.ibat_ma = (int16_t)(_sumIbat / _records);
+  record.vsys_mv = (uint16_t)(_sumVsys / _records);
+  record.soc = last.soc;
+  record.charge_state = last.charge_state;
+  if (!_ready) return;
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  File file = open();
+  uint32_t position = _header.written % MODBEE_HISTORY_ROLLUP_CAPACITY;
+  bool written = file && file.seek(sizeof(Header) + position * sizeof(record)) &&
+                 file.write((const uint8_t*)&record, sizeof(record)) == sizeof(record);
+  if (written) {
+    _header.written++;
+    written = saveHeader(file);
+  }
+  file.close();
+  xSemaphoreGive(_lock);
+  if (!written) MODBEE_LOGE("History rollup write failed");
+}
+
+uint32_t ModbeeMpptHistoryRollup::firstSequence() const {
+  uint32_t written = endSequence();
+  return written > MODBEE_HISTORY_ROLLUP_CAPACITY ? written - MODBEE_HISTORY_ROLLUP_CAPACITY : 0;
+}
+
+uint32_t ModbeeMpptHistoryRollup::endSequence() const {
+  if (!_ready) return 0;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  uint32_t written = _header.written;
+  xSemaphoreGive(_lock);
+  return written;
+}
+
+bool ModbeeMpptHistoryRollup::read(uint32_t sequence, ModbeeMpptHistoryRecord& record) const {
+  return readBlock(sequence, &record, 1) == 1;
+}
+
+size_t ModbeeMpptHistoryRollup::readBlock(uint32_t sequence, ModbeeMpptHistoryRecord* records,
+                                          size_t count) const {
+  if (!_ready) return 0;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  uint32_t written = _header.written;
+  uint32_t first = written > MODBEE_HISTORY_ROLLUP_CAPACITY ? written - MODBEE_HISTORY_ROLLUP_CAPACITY : 0;
+  size_t n = 0;
+  if (sequence >= first && sequence < written) {
+    // One run: up to the newest record or the end of the file, whichever is first
+    uint32_t position = sequence % MODBEE_HISTORY_ROLLUP_CAPACITY;
+    n = min(count, (size_t)min(written - sequence, (uint32_t)MODBEE_HISTORY_ROLLUP_CAPACITY - position));
+    File file = LittleFS.open(MODBEE_HISTORY_ROLLUP_FILE, "r");
+    size_t bytes = n * sizeof(ModbeeMpptHistoryRecord);
+    if (!file || !file.seek(sizeof(Header) + position * sizeof(ModbeeMpptHistoryRecord)) ||
+        file.read((uint8_t*)records, bytes) != bytes) {
+      n = 0;
+    }
+    file.close();
+  }
+  xSemaphoreGive(_lock);
+  return n;
+}
+
+// ========================================================================
+// HISTORY RING
+// ========================================================================
+
+ModbeeMpptHistory::ModbeeMpptHistory() :
+  _written(0),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _lastTelemetrySequence(0)
+{
+  memset(_records, 0, sizeof(_records));
+  resetAccumulators();
+}
+
+bool ModbeeMpptHistory::begin() {
+  return rollup.begin();
+}
+
+void ModbeeMpptHistory::resetAccumulators() {
+  _intervalStartMs = millis();
+  _sumVbus = _sumIbus = _sumVbat = _sumIbat = _sumVsys = 0.0f;
+  _samples = 0;
+}
+
+void ModbeeMpptHistory::clear() {
+  portENTER_CRITICAL(&_mux);
+  _written = 0;
+  portEXIT_CRITICAL(&_mux);
+  resetAccumulators();
+}
+
+void ModbeeMpptHistory::sample(const modbee_telemetry_t& telemetry, float soc) {
+  // Ignore frames we've already seen (loop may run faster than updateStats)
+  if (!telemetry.valid || telemetry.sequence == _lastTelemetrySequence) return;
+  _lastTelemetrySequence = telemetry.sequence;
+
+  _sumVbus += telemetry.vbus.voltage;
+  _sumIbus += telemetry.vbus.current;
+  _sumVbat += telemetry.battery.voltage;
+  _sumIbat += telemetry.battery.current;
+  _sumVsys += telemetry.system.voltage;
+  _samples++;
+
+  if (millis() - _intervalStartMs >= MODBEE_HISTORY_INTERVAL_MS) {
+    commit(telemetry, soc);
+    resetAccumulators();
+  }
+}
+
+void ModbeeMpptHistory::commit(const modbee_telemetry_t& telemetry, float soc) {
+  ModbeeMpptHistoryRecord record;
+  float n = (float)_samples;
+  record.timestamp = uptimeSeconds();
+  record.vbus_mv = toMilliUnsigned(_sumVbus / n);
+  record.ibus_ma = toMilliSigned(_sumIbus / n);
+  record.vbat_mv = toMilliUnsigned(_sumVbat / n);
+  record.ibat_ma = toMilliSigned(_sumIbat / n);
+  record.vsys_mv = toMilliUnsigned(_sumVsys / n);
+  record.soc = (uint8_t)constrain(lroundf(soc), 0L, 100L);
+  record.charge_state = (uint8_t)telemetry.charge_state;
+
+  portENTER_CRITICAL(&_mux);
+  _records[_written % MODBEE_HISTORY_CAPACITY] = record;
+  _written++;
+  portEXIT_CRITICAL(&_mux);
+
+  rollup.add(record);
+}
+
+uint32_t ModbeeMpptHistory::firstSequence() const {
+  portENTER_CRITICAL(&_mux);
+  uint32_t written = _written;
+  portEXIT_CRITICAL(&_mux);
+  return written > MODBEE_HISTORY_CAPACITY ? written - MODBEE_HISTORY_CAPACITY : 0;
+}
+
+uint32_t ModbeeMpptHistory::endSequence() const {
+  portENTER_CRITICAL(&_mux);
+  uint32_t written = _written;
+  portEXIT_CRITICAL(&_mux);
+  return written;
+}
+
+bool ModbeeMpptHistory::read(uint32_t sequence, ModbeeMpptHistoryRecord& record) const {
+  bool ok = false;
+  portENTER_CRITICAL(&_mux);
+  uint32_t first = _written > MODBEE_HISTORY_CAPACITY ? _written - MODBEE_HISTORY_CAPACITY : 0;
+  if (sequence >= first && sequence < _written) {
+    record = _records[sequence % MODBEE_HISTORY_CAPACITY];
+    ok = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return ok;
+}
+
+// ========================================================================
+// STREAMING ENCODER
+// ========================================================================
+
+static const char HISTORY_CSV_HEADER[] =
+  "timestamp,vbus_mv,ibus_ma,vbat_mv,ibat_ma,vsys_mv,soc,charge_state\n";
+
+// MessagePack integer encoders (smallest representation)
+static size_t packUint(uint8_t* p, uint32_t v) {
+  if (v < 0x80) { p[0] = (uint8_t)v; return 1; }
+  if (v <= 0xFF) { p[0] = 0xCC; p[1] = (uint8_t)v; return 2; }
+  if (v <= 0xFFFF) { p[0] = 0xCD; p[1] = v >> 8; p[2] = v & 0xFF; return 3; }
+  p[0] = 0xCE; p[1] = v >> 24; p[2] = (v >> 16) & 0xFF; p[3] = (v >> 8) & 0xFF; p[4] = v & 0xFF;
+  return 5;
+}
+
+static size_t packInt(uint8_t* p, int32_t v) {
+  if (v >= 0) return packUint(p, (uint32_t)v);
+  if (v >= -32) { p[0] = (uint8_t)(int8_t)v; return 1; }
+  if (v >= -128) { p[0] = 0xD0; p[1] = (uint8_t)(int8_t)v; return 2; }
+  uint16_t u = (uint16_t)(int16_t)v;  // History values are at most 16-bit
+  p[0] = 0xD1; p[1] = u >> 8; p[2] = u & 0xFF;
+  return 3;
+}
+
+ModbeeMpptHistoryStream::ModbeeMpptHistoryStream(const ModbeeMpptHistorySource& history,
+                                                 modbee_history_format_t format,
+                                                 uint32_t from, uint32_t to) :
+  _history(history),
+  _format(format),
+  _headerDone(format == MODBEE_HISTORY_BIN),
+  _blockStart(0),
+  _blockCount(0),
+  _stagingLen(0),
+  _stagingPos(0)
+{
+  _start = history.findSequence(from);
+  _end = (to == UINT32_MAX) ? history.endSequence() : history.findSequence(to + 1);
+  if (_end < _start) _end = _start;
+  _next = _start;
+}
+
+void ModbeeMpptHistoryStream::seekBinary(size_t offset) {
+  if (_format != MODBEE_HISTORY_BIN) return;
+  size_t recordSize = sizeof(ModbeeMpptHistoryRecord);
+  _next = _start + (uint32_t)(offset / recordSize);
+  if (_next > _end) _next = _end;
+  _blockCount = 0;
+  _stagingLen = _stagingPos = 0;
+  if (offset % recordSize && stageNext()) {
+    _stagingPos = offset % recordSize;
+  }
+}
+
+size_t ModbeeMpptHistoryStream::fill(uint8_t* buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (_stagingPos >= _stagingLen && !stageNext()) break;
+    size_t n = min(maxLen - written, (size_t)(_stagingLen - _stagingPos));
+    memcpy(buffer + written, _staging + _stagingPos, n);
+    _stagingPos += n;
+    written += n;
+  }
+  return written;
+}
+
+bool ModbeeMpptHistoryStream::fetch(uint32_t sequence, ModbeeMpptHistoryRecord& record) {
+  if (sequence < _blockStart || sequence >= _blockStart + _blockCount) {
+    _blockStart = sequence;
+    _blockCount = (uint8_t)_history.readBlock(sequence, _block,
+                                              min((size_t)MODBEE_HISTORY_STREAM_BLOCK, (size_t)(_end - sequence)));
+    if (_blockCount == 0) return false;
+  }
+  record = _block[sequence - _blockStart];
+  return true;
+}
+
+bool ModbeeMpptHistoryStream::stageNext() {
+  _stagingPos = 0;
+  _stagingLen = 0;
+
+  if (!_headerDone) {
+    _headerDone = true;
+    if (_format == MODBEE_HISTORY_CSV) {
+      memcpy(_staging, HISTORY_CSV_HEADER, sizeof(HISTORY_CSV_HEADER) - 1);
+      _stagingLen = sizeof(HISTORY_CSV_HEADER) - 1;
+    } else {
+      // array32 header with the record count fixed at request time
+      uint32_t count = recordCount();
+      _staging[0] = 0xDD;
+      _staging[1] = count >> 24;
+      _staging[2] = (count >> 16) & 0xFF;
+      _staging[3] = (count >> 8) & 0xFF;
+      _staging[4] = count & 0xFF;
+      _stagingLen = 5;
+    }
+    return true;
+  }
+
+  while (_next < _end) {
+    ModbeeMpptHistoryRecord record;
+    if (!fetch(_next++, record)) {
+      // Overwritten while streaming: CSV drops the row, fixed-size formats
+      // emit a zeroed record (timestamp 0) so lengths and counts still hold
+      if (_format == MODBEE_HISTORY_CSV) continue;
+      memset(&record, 0, sizeof(record));
+    }
+
+    switch (_format) {
+      case MODBEE_HISTORY_CSV:
+        _stagingLen = encodeCsv(record);
+        break;
+      case MODBEE_HISTORY_MSGPACK:
+        _stagingLen = encodeMsgPack(record);
+        break;
+      default:
+        memcpy(_staging, &record, sizeof(record));
+        _stagingLen = sizeof(record);
+        break;
+    }
+    return true;
+  }
+  return false;
+}
+
+size_t ModbeeMpptHistoryStream::encodeCsv(const ModbeeMpptHistoryRecord& record) {
+  int len = snprintf((char*)_staging, sizeof(_staging), "%lu,%u,%d,%u,%d,%u,%u,%u\n",
+                     (unsigned long)record.timestamp, record.vbus_mv, record.ibus_ma,
+                     record.vbat_mv, record.ibat_ma, record.vsys_mv, record.soc,
+                     record.charge_state);
+  return (len > 0 && len < (int)sizeof(_staging)) ? (size_t)len : 0;
+}
+
+size_t ModbeeMpptHistoryStream::encodeMsgPack(const ModbeeMpptHistoryRecord& record) {
+  uint8_t* p = _staging;
+  *p++ = 0x98;  // fixarray of 8 fields, same order as the CSV columns
+  p += packUint(p, record.timestamp);
+  p += packUint(p, record.vbus_mv);
+  p += packInt(p, record.ibus_ma);
+  p += packUint(p, record.vbat_mv);
+  p += packInt(p, record.ibat_ma);
+  p += packUint(p, record.vsys_mv);
+  p += packUint(p, record.soc);
+  p += packUint(p, record.charge_state);
+  return p - _staging;
+}
@@ -0,0 +1,266 @@
+/*!
+ * @file ModbeeMpptHistory.h
+ *
+ * @brief Telemetry history for ModbeeMPPT in two tiers
+ *
+ * - 1m: 1-minute averages of the 1 Hz telemetry frames, in a RAM ring
+ *   (ModbeeMpptHistory). Timestamps are seconds since boot.
+ * - 1h: hourly rollups of those records, in a ring file on LittleFS
+ *   (ModbeeMpptHistoryRollup) that keeps a year across reboots.
+ *   Timestamps are seconds of logged time: each boot's uptime continues
+ *   from the newest record, so they keep increasing, but the time the
+ *   board was off is not counted.
+ *
+ * ModbeeMpptHistoryStream encodes a time range of either tier as CSV,
+ * MessagePack or raw binary a few bytes at a time, so the web server can
+ * stream any range with constant memory.
+ */
+
+#ifndef MODBEE_MPPT_HISTORY_H
+#define MODBEE_MPPT_HISTORY_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+#include <LittleFS.h>
+
+// Ring capacity in records (1440 = 24 hours of 1-minute records, 23 KB)
+#ifndef MODBEE_HISTORY_CAPACITY
+#define MODBEE_HISTORY_CAPACITY 1440
+#endif
+
+// Averaging interval for one record
+#define MODBEE_HISTORY_INTERVAL_MS 60000UL
+
+// Rollup ring capacity in records (8784 = 366 days of hourly records, 137 KB)
+#ifndef MODBEE_HISTORY_ROLLUP_CAPACITY
+#define MODBEE_HISTORY_ROLLUP_CAPACITY 8784
+#endif
+
+#define MODBEE_HISTORY_ROLLUP_RECORDS 60   // 1-minute records per hourly record
+#define MODBEE_HISTORY_ROLLUP_FILE "/history/1h.bin"
+#define MODBEE_HISTORY_STREAM_BLOCK 16     // Records a stream reads at a time
+
+// One packed record of either tier; this is also the on-the-wire "bin"
+// format (little-endian, 16 bytes per record, no header)
+struct __attribute__((packed)) ModbeeMpptHistoryRecord {
+  uint32_t timestamp;     // End of the interval (seconds, on the tier's timeline)
+  uint16_t vbus_mv;       // Mean VBUS voltage (mV)
+  int16_t ibus_ma;        // Mean VBUS current (mA)
+  uint16_t vbat_mv;       // Mean battery voltage (mV)
+  int16_t ibat_ma;        // Mean battery current (mA, positive = charging)
+  uint16_t vsys_mv;       // Mean system voltage (mV)
+  uint8_t soc;            // Battery SOC at the end of the interval (%)
+  uint8_t charge_state;   // modbee_charge_state_t at the end of the interval
+};
+
+static_assert(sizeof(ModbeeMpptHistoryRecord) == 16, "History record must stay 16 bytes");
+
+// Output formats understood by ModbeeMpptHistoryStream
+typedef enum {
+  MODBEE_HISTORY_CSV = 0,
+  MODBEE_HISTORY_MSGPACK = 1,
+  MODBEE_HISTORY_BIN = 2
+} modbee_history_format_t;
+
+/*!
+ * @brief A tier of records in time order, addressed by sequence number
+ */
+class ModbeeMpptHistorySource {
+public:
+  virtual ~ModbeeMpptHistorySource() {}
+
+  /*!
+   * @brief Sequence number of the oldest record still kept
+   */
+  virtual uint32_t firstSequence() const = 0;
+
+  /*!
+   * @brief Sequence number one past the newest record
+   */
+  virtual uint32_t endSequence() const = 0;
+
+  /*!
+   * @brief Copy a record out
+   * @param sequence Record sequence number
+   * @param record Destination
+   * @return False if the record was overwritten or not yet written
+   */
+  virtual bool read(uint32_t sequence, ModbeeMpptHistoryRecord& record) const = 0;
+
+  /*!
+   * @brief Copy consecutive records out
+   * @param sequence Sequence number of the first record
+   * @param records Destination, count records
+   * @param count Records wanted
+   * @return Records copied; stops at the first that is not kept
+   */
+  virtual size_t readBlock(uint32_t sequence, ModbeeMpptHistoryRecord* records, size_t count) const;
+
+  /*!
+   * @brief Find the first record with timestamp >= the given time
+   * @param timestamp Seconds, on the tier's timeline
+   * @return Sequence number, endSequence() if none
+   */
+  uint32_t findSequence(uint32_t timestamp) const;
+};
+
+/*!
+ * @brief Hourly rollups in a ring file on LittleFS
+ *
+ * The file holds a header and MODBEE_HISTORY_ROLLUP_CAPACITY records. A
+ * record is written once an hour, before the header, so a power cut loses
+ * at most the hour in progress. Writes (main loop) and reads (web server
+ * and BLE streams) take a mutex, as they use the file from different tasks.
+ */
+class ModbeeMpptHistoryRollup : public ModbeeMpptHistorySource {
+public:
+  ModbeeMpptHistoryRollup();
+
+  /*!
+   * @brief Open the ring file, starting empty if it is invalid
+   */
+  bool begin();
+
+  /*!
+   * @brief Add a 1-minute record; writes an hourly record every MODBEE_HISTORY_ROLLUP_RECORDS
+   */
+  void add(const ModbeeMpptHistoryRecord& minute);
+
+  /*!
+   * @brief Delete the file and the hour in progress
+   */
+  void clear();
+
+  /*!
+   * @brief Now on this tier's timeline (seconds)
+   */
+  uint32_t clock() const;
+
+  uint32_t firstSequence() const override;
+  uint32_t endSequence() const override;
+  bool read(uint32_t sequence, ModbeeMpptHistoryRecord& record) const override;
+  size_t readBlock(uint32_t sequence, ModbeeMpptHistoryRecord* records, size_t count) const override;
+
+private:
+  struct Header {
+    uint32_t magic;
+    uint32_t written;             // Total records ever written
+  };
+
+  Header _header;
+  uint32_t _base;                 // Timeline at this boot: the newest record's timestamp
+  bool _ready;
+  SemaphoreHandle_t _lock;
+
+  // Hour in progress
+  int32_t _sumVbus, _sumIbus, _sumVbat, _sumIbat, _sumVsys;
+  uint8_t _records;
+
+  File open();
+  bool saveHeader(File& file);
+  void commit(const ModbeeMpptHistoryRecord& last);
+};
+
+class ModbeeMpptHistory : public ModbeeMpptHistorySource {
+public:
+  ModbeeMpptHistory();
+
+  ModbeeMpptHistoryRollup rollup;     // 1h tier, fed from this one
+
+  /*!
+   * @brief Open the 1h tier (after LittleFS is mounted)
+   */
+  bool begin();
+
+  /*!
+   * @brief Accumulate one telemetry frame; commits a record every interval
+   * @param telemetry Frame from ModbeeMpptAPI::getTelemetry()
+   * @param soc Current battery SOC (%)
+   */
+  void sample(const modbee_telemetry_t& telemetry, float soc);
+
+  /*!
+   * @brief Drop all records and the partial interval
+   */
+  void clear();
+
+  uint32_t firstSequence() const override;
+  uint32_t endSequence() const override;
+  bool read(uint32_t sequence, ModbeeMpptHistoryRecord& record) const override;
+
+private:
+  ModbeeMpptHistoryRecord _records[MODBEE_HISTORY_CAPACITY];
+  uint32_t _written;                  // Total records ever committed
+  mutable portMUX_TYPE _mux;
+
+  // Current interval accumulators
+  unsigned long _intervalStartMs;
+  float _sumVbus, _sumIbus, _sumVbat, _sumIbat, _sumVsys;
+  uint16_t _samples;
+  uint32_t _lastTelemetrySequence;
+
+  void commit(const modbee_telemetry_t& telemetry, float soc);
+  void resetAccumulators();
+};
+
+class ModbeeMpptHistoryStream {
+public:
+  /*!
+   * @brief Prepare a stream over the records in [from, to]
+   * @param history Source tier
+   * @param format Output format
+   * @param from First timestamp (inclusive, on the tier's timeline)
+   * @param to Last timestamp (inclusive)
+   */
+  ModbeeMpptHistoryStream(const ModbeeMpptHistorySource& history, modbee_history_format_t format,
+                          uint32_t from, uint32_t to);
+
+  /*!
+   * @brief Number of records selected when the stream was created
+   */
+  uint32_t recordCount() const { return _end - _start; }
+
+  /*!
+   * @brief Total encoded length in bytes (binary format only)
+   */
+  size_t binaryLength() const { return (size_t)recordCount() * sizeof(ModbeeMpptHistoryRecord); }
+
+  /*!
+   * @brief Skip to a byte offset of the binary output (for HTTP Range requests)
+   * @param offset Byte offset into the binary output
+   */
+  void seekBinary(size_t offset);
+
+  /*!
+   * @brief Fill the next part of the encoded output
+   * @param buffer Destination buffer
+   * @param maxLen Space available
+   * @return Bytes written, 0 once the stream is complete
+   */
+  size_t fill(uint8_t* buffer, size_t maxLen);
+
+private:
+  const ModbeeMpptHistorySource& _history;
+  modbee_history_format_t _format;
+  uint32_t _start;
+  uint32_t _end;
+  uint32_t _next;                     // Next record to encode
+  bool _headerDone;
+
+  // Records read ahead from the source, one file access per block
+  ModbeeMpptHistoryRecord _block[MODBEE_HISTORY_STREAM_BLOCK];
+  uint32_t _blockStart;
+  uint8_t _blockCount;
+
+  // Staging for the item currently being copied out
+  uint8_t _staging[96];
+  uint8_t _stagingLen;
+  uint8_t _stagingPos;
+
+  bool fetch(uint32_t sequence, ModbeeMpptHistoryRecord& record);
+  bool stageNext();
+  size_t encodeCsv(const ModbeeMpptHistoryRecord& record);
+  size_t encodeMsgPack(const ModbeeMpptHistoryRecord& record);
+};
+
+#endif // MODBEE_MPPT_HISTORY_H
@@ -0,0 +1,349 @@
+/*!
+ * @file ModbeeMpptMetrics.cpp
+ *
+ * @brief Implementation of the OpenMetrics exposition and loop timing
+ */
+
+#include "ModbeeMpptMetrics.h"
+#include "ModbeeMPPT.h"
+#include <stdarg.h>
+
+const uint32_t ModbeeMpptMetrics::LOOP_BUCKET_BOUNDS_US[MODBEE_LOOP_BUCKET_COUNT] = {
+  100, 500, 1000, 2000, 5000, 10000, 50000, 100000
+};
+
+// ========================================================================
+// LOOP TIMING
+// ========================================================================
+
+ModbeeMpptMetrics::ModbeeMpptMetrics() :
+  _mux(portMUX_INITIALIZER_UNLOCKED)
+{
+  memset(&_loop, 0, sizeof(_loop));
+}
+
+void ModbeeMpptMetrics::recordLoopTime(uint32_t duration_us) {
+  uint8_t bucket = 0;
+  while (bucket < MODBEE_LOOP_BUCKET_COUNT && duration_us > LOOP_BUCKET_BOUNDS_US[bucket]) {
+    bucket++;
+  }
+
+  portENTER_CRITICAL(&_mux);
+  _loop.buckets[bucket]++;
+  _loop.count++;
+  _loop.sum_us += duration_us;
+  if (duration_us > _loop.max_us) _loop.max_us = duration_us;
+  portEXIT_CRITICAL(&_mux);
+}
+
+modbee_loop_histogram_t ModbeeMpptMetrics::getLoopHistogram() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_loop_histogram_t copy = _loop;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+// ========================================================================
+// OPENMETRICS STREAM
+// ========================================================================
+
+// Label values shared by the energy and peak power families
+static const char* const ENERGY_DOMAINS[6] = {
+  "vin1", "vin2", "vbus", "battery_charge", "battery_discharge", "system"
+};
+
+static const char* const CHARGE_STATE_NAMES[8] = {
+  "not_charging", "trickle", "precharge", "fast_cc",
+  "taper_cv", "reserved", "topoff", "done"
+};
+
+// FAULT_Status_0 / FAULT_Status_1 bit names (nullptr = reserved bit)
+static const char* const FAULT0_NAMES[8] = {
+  "vac1_ovp", "vac2_ovp", "converter_ocp", "ibat_ocp",
+  "ibus_ocp", "vbat_ovp", "vbus_ovp", "ibat_regulation"
+};
+static const char* const FAULT1_NAMES[8] = {
+  nullptr, nullptr, "thermal_shutdown", nullptr,
+  "otg_uvp", "otg_ovp", "vsys_ovp", "vsys_short"
+};
+
+// Per-peer fleet families (Modbus master mode), rendered after the local ones
+enum {
+  FLEET_UP,
+  FLEET_INPUT_POWER,
+  FLEET_BATTERY_POWER,
+  FLEET_BATTERY_VOLTAGE,
+  FLEET_SOC,
+  FLEET_FAULT,
+  FLEET_ENERGY,
+  FLEET_POLLS,
+  FLEET_TIMEOUTS,
+  FLEET_ERRORS,
+  FLEET_RESPONSE,
+  FLEET_FAMILY_COUNT
+};
+
+static const struct {
+  const char* name;
+  const char* type;
+  const char* help;
+  uint8_t decimals;
+} FLEET_FAMILIES[FLEET_FAMILY_COUNT] = {
+  {"modbee_fleet_up", "gauge", "Peer answering polls", 0},
+  {"modbee_fleet_input_power_watts", "gauge", "Peer input power", 3},
+  {"modbee_fleet_battery_power_watts", "gauge", "Peer battery power (positive = charging)", 3},
+  {"modbee_fleet_battery_voltage_volts", "gauge", "Peer battery voltage", 3},
+  {"modbee_fleet_battery_soc_ratio", "gauge", "Peer state of charge", 4},
+  {"modbee_fleet_fault_active", "gauge", "Peer has a fault bit set", 0},
+  {"modbee_fleet_energy_joules", "counter", "Peer input energy seen by this master", 1},
+  {"modbee_fleet_polls", "counter", "Requests sent to the peer", 0},
+  {"modbee_fleet_timeouts", "counter", "Polls the peer did not answer in time", 0},
+  {"modbee_fleet_errors", "counter", "Bad or exception replies from the peer", 0},
+  {"modbee_fleet_response_seconds", "gauge", "Smoothed peer response time", 6}
+};
+
+#define METRICS_FLEET_FIRST 12               // Family number of FLEET_UP
+#define METRICS_FLEET_UNITS_PER_STAGE 8      // Peers per staging buffer fill
+
+ModbeeMpptMetricsStream::ModbeeMpptMetricsStream(ModbeeMPPT& mppt) :
+  _family(0),
+  _fleetUnit(0),
+  _stagingLen(0),
+  _stagingPos(0)
+{
+  ModbeeMpptAPI& api = mppt.api;
+  _telemetry = api.getTelemetry();
+  _loop = mppt.metrics.getLoopHistogram();
+  _soc = mppt._cachedSOC;
+
+  _energyWh[0] = api.getVin1TotalEnergyWh();
+  _energyWh[1] = api.getVin2TotalEnergyWh();
+  _energyWh[2] = api.getVbusTotalEnergyWh();
+  _energyWh[3] = api.getBatteryTotalEnergyWh();
+  _energyWh[4] = api.getBatteryWattHoursDischarge();
+  _energyWh[5] = api.getSystemTotalEnergyWh();
+
+  _peakPower[0] = api.getVin1PeakPower();
+  _peakPower[1] = api.getVin2PeakPower();
+  _peakPower[2] = api.getVbusPeakPower();
+  _peakPower[3] = api.getBatteryPeakPower();
+  _peakPower[4] = api.getBatteryPeakDischargePower();
+  _peakPower[5] = api.getSystemPeakPower();
+
+  _ampHoursCharge = api.getBatteryAmpHoursCharge();
+  _ampHoursDischarge = api.getBatteryAmpHoursDischarge();
+  _peakChargeAmps = api.getBatteryPeakChargeAmps();
+  _peakDischargeAmps = api.getBatteryPeakDischargeAmps();
+
+  _i2cTransactions = mppt._bq25798.getI2CTransactionCount();
+  _i2cErrors = mppt._bq25798.getI2CErrorCount();
+  _freeHeap = ESP.getFreeHeap();
+  _now = millis();
+
+  _fleet = mppt.modbus.master.getSummary();
+  _fleetCount = _fleet.running ? mppt.modbus.master.getUnits(_fleetUnits) : 0;
+}
+
+size_t ModbeeMpptMetricsStream::fill(uint8_t* buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (_stagingPos >= _stagingLen && !stageNext()) break;
+    size_t n = min(maxLen - written, _stagingLen - _stagingPos);
+    memcpy(buffer + written, _staging + _stagingPos, n);
+    _stagingPos += n;
+    written += n;
+  }
+  return written;
+}
+
+void ModbeeMpptMetricsStream::appendf(const char* format, ...) {
+  if (_stagingLen >= sizeof(_staging) - 1) return;
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(_staging + _stagingLen, sizeof(_staging) - _stagingLen, format, args);
+  va_end(args);
+  if (n > 0) {
+    _stagingLen = min(_stagingLen + (size_t)n, sizeof(_staging) - 1);
+  }
+}
+
+void ModbeeMpptMetricsStream::header(const char* name, const char* type, const char* help) {
+  appendf("# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+bool ModbeeMpptMetricsStream::stageNext() {
+  _stagingLen = 0;
+  _stagingPos = 0;
+
+  const modbee_telemetry_t& t = _telemetry;
+
+  // Render one metric family per call so the staging buffer stays small
+  uint8_t family = _family++;
+  switch (family) {
+    case 0:
+      header("modbee_uptime_seconds", "gauge", "Time since boot");
+      appendf("modbee_uptime_seconds %.3f\n", _now / 1000.0f);
+      header("modbee_heap_free_bytes", "gauge", "Free heap");
+      appendf("modbee_heap_free_bytes %lu\n", (unsigned long)_freeHeap);
+      header("modbee_telemetry_age_seconds", "gauge", "Age of the cached ADC frame");
+      appendf("modbee_telemetry_age_seconds %.3f\n",
+              t.valid ? (_now - t.timestamp_ms) / 1000.0f : -1.0f);
+      break;
+
+    case 1:
+    case 2:
+    case 3: {
+      // Voltage, current and power families share the domain list
+      const modbee_power_data_t* domains[5] = {&t.vbus, &t.battery, &t.system, &t.vac1, &t.vac2};
+      const char* names[5] = {"vbus", "battery", "system", "vac1", "vac2"};
+      uint8_t quantity = family - 1;
+      if (quantity == 0) {
+        header("modbee_voltage_volts", "gauge", "ADC voltage per power domain");
+      } else if (quantity == 1) {
+        header("modbee_current_amperes", "gauge", "Current per power domain (battery positive = charging)");
+      } else {
+        header("modbee_power_watts", "gauge", "Power per power domain");
+      }
+      for (uint8_t i = 0; i < 5; i++) {
+        if (quantity == 0) {
+          appendf("modbee_voltage_volts{domain=\"%s\"} %.3f\n", names[i], domains[i]->voltage);
+        } else if (quantity == 1) {
+          appendf("modbee_current_amperes{domain=\"%s\"} %.3f\n", names[i], domains[i]->current);
+        } else {
+          appendf("modbee_power_watts{domain=\"%s\"} %.3f\n", names[i], domains[i]->power);
+        }
+      }
+      break;
+    }
+
+    case 4:
+      header("modbee_temperature_celsius", "gauge", "Temperature sensors");
+      appendf("modbee_temperature_celsius{sensor=\"die\"} %.1f\n", t.die_temperature);
+      appendf("modbee_temperature_celsius{sensor=\"battery\"} %.1f\n", t.battery_temperature);
+      header("modbee_battery_soc_ratio", "gauge", "Battery state of charge");
+      appendf("modbee_battery_soc_ratio %.4f\n", _soc / 100.0f);
+      break;
+
+    case 5:
+      header("modbee_energy_joules", "counter", "Lifetime energy per domain");
+      for (uint8_t i = 0; i < 6; i++) {
+        appendf("modbee_energy_joules_total{domain=\"%s\"} %.1f\n", ENERGY_DOMAINS[i], _energyWh[i] * 3600.0f);
+      }
+      header("modbee_battery_charge_coulombs", "counter", "Lifetime battery charge moved");
+      appendf("modbee_battery_charge_coulombs_total{direction=\"charge\"} %.1f\n", _ampHoursCharge * 3600.0f);
+      appendf("modbee_battery_charge_coulombs_total{direction=\"discharge\"} %.1f\n", _ampHoursDischarge * 3600.0f);
+      break;
+
+    case 6:
+      header("modbee_peak_power_watts", "gauge", "Peak power per domain since last reset");
+      for (uint8_t i = 0; i < 6; i++) {
+        appendf("modbee_peak_power_watts{domain=\"%s\"} %.3f\n", ENERGY_DOMAINS[i], _peakPower[i]);
+      }
+      header("modbee_battery_peak_current_amperes", "gauge", "Peak battery current since last reset");
+      appendf("modbee_battery_peak_current_amperes{direction=\"charge\"} %.3f\n", _peakChargeAmps);
+      appendf("modbee_battery_peak_current_amperes{direction=\"discharge\"} %.3f\n", _peakDischargeAmps);
+      break;
+
+    case 7:
+      header("modbee_charge_state", "stateset", "BQ25798 charge state");
+      for (uint8_t i = 0; i < 8; i++) {
+        appendf("modbee_charge_state{modbee_charge_state=\"%s\"} %d\n",
+                CHARGE_STATE_NAMES[i], (t.valid && t.charge_state == i) ? 1 : 0);
+      }
+      break;
+
+    case 8:
+      header("modbee_fault_active", "gauge", "BQ25798 fault status bits");
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        appendf("modbee_fault_active{register=\"0\",fault=\"%s\"} %d\n",
+                FAULT0_NAMES[bit], (t.fault_status0 >> bit) & 0x01);
+      }
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        if (!FAULT1_NAMES[bit]) continue;
+        appendf("modbee_fault_active{register=\"1\",fault=\"%s\"} %d\n",
+                FAULT1_NAMES[bit], (t.fault_status1 >> bit) & 0x01);
+      }
+      break;
+
+    case 9: {
+      header("modbee_loop_duration_seconds", "histogram", "Main loop pass duration");
+      uint32_t cumulative = 0;
+      for (uint8_t i = 0; i < MODBEE_LOOP_BUCKET_COUNT; i++) {
+        cumulative += _loop.buckets[i];
+        appendf("modbee_loop_duration_seconds_bucket{le=\"%g\"} %lu\n",
+                ModbeeMpptMetrics::LOOP_BUCKET_BOUNDS_US[i] / 1e6, (unsigned long)cumulative);
+      }
+      appendf("modbee_loop_duration_seconds_bucket{le=\"+Inf\"} %lu\n", (unsigned long)_loop.count);
+      appendf("modbee_loop_duration_seconds_count %lu\n", (unsigned long)_loop.count);
+      appendf("modbee_loop_duration_seconds_sum %.6f\n", _loop.sum_us / 1e6);
+      header("modbee_loop_duration_max_seconds", "gauge", "Longest main loop pass since boot");
+      appendf("modbee_loop_duration_max_seconds %.6f\n", _loop.max_us / 1e6);
+      break;
+    }
+
+    case 10:
+      header("modbee_i2c_transactions", "counter", "BQ25798 I2C transactions");
+      appendf("modbee_i2c_transactions_total %lu\n", (unsigned long)_i2cTransactions);
+      header("modbee_i2c_errors", "counter", "Failed BQ25798 I2C transactions");
+      appendf("modbee_i2c_errors_total %lu\n", (unsigned long)_i2cErrors);
+      break;
+
+    case 11:
+      if (!_fleet.running) break;
+      header("modbee_fleet_units_online", "gauge", "Units answering, this one included");
+      appendf("modbee_fleet_units_online %u\n", (unsigned)_fleet.online);
+      header("modbee_fleet_poll_cycles", "counter", "Completed Modbus poll cycles");
+      appendf("modbee_fleet_poll_cycles_total %lu\n", (unsigned long)_fleet.cycles);
+      header("modbee_fleet_poll_cycle_seconds", "gauge", "Duration of the last poll cycle");
+      appendf("modbee_fleet_poll_cycle_seconds %.6f\n", _fleet.cycleUs / 1e6);
+      break;
+
+    default:
+      if (family < METRICS_FLEET_FIRST + FLEET_FAMILY_COUNT) {
+        // Stay on this family until all peers are out
+        if (!stageFleetFamily(family - METRICS_FLEET_FIRST)) _family = family;
+        break;
+      }
+      if (family == METRICS_FLEET_FIRST + FLEET_FAMILY_COUNT) {
+        appendf("# EOF\n");
+        break;
+      }
+      return false;
+  }
+  return true;
+}
+
+bool ModbeeMpptMetricsStream::stageFleetFamily(uint8_t index) {
+  if (_fleetCount == 0) return true;
+  const char* name = FLEET_FAMILIES[index].name;
+  bool counter = !strcmp(FLEET_FAMILIES[index].type, "counter");
+  if (_fleetUnit == 0) header(name, FLEET_FAMILIES[index].type, FLEET_FAMILIES[index].help);
+
+  size_t end = min(_fleetCount, (size_t)_fleetUnit + METRICS_FLEET_UNITS_PER_STAGE);
+  for (; _fleetUnit < end; _fleetUnit++) {
+    const modbee_fleet_unit_t& unit = _fleetUnits[_fleetUnit];
+    double value;
+    switch (index) {
+      case FLEET_UP: value = unit.online ? 1 : 0; break;
+      case FLEET_INPUT_POWER: value = unit.inputPower; break;
+      case FLEET_BATTERY_POWER: value = unit.batteryPower; break;
+      case FLEET_BATTERY_VOLTAGE: value = unit.batteryVoltage; break;
+      case FLEET_SOC: value = unit.soc / 100.0; break;
+      case FLEET_FAULT: value = unit.faults ? 1 : 0; break;
+      case FLEET_ENERGY: value = unit.energyWh * 3600.0; break;
+      case FLEET_POLLS: value = unit.polls; break;
+      case FLEET_TIMEOUTS: value = unit.timeouts; break;
+      case FLEET_ERRORS: value = unit.errors; break;
+      default: value = unit.srttUs / 1e6; break;
+    }
+    // Values that never arrived are left out rather than exposed as zero
+    if (!unit.valid && index >= FLEET_INPUT_POWER && index <= FLEET_ENERGY) continue;
+    if (index == FLEET_RESPONSE && unit.srttUs == 0) continue;
+    appendf("%s%s{unit=\"%u\"} %.*f\n", name, counter ? "_total" : "", (unsigned)unit.address,
+            FLEET_FAMILIES[index].decimals, value);
+  }
+
+  if (_fleetUnit < _fleetCount) return false;
+  _fleetUnit = 0;
+  return true;
+}
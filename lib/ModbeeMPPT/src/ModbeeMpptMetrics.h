@@ -0,0 +1,101 @@
+/*!
+ * @file ModbeeMpptMetrics.h
+ *
+ * @brief OpenMetrics exposition and loop timing for ModbeeMPPT
+ *
+ * ModbeeMpptMetrics records main loop durations into a fixed histogram.
+ * ModbeeMpptMetricsStream snapshots the cached telemetry, lifetime stats
+ * and counters once, then renders the OpenMetrics text one metric family
+ * at a time into a small staging buffer for a chunked HTTP response. It
+ * never touches the I2C bus.
+ */
+
+#ifndef MODBEE_MPPT_METRICS_H
+#define MODBEE_MPPT_METRICS_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+#include "ModbeeMpptModbusMaster.h"
+
+// Number of finite loop duration buckets (plus the implicit +Inf bucket)
+#define MODBEE_LOOP_BUCKET_COUNT 8
+
+// Loop duration histogram (non-cumulative bucket counts)
+typedef struct {
+  uint32_t buckets[MODBEE_LOOP_BUCKET_COUNT + 1];
+  uint32_t count;
+  uint64_t sum_us;
+  uint32_t max_us;
+} modbee_loop_histogram_t;
+
+class ModbeeMpptMetrics {
+public:
+  ModbeeMpptMetrics();
+
+  /*!
+   * @brief Record one pass of ModbeeMPPT::loop()
+   * @param duration_us Loop duration in microseconds
+   */
+  void recordLoopTime(uint32_t duration_us);
+
+  /*!
+   * @brief Get a consistent copy of the loop histogram
+   */
+  modbee_loop_histogram_t getLoopHistogram() const;
+
+  // Upper bounds of the finite buckets in microseconds
+  static const uint32_t LOOP_BUCKET_BOUNDS_US[MODBEE_LOOP_BUCKET_COUNT];
+
+private:
+  modbee_loop_histogram_t _loop;
+  mutable portMUX_TYPE _mux;
+};
+
+class ModbeeMpptMetricsStream {
+public:
+  /*!
+   * @brief Snapshot all values to expose
+   * @param mppt Controller to read cached values from
+   */
+  ModbeeMpptMetricsStream(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Fill the next part of the exposition
+   * @param buffer Destination buffer
+   * @param maxLen Space available
+   * @return Bytes written, 0 once "# EOF" has been sent
+   */
+  size_t fill(uint8_t* buffer, size_t maxLen);
+
+private:
+  // Snapshot taken at construction
+  modbee_telemetry_t _telemetry;
+  modbee_loop_histogram_t _loop;
+  float _soc;
+  float _energyWh[6];
+  float _peakPower[6];
+  float _ampHoursCharge;
+  float _ampHoursDischarge;
+  float _peakChargeAmps;
+  float _peakDischargeAmps;
+  uint32_t _i2cTransactions;
+  uint32_t _i2cErrors;
+  uint32_t _freeHeap;
+  unsigned long _now;
+  modbee_fleet_summary_t _fleet;
+  modbee_fleet_unit_t _fleetUnits[MODBEE_MODBUS_MAX_PEERS];
+  size_t _fleetCount;
+
+  uint8_t _family;                    // Next metric family to render
+  uint8_t _fleetUnit;                 // Next peer within a fleet family
+  char _staging[1024];
+  size_t _stagingLen;
+  size_t _stagingPos;
+
+  bool stageNext();
+  bool stageFleetFamily(uint8_t index);
+  void appendf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  void header(const char* name, const char* type, const char* help);
+};
+
+#endif // MODBEE_MPPT_METRICS_H
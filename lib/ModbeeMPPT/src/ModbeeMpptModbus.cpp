@@ -0,0 +1,411 @@
+/*!
+ * @file ModbeeMpptModbus.cpp
+ *
+ * @brief Implementation of the Modbus RTU slave and the RS485 port
+ */
+
+#include "ModbeeMpptModbus.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include <ArduinoJson.h>
+
+// Function codes
+#define MODBUS_READ_HOLDING 0x03
+#define MODBUS_READ_INPUT 0x04
+#define MODBUS_WRITE_SINGLE 0x06
+#define MODBUS_WRITE_MULTIPLE 0x10
+
+// Exception codes
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_ADDRESS 0x02
+#define MODBUS_ILLEGAL_VALUE 0x03
+#define MODBUS_DEVICE_FAILURE 0x04
+
+#define MODBUS_BROADCAST 0
+
+// CRC16/MODBUS, reflected polynomial 0xA001, one entry per byte value
+static const uint16_t CRC16_TABLE[256] = {
+  0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+  0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+  0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+  0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+  0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+  0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+  0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+  0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+  0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+  0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+  0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+  0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+  0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+  0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+  0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+  0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+  0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+  0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+  0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+  0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+  0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+  0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+  0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+  0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+  0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+  0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+  0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+  0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+  0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+  0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+  0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+  0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+static inline uint16_t getWord(const uint8_t* p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline void putWord(uint8_t* p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value & 0xFF;
+}
+
+// Scaled telemetry values, saturated to the register range
+static uint16_t scaled(float value, float scale) {
+  return (uint16_t)constrain(lroundf(value * scale), 0L, 65535L);
+}
+
+static uint16_t scaledSigned(float value, float scale) {
+  return (uint16_t)(int16_t)constrain(lroundf(value * scale), -32768L, 32767L);
+}
+
+ModbeeMpptModbus::ModbeeMpptModbus(ModbeeMPPT& mppt) :
+  master(mppt),
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _enabled(false),
+  _address(0),
+  _baud(0),
+  _parity(0),
+  _master(false),
+  _peerFirst(0),
+  _peerCount(0)
+{
+  memset(&_status, 0, sizeof(_status));
+}
+
+uint16_t ModbeeMpptModbus::crc16(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  while (length--) {
+    crc = (crc >> 8) ^ CRC16_TABLE[(crc ^ *data++) & 0xFF];
+  }
+  return crc;
+}
+
+modbee_modbus_status_t ModbeeMpptModbus::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_modbus_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+// ========================================================================
+// UART
+// ========================================================================
+
+void ModbeeMpptModbus::begin() {
+  if (_mppt.config.data.modbus_enable) start();
+}
+
+void ModbeeMpptModbus::loop() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  bool changed = data.modbus_enable != _enabled ||
+                 (_enabled && (data.modbus_address != _address || data.modbus_baud != _baud ||
+                               data.modbus_parity != _parity || data.modbus_master != _master ||
+                               data.modbus_peer_first != _peerFirst || data.modbus_peer_count != _peerCount));
+  if (changed) {
+    // Settings changed (possibly by a Modbus write, already answered): reopen
+    stop();
+    if (data.modbus_enable) start();
+  }
+  if (_master) master.poll();
+}
+
+void ModbeeMpptModbus::start() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  _enabled = true;
+  _address = data.modbus_address;
+  _baud = data.modbus_baud;
+  _parity = data.modbus_parity;
+  _master = data.modbus_master;
+  _peerFirst = data.modbus_peer_first;
+  _peerCount = data.modbus_peer_count;
+
+  static const uint32_t formats[] = {SERIAL_8N1, SERIAL_8E1, SERIAL_8O1};
+  MODBEE_MODBUS_SERIAL.setRxBufferSize(MODBEE_MODBUS_RX_BUFFER);
+  MODBEE_MODBUS_SERIAL.begin(_baud, formats[_parity < 3 ? _parity : 0],
+                             MODBEE_MODBUS_RX_PIN, MODBEE_MODBUS_TX_PIN);
+#if MODBEE_MODBUS_DE_PIN >= 0
+  // The UART drives DE (RTS) around each transmission
+  MODBEE_MODBUS_SERIAL.setPins(-1, -1, -1, MODBEE_MODBUS_DE_PIN);
+  MODBEE_MODBUS_SERIAL.setMode(UART_MODE_RS485_HALF_DUPLEX);
+#endif
+
+  // T3.5: 3.5 character times, fixed at 1.75 ms above 19200 baud. The RX
+  // timeout counts whole characters, so round up.
+  uint32_t bitsPerChar = _parity ? 11 : 10;
+  uint32_t charUs = bitsPerChar * 1000000UL / _baud;
+  uint8_t symbols = _baud <= 19200 ? 4 : (uint8_t)((1750 + charUs - 1) / charUs);
+  MODBEE_MODBUS_SERIAL.setRxTimeout(symbols);
+  MODBEE_MODBUS_SERIAL.onReceive([this]() { onReceive(); }, true);
+
+  portENTER_CRITICAL(&_mux);
+  _status.running = true;
+  _status.master = _master;
+  _status.address = _address;
+  _status.baud = _baud;
+  _status.parity = _parity;
+  portEXIT_CRITICAL(&_mux);
+  if (_master) {
+    master.begin(_peerFirst, _peerCount, _baud, _parity);
+  } else {
+    MODBEE_LOGI("Modbus slave %u at %lu baud", (unsigned)_address, (unsigned long)_baud);
+  }
+}
+
+void ModbeeMpptModbus::stop() {
+  if (_enabled) {
+    if (_master) master.end();
+    MODBEE_MODBUS_SERIAL.end();
+    MODBEE_LOGI("Modbus %s stopped", _master ? "master" : "slave");
+  }
+  _enabled = false;
+  _address = 0;
+  _baud = 0;
+  _parity = 0;
+  _master = false;
+  _peerFirst = 0;
+  _peerCount = 0;
+  portENTER_CRITICAL(&_mux);
+  _status.running = false;
+  _status.master = false;
+  portEXIT_CRITICAL(&_mux);
+}
+
+void ModbeeMpptModbus::onReceive() {
+  // One call per T3.5 gap: everything buffered is one frame
+  size_t length = 0;
+  bool overrun = false;
+  while (MODBEE_MODBUS_SERIAL.available() > 0) {
+    int c = MODBEE_MODBUS_SERIAL.read();
+    if (c < 0) break;
+    if (length < MODBEE_MODBUS_FRAME_MAX) {
+      _frame[length++] = (uint8_t)c;
+    } else {
+      overrun = true;
+    }
+  }
+  if (length == 0) return;
+
+  // Master mode: a reply for the poller, which runs on the main loop
+  if (_master) {
+    master.onFrame(_frame, overrun ? MODBEE_MODBUS_FRAME_MAX + 1 : length);
+    return;
+  }
+
+  uint32_t startUs = micros();
+  size_t replyLength = overrun ? 0 : handleFrame(_frame, length, _reply);
+  if (overrun) {
+    portENTER_CRITICAL(&_mux);
+    _status.crcErrors++;
+    portEXIT_CRITICAL(&_mux);
+  }
+  if (replyLength == 0) return;
+
+  MODBEE_MODBUS_SERIAL.write(_reply, replyLength);
+  MODBEE_MODBUS_SERIAL.flush();
+  // A transceiver that switches direction itself may echo the reply back
+  while (MODBEE_MODBUS_SERIAL.available() > 0) MODBEE_MODBUS_SERIAL.read();
+
+  uint32_t elapsed = micros() - startUs;
+  portENTER_CRITICAL(&_mux);
+  _status.lastRequestUs = elapsed;
+  if (elapsed > _status.maxRequestUs) _status.maxRequestUs = elapsed;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ========================================================================
+// PROTOCOL
+// ========================================================================
+
+size_t ModbeeMpptModbus::handleFrame(const uint8_t* request, size_t length, uint8_t* response) {
+  // Address, function code and CRC at least
+  if (length < 4 || crc16(request, length - 2) != (uint16_t)(request[length - 2] | request[length - 1] << 8)) {
+    portENTER_CRITICAL(&_mux);
+    _status.crcErrors++;
+    portEXIT_CRITICAL(&_mux);
+    return 0;
+  }
+
+  uint8_t address = request[0];
+  bool broadcast = address == MODBUS_BROADCAST;
+  if (!broadcast && address != _mppt.config.data.modbus_address) {
+    portENTER_CRITICAL(&_mux);
+    _status.otherSlaves++;
+    portEXIT_CRITICAL(&_mux);
+    return 0;
+  }
+
+  response[0] = address;
+  size_t pduLength = handlePdu(request + 1, length - 3, response + 1, broadcast);
+  bool isException = pduLength > 0 && (response[1] & 0x80);
+
+  portENTER_CRITICAL(&_mux);
+  _status.requests++;
+  if (isException && !broadcast) _status.exceptions++;
+  _status.lastRequestMs = millis();
+  portEXIT_CRITICAL(&_mux);
+
+  // Broadcasts are never answered
+  if (broadcast || pduLength == 0) return 0;
+  uint16_t crc = crc16(response, pduLength + 1);
+  response[pduLength + 1] = crc & 0xFF;
+  response[pduLength + 2] = crc >> 8;
+  return pduLength + 3;
+}
+
+size_t ModbeeMpptModbus::exception(uint8_t function, uint8_t code, uint8_t* reply) {
+  reply[0] = function | 0x80;
+  reply[1] = code;
+  return 2;
+}
+
+size_t ModbeeMpptModbus::handlePdu(const uint8_t* pdu, size_t length, uint8_t* reply, bool broadcast) {
+  uint8_t function = pdu[0];
+  switch (function) {
+    case MODBUS_READ_HOLDING:
+    case MODBUS_READ_INPUT: {
+      if (broadcast) return 0;
+      if (length != 5) return exception(function, MODBUS_ILLEGAL_VALUE, reply);
+      uint16_t start = getWord(pdu + 1);
+      uint16_t count = getWord(pdu + 3);
+      if (count == 0 || count > MODBEE_MODBUS_MAX_READ) return exception(function, MODBUS_ILLEGAL_VALUE, reply);
+      return function == MODBUS_READ_INPUT ? readInputRegisters(start, count, reply)
+                                           : readHoldingRegisters(start, count, reply);
+    }
+    case MODBUS_WRITE_SINGLE: {
+      if (length != 5) return exception(function, MODBUS_ILLEGAL_VALUE, reply);
+      // Only the low word of a field: the high word is taken as zero
+      uint16_t address = getWord(pdu + 1);
+      if (!(address & 1)) return exception(function, MODBUS_ILLEGAL_ADDRESS, reply);
+      uint8_t words[4] = {0, 0, pdu[3], pdu[4]};
+      uint8_t code = writeHoldingRegisters(address - 1, 2, words);
+      if (code) return exception(function, code, reply);
+      memcpy(reply, pdu, 5);  // Echo of the request
+      return 5;
+    }
+    case MODBUS_WRITE_MULTIPLE: {
+      if (length < 6) return exception(function, MODBUS_ILLEGAL_VALUE, reply);
+      uint16_t start = getWord(pdu + 1);
+      uint16_t count = getWord(pdu + 3);
+      uint8_t bytes = pdu[5];
+      if (count == 0 || count > MODBEE_MODBUS_MAX_WRITE || bytes != count * 2 || length != 6u + bytes) {
+        return exception(function, MODBUS_ILLEGAL_VALUE, reply);
+      }
+      uint8_t code = writeHoldingRegisters(start, count, pdu + 6);
+      if (code) return exception(function, code, reply);
+      memcpy(reply, pdu, 5);  // Function, start and count
+      return 5;
+    }
+    default:
+      if (broadcast) return 0;
+      return exception(function, MODBUS_ILLEGAL_FUNCTION, reply);
+  }
+}
+
+size_t ModbeeMpptModbus::readInputRegisters(uint16_t start, uint16_t count, uint8_t* reply) {
+  if ((uint32_t)start + count > MODBEE_MODBUS_IR_COUNT) {
+    return exception(MODBUS_READ_INPUT, MODBUS_ILLEGAL_ADDRESS, reply);
+  }
+
+  // Cached frame only: the charger may be mid-transfer on the main loop
+  modbee_telemetry_t t = _mppt.api.getTelemetry();
+  unsigned long now = millis();
+  uint32_t uptime = now / 1000;
+  uint16_t regs[MODBEE_MODBUS_IR_COUNT];
+  regs[MODBEE_MODBUS_IR_VBUS_MV] = scaled(t.vbus.voltage, 1000.0f);
+  regs[MODBEE_MODBUS_IR_IBUS_MA] = scaledSigned(t.vbus.current, 1000.0f);
+  regs[MODBEE_MODBUS_IR_VBUS_CW] = scaled(t.vbus.power, 100.0f);
+  regs[MODBEE_MODBUS_IR_VBAT_MV] = scaled(t.battery.voltage, 1000.0f);
+  regs[MODBEE_MODBUS_IR_IBAT_MA] = scaledSigned(t.battery.current, 1000.0f);
+  regs[MODBEE_MODBUS_IR_VBAT_CW] = scaledSigned(t.battery.power, 100.0f);
+  regs[MODBEE_MODBUS_IR_VSYS_MV] = scaled(t.system.voltage, 1000.0f);
+  regs[MODBEE_MODBUS_IR_ISYS_MA] = scaledSigned(t.system.current, 1000.0f);
+  regs[MODBEE_MODBUS_IR_VAC1_MV] = scaled(t.vac1.voltage, 1000.0f);
+  regs[MODBEE_MODBUS_IR_VAC2_MV] = scaled(t.vac2.voltage, 1000.0f);
+  regs[MODBEE_MODBUS_IR_DIE_TEMP_DC] = scaledSigned(t.die_temperature, 10.0f);
+  regs[MODBEE_MODBUS_IR_BAT_TEMP_DC] = scaledSigned(t.battery_temperature, 10.0f);
+  regs[MODBEE_MODBUS_IR_CHARGE_STATE] = t.charge_state;
+  regs[MODBEE_MODBUS_IR_FAULTS] = (uint16_t)(t.fault_status0 << 8 | t.fault_status1);
+  regs[MODBEE_MODBUS_IR_SOC_DPCT] = scaled(_mppt._cachedSOC, 10.0f);
+  regs[MODBEE_MODBUS_IR_SEQUENCE] = t.valid ? (uint16_t)t.sequence : 0;
+  regs[MODBEE_MODBUS_IR_FRAME_AGE_MS] = t.valid ? (uint16_t)min(now - t.timestamp_ms, 65535UL) : 0xFFFF;
+  regs[MODBEE_MODBUS_IR_UPTIME_HI] = uptime >> 16;
+  regs[MODBEE_MODBUS_IR_UPTIME_LO] = uptime & 0xFFFF;
+
+  reply[0] = MODBUS_READ_INPUT;
+  reply[1] = count * 2;
+  for (uint16_t i = 0; i < count; i++) putWord(reply + 2 + i * 2, regs[start + i]);
+  return 2 + count * 2;
+}
+
+size_t ModbeeMpptModbus::readHoldingRegisters(uint16_t start, uint16_t count, uint8_t* reply) {
+  size_t fieldCount;
+  const ModbeeMpptConfigField* fields = ModbeeMpptConfig::getFields(fieldCount);
+  if ((uint32_t)start + count > fieldCount * 2) {
+    return exception(MODBUS_READ_HOLDING, MODBUS_ILLEGAL_ADDRESS, reply);
+  }
+
+  reply[0] = MODBUS_READ_HOLDING;
+  reply[1] = count * 2;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t address = start + i;
+    size_t index = address / 2;
+    float value = _mppt.config.getFieldValue(index);
+    if (fields[index].type == MODBEE_CONFIG_FLOAT) value *= MODBEE_MODBUS_FLOAT_SCALE;
+    uint32_t raw = (uint32_t)(int32_t)lroundf(value);
+    putWord(reply + 2 + i * 2, (address & 1) ? raw & 0xFFFF : raw >> 16);
+  }
+  return 2 + count * 2;
+}
+
+uint8_t ModbeeMpptModbus::writeHoldingRegisters(uint16_t start, uint16_t count, const uint8_t* data) {
+  size_t fieldCount;
+  const ModbeeMpptConfigField* fields = ModbeeMpptConfig::getFields(fieldCount);
+  if ((start & 1) || (count & 1) || (uint32_t)start + count > fieldCount * 2) {
+    return MODBUS_ILLEGAL_ADDRESS;
+  }
+
+  // One patch for the whole request: all fields are accepted or none
+  JsonDocument doc;
+  JsonObject patch = doc["patch"].to<JsonObject>();
+  for (uint16_t i = 0; i < count; i += 2) {
+    const ModbeeMpptConfigField& field = fields[(start + i) / 2];
+    int32_t value = (int32_t)((uint32_t)getWord(data + i * 2) << 16 | getWord(data + i * 2 + 2));
+    switch (field.type) {
+      case MODBEE_CONFIG_FLOAT:
+        patch[field.key] = value / MODBEE_MODBUS_FLOAT_SCALE;
+        break;
+      case MODBEE_CONFIG_BOOL:
+        if (value != 0 && value != 1) return MODBUS_ILLEGAL_VALUE;
+        patch[field.key] = value == 1;
+        break;
+      default:
+        patch[field.key] = (long)value;
+        break;
+    }
+  }
+
+  JsonObject errors = doc["errors"].to<JsonObject>();
+  JsonArray changed = doc["changed"].to<JsonArray>();
+  if (_mppt.config.applyPatch(patch, errors, changed)) return 0;
+  return errors["_"].isNull() ? MODBUS_ILLEGAL_VALUE : MODBUS_DEVICE_FAILURE;
+}
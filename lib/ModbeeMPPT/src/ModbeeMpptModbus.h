@@ -0,0 +1,153 @@
+/*!
+ * @file ModbeeMpptModbus.h
+ *
+ * @brief Modbus RTU slave (or master) on the RS485 port for ModbeeMPPT
+ *
+ * Frames are received by the UART driver: the hardware RX timeout is set to
+ * the T3.5 silent interval, and the receive callback (UART event task) gets
+ * one complete frame per timeout. Requests are answered in that callback
+ * without touching I2C: input registers come from the cached telemetry
+ * frame, holding registers from the configuration.
+ *
+ * Input registers (function 04) mirror the telemetry frame, see
+ * modbee_modbus_input_t. Holding registers (functions 03, 06, 16) map the
+ * configuration fields two registers each, high word first, in
+ * ModbeeMpptConfig::getFields() order: field n is at address 2n. Float
+ * fields are scaled by 1000, the others are raw integers. Writes go through
+ * ModbeeMpptConfig::applyPatch(), so they are range-checked, saved, and
+ * applied to the charger by the main loop like a web UI change. Function 16
+ * must cover whole fields; function 06 writes the low word of a field whose
+ * value fits in 16 bits.
+ *
+ * With modbusMaster set the port polls other units instead of answering,
+ * see ModbeeMpptModbusMaster; this class still owns the UART.
+ */
+
+#ifndef MODBEE_MPPT_MODBUS_H
+#define MODBEE_MPPT_MODBUS_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+#include "ModbeeMpptModbusMaster.h"
+
+// RS485 transceiver on UART1
+#ifndef MODBEE_MODBUS_SERIAL
+#define MODBEE_MODBUS_SERIAL Serial1
+#endif
+#ifndef MODBEE_MODBUS_RX_PIN
+#define MODBEE_MODBUS_RX_PIN 20
+#endif
+#ifndef MODBEE_MODBUS_TX_PIN
+#define MODBEE_MODBUS_TX_PIN 21
+#endif
+#ifndef MODBEE_MODBUS_DE_PIN
+#define MODBEE_MODBUS_DE_PIN -1           // -1: the transceiver switches direction itself
+#endif
+
+#define MODBEE_MODBUS_FRAME_MAX 256       // Longest RTU frame
+#define MODBEE_MODBUS_RX_BUFFER 512       // UART driver ring buffer
+#define MODBEE_MODBUS_MAX_READ 125        // Registers per read request
+#define MODBEE_MODBUS_MAX_WRITE 122       // Registers per function 16 request (61 fields)
+#define MODBEE_MODBUS_FLOAT_SCALE 1000.0f // Holding register value of a float field
+
+// Input register addresses (function 04)
+typedef enum {
+  MODBEE_MODBUS_IR_VBUS_MV = 0,
+  MODBEE_MODBUS_IR_IBUS_MA,         // Signed
+  MODBEE_MODBUS_IR_VBUS_CW,         // Input power (0.01 W)
+  MODBEE_MODBUS_IR_VBAT_MV,
+  MODBEE_MODBUS_IR_IBAT_MA,         // Signed, positive = charging
+  MODBEE_MODBUS_IR_VBAT_CW,         // Signed battery power (0.01 W)
+  MODBEE_MODBUS_IR_VSYS_MV,
+  MODBEE_MODBUS_IR_ISYS_MA,         // Signed
+  MODBEE_MODBUS_IR_VAC1_MV,
+  MODBEE_MODBUS_IR_VAC2_MV,
+  MODBEE_MODBUS_IR_DIE_TEMP_DC,     // Signed (0.1 °C)
+  MODBEE_MODBUS_IR_BAT_TEMP_DC,     // Signed (0.1 °C)
+  MODBEE_MODBUS_IR_CHARGE_STATE,    // modbee_charge_state_t
+  MODBEE_MODBUS_IR_FAULTS,          // FAULT_Status_0 << 8 | FAULT_Status_1
+  MODBEE_MODBUS_IR_SOC_DPCT,        // State of charge (0.1 %)
+  MODBEE_MODBUS_IR_SEQUENCE,        // Telemetry frame counter (low 16 bits), 0 = none yet
+  MODBEE_MODBUS_IR_FRAME_AGE_MS,    // Age of the frame served (saturates at 65535)
+  MODBEE_MODBUS_IR_UPTIME_HI,       // Seconds since boot, 32 bits
+  MODBEE_MODBUS_IR_UPTIME_LO,
+  MODBEE_MODBUS_IR_COUNT
+} modbee_modbus_input_t;
+
+typedef struct {
+  bool running;                 // UART open and answering (or polling)
+  bool master;                  // Polling peers, see ModbeeMpptModbusMaster
+  uint8_t address;
+  uint32_t baud;
+  uint8_t parity;               // 0 = none, 1 = even, 2 = odd
+  uint32_t requests;            // Good frames addressed to this unit (broadcasts included)
+  uint32_t exceptions;          // Exception responses sent
+  uint32_t crcErrors;           // Frames dropped for a bad CRC or length
+  uint32_t otherSlaves;         // Good frames for another address
+  uint32_t lastRequestUs;       // Handling time of the last request, reply included
+  uint32_t maxRequestUs;
+  unsigned long lastRequestMs;  // millis() of the last request, 0 = none
+} modbee_modbus_status_t;
+
+class ModbeeMpptModbus {
+public:
+  ModbeeMpptModbus(class ModbeeMPPT& mppt);
+
+  ModbeeMpptModbusMaster master; // Fleet poller, idle unless in master mode
+
+  /*!
+   * @brief Open the UART if Modbus is enabled in the configuration
+   */
+  void begin();
+
+  /*!
+   * @brief Reopen or close the UART after a settings change, and run the
+   * master's poll schedule; call every loop pass
+   */
+  void loop();
+
+  /*!
+   * @brief Copy of the link status and counters
+   */
+  modbee_modbus_status_t getStatus() const;
+
+  /*!
+   * @brief Answer one RTU frame (address, PDU and CRC)
+   * @param request Received frame
+   * @param length Frame length in bytes
+   * @param response Reply, MODBEE_MODBUS_FRAME_MAX bytes
+   * @return Reply length, 0 when nothing is to be sent
+   */
+  size_t handleFrame(const uint8_t* request, size_t length, uint8_t* response);
+
+  /*!
+   * @brief Modbus CRC16 (polynomial 0xA001, initial 0xFFFF), table driven
+   */
+  static uint16_t crc16(const uint8_t* data, size_t length);
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_modbus_status_t _status;
+  mutable portMUX_TYPE _mux;
+  // Settings the UART was opened with
+  bool _enabled;
+  uint8_t _address;
+  uint32_t _baud;
+  uint8_t _parity;
+  bool _master;
+  uint8_t _peerFirst;
+  uint8_t _peerCount;
+  uint8_t _frame[MODBEE_MODBUS_FRAME_MAX];
+  uint8_t _reply[MODBEE_MODBUS_FRAME_MAX];
+
+  void start();
+  void stop();
+  void onReceive();
+  size_t handlePdu(const uint8_t* pdu, size_t length, uint8_t* reply, bool broadcast);
+  size_t readInputRegisters(uint16_t start, uint16_t count, uint8_t* reply);
+  size_t readHoldingRegisters(uint16_t start, uint16_t count, uint8_t* reply);
+  uint8_t writeHoldingRegisters(uint16_t start, uint16_t count, const uint8_t* data);
+  static size_t exception(uint8_t function, uint8_t code, uint8_t* reply);
+};
+
+#endif // MODBEE_MPPT_MODBUS_H
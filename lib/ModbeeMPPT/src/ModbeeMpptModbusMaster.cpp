@@ -0,0 +1,353 @@
+/*!
+ * @file ModbeeMpptModbusMaster.cpp
+ *
+ * @brief Implementation of the Modbus RTU master and fleet table
+ */
+
+#include "ModbeeMpptModbusMaster.h"
+#include "ModbeeMpptModbus.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+
+#define MODBUS_READ_INPUT 0x04
+
+static_assert(MODBEE_MODBUS_IR_SEQUENCE + 1 == MODBEE_MODBUS_POLL_REGISTERS,
+              "A poll reads the input registers up to the sequence counter");
+
+static inline uint16_t getWord(const uint8_t* p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline int16_t getSigned(const uint8_t* p) {
+  return (int16_t)getWord(p);
+}
+
+ModbeeMpptModbusMaster::ModbeeMpptModbusMaster(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _count(0),
+  _running(false),
+  _state(IDLE),
+  _next(0),
+  _current(0),
+  _cycles(0),
+  _cycleUs(0),
+  _cycleStartMs(0),
+  _cycleStartUs(0),
+  _gapUs(0),
+  _minTimeoutUs(0),
+  _sentUs(0),
+  _turnaroundUs(0),
+  _rxLength(0),
+  _rxUs(0),
+  _rxReady(false)
+{
+  memset(_units, 0, sizeof(_units));
+  memset(_request, 0, sizeof(_request));
+}
+
+void ModbeeMpptModbusMaster::begin(uint8_t first, uint8_t count, uint32_t baud, uint8_t parity) {
+  // Consecutive addresses, none past the last unicast address (247)
+  count = min((int)count, MODBEE_MODBUS_MAX_PEERS);
+  if (first + count > 248) count = 248 - first;
+
+  // Same T3.5 as the slave side: 3.5 characters, 1.75 ms above 19200 baud
+  uint32_t charUs = (parity ? 11 : 10) * 1000000UL / baud;
+  uint32_t t35Us = baud <= 19200 ? charUs * 7 / 2 : 1750;
+  _gapUs = t35Us + MODBEE_MODBUS_TURNAROUND_US;
+  _minTimeoutUs = MODBEE_MODBUS_POLL_REPLY * charUs + t35Us + MODBEE_MODBUS_TIMEOUT_MARGIN_US;
+
+  portENTER_CRITICAL(&_mux);
+  memset(_units, 0, sizeof(_units));
+  for (uint8_t i = 0; i < count; i++) {
+    _units[i].address = first + i;
+    _units[i].timeoutUs = max((uint32_t)MODBEE_MODBUS_TIMEOUT_INITIAL_US, _minTimeoutUs);
+  }
+  _count = count;
+  _cycles = 0;
+  _cycleUs = 0;
+  _rxReady = false;
+  _running = true;
+  portEXIT_CRITICAL(&_mux);
+
+  _state = IDLE;
+  _cycleStartMs = millis() - MODBEE_MODBUS_CYCLE_MS;  // First cycle on the next pass
+  MODBEE_LOGI("Modbus master polling %u peers from address %u", (unsigned)count, (unsigned)first);
+}
+
+void ModbeeMpptModbusMaster::end() {
+  portENTER_CRITICAL(&_mux);
+  _running = false;
+  _rxReady = false;
+  portEXIT_CRITICAL(&_mux);
+  _state = IDLE;
+}
+
+void ModbeeMpptModbusMaster::onFrame(const uint8_t* frame, size_t length) {
+  uint32_t now = micros();
+  portENTER_CRITICAL(&_mux);
+  memcpy(_rx, frame, min(length, sizeof(_rx)));
+  _rxLength = length;
+  _rxUs = now;
+  _rxReady = true;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ========================================================================
+// SCHEDULE
+// ========================================================================
+
+void ModbeeMpptModbusMaster::poll() {
+  if (!_running) return;
+  uint32_t now = micros();
+
+  if (_state == WAITING) {
+    uint8_t frame[MODBEE_MODBUS_POLL_REPLY];
+    size_t length = 0;
+    uint32_t rxUs = 0;
+    portENTER_CRITICAL(&_mux);
+    bool ready = _rxReady;
+    if (ready) {
+      length = _rxLength;
+      rxUs = _rxUs;
+      memcpy(frame, _rx, min(length, sizeof(frame)));
+      _rxReady = false;
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    // A transceiver that switches direction itself echoes the request back
+    bool echo = length == sizeof(_request) && !memcmp(frame, _request, length);
+    if (ready && !echo) {
+      handleReply(frame, length, (int32_t)(rxUs - _sentUs) > 0 ? rxUs - _sentUs : 0);
+    } else if (now - _sentUs >= _units[_current].timeoutUs) {
+      handleMiss(true);
+    }
+    return;
+  }
+
+  if (_state == TURNAROUND) {
+    if (now - _turnaroundUs < _gapUs) return;
+    if (!startNext()) {
+      portENTER_CRITICAL(&_mux);
+      _cycles++;
+      _cycleUs = now - _cycleStartUs;
+      portEXIT_CRITICAL(&_mux);
+      _state = IDLE;
+    }
+    return;
+  }
+
+  // Cycles start on a fixed period; a slow cycle starts the next one at once
+  if (millis() - _cycleStartMs < MODBEE_MODBUS_CYCLE_MS) return;
+  _cycleStartMs = millis();
+  _cycleStartUs = now;
+  _next = 0;
+  if (!startNext()) {
+    portENTER_CRITICAL(&_mux);
+    _cycles++;
+    _cycleUs = 0;
+    portEXIT_CRITICAL(&_mux);
+  }
+}
+
+bool ModbeeMpptModbusMaster::startNext() {
+  while (_next < _count) {
+    uint8_t index = _next++;
+    const modbee_fleet_unit_t& unit = _units[index];
+    // Offline peers only get a poll every few cycles
+    if (!unit.online && unit.misses >= MODBEE_MODBUS_OFFLINE_MISSES &&
+        _cycles % MODBEE_MODBUS_RETRY_CYCLES != 0) {
+      continue;
+    }
+    send(index);
+    return true;
+  }
+  return false;
+}
+
+void ModbeeMpptModbusMaster::send(uint8_t index) {
+  _current = index;
+  _request[0] = _units[index].address;
+  _request[1] = MODBUS_READ_INPUT;
+  _request[2] = 0;
+  _request[3] = 0;
+  _request[4] = 0;
+  _request[5] = MODBEE_MODBUS_POLL_REGISTERS;
+  uint16_t crc = ModbeeMpptModbus::crc16(_request, 6);
+  _request[6] = crc & 0xFF;
+  _request[7] = crc >> 8;
+
+  portENTER_CRITICAL(&_mux);
+  _rxReady = false;  // A late reply to the previous poll is stale now
+  _units[index].polls++;
+  portEXIT_CRITICAL(&_mux);
+
+  MODBEE_MODBUS_SERIAL.write(_request, sizeof(_request));
+  MODBEE_MODBUS_SERIAL.flush();  // Returns once the last stop bit is out
+  _sentUs = micros();
+  _state = WAITING;
+}
+
+void ModbeeMpptModbusMaster::finishPoll() {
+  _state = TURNAROUND;
+  _turnaroundUs = micros();
+}
+
+// ========================================================================
+// REPLIES
+// ========================================================================
+
+void ModbeeMpptModbusMaster::handleMiss(bool timeout) {
+  modbee_fleet_unit_t& unit = _units[_current];
+  bool wentOffline = false;
+  portENTER_CRITICAL(&_mux);
+  if (timeout) {
+    unit.timeouts++;
+    // Back off so a slow peer gets more time before it is given up on
+    unit.timeoutUs = min(unit.timeoutUs * 2, (uint32_t)MODBEE_MODBUS_TIMEOUT_MAX_US);
+  } else {
+    unit.errors++;
+  }
+  if (unit.misses < 255) unit.misses++;
+  if (unit.online && unit.misses >= MODBEE_MODBUS_OFFLINE_MISSES) {
+    unit.online = false;
+    wentOffline = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  if (wentOffline) MODBEE_LOGW("Modbus peer %u offline", (unsigned)unit.address);
+  finishPoll();
+}
+
+void ModbeeMpptModbusMaster::handleReply(const uint8_t* frame, size_t length, uint32_t rttUs) {
+  modbee_fleet_unit_t& unit = _units[_current];
+  if (length > MODBEE_MODBUS_POLL_REPLY || length < 5 ||
+      ModbeeMpptModbus::crc16(frame, length - 2) != (uint16_t)(frame[length - 2] | frame[length - 1] << 8)) {
+    handleMiss(false);
+    return;
+  }
+  // Another address answering means a second master or a duplicate address:
+  // keep waiting for the right one
+  if (frame[0] != unit.address) return;
+
+  bool cameOnline = !unit.online;
+  bool exception = frame[1] == (MODBUS_READ_INPUT | 0x80);
+  if (!exception && (frame[1] != MODBUS_READ_INPUT || frame[2] != MODBEE_MODBUS_POLL_REGISTERS * 2 ||
+                     length != MODBEE_MODBUS_POLL_REPLY)) {
+    handleMiss(false);
+    return;
+  }
+
+  const uint8_t* regs = frame + 3;
+  unsigned long nowMs = millis();
+  portENTER_CRITICAL(&_mux);
+  // Response time estimate as in TCP (RFC 6298): timeout = SRTT + max(G, 4 RTTVAR)
+  if (unit.srttUs == 0) {
+    unit.srttUs = rttUs;
+    unit.rttVarUs = rttUs / 2;
+  } else {
+    uint32_t delta = rttUs > unit.srttUs ? rttUs - unit.srttUs : unit.srttUs - rttUs;
+    unit.rttVarUs = (3 * unit.rttVarUs + delta) / 4;
+    unit.srttUs = (7 * unit.srttUs + rttUs) / 8;
+  }
+  uint32_t slack = max(4 * unit.rttVarUs, (uint32_t)MODBEE_MODBUS_TIMEOUT_MARGIN_US);
+  unit.timeoutUs = constrain(unit.srttUs + slack, _minTimeoutUs, (uint32_t)MODBEE_MODBUS_TIMEOUT_MAX_US);
+  unit.online = true;
+  unit.misses = 0;
+
+  if (exception) {
+    // Alive, but not serving these registers: keep the last values
+    unit.errors++;
+  } else {
+    float inputPower = getWord(regs + 2 * MODBEE_MODBUS_IR_VBUS_CW) / 100.0f;
+    // Trapezoid between consecutive replies; a long gap is skipped, not guessed
+    if (unit.valid && nowMs - unit.lastSeenMs <= MODBEE_MODBUS_ENERGY_GAP_MS) {
+      unit.energyWh += (unit.inputPower + inputPower) * 0.5f * (nowMs - unit.lastSeenMs) / 3600000.0f;
+    }
+    unit.vbusVoltage = getWord(regs + 2 * MODBEE_MODBUS_IR_VBUS_MV) / 1000.0f;
+    unit.inputPower = inputPower;
+    unit.batteryVoltage = getWord(regs + 2 * MODBEE_MODBUS_IR_VBAT_MV) / 1000.0f;
+    unit.batteryCurrent = getSigned(regs + 2 * MODBEE_MODBUS_IR_IBAT_MA) / 1000.0f;
+    unit.batteryPower = getSigned(regs + 2 * MODBEE_MODBUS_IR_VBAT_CW) / 100.0f;
+    unit.dieTemperature = getSigned(regs + 2 * MODBEE_MODBUS_IR_DIE_TEMP_DC) / 10.0f;
+    unit.batteryTemperature = getSigned(regs + 2 * MODBEE_MODBUS_IR_BAT_TEMP_DC) / 10.0f;
+    unit.chargeState = (uint8_t)getWord(regs + 2 * MODBEE_MODBUS_IR_CHARGE_STATE);
+    unit.faults = getWord(regs + 2 * MODBEE_MODBUS_IR_FAULTS);
+    unit.soc = getWord(regs + 2 * MODBEE_MODBUS_IR_SOC_DPCT) / 10.0f;
+    unit.sequence = getWord(regs + 2 * MODBEE_MODBUS_IR_SEQUENCE);
+    unit.lastSeenMs = nowMs;
+    unit.valid = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  if (cameOnline) MODBEE_LOGI("Modbus peer %u online", (unsigned)unit.address);
+  finishPoll();
+}
+
+// ========================================================================
+// FLEET TABLE
+// ========================================================================
+
+size_t ModbeeMpptModbusMaster::getUnits(modbee_fleet_unit_t* units) const {
+  portENTER_CRITICAL(&_mux);
+  size_t count = _count;
+  memcpy(units, _units, count * sizeof(modbee_fleet_unit_t));
+  portEXIT_CRITICAL(&_mux);
+  return count;
+}
+
+modbee_fleet_summary_t ModbeeMpptModbusMaster::getSummary() const {
+  modbee_fleet_summary_t summary;
+  memset(&summary, 0, sizeof(summary));
+
+  // This unit counts as a member of its own fleet
+  modbee_telemetry_t t = _mppt.api.getTelemetry();
+  if (t.valid) {
+    summary.online = 1;
+    summary.faulted = (t.fault_status0 || t.fault_status1) ? 1 : 0;
+    summary.inputPower = t.vbus.power;
+    summary.batteryPower = t.battery.power;
+  }
+
+  portENTER_CRITICAL(&_mux);
+  summary.running = _running;
+  summary.peers = _count;
+  summary.cycles = _cycles;
+  summary.cycleUs = _cycleUs;
+  for (uint8_t i = 0; i < _count; i++) {
+    const modbee_fleet_unit_t& unit = _units[i];
+    summary.energyWh += unit.energyWh;
+    if (!unit.online) continue;
+    summary.online++;
+    if (unit.faults) summary.faulted++;
+    summary.inputPower += unit.inputPower;
+    summary.batteryPower += unit.batteryPower;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return summary;
+}
+
+void ModbeeMpptModbusMaster::printFleet() const {
+  modbee_fleet_unit_t units[MODBEE_MODBUS_MAX_PEERS];
+  size_t count = getUnits(units);
+  modbee_fleet_summary_t summary = getSummary();
+  unsigned long now = millis();
+
+  Serial.printf("=== Fleet (%s, %u/%u units online, cycle %u ms) ===\n", summary.running ? "polling" : "stopped",
+                (unsigned)summary.online, (unsigned)(summary.peers + 1), (unsigned)(summary.cycleUs / 1000));
+  Serial.printf("%-4s %-4s %8s %8s %8s %8s %6s %5s %6s %8s %7s %7s %6s %6s %6s\n", "addr", "up", "vbus V", "in W",
+                "vbat V", "bat W", "soc %", "state", "faults", "energyWh", "rtt ms", "tmo ms", "polls", "tmout", "errs");
+  for (size_t i = 0; i < count; i++) {
+    const modbee_fleet_unit_t& u = units[i];
+    Serial.printf("%-4u %-4s %8.3f %8.2f %8.3f %8.2f %6.1f %5u   %04X %8.3f %7.1f %7.1f %6lu %6lu %6lu\n",
+                  (unsigned)u.address, u.online ? "yes" : "no", u.vbusVoltage, u.inputPower, u.batteryVoltage,
+                  u.batteryPower, u.soc, (unsigned)u.chargeState, (unsigned)u.faults, u.energyWh,
+                  u.srttUs / 1000.0f, u.timeoutUs / 1000.0f, (unsigned long)u.polls,
+                  (unsigned long)u.timeouts, (unsigned long)u.errors);
+    if (u.valid && now - u.lastSeenMs > 2 * MODBEE_MODBUS_CYCLE_MS) {
+      Serial.printf("     last reply %lu s ago\n", (now - u.lastSeenMs) / 1000);
+    }
+  }
+  Serial.printf("Total: %.2f W in, %.2f W battery, %.3f Wh from peers, %u faulted\n", summary.inputPower,
+                summary.batteryPower, summary.energyWh, (unsigned)summary.faulted);
+}
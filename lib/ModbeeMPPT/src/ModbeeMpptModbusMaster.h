@@ -0,0 +1,178 @@
+/*!
+ * @file ModbeeMpptModbusMaster.h
+ *
+ * @brief Modbus RTU master that aggregates a chain of ModbeeMPPT units
+ *
+ * In master mode the RS485 port polls peers at consecutive slave addresses
+ * instead of answering requests. Each cycle reads input registers 0..15
+ * (function 04, see modbee_modbus_input_t) from every peer in turn into a
+ * fleet table held in RAM; the web dashboard, /metrics and the "fleet"
+ * Serial command read that table and never wait on the bus.
+ *
+ * RTU allows one transaction on the line at a time, so the poller keeps the
+ * bus busy by scheduling rather than by overlapping requests: a reply is
+ * parsed on the next loop pass and the request for the following peer goes
+ * out as soon as the turnaround gap (T3.5 plus MODBEE_MODBUS_TURNAROUND_US)
+ * has passed. Each peer has its own reply timeout, derived from a smoothed
+ * response time and its variance (at least MODBEE_MODBUS_TIMEOUT_MARGIN_US
+ * above it, for the peer's loop latency) and doubled after every miss. A peer that
+ * misses MODBEE_MODBUS_OFFLINE_MISSES polls in a row is marked offline and
+ * only retried every MODBEE_MODBUS_RETRY_CYCLES cycles, so a dead unit
+ * cannot stretch the cycle for the live ones.
+ *
+ * Replies arrive in the UART event task (ModbeeMpptModbus::onReceive()),
+ * which only copies the frame; everything else runs in poll() on the main
+ * loop.
+ */
+
+#ifndef MODBEE_MPPT_MODBUS_MASTER_H
+#define MODBEE_MPPT_MODBUS_MASTER_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptConfig.h"
+
+#ifndef MODBEE_MODBUS_CYCLE_MS
+#define MODBEE_MODBUS_CYCLE_MS 1000            // Start of one poll cycle to the next
+#endif
+#ifndef MODBEE_MODBUS_TURNAROUND_US
+#define MODBEE_MODBUS_TURNAROUND_US 2000       // Extra gap after T3.5 for transceivers to release the line
+#endif
+#ifndef MODBEE_MODBUS_TIMEOUT_INITIAL_US
+#define MODBEE_MODBUS_TIMEOUT_INITIAL_US 250000  // Until the first reply is timed
+#endif
+#ifndef MODBEE_MODBUS_TIMEOUT_MAX_US
+#define MODBEE_MODBUS_TIMEOUT_MAX_US 1000000
+#endif
+#ifndef MODBEE_MODBUS_TIMEOUT_MARGIN_US
+#define MODBEE_MODBUS_TIMEOUT_MARGIN_US 20000  // Least slack over the smoothed response time
+#endif
+#define MODBEE_MODBUS_OFFLINE_MISSES 3         // Consecutive failed polls before a peer is offline
+#define MODBEE_MODBUS_RETRY_CYCLES 10          // Offline peers are polled every Nth cycle
+#define MODBEE_MODBUS_ENERGY_GAP_MS 10000      // Longer gaps between replies are not integrated
+#define MODBEE_MODBUS_POLL_REGISTERS 16        // Input registers 0..15 per poll
+#define MODBEE_MODBUS_POLL_REPLY (5 + 2 * MODBEE_MODBUS_POLL_REGISTERS)  // Address, function, count, data, CRC
+
+// One peer in the fleet table
+typedef struct {
+  uint8_t address;
+  bool online;                  // Answered one of the last MODBEE_MODBUS_OFFLINE_MISSES polls
+  bool valid;                   // The values below come from at least one reply
+  float vbusVoltage;
+  float inputPower;
+  float batteryVoltage;
+  float batteryCurrent;         // Positive = charging
+  float batteryPower;
+  float soc;                    // %
+  float dieTemperature;
+  float batteryTemperature;
+  uint8_t chargeState;          // modbee_charge_state_t
+  uint16_t faults;              // FAULT_Status_0 << 8 | FAULT_Status_1
+  uint16_t sequence;            // The peer's telemetry frame counter
+  float energyWh;               // Input energy seen by this master since boot
+  unsigned long lastSeenMs;     // millis() of the last good reply, 0 = never
+  uint32_t polls;
+  uint32_t timeouts;
+  uint32_t errors;              // Bad CRC, wrong length or exception replies
+  uint8_t misses;               // Consecutive failed polls
+  uint32_t srttUs;              // Smoothed response time, 0 = not measured yet
+  uint32_t rttVarUs;
+  uint32_t timeoutUs;           // Reply timeout for the next poll
+} modbee_fleet_unit_t;
+
+// Fleet totals, this unit included
+typedef struct {
+  bool running;
+  uint8_t peers;                // Peers configured
+  uint8_t online;               // Units online, this one included
+  uint8_t faulted;              // Online units with a fault bit set
+  float inputPower;
+  float batteryPower;
+  float energyWh;               // Peers only, see modbee_fleet_unit_t::energyWh
+  uint32_t cycles;
+  uint32_t cycleUs;             // Duration of the last complete cycle
+} modbee_fleet_summary_t;
+
+class ModbeeMpptModbusMaster {
+public:
+  ModbeeMpptModbusMaster(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Reset the fleet table and start polling; the UART is already open
+   * @param first Address of the first peer
+   * @param count Peers at consecutive addresses
+   * @param baud Line speed, for T3.5 and the reply wire time
+   * @param parity 0 = none, 1 = even, 2 = odd
+   */
+  void begin(uint8_t first, uint8_t count, uint32_t baud, uint8_t parity);
+
+  /*!
+   * @brief Stop polling; the fleet table is kept for display
+   */
+  void end();
+
+  /*!
+   * @brief Run the poll schedule; call every loop pass
+   */
+  void poll();
+
+  /*!
+   * @brief Hand over a received frame (UART event task)
+   */
+  void onFrame(const uint8_t* frame, size_t length);
+
+  /*!
+   * @brief Copy of the fleet table
+   * @param units Destination, MODBEE_MODBUS_MAX_PEERS entries
+   * @return Number of peers copied
+   */
+  size_t getUnits(modbee_fleet_unit_t* units) const;
+
+  /*!
+   * @brief Fleet totals, including this unit's own telemetry
+   */
+  modbee_fleet_summary_t getSummary() const;
+
+  /*!
+   * @brief Print the fleet table to Serial
+   */
+  void printFleet() const;
+
+private:
+  enum State {
+    IDLE,                       // Waiting for the next cycle
+    TURNAROUND,                 // Bus gap before the next request
+    WAITING                     // Request sent, reply pending
+  };
+
+  class ModbeeMPPT& _mppt;
+  mutable portMUX_TYPE _mux;
+  modbee_fleet_unit_t _units[MODBEE_MODBUS_MAX_PEERS];
+  uint8_t _count;
+  bool _running;
+  State _state;
+  uint8_t _next;                // Index of the next peer in this cycle
+  uint8_t _current;             // Index of the peer being polled
+  uint32_t _cycles;
+  uint32_t _cycleUs;
+  unsigned long _cycleStartMs;
+  uint32_t _cycleStartUs;
+  uint32_t _gapUs;              // Turnaround gap
+  uint32_t _minTimeoutUs;       // Reply wire time and T3.5, plus the margin
+  uint32_t _sentUs;
+  uint32_t _turnaroundUs;       // micros() the gap started
+  uint8_t _request[8];
+
+  // Written by onFrame(), taken by poll()
+  uint8_t _rx[MODBEE_MODBUS_POLL_REPLY];
+  size_t _rxLength;             // Full frame length, may exceed the buffer
+  uint32_t _rxUs;
+  bool _rxReady;
+
+  bool startNext();
+  void send(uint8_t index);
+  void handleReply(const uint8_t* frame, size_t length, uint32_t rttUs);
+  void handleMiss(bool timeout);
+  void finishPoll();
+};
+
+#endif // MODBEE_MPPT_MODBUS_MASTER_H
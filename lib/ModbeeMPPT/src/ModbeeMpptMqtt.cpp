@@ -0,0 +1,760 @@
+/*!
+ * @file ModbeeMpptMqtt.cpp
+ *
+ * @brief Implementation of the MQTT telemetry publisher and its spool
+ */
+
+#include "ModbeeMpptMqtt.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include "ModbeeMpptHash.h"
+#include <WiFi.h>
+
+// Control packet types (first byte of the fixed header)
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// PUBLISH flags
+#define MQTT_PUBLISH_QOS1 0x02
+#define MQTT_PUBLISH_RETAIN 0x01
+
+// CONNECT flags
+#define MQTT_CONNECT_CLEAN 0x02
+#define MQTT_CONNECT_PASSWORD 0x40
+#define MQTT_CONNECT_USER 0x80
+
+#define MQTT_PROTOCOL_LEVEL 4         // 3.1.1
+
+#define SPOOL_MAGIC 0x3153514DUL      // "MQS1"
+#define SPOOL_RECORD_HEADER 3         // Length (16 bits) and kind
+
+static const char* const KIND_TOPICS[] = {"telemetry", "daily"};
+
+static const char* const STATE_NAMES[] = {"idle", "joining", "connecting", "handshake", "online"};
+
+static size_t putString(uint8_t* p, const char* text) {
+  size_t length = strlen(text);
+  p[0] = length >> 8;
+  p[1] = length & 0xFF;
+  memcpy(p + 2, text, length);
+  return 2 + length;
+}
+
+// ========================================================================
+// SPOOL
+// ========================================================================
+
+ModbeeMpptMqttSpool::ModbeeMpptMqttSpool() : _ready(false) {
+  memset(&_header, 0, sizeof(_header));
+  _header.magic = SPOOL_MAGIC;
+}
+
+bool ModbeeMpptMqttSpool::begin() {
+  _ready = true;
+  if (!LittleFS.exists(MODBEE_MQTT_SPOOL_FILE)) return true;  // Created on the first push
+  File file = LittleFS.open(MODBEE_MQTT_SPOOL_FILE, "r");
+  Header header;
+  bool valid = file && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+               header.magic == SPOOL_MAGIC && header.head - header.tail <= MODBEE_MQTT_SPOOL_BYTES &&
+               header.count <= (header.head - header.tail) / (SPOOL_RECORD_HEADER + 1);
+  file.close();
+  if (!valid) {
+    MODBEE_LOGW("MQTT spool header invalid, starting empty");
+    reset();
+    return false;
+  }
+  _header = header;
+  return true;
+}
+
+File ModbeeMpptMqttSpool::open() {
+  if (LittleFS.exists(MODBEE_MQTT_SPOOL_FILE)) return LittleFS.open(MODBEE_MQTT_SPOOL_FILE, "r+");
+  if (!LittleFS.exists("/mqtt")) LittleFS.mkdir("/mqtt");
+  File file = LittleFS.open(MODBEE_MQTT_SPOOL_FILE, "w+");
+  if (file) saveHeader(file);
+  return file;
+}
+
+void ModbeeMpptMqttSpool::reset() {
+  uint32_t dropped = _header.dropped + _header.count;
+  memset(&_header, 0, sizeof(_header));
+  _header.magic = SPOOL_MAGIC;
+  _header.dropped = dropped;
+  LittleFS.remove(MODBEE_MQTT_SPOOL_FILE);
+}
+
+bool ModbeeMpptMqttSpool::access(File& file, uint32_t offset, uint8_t* data, size_t length, bool write) {
+  // The ring may wrap inside a record: at most two runs
+  uint32_t position = offset % MODBEE_MQTT_SPOOL_BYTES;
+  size_t first = min((size_t)(MODBEE_MQTT_SPOOL_BYTES - position), length);
+  size_t done = 0;
+  for (int run = 0; run < 2 && done < length; run++) {
+    size_t chunk = run == 0 ? first : length - first;
+    if (!file.seek(sizeof(Header) + (run == 0 ? position : 0))) return false;
+    size_t n = write ? file.write(data + done, chunk) : file.read(data + done, chunk);
+    if (n != chunk) return false;
+    done += chunk;
+  }
+  return true;
+}
+
+bool ModbeeMpptMqttSpool::saveHeader(File& file) {
+  return file.seek(0) && file.write((const uint8_t*)&_header, sizeof(_header)) == sizeof(_header);
+}
+
+bool ModbeeMpptMqttSpool::push(uint8_t kind, const char* payload, size_t length) {
+  size_t need = SPOOL_RECORD_HEADER + length;
+  if (!_ready || length == 0 || length > MODBEE_MQTT_PAYLOAD_MAX) return false;
+  File file = open();
+  if (!file) return false;
+
+  // Make room by dropping the oldest records
+  while (MODBEE_MQTT_SPOOL_BYTES - bytes() < need && _header.count > 0) {
+    uint8_t record[SPOOL_RECORD_HEADER];
+    if (!access(file, _header.tail, record, sizeof(record), false)) {
+      file.close();
+      reset();
+      return false;
+    }
+    _header.tail += SPOOL_RECORD_HEADER + (record[0] | record[1] << 8);
+    _header.count--;
+    _header.dropped++;
+  }
+
+  uint8_t record[SPOOL_RECORD_HEADER] = {(uint8_t)(length & 0xFF), (uint8_t)(length >> 8), kind};
+  bool written = access(file, _header.head, record, sizeof(record), true) &&
+                 access(file, _header.head + SPOOL_RECORD_HEADER, (uint8_t*)payload, length, true);
+  if (written) {
+    _header.head += need;
+    _header.count++;
+  }
+  bool saved = saveHeader(file);
+  file.close();
+  return written && saved;
+}
+
+size_t ModbeeMpptMqttSpool::peek(uint8_t& kind, char* payload) {
+  if (!_ready || _header.count == 0) return 0;
+  File file = LittleFS.open(MODBEE_MQTT_SPOOL_FILE, "r");
+  uint8_t record[SPOOL_RECORD_HEADER];
+  size_t length = 0;
+  if (file && access(file, _header.tail, record, sizeof(record), false)) {
+    length = record[0] | record[1] << 8;
+    kind = record[2];
+    if (length == 0 || length > MODBEE_MQTT_PAYLOAD_MAX || SPOOL_RECORD_HEADER + length > bytes() ||
+        !access(file, _header.tail + SPOOL_RECORD_HEADER, (uint8_t*)payload, length, false)) {
+      length = 0;
+    }
+  }
+  file.close();
+  if (length == 0) {
+    MODBEE_LOGE("MQTT spool unreadable, dropping %lu publishes", (unsigned long)_header.count);
+    reset();
+  }
+  return length;
+}
+
+void ModbeeMpptMqttSpool::pop() {
+  if (!_ready || _header.count == 0) return;
+  File file = LittleFS.open(MODBEE_MQTT_SPOOL_FILE, "r+");
+  uint8_t record[SPOOL_RECORD_HEADER];
+  if (!file || !access(file, _header.tail, record, sizeof(record), false)) {
+    file.close();
+    reset();
+    return;
+  }
+  _header.tail += SPOOL_RECORD_HEADER + (record[0] | record[1] << 8);
+  _header.count--;
+  if (_header.count == 0) _header.head = _header.tail = 0;  // Empty: start over at the front
+  saveHeader(file);
+  file.close();
+}
+
+// ========================================================================
+// CLIENT
+// ========================================================================
+
+ModbeeMpptMqtt::ModbeeMpptMqtt(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _enabled(false),
+  _port(0),
+  _keepaliveS(0),
+  _settingsHash(0),
+  _bootId(0),
+  _state(MODBEE_MQTT_IDLE),
+  _stateMs(0),
+  _stationMs(0),
+  _failures(0),
+  _retryAtMs(0),
+  _clockRequested(false),
+  _batchLength(0),
+  _batchSamples(0),
+  _batchSequence(0),
+  _lastSampleMs(0),
+  _lastTelemetrySequence(0),
+  _dailyCount(0),
+  _outboxCount(0),
+  _inFlight(false),
+  _packetId(0),
+  _sentMs(0),
+  _lastTxMs(0),
+  _pingPending(false),
+  _inLength(0),
+  _eventConnected(false),
+  _eventClosed(false),
+  _eventError(0),
+  _rxLength(0),
+  _rxOverflow(false)
+{
+  memset(&_status, 0, sizeof(_status));
+  memset(&_counters, 0, sizeof(_counters));
+  _clientId[0] = '\0';
+
+  // async_tcp task: record and copy only
+  _client.onConnect([this](void*, AsyncClient*) {
+    portENTER_CRITICAL(&_mux);
+    _eventConnected = true;
+    portEXIT_CRITICAL(&_mux);
+  });
+  _client.onDisconnect([this](void*, AsyncClient*) {
+    portENTER_CRITICAL(&_mux);
+    _eventClosed = true;
+    portEXIT_CRITICAL(&_mux);
+  });
+  _client.onError([this](void*, AsyncClient*, int8_t error) {
+    portENTER_CRITICAL(&_mux);
+    _eventError = error;
+    portEXIT_CRITICAL(&_mux);
+  });
+  _client.onData([this](void*, AsyncClient*, void* data, size_t length) {
+    portENTER_CRITICAL(&_mux);
+    size_t room = sizeof(_rx) - _rxLength;
+    if (length > room) _rxOverflow = true;
+    memcpy(_rx + _rxLength, data, min(length, room));
+    _rxLength += min(length, room);
+    portEXIT_CRITICAL(&_mux);
+  });
+}
+
+void ModbeeMpptMqtt::begin() {
+  uint64_t mac = ESP.getEfuseMac();
+  snprintf(_clientId, sizeof(_clientId), "modbee-%02x%02x%02x%02x%02x%02x",
+           (unsigned)(mac & 0xFF), (unsigned)(mac >> 8 & 0xFF), (unsigned)(mac >> 16 & 0xFF),
+           (unsigned)(mac >> 24 & 0xFF), (unsigned)(mac >> 32 & 0xFF), (unsigned)(mac >> 40 & 0xFF));
+  _bootId = esp_random();
+  _spool.begin();
+  if (_spool.count() > 0) {
+    MODBEE_LOGI("MQTT spool holds %lu publishes (%lu bytes)", (unsigned long)_spool.count(),
+                (unsigned long)_spool.bytes());
+    _failures = 1;  // Keep spooling until a session gets through
+  }
+  updateStatus();
+}
+
+void ModbeeMpptMqtt::loop() {
+  checkSettings();
+  if (_enabled) {
+    sampleTelemetry();
+    queueDaily();
+    runSession();
+  }
+  updateStatus();
+}
+
+void ModbeeMpptMqtt::checkSettings() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  uint32_t hash = ModbeeMpptHash::SEED;
+  hash = ModbeeMpptHash::text(hash, data.wifi_ssid);
+  hash = ModbeeMpptHash::text(hash, data.wifi_password);
+  hash = ModbeeMpptHash::text(hash, data.mqtt_host);
+  hash = ModbeeMpptHash::text(hash, data.mqtt_user);
+  hash = ModbeeMpptHash::text(hash, data.mqtt_password);
+  hash = ModbeeMpptHash::text(hash, data.mqtt_topic);
+  bool changed = data.mqtt_enable != _enabled ||
+                 (_enabled && (data.mqtt_port != _port || data.mqtt_keepalive_s != _keepaliveS ||
+                               hash != _settingsHash));
+  if (!changed) return;
+
+  // New broker or credentials: the next session uses them, without backoff
+  if (_state != MODBEE_MQTT_IDLE) endSession();
+  _enabled = data.mqtt_enable;
+  _port = data.mqtt_port;
+  _keepaliveS = data.mqtt_keepalive_s;
+  _settingsHash = hash;
+  _failures = _spool.count() > 0 ? 1 : 0;
+  _retryAtMs = millis();
+  if (_enabled) {
+    MODBEE_LOGI("MQTT publishing to %s:%d as %s", data.mqtt_host, data.mqtt_port, _clientId);
+  } else {
+    spillOutbox();
+    _batchSamples = 0;
+  }
+}
+
+// ========================================================================
+// BATCHING
+// ========================================================================
+
+void ModbeeMpptMqtt::sampleTelemetry() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  unsigned long now = millis();
+  if (_lastSampleMs && now - _lastSampleMs < (unsigned long)data.mqtt_interval_s * 1000UL) return;
+  modbee_telemetry_t t = _mppt.api.getTelemetry();
+  if (!t.valid || t.sequence == _lastTelemetrySequence) return;
+  _lastTelemetrySequence = t.sequence;
+  _lastSampleMs = now;
+
+  char sample[256];
+  int length = snprintf(sample, sizeof(sample),
+                        "{\"t\":%lu,\"up\":%lu,\"vbus\":%.3f,\"ibus\":%.3f,\"vbat\":%.3f,\"ibat\":%.3f,"
+                        "\"vsys\":%.3f,\"soc\":%.1f,\"state\":%u,\"faults\":%u,\"die\":%.1f,\"bt\":%.1f}",
+                        (unsigned long)ModbeeMpptDaily::epochNow(), t.timestamp_ms / 1000,
+                        t.vbus.voltage, t.vbus.current, t.battery.voltage, t.battery.current,
+                        t.system.voltage, _mppt._cachedSOC, (unsigned)t.charge_state,
+                        (unsigned)(t.fault_status0 << 8 | t.fault_status1), t.die_temperature,
+                        t.battery_temperature);
+  if (length <= 0 || length >= (int)sizeof(sample)) return;
+
+  // Close early rather than overflow the payload ("," before, "]}" after)
+  if (_batchSamples > 0 && _batchLength + 1 + length + 2 > MODBEE_MQTT_PAYLOAD_MAX) closeBatch();
+  if (_batchSamples == 0) {
+    _batchLength = snprintf(_batch, sizeof(_batch), "{\"id\":\"%s\",\"boot\":%lu,\"seq\":%lu,\"samples\":[",
+                            _clientId, (unsigned long)_bootId, (unsigned long)_batchSequence);
+  } else {
+    _batch[_batchLength++] = ',';
+  }
+  memcpy(_batch + _batchLength, sample, length);
+  _batchLength += length;
+  _batchSamples++;
+  _counters.samples++;
+
+  if (_batchSamples >= data.mqtt_batch) closeBatch();
+}
+
+void ModbeeMpptMqtt::closeBatch() {
+  memcpy(_batch + _batchLength, "]}", 2);
+  _batchLength += 2;
+  enqueue(MODBEE_MQTT_TELEMETRY, _batch, _batchLength);
+  _batchSequence++;
+  _batchSamples = 0;
+  _counters.batches++;
+}
+
+void ModbeeMpptMqtt::queueDaily() {
+  uint32_t count = _mppt.daily.completedCount();
+  if (count == _dailyCount) return;
+  _dailyCount = count;
+  modbee_daily_t day;
+  if (!_mppt.daily.lastCompleted(day)) return;
+
+  // Calendar days by date, days without a clock by their number since boot
+  char date[16];
+  if (day.wallClock) {
+    time_t start = (time_t)day.day * 86400;
+    struct tm tm;
+    gmtime_r(&start, &tm);
+    strftime(date, sizeof(date), "\"%Y-%m-%d\"", &tm);
+  } else {
+    snprintf(date, sizeof(date), "null");
+  }
+  char payload[512];
+  int length = snprintf(payload, sizeof(payload),
+                        "{\"id\":\"%s\",\"boot\":%lu,\"date\":%s,\"day\":%lu,\"seconds\":%lu,"
+                        "\"inputWh\":%.2f,\"chargeWh\":%.2f,\"dischargeWh\":%.2f,\"systemWh\":%.2f,"
+                        "\"peakInputW\":%.2f,\"vbatMin\":%.3f,\"vbatMax\":%.3f,\"socMin\":%.1f,"
+                        "\"socMax\":%.1f,\"faultSeconds\":%lu}",
+                        _clientId, (unsigned long)_bootId, date, (unsigned long)day.day,
+                        (unsigned long)day.seconds, day.inputWh, day.chargeWh, day.dischargeWh,
+                        day.systemWh, day.peakInputW, day.vbatMin, day.vbatMax, day.socMin, day.socMax,
+                        (unsigned long)day.faultSeconds);
+  if (length > 0 && length < (int)sizeof(payload)) enqueue(MODBEE_MQTT_DAILY, payload, length);
+}
+
+// ========================================================================
+// QUEUE
+// ========================================================================
+
+void ModbeeMpptMqtt::enqueue(uint8_t kind, const char* payload, size_t length) {
+  // The outbox is the newer end of the queue: while sessions fail, or when
+  // it is full, everything goes behind the spool's contents
+  if (_failures > 0 || _outboxCount == MODBEE_MQTT_OUTBOX) {
+    spillOutbox();
+    if (!_spool.push(kind, payload, length)) MODBEE_LOGE("MQTT spool write failed");
+    return;
+  }
+  Publish& publish = _outbox[_outboxCount++];
+  publish.kind = kind;
+  publish.length = length;
+  memcpy(publish.payload, payload, length);
+}
+
+void ModbeeMpptMqtt::spillOutbox() {
+  for (uint8_t i = 0; i < _outboxCount; i++) {
+    if (!_spool.push(_outbox[i].kind, _outbox[i].payload, _outbox[i].length)) {
+      MODBEE_LOGE("MQTT spool write failed");
+    }
+  }
+  _outboxCount = 0;
+}
+
+void ModbeeMpptMqtt::acknowledge() {
+  // The head of the queue was in flight: the spool's oldest, else the outbox's
+  if (_spool.count() > 0) {
+    _spool.pop();
+    _counters.replayed++;
+  } else if (_outboxCount > 0) {
+    _outboxCount--;
+    memmove(&_outbox[0], &_outbox[1], _outboxCount * sizeof(Publish));
+  }
+  _inFlight = false;
+  _counters.published++;
+  _counters.lastPublishMs = millis();
+}
+
+// ========================================================================
+// SESSION
+// ========================================================================
+
+void ModbeeMpptMqtt::setState(modbee_mqtt_state_t state) {
+  _state = state;
+  _stateMs = millis();
+}
+
+void ModbeeMpptMqtt::startStation() {
+  // Joins, or shares the station the web UI already holds
+  _stationMs = millis();
+  _mppt.station.acquire(MODBEE_STATION_MQTT);
+}
+
+void ModbeeMpptMqtt::releaseStation() {
+  _mppt.station.release(MODBEE_STATION_MQTT);
+  uint32_t onMs = millis() - _stationMs;
+  _counters.radioOnMs += onMs;
+  _counters.lastSessionMs = onMs;
+}
+
+void ModbeeMpptMqtt::fail(const char* reason) {
+  _client.close(true);
+  _inFlight = false;
+  _pingPending = false;
+  spillOutbox();
+  if (_failures < 255) _failures++;
+  uint32_t backoff = min((uint32_t)MODBEE_MQTT_RETRY_MIN_MS << min(_failures - 1, 6),
+                         (uint32_t)MODBEE_MQTT_RETRY_MAX_MS);
+  _retryAtMs = millis() + backoff;
+  if (_failures == 1) {
+    MODBEE_LOGW("MQTT %s, spooling (retry in %lu s)", reason, (unsigned long)(backoff / 1000));
+  } else {
+    MODBEE_LOGD("MQTT %s, retry in %lu s", reason, (unsigned long)(backoff / 1000));
+  }
+  _counters.failures++;
+  _counters.lastError = reason;
+  releaseStation();
+  setState(MODBEE_MQTT_IDLE);
+}
+
+void ModbeeMpptMqtt::endSession() {
+  if (_state == MODBEE_MQTT_ONLINE) sendPacket(MQTT_DISCONNECT, nullptr, 0);
+  _client.close();
+  _inFlight = false;  // Sent again in the next session
+  _pingPending = false;
+  releaseStation();
+  setState(MODBEE_MQTT_IDLE);
+}
+
+void ModbeeMpptMqtt::suspend() {
+  if (_state != MODBEE_MQTT_IDLE) endSession();
+}
+
+bool ModbeeMpptMqtt::linger() const {
+  // Keep the session if the next batch closes within one keep-alive
+  // interval: a ping costs less than joining the network again
+  if (_mppt.powerSave.isSaving()) return false;
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  uint32_t samplesLeft = data.mqtt_batch > _batchSamples ? data.mqtt_batch - _batchSamples : 1;
+  uint32_t dueMs = samplesLeft * (uint32_t)data.mqtt_interval_s * 1000UL;
+  uint32_t elapsedMs = min((uint32_t)(millis() - _lastSampleMs), dueMs);
+  return dueMs - elapsedMs < (uint32_t)_keepaliveS * 1000UL;
+}
+
+void ModbeeMpptMqtt::runSession() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  unsigned long now = millis();
+  if (_state >= MODBEE_MQTT_CONNECTING && !handleEvents()) return;
+
+  switch (_state) {
+    case MODBEE_MQTT_IDLE:
+      if (!pending() || (_failures > 0 && (long)(now - _retryAtMs) < 0)) return;
+      startStation();
+      setState(MODBEE_MQTT_JOINING);
+      break;
+
+    case MODBEE_MQTT_JOINING:
+      if (_mppt.station.isConnected()) {
+        if (!_clockRequested) {
+          configTime(0, 0, MODBEE_MQTT_NTP_SERVER);
+          _clockRequested = true;
+        }
+        resetEvents();
+        if (!_client.connect(data.mqtt_host, data.mqtt_port)) {
+          fail("TCP connect failed");
+          return;
+        }
+        setState(MODBEE_MQTT_CONNECTING);
+      } else if (now - _stateMs > MODBEE_MQTT_WIFI_TIMEOUT_MS) {
+        fail("WiFi join timed out");
+      }
+      break;
+
+    case MODBEE_MQTT_CONNECTING:
+    case MODBEE_MQTT_HANDSHAKE:
+      if (now - _stateMs > MODBEE_MQTT_CONNECT_TIMEOUT_MS) {
+        fail(_state == MODBEE_MQTT_CONNECTING ? "broker unreachable" : "no CONNACK");
+      }
+      break;
+
+    case MODBEE_MQTT_ONLINE:
+      if (!_mppt.station.isConnected()) {
+        fail("WiFi lost");
+      } else if (_inFlight || _pingPending) {
+        if (now - _sentMs > MODBEE_MQTT_ACK_TIMEOUT_MS) fail(_inFlight ? "no PUBACK" : "no PINGRESP");
+      } else if (pending()) {
+        sendPublish();  // Waits for send buffer space if it returns false
+      } else if (linger()) {
+        if (now - _lastTxMs >= (unsigned long)_keepaliveS * 750UL &&
+            sendPacket(MQTT_PINGREQ, nullptr, 0)) {
+          _pingPending = true;
+          _sentMs = now;
+        }
+      } else {
+        endSession();
+      }
+      break;
+  }
+}
+
+void ModbeeMpptMqtt::resetEvents() {
+  portENTER_CRITICAL(&_mux);
+  _eventConnected = false;
+  _eventClosed = false;
+  _eventError = 0;
+  _rxLength = 0;
+  _rxOverflow = false;
+  portEXIT_CRITICAL(&_mux);
+  _inLength = 0;
+}
+
+bool ModbeeMpptMqtt::handleEvents() {
+  portENTER_CRITICAL(&_mux);
+  bool connected = _eventConnected;
+  bool closed = _eventClosed;
+  int8_t error = _eventError;
+  bool overflow = _rxOverflow;
+  size_t length = min(_rxLength, sizeof(_in) - _inLength);
+  memcpy(_in + _inLength, _rx, length);
+  _inLength += length;
+  overflow = overflow || length < _rxLength;
+  _eventConnected = false;
+  _eventClosed = false;
+  _eventError = 0;
+  _rxLength = 0;
+  _rxOverflow = false;
+  portEXIT_CRITICAL(&_mux);
+
+  if (overflow) {
+    fail("unexpected data from broker");
+    return false;
+  }
+  if (error != 0) {
+    fail(_client.errorToString(error));
+    return false;
+  }
+  if (connected && _state == MODBEE_MQTT_CONNECTING) {
+    if (!sendConnect()) {
+      fail("CONNECT not sent");
+      return false;
+    }
+    setState(MODBEE_MQTT_HANDSHAKE);
+  }
+  if (!handlePackets()) return false;
+  if (closed) {
+    fail("connection closed by broker");
+    return false;
+  }
+  return true;
+}
+
+bool ModbeeMpptMqtt::handlePackets() {
+  size_t offset = 0;
+  while (_inLength - offset >= 2) {
+    const uint8_t* packet = _in + offset;
+    // Remaining length: variable byte integer, at most 4 bytes
+    size_t remaining = 0;
+    size_t used = 1;
+    bool complete = false;
+    for (int shift = 0; used < 5 && offset + used < _inLength; shift += 7) {
+      uint8_t b = packet[used++];
+      remaining |= (size_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) break;
+    if (used + remaining > sizeof(_in)) {
+      fail("oversized packet from broker");
+      return false;
+    }
+    if (offset + used + remaining > _inLength) break;  // Rest still on the way
+    const uint8_t* body = packet + used;
+
+    switch (packet[0] & 0xF0) {
+      case MQTT_CONNACK:
+        if (_state != MODBEE_MQTT_HANDSHAKE || remaining != 2) break;
+        if (body[1] != 0) {
+          MODBEE_LOGW("MQTT broker refused the connection (code %u)", body[1]);
+          fail("connection refused");
+          return false;
+        }
+        if (_failures > 0) {
+          MODBEE_LOGI("MQTT connected, replaying %lu spooled publishes", (unsigned long)_spool.count());
+        }
+        _failures = 0;
+        _counters.sessions++;
+        _counters.lastError = nullptr;
+        setState(MODBEE_MQTT_ONLINE);
+        break;
+      case MQTT_PUBACK:
+        if (remaining == 2 && _inFlight && (body[0] << 8 | body[1]) == _packetId) acknowledge();
+        break;
+      case MQTT_PINGRESP:
+        _pingPending = false;
+        break;
+      default:
+        break;  // Nothing else is expected without subscriptions
+    }
+    offset += used + remaining;
+  }
+  memmove(_in, _in + offset, _inLength - offset);
+  _inLength -= offset;
+  return true;
+}
+
+bool ModbeeMpptMqtt::sendPacket(uint8_t type, const uint8_t* header, size_t headerLength,
+                                const char* payload, size_t payloadLength) {
+  uint8_t fixed[5];
+  size_t remaining = headerLength + payloadLength;
+  size_t fixedLength = 0;
+  fixed[fixedLength++] = type;
+  do {
+    uint8_t b = remaining & 0x7F;
+    remaining >>= 7;
+    fixed[fixedLength++] = remaining ? b | 0x80 : b;
+  } while (remaining);
+
+  if (_client.space() < fixedLength + headerLength + payloadLength) return false;
+  _client.add((const char*)fixed, fixedLength);
+  if (headerLength) _client.add((const char*)header, headerLength);
+  if (payloadLength) _client.add(payload, payloadLength);
+  if (!_client.send()) return false;
+  _lastTxMs = millis();
+  return true;
+}
+
+bool ModbeeMpptMqtt::sendConnect() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  uint8_t packet[10 + 2 + sizeof(_clientId) + 2 + sizeof(data.mqtt_user) + 2 + sizeof(data.mqtt_password)];
+  size_t length = putString(packet, "MQTT");
+  packet[length++] = MQTT_PROTOCOL_LEVEL;
+  // A password is only allowed with a user name
+  uint8_t flags = MQTT_CONNECT_CLEAN;
+  if (data.mqtt_user[0]) flags |= MQTT_CONNECT_USER;
+  if (data.mqtt_user[0] && data.mqtt_password[0]) flags |= MQTT_CONNECT_PASSWORD;
+  packet[length++] = flags;
+  packet[length++] = _keepaliveS >> 8;
+  packet[length++] = _keepaliveS & 0xFF;
+  length += putString(packet + length, _clientId);
+  if (flags & MQTT_CONNECT_USER) length += putString(packet + length, data.mqtt_user);
+  if (flags & MQTT_CONNECT_PASSWORD) length += putString(packet + length, data.mqtt_password);
+  return sendPacket(MQTT_CONNECT, packet, length);
+}
+
+void ModbeeMpptMqtt::topicFor(uint8_t kind, char* topic, size_t size) const {
+  snprintf(topic, size, "%s/%s/%s", _mppt.config.data.mqtt_topic, _clientId,
+           KIND_TOPICS[kind < 2 ? kind : 0]);
+}
+
+bool ModbeeMpptMqtt::sendPublish() {
+  const Publish* publish = &_outbox[0];
+  if (_spool.count() > 0) {
+    uint8_t kind;
+    size_t length = _spool.peek(kind, _head.payload);
+    if (length == 0) return false;  // Spool was reset, the outbox is next
+    _head.kind = kind;
+    _head.length = length;
+    publish = &_head;
+  }
+
+  // Variable header: topic and packet identifier
+  uint8_t header[2 + sizeof(_mppt.config.data.mqtt_topic) + sizeof(_clientId) + 16 + 2];
+  char topic[sizeof(header) - 4];
+  topicFor(publish->kind, topic, sizeof(topic));
+  size_t length = putString(header, topic);
+  // Identifiers run 1..65535; 0 is not allowed
+  uint16_t packetId = (_packetId == 0xFFFF) ? 1 : _packetId + 1;
+  header[length++] = packetId >> 8;
+  header[length++] = packetId & 0xFF;
+
+  uint8_t type = MQTT_PUBLISH | MQTT_PUBLISH_QOS1;
+  if (publish->kind == MODBEE_MQTT_DAILY) type |= MQTT_PUBLISH_RETAIN;
+  if (!sendPacket(type, header, length, publish->payload, publish->length)) return false;
+  _packetId = packetId;
+  _inFlight = true;
+  _sentMs = millis();
+  return true;
+}
+
+// ========================================================================
+// STATUS
+// ========================================================================
+
+void ModbeeMpptMqtt::updateStatus() {
+  _counters.enabled = _enabled;
+  _counters.state = _state;
+  _counters.spooled = _spool.count();
+  _counters.spoolBytes = _spool.bytes();
+  _counters.spoolDropped = _spool.dropped();
+  portENTER_CRITICAL(&_mux);
+  _status = _counters;
+  portEXIT_CRITICAL(&_mux);
+}
+
+modbee_mqtt_status_t ModbeeMpptMqtt::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_mqtt_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+void ModbeeMpptMqtt::printStatus() const {
+  modbee_mqtt_status_t s = getStatus();
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  Serial.printf("=== MQTT (%s, %s) ===\n", s.enabled ? "on" : "off", STATE_NAMES[s.state]);
+  Serial.printf("Broker: %s:%d, topic %s/%s/..., client %s\n", data.mqtt_host, data.mqtt_port,
+                data.mqtt_topic, _clientId, _clientId);
+  Serial.printf("Samples: %lu in %lu batches (%u per publish, every %d s)\n", (unsigned long)s.samples,
+                (unsigned long)s.batches, data.mqtt_batch, data.mqtt_interval_s);
+  Serial.printf("Published: %lu (%lu from spool), sessions %lu, failures %lu%s%s\n",
+                (unsigned long)s.published, (unsigned long)s.replayed, (unsigned long)s.sessions,
+                (unsigned long)s.failures, s.lastError ? ", last: " : "", s.lastError ? s.lastError : "");
+  Serial.printf("Spool: %lu publishes, %lu bytes, %lu dropped\n", (unsigned long)s.spooled,
+                (unsigned long)s.spoolBytes, (unsigned long)s.spoolDropped);
+  Serial.printf("Radio on: %lu ms total, %lu ms last session, %lu ms per publish\n", (unsigned long)s.radioOnMs,
+                (unsigned long)s.lastSessionMs, (unsigned long)(s.published ? s.radioOnMs / s.published : 0));
+}
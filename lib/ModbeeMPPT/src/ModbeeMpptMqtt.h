@@ -0,0 +1,273 @@
+/*!
+ * @file ModbeeMpptMqtt.h
+ *
+ * @brief MQTT telemetry publisher over station-mode WiFi for ModbeeMPPT
+ *
+ * With mqttEnable set, a telemetry sample is taken every mqttInterval
+ * seconds and mqttBatch samples go out as one JSON publish to
+ * <mqttTopic>/<client id>/telemetry; each completed day from
+ * ModbeeMpptDaily goes to <mqttTopic>/<client id>/daily (retained). All
+ * publishes are QoS 1 and leave the queue only when the broker has
+ * acknowledged them, one in flight at a time, so the backend sees them in
+ * the order they were taken.
+ *
+ * The radio is only on for a session: when a publish is queued the station
+ * (ModbeeMpptStation) joins, the client connects, drains the queue and disconnects again. The
+ * session is kept open, with keep-alive pings, only if the next batch is
+ * due within the keep-alive interval and ModbeeMpptPowerSave is not saving
+ * power, which is cheaper than joining again. The power-save module waits
+ * for a session to end before its SOC check may sleep, and suspend() ends
+ * one at once before light sleep.
+ *
+ * Publishes wait in RAM (a small outbox) while a session comes up. When a
+ * session fails (no WiFi, no broker, no acknowledgement) the outbox moves
+ * to a LittleFS ring (ModbeeMpptMqttSpool) and new publishes go straight
+ * there until a session succeeds; the ring is replayed oldest first before
+ * anything newer, and drops its oldest publishes when full. Failed
+ * sessions are retried with exponential backoff.
+ *
+ * The protocol is MQTT 3.1.1 (CONNECT, PUBLISH, PUBACK, PINGREQ,
+ * DISCONNECT), encoded here over an AsyncTCP client. TCP callbacks run in
+ * the async_tcp task and only record events and copy received bytes;
+ * everything else runs in loop() on the main loop.
+ */
+
+#ifndef MODBEE_MPPT_MQTT_H
+#define MODBEE_MPPT_MQTT_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptConfig.h"
+#include <AsyncTCP.h>
+#include <LittleFS.h>
+
+#ifndef MODBEE_MQTT_PAYLOAD_MAX
+#define MODBEE_MQTT_PAYLOAD_MAX 2048           // One publish: a telemetry batch or a daily rollup
+#endif
+#ifndef MODBEE_MQTT_SPOOL_BYTES
+#define MODBEE_MQTT_SPOOL_BYTES 65536          // LittleFS ring for publishes no broker took
+#endif
+#ifndef MODBEE_MQTT_WIFI_TIMEOUT_MS
+#define MODBEE_MQTT_WIFI_TIMEOUT_MS 15000      // Station join and DHCP
+#endif
+#define MODBEE_MQTT_SPOOL_FILE "/mqtt/spool.bin"
+#define MODBEE_MQTT_OUTBOX 2                   // Publishes held in RAM before spilling to the ring
+#define MODBEE_MQTT_CONNECT_TIMEOUT_MS 10000   // TCP connect and CONNACK
+#define MODBEE_MQTT_ACK_TIMEOUT_MS 10000       // PUBACK or PINGRESP
+#define MODBEE_MQTT_RETRY_MIN_MS 5000          // Backoff after a failed session, doubled per failure
+#define MODBEE_MQTT_RETRY_MAX_MS 300000
+#define MODBEE_MQTT_RX_BUFFER 64               // Only CONNACK, PUBACK and PINGRESP are expected
+#define MODBEE_MQTT_NTP_SERVER "pool.ntp.org"  // Sets the clock for sample and day timestamps
+
+// Kinds of publish (topic suffix)
+typedef enum {
+  MODBEE_MQTT_TELEMETRY = 0,
+  MODBEE_MQTT_DAILY = 1
+} modbee_mqtt_kind_t;
+
+typedef enum {
+  MODBEE_MQTT_IDLE = 0,         // Radio released, nothing to send or backing off
+  MODBEE_MQTT_JOINING,          // Station joining the access point
+  MODBEE_MQTT_CONNECTING,       // TCP connect to the broker
+  MODBEE_MQTT_HANDSHAKE,        // CONNECT sent, waiting for CONNACK
+  MODBEE_MQTT_ONLINE            // Publishing
+} modbee_mqtt_state_t;
+
+typedef struct {
+  bool enabled;
+  modbee_mqtt_state_t state;
+  uint32_t samples;             // Telemetry samples taken
+  uint32_t batches;             // Telemetry publishes queued
+  uint32_t published;           // Publishes acknowledged by the broker
+  uint32_t replayed;            // Of those, taken from the spool
+  uint32_t sessions;            // Sessions the broker accepted
+  uint32_t failures;            // Sessions that failed
+  uint32_t spooled;             // Publishes in the spool
+  uint32_t spoolBytes;
+  uint32_t spoolDropped;        // Oldest publishes dropped from a full spool
+  uint32_t radioOnMs;           // Station time spent on sessions since boot
+  uint32_t lastSessionMs;       // Station time of the last session
+  unsigned long lastPublishMs;  // millis() of the last acknowledgement, 0 = none
+  const char* lastError;        // Why the last session failed, nullptr = none
+} modbee_mqtt_status_t;
+
+/*!
+ * @brief FIFO of publishes in a LittleFS file, used as a byte ring
+ *
+ * The file holds a header and MODBEE_MQTT_SPOOL_BYTES of ring; a record is
+ * a 16-bit length, the kind, and the payload, and may wrap. Data is written
+ * before the header, so a power cut loses at most the record being pushed.
+ */
+class ModbeeMpptMqttSpool {
+public:
+  ModbeeMpptMqttSpool();
+
+  /*!
+   * @brief Open the ring file, creating or resetting it if invalid
+   */
+  bool begin();
+
+  /*!
+   * @brief Append a publish, dropping the oldest ones if there is no room
+   */
+  bool push(uint8_t kind, const char* payload, size_t length);
+
+  /*!
+   * @brief Copy the oldest publish
+   * @param kind Publish kind
+   * @param payload Destination, MODBEE_MQTT_PAYLOAD_MAX bytes
+   * @return Payload length, 0 if the spool is empty or unreadable
+   */
+  size_t peek(uint8_t& kind, char* payload);
+
+  /*!
+   * @brief Drop the oldest publish
+   */
+  void pop();
+
+  uint32_t count() const { return _header.count; }
+  uint32_t bytes() const { return _header.head - _header.tail; }
+  uint32_t dropped() const { return _header.dropped; }
+
+private:
+  struct Header {
+    uint32_t magic;
+    uint32_t head;              // Ring offset of the next record, free running
+    uint32_t tail;              // Ring offset of the oldest record
+    uint32_t count;
+    uint32_t dropped;
+  };
+
+  Header _header;
+  bool _ready;
+
+  File open();
+  bool access(File& file, uint32_t offset, uint8_t* data, size_t length, bool write);
+  bool saveHeader(File& file);
+  void reset();
+};
+
+class ModbeeMpptMqtt {
+public:
+  ModbeeMpptMqtt(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Open the spool; the first session starts when a publish is due
+   */
+  void begin();
+
+  /*!
+   * @brief Sample, batch and run the session; call every loop pass
+   */
+  void loop();
+
+  /*!
+   * @brief End a session now (before light sleep); queued publishes stay
+   */
+  void suspend();
+
+  /*!
+   * @brief True while a session holds the station interface
+   */
+  bool stationActive() const { return _state != MODBEE_MQTT_IDLE; }
+
+  /*!
+   * @brief Copy of the status and counters (any task)
+   */
+  modbee_mqtt_status_t getStatus() const;
+
+  /*!
+   * @brief Print the status to Serial
+   */
+  void printStatus() const;
+
+  // The host test (test/native/test_mqtt.cpp) moves the packet identifier to its wrap
+  friend class ModbeeMpptMqttTest;
+
+private:
+  struct Publish {
+    uint8_t kind;
+    uint16_t length;
+    char payload[MODBEE_MQTT_PAYLOAD_MAX];
+  };
+
+  class ModbeeMPPT& _mppt;
+  AsyncClient _client;
+  ModbeeMpptMqttSpool _spool;
+  mutable portMUX_TYPE _mux;
+  modbee_mqtt_status_t _status;
+
+  // Settings the session was started with
+  bool _enabled;
+  int _port;
+  int _keepaliveS;
+  uint32_t _settingsHash;       // Text settings (SSID, host, credentials, topic)
+
+  char _clientId[20];
+  uint32_t _bootId;             // Random per boot, with seq identifies a batch
+  modbee_mqtt_state_t _state;
+  unsigned long _stateMs;       // millis() the state was entered
+  unsigned long _stationMs;     // millis() the station was started
+  uint8_t _failures;            // Consecutive failed sessions
+  unsigned long _retryAtMs;
+  bool _clockRequested;
+
+  // Batch being built
+  char _batch[MODBEE_MQTT_PAYLOAD_MAX];
+  size_t _batchLength;
+  uint8_t _batchSamples;
+  uint32_t _batchSequence;
+  unsigned long _lastSampleMs;
+  uint32_t _lastTelemetrySequence;
+  uint32_t _dailyCount;         // ModbeeMpptDaily::completedCount() already queued
+
+  // Queue: spool (older) then outbox (newer); the head is in flight
+  Publish _outbox[MODBEE_MQTT_OUTBOX];
+  uint8_t _outboxCount;
+  Publish _head;                // Copy of the spool head being sent
+  bool _inFlight;
+  uint16_t _packetId;
+  unsigned long _sentMs;
+  unsigned long _lastTxMs;
+  bool _pingPending;
+
+  modbee_mqtt_status_t _counters; // Main loop copy of the status, published by updateStatus()
+  uint8_t _in[MODBEE_MQTT_RX_BUFFER]; // Received bytes not yet parsed
+  size_t _inLength;
+
+  // Written by the TCP callbacks, taken by loop()
+  bool _eventConnected;
+  bool _eventClosed;
+  int8_t _eventError;
+  uint8_t _rx[MODBEE_MQTT_RX_BUFFER];
+  size_t _rxLength;
+  bool _rxOverflow;
+
+  void checkSettings();
+  void sampleTelemetry();
+  void queueDaily();
+  void closeBatch();
+  void enqueue(uint8_t kind, const char* payload, size_t length);
+  void spillOutbox();
+  bool pending() const { return _outboxCount > 0 || _spool.count() > 0; }
+
+  void runSession();
+  void startStation();
+  void releaseStation();
+  void setState(modbee_mqtt_state_t state);
+  void fail(const char* reason);
+  void endSession();
+  bool linger() const;
+
+  void resetEvents();
+  bool handleEvents();
+  bool handlePackets();
+  bool sendConnect();
+  bool sendPublish();
+  bool sendPacket(uint8_t type, const uint8_t* header, size_t headerLength,
+                  const char* payload = nullptr, size_t payloadLength = 0);
+  void acknowledge();
+  void topicFor(uint8_t kind, char* topic, size_t size) const;
+  void updateStatus();
+};
+
+#endif // MODBEE_MPPT_MQTT_H
@@ -0,0 +1,123 @@
+/*!
+ * @file ModbeeMpptOcv.cpp
+ *
+ * @brief Implementation of the OCV vs SOC curves
+ */
+
+#include "ModbeeMpptOcv.h"
+#include <math.h>
+
+// Rested OCV per cell at 0, 6.25, ... 100 % SOC (mV), tempco (µV/°C)
+static constexpr modbee_ocv_curve_t OCV_LIFEPO4 = {
+  {2500, 2812, 3050, 3175, 3210, 3224, 3242, 3254, 3260, 3266, 3272, 3279, 3290, 3302, 3315, 3350, 3400}, -50
+};
+static constexpr modbee_ocv_curve_t OCV_LIPO = {
+  {3000, 3281, 3490, 3590, 3650, 3698, 3735, 3765, 3790, 3828, 3868, 3911, 3955, 4001, 4058, 4118, 4180}, -100
+};
+static constexpr modbee_ocv_curve_t OCV_LEAD_ACID = {
+  {1930, 1949, 1965, 1978, 1990, 2002, 2015, 2024, 2030, 2042, 2055, 2068, 2075, 2082, 2095, 2108, 2120}, 200
+};
+
+// The search and the interpolation rely on strictly increasing points
+static constexpr bool increasing(const modbee_ocv_curve_t& curve, uint8_t i = 1) {
+  return i >= MODBEE_OCV_POINTS || (curve.mv[i] > curve.mv[i - 1] && increasing(curve, i + 1));
+}
+static_assert(increasing(OCV_LIFEPO4) && increasing(OCV_LIPO) && increasing(OCV_LEAD_ACID),
+              "OCV curves must be strictly increasing");
+static_assert(MODBEE_OCV_POINTS == 17, "segment() searches exactly 16 segments");
+
+const modbee_ocv_curve_t* ModbeeMpptOcv::getCurve(modbee_battery_type_t type) {
+  switch (type) {
+    case MODBEE_BATTERY_LIFEPO4: return &OCV_LIFEPO4;
+    case MODBEE_BATTERY_LIPO: return &OCV_LIPO;
+    case MODBEE_BATTERY_LEAD_ACID: return &OCV_LEAD_ACID;
+    default: return nullptr;
+  }
+}
+
+bool ModbeeMpptOcv::isValid(const modbee_ocv_curve_t& curve) {
+  if (curve.mv[0] < MODBEE_OCV_CUSTOM_MIN_MV) return false;
+  if (curve.mv[MODBEE_OCV_POINTS - 1] > MODBEE_OCV_CUSTOM_MAX_MV) return false;
+  for (uint8_t i = 1; i < MODBEE_OCV_POINTS; i++) {
+    if (curve.mv[i] <= curve.mv[i - 1]) return false;
+  }
+  return true;
+}
+
+// ========================================================================
+// FIXED POINT EVALUATION
+// ========================================================================
+
+uint8_t ModbeeMpptOcv::segment(const modbee_ocv_curve_t& curve, int32_t cellUv) {
+  // Branch-free binary search: each step adds its half-width when the
+  // voltage is at or above that point. Comparisons compile to slt, so the
+  // timing does not depend on the voltage. Result 0..15, segment [i, i+1]
+  const uint16_t* mv = curve.mv;
+  uint32_t i = 0;
+  i += (uint32_t)(cellUv >= (int32_t)mv[i + 8] * 1000) << 3;
+  i += (uint32_t)(cellUv >= (int32_t)mv[i + 4] * 1000) << 2;
+  i += (uint32_t)(cellUv >= (int32_t)mv[i + 2] * 1000) << 1;
+  i += (uint32_t)(cellUv >= (int32_t)mv[i + 1] * 1000);
+  return (uint8_t)i;
+}
+
+uint16_t ModbeeMpptOcv::socAt(const modbee_ocv_curve_t& curve, int32_t cellUv) {
+  uint8_t i = segment(curve, cellUv);
+  int32_t low = (int32_t)curve.mv[i] * 1000;
+  int32_t span = ((int32_t)curve.mv[i + 1] - curve.mv[i]) * 1000;
+
+  // Clamp the position to [0, span] with masks instead of branches
+  int32_t position = cellUv - low;
+  position &= ~(position >> 31);
+  int32_t over = span - position;
+  position = span - (over & ~(over >> 31));
+
+  // span < 4.5 V for any valid curve, so position * 625 fits in 32 bits
+  return (uint16_t)(i * MODBEE_OCV_SOC_STEP + (uint32_t)position * MODBEE_OCV_SOC_STEP / (uint32_t)span);
+}
+
+int32_t ModbeeMpptOcv::voltageAt(const modbee_ocv_curve_t& curve, uint16_t soc) {
+  if (soc > MODBEE_OCV_SOC_FULL) soc = MODBEE_OCV_SOC_FULL;
+  uint32_t i = soc / MODBEE_OCV_SOC_STEP;
+  if (i > MODBEE_OCV_POINTS - 2) i = MODBEE_OCV_POINTS - 2;
+  int32_t span = (int32_t)curve.mv[i + 1] - curve.mv[i];
+  int32_t position = soc - i * MODBEE_OCV_SOC_STEP;
+  // mV span x position / 625 steps in µV is x 1000 / 625 = x 8 / 5
+  return (int32_t)curve.mv[i] * 1000 + span * position * 8 / 5;
+}
+
+// ========================================================================
+// FLOAT HELPERS
+// ========================================================================
+
+int32_t ModbeeMpptOcv::temperatureOffset(const modbee_ocv_curve_t& curve, float temperature) {
+  // Sentinel readings (no NTC fitted) read as the reference temperature
+  if (isnan(temperature) || temperature <= -40.0f || temperature >= 150.0f) return 0;
+  int32_t degrees = (int32_t)lroundf(temperature);
+  if (degrees < -20) degrees = -20;
+  if (degrees > 60) degrees = 60;
+  return (int32_t)curve.tempco_uv * (degrees - MODBEE_OCV_TEMP_REFERENCE);
+}
+
+float ModbeeMpptOcv::socFromVoltage(const modbee_ocv_curve_t& curve, float cellVoltage,
+                                    float temperature, float* slope) {
+  int32_t cellUv = (int32_t)lroundf(cellVoltage * 1e6f) - temperatureOffset(curve, temperature);
+  if (slope) {
+    uint8_t i = segment(curve, cellUv);
+    *slope = (curve.mv[i + 1] - curve.mv[i]) * 1e-3f * (MODBEE_OCV_SOC_FULL / MODBEE_OCV_SOC_STEP);
+  }
+  return socAt(curve, cellUv) * (1.0f / MODBEE_OCV_SOC_FULL);
+}
+
+float ModbeeMpptOcv::voltageFromSoc(const modbee_ocv_curve_t& curve, float soc,
+                                    float temperature, float* slope) {
+  if (soc < 0.0f) soc = 0.0f;
+  if (soc > 1.0f) soc = 1.0f;
+  uint16_t fixed = (uint16_t)lroundf(soc * MODBEE_OCV_SOC_FULL);
+  if (slope) {
+    uint32_t i = fixed / MODBEE_OCV_SOC_STEP;
+    if (i > MODBEE_OCV_POINTS - 2) i = MODBEE_OCV_POINTS - 2;
+    *slope = (curve.mv[i + 1] - curve.mv[i]) * 1e-3f * (MODBEE_OCV_SOC_FULL / MODBEE_OCV_SOC_STEP);
+  }
+  return (voltageAt(curve, fixed) + temperatureOffset(curve, temperature)) * 1e-6f;
+}
@@ -0,0 +1,90 @@
+/*!
+ * @file ModbeeMpptOcv.h
+ *
+ * @brief Open-circuit voltage vs state of charge curves for ModbeeMPPT
+ *
+ * One rested OCV curve per cell for each chemistry, 17 points at 0, 6.25,
+ * ... 100 % SOC, plus a temperature coefficient referenced to 25 °C. The
+ * built-in curves are constexpr tables in flash; MODBEE_BATTERY_CUSTOM
+ * uses a curve uploaded into the configuration.
+ *
+ * Evaluation is integer only (the C3 has no FPU): the segment is found by
+ * a branch-free binary search over the 16 segments (four compare-and-add
+ * steps, no data-dependent jumps) and interpolated linearly in µV and
+ * 0.01 % SOC units. The float helpers convert at the edges.
+ */
+
+#ifndef MODBEE_MPPT_OCV_H
+#define MODBEE_MPPT_OCV_H
+
+#include <stdint.h>
+#include "ModbeeMpptAPI.h"
+
+#define MODBEE_OCV_POINTS 17                // Curve points, a power of two segments
+#define MODBEE_OCV_SOC_FULL 10000           // SOC unit: 0.01 %
+#define MODBEE_OCV_SOC_STEP (MODBEE_OCV_SOC_FULL / (MODBEE_OCV_POINTS - 1))
+#define MODBEE_OCV_TEMP_REFERENCE 25        // °C the curves are measured at
+
+// Accepted range for uploaded curves (mV per cell)
+#define MODBEE_OCV_CUSTOM_MIN_MV 500
+#define MODBEE_OCV_CUSTOM_MAX_MV 5000
+
+typedef struct {
+  uint16_t mv[MODBEE_OCV_POINTS];   // Rested OCV per cell (mV), strictly increasing
+  int16_t tempco_uv;                // OCV change per cell per °C above 25 °C (µV)
+} modbee_ocv_curve_t;
+
+class ModbeeMpptOcv {
+public:
+  /*!
+   * @brief Built-in curve for a chemistry
+   * @return nullptr for MODBEE_BATTERY_CUSTOM
+   */
+  static const modbee_ocv_curve_t* getCurve(modbee_battery_type_t type);
+
+  /*!
+   * @brief True if the curve can be evaluated (custom curve validation)
+   */
+  static bool isValid(const modbee_ocv_curve_t& curve);
+
+  /*!
+   * @brief SOC for a rested cell voltage (fixed point)
+   * @param curve Curve to evaluate
+   * @param cellUv Cell voltage (µV), already temperature compensated
+   * @return SOC in 0.01 % (0 - MODBEE_OCV_SOC_FULL), clamped at the curve ends
+   */
+  static uint16_t socAt(const modbee_ocv_curve_t& curve, int32_t cellUv);
+
+  /*!
+   * @brief Rested cell voltage for a SOC (fixed point inverse of socAt)
+   * @param soc SOC in 0.01 %
+   * @return Cell voltage (µV) at 25 °C
+   */
+  static int32_t voltageAt(const modbee_ocv_curve_t& curve, uint16_t soc);
+
+  /*!
+   * @brief SOC for a rested cell voltage
+   * @param cellVoltage Cell voltage (V)
+   * @param temperature Battery temperature (°C), NAN or out of range reads as 25 °C
+   * @param slope Optional, set to the curve slope there (V per unit SOC)
+   * @return SOC fraction 0..1
+   */
+  static float socFromVoltage(const modbee_ocv_curve_t& curve, float cellVoltage,
+                              float temperature, float* slope = nullptr);
+
+  /*!
+   * @brief Rested cell voltage for a SOC
+   * @param soc SOC fraction 0..1
+   * @param temperature Battery temperature (°C), NAN or out of range reads as 25 °C
+   * @param slope Optional, set to the curve slope there (V per unit SOC)
+   * @return Cell voltage (V)
+   */
+  static float voltageFromSoc(const modbee_ocv_curve_t& curve, float soc,
+                              float temperature, float* slope = nullptr);
+
+private:
+  static uint8_t segment(const modbee_ocv_curve_t& curve, int32_t cellUv);
+  static int32_t temperatureOffset(const modbee_ocv_curve_t& curve, float temperature);
+};
+
+#endif // MODBEE_MPPT_OCV_H
@@ -1,16 +1,21 @@
 #include "ModbeeMpptPowerSave.h"
 #include "ModbeeMPPT.h"
 #include "ModbeeMpptWebServer.h"
+#include "ModbeeMpptEventLog.h"
 #include <esp_sleep.h>
 
 ModbeeMpptPowerSave::ModbeeMpptPowerSave(ModbeeMPPT& mppt)
     : _mppt(mppt), _powerSaveMode(1), _socSetpoint1(20.0), _socSetpoint2(10.0),
       _wakeInterval1(10000), _wakeInterval2(600000), _lastSocCheck(0),
-      _wifiEnableTime(0), _bluetoothActive(false), _buttonPressed(false) {}
+      _wifiEnableTime(0), _bluetoothActive(false), _buttonPressed(false), _saving(false),
+      _soc(100.0f), _bleMode(MODBEE_BLE_OFF), _sleepMs(0) {}
 
 void ModbeeMpptPowerSave::begin() {
     pinMode(WIFI_BUTTON_PIN, INPUT);
     _wifiEnableTime = millis();
+    // A low-power boot comes up with BLE rather than waiting for the first SOC check
+    _soc = _mppt._cachedSOC;
+    updateBluetooth();
 }
 
 void ModbeeMpptPowerSave::loop() {
@@ -19,17 +24,38 @@ void ModbeeMpptPowerSave::loop() {
     // WiFi timeout (5 min)
     if (now - _wifiEnableTime > 300000) {
         disableWiFi();
-        disableBluetooth();
+        if (!preferBluetooth()) disableBluetooth();
     }
+    // Settings change of bleMode
+    if (_mppt.config.data.ble_mode != _bleMode) updateBluetooth();
     // Button press triggers enableWiFi directly (see handleWiFiButton)
     handleWiFiButton();
-    // SOC check triggers sleep directly
-    if (now - _lastSocCheck > 60000) {
+    // SOC check triggers sleep directly, once an MQTT session has released the station
+    // and no BLE client is connected
+    if (now - _lastSocCheck > 60000 && !_mppt.mqtt.stationActive() && !_mppt.ble.isConnected()) {
         _lastSocCheck = now;
         checkPowerSave();
+        updateBluetooth();
+    }
+    // Beacon mode sleeps between advertising bursts; the beacon is stopped
+    // with the radio and bursts again on wake
+    uint32_t idleMs = _mppt.ble.beaconIdleMs();
+    if (idleMs >= MODBEE_BLE_BEACON_MIN_SLEEP_MS && canBeaconSleep()) {
+        enterLightSleep(idleMs);
+        enableBluetooth();
     }
 }
 
+bool ModbeeMpptPowerSave::canBeaconSleep() const {
+    // Not while the AP or an MQTT session has the radio, or Modbus may be polled
+    if (WiFi.getMode() != WIFI_OFF || _mppt.mqtt.stationActive() || _mppt.config.data.modbus_enable) return false;
+    // Nor in the middle of a timed sequence: the charger would be left forced
+    // to discharge or with a swept VINDPM for the whole sleep
+    return !_mppt.api.isTrueBatteryVoltageBusy() &&
+           _mppt.tracker.getStatus().state != MODBEE_TRACKER_SWEEPING &&
+           !_mppt.curveTracer.isPending() && !_mppt.selfTest.isPending();
+}
+
 void ModbeeMpptPowerSave::handleWiFiButton() {
     // Simple debounce logic
     static unsigned long lastPressTime = 0;
@@ -45,18 +71,28 @@ void ModbeeMpptPowerSave::handleWiFiButton() {
             if (!_mppt._webServer) {
                 _mppt.initWebServer();
             }
-            if (!_mppt.isWebServerEnabled()) {
-                _mppt.enableWebServer();
+            if (_mppt.config.data.ble_mode == MODBEE_BLE_LOW_SOC && preferBluetooth()) {
+                // Low battery: BLE is the cheaper way in, the AP stays off
+                MODBEE_LOGI("Button: BLE instead of WiFi AP (SOC %.1f%%)", _soc);
+                enableBluetooth();
+                _wifiEnableTime = millis();
+            } else {
+                if (!_mppt.isWebServerEnabled()) {
+                    _mppt.enableWebServer();
+                }
+                enableWiFi();
+                _wifiEnableTime = millis();
             }
-            enableWiFi();
-            _wifiEnableTime = millis();
         }
     }
     lastButtonState = buttonState;
 }
 
 void ModbeeMpptPowerSave::checkPowerSave() {
+    // OCV curve SOC of the true battery voltage, temperature compensated
     float soc = _mppt.api.getActualBatterySOC();
+    _soc = soc;
+    _saving = (_powerSaveMode == 1 && soc < _socSetpoint1) || (_powerSaveMode == 2 && soc < _socSetpoint2);
     if (_powerSaveMode == 1 && soc < _socSetpoint1) {
         enterLightSleep(_wakeInterval1);
     } else if (_powerSaveMode == 2 && soc < _socSetpoint2) {
@@ -77,9 +113,12 @@ void ModbeeMpptPowerSave::enterLightSleep(uint32_t wakeTimeMs) {
     // Turn off LED before sleep
     _mppt._leds[0] = CRGB::Black;
     FastLED.show();
+    _mppt.mqtt.suspend();
     disableWiFi();
     disableBluetooth();
+    unsigned long sleepStart = millis();
     esp_light_sleep_start();
+    _sleepMs += millis() - sleepStart;
     // After wakeup, re-enable WiFi if needed
 }
 
@@ -102,19 +141,43 @@ void ModbeeMpptPowerSave::disableWiFi() {
         _mppt._webServer->stopWiFi();
     }
     setCpuFrequencyMhz(80);
+    // An MQTT session keeps the station until it ends (ModbeeMpptStation leaves after the last user)
+    if (_mppt.station.isActive()) return;
     WiFi.disconnect(true);
     WiFi.mode(WIFI_OFF); // ESP-IDF/Arduino API
 }
 
 void ModbeeMpptPowerSave::enableBluetooth() {
-    _bluetoothActive = true;
-    btStart(); // ESP-IDF API, if available for ESP32-C3
+    // The GATT service owns the controller (ModbeeMpptBle)
+    _bluetoothActive = _mppt.ble.start();
 }
 
 void ModbeeMpptPowerSave::disableBluetooth() {
     _bluetoothActive = false;
-    btStop(); // ESP-IDF API, if available for ESP32-C3
+    _mppt.ble.stop();
+}
 
+bool ModbeeMpptPowerSave::preferBluetooth() const {
+    switch (_mppt.config.data.ble_mode) {
+        case MODBEE_BLE_ALWAYS:
+        case MODBEE_BLE_BEACON:
+            return true;
+        case MODBEE_BLE_LOW_SOC:
+            return _soc < (_powerSaveMode == 2 ? _socSetpoint2 : _socSetpoint1);
+        default:
+            return false;
+    }
+}
+
+void ModbeeMpptPowerSave::updateBluetooth() {
+    // Stopped when no longer preferred, except that in low-SOC mode a
+    // connected client keeps the service until it leaves
+    _bleMode = _mppt.config.data.ble_mode;
+    if (preferBluetooth()) {
+        enableBluetooth();
+    } else if (_bleMode != MODBEE_BLE_LOW_SOC || !_mppt.ble.isConnected()) {
+        disableBluetooth();
+    }
 }
 
 void ModbeeMpptPowerSave::setPowerSaveMode(uint8_t mode) {
@@ -25,6 +25,9 @@ public:
     void setSocSetpoint2(float soc);
     void setWakeInterval(uint32_t intervalMs);
     void setWakeInterval2(uint32_t intervalMs);
+    bool isSaving() const { return _saving; }  // Last SOC check was below the active setpoint
+    bool preferBluetooth() const;  // bleMode wants the BLE service rather than the WiFi AP now
+    uint32_t getSleepMs() const { return _sleepMs; }  // Time spent in light sleep since boot
 
 private:
     ModbeeMPPT& _mppt;
@@ -38,6 +41,14 @@ private:
     bool _wifiActive;
     bool _bluetoothActive;
     bool _buttonPressed;
+    bool _saving;
+    float _soc;                    // SOC at the last check
+    uint8_t _bleMode;              // bleMode the service was last started or stopped for
+    uint32_t _sleepMs;
+
+    bool canBeaconSleep() const;
+
+    void updateBluetooth();
 };
 
 #endif // MODBEE_MPPT_POWERSAVE_H
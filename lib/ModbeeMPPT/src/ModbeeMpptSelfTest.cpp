@@ -0,0 +1,176 @@
+/*!
+ * @file ModbeeMpptSelfTest.cpp
+ *
+ * @brief Implementation of the on-target timing self-test
+ */
+
+#include "ModbeeMpptSelfTest.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include <ArduinoJson.h>
+#include <algorithm>
+
+static const uint16_t OP_REPETITIONS[MODBEE_SELFTEST_OP_COUNT] = {
+  MODBEE_SELFTEST_REG_READS,
+  MODBEE_SELFTEST_ADC_READS,
+  MODBEE_SELFTEST_CONFIG_APPLIES,
+  MODBEE_SELFTEST_STATS_SAVES,
+  MODBEE_SELFTEST_JSON_BUILDS,
+  MODBEE_SELFTEST_LED_SHOWS
+};
+
+static_assert(MODBEE_SELFTEST_REG_READS <= MODBEE_SELFTEST_MAX_SAMPLES &&
+              MODBEE_SELFTEST_ADC_READS <= MODBEE_SELFTEST_MAX_SAMPLES &&
+              MODBEE_SELFTEST_CONFIG_APPLIES <= MODBEE_SELFTEST_MAX_SAMPLES &&
+              MODBEE_SELFTEST_STATS_SAVES <= MODBEE_SELFTEST_MAX_SAMPLES &&
+              MODBEE_SELFTEST_JSON_BUILDS <= MODBEE_SELFTEST_MAX_SAMPLES &&
+              MODBEE_SELFTEST_LED_SHOWS <= MODBEE_SELFTEST_MAX_SAMPLES,
+              "Sample buffer too small");
+
+ModbeeMpptSelfTest::ModbeeMpptSelfTest(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _requested(false),
+  _print(false),
+  _mux(portMUX_INITIALIZER_UNLOCKED)
+{
+  memset(&_result, 0, sizeof(_result));
+}
+
+bool ModbeeMpptSelfTest::requestRun(bool print) {
+  if (_requested) return false;
+  _print = print;
+  _requested = true;
+  return true;
+}
+
+modbee_selftest_result_t ModbeeMpptSelfTest::getResult() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_selftest_result_t copy = _result;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+const char* ModbeeMpptSelfTest::opName(modbee_selftest_op_t op) {
+  switch (op) {
+    case MODBEE_SELFTEST_REG_READ: return "regRead";
+    case MODBEE_SELFTEST_ADC_BURST: return "adcBurst";
+    case MODBEE_SELFTEST_CONFIG_APPLY: return "configApply";
+    case MODBEE_SELFTEST_STATS_SAVE: return "statsSave";
+    case MODBEE_SELFTEST_JSON_BUILD: return "jsonBuild";
+    case MODBEE_SELFTEST_LED_SHOW: return "ledShow";
+    default: return "unknown";
+  }
+}
+
+void ModbeeMpptSelfTest::loop() {
+  // A curve trace owns VINDPM: a config apply now would end it early
+  if (!_requested || _mppt.curveTracer.isBusy()) return;
+  run();
+  _requested = false;
+}
+
+// ========================================================================
+// RUN
+// ========================================================================
+
+void ModbeeMpptSelfTest::run() {
+  modbee_selftest_result_t r;
+  memset(&r, 0, sizeof(r));
+  r.cpuMhz = getCpuFrequencyMhz();
+  r.freeHeapBefore = ESP.getFreeHeap();
+  r.maxBlockBefore = ESP.getMaxAllocHeap();
+  unsigned long startUs = micros();
+
+  for (uint8_t op = 0; op < MODBEE_SELFTEST_OP_COUNT; op++) {
+    modbee_selftest_op_t id = (modbee_selftest_op_t)op;
+    if (id == MODBEE_SELFTEST_LED_SHOW && !_mppt._ledsInitialized) continue;
+    uint16_t failures = 0;
+    for (uint16_t i = 0; i < OP_REPETITIONS[op]; i++) {
+      uint32_t start = ESP.getCycleCount();
+      bool ok = runOnce(id);
+      _samples[i] = ESP.getCycleCount() - start;
+      if (!ok) failures++;
+    }
+    r.ops[op].failures = failures;
+    summarize(r.ops[op], OP_REPETITIONS[op], r.cpuMhz);
+  }
+
+  r.durationUs = micros() - startUs;
+  r.freeHeapAfter = ESP.getFreeHeap();
+  r.maxBlockAfter = ESP.getMaxAllocHeap();
+  r.uptime = millis() / 1000;
+
+  portENTER_CRITICAL(&_mux);
+  r.sequence = _result.sequence + 1;
+  _result = r;
+  portEXIT_CRITICAL(&_mux);
+
+  MODBEE_LOGI("Self-test #%u done in %u ms", (unsigned)r.sequence, (unsigned)(r.durationUs / 1000));
+  if (_print) printResult(r);
+}
+
+bool ModbeeMpptSelfTest::runOnce(modbee_selftest_op_t op) {
+  switch (op) {
+    case MODBEE_SELFTEST_REG_READ: {
+      uint8_t value;
+      return _mppt._bq25798.readRegisterDirect(BQ25798_REG_CHARGER_STATUS_0, &value);
+    }
+    case MODBEE_SELFTEST_ADC_BURST: {
+      float vbus, ibus;
+      return _mppt._bq25798.getADCInputSample(&vbus, &ibus);
+    }
+    case MODBEE_SELFTEST_CONFIG_APPLY:
+      return _mppt.config.applyToMPPT(_mppt.api);
+    case MODBEE_SELFTEST_STATS_SAVE:
+      _mppt.statsLog.saveStatsFromAPI();
+      return true;
+    case MODBEE_SELFTEST_JSON_BUILD: {
+      JsonDocument doc;
+      _mppt.config.toSettingsJson(doc["settings"].to<JsonObject>());
+      String text;
+      return serializeJson(doc, text) > 0;
+    }
+    case MODBEE_SELFTEST_LED_SHOW:
+      FastLED.show();
+      return true;
+    default:
+      return false;
+  }
+}
+
+void ModbeeMpptSelfTest::summarize(modbee_selftest_timing_t& timing, uint16_t count, uint32_t cpuMhz) {
+  timing.count = count;
+  if (count == 0 || cpuMhz == 0) return;
+  std::sort(_samples, _samples + count);
+  uint64_t sum = 0;
+  for (uint16_t i = 0; i < count; i++) sum += _samples[i];
+  // Nearest-rank percentile: with fewer than 100 repetitions p99 is the maximum
+  uint16_t p99 = (uint16_t)ceilf(0.99f * count) - 1;
+  float mhz = (float)cpuMhz;
+  timing.minUs = _samples[0] / mhz;
+  timing.meanUs = (float)sum / count / mhz;
+  timing.p99Us = _samples[p99] / mhz;
+  timing.maxUs = _samples[count - 1] / mhz;
+}
+
+// ========================================================================
+// REPORT
+// ========================================================================
+
+void ModbeeMpptSelfTest::printResult(const modbee_selftest_result_t& result) {
+  Serial.printf("=== Self-test #%u (%u MHz, %u ms) ===\n", (unsigned)result.sequence,
+                (unsigned)result.cpuMhz, (unsigned)(result.durationUs / 1000));
+  Serial.printf("%-12s %5s %5s %10s %10s %10s %10s\n", "operation", "n", "fail", "min us", "mean us", "p99 us", "max us");
+  for (uint8_t op = 0; op < MODBEE_SELFTEST_OP_COUNT; op++) {
+    const modbee_selftest_timing_t& t = result.ops[op];
+    if (t.count == 0) {
+      Serial.printf("%-12s %5s\n", opName((modbee_selftest_op_t)op), "skip");
+      continue;
+    }
+    Serial.printf("%-12s %5u %5u %10.1f %10.1f %10.1f %10.1f\n", opName((modbee_selftest_op_t)op),
+                  t.count, t.failures, t.minUs, t.meanUs, t.p99Us, t.maxUs);
+  }
+  Serial.printf("Heap free: %u -> %u bytes, largest block: %u -> %u bytes\n",
+                (unsigned)result.freeHeapBefore, (unsigned)result.freeHeapAfter,
+                (unsigned)result.maxBlockBefore, (unsigned)result.maxBlockAfter);
+}
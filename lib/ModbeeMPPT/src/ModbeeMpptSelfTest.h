@@ -0,0 +1,112 @@
+/*!
+ * @file ModbeeMpptSelfTest.h
+ *
+ * @brief On-target timing self-test for ModbeeMPPT
+ *
+ * Host benchmarks cannot see SoftWire bit-banging, LittleFS flash latency
+ * or WiFi interrupts on the ESP32-C3. The self-test runs a fixed battery of
+ * operations on the unit itself, times every repetition with the CPU cycle
+ * counter and reports min/mean/p99/max in microseconds, with the free heap
+ * and largest free block before and after, so units in the field can be
+ * compared with the lab.
+ *
+ * A run is requested over Serial ("selftest") or WebSocket and happens in
+ * one blocking pass of the main loop (well under a second), where register
+ * access belongs to the firmware. It waits while a curve trace owns VINDPM.
+ */
+
+#ifndef MODBEE_MPPT_SELF_TEST_H
+#define MODBEE_MPPT_SELF_TEST_H
+
+#include "ModbeeMpptGlobal.h"
+
+// Repetitions per operation
+#define MODBEE_SELFTEST_REG_READS 100
+#define MODBEE_SELFTEST_ADC_READS 20
+#define MODBEE_SELFTEST_CONFIG_APPLIES 4
+#define MODBEE_SELFTEST_STATS_SAVES 4
+#define MODBEE_SELFTEST_JSON_BUILDS 20
+#define MODBEE_SELFTEST_LED_SHOWS 20
+#define MODBEE_SELFTEST_MAX_SAMPLES MODBEE_SELFTEST_REG_READS  // Largest of the above
+
+typedef enum {
+  MODBEE_SELFTEST_REG_READ = 0,   // One status register read
+  MODBEE_SELFTEST_ADC_BURST,      // VBUS and IBUS in one burst read
+  MODBEE_SELFTEST_CONFIG_APPLY,   // ModbeeMpptConfig::applyToMPPT()
+  MODBEE_SELFTEST_STATS_SAVE,     // Lifetime stats to LittleFS
+  MODBEE_SELFTEST_JSON_BUILD,     // Settings document built and serialized
+  MODBEE_SELFTEST_LED_SHOW,       // FastLED.show()
+  MODBEE_SELFTEST_OP_COUNT
+} modbee_selftest_op_t;
+
+typedef struct {
+  uint16_t count;                 // Repetitions timed, 0 = skipped
+  uint16_t failures;              // Repetitions that reported an error
+  float minUs;
+  float meanUs;
+  float p99Us;
+  float maxUs;
+} modbee_selftest_timing_t;
+
+typedef struct {
+  uint32_t sequence;              // Runs since boot, 0 = none yet
+  uint32_t uptime;                // Seconds since boot when the run finished
+  uint32_t cpuMhz;
+  uint32_t durationUs;            // Whole run
+  uint32_t freeHeapBefore;
+  uint32_t maxBlockBefore;        // Largest allocatable block
+  uint32_t freeHeapAfter;
+  uint32_t maxBlockAfter;
+  modbee_selftest_timing_t ops[MODBEE_SELFTEST_OP_COUNT];
+} modbee_selftest_result_t;
+
+class ModbeeMpptSelfTest {
+public:
+  ModbeeMpptSelfTest(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Run the self-test at the next loop pass
+   * @param print Also print the result on Serial when it is done
+   * @return False if a run is already requested
+   */
+  bool requestRun(bool print = false);
+
+  /*!
+   * @brief Run a requested self-test; call every loop pass
+   */
+  void loop();
+
+  /*!
+   * @brief True while a run is requested and not finished
+   */
+  bool isPending() const { return _requested; }
+
+  /*!
+   * @brief Copy of the last result (sequence 0 if there is none yet)
+   */
+  modbee_selftest_result_t getResult() const;
+
+  /*!
+   * @brief Short name of an operation ("regRead", "adcBurst", ...)
+   */
+  static const char* opName(modbee_selftest_op_t op);
+
+  /*!
+   * @brief Print a result as a table on Serial
+   */
+  static void printResult(const modbee_selftest_result_t& result);
+
+private:
+  class ModbeeMPPT& _mppt;
+  volatile bool _requested;
+  bool _print;
+  modbee_selftest_result_t _result;
+  mutable portMUX_TYPE _mux;
+  uint32_t _samples[MODBEE_SELFTEST_MAX_SAMPLES];  // Cycles per repetition
+
+  void run();
+  bool runOnce(modbee_selftest_op_t op);
+  void summarize(modbee_selftest_timing_t& timing, uint16_t count, uint32_t cpuMhz);
+};
+
+#endif // MODBEE_MPPT_SELF_TEST_H
@@ -0,0 +1,154 @@
+/*!
+ * @file ModbeeMpptSocEkf.cpp
+ *
+ * @brief Implementation of the battery extended Kalman filter
+ */
+
+#include "ModbeeMpptSocEkf.h"
+#include <string.h>
+
+static const uint8_t N = MODBEE_EKF_STATES;
+
+ModbeeMpptSocEkf::ModbeeMpptSocEkf() {
+  init(0.5f, 0.3f, 0.05f, 10.0f, 1);
+}
+
+void ModbeeMpptSocEkf::init(float soc, float socSigma, float r0, float capacityAh, uint8_t cells) {
+  _x[MODBEE_EKF_SOC] = soc;
+  _x[MODBEE_EKF_V1] = 0.0f;
+  _x[MODBEE_EKF_R0] = r0;
+  _x[MODBEE_EKF_INV_CAPACITY] = 1.0f / capacityAh;
+
+  // Ageing moves these within a bounded range of the configured battery
+  _r0Min = r0 * 0.2f;
+  _r0Max = r0 * 10.0f;
+  _invCapacityMin = 1.0f / (capacityAh * 1.5f);
+  _invCapacityMax = 1.0f / (capacityAh * 0.5f);
+
+  float voltageNoise = MODBEE_EKF_R_VOLTAGE * cells;
+  _voltageVariance = voltageNoise * voltageNoise;
+  _innovation = 0.0f;
+  _decayDt = 0.0f;
+  _decay = 1.0f;
+
+  memset(_P, 0, sizeof(_P));
+  _P[0][0] = socSigma * socSigma;
+  _P[1][1] = 0.05f * 0.05f * cells;
+  _P[2][2] = (0.5f * r0) * (0.5f * r0);
+  _P[3][3] = (0.2f * _x[MODBEE_EKF_INV_CAPACITY]) * (0.2f * _x[MODBEE_EKF_INV_CAPACITY]);
+}
+
+// ========================================================================
+// TIME UPDATE
+// ========================================================================
+
+void ModbeeMpptSocEkf::predict(float current, float dt, float efficiency) {
+  float charge = current * dt / 3600.0f;
+  if (current > 0.0f) charge *= efficiency;
+  // The C3 has no FPU: expf only when the step changes
+  if (dt != _decayDt) {
+    _decayDt = dt;
+    _decay = expf(-dt / MODBEE_EKF_TAU_S);
+  }
+  float a = _decay;
+  float r1Gain = (1.0f - a) * MODBEE_EKF_R1_RATIO * current;
+
+  // x = f(x)
+  _x[MODBEE_EKF_SOC] += charge * _x[MODBEE_EKF_INV_CAPACITY];
+  _x[MODBEE_EKF_V1] = a * _x[MODBEE_EKF_V1] + r1Gain * _x[MODBEE_EKF_R0];
+
+  // P = F P F' + Q with F = I except
+  //   F[0][3] = charge, F[1][1] = a, F[1][2] = r1Gain
+  // Rows first (F P), then columns (... F'), touching only the non-identity terms
+  float P[N][N];
+  memcpy(P, _P, sizeof(P));
+  for (uint8_t j = 0; j < N; j++) {
+    P[0][j] = _P[0][j] + charge * _P[3][j];
+    P[1][j] = a * _P[1][j] + r1Gain * _P[2][j];
+  }
+  for (uint8_t i = 0; i < N; i++) {
+    float p0 = P[i][0] + charge * P[i][3];
+    float p1 = a * P[i][1] + r1Gain * P[i][2];
+    P[i][0] = p0;
+    P[i][1] = p1;
+  }
+
+  // Random walks: variance grows linearly with time
+  float qR0 = MODBEE_EKF_Q_R0 * _x[MODBEE_EKF_R0];
+  float qFade = MODBEE_EKF_Q_FADE * _x[MODBEE_EKF_INV_CAPACITY];
+  P[0][0] += MODBEE_EKF_Q_SOC * MODBEE_EKF_Q_SOC * dt;
+  P[1][1] += MODBEE_EKF_Q_V1 * MODBEE_EKF_Q_V1 * dt;
+  P[2][2] += qR0 * qR0 * dt;
+  P[3][3] += qFade * qFade * dt;
+  memcpy(_P, P, sizeof(P));
+
+  clampState();
+}
+
+// ========================================================================
+// MEASUREMENT UPDATE
+// ========================================================================
+
+void ModbeeMpptSocEkf::correct(float voltage, float current, float ocv, float ocvSlope, float temperature) {
+  // Resistance rises in the cold; clamp to the range the coefficient is good for
+  float tempFactor = 1.0f;
+  if (!isnan(temperature)) {
+    tempFactor = 1.0f + MODBEE_EKF_R0_TEMPCO * (25.0f - temperature);
+    if (tempFactor < 0.5f) tempFactor = 0.5f;
+    if (tempFactor > 3.0f) tempFactor = 3.0f;
+  }
+
+  float predicted = ocv + _x[MODBEE_EKF_V1] + _x[MODBEE_EKF_R0] * tempFactor * current;
+  float H[N] = {ocvSlope, 1.0f, tempFactor * current, 0.0f};
+  _innovation = voltage - predicted;
+  scalarUpdate(H, _innovation, _voltageVariance);
+}
+
+void ModbeeMpptSocEkf::observeSoc(float soc, float sigma) {
+  float H[N] = {1.0f, 0.0f, 0.0f, 0.0f};
+  scalarUpdate(H, soc - _x[MODBEE_EKF_SOC], sigma * sigma);
+}
+
+void ModbeeMpptSocEkf::scalarUpdate(const float* H, float residual, float variance) {
+  // PHt = P H', S = H P H' + R, K = PHt / S (scalar measurement, no inversion)
+  float PHt[N];
+  float S = variance;
+  for (uint8_t i = 0; i < N; i++) {
+    PHt[i] = 0.0f;
+    for (uint8_t j = 0; j < N; j++) PHt[i] += _P[i][j] * H[j];
+    S += H[i] * PHt[i];
+  }
+  if (S <= 0.0f) return;
+
+  float K[N];
+  for (uint8_t i = 0; i < N; i++) {
+    K[i] = PHt[i] / S;
+    _x[i] += K[i] * residual;
+  }
+
+  // P = P - K (H P) = P - K PHt', kept symmetric
+  for (uint8_t i = 0; i < N; i++) {
+    for (uint8_t j = i; j < N; j++) {
+      float p = _P[i][j] - K[i] * PHt[j];
+      _P[i][j] = p;
+      _P[j][i] = p;
+    }
+  }
+  for (uint8_t i = 0; i < N; i++) {
+    if (_P[i][i] < 1e-12f) _P[i][i] = 1e-12f;
+  }
+
+  clampState();
+}
+
+void ModbeeMpptSocEkf::clampState() {
+  float& soc = _x[MODBEE_EKF_SOC];
+  float& r0 = _x[MODBEE_EKF_R0];
+  float& invCapacity = _x[MODBEE_EKF_INV_CAPACITY];
+  if (soc < 0.0f) soc = 0.0f;
+  if (soc > 1.0f) soc = 1.0f;
+  if (r0 < _r0Min) r0 = _r0Min;
+  if (r0 > _r0Max) r0 = _r0Max;
+  if (invCapacity < _invCapacityMin) invCapacity = _invCapacityMin;
+  if (invCapacity > _invCapacityMax) invCapacity = _invCapacityMax;
+}
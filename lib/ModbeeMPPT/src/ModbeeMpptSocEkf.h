@@ -0,0 +1,111 @@
+/*!
+ * @file ModbeeMpptSocEkf.h
+ *
+ * @brief Extended Kalman filter for battery SOC, resistance and capacity
+ *
+ * Battery model: first-order Thevenin equivalent circuit,
+ *
+ *   VBAT = OCV(soc) + V1 + R0 * f(T) * IBAT
+ *   V1'  = a * V1 + (1 - a) * R1 * IBAT,   a = exp(-dt / tau),  R1 = ratio * R0
+ *
+ * with the state x = [soc, V1, R0, 1/capacity]. R0 and 1/capacity are
+ * random walks, so resistance growth and capacity fade are tracked as the
+ * battery ages. IBAT is positive when charging. f(T) scales R0 (estimated
+ * at 25 °C) for the battery temperature.
+ *
+ * All matrices are fixed 4x4 float arrays on the object; there is no heap
+ * use. The class is plain math and knows nothing about chemistries: the
+ * caller looks up OCV and its slope at the predicted SOC between predict()
+ * and correct().
+ */
+
+#ifndef MODBEE_MPPT_SOC_EKF_H
+#define MODBEE_MPPT_SOC_EKF_H
+
+#include <math.h>
+#include <stdint.h>
+
+#define MODBEE_EKF_STATES 4
+
+// Polarization branch: time constant and R1 as a multiple of R0
+#define MODBEE_EKF_TAU_S 60.0f
+#define MODBEE_EKF_R1_RATIO 1.0f
+
+// Process noise per second (standard deviations)
+#define MODBEE_EKF_Q_SOC 1e-4f          // Current sensor error, fraction of SOC
+#define MODBEE_EKF_Q_V1 1e-3f           // Polarization model error (V)
+#define MODBEE_EKF_Q_R0 1e-6f           // Relative resistance drift
+#define MODBEE_EKF_Q_FADE 1e-6f         // Relative capacity drift
+
+// Measurement noise: model + hysteresis + ADC, per cell (V)
+#define MODBEE_EKF_R_VOLTAGE 0.02f
+
+// Resistance temperature coefficient, relative per °C below 25 °C
+#define MODBEE_EKF_R0_TEMPCO 0.02f
+
+typedef enum {
+  MODBEE_EKF_SOC = 0,
+  MODBEE_EKF_V1 = 1,
+  MODBEE_EKF_R0 = 2,
+  MODBEE_EKF_INV_CAPACITY = 3
+} modbee_ekf_state_t;
+
+class ModbeeMpptSocEkf {
+public:
+  ModbeeMpptSocEkf();
+
+  /*!
+   * @brief Reset the filter
+   * @param soc Initial SOC (0..1)
+   * @param socSigma Its standard deviation
+   * @param r0 Initial series resistance of the pack (Ohm)
+   * @param capacityAh Initial capacity (Ah)
+   * @param cells Series cells (scales the voltage noise)
+   */
+  void init(float soc, float socSigma, float r0, float capacityAh, uint8_t cells);
+
+  /*!
+   * @brief Time update
+   * @param current IBAT (A, positive = charging)
+   * @param dt Seconds since the last update
+   * @param efficiency Fraction of charge current stored
+   */
+  void predict(float current, float dt, float efficiency);
+
+  /*!
+   * @brief Measurement update with the pack voltage
+   * @param voltage VBAT (V)
+   * @param current IBAT (A), same frame as the voltage
+   * @param ocv Pack OCV at getSoc() (V)
+   * @param ocvSlope Pack dOCV/dSOC there (V per unit SOC)
+   * @param temperature Battery temperature (°C), NAN if unknown
+   */
+  void correct(float voltage, float current, float ocv, float ocvSlope, float temperature);
+
+  /*!
+   * @brief Direct SOC observation, e.g. full at charge termination
+   */
+  void observeSoc(float soc, float sigma);
+
+  float getSoc() const { return _x[MODBEE_EKF_SOC]; }
+  float getSocSigma() const { return sqrtf(_P[0][0]); }
+  float getV1() const { return _x[MODBEE_EKF_V1]; }
+  float getR0() const { return _x[MODBEE_EKF_R0]; }
+  float getCapacityAh() const { return 1.0f / _x[MODBEE_EKF_INV_CAPACITY]; }
+  float getInnovation() const { return _innovation; }
+
+private:
+  float _x[MODBEE_EKF_STATES];
+  float _P[MODBEE_EKF_STATES][MODBEE_EKF_STATES];
+  float _r0Min, _r0Max;           // Bounds around the initial values
+  float _invCapacityMin, _invCapacityMax;
+  float _voltageVariance;
+  float _innovation;              // Last voltage residual (V)
+  float _decayDt;                 // Step the cached polarization decay is for
+  float _decay;
+
+  void scalarUpdate(const float* H, float residual, float variance);
+  void clampState();
+};
+
+#endif // MODBEE_MPPT_SOC_EKF_H
@@ -0,0 +1,358 @@
+/*!
+ * @file ModbeeMpptSocEstimator.cpp
+ *
+ * @brief Implementation of the coulomb-counting SOC estimator
+ */
+
+#include "ModbeeMpptSocEstimator.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+
+// Charge efficiency, R0 x capacity; the OCV curves are in ModbeeMpptOcv
+static const modbee_soc_chemistry_t CHEMISTRY_LIFEPO4 = {0.99f, 0.05f};
+static const modbee_soc_chemistry_t CHEMISTRY_LIPO = {0.99f, 0.05f};
+static const modbee_soc_chemistry_t CHEMISTRY_LEAD_ACID = {0.90f, 0.10f};
+
+ModbeeMpptSocEstimator::ModbeeMpptSocEstimator(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _valid(false),
+  _loaded(false),
+  _soc(0.0f),
+  _sigma(MODBEE_SOC_ZERO_CONFIDENCE),
+  _capacityAh(0.0f),
+  _nominalAh(0.0f),
+  _r0(0.0f),
+  _lastAnchor(MODBEE_SOC_ANCHOR_NONE),
+  _anchors(0),
+  _capacityUpdates(0),
+  _restSeconds(0.0f),
+  _atFull(false),
+  _lastFrameMs(0),
+  _anchorSoc(0.0f),
+  _anchorSigma(1.0f),
+  _ahSinceAnchor(0.0f),
+  _lastSave(0),
+  _ekfActive(false),
+  _resetPending(false)
+{
+  memset(&_status, 0, sizeof(_status));
+}
+
+const modbee_soc_chemistry_t* ModbeeMpptSocEstimator::getChemistry(modbee_battery_type_t type) {
+  switch (type) {
+    case MODBEE_BATTERY_LIFEPO4: return &CHEMISTRY_LIFEPO4;
+    case MODBEE_BATTERY_LIPO: return &CHEMISTRY_LIPO;
+    case MODBEE_BATTERY_LEAD_ACID: return &CHEMISTRY_LEAD_ACID;
+    default: return nullptr;
+  }
+}
+
+const char* ModbeeMpptSocEstimator::anchorName(modbee_soc_anchor_t anchor) {
+  switch (anchor) {
+    case MODBEE_SOC_ANCHOR_BOOT: return "boot";
+    case MODBEE_SOC_ANCHOR_FULL: return "full";
+    case MODBEE_SOC_ANCHOR_OCV: return "ocv";
+    default: return "none";
+  }
+}
+
+bool ModbeeMpptSocEstimator::isValid() const {
+  portENTER_CRITICAL(&_mux);
+  bool valid = _status.valid;
+  portEXIT_CRITICAL(&_mux);
+  return valid;
+}
+
+float ModbeeMpptSocEstimator::getSoc() const {
+  portENTER_CRITICAL(&_mux);
+  float soc = _status.soc;
+  portEXIT_CRITICAL(&_mux);
+  return soc;
+}
+
+bool ModbeeMpptSocEstimator::isConfident() const {
+  portENTER_CRITICAL(&_mux);
+  bool confident = _status.valid && _status.confidence >= MODBEE_SOC_CONFIDENT;
+  portEXIT_CRITICAL(&_mux);
+  return confident;
+}
+
+modbee_soc_status_t ModbeeMpptSocEstimator::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_soc_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+void ModbeeMpptSocEstimator::requestReset() {
+  _resetPending = true;
+}
+
+// ========================================================================
+// PERSISTENCE
+// ========================================================================
+
+void ModbeeMpptSocEstimator::begin() {
+  _loaded = load();
+  if (_loaded) {
+    MODBEE_LOGI("SOC restored: %.1f%% +/- %.1f%%, capacity %.2fAh", _soc * 100.0f, _sigma * 100.0f, _capacityAh);
+  }
+}
+
+bool ModbeeMpptSocEstimator::load() {
+  if (!LittleFS.exists(MODBEE_SOC_FILE)) return false;
+  File file = LittleFS.open(MODBEE_SOC_FILE, "r");
+  if (!file) return false;
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, file);
+  file.close();
+  if (err) return false;
+
+  float capacity = doc["capacity_ah"] | 0.0f;
+  if (capacity <= 0.0f) return false;
+  _soc = constrain(doc["soc"] | 0.5f, 0.0f, 1.0f);
+  _sigma = constrain(doc["sigma"] | MODBEE_SOC_ZERO_CONFIDENCE, 0.0f, 1.0f);
+  _capacityAh = capacity;
+  _nominalAh = doc["nominal_ah"] | capacity;
+  _r0 = doc["r0_ohm"] | 0.0f;
+  return true;
+}
+
+bool ModbeeMpptSocEstimator::save() {
+  if (!_valid) return false;
+  JsonDocument doc;
+  doc["soc"] = _soc;
+  doc["sigma"] = _sigma;
+  doc["capacity_ah"] = _capacityAh;
+  doc["nominal_ah"] = _nominalAh;
+  if (_r0 > 0.0f) doc["r0_ohm"] = _r0;
+  File file = LittleFS.open(MODBEE_SOC_FILE, "w");
+  if (!file) return false;
+  size_t written = serializeJson(doc, file);
+  file.close();
+  _lastSave = millis();
+  return written > 0;
+}
+
+// ========================================================================
+// ESTIMATION
+// ========================================================================
+
+void ModbeeMpptSocEstimator::seed(const modbee_telemetry_t& telemetry) {
+  if (_loaded) {
+    // Self-discharge and loads while powered off are unknown
+    anchor(MODBEE_SOC_ANCHOR_BOOT, _soc, min(_sigma + MODBEE_SOC_BOOT_SIGMA, 1.0f));
+  } else {
+    // First start: best guess from the (unrested) battery voltage
+    const ModbeeMpptConfigData& config = _mppt.config.data;
+    const modbee_ocv_curve_t* curve = _mppt.config.ocvCurve(config.battery_type);
+    float soc = 0.5f;
+    if (curve) {
+      soc = ModbeeMpptOcv::socFromVoltage(*curve, telemetry.battery.voltage / max((uint8_t)1, config.battery_cell_count),
+                                          telemetry.battery_temperature);
+    }
+    anchor(MODBEE_SOC_ANCHOR_BOOT, soc, MODBEE_SOC_ZERO_CONFIDENCE);
+    MODBEE_LOGI("SOC seeded from voltage: %.1f%%", soc * 100.0f);
+  }
+  _valid = true;
+}
+
+void ModbeeMpptSocEstimator::anchor(modbee_soc_anchor_t kind, float soc, float sigma) {
+  // Two good anchors far enough apart measure the capacity: the charge
+  // counted between them divided by the SOC difference
+  float span = soc - _anchorSoc;
+  if (kind != MODBEE_SOC_ANCHOR_BOOT && _lastAnchor != MODBEE_SOC_ANCHOR_BOOT &&
+      sigma <= MODBEE_SOC_GOOD_ANCHOR_SIGMA && _anchorSigma <= MODBEE_SOC_GOOD_ANCHOR_SIGMA &&
+      fabsf(span) >= MODBEE_SOC_LEARN_SPAN) {
+    float measured = _ahSinceAnchor / span;
+    if (measured >= _nominalAh * 0.5f && measured <= _nominalAh * 1.5f) {
+      _capacityAh += MODBEE_SOC_LEARN_GAIN * (measured - _capacityAh);
+      _capacityUpdates++;
+      MODBEE_LOGI("SOC capacity measured %.2fAh, learned %.2fAh", measured, _capacityAh);
+    } else {
+      MODBEE_LOGW("SOC capacity measurement %.2fAh out of range, ignored", measured);
+    }
+  }
+
+  _soc = soc;
+  _sigma = sigma;
+  _anchorSoc = soc;
+  _anchorSigma = sigma;
+  _ahSinceAnchor = 0.0f;
+  _lastAnchor = kind;
+  if (kind != MODBEE_SOC_ANCHOR_BOOT) _anchors++;
+}
+
+void ModbeeMpptSocEstimator::sample(const modbee_telemetry_t& telemetry) {
+  if (!telemetry.valid) return;
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+
+  if (_resetPending) {
+    _resetPending = false;
+    _valid = _loaded = false;
+    _capacityUpdates = 0;
+    _lastAnchor = MODBEE_SOC_ANCHOR_NONE;
+    _nominalAh = 0.0f;
+    _r0 = 0.0f;
+    _ekfActive = false;
+    _lastFrameMs = 0;
+    LittleFS.remove(MODBEE_SOC_FILE);
+    MODBEE_LOGI("SOC estimate reset");
+  }
+
+  // A new nominal capacity means a different battery
+  if (config.battery_capacity_ah != _nominalAh) {
+    _nominalAh = config.battery_capacity_ah;
+    _capacityAh = _nominalAh;
+    _anchorSigma = 1.0f;
+    _r0 = 0.0f;
+    _ekfActive = false;  // Restarted below with the new battery
+  }
+  if (!_valid) seed(telemetry);
+
+  // Seconds since the last frame; a repeated frame adds nothing
+  float dt = 1.0f;
+  if (_lastFrameMs) {
+    dt = constrain((telemetry.timestamp_ms - _lastFrameMs) / 1000.0f, 0.0f, MODBEE_SOC_MAX_DT_S);
+  }
+  _lastFrameMs = telemetry.timestamp_ms;
+
+  const modbee_soc_chemistry_t* chemistry = getChemistry(config.battery_type);
+  const modbee_ocv_curve_t* curve = _mppt.config.ocvCurve(config.battery_type);
+  uint8_t cells = max((uint8_t)1, config.battery_cell_count);
+
+  // Full: the chip terminated, or the charge profile holds float
+  bool full = telemetry.charge_state == MODBEE_CHARGE_DONE ||
+              _mppt.chargeProfile.getStatus().stage == MODBEE_STAGE_FLOAT;
+
+  // The filter needs chemistry parameters and an OCV table; custom batteries
+  // stay on coulomb counting, with OCV anchors when a curve was uploaded
+  bool ekf = config.soc_ekf && chemistry && curve;
+  if (ekf != _ekfActive) {
+    _ekfActive = ekf;
+    if (ekf) {
+      float r0 = _r0 > 0.0f ? _r0 : cells * chemistry->resistanceAh / _capacityAh;
+      _ekf.init(_soc, _sigma, r0, _capacityAh, cells);
+      MODBEE_LOGI("SOC Kalman filter started: R0 %.0fmOhm, %.2fAh", r0 * 1000.0f, _capacityAh);
+    } else {
+      // Counting carries on from the filter's estimate
+      _anchorSigma = 1.0f;
+      _ahSinceAnchor = 0.0f;
+      MODBEE_LOGI("SOC Kalman filter stopped");
+    }
+  }
+
+  if (_ekfActive) {
+    sampleEkf(telemetry, *chemistry, *curve, cells, full, dt);
+  } else {
+    sampleCoulomb(telemetry, chemistry, curve, cells, full, dt);
+  }
+  _atFull = full;
+
+  if (millis() - _lastSave >= MODBEE_SOC_SAVE_INTERVAL_MS) {
+    save();
+  }
+  publish();
+}
+
+void ModbeeMpptSocEstimator::sampleCoulomb(const modbee_telemetry_t& telemetry,
+                                           const modbee_soc_chemistry_t* chemistry,
+                                           const modbee_ocv_curve_t* curve,
+                                           uint8_t cells, bool full, float dt) {
+  float current = telemetry.battery.current;
+
+  // Coulomb counting; not all of the charge current is stored
+  float ah = current * dt / 3600.0f;
+  if (ah > 0.0f && chemistry) ah *= chemistry->chargeEfficiency;
+  _soc = constrain(_soc + ah / _capacityAh, 0.0f, 1.0f);
+  _sigma = min(_sigma + (fabsf(ah) * MODBEE_SOC_CURRENT_ERROR + MODBEE_SOC_OFFSET_CURRENT * dt / 3600.0f) / _capacityAh, 1.0f);
+  _ahSinceAnchor += ah;
+
+  if (full) {
+    if (!_atFull) {
+      anchor(MODBEE_SOC_ANCHOR_FULL, 1.0f, MODBEE_SOC_FULL_SIGMA);
+      MODBEE_LOGI("SOC recalibrated: full");
+      save();
+    } else {
+      _soc = 1.0f;
+      _sigma = MODBEE_SOC_FULL_SIGMA;
+      _ahSinceAnchor = 0.0f;
+    }
+  }
+
+  // Rested OCV, weighted against the counted estimate by the table slope
+  float restCurrent = max(MODBEE_SOC_REST_CURRENT, _capacityAh * MODBEE_SOC_REST_C_RATE);
+  float rested = _restSeconds;
+  _restSeconds = fabsf(current) < restCurrent ? _restSeconds + dt : 0.0f;
+  if (rested < MODBEE_SOC_REST_S && _restSeconds >= MODBEE_SOC_REST_S && !full && curve) {
+    float slope;
+    float ocvSoc = ModbeeMpptOcv::socFromVoltage(*curve, telemetry.battery.voltage / cells,
+                                                 telemetry.battery_temperature, &slope);
+    float ocvSigma = MODBEE_SOC_OCV_ERROR / max(slope, 0.01f);
+    float gain = _sigma * _sigma / (_sigma * _sigma + ocvSigma * ocvSigma);
+    float soc = _soc + gain * (ocvSoc - _soc);
+    float sigma = ocvSigma * sqrtf(gain);
+    MODBEE_LOGI("SOC rested OCV %.3fV/cell = %.1f%% +/- %.1f%%, estimate %.1f%% -> %.1f%%",
+                telemetry.battery.voltage / cells, ocvSoc * 100.0f, ocvSigma * 100.0f,
+                _soc * 100.0f, soc * 100.0f);
+    if (ocvSigma <= MODBEE_SOC_GOOD_ANCHOR_SIGMA) {
+      anchor(MODBEE_SOC_ANCHOR_OCV, soc, sigma);
+      save();
+    } else {
+      // On a plateau: a nudge, not a new reference for capacity learning
+      _soc = soc;
+      _sigma = sigma;
+    }
+  }
+}
+
+void ModbeeMpptSocEstimator::sampleEkf(const modbee_telemetry_t& telemetry,
+                                       const modbee_soc_chemistry_t& chemistry,
+                                       const modbee_ocv_curve_t& curve,
+                                       uint8_t cells, bool full, float dt) {
+  // A repeated frame is no new measurement
+  if (dt <= 0.0f) return;
+  float current = telemetry.battery.current;
+  float temperature = telemetry.battery_temperature;
+  if (temperature <= -40.0f || temperature >= 150.0f) temperature = NAN;  // No NTC
+
+  // Every frame is a measurement; no rest or charge interruption is needed
+  _ekf.predict(current, dt, chemistry.chargeEfficiency);
+  float slope;
+  float ocv = ModbeeMpptOcv::voltageFromSoc(curve, _ekf.getSoc(), temperature, &slope);
+  _ekf.correct(telemetry.battery.voltage, current, ocv * cells, slope * cells, temperature);
+
+  if (full && !_atFull) {
+    _ekf.observeSoc(1.0f, MODBEE_SOC_FULL_SIGMA);
+    _lastAnchor = MODBEE_SOC_ANCHOR_FULL;
+    _anchors++;
+    MODBEE_LOGI("SOC full: R0 %.0fmOhm, capacity %.2fAh", _ekf.getR0() * 1000.0f, _ekf.getCapacityAh());
+  }
+
+  _soc = _ekf.getSoc();
+  _sigma = _ekf.getSocSigma();
+  _capacityAh = _ekf.getCapacityAh();
+  _r0 = _ekf.getR0();
+  _restSeconds = 0.0f;
+}
+
+void ModbeeMpptSocEstimator::publish() {
+  portENTER_CRITICAL(&_mux);
+  _status.valid = _valid;
+  _status.soc = _soc * 100.0f;
+  _status.sigma = _sigma * 100.0f;
+  _status.confidence = max(0.0f, 1.0f - _sigma / MODBEE_SOC_ZERO_CONFIDENCE) * 100.0f;
+  _status.capacityAh = _capacityAh;
+  _status.nominalAh = _nominalAh;
+  _status.ahSinceAnchor = _ahSinceAnchor;
+  _status.restSeconds = (uint32_t)_restSeconds;
+  _status.anchors = _anchors;
+  _status.capacityUpdates = _capacityUpdates;
+  _status.lastAnchor = _lastAnchor;
+  _status.ekf = _ekfActive;
+  _status.resistance = _ekfActive ? _r0 * 1000.0f : 0.0f;
+  portEXIT_CRITICAL(&_mux);
+}
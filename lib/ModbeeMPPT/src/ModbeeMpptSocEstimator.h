@@ -0,0 +1,184 @@
+/*!
+ * @file ModbeeMpptSocEstimator.h
+ *
+ * @brief Coulomb-counting battery state of charge estimator for ModbeeMPPT
+ *
+ * calculateBatterySOC() reads the voltage through the OCV curve, which says
+ * little about a LiFePO4 battery's flat middle, or about any battery under
+ * load. This estimator integrates IBAT against a learned capacity and
+ * recalibrates at two kinds of anchor: full charge (charge done, or the
+ * charge profile in float) and rested open-circuit voltage looked up in the
+ * battery's OCV curve, built in or uploaded for a custom battery
+ * (ModbeeMpptConfig::ocvCurve()). An OCV reading is weighted by how steep
+ * the table is at that point, so it corrects the estimate on the slopes and
+ * barely moves it on a plateau. The uncertainty is tracked as a standard
+ * deviation and reported as a confidence, and the state survives reboots
+ * in LittleFS.
+ *
+ * With config.soc_ekf the estimate comes from ModbeeMpptSocEkf instead,
+ * which fuses IBAT, VBAT and temperature continuously through a battery
+ * model and tracks internal resistance and capacity fade as it goes.
+ */
+
+#ifndef MODBEE_MPPT_SOC_ESTIMATOR_H
+#define MODBEE_MPPT_SOC_ESTIMATOR_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+#include "ModbeeMpptSocEkf.h"
+#include "ModbeeMpptOcv.h"
+
+#define MODBEE_SOC_FILE "/data/soc.json"
+#define MODBEE_SOC_SAVE_INTERVAL_MS 300000UL
+
+// Rest detection: OCV is read once per rest, after this long below the current
+#define MODBEE_SOC_REST_CURRENT 0.05f       // |IBAT| (A), or C/100 if larger
+#define MODBEE_SOC_REST_C_RATE 0.01f
+#define MODBEE_SOC_REST_S 1800
+
+// Frames are counted over the time between them: 1 s normally, up to a
+// beacon period when the BLE beacon light-sleeps between bursts
+#define MODBEE_SOC_MAX_DT_S 10.0f           // Longer gaps count as this long
+
+// Error model (all SOC values are fractions 0..1)
+#define MODBEE_SOC_CURRENT_ERROR 0.02f      // Gain error, fraction of the charge counted
+#define MODBEE_SOC_OFFSET_CURRENT 0.01f     // IBAT offset error (A), accumulates over time
+#define MODBEE_SOC_OCV_ERROR 0.015f         // Rested OCV uncertainty per cell (V)
+#define MODBEE_SOC_FULL_SIGMA 0.01f         // Uncertainty right after a full charge
+#define MODBEE_SOC_BOOT_SIGMA 0.05f         // Added on boot for the unknown time powered off
+#define MODBEE_SOC_ZERO_CONFIDENCE 0.3f     // Sigma at which confidence reaches 0 %
+#define MODBEE_SOC_CONFIDENT 80.0f          // Confidence (%) above which no true VBAT is needed
+
+// Capacity learning between two good anchors
+#define MODBEE_SOC_GOOD_ANCHOR_SIGMA 0.08f  // Anchors more uncertain than this are not used
+#define MODBEE_SOC_LEARN_SPAN 0.3f          // Minimum SOC difference between the anchors
+#define MODBEE_SOC_LEARN_GAIN 0.25f         // Weight of a new capacity measurement
+
+typedef enum {
+  MODBEE_SOC_ANCHOR_NONE = 0,     // No state yet
+  MODBEE_SOC_ANCHOR_BOOT = 1,     // Restored from flash or seeded from voltage
+  MODBEE_SOC_ANCHOR_FULL = 2,     // Charge done / float
+  MODBEE_SOC_ANCHOR_OCV = 3       // Rested open-circuit voltage
+} modbee_soc_anchor_t;
+
+// Per-chemistry charge efficiency and resistance
+typedef struct {
+  float chargeEfficiency;         // Fraction of charge current stored
+  float resistanceAh;             // Typical cell R0 x capacity (Ohm Ah), EKF starting point
+} modbee_soc_chemistry_t;
+
+typedef struct {
+  bool valid;                     // False until the first telemetry frame
+  float soc;                      // Estimated SOC (%)
+  float confidence;               // 0..100 %, from the tracked uncertainty
+  float sigma;                    // Uncertainty, one standard deviation (%)
+  float capacityAh;               // Learned capacity
+  float nominalAh;                // Configured capacity it started from
+  float ahSinceAnchor;            // Net charge counted since the last anchor
+  uint32_t restSeconds;           // Current rest period
+  uint32_t anchors;               // Recalibrations since boot
+  uint32_t capacityUpdates;       // Capacity measurements since boot
+  modbee_soc_anchor_t lastAnchor;
+  bool ekf;                       // Estimate from the Kalman filter
+  float resistance;               // EKF pack R0 at 25 °C (mOhm)
+} modbee_soc_status_t;
+
+class ModbeeMpptSocEstimator {
+public:
+  ModbeeMpptSocEstimator(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Restore the saved state (LittleFS must be mounted)
+   */
+  void begin();
+
+  /*!
+   * @brief Integrate one telemetry frame over the time since the last one
+   * and recalibrate at anchors
+   * @param telemetry Frame from ModbeeMpptAPI::getTelemetry()
+   */
+  void sample(const modbee_telemetry_t& telemetry);
+
+  /*!
+   * @brief True once the estimate has been seeded
+   */
+  bool isValid() const;
+
+  /*!
+   * @brief Estimated SOC (0.0 - 100.0)
+   */
+  float getSoc() const;
+
+  /*!
+   * @brief True when the estimate is good enough to skip true VBAT measurements
+   */
+  bool isConfident() const;
+
+  /*!
+   * @brief Copy of the estimator state for the web UI
+   */
+  modbee_soc_status_t getStatus() const;
+
+  /*!
+   * @brief Forget the learned capacity and reseed on the next frame
+   *
+   * Safe to call from the web server task.
+   */
+  void requestReset();
+
+  /*!
+   * @brief Write the state to flash now
+   */
+  bool save();
+
+  /*!
+   * @brief Charge efficiency and resistance for a chemistry
+   * @return nullptr for MODBEE_BATTERY_CUSTOM
+   */
+  static const modbee_soc_chemistry_t* getChemistry(modbee_battery_type_t type);
+
+  /*!
+   * @brief Short name of an anchor ("full", "ocv", ...)
+   */
+  static const char* anchorName(modbee_soc_anchor_t anchor);
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_soc_status_t _status;    // Published copy for other tasks
+  mutable portMUX_TYPE _mux;
+
+  bool _valid;
+  bool _loaded;                   // State came from flash
+  float _soc;                     // Fraction 0..1
+  float _sigma;
+  float _capacityAh;
+  float _nominalAh;
+  float _r0;                      // EKF resistance, 0 until it has run
+  modbee_soc_anchor_t _lastAnchor;
+  uint32_t _anchors;
+  uint32_t _capacityUpdates;
+  float _restSeconds;
+  bool _atFull;
+  unsigned long _lastFrameMs;     // Timestamp of the last frame counted, 0 = none yet
+
+  // Last anchor, for capacity learning
+  float _anchorSoc;
+  float _anchorSigma;
+  float _ahSinceAnchor;
+
+  unsigned long _lastSave;
+  ModbeeMpptSocEkf _ekf;
+  bool _ekfActive;
+  volatile bool _resetPending;
+
+  bool load();
+  void seed(const modbee_telemetry_t& telemetry);
+  void anchor(modbee_soc_anchor_t kind, float soc, float sigma);
+  void sampleCoulomb(const modbee_telemetry_t& telemetry, const modbee_soc_chemistry_t* chemistry,
+                     const modbee_ocv_curve_t* curve, uint8_t cells, bool full, float dt);
+  void sampleEkf(const modbee_telemetry_t& telemetry, const modbee_soc_chemistry_t& chemistry,
+                 const modbee_ocv_curve_t& curve, uint8_t cells, bool full, float dt);
+  void publish();
+};
+
+#endif // MODBEE_MPPT_SOC_ESTIMATOR_H
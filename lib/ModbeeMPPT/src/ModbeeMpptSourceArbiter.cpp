@@ -0,0 +1,370 @@
+/*!
+ * @file ModbeeMpptSourceArbiter.cpp
+ *
+ * @brief Implementation of the VAC1/VAC2 source arbiter
+ */
+
+#include "ModbeeMpptSourceArbiter.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+
+ModbeeMpptSourceArbiter::ModbeeMpptSourceArbiter(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _running(false),
+  _hardware(false),
+  _active(0),
+  _demand(false),
+  _switchedAt(0),
+  _probeUntil(0),
+  _probeFrom(0),
+  _onset(0),
+  _pending(0),
+  _appliedVoltage(0.0f),
+  _appliedCurrent(0.0f)
+{
+  memset(&_status, 0, sizeof(_status));
+  memset(_present, 0, sizeof(_present));
+  memset(_voltage, 0, sizeof(_voltage));
+  memset(_power, 0, sizeof(_power));
+  memset(_measuredAt, 0, sizeof(_measuredAt));
+  memset(_measured, 0, sizeof(_measured));
+}
+
+const char* ModbeeMpptSourceArbiter::policyName(modbee_source_policy_t policy) {
+  switch (policy) {
+    case MODBEE_SOURCE_POLICY_PREFER_SOLAR: return "prefer-solar";
+    case MODBEE_SOURCE_POLICY_MAX_POWER: return "max-power";
+    case MODBEE_SOURCE_POLICY_CHEAPEST: return "cheapest";
+    case MODBEE_SOURCE_POLICY_FAILOVER: return "failover";
+    default: return "off";
+  }
+}
+
+bool ModbeeMpptSourceArbiter::isActive() const {
+  return _mppt.config.sourceArbiterActive();
+}
+
+modbee_source_status_t ModbeeMpptSourceArbiter::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_source_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+// ========================================================================
+// ENABLE / DISABLE
+// ========================================================================
+
+void ModbeeMpptSourceArbiter::start() {
+  // The chip latches which ACFET-RBFET pairs are fitted at power-up; with
+  // either missing EN_ACDRV is locked and there is nothing to switch
+  modbee_status3_t status3 = _mppt.api.getStatus3();
+  _hardware = status3.acrb1_active && status3.acrb2_active;
+  _running = true;
+  _active = 0;
+  _probeUntil = 0;
+  _probeFrom = 0;
+  _onset = 0;
+  _pending = 0;
+  _switchedAt = millis();
+  _appliedVoltage = _appliedCurrent = 0.0f;
+  memset(_present, 0, sizeof(_present));
+  memset(_measured, 0, sizeof(_measured));
+
+  if (!_hardware) {
+    MODBEE_LOGW("Source arbiter: ACFETs not fitted on both inputs, input left to the chip");
+    return;
+  }
+
+  // Carry on with whichever input the chip has on; none starts on the first frame
+  if (_mppt._bq25798.getACDRV1enable()) {
+    _active = 1;
+  } else if (_mppt._bq25798.getACDRV2enable()) {
+    _active = 2;
+  }
+  _mppt.api.setActiveInput(_active);
+  if (_active) applyLimits(_active);
+  MODBEE_LOGI("Source arbiter started: %s, VAC%u active",
+              policyName(_mppt.config.data.source_policy), _active);
+}
+
+void ModbeeMpptSourceArbiter::stop() {
+  // Hand the limits back to the config values; the active ACFET stays on
+  // so stopping never interrupts the input
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  if (!_mppt.config.firmwareMpptActive()) {
+    _mppt.api.setInputVoltageLimit(config.input_voltage_limit);
+  }
+  _mppt.api.setInputCurrentLimit(config.input_current_limit);
+  _mppt.api.setActiveInput(0);
+  _running = false;
+  _active = 0;
+
+  portENTER_CRITICAL(&_mux);
+  memset(&_status, 0, sizeof(_status));
+  portEXIT_CRITICAL(&_mux);
+  MODBEE_LOGI("Source arbiter stopped");
+}
+
+// ========================================================================
+// MEASUREMENT
+// ========================================================================
+
+void ModbeeMpptSourceArbiter::sampleSources(const modbee_telemetry_t& telemetry, unsigned long now) {
+  _voltage[0] = telemetry.vac1.voltage;
+  _voltage[1] = telemetry.vac2.voltage;
+  for (uint8_t i = 0; i < MODBEE_SOURCE_COUNT; i++) {
+    if (_present[i] && _voltage[i] < MODBEE_SOURCE_LOST_V) _present[i] = false;
+    if (!_present[i] && _voltage[i] > MODBEE_SOURCE_PRESENT_V) _present[i] = true;
+  }
+
+  // An input's power only says something while the charger wants more
+  _demand = telemetry.charge_state == MODBEE_CHARGE_TRICKLE ||
+            telemetry.charge_state == MODBEE_CHARGE_PRECHARGE ||
+            telemetry.charge_state == MODBEE_CHARGE_FAST_CC;
+  if (!_active || !_demand || now - _switchedAt < MODBEE_SOURCE_SETTLE_S * 1000UL) return;
+
+  // All of VBUS power comes through the active input
+  uint8_t i = _active - 1;
+  float power = telemetry.vbus.power;
+  _power[i] = _measured[i] ? _power[i] + MODBEE_SOURCE_POWER_ALPHA * (power - _power[i]) : power;
+  _measured[i] = true;
+  _measuredAt[i] = now;
+}
+
+bool ModbeeMpptSourceArbiter::fresh(uint8_t source, unsigned long now) const {
+  uint8_t i = source - 1;
+  return _measured[i] && now - _measuredAt[i] <= MODBEE_SOURCE_STALE_S * 1000UL;
+}
+
+// ========================================================================
+// POLICIES
+// ========================================================================
+
+uint8_t ModbeeMpptSourceArbiter::choose(unsigned long now) const {
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  uint8_t primary = config.source_primary == 2 ? 2 : 1;
+  uint8_t secondary = 3 - primary;
+
+  // Presence first: a missing input is never chosen, whatever the policy
+  if (!_present[0] && !_present[1]) return _active;
+  if (!_present[primary - 1]) return secondary;
+  if (!_present[secondary - 1]) return primary;
+
+  switch (config.source_policy) {
+    case MODBEE_SOURCE_POLICY_FAILOVER:
+      return primary;
+
+    case MODBEE_SOURCE_POLICY_CHEAPEST: {
+      float primaryCost = primary == 1 ? config.vac1_cost : config.vac2_cost;
+      float secondaryCost = primary == 1 ? config.vac2_cost : config.vac1_cost;
+      return secondaryCost < primaryCost ? secondary : primary;
+    }
+
+    case MODBEE_SOURCE_POLICY_PREFER_SOLAR:
+      // A stale solar reading is refreshed by a probe, not by switching for good
+      if (!fresh(primary, now)) return _active ? _active : primary;
+      return _power[primary - 1] < MODBEE_SOURCE_SOLAR_MIN_W ? secondary : primary;
+
+    case MODBEE_SOURCE_POLICY_MAX_POWER: {
+      if (!_active) return primary;
+      // The margin favours the input in use, or the one a probe left from
+      uint8_t incumbent = _probeFrom ? _probeFrom : _active;
+      uint8_t challenger = 3 - incumbent;
+      if (!fresh(incumbent, now) || !fresh(challenger, now)) return _active;
+      float incumbentPower = _power[incumbent - 1];
+      float challengerPower = _power[challenger - 1];
+      bool better = challengerPower > incumbentPower * (1.0f + MODBEE_SOURCE_MARGIN) &&
+                    challengerPower - incumbentPower > MODBEE_SOURCE_MARGIN_W;
+      return better ? challenger : incumbent;
+    }
+
+    default:
+      return _active;
+  }
+}
+
+bool ModbeeMpptSourceArbiter::wantsProbe(unsigned long now) const {
+  if (!_active || !_demand) return false;
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  uint8_t idle = 3 - _active;
+  if (config.source_policy == MODBEE_SOURCE_POLICY_PREFER_SOLAR) {
+    if (idle != (config.source_primary == 2 ? 2 : 1)) return false;
+  } else if (config.source_policy != MODBEE_SOURCE_POLICY_MAX_POWER) {
+    return false;
+  }
+  return _present[idle - 1] && !fresh(idle, now) &&
+         now - _switchedAt >= (unsigned long)config.source_dwell_s * 1000UL;
+}
+
+// ========================================================================
+// SWITCHING
+// ========================================================================
+
+void ModbeeMpptSourceArbiter::applyLimits(uint8_t source) {
+  // 0 = no input selected: the config input limits
+  const ModbeeMpptConfigData& config = _mppt.config.data;
+  float voltage = source == 1 ? config.vac1_voltage_limit : (source == 2 ? config.vac2_voltage_limit : 0.0f);
+  float current = source == 1 ? config.vac1_current_limit : (source == 2 ? config.vac2_current_limit : 0.0f);
+  if (voltage <= 0.0f) voltage = config.input_voltage_limit;
+  if (current <= 0.0f) current = config.input_current_limit;
+
+  if (_mppt.config.firmwareMpptActive()) {
+    _appliedVoltage = 0.0f;  // Tracker owns VINDPM; written again once it stops
+  } else if (fabsf(voltage - _appliedVoltage) >= 0.01f) {
+    _mppt.api.setInputVoltageLimit(voltage);
+    _appliedVoltage = voltage;
+  }
+  if (fabsf(current - _appliedCurrent) >= 0.01f) {
+    _mppt.api.setInputCurrentLimit(current);
+    _appliedCurrent = current;
+  }
+}
+
+void ModbeeMpptSourceArbiter::switchTo(uint8_t source, const char* reason, unsigned long onset,
+                                       bool lost, unsigned long now) {
+  const ModbeeMpptConfig& config = _mppt.config;
+  unsigned long start = micros();
+
+  // The new input's limits go in before its FET closes
+  applyLimits(source);
+
+  // Break before make: both ACFETs must never be on together
+  if (source == 1) {
+    _mppt._bq25798.setACDRV2enable(false);
+    _mppt._bq25798.setACDRV1enable(true);
+  } else {
+    _mppt._bq25798.setACDRV1enable(false);
+    _mppt._bq25798.setACDRV2enable(true);
+  }
+  _mppt.api.setActiveInput(source);
+
+  // The old input's MPP means nothing on the new one
+  if (config.firmwareMpptActive()) {
+    _mppt.tracker.requestSweep();
+  } else if (config.data.mppt_enable) {
+    // Re-enabling restarts the VOC measurement cycle on the new input
+    _mppt.api.setMPPTEnable(false);
+    _mppt.api.setMPPTEnable(true);
+  }
+  uint32_t writeUs = micros() - start;
+  uint32_t latencyMs = onset ? now - onset : 0;
+
+  MODBEE_LOGI("Input VAC%u -> VAC%u (%s, %lu ms after onset, %lu us)",
+              _active, source, reason, (unsigned long)latencyMs, (unsigned long)writeUs);
+  _active = source;
+  _switchedAt = now;
+  _measured[source - 1] = false;  // Re-measured once MPPT has settled
+  _onset = 0;
+  _pending = 0;
+
+  portENTER_CRITICAL(&_mux);
+  _status.switches++;
+  _status.reason = reason;
+  _status.lastSwitchUs = writeUs;
+  _status.lastLatencyMs = latencyMs;
+  if (lost && latencyMs > _status.maxLossLatencyMs) _status.maxLossLatencyMs = latencyMs;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ========================================================================
+// DECISION
+// ========================================================================
+
+void ModbeeMpptSourceArbiter::update(const modbee_telemetry_t& telemetry) {
+  bool active = isActive();
+  if (active != _running) {
+    if (active) {
+      start();
+    } else {
+      stop();
+    }
+  }
+  if (!active || !telemetry.valid) return;
+
+  unsigned long now = millis();
+  if (!_hardware) {
+    // Nothing to switch, but the arbiter still owns the input limits
+    applyLimits(0);
+    publish(now, 0);
+    return;
+  }
+
+  unsigned long decisionStart = micros();
+  unsigned long dwell = (unsigned long)_mppt.config.data.source_dwell_s * 1000UL;
+  sampleSources(telemetry, now);
+  bool lost = _active && !_present[_active - 1];
+
+  bool probeDone = false;
+  if (_probeUntil && (lost || (long)(now - _probeUntil) >= 0)) {
+    _probeUntil = 0;
+    probeDone = true;
+  }
+
+  // Onset is the capture time of the first frame that wanted this input
+  uint8_t desired = _probeUntil ? _active : choose(now);
+  if (desired == 0 || desired == _active) {
+    _onset = 0;
+    _pending = 0;
+  } else if (desired != _pending) {
+    _pending = desired;
+    _onset = telemetry.timestamp_ms;
+  }
+
+  uint8_t target = 0;
+  const char* reason = nullptr;
+  bool probe = false;
+  if (_pending) {
+    if (!_active) {
+      target = _pending;
+      reason = "start";
+    } else if (lost) {
+      target = _pending;
+      reason = "lost";
+    } else if (probeDone) {
+      // The probe already measured both inputs, no need to dwell on the worse one
+      target = _pending;
+      reason = "probe result";
+    } else if (now - _onset >= dwell && now - _switchedAt >= dwell) {
+      target = _pending;
+      reason = policyName(_mppt.config.data.source_policy);
+    }
+  } else if (!_probeUntil && !probeDone && wantsProbe(now)) {
+    target = 3 - _active;
+    reason = "probe";
+    probe = true;
+  }
+  uint32_t decisionUs = micros() - decisionStart;
+
+  if (probe) _probeFrom = _active;
+  if (target) {
+    switchTo(target, reason, probe ? 0 : _onset, lost, now);
+    if (probe) _probeUntil = now + MODBEE_SOURCE_PROBE_S * 1000UL;
+  } else if (_active) {
+    applyLimits(_active);  // Config edits to the limits
+  }
+  if (probeDone) _probeFrom = 0;
+  publish(now, decisionUs);
+}
+
+void ModbeeMpptSourceArbiter::publish(unsigned long now, uint32_t decisionUs) {
+  portENTER_CRITICAL(&_mux);
+  _status.policy = _mppt.config.data.source_policy;
+  _status.hardware = _hardware;
+  _status.active = _active;
+  _status.probing = _probeUntil != 0;
+  for (uint8_t i = 0; i < MODBEE_SOURCE_COUNT; i++) {
+    modbee_source_info_t& info = _status.sources[i];
+    info.voltage = _voltage[i];
+    info.present = _present[i];
+    info.measured = fresh(i + 1, now);
+    info.power = _measured[i] ? _power[i] : 0.0f;
+    info.ageSeconds = _measured[i] ? (now - _measuredAt[i]) / 1000 : 0;
+  }
+  _status.voltageLimit = _appliedVoltage;
+  _status.currentLimit = _appliedCurrent;
+  _status.lastDecisionUs = decisionUs;
+  if (decisionUs > _status.maxDecisionUs) _status.maxDecisionUs = decisionUs;
+  portEXIT_CRITICAL(&_mux);
+}
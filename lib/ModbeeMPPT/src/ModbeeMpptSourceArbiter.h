@@ -0,0 +1,132 @@
+/*!
+ * @file ModbeeMpptSourceArbiter.h
+ *
+ * @brief VAC1/VAC2 input source arbitration for ModbeeMPPT
+ *
+ * The BQ25798 can switch between two inputs through external ACFET-RBFET
+ * pairs (ACDRV1/ACDRV2). Left alone it keeps whichever input it picked at
+ * power-up. With a policy set, this engine decides once per telemetry frame
+ * which input to use, switches break-before-make, and applies that input's
+ * VINDPM/IINDPM before its FET closes.
+ *
+ * Only the active input's power can be measured (IBUS flows through one
+ * FET); the idle input's voltage is read upstream of its FET. Policies that
+ * compare power re-measure the idle input with a short probe when its last
+ * measurement is stale. Power is only judged while the charger is asking
+ * for current: in CV or done, every input looks weak.
+ *
+ * Voluntary switches wait until the condition has held for the dwell time
+ * and the active input has been on for at least as long; losing the active
+ * input switches on the next frame. The decision compute time, the register
+ * write time and the delay from condition onset to switch are reported.
+ */
+
+#ifndef MODBEE_MPPT_SOURCE_ARBITER_H
+#define MODBEE_MPPT_SOURCE_ARBITER_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+
+#define MODBEE_SOURCE_COUNT 2
+
+// Presence from the VAC ADC, with hysteresis (V)
+#define MODBEE_SOURCE_PRESENT_V 4.0f
+#define MODBEE_SOURCE_LOST_V 3.5f
+
+// Power measurement of the active input
+#define MODBEE_SOURCE_SETTLE_S 3          // Ignored after a switch while MPPT settles
+#define MODBEE_SOURCE_POWER_ALPHA 0.2f    // EWMA weight of one 1 Hz sample
+#define MODBEE_SOURCE_STALE_S 600         // Idle input measurement expires, probe again
+#define MODBEE_SOURCE_PROBE_S 10          // Probe length, settle time included
+
+// Decision thresholds
+#define MODBEE_SOURCE_MARGIN 0.1f         // Max power: the other input must be 10 % better
+#define MODBEE_SOURCE_MARGIN_W 0.2f       // ... and at least this much (W)
+#define MODBEE_SOURCE_SOLAR_MIN_W 0.5f    // Prefer solar: below this the other input takes over
+
+typedef struct {
+  float voltage;                // VAC reading (V)
+  float power;                  // Smoothed power while active (W), 0 until measured
+  bool present;
+  bool measured;                // power is from the last MODBEE_SOURCE_STALE_S
+  uint32_t ageSeconds;          // Since the last power sample
+} modbee_source_info_t;
+
+typedef struct {
+  modbee_source_policy_t policy;
+  bool hardware;                // Both ACFET-RBFET pairs fitted
+  uint8_t active;               // 1 = VAC1, 2 = VAC2, 0 = not arbitrating
+  bool probing;                 // Measuring the idle input
+  modbee_source_info_t sources[MODBEE_SOURCE_COUNT];
+  float voltageLimit;           // VINDPM written for the active input (0 = tracker owns it)
+  float currentLimit;           // IINDPM written for the active input
+  uint32_t switches;            // Since the policy was enabled
+  const char* reason;           // Why the last switch happened
+  uint32_t lastDecisionUs;      // Compute time of the last decision
+  uint32_t maxDecisionUs;
+  uint32_t lastSwitchUs;        // Register writes of the last switch
+  uint32_t lastLatencyMs;       // Condition onset to switch, last switch
+  uint32_t maxLossLatencyMs;    // Worst onset to switch after losing the active input
+} modbee_source_status_t;
+
+class ModbeeMpptSourceArbiter {
+public:
+  ModbeeMpptSourceArbiter(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Decide and switch inputs with one 1 Hz telemetry frame
+   * @param telemetry Frame from ModbeeMpptAPI::getTelemetry()
+   */
+  void update(const modbee_telemetry_t& telemetry);
+
+  /*!
+   * @brief True while the arbiter owns ACDRV and the input limits
+   */
+  bool isActive() const;
+
+  /*!
+   * @brief Copy of the arbiter state for the web UI
+   */
+  modbee_source_status_t getStatus() const;
+
+  /*!
+   * @brief Short name of a policy ("failover", ...)
+   */
+  static const char* policyName(modbee_source_policy_t policy);
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_source_status_t _status;
+  mutable portMUX_TYPE _mux;
+
+  bool _running;
+  bool _hardware;
+  uint8_t _active;              // 1 or 2, 0 before the first switch
+  bool _demand;                 // Charger asking for current (power is meaningful)
+  bool _present[MODBEE_SOURCE_COUNT];
+  float _voltage[MODBEE_SOURCE_COUNT];
+  float _power[MODBEE_SOURCE_COUNT];
+  unsigned long _measuredAt[MODBEE_SOURCE_COUNT];
+  bool _measured[MODBEE_SOURCE_COUNT];
+  unsigned long _switchedAt;
+  unsigned long _probeUntil;    // 0 = not probing
+  uint8_t _probeFrom;           // Input the probe left from, 0 = none
+  unsigned long _onset;         // First frame the pending switch was wanted, 0 = none
+  uint8_t _pending;             // Input the onset belongs to
+
+  // Last register values, written again only on change
+  float _appliedVoltage;
+  float _appliedCurrent;
+
+  void start();
+  void stop();
+  void sampleSources(const modbee_telemetry_t& telemetry, unsigned long now);
+  bool fresh(uint8_t source, unsigned long now) const;
+  uint8_t choose(unsigned long now) const;
+  bool wantsProbe(unsigned long now) const;
+  void switchTo(uint8_t source, const char* reason, unsigned long onset, bool lost, unsigned long now);
+  void applyLimits(uint8_t source);
+  void publish(unsigned long now, uint32_t decisionUs);
+};
+
+#endif // MODBEE_MPPT_SOURCE_ARBITER_H
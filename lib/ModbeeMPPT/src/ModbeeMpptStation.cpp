@@ -0,0 +1,237 @@
+/*!
+ * @file ModbeeMpptStation.cpp
+ *
+ * @brief Implementation of the station-mode WiFi owner and its RTC cache
+ */
+
+#include "ModbeeMpptStation.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+#include "ModbeeMpptHash.h"
+#include <WiFi.h>
+#include <esp_wifi.h>
+
+RTC_DATA_ATTR ModbeeMpptStation::Cache ModbeeMpptStation::_cache;
+
+// ========================================================================
+// STATION
+// ========================================================================
+
+ModbeeMpptStation::ModbeeMpptStation(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _bootId(0),
+  _holders(0),
+  _joining(false),
+  _joined(false),
+  _fast(false),
+  _ipReused(false),
+  _credentials(0),
+  _joinStart(0),
+  _onSince(0),
+  _sleepType(-1)
+{
+  memset(&_status, 0, sizeof(_status));
+  memset(&_counters, 0, sizeof(_counters));
+}
+
+void ModbeeMpptStation::begin() {
+  _bootId = esp_random();
+  // Joins are driven from here: nothing written to flash, no retries behind our back
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  if (_cache.magic == MODBEE_STATION_CACHE_MAGIC) {
+    MODBEE_LOGD("WiFi cache: channel %u, %02x:%02x:%02x:%02x:%02x:%02x", _cache.channel,
+                _cache.bssid[0], _cache.bssid[1], _cache.bssid[2], _cache.bssid[3], _cache.bssid[4],
+                _cache.bssid[5]);
+  }
+  updateStatus();
+}
+
+void ModbeeMpptStation::loop() {
+  if (!_holders) return;
+  unsigned long now = millis();
+
+  // New network or password: join again with them
+  if (credentialsHash() != _credentials) {
+    MODBEE_LOGI("WiFi credentials changed, joining again");
+    WiFi.disconnect(false);
+    join();
+  }
+
+  if (_joining) {
+    if (WiFi.status() == WL_CONNECTED) {
+      _joining = false;
+      _joined = true;
+      _counters.joins++;
+      if (_fast) _counters.fastJoins++;
+      _counters.lastJoinMs = now - _joinStart;
+      _counters.lastJoinFast = _fast;
+      saveCache();
+      _sleepType = -1;
+      MODBEE_LOGI("WiFi joined %s in %lu ms (%s), IP %s", _mppt.config.data.wifi_ssid,
+                  (unsigned long)_counters.lastJoinMs, _fast ? "cached AP" : "scan",
+                  WiFi.localIP().toString().c_str());
+    } else if (_fast && now - _joinStart > MODBEE_STATION_FAST_TIMEOUT_MS) {
+      // The access point moved or is gone: forget it and scan
+      MODBEE_LOGW("WiFi cached AP not joined in %u ms, scanning", MODBEE_STATION_FAST_TIMEOUT_MS);
+      _cache.magic = 0;
+      _counters.fastFallbacks++;
+      WiFi.disconnect(false);
+      join();
+    } else if (!_fast && now - _joinStart > MODBEE_STATION_JOIN_TIMEOUT_MS) {
+      MODBEE_LOGD("WiFi join timed out, trying again");
+      _counters.timeouts++;
+      WiFi.disconnect(false);
+      join();
+    }
+  } else if (_joined && WiFi.status() != WL_CONNECTED) {
+    MODBEE_LOGW("WiFi link lost, joining again");
+    _joined = false;
+    join();
+  }
+
+  if (_joined) applySleep();
+  updateStatus();
+}
+
+void ModbeeMpptStation::acquire(uint8_t holder) {
+  if (_holders & holder) return;
+  bool first = !_holders;
+  _holders |= holder;
+  if (first) {
+    _onSince = millis();
+    join();
+  }
+  updateStatus();
+}
+
+void ModbeeMpptStation::release(uint8_t holder) {
+  if (!(_holders & holder)) return;
+  _holders &= ~holder;
+  if (!_holders) leave();
+  updateStatus();
+}
+
+uint32_t ModbeeMpptStation::credentialsHash() const {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  // Matches the cache to the credentials it was made with
+  return ModbeeMpptHash::text(ModbeeMpptHash::text(ModbeeMpptHash::SEED, data.wifi_ssid), data.wifi_password);
+}
+
+void ModbeeMpptStation::join() {
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  _credentials = credentialsHash();
+  _fast = _cache.magic == MODBEE_STATION_CACHE_MAGIC && _cache.credentials == _credentials;
+  // A lease from an earlier boot may have been handed on since; within this
+  // boot it is reused for no longer than the lease surely lasts
+  _ipReused = _fast && _cache.ip && _cache.bootId == _bootId &&
+              millis() - _cache.savedMs < MODBEE_STATION_IP_REUSE_MS;
+  _joining = true;
+  _joined = false;
+  _joinStart = millis();
+
+  // Alongside the soft AP when the web UI runs one
+  WiFi.mode((wifi_mode_t)(WiFi.getMode() | WIFI_STA));
+  if (_ipReused) {
+    WiFi.config(IPAddress(_cache.ip), IPAddress(_cache.gateway), IPAddress(_cache.subnet), IPAddress(_cache.dns));
+  } else {
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());  // DHCP
+  }
+  const char* password = data.wifi_password[0] ? data.wifi_password : nullptr;
+  WiFi.begin(data.wifi_ssid, password, _fast ? _cache.channel : 0, _fast ? _cache.bssid : nullptr, false);
+
+  // The listen interval goes out in the association request, so it is set
+  // between configuring the station and connecting
+  wifi_config_t config;
+  if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+    config.sta.listen_interval = MODBEE_STATION_LISTEN_INTERVAL;
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+  }
+  esp_wifi_connect();
+}
+
+void ModbeeMpptStation::leave() {
+  WiFi.disconnect(false);
+  WiFi.mode((wifi_mode_t)(WiFi.getMode() & ~WIFI_STA));
+  _counters.radioOnMs += millis() - _onSince;
+  _joining = false;
+  _joined = false;
+  _sleepType = -1;
+}
+
+void ModbeeMpptStation::saveCache() {
+  const uint8_t* bssid = WiFi.BSSID();
+  if (!bssid) return;
+  _cache.credentials = _credentials;
+  memcpy(_cache.bssid, bssid, sizeof(_cache.bssid));
+  _cache.channel = WiFi.channel();
+  _cache.ip = (uint32_t)WiFi.localIP();
+  _cache.gateway = (uint32_t)WiFi.gatewayIP();
+  _cache.subnet = (uint32_t)WiFi.subnetMask();
+  _cache.dns = (uint32_t)WiFi.dnsIP();
+  _cache.bootId = _bootId;
+  // A reused address keeps the age of the lease it came from
+  if (!_ipReused) _cache.savedMs = millis();
+  _cache.magic = MODBEE_STATION_CACHE_MAGIC;
+}
+
+void ModbeeMpptStation::applySleep() {
+  bool mqttOnly = _holders == MODBEE_STATION_MQTT && !(WiFi.getMode() & WIFI_AP);
+  wifi_ps_type_t type = mqttOnly ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM;
+  if ((int)type == _sleepType) return;
+  WiFi.setSleep(type);
+  _sleepType = type;
+}
+
+void ModbeeMpptStation::updateStatus() {
+  _counters.active = _holders != 0;
+  _counters.connected = _joined;
+  _counters.holders = _holders;
+  _counters.rssi = _joined ? WiFi.RSSI() : 0;
+  _counters.channel = _joined ? WiFi.channel() : 0;
+  _counters.ip = _joined ? (uint32_t)WiFi.localIP() : 0;
+  modbee_station_status_t status = _counters;
+  if (_holders) status.radioOnMs += millis() - _onSince;
+  portENTER_CRITICAL(&_mux);
+  _status = status;
+  portEXIT_CRITICAL(&_mux);
+}
+
+modbee_station_status_t ModbeeMpptStation::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_station_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+void ModbeeMpptStation::printStatus() const {
+  modbee_station_status_t s = getStatus();
+  static const char* const SLEEP_NAMES[] = {"none", "min modem", "max modem"};
+  Serial.printf("=== WiFi station (%s) ===\n",
+                !s.active ? "off" : s.connected ? "joined" : "joining");
+  Serial.printf("Network: %s, web UI %s\n", _mppt.config.data.wifi_ssid[0] ? _mppt.config.data.wifi_ssid : "(none)",
+                _mppt.config.data.wifi_mode == MODBEE_WIFI_STATION ? "on station" : "on AP");
+  Serial.printf("Held by: %s%s%s\n", s.holders & MODBEE_STATION_MQTT ? "mqtt " : "",
+                s.holders & MODBEE_STATION_WEB ? "web " : "", s.holders ? "" : "nobody");
+  if (s.connected) {
+    Serial.printf("Link: IP %s, channel %u, RSSI %d dBm, sleep %s, listen interval %u\n",
+                  IPAddress(s.ip).toString().c_str(), s.channel, s.rssi,
+                  _sleepType >= 0 && _sleepType <= 2 ? SLEEP_NAMES[_sleepType] : "-",
+                  MODBEE_STATION_LISTEN_INTERVAL);
+  }
+  Serial.printf("Joins: %lu (%lu to cached AP, %lu fell back to a scan, %lu timed out)\n",
+                (unsigned long)s.joins, (unsigned long)s.fastJoins, (unsigned long)s.fastFallbacks,
+                (unsigned long)s.timeouts);
+  Serial.printf("Last join: %lu ms (%s)\n", (unsigned long)s.lastJoinMs,
+                s.joins ? (s.lastJoinFast ? "cached AP" : "scan") : "none yet");
+  if (_cache.magic == MODBEE_STATION_CACHE_MAGIC) {
+    Serial.printf("Cache: %02x:%02x:%02x:%02x:%02x:%02x channel %u, IP %s%s\n", _cache.bssid[0],
+                  _cache.bssid[1], _cache.bssid[2], _cache.bssid[3], _cache.bssid[4], _cache.bssid[5],
+                  _cache.channel, IPAddress(_cache.ip).toString().c_str(),
+                  _cache.bootId == _bootId ? "" : " (earlier boot, DHCP)");
+  } else {
+    Serial.println("Cache: empty");
+  }
+  Serial.printf("Radio on: %lu ms total\n", (unsigned long)s.radioOnMs);
+}
@@ -0,0 +1,147 @@
+/*!
+ * @file ModbeeMpptStation.h
+ *
+ * @brief Station-mode WiFi for ModbeeMPPT, with fast reconnect
+ *
+ * The one owner of the station interface. Its users, the MQTT publisher
+ * for a session and the web server when wifiMode is station, acquire() it
+ * and release() it when done: the station joins wifiSsid on the first
+ * acquire and leaves after the last release, so the radio is only on
+ * while someone needs it. radioOnMs counts that time.
+ *
+ * A full join scans every channel and waits for DHCP, which takes
+ * seconds. After each join the access point's BSSID and channel and the
+ * DHCP lease are cached in RTC memory. The next join goes straight to
+ * that access point on that channel, and within the same boot and
+ * MODBEE_STATION_IP_REUSE_MS configures the address statically, so a
+ * reconnect after light sleep costs little more than the association. A
+ * fast join that has not completed after MODBEE_STATION_FAST_TIMEOUT_MS
+ * (access point moved or replaced) drops the cache and scans.
+ *
+ * While joined the station modem-sleeps. With only MQTT holding it, max
+ * modem sleep wakes every MODBEE_STATION_LISTEN_INTERVAL beacons, as a
+ * session only waits for acknowledgements; with the web UI holding it or
+ * the soft AP up, min modem sleep wakes every DTIM so pages stay
+ * responsive.
+ */
+
+#ifndef MODBEE_MPPT_STATION_H
+#define MODBEE_MPPT_STATION_H
+
+#include "ModbeeMpptGlobal.h"
+
+#ifndef MODBEE_STATION_LISTEN_INTERVAL
+#define MODBEE_STATION_LISTEN_INTERVAL 10      // Beacon intervals (102.4 ms) between wakes in max modem sleep
+#endif
+#ifndef MODBEE_STATION_IP_REUSE_MS
+#define MODBEE_STATION_IP_REUSE_MS 1800000     // 30 min, well inside a typical DHCP lease
+#endif
+#define MODBEE_STATION_FAST_TIMEOUT_MS 2000    // Join to the cached access point before scanning instead
+#define MODBEE_STATION_JOIN_TIMEOUT_MS 15000   // Full join, then it starts again
+#define MODBEE_STATION_CACHE_MAGIC 0x4D535441  // "MSTA"
+
+// Users of the station (acquire() and release())
+#define MODBEE_STATION_MQTT 0x01
+#define MODBEE_STATION_WEB 0x02
+
+typedef struct {
+  bool active;                  // Held by a user: joining or joined
+  bool connected;
+  uint8_t holders;              // MODBEE_STATION_* bits
+  uint32_t joins;               // Completed joins since boot
+  uint32_t fastJoins;           // Of those, to the cached access point
+  uint32_t fastFallbacks;       // Fast joins that timed out and scanned instead
+  uint32_t timeouts;            // Full joins that timed out and started again
+  uint32_t lastJoinMs;          // From the start of the last join to an address
+  bool lastJoinFast;
+  uint32_t radioOnMs;           // Station held since boot
+  int8_t rssi;
+  uint8_t channel;
+  uint32_t ip;
+} modbee_station_status_t;
+
+class ModbeeMpptStation {
+public:
+  ModbeeMpptStation(class ModbeeMPPT& mppt);
+
+  void begin();
+
+  /*!
+   * @brief Follow the join, rejoin a lost link; call every loop pass
+   */
+  void loop();
+
+  /*!
+   * @brief Take the station for a user, joining if it is the first
+   * @param holder MODBEE_STATION_MQTT or MODBEE_STATION_WEB
+   */
+  void acquire(uint8_t holder);
+
+  /*!
+   * @brief Give the station back, leaving the network after the last user
+   */
+  void release(uint8_t holder);
+
+  /*!
+   * @brief True while any user holds the station (main loop)
+   */
+  bool isActive() const { return _holders != 0; }
+
+  /*!
+   * @brief True once joined with an address (main loop)
+   */
+  bool isConnected() const { return _joined; }
+
+  /*!
+   * @brief Copy of the status and counters (any task)
+   */
+  modbee_station_status_t getStatus() const;
+
+  /*!
+   * @brief Print the status to Serial
+   */
+  void printStatus() const;
+
+private:
+  // Survives light sleep and resets other than power-on
+  struct Cache {
+    uint32_t magic;
+    uint32_t credentials;       // Hash of the SSID and password it was joined with
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t bootId;            // Boot the lease was taken in
+    unsigned long savedMs;      // millis() the lease was taken
+  };
+
+  static Cache _cache;
+
+  class ModbeeMPPT& _mppt;
+  mutable portMUX_TYPE _mux;
+  modbee_station_status_t _status;
+
+  uint32_t _bootId;
+  uint8_t _holders;
+  bool _joining;
+  bool _joined;
+  bool _fast;                   // Join to the cached access point
+  bool _ipReused;               // Join with the cached address
+  uint32_t _credentials;        // Hash of the settings being joined with
+  unsigned long _joinStart;
+  unsigned long _onSince;       // millis() of the first acquire
+  int _sleepType;               // wifi_ps_type_t set while joined, -1 = none yet
+
+  modbee_station_status_t _counters; // Main loop copy of the status, published by updateStatus()
+
+  uint32_t credentialsHash() const;
+  void join();
+  void leave();
+  void saveCache();
+  void applySleep();
+  void updateStatus();
+};
+
+#endif // MODBEE_MPPT_STATION_H
@@ -0,0 +1,315 @@
+/*!
+ * @file ModbeeMpptTracker.cpp
+ *
+ * @brief Implementation of the firmware perturb & observe tracker
+ */
+
+#include "ModbeeMpptTracker.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+
+// Round to the 100 mV VINDPM register resolution
+static float quantizeVref(float voltage) {
+  return roundf(voltage * 10.0f) / 10.0f;
+}
+
+ModbeeMpptTracker::ModbeeMpptTracker(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _wasActive(false),
+  _sweepRequested(false),
+  _lastSweepTime(0),
+  _sweepIndex(-1),
+  _sweepStep(MODBEE_TRACKER_MIN_STEP)
+{
+  memset(&_status, 0, sizeof(_status));
+  memset(&_scan, 0, sizeof(_scan));
+  memset(&_curve, 0, sizeof(_curve));
+  _status.sweepPeriodMs = MODBEE_SWEEP_PERIOD_MS;
+  reset();
+}
+
+bool ModbeeMpptTracker::isActive() const {
+  return _mppt.config.firmwareMpptActive();
+}
+
+modbee_tracker_status_t ModbeeMpptTracker::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_tracker_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+bool ModbeeMpptTracker::getLastCurve(modbee_pv_curve_t& curve) const {
+  portENTER_CRITICAL(&_mux);
+  curve = _curve;
+  portEXIT_CRITICAL(&_mux);
+  return curve.count > 0;
+}
+
+void ModbeeMpptTracker::reset() {
+  _stepTime = millis();
+  _lastSampleTime = 0;
+  _samples = 0;
+  _sumV = _sumI = _sumP = 0.0f;
+  _havePrevious = false;
+}
+
+void ModbeeMpptTracker::setVref(float vref) {
+  float ceiling = _mppt.config.data.input_voltage_limit;
+  vref = quantizeVref(constrain(vref, MODBEE_MIN_INPUT_VOLTAGE, ceiling));
+  if (vref != _status.vref) {
+    _mppt.api.setInputVoltageLimit(vref);
+  }
+  _stepTime = millis();
+  _samples = 0;
+  _sumV = _sumI = _sumP = 0.0f;
+
+  portENTER_CRITICAL(&_mux);
+  _status.step = vref - _status.vref;
+  _status.vref = vref;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ========================================================================
+// STATE MACHINE
+// ========================================================================
+
+void ModbeeMpptTracker::loop() {
+  bool active = isActive();
+  if (active != _wasActive) {
+    _wasActive = active;
+    if (_status.state == MODBEE_TRACKER_SWEEPING) {
+      _mppt.api.configureADC(MODBEE_ADC_RES_15BIT, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);
+    }
+    reset();
+    if (active) {
+      // Start from the register value and sweep once to find the global maximum
+      portENTER_CRITICAL(&_mux);
+      _status.vref = _mppt.api.getInputVoltageLimit();
+      _status.iterations = 0;
+      portEXIT_CRITICAL(&_mux);
+      _sweepRequested = true;
+      MODBEE_LOGI("Firmware MPPT started at VINDPM %.1fV", _status.vref);
+    } else {
+      MODBEE_LOGI("Firmware MPPT stopped");
+    }
+    portENTER_CRITICAL(&_mux);
+    _status.state = active ? MODBEE_TRACKER_TRACKING : MODBEE_TRACKER_OFF;
+    portEXIT_CRITICAL(&_mux);
+  }
+  if (!active) return;
+
+  // An I-V trace owns VINDPM, and a true battery voltage measurement stops
+  // the converter; start over once either is done
+  if (_mppt.curveTracer.isBusy() || _mppt.api.isTrueBatteryVoltageBusy()) {
+    if (_status.state == MODBEE_TRACKER_SWEEPING) abortSweep();
+    reset();
+    return;
+  }
+
+  unsigned long now = millis();
+
+  if (_status.state == MODBEE_TRACKER_SWEEPING) {
+    unsigned long settle = (_sweepIndex < 0) ? MODBEE_SWEEP_VOC_SETTLE_MS : MODBEE_SWEEP_SETTLE_MS;
+    if (now - _stepTime < settle) return;
+    modbee_power_data_t sample;
+    if (!_mppt.api.sampleInputPower(sample)) return;
+    sweepPoint(sample.voltage, sample.current);
+    return;
+  }
+
+  // Sweeps start only from a settled tracking state, between steps
+  if (_status.state == MODBEE_TRACKER_TRACKING && _samples == 0 &&
+      (_sweepRequested || now - _lastSweepTime >= _status.sweepPeriodMs)) {
+    startSweep();
+    return;
+  }
+
+  if (now - _stepTime < MODBEE_TRACKER_SETTLE_MS) return;
+  if (_samples > 0 && now - _lastSampleTime < MODBEE_TRACKER_SAMPLE_SPACING_MS) return;
+
+  modbee_power_data_t sample;
+  if (!_mppt.api.sampleInputPower(sample)) return;
+  _lastSampleTime = now;
+  _sumV += sample.voltage;
+  _sumI += sample.current;
+  _sumP += sample.power;
+  if (++_samples < MODBEE_TRACKER_SAMPLES) return;
+
+  float n = (float)_samples;
+  evaluate(_sumV / n, _sumI / n, _sumP / n);
+}
+
+void ModbeeMpptTracker::evaluate(float voltage, float current, float power) {
+  float vref = _status.vref;
+  modbee_tracker_state_t state;
+  float next;
+
+  if (voltage < MODBEE_MIN_INPUT_VOLTAGE) {
+    // No source: park VINDPM where the next sunrise will start from
+    state = MODBEE_TRACKER_NO_INPUT;
+    _havePrevious = false;
+    next = _mppt.config.data.input_voltage_limit;
+  } else if (voltage < vref - MODBEE_TRACKER_REG_MARGIN) {
+    // VINDPM above the source's reach, so the converter draws almost
+    // nothing; restart from a typical Vmp/Voc ratio
+    state = MODBEE_TRACKER_TRACKING;
+    _havePrevious = false;
+    next = voltage * MODBEE_TRACKER_START_RATIO;
+  } else if (voltage > vref + MODBEE_TRACKER_REG_MARGIN) {
+    // Charge current or input current limit reached before VINDPM:
+    // the source has spare power. Follow VBUS so tracking resumes from
+    // the right place when demand rises.
+    state = MODBEE_TRACKER_LIMITED;
+    _havePrevious = false;
+    next = voltage - MODBEE_TRACKER_MIN_STEP;
+  } else {
+    state = MODBEE_TRACKER_TRACKING;
+    float step = MODBEE_TRACKER_MIN_STEP;
+    float direction = -1.0f;  // First step from a fresh start: move down from Voc side
+    if (_havePrevious) {
+      float dP = power - _prevPower;
+      float dV = vref - _prevVref;
+      float lastDirection = (dV >= 0.0f) ? 1.0f : -1.0f;
+      float deadband = max(MODBEE_TRACKER_DEADBAND_W, power * MODBEE_TRACKER_DEADBAND_REL);
+      if (fabsf(dV) < 0.05f) {
+        // Setpoint was clamped, so there is no slope to follow: turn back
+        direction = -lastDirection;
+      } else {
+        // Keep going while power rises, reverse when it falls; near the
+        // peak (change within noise) this dithers with the smallest step
+        direction = (dP > 0.0f) ? lastDirection : -lastDirection;
+        if (fabsf(dP) > deadband) {
+          step = constrain(MODBEE_TRACKER_STEP_GAIN * fabsf(dP / dV),
+                           MODBEE_TRACKER_MIN_STEP, MODBEE_TRACKER_MAX_STEP);
+        }
+      }
+    }
+    _prevPower = power;
+    _prevVref = vref;
+    _havePrevious = true;
+    next = vref + direction * step;
+  }
+
+  portENTER_CRITICAL(&_mux);
+  _status.state = state;
+  _status.voltage = voltage;
+  _status.current = current;
+  _status.power = power;
+  _status.iterations++;
+  portEXIT_CRITICAL(&_mux);
+
+  setVref(next);
+}
+
+// ========================================================================
+// GLOBAL SWEEP
+// ========================================================================
+
+void ModbeeMpptTracker::startSweep() {
+  _sweepRequested = false;
+  _sweepIndex = -1;
+  memset(&_scan, 0, sizeof(_scan));
+
+  // 15-bit conversions take ~24 ms per channel; 12-bit keeps the sweep short
+  _mppt.api.configureADC(MODBEE_ADC_RES_12BIT, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);
+
+  portENTER_CRITICAL(&_mux);
+  _status.state = MODBEE_TRACKER_SWEEPING;
+  portEXIT_CRITICAL(&_mux);
+
+  // VINDPM at the ceiling stops the converter drawing, so VBUS rises to Voc
+  setVref(_mppt.config.data.input_voltage_limit);
+}
+
+void ModbeeMpptTracker::sweepPoint(float voltage, float current) {
+  if (_sweepIndex < 0) {
+    _scan.voc = voltage;
+    if (voltage < MODBEE_MIN_INPUT_VOLTAGE + MODBEE_TRACKER_MIN_STEP) {
+      finishSweep();
+      return;
+    }
+    // Spread the points evenly from just below Voc to the minimum
+    float span = voltage - MODBEE_MIN_INPUT_VOLTAGE;
+    _sweepStep = max(MODBEE_TRACKER_MIN_STEP, ceilf(span * 10.0f / (MODBEE_SWEEP_MAX_POINTS - 1)) / 10.0f);
+    _sweepIndex = 0;
+    setVref(quantizeVref(voltage) - _sweepStep);
+    return;
+  }
+
+  modbee_pv_point_t& point = _scan.points[_scan.count++];
+  point.voltage = voltage;
+  point.current = current;
+  _sweepIndex++;
+
+  float next = _status.vref - _sweepStep;
+  if (_scan.count >= MODBEE_SWEEP_MAX_POINTS || next < MODBEE_MIN_INPUT_VOLTAGE - 0.05f) {
+    finishSweep();
+    return;
+  }
+  setVref(next);
+}
+
+void ModbeeMpptTracker::abortSweep() {
+  // Neither starts while a sweep runs, but one started directly takes the
+  // ADC and restores 15 bit itself when done; sweep again after it
+  _sweepIndex = -1;
+  _sweepRequested = true;
+  portENTER_CRITICAL(&_mux);
+  _status.state = MODBEE_TRACKER_TRACKING;
+  portEXIT_CRITICAL(&_mux);
+  MODBEE_LOGD("MPP sweep interrupted, repeating it");
+}
+
+void ModbeeMpptTracker::finishSweep() {
+  _mppt.api.configureADC(MODBEE_ADC_RES_15BIT, MODBEE_ADC_AVG_1, MODBEE_ADC_CONTINUOUS);
+  _sweepIndex = -1;
+  _lastSweepTime = millis();
+  reset();
+
+  if (_scan.count == 0) {
+    // No source to sweep; let the P&O state machine report it
+    portENTER_CRITICAL(&_mux);
+    _status.state = MODBEE_TRACKER_TRACKING;
+    portEXIT_CRITICAL(&_mux);
+    setVref(_mppt.config.data.input_voltage_limit);
+    return;
+  }
+
+  uint8_t best = 0;
+  for (uint8_t i = 1; i < _scan.count; i++) {
+    if (_scan.points[i].voltage * _scan.points[i].current >
+        _scan.points[best].voltage * _scan.points[best].current) {
+      best = i;
+    }
+  }
+  _scan.pmax = _scan.points[best].voltage * _scan.points[best].current;
+  _scan.vmp = quantizeVref(_scan.points[best].voltage);
+  _scan.timestamp_ms = _lastSweepTime;
+
+  // Sweep less often while the curve is stable, more often when it moves
+  unsigned long period = _status.sweepPeriodMs;
+  if (_curve.count > 0) {
+    float change = fabsf(_scan.pmax - _curve.pmax) / max(_scan.pmax, 0.1f) +
+                   fabsf(_scan.vmp - _curve.vmp) / _scan.voc;
+    if (change < MODBEE_SWEEP_CHANGE_LOW) {
+      period = min(period * 2, MODBEE_SWEEP_PERIOD_MAX_MS);
+    } else if (change > MODBEE_SWEEP_CHANGE_HIGH) {
+      period = max(period / 2, MODBEE_SWEEP_PERIOD_MIN_MS);
+    }
+  }
+
+  portENTER_CRITICAL(&_mux);
+  _curve = _scan;
+  _status.sweeps++;
+  _status.sweepPeriodMs = period;
+  _status.state = MODBEE_TRACKER_TRACKING;
+  portEXIT_CRITICAL(&_mux);
+
+  MODBEE_LOGI("MPP sweep: Voc %.1fV, max %.2fW at %.1fV, next in %lus",
+              _scan.voc, _scan.pmax, _scan.vmp, period / 1000);
+
+  // Hand over to P&O at the global maximum
+  setVref(_scan.vmp);
+}
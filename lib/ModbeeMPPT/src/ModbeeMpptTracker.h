@@ -0,0 +1,165 @@
+/*!
+ * @file ModbeeMpptTracker.h
+ *
+ * @brief Firmware perturb & observe MPPT for ModbeeMPPT
+ *
+ * When the config selects MODBEE_MPPT_MODE_PO, the BQ25798's fractional-VOC
+ * sampling is disabled and this tracker moves the input voltage limit
+ * (VINDPM) itself. Every step it waits for the converter to settle, averages
+ * a few burst-read VBUS/IBUS pairs and moves VINDPM towards higher input
+ * power. The step size scales with |dP/dV|, so it is large far from the
+ * maximum power point and shrinks to the 100 mV register resolution near it.
+ *
+ * Hill climbing can settle on a local peak when part of the panel is
+ * shaded, so the tracker periodically sweeps VINDPM from the open-circuit
+ * voltage down to MODBEE_MIN_INPUT_VOLTAGE, keeps the P-V curve, jumps to
+ * the global maximum and resumes P&O from there. The sweep period doubles
+ * while consecutive curves agree and halves when they differ.
+ */
+
+#ifndef MODBEE_MPPT_TRACKER_H
+#define MODBEE_MPPT_TRACKER_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+
+// Timing of one perturbation
+#define MODBEE_TRACKER_SETTLE_MS 250          // Converter settle time after a VINDPM change
+#define MODBEE_TRACKER_SAMPLE_SPACING_MS 30   // At least one ADC cycle between samples
+#define MODBEE_TRACKER_SAMPLES 4              // Samples averaged per step
+
+// Step size limits (V); VINDPM resolution is 100 mV
+#define MODBEE_TRACKER_MIN_STEP 0.1f
+#define MODBEE_TRACKER_MAX_STEP 1.0f
+#define MODBEE_TRACKER_STEP_GAIN 0.05f        // Step (V) per W/V of |dP/dV|
+
+// Power change treated as noise: max(absolute, relative to P)
+#define MODBEE_TRACKER_DEADBAND_W 0.02f
+#define MODBEE_TRACKER_DEADBAND_REL 0.005f
+
+// VBUS this far from VINDPM means the converter is not regulating on it
+#define MODBEE_TRACKER_REG_MARGIN 0.3f
+
+// Initial operating point as a fraction of the measured VBUS (~Vmp/Voc)
+#define MODBEE_TRACKER_START_RATIO 0.8f
+
+// Global sweep: points, per-point settle (ADC runs at 12 bits during a sweep)
+#define MODBEE_SWEEP_MAX_POINTS 32
+#define MODBEE_SWEEP_SETTLE_MS 35             // About one 12-bit ADC cycle over all channels
+#define MODBEE_SWEEP_VOC_SETTLE_MS 150        // VINDPM at the ceiling, converter idle
+
+// Sweep period adapts between these bounds (ms)
+#define MODBEE_SWEEP_PERIOD_MS 300000UL
+#define MODBEE_SWEEP_PERIOD_MIN_MS 120000UL
+#define MODBEE_SWEEP_PERIOD_MAX_MS 1800000UL
+
+// Relative curve change below which the period doubles, above which it halves
+#define MODBEE_SWEEP_CHANGE_LOW 0.05f
+#define MODBEE_SWEEP_CHANGE_HIGH 0.20f
+
+typedef enum {
+  MODBEE_TRACKER_OFF = 0,       // Not selected in config
+  MODBEE_TRACKER_NO_INPUT = 1,  // VBUS below the minimum input voltage
+  MODBEE_TRACKER_LIMITED = 2,   // Input power limited by the charger, not the source
+  MODBEE_TRACKER_TRACKING = 3,  // Perturbing VINDPM around the maximum power point
+  MODBEE_TRACKER_SWEEPING = 4   // Global sweep in progress
+} modbee_tracker_state_t;
+
+// One P-V curve point
+typedef struct {
+  float voltage;                // Averaged VBUS (V)
+  float current;                // Averaged IBUS (A)
+} modbee_pv_point_t;
+
+// P-V curve captured by the last global sweep (points from Voc downwards)
+typedef struct {
+  modbee_pv_point_t points[MODBEE_SWEEP_MAX_POINTS];
+  uint8_t count;
+  float voc;                    // Open-circuit voltage before the sweep (V)
+  float vmp;                    // VINDPM of the global maximum (V)
+  float pmax;                   // Power at the global maximum (W)
+  unsigned long timestamp_ms;   // millis() when the sweep finished
+} modbee_pv_curve_t;
+
+typedef struct {
+  modbee_tracker_state_t state;
+  float vref;                   // VINDPM setpoint (V)
+  float step;                   // Last step (V, signed)
+  float voltage;                // Averaged VBUS at the last step (V)
+  float current;                // Averaged IBUS at the last step (A)
+  float power;                  // Input power at the last step (W)
+  uint32_t iterations;          // Completed perturbations since enabled
+  uint32_t sweeps;              // Completed global sweeps since boot
+  unsigned long sweepPeriodMs;  // Current adaptive sweep period
+} modbee_tracker_status_t;
+
+class ModbeeMpptTracker {
+public:
+  ModbeeMpptTracker(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Run the tracker state machine; call every loop pass (non-blocking)
+   */
+  void loop();
+
+  /*!
+   * @brief True while the tracker owns VINDPM (PO mode and MPPT enabled)
+   */
+  bool isActive() const;
+
+  /*!
+   * @brief True while a global sweep owns VINDPM and the ADC (main loop)
+   */
+  bool isSweeping() const { return _status.state == MODBEE_TRACKER_SWEEPING; }
+
+  /*!
+   * @brief Copy of the tracker state for the web UI
+   */
+  modbee_tracker_status_t getStatus() const;
+
+  /*!
+   * @brief Start a global sweep at the next step (ignored unless tracking)
+   */
+  void requestSweep() { _sweepRequested = true; }
+
+  /*!
+   * @brief Copy the P-V curve of the last completed sweep
+   * @param curve Destination
+   * @return False if no sweep has completed yet
+   */
+  bool getLastCurve(modbee_pv_curve_t& curve) const;
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_tracker_status_t _status;
+  mutable portMUX_TYPE _mux;
+
+  bool _wasActive;
+  unsigned long _stepTime;      // When VINDPM was last written
+  unsigned long _lastSampleTime;
+  uint8_t _samples;
+  float _sumV, _sumI, _sumP;
+
+  // Previous operating point for the P&O decision
+  bool _havePrevious;
+  float _prevPower;
+  float _prevVref;
+
+  // Global sweep
+  volatile bool _sweepRequested;
+  unsigned long _lastSweepTime;
+  int8_t _sweepIndex;           // -1 = measuring Voc, else next point to record
+  float _sweepStep;
+  modbee_pv_curve_t _scan;      // Curve being recorded
+  modbee_pv_curve_t _curve;     // Last completed curve (read by the web server)
+
+  void reset();
+  void setVref(float vref);
+  void evaluate(float voltage, float current, float power);
+  void startSweep();
+  void sweepPoint(float voltage, float current);
+  void finishSweep();
+  void abortSweep();
+};
+
+#endif // MODBEE_MPPT_TRACKER_H
@@ -0,0 +1,180 @@
+/*!
+ * @file ModbeeMpptVocTuner.cpp
+ *
+ * @brief Implementation of the adaptive VOC sampling rate
+ */
+
+#include "ModbeeMpptVocTuner.h"
+#include "ModbeeMPPT.h"
+#include "ModbeeMpptEventLog.h"
+
+// Register settings per level and their duty cost (converter off delay / rate)
+struct VocLevelSetting {
+  modbee_voc_rate_t rate;
+  modbee_voc_delay_t delay;
+  float rateSeconds;
+  float delaySeconds;
+};
+
+static const VocLevelSetting LEVEL_SETTINGS[MODBEE_VOC_LEVEL_COUNT] = {
+  {MODBEE_VOC_RATE_10MIN, MODBEE_VOC_DELAY_300MS, 600.0f, 0.3f},
+  {MODBEE_VOC_RATE_2MIN, MODBEE_VOC_DELAY_300MS, 120.0f, 0.3f},
+  {MODBEE_VOC_RATE_30S, MODBEE_VOC_DELAY_50MS, 30.0f, 0.05f}
+};
+
+ModbeeMpptVocTuner::ModbeeMpptVocTuner(ModbeeMPPT& mppt) :
+  _mppt(mppt),
+  _mux(portMUX_INITIALIZER_UNLOCKED),
+  _haveMean(false),
+  _inDip(false),
+  _prevPower(0.0f),
+  _levelSince(0)
+{
+  memset(&_status, 0, sizeof(_status));
+  _status.level = MODBEE_VOC_LEVEL_MODERATE;
+}
+
+bool ModbeeMpptVocTuner::isActive() const {
+  return _mppt.config.vocTunerActive();
+}
+
+modbee_voc_tuner_status_t ModbeeMpptVocTuner::getStatus() const {
+  portENTER_CRITICAL(&_mux);
+  modbee_voc_tuner_status_t copy = _status;
+  portEXIT_CRITICAL(&_mux);
+  return copy;
+}
+
+const char* ModbeeMpptVocTuner::levelName(modbee_voc_level_t level) {
+  switch (level) {
+    case MODBEE_VOC_LEVEL_STABLE: return "stable";
+    case MODBEE_VOC_LEVEL_FAST: return "fast";
+    default: return "moderate";
+  }
+}
+
+// ========================================================================
+// ENABLE / DISABLE
+// ========================================================================
+
+void ModbeeMpptVocTuner::start() {
+  _haveMean = false;
+  _inDip = false;
+  portENTER_CRITICAL(&_mux);
+  memset(&_status, 0, sizeof(_status));
+  _status.active = true;
+  _status.level = MODBEE_VOC_LEVEL_MODERATE;
+  portEXIT_CRITICAL(&_mux);
+
+  // Start from the chip default rate until there is a variability estimate
+  const VocLevelSetting& setting = LEVEL_SETTINGS[MODBEE_VOC_LEVEL_MODERATE];
+  _mppt.api.setMPPTVOCRate(setting.rate);
+  _mppt.api.setMPPTVOCDelay(setting.delay);
+  _levelSince = millis();
+  MODBEE_LOGI("Adaptive VOC rate started");
+}
+
+void ModbeeMpptVocTuner::stop() {
+  portENTER_CRITICAL(&_mux);
+  _status.active = false;
+  portEXIT_CRITICAL(&_mux);
+
+  // Hand the registers back to the static config values
+  _mppt.api.setMPPTVOCRate(_mppt.config.data.mppt_voc_rate);
+  _mppt.api.setMPPTVOCDelay(_mppt.config.data.mppt_voc_delay);
+  MODBEE_LOGI("Adaptive VOC rate stopped");
+}
+
+void ModbeeMpptVocTuner::setLevel(modbee_voc_level_t level) {
+  const VocLevelSetting& setting = LEVEL_SETTINGS[level];
+  _mppt.api.setMPPTVOCRate(setting.rate);
+  _mppt.api.setMPPTVOCDelay(setting.delay);
+
+  // Report what the level being left has cost so far
+  modbee_voc_level_t previous = _status.level;
+  const modbee_voc_level_stats_t& cost = _status.levels[previous];
+  MODBEE_LOGI("VOC level %s -> %s (variability %.2f%%/s); %s cost %.1fs / %.3fWh in %lus",
+              levelName(previous), levelName(level), _status.variability * 100.0f,
+              levelName(previous), cost.lostSeconds, cost.lostWh, (unsigned long)cost.seconds);
+
+  portENTER_CRITICAL(&_mux);
+  _status.level = level;
+  _status.changes++;
+  portEXIT_CRITICAL(&_mux);
+  _levelSince = millis();
+}
+
+// ========================================================================
+// VARIABILITY ESTIMATE
+// ========================================================================
+
+void ModbeeMpptVocTuner::sample(const modbee_telemetry_t& telemetry) {
+  bool active = isActive();
+  if (active != _status.active) {
+    if (active) {
+      start();
+    } else {
+      stop();
+    }
+  }
+  if (!active || !telemetry.valid) return;
+
+  float power = telemetry.vbus.power;
+  float mean = _status.meanPower;
+  float variability = _status.variability;
+  const float alpha = 1.0f / MODBEE_VOC_TUNER_WINDOW_S;
+
+  if (!_haveMean) {
+    // Seed from the first frame with real input (not a VOC measurement)
+    if (power >= MODBEE_VOC_TUNER_MIN_POWER) {
+      mean = power;
+      _prevPower = power;
+      _haveMean = true;
+    }
+  } else if (!_inDip && mean >= MODBEE_VOC_TUNER_MIN_POWER && power < mean * MODBEE_VOC_TUNER_DIP_RATIO) {
+    // One low frame is the chip measuring VOC, not weather; a second one
+    // in a row is a real drop and is counted
+    _inDip = true;
+  } else {
+    _inDip = false;
+    mean += alpha * (power - mean);
+    if (mean >= MODBEE_VOC_TUNER_MIN_POWER) {
+      variability += alpha * (fabsf(power - _prevPower) / mean - variability);
+    }
+    _prevPower = power;
+  }
+
+  // Charge this frame to the current level
+  const VocLevelSetting& setting = LEVEL_SETTINGS[_status.level];
+  float lostFraction = setting.delaySeconds / setting.rateSeconds;
+  portENTER_CRITICAL(&_mux);
+  modbee_voc_level_stats_t& stats = _status.levels[_status.level];
+  stats.seconds++;
+  stats.lostSeconds += lostFraction;
+  stats.lostWh += max(mean, 0.0f) * lostFraction / 3600.0f;
+  _status.meanPower = mean;
+  _status.variability = variability;
+  portEXIT_CRITICAL(&_mux);
+
+  // Hold the level at night and in very low light, the estimate is noise
+  if (mean < MODBEE_VOC_TUNER_MIN_POWER) return;
+
+  modbee_voc_level_t level = _status.level;
+  modbee_voc_level_t target = level;
+  if (variability > MODBEE_VOC_TUNER_FAST_UP) {
+    target = MODBEE_VOC_LEVEL_FAST;
+  } else if (variability > MODBEE_VOC_TUNER_MODERATE_UP && level < MODBEE_VOC_LEVEL_MODERATE) {
+    target = MODBEE_VOC_LEVEL_MODERATE;
+  } else if (level == MODBEE_VOC_LEVEL_FAST && variability < MODBEE_VOC_TUNER_FAST_DOWN) {
+    target = MODBEE_VOC_LEVEL_MODERATE;
+  } else if (level == MODBEE_VOC_LEVEL_MODERATE && variability < MODBEE_VOC_TUNER_MODERATE_DOWN) {
+    target = MODBEE_VOC_LEVEL_STABLE;
+  }
+
+  // React quickly to clouds, relax slowly once they pass
+  unsigned long elapsed = millis() - _levelSince;
+  if ((target > level && elapsed >= MODBEE_VOC_TUNER_UP_DWELL_MS) ||
+      (target < level && elapsed >= MODBEE_VOC_TUNER_DOWN_DWELL_MS)) {
+    setLevel(target);
+  }
+}
@@ -0,0 +1,99 @@
+/*!
+ * @file ModbeeMpptVocTuner.h
+ *
+ * @brief Adaptive BQ25798 VOC sampling rate for ModbeeMPPT
+ *
+ * Every VOC measurement stops the converter for the VOC delay, so frequent
+ * sampling costs harvest on a clear day while a slow rate leaves VINDPM
+ * stale under passing clouds. When enabled, this module measures input
+ * power variability from the 1 Hz telemetry frames and switches between a
+ * few rate/delay pairs, with separate up/down thresholds and a minimum
+ * dwell time so the registers are only rewritten on real weather changes.
+ * The harvest time each setting cost is accumulated for the debug page.
+ */
+
+#ifndef MODBEE_MPPT_VOC_TUNER_H
+#define MODBEE_MPPT_VOC_TUNER_H
+
+#include "ModbeeMpptGlobal.h"
+#include "ModbeeMpptAPI.h"
+
+// Variability = EWMA of |dP| / mean P between 1 s frames
+#define MODBEE_VOC_TUNER_WINDOW_S 60          // EWMA time constant (frames)
+#define MODBEE_VOC_TUNER_MIN_POWER 0.5f       // Below this (W) the level is held
+#define MODBEE_VOC_TUNER_DIP_RATIO 0.5f       // A single frame below this x mean is a VOC measurement
+
+// Level thresholds (variability per second): enter above UP, leave below DOWN
+#define MODBEE_VOC_TUNER_MODERATE_UP 0.008f
+#define MODBEE_VOC_TUNER_MODERATE_DOWN 0.004f
+#define MODBEE_VOC_TUNER_FAST_UP 0.03f
+#define MODBEE_VOC_TUNER_FAST_DOWN 0.015f
+
+// Minimum time in a level before moving up / down
+#define MODBEE_VOC_TUNER_UP_DWELL_MS 30000UL
+#define MODBEE_VOC_TUNER_DOWN_DWELL_MS 300000UL
+
+typedef enum {
+  MODBEE_VOC_LEVEL_STABLE = 0,    // Clear sky: 10 min rate, 300 ms delay
+  MODBEE_VOC_LEVEL_MODERATE = 1,  // Some cloud: 2 min rate, 300 ms delay
+  MODBEE_VOC_LEVEL_FAST = 2,      // Fast-moving cloud: 30 s rate, 50 ms delay
+  MODBEE_VOC_LEVEL_COUNT = 3
+} modbee_voc_level_t;
+
+// Time spent at one level and what its VOC measurements cost
+typedef struct {
+  uint32_t seconds;               // Frames spent at this level
+  float lostSeconds;              // Converter-off time spent measuring VOC
+  float lostWh;                   // Estimated energy not harvested meanwhile
+} modbee_voc_level_stats_t;
+
+typedef struct {
+  bool active;
+  modbee_voc_level_t level;
+  float variability;              // Current variability estimate (1/s)
+  float meanPower;                // EWMA input power (W)
+  uint32_t changes;               // Register updates since enabled
+  modbee_voc_level_stats_t levels[MODBEE_VOC_LEVEL_COUNT];
+} modbee_voc_tuner_status_t;
+
+class ModbeeMpptVocTuner {
+public:
+  ModbeeMpptVocTuner(class ModbeeMPPT& mppt);
+
+  /*!
+   * @brief Feed one 1 Hz telemetry frame; retunes the registers if needed
+   * @param telemetry Frame from ModbeeMpptAPI::getTelemetry()
+   */
+  void sample(const modbee_telemetry_t& telemetry);
+
+  /*!
+   * @brief True while the tuner owns the VOC rate/delay registers
+   */
+  bool isActive() const;
+
+  /*!
+   * @brief Copy of the tuner state for the web UI
+   */
+  modbee_voc_tuner_status_t getStatus() const;
+
+  /*!
+   * @brief Short name of a level ("stable", "moderate", "fast")
+   */
+  static const char* levelName(modbee_voc_level_t level);
+
+private:
+  class ModbeeMPPT& _mppt;
+  modbee_voc_tuner_status_t _status;
+  mutable portMUX_TYPE _mux;
+
+  bool _haveMean;
+  bool _inDip;                    // Previous frame was skipped as a VOC measurement
+  float _prevPower;
+  unsigned long _levelSince;
+
+  void start();
+  void stop();
+  void setLevel(modbee_voc_level_t level);
+};
+
+#endif // MODBEE_MPPT_VOC_TUNER_H
@@ -7,14 +7,25 @@
 #include "ModbeeMpptWebServer.h"
 #include "ModbeeMPPT.h"
 #include "ModbeeMpptLog.h"
+#include "ModbeeMpptHistory.h"
+#include "ModbeeMpptMetrics.h"
+#include "ModbeeMpptEventLog.h"
+#include <AsyncJson.h>
+#include <memory>
 
 ModbeeMpptWebServer::ModbeeMpptWebServer(ModbeeMPPT& mppt)
-  : _mppt(mppt),
+  : _wifiActive(false),
+    _mppt(mppt),
+    _statsLog(nullptr),
     _server(80),
     _webSocket("/ws"),
+    _wsMux(portMUX_INITIALIZER_UNLOCKED),
     _clientConnected(false),
     _lastActivity(0),
-    _wifiActive(false) {
+    _usingStation(false),
+    _stationJoining(false),
+    _stationStart(0) {
+  memset(_wsClients, 0, sizeof(_wsClients));
 }
 
 bool ModbeeMpptWebServer::begin() {
@@ -44,8 +55,37 @@ bool ModbeeMpptWebServer::begin() {
     this->handleDebug(request);
   });
   
-  // Serve static files from LittleFS
-  _server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html");
+  _server.on("/api/history", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    this->handleHistory(request);
+  });
+  
+  _server.on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    this->handleMetrics(request);
+  });
+  
+  _server.on("/api/pvcurve", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    this->handlePVCurve(request);
+  });
+  
+  _server.on("/fleet", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    this->handleFleetPage(request);
+  });
+  
+  _server.on("/api/fleet", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    this->handleFleet(request);
+  });
+  
+  // JSON config API: GET returns all settings, PATCH applies a partial update
+  AsyncCallbackJsonWebHandler *configHandler = new AsyncCallbackJsonWebHandler("/api/config",
+    [this](AsyncWebServerRequest *request, JsonVariant &json) {
+      this->handleConfig(request, json);
+    });
+  configHandler->setMethod(HTTP_GET | HTTP_PATCH);
+  configHandler->setMaxContentLength(2048);
+  _server.addHandler(configHandler);
+  
+  // Serve the web pages from LittleFS
+  _server.serveStatic("/", LittleFS, MODBEE_WEB_ROOT).setDefaultFile("index.html");
   
   // Add WebSocket to server
   _server.addHandler(&_webSocket);
@@ -69,11 +109,25 @@ void ModbeeMpptWebServer::loop() {
   // Auto-start WiFi when webserver is enabled (first time)
   static bool autoStarted = false;
   if (!autoStarted && !_wifiActive) {
-    Serial.println("Auto-starting WiFi AP...");
+    MODBEE_LOGI("Auto-starting WiFi...");
     startWiFi();
     autoStarted = true;
   }
   
+  if (_stationJoining) {
+    if (_mppt.station.isConnected()) {
+      _stationJoining = false;
+      MODBEE_LOGI("Web server started on http://%s", WiFi.localIP().toString().c_str());
+    } else if (millis() - _stationStart > MODBEE_STATION_JOIN_TIMEOUT_MS) {
+      MODBEE_LOGW("WiFi network %s not joined, starting the AP instead", _mppt.config.data.wifi_ssid);
+      _server.end();
+      _mppt.station.release(MODBEE_STATION_WEB);
+      _usingStation = false;
+      _stationJoining = false;
+      startAccessPoint();
+    }
+  }
+  
   if (_wifiActive) {
     updateClientStatus();
     
@@ -82,6 +136,9 @@ void ModbeeMpptWebServer::loop() {
     if (millis() - lastBroadcast > 1000) {
       broadcastData();
       lastBroadcast = millis();
+    } else {
+      // Hand the newest frame to clients whose queue has drained since
+      sendTelemetry(false);
     }
   }
 }
@@ -93,14 +150,30 @@ void ModbeeMpptWebServer::stop() {
 bool ModbeeMpptWebServer::startWiFi() {
   if (_wifiActive) return true;
   
-  Serial.println("Starting WiFi AP...");
+  const ModbeeMpptConfigData& data = _mppt.config.data;
+  if (data.wifi_mode == MODBEE_WIFI_STATION && data.wifi_ssid[0]) {
+    // Serve on the configured network; a cached AP makes this a fast rejoin
+    MODBEE_LOGI("Joining WiFi network %s...", data.wifi_ssid);
+    _mppt.station.acquire(MODBEE_STATION_WEB);
+    _server.begin();
+    _usingStation = true;
+    _stationJoining = true;
+    _stationStart = millis();
+    _wifiActive = true;
+    _lastActivity = millis();
+    return true;
+  }
+  return startAccessPoint();
+}
+
+bool ModbeeMpptWebServer::startAccessPoint() {
+  MODBEE_LOGI("Starting WiFi AP...");
   
-  // Start WiFi AP
-  WiFi.mode(WIFI_AP);
+  // Start WiFi AP (beside the station while an MQTT session holds it)
+  WiFi.mode(_mppt.station.isActive() ? WIFI_AP_STA : WIFI_AP);
   WiFi.softAP(WIFI_SSID, WIFI_PASSWORD);
   
-  Serial.print("WiFi AP started. IP: ");
-  Serial.println(WiFi.softAPIP());
+  MODBEE_LOGI("WiFi AP started. IP: %s", WiFi.softAPIP().toString().c_str());
   
   // Start DNS server for captive portal
   _dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());
@@ -111,24 +184,31 @@ bool ModbeeMpptWebServer::startWiFi() {
   _wifiActive = true;
   _lastActivity = millis();
   
-  Serial.println("Web server started on http://192.168.4.1");
+  MODBEE_LOGI("Web server started on http://192.168.4.1");
   return true;
 }
 
 void ModbeeMpptWebServer::stopWiFi() {
   if (!_wifiActive) return;
   
-  Serial.println("Stopping WiFi and web server...");
+  MODBEE_LOGI("Stopping WiFi and web server...");
   
   _server.end();
-  _dnsServer.stop();
-  WiFi.softAPdisconnect(true);
-  WiFi.mode(WIFI_OFF);
+  if (_usingStation) {
+    _mppt.station.release(MODBEE_STATION_WEB);
+  } else {
+    _dnsServer.stop();
+    bool station = _mppt.station.isActive();
+    WiFi.softAPdisconnect(!station);
+    WiFi.mode(station ? WIFI_STA : WIFI_OFF);
+  }
   
+  _usingStation = false;
+  _stationJoining = false;
   _wifiActive = false;
   _clientConnected = false;
   
-  Serial.println("WiFi stopped");
+  MODBEE_LOGI("WiFi stopped");
 }
 
 void ModbeeMpptWebServer::updateClientStatus() {
@@ -156,16 +236,17 @@ void ModbeeMpptWebServer::onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocke
         for (size_t i = 0; i < server->count(); i++) {
           AsyncWebSocketClient* c = server->client(i);
           if (c && c->remoteIP().toString() == clientIP && c->id() != client->id()) {
-            Serial.printf("Closing old WebSocket connection #%u from %s (too many connections)\n", 
-                         c->id(), clientIP.c_str());
+            MODBEE_LOGW("Closing old WebSocket connection #%u from %s (too many connections)",
+                        c->id(), clientIP.c_str());
             c->close();
             break;
           }
         }
       }
       
-      Serial.printf("WebSocket client #%u connected from %s\n", client->id(), clientIP.c_str());
+      MODBEE_LOGI("WebSocket client #%u connected from %s", client->id(), clientIP.c_str());
       _clientConnected = true;
+      trackClient(client->id());
       
       // Send initial data to new client
       sendSystemData(client);
@@ -175,7 +256,8 @@ void ModbeeMpptWebServer::onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocke
     }
       
     case WS_EVT_DISCONNECT:
-      Serial.printf("WebSocket client #%u disconnected\n", client->id());
+      MODBEE_LOGI("WebSocket client #%u disconnected", client->id());
+      untrackClient(client->id());
       updateClientStatus();
       break;
       
@@ -192,7 +274,11 @@ void ModbeeMpptWebServer::onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocke
     }
       
     case WS_EVT_ERROR:
-      Serial.printf("WebSocket client #%u error(%u): %s\n", client->id(), *((uint16_t*)arg), (char*)data);
+      MODBEE_LOGW("WebSocket client #%u error(%u): %s", client->id(), *((uint16_t*)arg), (char*)data);
+      break;
+
+    case WS_EVT_PONG:
+      // Answer to a ping; nothing to track
       break;
   }
 }
@@ -202,7 +288,7 @@ void ModbeeMpptWebServer::handleWebSocketMessage(AsyncWebSocketClient *client, c
   DeserializationError error = deserializeJson(doc, message);
   
   if (error) {
-    Serial.println("Failed to parse WebSocket message");
+    MODBEE_LOGW("Failed to parse WebSocket message");
     return;
   }
   
@@ -218,6 +304,29 @@ void ModbeeMpptWebServer::handleWebSocketMessage(AsyncWebSocketClient *client, c
     if (doc["settings"].is<JsonObject>()) {
       saveSettings(client, doc["settings"]);
     }
+  } else if (command == "setOcvCurve") {
+    saveOcvCurve(client, doc.as<JsonVariant>());
+  } else if (command == "getLog") {
+    sendLog(client, doc["since"] | 0UL);
+  } else if (command == "setLogLevel") {
+    ModbeeEventLog.setLevel(doc["level"] | (uint8_t)MODBEE_LOG_LEVEL_INFO);
+    sendLog(client, doc["since"] | 0UL);
+  } else if (command == "sweepNow") {
+    _mppt.tracker.requestSweep();
+  } else if (command == "resetSoc") {
+    _mppt.socEstimator.requestReset();
+  } else if (command == "traceCurve") {
+    _mppt.curveTracer.requestTrace();
+    sendCurves(client);
+  } else if (command == "getCurves") {
+    sendCurves(client);
+  } else if (command == "getCurve") {
+    sendCurve(client, doc["sequence"] | 0UL);
+  } else if (command == "selftest") {
+    _mppt.selfTest.requestRun();
+    sendSelfTest(client);
+  } else if (command == "getSelftest") {
+    sendSelfTest(client);
   } else if (command == "resetDefaults" || command == "resetSettings") {
     resetDefaults(client);
   } else if (command == "resetStat") {
@@ -270,189 +379,182 @@ void ModbeeMpptWebServer::sendDebugData(AsyncWebSocketClient *client) {
   }
 }
 
+void ModbeeMpptWebServer::sendLog(AsyncWebSocketClient *client, uint32_t since) {
+  JsonDocument response;
+  response["type"] = "log";
+  response["level"] = ModbeeEventLog.getLevel();
+  response["suppressed"] = ModbeeEventLog.getSuppressedCount();
+  
+  // At most 16 lines per reply; the page asks again from "next"
+  uint32_t sequence = max(since, ModbeeEventLog.firstSequence());
+  uint32_t end = min(ModbeeEventLog.endSequence(), sequence + 16);
+  JsonArray entries = response["entries"].to<JsonArray>();
+  modbee_log_entry_t entry;
+  for (; sequence < end; sequence++) {
+    if (!ModbeeEventLog.read(sequence, entry)) continue;
+    JsonObject line = entries.add<JsonObject>();
+    line["t"] = entry.timestamp_ms;
+    line["level"] = ModbeeMpptEventLog::levelTag(entry.level);
+    line["text"] = (const char*)entry.text;
+  }
+  response["next"] = sequence;
+  
+  String responseStr;
+  serializeJson(response, responseStr);
+  client->text(responseStr);
+}
+
+// Fitted parameters of a stored trace (shared by the list and single-curve replies)
+static void curveSummaryToJson(const ModbeeMpptCurveRecord& record, JsonObject obj) {
+  obj["sequence"] = record.sequence;
+  obj["uptime"] = record.uptime;
+  obj["voc"] = record.voc_mv / 1000.0f;
+  obj["isc"] = record.isc_ma / 1000.0f;
+  obj["vmp"] = record.vmp_mv / 1000.0f;
+  obj["imp"] = record.imp_ma / 1000.0f;
+  obj["ff"] = record.ff_permille / 1000.0f;
+  obj["limited"] = (record.flags & MODBEE_CURVE_FLAG_CURRENT_LIMITED) != 0;
+  obj["iscFitted"] = (record.flags & MODBEE_CURVE_FLAG_ISC_FITTED) != 0;
+  obj["points"] = record.count;
+}
+
+void ModbeeMpptWebServer::sendCurves(AsyncWebSocketClient *client) {
+  JsonDocument response;
+  response["type"] = "curves";
+  response["busy"] = _mppt.curveTracer.isPending();
+  response["result"] = _mppt.curveTracer.getLastResult();
+  
+  // Newest first; each record is read from flash into one reused buffer
+  JsonArray curves = response["curves"].to<JsonArray>();
+  ModbeeMpptCurveRecord record;
+  uint32_t first = _mppt.curveTracer.firstSequence();
+  for (uint32_t sequence = _mppt.curveTracer.endSequence(); sequence > first; sequence--) {
+    if (!_mppt.curveTracer.readCurve(sequence - 1, record)) continue;
+    curveSummaryToJson(record, curves.add<JsonObject>());
+  }
+  
+  String responseStr;
+  serializeJson(response, responseStr);
+  client->text(responseStr);
+}
+
+void ModbeeMpptWebServer::sendCurve(AsyncWebSocketClient *client, uint32_t sequence) {
+  JsonDocument response;
+  response["type"] = "curve";
+  
+  ModbeeMpptCurveRecord record;
+  if (!_mppt.curveTracer.readCurve(sequence, record)) {
+    response["error"] = "Curve not found";
+  } else {
+    curveSummaryToJson(record, response.as<JsonObject>());
+    // Compact [mV, mA] pairs, from Voc downwards
+    JsonArray points = response["data"].to<JsonArray>();
+    for (uint8_t i = 0; i < record.count; i++) {
+      JsonArray point = points.add<JsonArray>();
+      point.add(record.points[i].voltage_mv);
+      point.add(record.points[i].current_ma);
+    }
+  }
+  
+  String responseStr;
+  serializeJson(response, responseStr);
+  client->text(responseStr);
+}
+
 void ModbeeMpptWebServer::saveSettings(AsyncWebSocketClient *client, const JsonVariant& settings) {
   JsonDocument response;
   response["type"] = "status";
   
-  Serial.println("=== SAVING SETTINGS DEBUG ===");
-  Serial.println("Received settings data:");
-  String settingsStr;
-  serializeJsonPretty(settings, settingsStr);
-  Serial.println(settingsStr);
-  
-  // Simple direct updates to config data
-  bool success = true;
-  
-  try {
-    // Battery configuration - Using ArduinoJson v7 recommended approach
-    // Read values directly - use proper ArduinoJson v7 syntax
-    if (auto val = settings["batteryType"]; !val.isNull()) {
-      int batteryTypeValue = val.as<int>();
-      Serial.printf("Setting battery type: %d -> %d\n", _mppt.config.data.battery_type, batteryTypeValue);
-      _mppt.config.data.battery_type = (modbee_battery_type_t)batteryTypeValue;
-    }
-    if (auto val = settings["cellCount"]; !val.isNull()) {
-      Serial.printf("Setting cell count: %d -> %d\n", _mppt.config.data.battery_cell_count, val.as<uint8_t>());
-      _mppt.config.data.battery_cell_count = val.as<uint8_t>();
-    }
-    if (auto val = settings["chargeVoltage"]; !val.isNull()) {
-      Serial.printf("Setting charge voltage: %.2f -> %.2f\n", _mppt.config.data.charge_voltage, val.as<float>());
-      _mppt.config.data.charge_voltage = val.as<float>();
-    }
-    if (auto val = settings["chargeCurrent"]; !val.isNull()) {
-      Serial.printf("Setting charge current: %.2f -> %.2f\n", _mppt.config.data.charge_current, val.as<float>());
-      _mppt.config.data.charge_current = val.as<float>();
-    }
-    if (auto val = settings["termCurrent"]; !val.isNull()) {
-      Serial.printf("Setting termination current: %.3f -> %.3f\n", _mppt.config.data.termination_current, val.as<float>());
-      _mppt.config.data.termination_current = val.as<float>();
-    }
-    if (auto val = settings["prechargeCurrent"]; !val.isNull()) {
-      Serial.printf("Setting precharge current: %.3f -> %.3f\n", _mppt.config.data.precharge_current, val.as<float>());
-      _mppt.config.data.precharge_current = val.as<float>();
-    }
-    if (auto val = settings["prechargeVoltageThreshold"]; !val.isNull()) {
-      int prechargeVoltageThresholdValue = val.as<int>();
-      Serial.printf("Setting precharge voltage threshold: %d -> %d\n", _mppt.config.data.precharge_voltage_threshold, prechargeVoltageThresholdValue);
-      _mppt.config.data.precharge_voltage_threshold = (modbee_vbat_lowv_t)prechargeVoltageThresholdValue;
-    }
-    if (auto val = settings["rechargeThreshold"]; !val.isNull()) {
-      Serial.printf("Setting recharge threshold: %.3f -> %.3f\n", _mppt.config.data.recharge_threshold, val.as<float>());
-      _mppt.config.data.recharge_threshold = val.as<float>();
-    }
-    if (auto val = settings["inputVoltage"]; !val.isNull()) {
-      Serial.printf("Setting input voltage limit: %.1f -> %.1f\n", _mppt.config.data.input_voltage_limit, val.as<float>());
-      _mppt.config.data.input_voltage_limit = val.as<float>();
-    }
-    if (auto val = settings["inputCurrent"]; !val.isNull()) {
-      Serial.printf("Setting input current limit: %.2f -> %.2f\n", _mppt.config.data.input_current_limit, val.as<float>());
-      _mppt.config.data.input_current_limit = val.as<float>();
-    }
-    if (auto val = settings["vacOvp"]; !val.isNull()) {
-      Serial.printf("Setting VAC OVP threshold: %.1f -> %.1f\n", _mppt.config.data.vac_ovp_threshold, val.as<float>());
-      _mppt.config.data.vac_ovp_threshold = val.as<float>();
-    }
-    if (auto val = settings["mpptEnable"]; !val.isNull()) {
-      Serial.printf("Setting MPPT enable: %s -> %s\n", _mppt.config.data.mppt_enable ? "true" : "false", val.as<bool>() ? "true" : "false");
-      _mppt.config.data.mppt_enable = val.as<bool>();
-    }
-    if (auto val = settings["systemVoltage"]; !val.isNull()) {
-      Serial.printf("Setting min system voltage: %.1f -> %.1f\n", _mppt.config.data.min_system_voltage, val.as<float>());
-      _mppt.config.data.min_system_voltage = val.as<float>();
-    }
-    
-    // MPPT timer and advanced settings
-    if (auto val = settings["vocPercent"]; !val.isNull()) {
-      int vocPercentValue = val.as<int>();
-      Serial.printf("Setting VOC percent: %d -> %d\n", _mppt.config.data.mppt_voc_percent, vocPercentValue);
-      _mppt.config.data.mppt_voc_percent = (modbee_voc_percent_t)vocPercentValue;
-    }
-    if (auto val = settings["vocDelay"]; !val.isNull()) {
-      int vocDelayValue = val.as<int>();
-      Serial.printf("Setting VOC delay: %d -> %d\n", _mppt.config.data.mppt_voc_delay, vocDelayValue);
-      _mppt.config.data.mppt_voc_delay = (modbee_voc_delay_t)vocDelayValue;
-    }
-    if (auto val = settings["vocRate"]; !val.isNull()) {
-      int vocRateValue = val.as<int>();
-      Serial.printf("Setting VOC rate: %d -> %d\n", _mppt.config.data.mppt_voc_rate, vocRateValue);
-      _mppt.config.data.mppt_voc_rate = (modbee_voc_rate_t)vocRateValue;
-    }
-    if (auto val = settings["chargeTimer"]; !val.isNull()) {
-      int chargeTimerValue = val.as<int>();
-      Serial.printf("Setting charge timer: %d -> %d\n", _mppt.config.data.fast_charge_timer, chargeTimerValue);
-      _mppt.config.data.fast_charge_timer = (modbee_charge_timer_t)chargeTimerValue;
-    }
-    if (auto val = settings["chargeTimerEnable"]; !val.isNull()) {
-      Serial.printf("Setting charge timer enable: %s -> %s\n", _mppt.config.data.fast_charge_timer_enable ? "true" : "false", val.as<bool>() ? "true" : "false");
-      _mppt.config.data.fast_charge_timer_enable = val.as<bool>();
-    }
-    if (auto val = settings["prechargeTimer"]; !val.isNull()) {
-      int prechargeTimerValue = val.as<int>();
-      Serial.printf("Setting precharge timer: %d -> %d\n", _mppt.config.data.precharge_timer, prechargeTimerValue);
-      _mppt.config.data.precharge_timer = (modbee_precharge_timer_t)prechargeTimerValue;
-    }
-    if (auto val = settings["prechargeTimerEnable"]; !val.isNull()) {
-      Serial.printf("Setting precharge timer enable: %s -> %s\n", _mppt.config.data.precharge_timer_enable ? "true" : "false", val.as<bool>() ? "true" : "false");
-      _mppt.config.data.precharge_timer_enable = val.as<bool>();
-    }
-    if (auto val = settings["topoffTimer"]; !val.isNull()) {
-      int topoffTimerValue = val.as<int>();
-      Serial.printf("Setting topoff timer: %d -> %d\n", _mppt.config.data.topoff_timer, topoffTimerValue);
-      _mppt.config.data.topoff_timer = (modbee_topoff_timer_t)topoffTimerValue;
-    }
-    
-    // Power Management & Noise Control settings
-    if (auto val = settings["pfmForwardEnable"]; !val.isNull()) {
-      Serial.printf("Setting forward PFM enable: %s -> %s\n", _mppt.config.data.pfm_forward_enable ? "true" : "false", val.as<bool>() ? "true" : "false");
-      _mppt.config.data.pfm_forward_enable = val.as<bool>();
-    }
-    if (auto val = settings["ooaForwardEnable"]; !val.isNull()) {
-      Serial.printf("Setting forward OOA enable: %s -> %s\n", _mppt.config.data.ooa_forward_enable ? "true" : "false", val.as<bool>() ? "true" : "false");
-      _mppt.config.data.ooa_forward_enable = val.as<bool>();
-    }
-    
-    // System Intervals
-    if (auto val = settings["batteryCheckInterval"]; !val.isNull()) {
-      unsigned long newInterval = val.as<unsigned long>();
-      Serial.printf("Setting battery check interval: %lu -> %lu\n", _mppt.config.data.battery_check_interval, newInterval);
-      _mppt.config.data.battery_check_interval = newInterval;
-    }
-    if (auto val = settings["socCheckInterval"]; !val.isNull()) {
-      unsigned long newInterval = val.as<unsigned long>();
-      Serial.printf("Setting SOC check interval: %lu -> %lu\n", _mppt.config.data.soc_check_interval, newInterval);
-      _mppt.config.data.soc_check_interval = newInterval;
-    }
-    
-    Serial.println("=== VALIDATING CONFIG ===");
-    if (!_mppt.config.validateConfig()) {
-      Serial.println("ERROR: Config validation failed!");
-      success = false;
+  // Same validation and apply path as PATCH /api/config
+  JsonDocument result;
+  JsonObject errors = result["errors"].to<JsonObject>();
+  JsonArray changed = result["changed"].to<JsonArray>();
+  bool success = _mppt.config.applyPatch(settings, errors, changed);
+  
+  response["success"] = success;
+  if (success) {
+    response["message"] = "Settings saved successfully";
+  } else {
+    // Report the first offending field, the UI shows a single message
+    JsonObject::iterator first = errors.begin();
+    if (first != errors.end()) {
+      response["message"] = String("Failed to save settings: ") + first->key().c_str() + " " + first->value().as<String>();
     } else {
-      Serial.println("Config validation passed");
-    }
-    
-    // Save to file
-    if (success) {
-      Serial.println("=== SAVING CONFIG TO FILE ===");
-      success = _mppt.config.saveConfig();
-      if (success) {
-        Serial.println("Config saved to file successfully");
-      } else {
-        Serial.println("ERROR: Failed to save config to file");
-      }
-    }
-    
-    // Apply to hardware
-    if (success) {
-      Serial.println("=== APPLYING CONFIG TO MPPT ===");
-      bool applySuccess = _mppt.config.applyToMPPT(_mppt.api);
-      if (applySuccess) {
-        Serial.println("Config applied to MPPT successfully");
-      } else {
-        Serial.println("ERROR: Failed to apply config to MPPT");
-        success = false;
-      }
+      response["message"] = "Failed to save settings";
     }
-    
-  } catch (...) {
-    Serial.println("ERROR: Exception caught during settings save");
-    success = false;
   }
   
-  Serial.printf("=== SAVE RESULT: %s ===\n", success ? "SUCCESS" : "FAILED");
+  String responseStr;
+  serializeJson(response, responseStr);
+  client->text(responseStr);
   
+  if (success && changed.size() > 0) {
+    broadcastSettings();
+  }
+}
+
+void ModbeeMpptWebServer::saveOcvCurve(AsyncWebSocketClient *client, const JsonVariant& request) {
+  // {"curve": [17 x mV per cell], "tempcoUv": n}; an empty curve clears it
+  modbee_ocv_curve_t curve;
+  memset(&curve, 0, sizeof(curve));
+  JsonArray points = request["curve"].as<JsonArray>();
+  bool success = points.size() == 0 || points.size() == MODBEE_OCV_POINTS;
+  if (success && points.size() > 0) {
+    for (uint8_t i = 0; i < MODBEE_OCV_POINTS; i++) curve.mv[i] = constrain(points[i] | 0L, 0L, 65535L);
+    curve.tempco_uv = constrain(request["tempcoUv"] | 0L, -5000L, 5000L);
+  }
+  success = success && _mppt.config.setCustomOcvCurve(curve);
+
+  JsonDocument response;
+  response["type"] = "status";
   response["success"] = success;
-  response["message"] = success ? "Settings saved successfully" : "Failed to save settings";
-  
+  response["message"] = success ? "OCV curve saved" :
+    "Invalid OCV curve: 17 increasing values from 500mV to 5000mV";
+
   String responseStr;
   serializeJson(response, responseStr);
   client->text(responseStr);
-  
+
   if (success) {
     broadcastSettings();
   }
 }
 
+void ModbeeMpptWebServer::sendSelfTest(AsyncWebSocketClient *client) {
+  JsonDocument response;
+  response["type"] = "selftest";
+  response["busy"] = _mppt.selfTest.isPending();
+  
+  // Last finished run; the page polls until busy clears
+  modbee_selftest_result_t result = _mppt.selfTest.getResult();
+  if (result.sequence > 0) {
+    response["sequence"] = result.sequence;
+    response["uptime"] = result.uptime;
+    response["cpuMhz"] = result.cpuMhz;
+    response["durationMs"] = result.durationUs / 1000.0f;
+    JsonObject heap = response["heap"].to<JsonObject>();
+    heap["freeBefore"] = result.freeHeapBefore;
+    heap["maxBlockBefore"] = result.maxBlockBefore;
+    heap["freeAfter"] = result.freeHeapAfter;
+    heap["maxBlockAfter"] = result.maxBlockAfter;
+    JsonObject ops = response["ops"].to<JsonObject>();
+    for (uint8_t op = 0; op < MODBEE_SELFTEST_OP_COUNT; op++) {
+      const modbee_selftest_timing_t& t = result.ops[op];
+      JsonObject obj = ops[ModbeeMpptSelfTest::opName((modbee_selftest_op_t)op)].to<JsonObject>();
+      obj["count"] = t.count;
+      obj["failures"] = t.failures;
+      obj["minUs"] = t.minUs;
+      obj["meanUs"] = t.meanUs;
+      obj["p99Us"] = t.p99Us;
+      obj["maxUs"] = t.maxUs;
+    }
+  }
+  
+  String responseStr;
+  serializeJson(response, responseStr);
+  client->text(responseStr);
+}
+
 void ModbeeMpptWebServer::resetDefaults(AsyncWebSocketClient *client) {
   bool success = _mppt.resetConfig();
   
@@ -473,8 +575,78 @@ void ModbeeMpptWebServer::resetDefaults(AsyncWebSocketClient *client) {
 void ModbeeMpptWebServer::broadcastData() {
   if (_webSocket.count() > 0) {
     String data = getSystemData();
-    Serial.printf("Broadcasting data to %d clients: %s\n", _webSocket.count(), data.c_str());
-    _webSocket.textAll(data);
+    MODBEE_LOGD("Broadcasting %u bytes to %u clients", data.length(), (unsigned)_webSocket.count());
+    const uint8_t *bytes = (const uint8_t*)data.c_str();
+    _latestTelemetry = std::make_shared<std::vector<uint8_t>>(bytes, bytes + data.length());
+    sendTelemetry(true);
+  }
+}
+
+// ========================================================================
+// TELEMETRY BACKPRESSURE
+// ========================================================================
+
+void ModbeeMpptWebServer::trackClient(uint32_t id) {
+  portENTER_CRITICAL(&_wsMux);
+  bool tracked = false;
+  for (uint8_t i = 0; i < MODBEE_WS_MAX_CLIENTS && !tracked; i++) {
+    if (_wsClients[i].id == 0) {
+      _wsClients[i].id = id;
+      _wsClients[i].pending = false;
+      _wsClients[i].sent = 0;
+      _wsClients[i].dropped = 0;
+      tracked = true;
+    }
+  }
+  portEXIT_CRITICAL(&_wsMux);
+  if (!tracked) {
+    MODBEE_LOGW("WebSocket client #%u not tracked, no telemetry will be sent", id);
+  }
+}
+
+void ModbeeMpptWebServer::untrackClient(uint32_t id) {
+  portENTER_CRITICAL(&_wsMux);
+  for (uint8_t i = 0; i < MODBEE_WS_MAX_CLIENTS; i++) {
+    if (_wsClients[i].id == id) {
+      _wsClients[i].id = 0;
+      _wsClients[i].pending = false;
+    }
+  }
+  portEXIT_CRITICAL(&_wsMux);
+}
+
+void ModbeeMpptWebServer::sendTelemetry(bool newFrame) {
+  if (!_latestTelemetry) return;
+  
+  for (uint8_t i = 0; i < MODBEE_WS_MAX_CLIENTS; i++) {
+    portENTER_CRITICAL(&_wsMux);
+    uint32_t id = _wsClients[i].id;
+    bool pending = _wsClients[i].pending;
+    portEXIT_CRITICAL(&_wsMux);
+    if (id == 0 || (!newFrame && !pending)) continue;
+    
+    AsyncWebSocketClient *client = _webSocket.client(id);
+    if (!client || client->status() != WS_CONNECTED) continue;
+    
+    // Only queue telemetry behind an empty queue; otherwise keep the newest
+    // frame aside so a slow client never holds more than one telemetry frame.
+    // Control and status replies go straight to the queue and keep their order.
+    bool idle = client->queueLen() == 0;
+    if (idle) {
+      client->text(_latestTelemetry);
+    }
+    
+    portENTER_CRITICAL(&_wsMux);
+    if (_wsClients[i].id == id) {
+      if (idle) {
+        _wsClients[i].sent++;
+        _wsClients[i].pending = false;
+      } else {
+        if (newFrame && _wsClients[i].pending) _wsClients[i].dropped++;
+        _wsClients[i].pending = true;
+      }
+    }
+    portEXIT_CRITICAL(&_wsMux);
   }
 }
 
@@ -552,6 +724,11 @@ String ModbeeMpptWebServer::getSystemData() {
   doc["actualSOC"] = _mppt.api.getActualBatterySOC();
   doc["usableSOC"] = _mppt.api.getUsableBatterySOC();
   doc["chargePercent"] = _mppt.api.getBatteryChargePercent();
+  modbee_soc_status_t soc = _mppt.socEstimator.getStatus();
+  if (soc.valid) {
+    doc["estimatedSOC"] = soc.soc;
+    doc["socConfidence"] = soc.confidence;
+  }
 
   // System status
   doc["isCharging"] = _mppt.api.isCharging();
@@ -575,32 +752,15 @@ String ModbeeMpptWebServer::getSettingsData() {
   
   JsonObject settings = doc["settings"].to<JsonObject>();
   
-  // Get actual settings from config data - direct access!
-  settings["batteryType"] = (int)_mppt.config.data.battery_type;
-  settings["cellCount"] = _mppt.config.data.battery_cell_count;
-  settings["chargeVoltage"] = _mppt.config.data.charge_voltage;
-  settings["chargeCurrent"] = _mppt.config.data.charge_current;
-  settings["termCurrent"] = _mppt.config.data.termination_current;
-  settings["prechargeCurrent"] = _mppt.config.data.precharge_current;
-  settings["prechargeVoltageThreshold"] = (int)_mppt.config.data.precharge_voltage_threshold;
-  settings["rechargeThreshold"] = _mppt.config.data.recharge_threshold;
-  settings["inputVoltage"] = _mppt.config.data.input_voltage_limit;
-  settings["inputCurrent"] = _mppt.config.data.input_current_limit;
-  settings["vacOvp"] = _mppt.config.data.vac_ovp_threshold;
-  settings["mpptEnable"] = _mppt.config.data.mppt_enable;
-  settings["vocPercent"] = (int)_mppt.config.data.mppt_voc_percent;
-  settings["vocDelay"] = (int)_mppt.config.data.mppt_voc_delay;
-  settings["vocRate"] = (int)_mppt.config.data.mppt_voc_rate;
-  settings["chargeTimer"] = (int)_mppt.config.data.fast_charge_timer;
-  settings["chargeTimerEnable"] = _mppt.config.data.fast_charge_timer_enable;
-  settings["prechargeTimer"] = (int)_mppt.config.data.precharge_timer;
-  settings["prechargeTimerEnable"] = _mppt.config.data.precharge_timer_enable;
-  settings["topoffTimer"] = (int)_mppt.config.data.topoff_timer;
-  settings["systemVoltage"] = _mppt.config.data.min_system_voltage;
-  settings["pfmForwardEnable"] = _mppt.config.data.pfm_forward_enable;
-  settings["ooaForwardEnable"] = _mppt.config.data.ooa_forward_enable;
-  settings["batteryCheckInterval"] = _mppt.config.data.battery_check_interval;
-  settings["socCheckInterval"] = _mppt.config.data.soc_check_interval;
+  _mppt.config.toSettingsJson(settings);
+  
+  // Custom OCV curve is an array, outside the scalar field table
+  const modbee_ocv_curve_t& curve = _mppt.config.data.ocv_custom;
+  if (ModbeeMpptOcv::isValid(curve)) {
+    JsonArray points = settings["ocvCurve"].to<JsonArray>();
+    for (uint8_t i = 0; i < MODBEE_OCV_POINTS; i++) points.add(curve.mv[i]);
+    settings["ocvTempcoUv"] = curve.tempco_uv;
+  }
   
   String result;
   serializeJson(doc, result);
@@ -659,6 +819,187 @@ String ModbeeMpptWebServer::getDebugData() {
   statusRegs["status3"] = _mppt.api.getStatus3String();
   statusRegs["status4"] = _mppt.api.getStatus4String();
   
+  // Firmware MPPT tracker
+  static const char* const trackerStates[] = {"off", "no input", "limited", "tracking", "sweeping"};
+  modbee_tracker_status_t tracker = _mppt.tracker.getStatus();
+  JsonObject trackerObj = doc["tracker"].to<JsonObject>();
+  trackerObj["state"] = trackerStates[tracker.state];
+  trackerObj["vref"] = String(tracker.vref, 1);
+  trackerObj["step"] = String(tracker.step, 1);
+  trackerObj["power"] = String(tracker.power, 3);
+  trackerObj["iterations"] = tracker.iterations;
+  trackerObj["sweeps"] = tracker.sweeps;
+  trackerObj["sweepPeriod"] = tracker.sweepPeriodMs / 1000;
+  
+  // Adaptive VOC rate: current level and what each level has cost
+  modbee_voc_tuner_status_t tuner = _mppt.vocTuner.getStatus();
+  JsonObject tunerObj = doc["vocTuner"].to<JsonObject>();
+  tunerObj["active"] = tuner.active;
+  tunerObj["level"] = ModbeeMpptVocTuner::levelName(tuner.level);
+  tunerObj["variability"] = String(tuner.variability * 100.0f, 2);
+  tunerObj["changes"] = tuner.changes;
+  JsonArray tunerLevels = tunerObj["levels"].to<JsonArray>();
+  for (uint8_t i = 0; i < MODBEE_VOC_LEVEL_COUNT; i++) {
+    JsonObject levelObj = tunerLevels.add<JsonObject>();
+    levelObj["name"] = ModbeeMpptVocTuner::levelName((modbee_voc_level_t)i);
+    levelObj["seconds"] = tuner.levels[i].seconds;
+    levelObj["lostSeconds"] = String(tuner.levels[i].lostSeconds, 1);
+    levelObj["lostWh"] = String(tuner.levels[i].lostWh, 3);
+  }
+  
+  // Coulomb-counting SOC estimator
+  modbee_soc_status_t soc = _mppt.socEstimator.getStatus();
+  JsonObject socObj = doc["socEstimator"].to<JsonObject>();
+  socObj["valid"] = soc.valid;
+  socObj["soc"] = String(soc.soc, 1);
+  socObj["sigma"] = String(soc.sigma, 1);
+  socObj["confidence"] = String(soc.confidence, 0);
+  socObj["capacityAh"] = String(soc.capacityAh, 2);
+  socObj["nominalAh"] = String(soc.nominalAh, 2);
+  socObj["ahSinceAnchor"] = String(soc.ahSinceAnchor, 3);
+  socObj["lastAnchor"] = ModbeeMpptSocEstimator::anchorName(soc.lastAnchor);
+  socObj["anchors"] = soc.anchors;
+  socObj["capacityUpdates"] = soc.capacityUpdates;
+  socObj["restSeconds"] = soc.restSeconds;
+  socObj["mode"] = soc.ekf ? "ekf" : "coulomb";
+  socObj["resistance"] = String(soc.resistance, 1);
+  
+  // Last true battery voltage burst
+  modbee_tbv_status_t tbv = _mppt.api.getTrueBatteryVoltageStatus();
+  JsonObject tbvObj = doc["trueVbat"].to<JsonObject>();
+  tbvObj["voltage"] = String(tbv.voltage, 3);
+  tbvObj["measured"] = String(tbv.measured, 3);
+  tbvObj["durationMs"] = tbv.duration_ms;
+  tbvObj["samples"] = tbv.samples;
+  tbvObj["stable"] = tbv.stable;
+  tbvObj["count"] = tbv.count;
+  
+  // Charge profile stage and the registers it has written
+  modbee_charge_profile_status_t profile = _mppt.chargeProfile.getStatus();
+  JsonObject profileObj = doc["chargeProfile"].to<JsonObject>();
+  profileObj["stage"] = ModbeeMpptChargeProfile::stageName(profile.stage);
+  profileObj["voltage"] = String(profile.voltage, 2);
+  profileObj["current"] = String(profile.current, 2);
+  profileObj["compensation"] = String(profile.compensation, 3);
+  profileObj["cells"] = profile.cells;
+  profileObj["stageSeconds"] = profile.stageSeconds;
+  profileObj["equalizeDue"] = profile.equalizeDueSeconds;
+
+  // Input source arbitration: per-input readings, last switch and its latency
+  modbee_source_status_t source = _mppt.sourceArbiter.getStatus();
+  JsonObject sourceObj = doc["sourceArbiter"].to<JsonObject>();
+  sourceObj["policy"] = ModbeeMpptSourceArbiter::policyName(source.policy);
+  sourceObj["hardware"] = source.hardware;
+  sourceObj["active"] = source.active;
+  sourceObj["probing"] = source.probing;
+  sourceObj["voltageLimit"] = String(source.voltageLimit, 2);
+  sourceObj["currentLimit"] = String(source.currentLimit, 2);
+  sourceObj["switches"] = source.switches;
+  sourceObj["reason"] = source.reason ? source.reason : "";
+  sourceObj["decisionUs"] = source.lastDecisionUs;
+  sourceObj["maxDecisionUs"] = source.maxDecisionUs;
+  sourceObj["switchUs"] = source.lastSwitchUs;
+  sourceObj["latencyMs"] = source.lastLatencyMs;
+  sourceObj["maxLossLatencyMs"] = source.maxLossLatencyMs;
+  JsonArray sourceInputs = sourceObj["inputs"].to<JsonArray>();
+  for (uint8_t i = 0; i < MODBEE_SOURCE_COUNT; i++) {
+    JsonObject inputObj = sourceInputs.add<JsonObject>();
+    inputObj["voltage"] = String(source.sources[i].voltage, 2);
+    inputObj["present"] = source.sources[i].present;
+    inputObj["power"] = String(source.sources[i].power, 2);
+    inputObj["measured"] = source.sources[i].measured;
+    inputObj["age"] = source.sources[i].ageSeconds;
+  }
+
+  // Modbus RTU link counters (slave side; the master's are on /api/fleet)
+  modbee_modbus_status_t modbus = _mppt.modbus.getStatus();
+  JsonObject modbusObj = doc["modbus"].to<JsonObject>();
+  modbusObj["running"] = modbus.running;
+  modbusObj["master"] = modbus.master;
+  modbusObj["address"] = modbus.address;
+  modbusObj["baud"] = modbus.baud;
+  modbusObj["requests"] = modbus.requests;
+  modbusObj["exceptions"] = modbus.exceptions;
+  modbusObj["crcErrors"] = modbus.crcErrors;
+  modbusObj["otherSlaves"] = modbus.otherSlaves;
+  modbusObj["requestUs"] = modbus.lastRequestUs;
+  modbusObj["maxRequestUs"] = modbus.maxRequestUs;
+  modbusObj["lastRequestAge"] = modbus.lastRequestMs ? (millis() - modbus.lastRequestMs) / 1000 : -1;
+
+  // WiFi station: users, joins and how fast the last one was
+  modbee_station_status_t station = _mppt.station.getStatus();
+  JsonObject stationObj = doc["station"].to<JsonObject>();
+  stationObj["mode"] = _mppt.config.data.wifi_mode;
+  stationObj["active"] = station.active;
+  stationObj["connected"] = station.connected;
+  stationObj["holders"] = station.holders;
+  stationObj["joins"] = station.joins;
+  stationObj["fastJoins"] = station.fastJoins;
+  stationObj["fastFallbacks"] = station.fastFallbacks;
+  stationObj["timeouts"] = station.timeouts;
+  stationObj["lastJoinMs"] = station.lastJoinMs;
+  stationObj["lastJoinFast"] = station.lastJoinFast;
+  stationObj["radioOnMs"] = station.radioOnMs;
+  stationObj["rssi"] = station.rssi;
+  stationObj["channel"] = station.channel;
+
+  // MQTT publisher: session state, queue and radio time
+  modbee_mqtt_status_t mqtt = _mppt.mqtt.getStatus();
+  JsonObject mqttObj = doc["mqtt"].to<JsonObject>();
+  mqttObj["enabled"] = mqtt.enabled;
+  mqttObj["state"] = (int)mqtt.state;
+  mqttObj["samples"] = mqtt.samples;
+  mqttObj["batches"] = mqtt.batches;
+  mqttObj["published"] = mqtt.published;
+  mqttObj["replayed"] = mqtt.replayed;
+  mqttObj["sessions"] = mqtt.sessions;
+  mqttObj["failures"] = mqtt.failures;
+  mqttObj["spooled"] = mqtt.spooled;
+  mqttObj["spoolBytes"] = mqtt.spoolBytes;
+  mqttObj["spoolDropped"] = mqtt.spoolDropped;
+  mqttObj["radioOnMs"] = mqtt.radioOnMs;
+  mqttObj["lastSessionMs"] = mqtt.lastSessionMs;
+  mqttObj["lastPublishAge"] = mqtt.lastPublishMs ? (millis() - mqtt.lastPublishMs) / 1000 : -1;
+  mqttObj["lastError"] = mqtt.lastError ? mqtt.lastError : "";
+
+  // BLE GATT service: link and request counters; beacon duty and current estimate
+  modbee_ble_status_t ble = _mppt.ble.getStatus();
+  JsonObject bleObj = doc["ble"].to<JsonObject>();
+  bleObj["mode"] = _mppt.config.data.ble_mode;
+  bleObj["running"] = ble.running;
+  bleObj["connected"] = ble.connected;
+  bleObj["mtu"] = ble.mtu;
+  bleObj["connections"] = ble.connections;
+  bleObj["notifications"] = ble.notifications;
+  bleObj["configRequests"] = ble.configRequests;
+  bleObj["configErrors"] = ble.configErrors;
+  bleObj["downloads"] = ble.downloads;
+  bleObj["downloadsFailed"] = ble.downloadsFailed;
+  bleObj["chunks"] = ble.chunks;
+  bleObj["downloadRemaining"] = ble.downloadRemaining;
+  bleObj["beacon"] = ble.beacon;
+  bleObj["beaconBursts"] = ble.beaconBursts;
+  bleObj["beaconAwakeMs"] = ble.beaconAwakeMs;
+  bleObj["beaconSleepMs"] = ble.beaconSleepMs;
+  bleObj["beaconCurrentMa"] = ble.beaconCurrentMa;
+
+  // Per-client WebSocket telemetry delivery
+  modbee_ws_client_state_t wsClients[MODBEE_WS_MAX_CLIENTS];
+  portENTER_CRITICAL(&_wsMux);
+  memcpy(wsClients, _wsClients, sizeof(wsClients));
+  portEXIT_CRITICAL(&_wsMux);
+  JsonArray clients = doc["wsClients"].to<JsonArray>();
+  for (uint8_t i = 0; i < MODBEE_WS_MAX_CLIENTS; i++) {
+    if (wsClients[i].id == 0) continue;
+    AsyncWebSocketClient *client = _webSocket.client(wsClients[i].id);
+    JsonObject entry = clients.add<JsonObject>();
+    entry["id"] = wsClients[i].id;
+    entry["ip"] = client ? client->remoteIP().toString() : String("-");
+    entry["queued"] = client ? client->queueLen() : 0;
+    entry["sent"] = wsClients[i].sent;
+    entry["dropped"] = wsClients[i].dropped;
+  }
+  
   // Configuration values - ALL settings from API
   JsonObject config = doc["configuration"].to<JsonObject>();
   
@@ -705,16 +1046,249 @@ String ModbeeMpptWebServer::getDebugData() {
   return result;
 }
 
+String ModbeeMpptWebServer::getFleetData() {
+  JsonDocument doc;
+  modbee_fleet_summary_t summary = _mppt.modbus.master.getSummary();
+  doc["running"] = summary.running;
+  doc["peers"] = summary.peers;
+  doc["online"] = summary.online;
+  doc["faulted"] = summary.faulted;
+  doc["inputPower"] = String(summary.inputPower, 2);
+  doc["batteryPower"] = String(summary.batteryPower, 2);
+  doc["energyWh"] = String(summary.energyWh, 3);
+  doc["cycles"] = summary.cycles;
+  doc["cycleMs"] = String(summary.cycleUs / 1000.0f, 1);
+
+  // This unit, from its own telemetry frame
+  modbee_telemetry_t t = _mppt.api.getTelemetry();
+  JsonObject local = doc["local"].to<JsonObject>();
+  local["address"] = _mppt.config.data.modbus_address;
+  local["vbusVoltage"] = String(t.vbus.voltage, 3);
+  local["inputPower"] = String(t.vbus.power, 2);
+  local["batteryVoltage"] = String(t.battery.voltage, 3);
+  local["batteryCurrent"] = String(t.battery.current, 3);
+  local["batteryPower"] = String(t.battery.power, 2);
+  local["soc"] = String(_mppt._cachedSOC, 1);
+  local["chargeState"] = t.charge_state;
+  local["faults"] = (t.fault_status0 << 8) | t.fault_status1;
+
+  modbee_fleet_unit_t units[MODBEE_MODBUS_MAX_PEERS];
+  size_t count = _mppt.modbus.master.getUnits(units);
+  unsigned long now = millis();
+  JsonArray unitArray = doc["units"].to<JsonArray>();
+  for (size_t i = 0; i < count; i++) {
+    const modbee_fleet_unit_t& unit = units[i];
+    JsonObject unitObj = unitArray.add<JsonObject>();
+    unitObj["address"] = unit.address;
+    unitObj["online"] = unit.online;
+    unitObj["valid"] = unit.valid;
+    unitObj["vbusVoltage"] = String(unit.vbusVoltage, 3);
+    unitObj["inputPower"] = String(unit.inputPower, 2);
+    unitObj["batteryVoltage"] = String(unit.batteryVoltage, 3);
+    unitObj["batteryCurrent"] = String(unit.batteryCurrent, 3);
+    unitObj["batteryPower"] = String(unit.batteryPower, 2);
+    unitObj["soc"] = String(unit.soc, 1);
+    unitObj["dieTemperature"] = String(unit.dieTemperature, 1);
+    unitObj["batteryTemperature"] = String(unit.batteryTemperature, 1);
+    unitObj["chargeState"] = unit.chargeState;
+    unitObj["faults"] = unit.faults;
+    unitObj["energyWh"] = String(unit.energyWh, 3);
+    unitObj["age"] = unit.lastSeenMs ? (long)((now - unit.lastSeenMs) / 1000) : -1;
+    unitObj["polls"] = unit.polls;
+    unitObj["timeouts"] = unit.timeouts;
+    unitObj["errors"] = unit.errors;
+    unitObj["rttMs"] = String(unit.srttUs / 1000.0f, 1);
+    unitObj["timeoutMs"] = String(unit.timeoutUs / 1000.0f, 1);
+  }
+
+  String result;
+  serializeJson(doc, result);
+  return result;
+}
+
 void ModbeeMpptWebServer::handleRoot(AsyncWebServerRequest *request) {
-  request->send(LittleFS, "/index.html", "text/html");
+  request->send(LittleFS, MODBEE_WEB_ROOT "index.html", "text/html");
 }
 
 void ModbeeMpptWebServer::handleSettings(AsyncWebServerRequest *request) {
-  request->send(LittleFS, "/settings.html", "text/html");
+  request->send(LittleFS, MODBEE_WEB_ROOT "settings.html", "text/html");
 }
 
 void ModbeeMpptWebServer::handleDebug(AsyncWebServerRequest *request) {
-  request->send(LittleFS, "/debug.html", "text/html");
+  request->send(LittleFS, MODBEE_WEB_ROOT "debug.html", "text/html");
+}
+
+void ModbeeMpptWebServer::handleFleetPage(AsyncWebServerRequest *request) {
+  request->send(LittleFS, MODBEE_WEB_ROOT "fleet.html", "text/html");
+}
+
+void ModbeeMpptWebServer::handleFleet(AsyncWebServerRequest *request) {
+  // GET /api/fleet: the Modbus master's fleet table, read from RAM only
+  request->send(200, "application/json", getFleetData());
+}
+
+void ModbeeMpptWebServer::handleHistory(AsyncWebServerRequest *request) {
+  // GET /api/history?tier=1m|1h&from=<s>&to=<s>&format=csv|msgpack|bin
+  // Timestamps are seconds on the tier's timeline (since boot for 1m, logged
+  // time for 1h); X-Modbee-Uptime is now on it, so clients can map them to wall time
+  const ModbeeMpptHistorySource* tier = &_mppt.history;
+  uint32_t clock = (uint32_t)(esp_timer_get_time() / 1000000LL);
+  if (request->hasParam("tier")) {
+    String value = request->getParam("tier")->value();
+    if (value == "1h") {
+      tier = &_mppt.history.rollup;
+      clock = _mppt.history.rollup.clock();
+    } else if (value != "1m") {
+      request->send(400, "text/plain", "Unsupported tier (1m or 1h)");
+      return;
+    }
+  }
+
+  modbee_history_format_t format = MODBEE_HISTORY_CSV;
+  const char* contentType = "text/csv";
+  if (request->hasParam("format")) {
+    String value = request->getParam("format")->value();
+    if (value == "msgpack") {
+      format = MODBEE_HISTORY_MSGPACK;
+      contentType = "application/msgpack";
+    } else if (value == "bin") {
+      format = MODBEE_HISTORY_BIN;
+      contentType = "application/octet-stream";
+    } else if (value != "csv") {
+      request->send(400, "text/plain", "Unsupported format (csv, msgpack or bin)");
+      return;
+    }
+  }
+
+  uint32_t from = 0;
+  uint32_t to = UINT32_MAX;
+  if (request->hasParam("from")) from = strtoul(request->getParam("from")->value().c_str(), nullptr, 10);
+  if (request->hasParam("to")) to = strtoul(request->getParam("to")->value().c_str(), nullptr, 10);
+
+  // The stream holds only a cursor and a small staging buffer, so memory use
+  // is constant regardless of the range requested
+  auto stream = std::make_shared<ModbeeMpptHistoryStream>(*tier, format, from, to);
+  String uptime = String(clock);
+
+  AsyncWebServerResponse *response;
+  if (format == MODBEE_HISTORY_BIN) {
+    // Binary records are fixed size, so the length is known and Range can resume a download
+    size_t total = stream->binaryLength();
+    size_t first = 0;
+    size_t last = total ? total - 1 : 0;
+    bool partial = false;
+
+    if (request->hasHeader("Range")) {
+      String range = request->getHeader("Range")->value();
+      if (!range.startsWith("bytes=")) {
+        request->send(416, "text/plain", "Only byte ranges are supported");
+        return;
+      }
+      int dash = range.indexOf('-');
+      String startStr = range.substring(6, dash);
+      String endStr = dash >= 0 ? range.substring(dash + 1) : String();
+      if (startStr.length() == 0 || dash < 0) {
+        request->send(416, "text/plain", "Suffix ranges are not supported");
+        return;
+      }
+      first = strtoul(startStr.c_str(), nullptr, 10);
+      if (endStr.length() > 0) last = min((size_t)strtoul(endStr.c_str(), nullptr, 10), last);
+      if (first >= total || first > last) {
+        AsyncWebServerResponse *invalid = request->beginResponse(416, "text/plain", "Range not satisfiable");
+        invalid->addHeader("Content-Range", ("bytes */" + String(total)).c_str());
+        request->send(invalid);
+        return;
+      }
+      partial = true;
+      stream->seekBinary(first);
+    }
+
+    size_t length = total ? last - first + 1 : 0;
+    response = request->beginResponse(contentType, length,
+      [stream](uint8_t *buffer, size_t maxLen, size_t /*index*/) -> size_t {
+        return stream->fill(buffer, maxLen);
+      });
+    response->addHeader("Accept-Ranges", "bytes");
+    if (partial) {
+      response->setCode(206);
+      String contentRange = "bytes " + String(first) + "-" + String(last) + "/" + String(total);
+      response->addHeader("Content-Range", contentRange.c_str());
+    }
+  } else {
+    response = request->beginChunkedResponse(contentType,
+      [stream](uint8_t *buffer, size_t maxLen, size_t /*index*/) -> size_t {
+        return stream->fill(buffer, maxLen);
+      });
+  }
+
+  response->addHeader("X-Modbee-Uptime", uptime.c_str());
+  response->addHeader("X-Modbee-Records", String(stream->recordCount()).c_str());
+  request->send(response);
+}
+
+void ModbeeMpptWebServer::handleMetrics(AsyncWebServerRequest *request) {
+  // Rendered from cached values only, so scraping never touches the I2C bus
+  auto stream = std::make_shared<ModbeeMpptMetricsStream>(_mppt);
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+    "application/openmetrics-text; version=1.0.0; charset=utf-8",
+    [stream](uint8_t *buffer, size_t maxLen, size_t /*index*/) -> size_t {
+      return stream->fill(buffer, maxLen);
+    });
+  request->send(response);
+}
+
+void ModbeeMpptWebServer::handlePVCurve(AsyncWebServerRequest *request) {
+  // GET /api/pvcurve: points of the last global sweep, from Voc downwards
+  modbee_pv_curve_t curve;
+  if (!_mppt.tracker.getLastCurve(curve)) {
+    request->send(404, "text/plain", "No sweep recorded yet");
+    return;
+  }
+
+  // At most 32 short lines, so the CSV is built in one piece
+  String csv;
+  csv.reserve(32 + curve.count * 24);
+  csv += "voltage,current,power\n";
+  char line[48];
+  for (uint8_t i = 0; i < curve.count; i++) {
+    const modbee_pv_point_t& point = curve.points[i];
+    snprintf(line, sizeof(line), "%.3f,%.3f,%.3f\n", point.voltage, point.current, point.voltage * point.current);
+    csv += line;
+  }
+
+  AsyncWebServerResponse *response = request->beginResponse(200, "text/csv", csv);
+  response->addHeader("Content-Disposition", "attachment; filename=\"pvcurve.csv\"");
+  response->addHeader("X-Modbee-Voc", String(curve.voc, 2).c_str());
+  response->addHeader("X-Modbee-Vmp", String(curve.vmp, 1).c_str());
+  response->addHeader("X-Modbee-Pmax", String(curve.pmax, 3).c_str());
+  response->addHeader("X-Modbee-Age", String((millis() - curve.timestamp_ms) / 1000).c_str());
+  request->send(response);
+}
+
+void ModbeeMpptWebServer::handleConfig(AsyncWebServerRequest *request, JsonVariant &json) {
+  JsonDocument doc;
+  int code = 200;
+  
+  if (request->method() == HTTP_PATCH) {
+    // Validated as a whole: either every field applies or none does
+    JsonObject errors = doc["errors"].to<JsonObject>();
+    JsonArray changed = doc["changed"].to<JsonArray>();
+    bool success = _mppt.config.applyPatch(json, errors, changed);
+    doc["success"] = success;
+    if (success) {
+      doc.remove("errors");
+      if (changed.size() > 0) broadcastSettings();
+    } else {
+      doc.remove("changed");
+      code = 400;
+    }
+  } else {
+    _mppt.config.toSettingsJson(doc.to<JsonObject>());
+  }
+  
+  String body;
+  serializeJson(doc, body);
+  request->send(code, "application/json", body);
 }
 
 void ModbeeMpptWebServer::handleNotFound(AsyncWebServerRequest *request) {
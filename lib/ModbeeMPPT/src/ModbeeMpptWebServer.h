@@ -5,6 +5,10 @@
  * 
  * This file handles WiFi AP mode, web server, WebSocket communication,
  * and power management for the ModbeeMPPT web interface.
+ *
+ * With wifiMode station the UI is served on the configured network
+ * instead, over the shared station (ModbeeMpptStation); if it is not
+ * joined within MODBEE_STATION_JOIN_TIMEOUT_MS the AP starts as usual.
  */
 
 #ifndef MODBEE_MPPT_WEBSERVER_H
@@ -26,6 +30,23 @@
 // DNS Configuration
 #define DNS_PORT 53
 
+// Web pages (data/www/): only this LittleFS directory is served, never the
+// config and data files beside it; the config holds the WiFi and MQTT passwords
+#define MODBEE_WEB_ROOT "/www/"
+
+// WebSocket clients tracked for telemetry backpressure
+#ifndef MODBEE_WS_MAX_CLIENTS
+#define MODBEE_WS_MAX_CLIENTS 8
+#endif
+
+// Per-client telemetry delivery state (id 0 = free slot)
+typedef struct {
+  uint32_t id;
+  bool pending;       // A newer frame is waiting for the client's queue to drain
+  uint32_t sent;      // Telemetry frames queued to the client
+  uint32_t dropped;   // Frames superseded before they could be queued
+} modbee_ws_client_state_t;
+
 class ModbeeMpptWebServer {
 public:
   ModbeeMpptWebServer(class ModbeeMPPT& mppt);
@@ -38,6 +59,7 @@ public:
   // WiFi management
    bool startWiFi(); // Keep WiFi management functions
    void stopWiFi();
+   bool startAccessPoint();
    bool isClientConnected() const { return _clientConnected; }
 
    bool _wifiActive; // Track if WiFi is active
@@ -59,9 +81,17 @@ private:
   AsyncWebSocket _webSocket;
   DNSServer _dnsServer;
   
+  // Telemetry backpressure ("latest wins" per client)
+  modbee_ws_client_state_t _wsClients[MODBEE_WS_MAX_CLIENTS];
+  AsyncWebSocketSharedBuffer _latestTelemetry;  // Serialized once, shared by all clients
+  portMUX_TYPE _wsMux;
+  
   // State management
    bool _clientConnected; // Keep only necessary state variables
    unsigned long _lastActivity;
+   bool _usingStation;    // Serving on the station rather than the AP
+   bool _stationJoining;  // Station not joined yet, the AP follows if it times out
+   unsigned long _stationStart;
   
   // Button handling
    // Removed button handling variables
@@ -74,6 +104,12 @@ private:
   void handleRoot(AsyncWebServerRequest *request);
   void handleSettings(AsyncWebServerRequest *request);
   void handleDebug(AsyncWebServerRequest *request);
+  void handleHistory(AsyncWebServerRequest *request);
+  void handleMetrics(AsyncWebServerRequest *request);
+  void handlePVCurve(AsyncWebServerRequest *request);
+  void handleFleetPage(AsyncWebServerRequest *request);
+  void handleFleet(AsyncWebServerRequest *request);
+  void handleConfig(AsyncWebServerRequest *request, JsonVariant &json);
   void handleNotFound(AsyncWebServerRequest *request);
   
   // WebSocket command handlers
@@ -82,18 +118,32 @@ private:
   void sendSystemData(AsyncWebSocketClient *client);
   void sendDebugData(AsyncWebSocketClient *client);
   void saveSettings(AsyncWebSocketClient *client, const JsonVariant& settings);
+  void saveOcvCurve(AsyncWebSocketClient *client, const JsonVariant& request);
+  void sendLog(AsyncWebSocketClient *client, uint32_t since);
+  void sendCurves(AsyncWebSocketClient *client);
+  void sendCurve(AsyncWebSocketClient *client, uint32_t sequence);
+  void sendSelfTest(AsyncWebSocketClient *client);
   void resetDefaults(AsyncWebSocketClient *client);
   
   // Utility functions
   String getSystemData();
   String getSettingsData();
   String getDebugData();
+  String getFleetData();
   String getRegisterData();
   String getFaultData();
   
   // Power management helpers
    // Removed power management helper functions
   void updateClientStatus();
+  
+  // Host microbenchmarks (tools/bench) time the builders and handlers above
+  friend class ModbeeMpptBench;
+  
+  // Telemetry backpressure helpers
+  void trackClient(uint32_t id);
+  void untrackClient(uint32_t id);
+  void sendTelemetry(bool newFrame);
 };
 
 #endif // MODBEE_MPPT_WEBSERVER_H
@@ -0,0 +1,435 @@
+#include "Arduino.h"
+#include "ModbeeNative.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+
+HWCDC Serial;
+EspClass ESP;
+
+// ==================== Time ====================
+
+unsigned long millis() {
+  return (unsigned long)(ModbeeNative::now() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)ModbeeNative::now();
+}
+
+void delay(unsigned long ms) {
+  ModbeeNative::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  ModbeeNative::advance(us);
+}
+
+void yield() {
+}
+
+int64_t esp_timer_get_time() {
+  return (int64_t)ModbeeNative::now();
+}
+
+uint32_t esp_random() {
+  // Fixed sequence, so runs repeat exactly
+  static uint32_t state = 0x6d6f6462;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// ==================== GPIO ====================
+
+// No buttons are pressed on the host; outputs read back what was written
+static uint8_t pinLevels[32];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < 32 ? pinLevels[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < 32) pinLevels[pin] = value ? HIGH : LOW;
+}
+
+// ==================== String ====================
+
+static std::string formatInteger(unsigned long value, unsigned char base, bool negative) {
+  if (base < 2 || base > 36) base = 10;
+  char buffer[72];
+  char* p = buffer + sizeof(buffer) - 1;
+  *p = '\0';
+  do {
+    unsigned digit = value % base;
+    *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+    value /= base;
+  } while (value);
+  if (negative) *--p = '-';
+  return p;
+}
+
+String::String(int value, unsigned char base)
+  : _s(base == 10 ? formatInteger(value < 0 ? -(unsigned long)(long)value : value, 10, value < 0)
+                  : formatInteger((unsigned int)value, base, false)) {}
+
+String::String(unsigned int value, unsigned char base) : _s(formatInteger(value, base, false)) {}
+
+String::String(long value, unsigned char base)
+  : _s(base == 10 ? formatInteger(value < 0 ? -(unsigned long)value : value, 10, value < 0)
+                  : formatInteger((unsigned long)value, base, false)) {}
+
+String::String(unsigned long value, unsigned char base) : _s(formatInteger(value, base, false)) {}
+
+String::String(float value, unsigned int decimals) : String((double)value, decimals) {}
+
+String::String(double value, unsigned int decimals) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+  _s = buffer;
+}
+
+bool String::equalsIgnoreCase(const String& s) const {
+  if (_s.size() != s._s.size()) return false;
+  for (size_t i = 0; i < _s.size(); i++) {
+    if (tolower((unsigned char)_s[i]) != tolower((unsigned char)s._s[i])) return false;
+  }
+  return true;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t pos = _s.find(c, from);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const char* s, unsigned int from) const {
+  size_t pos = _s.find(s ? s : "", from);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(char c) const {
+  size_t pos = _s.rfind(c);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+bool String::endsWith(const String& suffix) const {
+  return _s.size() >= suffix._s.size() &&
+         _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+}
+
+String String::substring(unsigned int begin, unsigned int end) const {
+  if (begin > end) std::swap(begin, end);
+  if (begin >= _s.size()) return String();
+  if (end > _s.size()) end = _s.size();
+  return String(_s.substr(begin, end - begin));
+}
+
+void String::replace(const String& find, const String& replacement) {
+  if (find._s.empty()) return;
+  size_t pos = 0;
+  while ((pos = _s.find(find._s, pos)) != std::string::npos) {
+    _s.replace(pos, find._s.size(), replacement._s);
+    pos += replacement._s.size();
+  }
+}
+
+void String::toLowerCase() {
+  for (char& c : _s) c = (char)tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+  for (char& c : _s) c = (char)toupper((unsigned char)c);
+}
+
+void String::trim() {
+  size_t begin = _s.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    _s.clear();
+    return;
+  }
+  size_t end = _s.find_last_not_of(" \t\r\n");
+  _s = _s.substr(begin, end - begin + 1);
+}
+
+// ==================== Print / Stream ====================
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (!write(*buffer++)) break;
+    n++;
+  }
+  return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+  char stackBuffer[128];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(stackBuffer, sizeof(stackBuffer), format, args);
+  va_end(args);
+  if (len < 0) return 0;
+  if ((size_t)len < sizeof(stackBuffer)) {
+    return write((const uint8_t*)stackBuffer, len);
+  }
+  std::string buffer(len + 1, '\0');
+  va_start(args, format);
+  vsnprintf(&buffer[0], buffer.size(), format, args);
+  va_end(args);
+  return write((const uint8_t*)buffer.data(), len);
+}
+
+size_t Print::print(long value, int base) {
+  return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(double value, int decimals) {
+  return print(String(value, (unsigned int)decimals));
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t n = 0;
+  while (n < length) {
+    int c = read();
+    if (c < 0) break;
+    buffer[n++] = (char)c;
+  }
+  return n;
+}
+
+String Stream::readString() {
+  String s;
+  int c;
+  while ((c = read()) >= 0) s += (char)c;
+  return s;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String s;
+  int c;
+  while ((c = read()) >= 0 && c != terminator) s += (char)c;
+  return s;
+}
+
+// ==================== Serial ====================
+
+// stdin is only read when it is not a terminal, without blocking
+static int stdinPeek = -1;
+static bool stdinReady = false;
+static bool stdinOpen = false;
+
+static void stdinSetup() {
+  if (stdinReady) return;
+  stdinReady = true;
+  if (isatty(STDIN_FILENO)) return;
+  int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+  stdinOpen = flags >= 0 && fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static int stdinFill() {
+  stdinSetup();
+  if (stdinPeek < 0 && stdinOpen) {
+    uint8_t c;
+    ssize_t n = ::read(STDIN_FILENO, &c, 1);
+    if (n == 1) {
+      stdinPeek = c;
+    } else if (n == 0) {
+      stdinOpen = false;
+    }
+  }
+  return stdinPeek;
+}
+
+size_t HWCDC::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HWCDC::write(const uint8_t* buffer, size_t size) {
+  if (!ModbeeNative::consoleEnabled()) return size;
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HWCDC::flush() {
+  fflush(stdout);
+}
+
+int HWCDC::available() {
+  return stdinFill() >= 0 ? 1 : 0;
+}
+
+int HWCDC::read() {
+  int c = stdinFill();
+  stdinPeek = -1;
+  return c;
+}
+
+int HWCDC::peek() {
+  return stdinFill();
+}
+
+// ==================== UART ====================
+
+HardwareSerial Serial1(1);
+
+static uint64_t wallMicros() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin,
+                           bool invert, unsigned long timeoutMs, uint8_t rxfifoFullThreshold) {
+  (void)rxPin;
+  (void)txPin;
+  (void)invert;
+  (void)timeoutMs;
+  (void)rxfifoFullThreshold;
+  _baud = baud ? baud : 9600;
+  _bitsPerSymbol = config == SERIAL_8N1 ? 10 : 11;
+  _rx.clear();
+  _rxPos = 0;
+  _rxPending = false;
+  _begun = true;
+}
+
+void HardwareSerial::end() {
+  _begun = false;
+  _onReceive = nullptr;
+}
+
+bool HardwareSerial::setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin, int8_t rtsPin) {
+  (void)rxPin;
+  (void)txPin;
+  (void)ctsPin;
+  (void)rtsPin;
+  return true;
+}
+
+bool HardwareSerial::setMode(uint8_t mode) {
+  return mode == UART_MODE_UART || mode == UART_MODE_RS485_HALF_DUPLEX;
+}
+
+bool HardwareSerial::setRxTimeout(uint8_t symbols) {
+  _rxTimeoutSymbols = symbols;
+  return true;
+}
+
+size_t HardwareSerial::setRxBufferSize(size_t size) {
+  if (_begun) return 0;  // Like the driver: only before begin()
+  _rxBufferSize = size;
+  return size;
+}
+
+void HardwareSerial::onReceive(OnReceiveCb function, bool onlyOnTimeout) {
+  (void)onlyOnTimeout;
+  _onReceive = function;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (!_begun) return 0;
+  if (_fd < 0) return size;
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = ::write(_fd, buffer + sent, size - sent);
+    if (n <= 0) break;
+    sent += (size_t)n;
+  }
+  return sent;
+}
+
+int HardwareSerial::available() {
+  return (int)(_rx.size() - _rxPos);
+}
+
+int HardwareSerial::read() {
+  if (_rxPos >= _rx.size()) return -1;
+  return (uint8_t)_rx[_rxPos++];
+}
+
+int HardwareSerial::peek() {
+  return _rxPos < _rx.size() ? (uint8_t)_rx[_rxPos] : -1;
+}
+
+void HardwareSerial::hostPoll() {
+  if (!_begun || _fd < 0) return;
+  if (_rxPos >= _rx.size()) {
+    _rx.clear();
+    _rxPos = 0;
+  }
+  uint8_t buffer[256];
+  ssize_t n;
+  while ((n = ::read(_fd, buffer, sizeof(buffer))) > 0) {
+    // A full buffer drops new bytes, as the driver's ring buffer does
+    size_t held = (size_t)available();
+    size_t room = _rxBufferSize > held ? _rxBufferSize - held : 0;
+    _rx.append((const char*)buffer, std::min((size_t)n, room));
+    _lastRxWallUs = wallMicros();
+    _rxPending = true;
+  }
+  uint64_t quietUs = (uint64_t)_rxTimeoutSymbols * _bitsPerSymbol * 1000000ULL / _baud;
+  if (_rxPending && wallMicros() - _lastRxWallUs >= quietUs) {
+    _rxPending = false;
+    if (_onReceive && available() > 0) _onReceive();
+  }
+}
+
+// ==================== ESP ====================
+
+// Figures of an ESP32-C3 with the WiFi stack running
+uint32_t EspClass::getFreeHeap() { return 180000; }
+uint32_t EspClass::getMinFreeHeap() { return 160000; }
+uint32_t EspClass::getMaxAllocHeap() { return 110000; }
+uint32_t EspClass::getHeapSize() { return 320000; }
+
+uint32_t EspClass::getCycleCount() {
+  return (uint32_t)(ModbeeNative::now() * getCpuFrequencyMhz());
+}
+
+uint32_t EspClass::getCpuFreqMHz() {
+  return getCpuFrequencyMhz();
+}
+
+void EspClass::restart() {
+  fflush(stdout);
+  ModbeeNative::requestExit(0);
+}
+
+static uint32_t cpuFrequencyMhz = 160;
+
+bool setCpuFrequencyMhz(uint32_t mhz) {
+  cpuFrequencyMhz = mhz;
+  return true;
+}
+
+uint32_t getCpuFrequencyMhz() {
+  return cpuFrequencyMhz;
+}
+
+void btStart() {
+}
+
+void btStop() {
+}
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1,
+                const char* server2, const char* server3) {
+  (void)gmtOffsetSec;
+  (void)daylightOffsetSec;
+  (void)server1;
+  (void)server2;
+  (void)server3;
+}
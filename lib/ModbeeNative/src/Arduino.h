@@ -0,0 +1,349 @@
+/*!
+ * @file Arduino.h
+ *
+ * @brief Host stand-in for the Arduino core, for the native build
+ *
+ * Just enough of the ESP32 Arduino core for ModbeeMPPT to build and run on
+ * a PC: String, Print/Stream, Serial on stdout and a virtual clock. millis()
+ * and micros() only move when the firmware waits (delay(), a bus transfer)
+ * or when the host loop advances them, so a run is repeatable and can go
+ * much faster than real time. See ModbeeNative.h.
+ */
+
+#ifndef MODBEE_NATIVE_ARDUINO_H
+#define MODBEE_NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define F(x) (x)
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define OUTPUT_OPEN_DRAIN 0x13
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// ==================== Time (virtual clock) ====================
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// ==================== GPIO ====================
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+// ==================== String ====================
+
+class String {
+public:
+  String() {}
+  String(const char* cstr) : _s(cstr ? cstr : "") {}
+  String(const std::string& s) : _s(s) {}
+  explicit String(char c) : _s(1, c) {}
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  explicit String(float value, unsigned int decimals = 2);
+  explicit String(double value, unsigned int decimals = 2);
+
+  const char* c_str() const { return _s.c_str(); }
+  unsigned int length() const { return _s.size(); }
+  bool isEmpty() const { return _s.empty(); }
+  bool reserve(unsigned int size) { _s.reserve(size); return true; }
+  void clear() { _s.clear(); }
+
+  bool concat(const String& s) { _s += s._s; return true; }
+  bool concat(const char* cstr) { if (!cstr) return false; _s += cstr; return true; }
+  bool concat(const char* cstr, unsigned int length) { if (!cstr) return false; _s.append(cstr, length); return true; }
+  bool concat(char c) { _s += c; return true; }
+  bool concat(int value) { return concat(String(value)); }
+  bool concat(unsigned int value) { return concat(String(value)); }
+  bool concat(long value) { return concat(String(value)); }
+  bool concat(unsigned long value) { return concat(String(value)); }
+  bool concat(float value) { return concat(String(value)); }
+  bool concat(double value) { return concat(String(value)); }
+
+  template <typename T> String& operator+=(const T& value) { concat(value); return *this; }
+
+  bool equals(const String& s) const { return _s == s._s; }
+  bool equals(const char* cstr) const { return _s == (cstr ? cstr : ""); }
+  bool equalsIgnoreCase(const String& s) const;
+  bool operator==(const String& s) const { return equals(s); }
+  bool operator==(const char* cstr) const { return equals(cstr); }
+  bool operator!=(const String& s) const { return !equals(s); }
+  bool operator!=(const char* cstr) const { return !equals(cstr); }
+  bool operator<(const String& s) const { return _s < s._s; }
+
+  char charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) { return _s[index]; }
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const char* s, unsigned int from = 0) const;
+  int indexOf(const String& s, unsigned int from = 0) const { return indexOf(s.c_str(), from); }
+  int lastIndexOf(char c) const;
+  bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+  bool endsWith(const String& suffix) const;
+  String substring(unsigned int begin) const { return substring(begin, _s.size()); }
+  String substring(unsigned int begin, unsigned int end) const;
+
+  void replace(const String& find, const String& replacement);
+  void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+
+  long toInt() const { return atol(_s.c_str()); }
+  float toFloat() const { return (float)atof(_s.c_str()); }
+  double toDouble() const { return atof(_s.c_str()); }
+
+private:
+  std::string _s;
+};
+
+inline String operator+(const String& a, const String& b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String& a, const char* b) { String r(a); r.concat(b); return r; }
+inline String operator+(const char* a, const String& b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String& a, char b) { String r(a); r.concat(b); return r; }
+template <typename T> String operator+(const String& a, const T& b) { String r(a); r.concat(b); return r; }
+
+// ==================== Print / Stream ====================
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int decimals = 2);
+  size_t print(const Printable& p) { return p.printTo(*this); }
+
+  template <typename T> size_t println(const T& value) { size_t n = print(value); return n + println(); }
+  template <typename T> size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+  size_t println() { return write("\r\n"); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+  String readString();
+  String readStringUntil(char terminator);
+
+protected:
+  unsigned long _timeout = 1000;
+};
+
+// ==================== Serial ====================
+
+/*!
+ * @brief USB CDC console: writes to stdout, reads from stdin when it is a pipe or file
+ */
+class HWCDC : public Stream {
+public:
+  void begin(unsigned long baud = 0) { (void)baud; }
+  void end() {}
+  operator bool() const { return true; }
+
+  using Print::write;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  int availableForWrite() override { return 4096; }
+  void flush() override;
+
+  int available() override;
+  int read() override;
+  int peek() override;
+};
+
+extern HWCDC Serial;
+
+// ==================== UART ====================
+
+#define SERIAL_8N1 0x800001c
+#define SERIAL_8E1 0x800001e
+#define SERIAL_8O1 0x800001f
+
+#define UART_MODE_UART 0x00
+#define UART_MODE_RS485_HALF_DUPLEX 0x01
+
+typedef std::function<void(void)> OnReceiveCb;
+
+/*!
+ * @brief Hardware UART: silent unless the host attaches a descriptor (a pty)
+ *
+ * hostPoll() moves bytes from the descriptor into the receive buffer and
+ * calls the onReceive() callback once the line has been quiet for the RX
+ * timeout, like the ESP32 driver's UART_DATA event. The quiet time is wall
+ * clock, as the peer on the other end of the pty runs in real time.
+ */
+class HardwareSerial : public Stream {
+public:
+  explicit HardwareSerial(int uartNum) : _uartNum(uartNum) {}
+
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1,
+             bool invert = false, unsigned long timeoutMs = 20000UL, uint8_t rxfifoFullThreshold = 112);
+  void end();
+  bool setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin = -1, int8_t rtsPin = -1);
+  bool setMode(uint8_t mode);
+  bool setRxTimeout(uint8_t symbols);
+  size_t setRxBufferSize(size_t size);
+  void onReceive(OnReceiveCb function, bool onlyOnTimeout = false);
+  operator bool() const { return _begun; }
+
+  using Print::write;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  int availableForWrite() override { return 4096; }
+  void flush() override {}
+
+  int available() override;
+  int read() override;
+  int peek() override;
+
+  /*!
+   * @brief Connect the UART to a non-blocking descriptor (-1 detaches)
+   */
+  void hostAttach(int fd) { _fd = fd; }
+
+  /*!
+   * @brief Read the descriptor and fire onReceive(); call from the host loop
+   */
+  void hostPoll();
+
+private:
+  int _uartNum;
+  int _fd = -1;
+  bool _begun = false;
+  unsigned long _baud = 9600;
+  uint8_t _bitsPerSymbol = 10;  // Start, data, parity and stop bits
+  uint8_t _rxTimeoutSymbols = 2;
+  size_t _rxBufferSize = 256;
+  OnReceiveCb _onReceive;
+  std::string _rx;
+  size_t _rxPos = 0;
+  uint64_t _lastRxWallUs = 0;
+  bool _rxPending = false;     // Bytes arrived since the callback last ran
+};
+
+extern HardwareSerial Serial1;
+
+// ==================== ESP-IDF / FreeRTOS ====================
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+// Single-threaded on the host: critical sections only need to compile
+typedef struct {
+  int owner;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_ISR(mux) (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux) (void)(mux)
+
+// Mutexes likewise: a take always succeeds at once
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define pdTRUE 1
+#define pdFALSE 0
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  static int mutexes;
+  return &mutexes;
+}
+inline int xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  (void)ticks;
+  return semaphore ? pdTRUE : pdFALSE;
+}
+inline int xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  return semaphore ? pdTRUE : pdFALSE;
+}
+
+class EspClass {
+public:
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getHeapSize();
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz();
+  uint64_t getEfuseMac() { return 0x0000C3EE0B0D0EULL; }
+  void restart();
+};
+
+extern EspClass ESP;
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+int64_t esp_timer_get_time();
+uint32_t esp_random();
+void btStart();
+void btStop();
+// SNTP: the host clock is already set, so time() is valid from the start
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+
+#endif // MODBEE_NATIVE_ARDUINO_H
@@ -0,0 +1,25 @@
+/*!
+ * @file AsyncJson.h
+ *
+ * @brief Host stand-in for the JSON handler of ESPAsyncWebServer
+ */
+
+#ifndef MODBEE_NATIVE_ASYNC_JSON_H
+#define MODBEE_NATIVE_ASYNC_JSON_H
+
+#include <ESPAsyncWebServer.h>
+
+typedef std::function<void(AsyncWebServerRequest*, JsonVariant&)> ArJsonRequestHandlerFunction;
+
+class AsyncCallbackJsonWebHandler : public AsyncWebHandler {
+public:
+  AsyncCallbackJsonWebHandler(const String& uri, ArJsonRequestHandlerFunction onRequest = nullptr)
+    : _onRequest(onRequest) { (void)uri; }
+  void setMethod(WebRequestMethodComposite method) { (void)method; }
+  void setMaxContentLength(int maxContentLength) { (void)maxContentLength; }
+  void onRequest(ArJsonRequestHandlerFunction fn) { _onRequest = fn; }
+private:
+  ArJsonRequestHandlerFunction _onRequest;
+};
+
+#endif // MODBEE_NATIVE_ASYNC_JSON_H
@@ -0,0 +1,187 @@
+#include "AsyncTCP.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// lwIP error codes the handlers see on the ESP32
+#define ERR_TIMEOUT -3
+#define ERR_CONN -11
+#define ERR_ABRT -13
+#define ERR_RST -14
+#define ERR_CLSD -15
+#define ERR_DNS -55
+
+static std::vector<AsyncClient*>& clients() {
+  static std::vector<AsyncClient*> registry;
+  return registry;
+}
+
+AsyncClient::AsyncClient() {
+  clients().push_back(this);
+}
+
+AsyncClient::~AsyncClient() {
+  if (_fd >= 0) ::close(_fd);
+  std::vector<AsyncClient*>& registry = clients();
+  registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+}
+
+// ==================== Connection ====================
+
+bool AsyncClient::connect(const char* host, uint16_t port) {
+  // Resolved at once: the host's resolver stands in for lwIP's DNS
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* result = nullptr;
+  if (!host || getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) return false;
+  uint32_t address = ((struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(result);
+  return connectTo(address, port);
+}
+
+bool AsyncClient::connect(IPAddress ip, uint16_t port) {
+  return connectTo((uint32_t)ip, port);
+}
+
+bool AsyncClient::connectTo(uint32_t address, uint16_t port) {
+  if (_state != CLOSED) return false;
+  _fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_fd < 0) return false;
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  struct sockaddr_in peer;
+  memset(&peer, 0, sizeof(peer));
+  peer.sin_family = AF_INET;
+  peer.sin_port = htons(port);
+  peer.sin_addr.s_addr = address;
+  if (::connect(_fd, (struct sockaddr*)&peer, sizeof(peer)) != 0 && errno != EINPROGRESS) {
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+  _remote = IPAddress(address);
+  _tx.clear();
+  _state = CONNECTING;
+  return true;
+}
+
+void AsyncClient::close(bool now) {
+  (void)now;
+  if (_fd < 0) return;
+  ::close(_fd);
+  _fd = -1;
+  _state = CLOSED;
+  _tx.clear();
+  if (_disconnectCb) _disconnectCb(_disconnectArg, this);
+}
+
+void AsyncClient::fail(int8_t error) {
+  // As lwIP's error callback: the connection is gone, then discarded
+  ::close(_fd);
+  _fd = -1;
+  _state = CLOSED;
+  _tx.clear();
+  if (_errorCb) _errorCb(_errorArg, this, error);
+  if (_disconnectCb) _disconnectCb(_disconnectArg, this);
+}
+
+const char* AsyncClient::errorToString(int8_t error) const {
+  switch (error) {
+    case 0:           return "OK";
+    case ERR_TIMEOUT: return "Timeout";
+    case ERR_CONN:    return "Not connected";
+    case ERR_ABRT:    return "Connection aborted";
+    case ERR_RST:     return "Connection reset";
+    case ERR_CLSD:    return "Connection closed";
+    case ERR_DNS:     return "DNS failed";
+    default:          return "UNKNOWN";
+  }
+}
+
+// ==================== Data ====================
+
+size_t AsyncClient::space() const {
+  if (_state != CONNECTED) return 0;
+  return _tx.size() < MODBEE_NATIVE_TCP_SND_BUF ? MODBEE_NATIVE_TCP_SND_BUF - _tx.size() : 0;
+}
+
+size_t AsyncClient::add(const char* data, size_t size, uint8_t flags) {
+  (void)flags;
+  if (!data || size == 0) return 0;
+  size = std::min(size, space());
+  _tx.append(data, size);
+  return size;
+}
+
+bool AsyncClient::send() {
+  return _state == CONNECTED && flush();
+}
+
+size_t AsyncClient::write(const char* data, size_t size, uint8_t flags) {
+  size_t added = add(data, size, flags);
+  if (!added || !send()) return 0;
+  return added;
+}
+
+bool AsyncClient::flush() {
+  while (!_tx.empty()) {
+    ssize_t n = ::send(_fd, _tx.data(), _tx.size(), MSG_NOSIGNAL);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;  // Rest goes on the next poll
+    _tx.erase(0, (size_t)n);
+  }
+  return true;
+}
+
+// ==================== Polling ====================
+
+void AsyncClient::hostPollAll() {
+  // A handler may close or reconnect its own client; the registry itself
+  // only changes when clients are constructed or destroyed
+  std::vector<AsyncClient*> snapshot = clients();
+  for (AsyncClient* client : snapshot) client->hostPoll();
+}
+
+void AsyncClient::hostPoll() {
+  if (_state == CONNECTING) {
+    struct pollfd pfd = {_fd, POLLOUT, 0};
+    if (poll(&pfd, 1, 0) <= 0) return;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0) {
+      fail(error == ETIMEDOUT ? ERR_TIMEOUT : ERR_RST);
+      return;
+    }
+    _state = CONNECTED;
+    if (_connectCb) _connectCb(_connectArg, this);
+    if (_state != CONNECTED) return;
+  }
+  if (_state != CONNECTED) return;
+
+  if (!flush()) {
+    fail(ERR_RST);
+    return;
+  }
+  uint8_t buffer[1460];
+  while (_state == CONNECTED) {
+    ssize_t n = ::recv(_fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      if (_dataCb) _dataCb(_dataArg, this, buffer, (size_t)n);
+    } else if (n == 0) {
+      close();        // Peer closed: discarded without an error, like lwIP
+    } else {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) fail(ERR_RST);
+      break;
+    }
+  }
+}
@@ -0,0 +1,92 @@
+/*!
+ * @file AsyncTCP.h
+ *
+ * @brief Host stand-in for AsyncTCP: a client on a non-blocking socket
+ *
+ * The firmware sees the AsyncTCP client API; underneath is a POSIX socket
+ * that hostPollAll() (run from an onTick() hook with --network) connects,
+ * drains and reads, calling the handlers the way the async_tcp task would.
+ * Without that hook a client connects but nothing ever happens, like a
+ * radio that never reaches the access point.
+ */
+
+#ifndef MODBEE_NATIVE_ASYNC_TCP_H
+#define MODBEE_NATIVE_ASYNC_TCP_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+#define ASYNC_WRITE_FLAG_MORE 0x02
+
+#define MODBEE_NATIVE_TCP_SND_BUF 5744     // lwIP TCP_SND_BUF of the ESP32 core
+
+class AsyncClient {
+public:
+  typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+  typedef std::function<void(void*, AsyncClient*, size_t, uint32_t)> AcAckHandler;
+  typedef std::function<void(void*, AsyncClient*, int8_t)> AcErrorHandler;
+  typedef std::function<void(void*, AsyncClient*, void*, size_t)> AcDataHandler;
+  typedef std::function<void(void*, AsyncClient*, uint32_t)> AcTimeoutHandler;
+
+  AsyncClient();
+  ~AsyncClient();
+  AsyncClient(const AsyncClient&) = delete;
+  AsyncClient& operator=(const AsyncClient&) = delete;
+
+  bool connect(const char* host, uint16_t port);
+  bool connect(IPAddress ip, uint16_t port);
+  void close(bool now = false);
+  bool connected() const { return _state == CONNECTED; }
+  bool connecting() const { return _state == CONNECTING; }
+  bool disconnected() const { return _state == CLOSED; }
+  bool freeable() const { return _state == CLOSED; }
+  bool canSend() const { return space() > 0; }
+  size_t space() const;
+  size_t add(const char* data, size_t size, uint8_t flags = ASYNC_WRITE_FLAG_COPY);
+  bool send();
+  size_t write(const char* data) { return write(data, strlen(data)); }
+  size_t write(const char* data, size_t size, uint8_t flags = ASYNC_WRITE_FLAG_COPY);
+  void setRxTimeout(uint32_t timeout) { (void)timeout; }
+  void setAckTimeout(uint32_t timeout) { (void)timeout; }
+  void setNoDelay(bool nodelay) { (void)nodelay; }
+  IPAddress remoteIP() const { return _remote; }
+  const char* errorToString(int8_t error) const;
+
+  void onConnect(AcConnectHandler cb, void* arg = nullptr) { _connectCb = cb; _connectArg = arg; }
+  void onDisconnect(AcConnectHandler cb, void* arg = nullptr) { _disconnectCb = cb; _disconnectArg = arg; }
+  void onAck(AcAckHandler cb, void* arg = nullptr) { (void)cb; (void)arg; }
+  void onError(AcErrorHandler cb, void* arg = nullptr) { _errorCb = cb; _errorArg = arg; }
+  void onData(AcDataHandler cb, void* arg = nullptr) { _dataCb = cb; _dataArg = arg; }
+  void onTimeout(AcTimeoutHandler cb, void* arg = nullptr) { (void)cb; (void)arg; }
+  void onPoll(AcConnectHandler cb, void* arg = nullptr) { (void)cb; (void)arg; }
+
+  /*!
+   * @brief Advance every client's socket (host side, NativeMain --network)
+   */
+  static void hostPollAll();
+
+private:
+  enum State { CLOSED, CONNECTING, CONNECTED };
+
+  int _fd = -1;
+  State _state = CLOSED;
+  IPAddress _remote;
+  std::string _tx;            // Added, not yet taken by the socket
+
+  AcConnectHandler _connectCb;
+  AcConnectHandler _disconnectCb;
+  AcErrorHandler _errorCb;
+  AcDataHandler _dataCb;
+  void* _connectArg = nullptr;
+  void* _disconnectArg = nullptr;
+  void* _errorArg = nullptr;
+  void* _dataArg = nullptr;
+
+  bool connectTo(uint32_t address, uint16_t port);
+  void hostPoll();
+  bool flush();
+  void fail(int8_t error);
+};
+
+#endif // MODBEE_NATIVE_ASYNC_TCP_H
@@ -0,0 +1,21 @@
+/*!
+ * @file BLE2902.h
+ *
+ * @brief Host stand-in for the Client Characteristic Configuration descriptor
+ */
+
+#ifndef MODBEE_NATIVE_BLE2902_H
+#define MODBEE_NATIVE_BLE2902_H
+
+#include "BLEDevice.h"
+
+class BLE2902 : public BLEDescriptor {
+public:
+  BLE2902() : BLEDescriptor(BLEUUID((uint16_t)0x2902)) {}
+  bool getNotifications() const { return false; }
+  bool getIndications() const { return false; }
+  void setNotifications(bool enable) { (void)enable; }
+  void setIndications(bool enable) { (void)enable; }
+};
+
+#endif // MODBEE_NATIVE_BLE2902_H
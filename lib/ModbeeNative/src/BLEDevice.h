@@ -0,0 +1,352 @@
+/*!
+ * @file BLEDevice.h
+ *
+ * @brief Host stand-in for the ESP32 core BLE library (Bluedroid)
+ *
+ * Only the server side the firmware uses: the GATT database is built and
+ * values are kept so they can be read back, advertising state and data
+ * are remembered, and no client ever connects, so notify() and indicate()
+ * have no one to send to. A test stands in for a client's write with
+ * hostWrite() and for its pairing with hostPair(); a write needing an
+ * encrypted, MITM protected link is refused until the pairing succeeded.
+ */
+
+#ifndef MODBEE_NATIVE_BLEDEVICE_H
+#define MODBEE_NATIVE_BLEDEVICE_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "esp_gap_ble_api.h"
+
+#define ESP_BLE_ADV_FLAG_GEN_DISC (0x01 << 1)
+#define ESP_BLE_ADV_FLAG_BREDR_NOT_SPT (0x01 << 2)
+
+typedef uint16_t esp_gatt_perm_t;
+#define ESP_GATT_PERM_READ (1 << 0)
+#define ESP_GATT_PERM_READ_ENCRYPTED (1 << 1)
+#define ESP_GATT_PERM_READ_ENC_MITM (1 << 2)
+#define ESP_GATT_PERM_WRITE (1 << 4)
+#define ESP_GATT_PERM_WRITE_ENCRYPTED (1 << 5)
+#define ESP_GATT_PERM_WRITE_ENC_MITM (1 << 6)
+
+typedef enum {
+  ADV_TYPE_IND = 0x00,
+  ADV_TYPE_DIRECT_IND_HIGH = 0x01,
+  ADV_TYPE_SCAN_IND = 0x02,
+  ADV_TYPE_NONCONN_IND = 0x03
+} esp_ble_adv_type_t;
+
+// The members of the Bluedroid GATT server event the firmware reads
+typedef union {
+  struct { uint16_t conn_id; esp_bd_addr_t remote_bda; } connect;
+  struct { uint16_t conn_id; esp_bd_addr_t remote_bda; uint16_t reason; } disconnect;
+  struct { uint16_t conn_id; uint16_t mtu; } mtu;
+  struct { uint16_t conn_id; uint16_t handle; uint16_t len; uint8_t* value; } write;
+} esp_ble_gatts_cb_param_t;
+
+class BLEUUID {
+public:
+  BLEUUID() {}
+  BLEUUID(const char* uuid) : _uuid(uuid) {}
+  BLEUUID(uint16_t uuid) {
+    char text[8];
+    snprintf(text, sizeof(text), "%04x", uuid);
+    _uuid = text;
+  }
+  std::string toString() const { return _uuid; }
+  bool equals(const BLEUUID& other) const { return _uuid == other._uuid; }
+private:
+  std::string _uuid;
+};
+
+class BLEDescriptor {
+public:
+  BLEDescriptor(const BLEUUID& uuid) : _uuid(uuid) {}
+  virtual ~BLEDescriptor() {}
+  BLEUUID getUUID() const { return _uuid; }
+private:
+  BLEUUID _uuid;
+};
+
+class BLECharacteristic;
+
+class BLECharacteristicCallbacks {
+public:
+  typedef enum {
+    SUCCESS_INDICATE,
+    SUCCESS_NOTIFY,
+    ERROR_INDICATE_DISABLED,
+    ERROR_NOTIFY_DISABLED,
+    ERROR_GATT,
+    ERROR_NO_CLIENT,
+    ERROR_INDICATE_TIMEOUT,
+    ERROR_INDICATE_FAILURE
+  } Status;
+
+  virtual ~BLECharacteristicCallbacks() {}
+  virtual void onRead(BLECharacteristic* characteristic) { (void)characteristic; }
+  virtual void onWrite(BLECharacteristic* characteristic) { (void)characteristic; }
+  virtual void onWrite(BLECharacteristic* characteristic, esp_ble_gatts_cb_param_t* param) {
+    (void)param;
+    onWrite(characteristic);
+  }
+  virtual void onNotify(BLECharacteristic* characteristic) { (void)characteristic; }
+  virtual void onStatus(BLECharacteristic* characteristic, Status status, uint32_t code) {
+    (void)characteristic; (void)status; (void)code;
+  }
+};
+
+class BLECharacteristic {
+public:
+  static const uint32_t PROPERTY_READ = 1 << 0;
+  static const uint32_t PROPERTY_WRITE = 1 << 1;
+  static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+  static const uint32_t PROPERTY_BROADCAST = 1 << 3;
+  static const uint32_t PROPERTY_INDICATE = 1 << 4;
+  static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+  BLECharacteristic(const BLEUUID& uuid, uint32_t properties) : _uuid(uuid), _properties(properties) {}
+  ~BLECharacteristic() {
+    for (BLEDescriptor* descriptor : _descriptors) delete descriptor;
+  }
+
+  void addDescriptor(BLEDescriptor* descriptor) { _descriptors.push_back(descriptor); }
+  void setCallbacks(BLECharacteristicCallbacks* callbacks) { _callbacks = callbacks; }
+  void setAccessPermissions(esp_gatt_perm_t permissions) { _permissions = permissions; }
+  void setValue(const uint8_t* data, size_t length) { _value.assign((const char*)data, length); }
+  void setValue(const std::string& value) { _value = value; }
+  std::string getValue() const { return _value; }
+  uint8_t* getData() { return (uint8_t*)_value.data(); }
+  BLEUUID getUUID() const { return _uuid; }
+
+  void notify(bool isNotification = true) {
+    if (!_callbacks) return;
+    _callbacks->onNotify(this);
+    _callbacks->onStatus(this, isNotification ? BLECharacteristicCallbacks::ERROR_NOTIFY_DISABLED
+                                              : BLECharacteristicCallbacks::ERROR_INDICATE_DISABLED, 0);
+  }
+  void indicate() { notify(false); }
+
+  // Host only: a client writes the value, as the GATT server event delivers
+  // it; false if the stack refused it for lack of authentication
+  bool hostWrite(const uint8_t* data, size_t length) {
+    bool open = _permissions & ESP_GATT_PERM_WRITE;
+    bool paired = (_permissions & ESP_GATT_PERM_WRITE_ENC_MITM) && ModbeeNativeBleSecurity::get().linkAuthenticated;
+    if (!open && !paired) return false;
+    _value.assign((const char*)data, length);
+    if (!_callbacks) return true;
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.write.len = length;
+    param.write.value = (uint8_t*)data;
+    _callbacks->onWrite(this, &param);
+    return true;
+  }
+
+private:
+  BLEUUID _uuid;
+  uint32_t _properties;
+  esp_gatt_perm_t _permissions = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
+  std::string _value;
+  std::vector<BLEDescriptor*> _descriptors;
+  BLECharacteristicCallbacks* _callbacks = nullptr;
+};
+
+class BLEService {
+public:
+  BLEService(const BLEUUID& uuid) : _uuid(uuid) {}
+  ~BLEService() {
+    for (BLECharacteristic* characteristic : _characteristics) delete characteristic;
+  }
+
+  BLECharacteristic* createCharacteristic(const char* uuid, uint32_t properties) {
+    return createCharacteristic(BLEUUID(uuid), properties);
+  }
+  BLECharacteristic* createCharacteristic(const BLEUUID& uuid, uint32_t properties) {
+    BLECharacteristic* characteristic = new BLECharacteristic(uuid, properties);
+    _characteristics.push_back(characteristic);
+    return characteristic;
+  }
+  BLECharacteristic* getCharacteristic(const char* uuid) {
+    for (BLECharacteristic* characteristic : _characteristics) {
+      if (characteristic->getUUID().equals(BLEUUID(uuid))) return characteristic;
+    }
+    return nullptr;
+  }
+  void start() { _started = true; }
+  void stop() { _started = false; }
+  BLEUUID getUUID() const { return _uuid; }
+
+private:
+  BLEUUID _uuid;
+  std::vector<BLECharacteristic*> _characteristics;
+  bool _started = false;
+};
+
+class BLEServer;
+
+class BLEServerCallbacks {
+public:
+  virtual ~BLEServerCallbacks() {}
+  virtual void onConnect(BLEServer* server) { (void)server; }
+  virtual void onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+    (void)param;
+    onConnect(server);
+  }
+  virtual void onDisconnect(BLEServer* server) { (void)server; }
+  virtual void onDisconnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+    (void)param;
+    onDisconnect(server);
+  }
+  virtual void onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+    (void)server; (void)param;
+  }
+};
+
+class BLEServer {
+public:
+  ~BLEServer() {
+    for (BLEService* service : _services) delete service;
+  }
+
+  BLEService* createService(const char* uuid) { return createService(BLEUUID(uuid)); }
+  BLEService* createService(const BLEUUID& uuid) {
+    BLEService* service = new BLEService(uuid);
+    _services.push_back(service);
+    return service;
+  }
+  BLEService* getServiceByUUID(const char* uuid) {
+    for (BLEService* service : _services) {
+      if (service->getUUID().equals(BLEUUID(uuid))) return service;
+    }
+    return nullptr;
+  }
+  void setCallbacks(BLEServerCallbacks* callbacks) { _callbacks = callbacks; }
+  uint32_t getConnectedCount() const { return 0; }
+  uint16_t getConnId() const { return 0; }
+  void disconnect(uint16_t connId) { (void)connId; }
+  void updateConnParams(esp_bd_addr_t remoteBda, uint16_t minInterval, uint16_t maxInterval,
+                        uint16_t latency, uint16_t timeout) {
+    (void)remoteBda; (void)minInterval; (void)maxInterval; (void)latency; (void)timeout;
+  }
+
+private:
+  std::vector<BLEService*> _services;
+  BLEServerCallbacks* _callbacks = nullptr;
+};
+
+class BLEAdvertisementData {
+public:
+  void setFlags(uint8_t flags) {
+    _payload.append("\x02\x01", 2);
+    _payload += (char)flags;
+  }
+  void setName(const std::string& name) {
+    _payload += (char)(name.size() + 1);
+    _payload += '\x09';
+    _payload += name;
+  }
+  void setManufacturerData(const std::string& data) {
+    _payload += (char)(data.size() + 1);
+    _payload += '\xFF';
+    _payload += data;
+  }
+  void setCompleteServices(const BLEUUID& uuid) {
+    // 128-bit UUID, least significant byte first as on the air
+    std::string text = uuid.toString();
+    std::string bytes;
+    for (size_t i = 0; i + 1 < text.size(); i++) {
+      if (text[i] == '-') continue;
+      bytes += (char)strtol(text.substr(i, 2).c_str(), nullptr, 16);
+      i++;
+    }
+    _payload += (char)(bytes.size() + 1);
+    _payload += '\x07';
+    _payload.append(bytes.rbegin(), bytes.rend());
+  }
+  std::string getPayload() const { return _payload; }
+private:
+  std::string _payload;
+};
+
+class BLEAdvertising {
+public:
+  void addServiceUUID(const char* uuid) { (void)uuid; }
+  void addServiceUUID(const BLEUUID& uuid) { (void)uuid; }
+  void setScanResponse(bool enable) { (void)enable; }
+  void setMinInterval(uint16_t interval) { _minInterval = interval; }
+  void setMaxInterval(uint16_t interval) { _maxInterval = interval; }
+  void setMinPreferred(uint16_t interval) { (void)interval; }
+  void setMaxPreferred(uint16_t interval) { (void)interval; }
+  void setAdvertisementData(BLEAdvertisementData& data) { _data = data.getPayload(); }
+  void setScanResponseData(BLEAdvertisementData& data) { _scanResponse = data.getPayload(); }
+  void setAdvertisementType(esp_ble_adv_type_t type) { _type = type; }
+  void start() { _running = true; }
+  void stop() { _running = false; }
+
+  // Host only
+  bool isRunning() const { return _running; }
+  const std::string& data() const { return _data; }
+  const std::string& scanResponse() const { return _scanResponse; }
+  esp_ble_adv_type_t type() const { return _type; }
+  uint16_t minInterval() const { return _minInterval; }
+
+private:
+  uint16_t _minInterval = 0x20;
+  uint16_t _maxInterval = 0x40;
+  std::string _data;
+  std::string _scanResponse;
+  esp_ble_adv_type_t _type = ADV_TYPE_IND;
+  bool _running = false;
+};
+
+class BLEDevice {
+public:
+  static void init(const std::string& name) {
+    (void)name;
+    _initialized() = true;
+  }
+  static bool getInitialized() { return _initialized(); }
+  static void deinit(bool releaseMemory = false) {
+    (void)releaseMemory;
+    _initialized() = false;
+  }
+  static esp_err_t setMTU(uint16_t mtu) {
+    (void)mtu;
+    return ESP_OK;
+  }
+  static BLEServer* createServer() {
+    static BLEServer server;
+    return &server;
+  }
+  static BLEAdvertising* getAdvertising() {
+    static BLEAdvertising advertising;
+    return &advertising;
+  }
+  static void startAdvertising() { getAdvertising()->start(); }
+  static void stopAdvertising() { getAdvertising()->stop(); }
+
+  // Host only: the client pairs, entering passkey; passkey entry is the
+  // only MITM protected method the stand-in knows
+  static bool hostPair(uint32_t passkey) {
+    ModbeeNativeBleSecurity& security = ModbeeNativeBleSecurity::get();
+    bool mitm = (security.authReq & ESP_LE_AUTH_REQ_MITM) && security.ioCap == ESP_IO_CAP_OUT;
+    if (!mitm || !security.passkeySet || passkey != security.passkey) return false;
+    security.linkAuthenticated = true;
+    if ((security.authReq & ESP_LE_AUTH_BOND) && esp_ble_get_bond_device_num() == 0) {
+      esp_ble_bond_dev_t bond;
+      memcpy(bond.bd_addr, MODBEE_NATIVE_BLE_PEER, sizeof(bond.bd_addr));
+      security.bonds.push_back(bond);
+    }
+    return true;
+  }
+
+private:
+  static bool& _initialized() {
+    static bool initialized = false;
+    return initialized;
+  }
+};
+
+#endif // MODBEE_NATIVE_BLEDEVICE_H
@@ -0,0 +1,33 @@
+/*!
+ * @file BLESecurity.h
+ *
+ * @brief Host stand-in for the ESP32 core BLE security settings
+ *
+ * The settings go to the security manager stand-in in esp_gap_ble_api.h,
+ * as the core hands them to Bluedroid; setStaticPIN() picks the same IO
+ * capability and mode as the core does.
+ */
+
+#ifndef MODBEE_NATIVE_BLESECURITY_H
+#define MODBEE_NATIVE_BLESECURITY_H
+
+#include "BLEDevice.h"
+
+class BLESecurity {
+public:
+  void setAuthenticationMode(esp_ble_auth_req_t authReq) { ModbeeNativeBleSecurity::get().authReq = authReq; }
+  void setCapability(esp_ble_io_cap_t ioCap) { ModbeeNativeBleSecurity::get().ioCap = ioCap; }
+  void setInitEncryptionKey(uint8_t key) { (void)key; }
+  void setRespEncryptionKey(uint8_t key) { (void)key; }
+  void setKeySize(uint8_t size = 16) { (void)size; }
+  void setStaticPIN(uint32_t pin) {
+    ModbeeNativeBleSecurity& security = ModbeeNativeBleSecurity::get();
+    security.passkey = pin;
+    security.passkeySet = true;
+    setCapability(ESP_IO_CAP_OUT);
+    setKeySize();
+    setAuthenticationMode(ESP_LE_AUTH_REQ_SC_ONLY);
+  }
+};
+
+#endif // MODBEE_NATIVE_BLESECURITY_H
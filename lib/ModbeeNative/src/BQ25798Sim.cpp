@@ -0,0 +1,605 @@
+#include "BQ25798Sim.h"
+#include <math.h>
+
+// ==================== Register map ====================
+
+// Bits the host can write; 0 marks a read-only register (status, flags, ADC)
+static const uint8_t WRITABLE[BQ25798_SIM_REGISTERS] = {
+  0x3F, 0x07, 0xFF, 0x01, 0xFF, 0xFF, 0x01, 0xFF,   // 0x00 VSYSMIN .. 0x07
+  0xFF, 0x7F, 0xFF, 0x07, 0xFF, 0xFF, 0xFF, 0xFF,   // 0x08 .. 0x0F CTRL0
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,   // 0x10 CTRL1 .. 0x17 NTC0
+  0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 0x18 NTC1, ICO_ILIM, STATUS0..4
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 0x20 FAULT0/1, flags
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,   // 0x28 masks, ADC_CTRL, ADC_DIS0
+  0xF0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // 0x30 ADC_DIS1, ADC results
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFC,   // 0x40 .. 0x47 DPDM
+  0x00                                              // 0x48 part information
+};
+
+static const float VOC_PCT[8] = {0.5625f, 0.625f, 0.6875f, 0.75f, 0.8125f, 0.875f, 0.9375f, 1.0f};
+static const uint32_t VOC_DLY_MS[4] = {50, 300, 2000, 5000};
+static const uint32_t VOC_RATE_S[4] = {30, 120, 600, 1800};
+static const uint32_t WATCHDOG_MS[8] = {0, 500, 1000, 2000, 20000, 40000, 80000, 160000};
+static const uint32_t CHG_TMR_H[4] = {5, 8, 12, 24};
+static const uint32_t TOPOFF_MIN[4] = {0, 15, 30, 45};
+static const float VBAT_LOWV[4] = {0.15f, 0.622f, 0.667f, 0.714f};
+static const float VAC_OVP[4] = {26.0f, 22.0f, 12.0f, 7.0f};
+static const float TREG_C[4] = {60.0f, 80.0f, 100.0f, 120.0f};
+static const float TSHUT_C[4] = {150.0f, 130.0f, 120.0f, 85.0f};
+static const uint32_t ADC_CHANNEL_US[4] = {24000, 12000, 6000, 3000};   // 15/14/13/12-bit
+
+#define US_PER_S 1000000ULL
+#define NEVER UINT64_MAX
+
+// ==================== Construction ====================
+
+// POR register values for a PROG cell count
+static void porRegisters(uint8_t cells, uint8_t* regs) {
+  static const uint8_t VSYSMIN[4] = {0x04, 0x12, 0x1A, 0x26};      // 3.5/7/9/12 V
+  static const uint16_t VREG[4] = {420, 840, 1260, 1680};          // 4.2 V per cell
+
+  memset(regs, 0, BQ25798_SIM_REGISTERS);
+  regs[0x00] = VSYSMIN[cells - 1];
+  regs[0x01] = VREG[cells - 1] >> 8;
+  regs[0x02] = VREG[cells - 1] & 0xFF;
+  regs[0x04] = 100;                   // ICHG 1 A
+  regs[0x05] = 0x24;                  // VINDPM 3.6 V
+  regs[0x06] = 300 >> 8;              // IINDPM 3 A
+  regs[0x07] = 300 & 0xFF;
+  regs[0x08] = 0xC3;                  // VBAT_LOWV 71.4 %, IPRECHG 120 mA
+  regs[0x09] = 0x05;                  // ITERM 200 mA
+  regs[0x0A] = (uint8_t)((cells - 1) << 6) | 0x23;
+  regs[0x0C] = 220;                   // VOTG 5 V
+  regs[0x0D] = 0x4C;
+  regs[0x0E] = 0x3D;                  // Timers on, 12 h fast charge, 2x in DPM
+  regs[0x0F] = 0xB2;                  // EN_AUTO_IBATDIS, EN_CHG, EN_ICO, EN_TERM
+  regs[0x10] = 0x05;                  // VAC_OVP 26 V, watchdog 40 s
+  regs[0x11] = 0x40;                  // AUTO_INDET
+  regs[0x13] = 0x01;
+  regs[0x14] = 0x16;
+  regs[0x15] = 0xAA;                  // VOC 87.5 %, 300 ms, every 2 min, MPPT off
+  regs[0x16] = 0xC0;                  // TREG 120 °C, TSHUT 150 °C
+  regs[0x17] = 0x7A;
+  regs[0x18] = 0x54;
+  regs[0x2E] = 0x30;                  // ADC off, 12-bit
+  regs[0x48] = 0x19;                  // BQ25798, rev 1
+}
+
+BQ25798Sim::BQ25798Sim(uint8_t cells)
+  : _cells(constrain(cells, 1, 4)), _pointer(0), _expectPointer(false),
+    _sources{nullptr, nullptr}, _battery(nullptr), _acrb{false, false},
+    _present{false, false}, _load(0.0f), _ambient(25.0f), _batteryTemperature(25.0f),
+    _time(0), _solvedUs(0), _dirty(true) {
+  powerOnReset();
+}
+
+void BQ25798Sim::powerOnReset() {
+  porRegisters(_cells, _regs);
+
+  _done = false;
+  _topoffUs = 0;
+  _chargeUs = _prechargeUs = _trickleUs = 0;
+  _chargeTimerExpired = _prechargeTimerExpired = _trickleTimerExpired = false;
+  _watchdogUs = 0;
+  _adcNextUs = 0;
+  _adcOneShotDone = false;
+  _vocNextUs = 0;
+  _vocEndUs = 0;
+  memset(&_state, 0, sizeof(_state));
+  _dirty = true;
+  _state.tdie = _ambient;
+  _state.batteryTemperature = _batteryTemperature;
+}
+
+void BQ25798Sim::attachInput(uint8_t input, BQ25798SimSource* source) {
+  if (input == 1 || input == 2) _sources[input - 1] = source;
+  _dirty = true;
+}
+
+void BQ25798Sim::setInputFets(bool acrb1, bool acrb2) {
+  _acrb[0] = acrb1;
+  _acrb[1] = acrb2;
+  _dirty = true;
+}
+
+// ==================== I2C ====================
+
+void BQ25798Sim::i2cStart(bool read) {
+  update();
+  _expectPointer = !read;
+}
+
+bool BQ25798Sim::i2cWrite(uint8_t data) {
+  if (_expectPointer) {
+    _expectPointer = false;
+    if (data >= BQ25798_SIM_REGISTERS) return false;
+    _pointer = data;
+    return true;
+  }
+  if (_pointer >= BQ25798_SIM_REGISTERS) return false;
+  writeRegister(_pointer++, data);
+  return true;
+}
+
+uint8_t BQ25798Sim::i2cRead(bool ack) {
+  (void)ack;
+  if (_pointer >= BQ25798_SIM_REGISTERS) return 0xFF;
+  return readRegister(_pointer++);
+}
+
+uint8_t BQ25798Sim::readRegister(uint8_t reg) {
+  uint8_t value = _regs[reg];
+  // Flag registers clear on read
+  if (reg >= 0x22 && reg <= 0x27) _regs[reg] = 0;
+  return value;
+}
+
+void BQ25798Sim::writeRegister(uint8_t reg, uint8_t value) {
+  uint8_t mask = WRITABLE[reg];
+  if (!mask) return;
+  uint8_t old = _regs[reg];
+  uint8_t v = (old & ~mask) | (value & mask);
+  _dirty = true;
+
+  switch (reg) {
+    case 0x09:
+      if (v & 0x40) {               // REG_RST
+        powerOnReset();
+        return;
+      }
+      break;
+    case 0x0F:
+      v &= ~0x08;                   // FORCE_ICO self-clears
+      if ((v & 0x20) && !(old & 0x20)) {
+        // Re-enabling charge restarts the cycle and its timers
+        _done = false;
+        _topoffUs = 0;
+        _chargeUs = _prechargeUs = _trickleUs = 0;
+        _chargeTimerExpired = _prechargeTimerExpired = _trickleTimerExpired = false;
+      }
+      break;
+    case 0x10:
+      if (v & 0x08) {               // WD_RST
+        _watchdogUs = 0;
+        _regs[0x1B] &= ~0x20;
+      }
+      v &= ~0x08;
+      if ((v ^ old) & 0x07) _watchdogUs = 0;
+      break;
+    case 0x11:
+      v &= ~0x80;                   // FORCE_INDET self-clears
+      break;
+    case 0x13:
+      if (!_acrb[0] || !_acrb[1]) {
+        v &= ~0xC0;                 // ACDRV needs both FET pairs
+      } else if ((v & 0xC0) == 0xC0) {
+        v = (v & ~0xC0) | (old & 0xC0);   // Both inputs at once is refused
+      }
+      break;
+    case 0x15:
+      if ((v & 0x01) && !(old & 0x01)) _vocNextUs = _time;
+      if (!(v & 0x01)) _vocEndUs = 0;
+      break;
+    default:
+      break;
+  }
+
+  _regs[reg] = v;
+
+  if (reg == 0x2E) {
+    if (!(v & 0x80)) {
+      _adcNextUs = 0;
+    } else if (!(old & 0x80) || !_adcNextUs) {
+      startAdc();
+    }
+  }
+}
+
+// ==================== Time ====================
+
+void BQ25798Sim::update() {
+  uint64_t now = ModbeeNative::now();
+  while (_time < now) {
+    uint64_t end = min(now, _time + (uint64_t)BQ25798_SIM_MAX_STEP_US);
+    uint64_t event = nextEvent();
+    if (event > _time && event < end) end = event;
+    uint64_t us = end - _time;
+    _time = end;
+    step(us);
+  }
+}
+
+uint64_t BQ25798Sim::nextEvent() const {
+  uint64_t event = NEVER;
+  if (_adcNextUs) event = min(event, _adcNextUs);
+  if (_vocEndUs) event = min(event, _vocEndUs);
+  else if (bit(0x15, 0)) event = min(event, _vocNextUs);
+  uint32_t watchdog = WATCHDOG_MS[_regs[0x10] & 0x07];
+  if (watchdog) event = min(event, _time + (uint64_t)watchdog * 1000 - min(_watchdogUs, (uint64_t)watchdog * 1000));
+  return event;
+}
+
+void BQ25798Sim::step(uint64_t us) {
+  selectInput();
+
+  // I2C watchdog
+  uint32_t watchdog = WATCHDOG_MS[_regs[0x10] & 0x07];
+  if (watchdog) {
+    _watchdogUs += us;
+    if (_watchdogUs >= (uint64_t)watchdog * 1000) watchdogExpired();
+  }
+
+  // Built-in MPPT: stop switching, measure VOC, set VINDPM
+  BQ25798SimSource* source = _state.input ? _sources[_state.input - 1] : nullptr;
+  if (bit(0x15, 0) && source && !bit(0x0F, 2)) {
+    if (!_vocEndUs && _time >= _vocNextUs) {
+      _vocEndUs = _time + (uint64_t)VOC_DLY_MS[(_regs[0x15] >> 3) & 0x03] * 1000;
+      _dirty = true;
+    } else if (_vocEndUs && _time >= _vocEndUs) {
+      float vindpm = source->openCircuitVoltage() * VOC_PCT[_regs[0x15] >> 5];
+      _regs[0x05] = (uint8_t)constrain((int)lroundf(vindpm * 10.0f), 36, 220);
+      _vocEndUs = 0;
+      _vocNextUs = _time + (uint64_t)VOC_RATE_S[(_regs[0x15] >> 1) & 0x03] * US_PER_S;
+      _dirty = true;
+    }
+  } else if (_vocEndUs) {
+    _vocEndUs = 0;
+    _dirty = true;
+  }
+
+  // The operating point only moves with the registers or slowly with the
+  // battery and conditions; re-solving it on every bus access is wasted work
+  if (_dirty || _time - _solvedUs >= BQ25798_SIM_SOLVE_US) {
+    solve();
+    _solvedUs = _time;
+    _dirty = false;
+  }
+  if (_battery) _battery->step(_state.ibat, us / 1e6f);
+  chargeTimers(us);
+
+  // Termination, top-off and recharge
+  float vreg = (get16(0x01) & 0x7FF) * 0.01f;
+  float iterm = (_regs[0x09] & 0x1F) * 0.04f;
+  if (_state.chargeState == 4 && bit(0x0F, 1) && !_state.vindpm && !_state.iindpm &&
+      _state.ibat < iterm) {
+    uint32_t topoff = TOPOFF_MIN[_regs[0x0E] >> 6];
+    if (topoff) _topoffUs = (uint64_t)topoff * 60 * US_PER_S;
+    else _done = true;
+    _dirty = true;
+  }
+  float vrechg = ((_regs[0x0A] & 0x0F) + 1) * 0.05f;
+  if (_done && _battery && _state.vbat < vreg - vrechg) {
+    _done = false;
+    _chargeUs = _prechargeUs = _trickleUs = 0;
+    _dirty = true;
+  }
+
+  if (_adcNextUs && _time >= _adcNextUs) finishAdc();
+  updateStatus();
+}
+
+void BQ25798Sim::chargeTimers(uint64_t us) {
+  if (_topoffUs) {
+    if (_topoffUs <= us) {
+      _topoffUs = 0;
+      _done = true;
+      _dirty = true;
+    } else {
+      _topoffUs -= us;
+    }
+  }
+
+  bool dpm = _state.vindpm || _state.iindpm;
+  switch (_state.chargeState) {
+    case 1:
+      _trickleUs += us;
+      if (bit(0x0E, 5) && _trickleUs >= 3600 * US_PER_S) _trickleTimerExpired = true;
+      break;
+    case 2:
+      _prechargeUs += us;
+      if (bit(0x0E, 4) && _prechargeUs >= (bit(0x0D, 7) ? 1800 : 7200) * US_PER_S) {
+        _prechargeTimerExpired = true;
+      }
+      break;
+    case 3:
+    case 4:
+      // TMR2X: the safety timer runs at half speed while the input limits charge
+      _chargeUs += (bit(0x0E, 0) && dpm) ? us / 2 : us;
+      if (bit(0x0E, 3) && _chargeUs >= CHG_TMR_H[(_regs[0x0E] >> 1) & 0x03] * 3600 * US_PER_S) {
+        _chargeTimerExpired = true;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void BQ25798Sim::watchdogExpired() {
+  // Charge parameters back to POR so a hung host leaves a safe charger
+  uint8_t por[BQ25798_SIM_REGISTERS];
+  porRegisters(_cells, por);
+  bool stopCharge = bit(0x09, 5);
+  memcpy(_regs, por, 0x0F);
+  if (stopCharge) _regs[0x0F] &= ~0x20;
+  _regs[0x1B] |= 0x20;              // WD_STAT until WD_RST
+  _regs[0x22] |= 0x20;
+  _watchdogUs = 0;
+  _dirty = true;
+}
+
+// ==================== Input selection ====================
+
+void BQ25798Sim::selectInput() {
+  bool present[2];
+  bool plugged[2];
+  for (uint8_t k = 0; k < 2; k++) {
+    present[k] = _sources[k] && _sources[k]->openCircuitVoltage() > BQ25798_SIM_PRESENT_V;
+    plugged[k] = present[k] && !_present[k];
+    _present[k] = present[k];
+  }
+
+  uint8_t input;
+  if (!_acrb[0] || !_acrb[1]) {
+    // No input FETs: VAC1 and VBUS are the same node
+    input = present[0] ? 1 : 0;
+  } else if (bit(0x12, 7)) {
+    input = 0;                      // DIS_ACDRV
+  } else {
+    bool en1 = bit(0x13, 6);
+    bool en2 = bit(0x13, 7);
+    if (en1 && !present[0] && present[1]) {
+      en1 = false;
+      en2 = true;
+    } else if (en2 && !present[1] && present[0]) {
+      en2 = false;
+      en1 = true;
+    } else if (!en1 && !en2) {
+      // The first input to appear is taken, VAC1 if both come up together
+      if (plugged[0]) en1 = true;
+      else if (plugged[1]) en2 = true;
+    }
+    _regs[0x13] = (_regs[0x13] & ~0xC0) | (en2 ? 0x80 : 0) | (en1 ? 0x40 : 0);
+    input = en1 && present[0] ? 1 : en2 && present[1] ? 2 : 0;
+  }
+
+  if (input != _state.input) _dirty = true;
+  if (input && !_state.input) {
+    // A new adapter starts a new charge cycle
+    _chargeUs = _prechargeUs = _trickleUs = 0;
+    _chargeTimerExpired = _prechargeTimerExpired = _trickleTimerExpired = false;
+  }
+  _state.input = input;
+}
+
+float BQ25798Sim::vacOvp() const {
+  return VAC_OVP[(_regs[0x10] >> 4) & 0x03];
+}
+
+// ==================== Power path ====================
+
+// Battery current that makes the terminal power equal p (negative p discharges)
+static float batteryCurrent(float ocv, float r, float p) {
+  float disc = ocv * ocv + 4.0f * r * p;
+  if (disc < 0.0f) disc = 0.0f;
+  return (sqrtf(disc) - ocv) / (2.0f * r);
+}
+
+bool BQ25798Sim::solveInput(BQ25798SimSource* source, float preq, float& v, float& i,
+                            bool& vdpm, bool& idpm) {
+  float voc = source->openCircuitVoltage();
+  float vindpm = _regs[0x05] * 0.1f;
+  float iindpm = (get16(0x06) & 0x1FF) * 0.01f;
+  vdpm = idpm = false;
+  v = voc;
+  i = 0.0f;
+  if (preq <= 0.0f) return true;
+  if (vindpm >= voc) {
+    vdpm = true;
+    return false;
+  }
+
+  // Walk VBUS down from VOC until the power is there or a limit is hit
+  const int steps = 64;
+  float hi = voc;
+  for (int k = 1; k <= steps; k++) {
+    float lo = voc - (voc - vindpm) * k / steps;
+    float ilo = source->current(lo);
+    if (ilo * lo < preq && ilo < iindpm) {
+      hi = lo;
+      continue;
+    }
+    for (int n = 0; n < 20; n++) {
+      float mid = 0.5f * (hi + lo);
+      float imid = source->current(mid);
+      if (imid * mid < preq && imid < iindpm) hi = mid;
+      else lo = mid;
+    }
+    v = lo;
+    i = source->current(lo);
+    if (i >= iindpm && iindpm * lo < preq) {
+      i = iindpm;
+      idpm = true;
+      return false;
+    }
+    i = preq / v;
+    return true;
+  }
+  v = vindpm;
+  i = min(source->current(vindpm), iindpm);
+  vdpm = true;
+  return false;
+}
+
+void BQ25798Sim::solve() {
+  bq25798_sim_state_t& s = _state;
+  for (uint8_t k = 0; k < 2; k++) s.vac[k] = _sources[k] ? _sources[k]->openCircuitVoltage() : 0.0f;
+  s.batteryTemperature = _batteryTemperature;
+  s.vindpm = s.iindpm = false;
+  s.vocSampling = _vocEndUs != 0;
+
+  BQ25798SimSource* source = s.input ? _sources[s.input - 1] : nullptr;
+  bool ovp = source && source->openCircuitVoltage() > vacOvp();
+  s.converter = source && !ovp && !bit(0x0F, 2) && !s.vocSampling;
+
+  float ocv = _battery ? _battery->openCircuitVoltage() : 0.0f;
+  float r = _battery ? max(_battery->resistance(), 0.001f) : 0.001f;
+  float vsysmin = 2.5f + (_regs[0x00] & 0x3F) * 0.25f;
+  float vreg = (get16(0x01) & 0x7FF) * 0.01f;
+  uint8_t cells = (_regs[0x0A] >> 6) + 1;
+
+  // What the charge state machine asks for
+  bool tsSuspend = !bit(0x18, 0) && (_batteryTemperature < 0.0f || _batteryTemperature > 60.0f);
+  bool timerFault = _chargeTimerExpired || _prechargeTimerExpired || _trickleTimerExpired;
+  bool charge = s.converter && _battery && bit(0x0F, 5) && !bit(0x0F, 6) && !tsSuspend && !timerFault;
+  float target = 0.0f;
+  s.chargeState = 0;
+  if (charge && _done) {
+    s.chargeState = 7;
+  } else if (charge) {
+    if (ocv < BQ25798_SIM_VBAT_SHORT * cells) {
+      s.chargeState = 1;
+      target = BQ25798_SIM_ITRICKLE;
+    } else if (ocv < vreg * VBAT_LOWV[_regs[0x08] >> 6]) {
+      s.chargeState = 2;
+      target = (_regs[0x08] & 0x3F) * 0.04f;
+    } else {
+      target = (get16(0x03) & 0x1FF) * 0.01f;
+      float cv = (vreg - ocv) / r;
+      s.chargeState = cv < target ? 4 : 3;
+      target = constrain(cv, 0.0f, target);
+      if (_topoffUs) s.chargeState = 6;
+    }
+  }
+  if (s.converter && _battery && bit(0x0F, 6)) target = -BQ25798_SIM_IBATDIS;
+
+  if (!_battery) {
+    s.vbat = 0.0f;
+    s.ibat = 0.0f;
+    s.vsys = s.converter ? vsysmin : 0.0f;
+  } else {
+    s.vbat = ocv + target * r;
+    s.vsys = max(s.vbat, vsysmin);
+  }
+  float psys = s.vsys * _load;
+
+  if (!s.converter) {
+    s.vbus = source ? source->openCircuitVoltage() : 0.0f;
+    s.ibus = 0.0f;
+    if (_battery) {
+      s.ibat = batteryCurrent(ocv, r, -psys);
+      s.vbat = ocv + s.ibat * r;
+      s.vsys = s.vbat;
+    }
+  } else {
+    float pbat = _battery ? s.vsys * target : 0.0f;
+    float preq = (psys + max(pbat, 0.0f)) / BQ25798_SIM_EFFICIENCY;
+    bool idpm, vdpm;
+    solveInput(source, preq, s.vbus, s.ibus, vdpm, idpm);
+    s.vindpm = vdpm;
+    s.iindpm = idpm;
+    if (_battery) {
+      if (vdpm || idpm) {
+        // Input-limited: the battery gets what is left, or supplements the system
+        s.ibat = min(batteryCurrent(ocv, r, s.vbus * s.ibus * BQ25798_SIM_EFFICIENCY - psys), target);
+        s.vbat = ocv + s.ibat * r;
+        s.vsys = max(s.vbat, vsysmin);
+      } else {
+        s.ibat = target;
+      }
+    }
+  }
+
+  float loss = s.vbus * s.ibus * (1.0f - BQ25798_SIM_EFFICIENCY);
+  s.tdie = _ambient + loss * BQ25798_SIM_RTH_DIE;
+  if (s.input) {
+    s.vac[s.input - 1] = s.vbus;
+  } else if (_sources[0] && (!_acrb[0] || !_acrb[1])) {
+    s.vac[0] = s.vbus;
+  }
+}
+
+// ==================== ADC ====================
+
+void BQ25798Sim::startAdc() {
+  uint8_t channels = 0;
+  for (uint8_t b = 1; b <= 7; b++) channels += !bit(0x2F, b);
+  for (uint8_t b = 4; b <= 7; b++) channels += !bit(0x30, b);
+  uint32_t cycle = ADC_CHANNEL_US[(_regs[0x2E] >> 4) & 0x03] * max(channels, (uint8_t)1);
+  _adcNextUs = _time + cycle;
+  _adcOneShotDone = false;
+}
+
+float BQ25798Sim::tsPercent() const {
+  float t = _batteryTemperature + 273.15f;
+  float ntc = BQ25798_SIM_NTC_R25 * expf(BQ25798_SIM_NTC_BETA * (1.0f / t - 1.0f / 298.15f));
+  return 100.0f * ntc / (BQ25798_SIM_NTC_PULLUP + ntc);
+}
+
+void BQ25798Sim::finishAdc() {
+  const bq25798_sim_state_t& s = _state;
+  // Disabled channels keep their last result
+  if (!bit(0x2F, 7)) set16(0x31, (uint16_t)(int16_t)lroundf(s.ibus * 1000.0f));
+  if (!bit(0x2F, 6)) set16(0x33, (uint16_t)(int16_t)lroundf(s.ibat * 1000.0f));
+  if (!bit(0x2F, 5)) set16(0x35, (uint16_t)lroundf(s.vbus * 1000.0f));
+  if (!bit(0x30, 4)) set16(0x37, (uint16_t)lroundf(s.vac[0] * 1000.0f));
+  if (!bit(0x30, 5)) set16(0x39, (uint16_t)lroundf(s.vac[1] * 1000.0f));
+  if (!bit(0x2F, 4)) set16(0x3B, (uint16_t)lroundf(s.vbat * 1000.0f));
+  if (!bit(0x2F, 3)) set16(0x3D, (uint16_t)lroundf(s.vsys * 1000.0f));
+  if (!bit(0x2F, 2)) set16(0x3F, (uint16_t)lroundf(tsPercent() / 0.0976563f));
+  if (!bit(0x2F, 1)) set16(0x41, (uint16_t)(int16_t)lroundf(s.tdie * 2.0f));
+  if (!bit(0x30, 7)) set16(0x43, 0);
+  if (!bit(0x30, 6)) set16(0x45, 0);
+
+  if (bit(0x2E, 6)) {
+    // One-shot: done, ADC_EN drops
+    _regs[0x2E] &= ~0x80;
+    _adcNextUs = 0;
+    _adcOneShotDone = true;
+  } else {
+    startAdc();
+  }
+}
+
+// ==================== Status and flags ====================
+
+void BQ25798Sim::updateStatus() {
+  const bq25798_sim_state_t& s = _state;
+  uint8_t old[7];
+  memcpy(old, &_regs[0x1B], sizeof(old));
+
+  BQ25798SimSource* source = s.input ? _sources[s.input - 1] : nullptr;
+  bool activeOvp = source && source->openCircuitVoltage() > vacOvp();
+  float t = _batteryTemperature;
+
+  _regs[0x1B] = (s.iindpm ? 0x80 : 0) | (s.vindpm ? 0x40 : 0) | (old[0] & 0x20) |
+                (source && !activeOvp ? 0x08 : 0) | (_present[1] ? 0x04 : 0) |
+                (_present[0] ? 0x02 : 0) | (s.input ? 0x01 : 0);
+  // Floating D+/D- on a solar or bench input: BC1.2 ends as an unknown adapter
+  _regs[0x1C] = (uint8_t)(s.chargeState << 5) | (s.input ? (0x5 << 1) | 0x01 : 0);
+  _regs[0x1D] = (bit(0x0F, 4) && s.converter ? 0x80 : 0) |
+                (s.tdie > TREG_C[_regs[0x16] >> 6] ? 0x04 : 0) |
+                (_battery && s.vbat > 2.0f ? 0x01 : 0);
+  _regs[0x1E] = (_acrb[1] ? 0x80 : 0) | (_acrb[0] ? 0x40 : 0) | (_adcOneShotDone ? 0x20 : 0) |
+                (s.converter && s.vsys > s.vbat + 0.01f ? 0x10 : 0) |
+                (_chargeTimerExpired ? 0x08 : 0) | (_trickleTimerExpired ? 0x04 : 0) |
+                (_prechargeTimerExpired ? 0x02 : 0);
+  _regs[0x1F] = (t < 0.0f ? 0x08 : 0) | (t >= 0.0f && t < 10.0f ? 0x04 : 0) |
+                (t > 45.0f && t <= 60.0f ? 0x02 : 0) | (t > 60.0f ? 0x01 : 0);
+  _regs[0x20] = (activeOvp ? 0x40 : 0) | (s.vac[1] > vacOvp() ? 0x02 : 0) |
+                (s.vac[0] > vacOvp() ? 0x01 : 0);
+  _regs[0x21] = s.tdie > TSHUT_C[(_regs[0x16] >> 4) & 0x03] ? 0x04 : 0;
+
+  const uint8_t* now = &_regs[0x1B];
+  _regs[0x22] |= (old[0] ^ now[0]) & 0xCF;
+  if ((old[1] ^ now[1]) & 0xE0) _regs[0x23] |= 0x80;
+  if ((old[2] ^ now[2]) & 0xC0) _regs[0x23] |= 0x40;
+  if ((old[1] ^ now[1]) & 0x1E) _regs[0x23] |= 0x10;
+  if ((old[2] ^ now[2]) & 0x04) _regs[0x23] |= 0x04;
+  if ((old[2] ^ now[2]) & 0x01) _regs[0x23] |= 0x02;
+  if (~old[1] & now[1] & 0x01) _regs[0x23] |= 0x01;
+  _regs[0x24] |= (~old[3] & now[3] & 0x2E) | ((old[3] ^ now[3]) & 0x10);
+  _regs[0x25] |= (old[4] ^ now[4]) & 0x1F;
+  _regs[0x26] |= ~old[5] & now[5];
+  _regs[0x27] |= ~old[6] & now[6];
+}
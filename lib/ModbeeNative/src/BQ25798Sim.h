@@ -0,0 +1,226 @@
+/*!
+ * @file BQ25798Sim.h
+ *
+ * @brief Register-level BQ25798 simulator for the native build
+ *
+ * Sits on the simulated I2C bus at 0x6B and answers the driver byte by byte:
+ * a register pointer followed by auto-incrementing reads or writes, 16-bit
+ * registers MSB first. Behind the registers it runs the parts of the charger
+ * the firmware can observe:
+ * - POR defaults by cell count (the PROG pin), writable-bit masks, self-
+ *   clearing command bits (REG_RST, WD_RST, FORCE_ICO, FORCE_INDET);
+ * - the I2C watchdog, which resets the charge parameters when it expires;
+ * - the ADC in continuous or one-shot mode, with conversion time set by the
+ *   resolution and the enabled channels, results held while it is off;
+ * - charge states (trickle, pre-charge, CC, CV, top-off, done, recharge),
+ *   the safety timers and TS cold/hot suspend;
+ * - VINDPM/IINDPM regulation against the source's I-V curve, the VOC
+ *   sampling of the built-in MPPT, VAC over-voltage faults;
+ * - VAC1/VAC2 selection through ACDRV1/ACDRV2 when both ACFET-RBFET pairs
+ *   are fitted, including failover when the active input disappears;
+ * - status registers, and flag registers that latch changes and clear on
+ *   read.
+ *
+ * The electrical side is deliberately small: the inputs are
+ * BQ25798SimSource curves, the battery is a BQ25798SimBattery, the
+ * converter has a fixed efficiency and the system draws a constant current.
+ * BQ25798SimPlant.h has the PV panel, battery and condition models.
+ */
+
+#ifndef BQ25798_SIM_H
+#define BQ25798_SIM_H
+
+#include "ModbeeNative.h"
+
+#define BQ25798_SIM_ADDRESS 0x6B
+#define BQ25798_SIM_REGISTERS 0x49
+
+#define BQ25798_SIM_MAX_STEP_US 100000ULL   // Longest physics step between events
+#define BQ25798_SIM_SOLVE_US 50000ULL       // Operating point reused for this long unless registers change
+#define BQ25798_SIM_EFFICIENCY 0.93f        // Converter efficiency
+#define BQ25798_SIM_RTH_DIE 25.0f           // Die heating (°C per W of loss)
+#define BQ25798_SIM_PRESENT_V 3.4f          // VBUS/VAC present threshold
+#define BQ25798_SIM_ITRICKLE 0.1f           // Below VBAT_SHORT (A)
+#define BQ25798_SIM_VBAT_SHORT 2.2f         // Per cell
+#define BQ25798_SIM_IBATDIS 0.03f           // FORCE_IBATDIS sink (A)
+#define BQ25798_SIM_NTC_PULLUP 10000.0f     // Board TS network: 10k pull-up to REGN ...
+#define BQ25798_SIM_NTC_R25 10000.0f        // ... and a 10k NTC to ground
+#define BQ25798_SIM_NTC_BETA 3380.0f
+
+/*!
+ * @brief An input source seen through its I-V curve
+ */
+class BQ25798SimSource {
+public:
+  virtual ~BQ25798SimSource() {}
+  virtual float openCircuitVoltage() = 0;
+
+  /*!
+   * @brief Current the source delivers with its terminals at this voltage
+   */
+  virtual float current(float voltage) = 0;
+};
+
+/*!
+ * @brief Bench supply: voltage behind a series resistance, with a current limit
+ */
+class BQ25798SimSupply : public BQ25798SimSource {
+public:
+  BQ25798SimSupply(float voltage, float resistance = 0.1f, float currentLimit = 5.0f)
+    : voltage(voltage), resistance(resistance), currentLimit(currentLimit) {}
+
+  float openCircuitVoltage() override { return voltage; }
+  float current(float v) override {
+    if (v >= voltage) return 0.0f;
+    return min((voltage - v) / resistance, currentLimit);
+  }
+
+  float voltage;
+  float resistance;
+  float currentLimit;
+};
+
+/*!
+ * @brief Battery seen by the charger: a voltage behind a series resistance
+ *
+ * openCircuitVoltage() is the voltage behind the resistance, OCV plus any
+ * polarisation the model keeps (see BQ25798SimCell).
+ */
+class BQ25798SimBattery {
+public:
+  virtual ~BQ25798SimBattery() {}
+  virtual float openCircuitVoltage() = 0;
+  virtual float resistance() = 0;
+
+  /*!
+   * @brief Apply a current (positive = charging) for a time step
+   */
+  virtual void step(float current, float seconds) = 0;
+};
+
+/*!
+ * @brief What the charger is doing, for host code and reports
+ */
+typedef struct {
+  float vac[2];                 // VAC1/VAC2 pin voltage
+  float vbus;
+  float ibus;
+  float vbat;                   // Terminal voltage
+  float ibat;                   // Positive = charging
+  float vsys;
+  float tdie;
+  float batteryTemperature;
+  uint8_t input;                // 1 = VAC1, 2 = VAC2, 0 = none
+  bool converter;               // Switching (not HIZ, not sampling VOC)
+  bool vocSampling;             // Built-in MPPT measuring VOC
+  uint8_t chargeState;          // CHG_STAT
+  bool vindpm;
+  bool iindpm;
+} bq25798_sim_state_t;
+
+class BQ25798Sim : public ModbeeNativeI2CDevice {
+public:
+  /*!
+   * @param cells Cell count strapped on PROG, sets the POR charge parameters
+   */
+  BQ25798Sim(uint8_t cells = 3);
+
+  /*!
+   * @brief Connect a source to VAC1 (1) or VAC2 (2), nullptr for nothing
+   */
+  void attachInput(uint8_t input, BQ25798SimSource* source);
+
+  /*!
+   * @brief Fit the ACFET-RBFET pairs (both are needed to switch inputs)
+   */
+  void setInputFets(bool acrb1, bool acrb2);
+
+  void attachBattery(BQ25798SimBattery* battery) { _battery = battery; _dirty = true; }
+  void setSystemLoad(float amps) { _load = amps; _dirty = true; }
+  void setTemperature(float ambient) { _ambient = ambient; _batteryTemperature = ambient; }
+  void setBatteryTemperature(float celsius) { _batteryTemperature = celsius; }
+
+  /*!
+   * @brief Run the charger up to the virtual clock
+   */
+  void update();
+
+  /*!
+   * @brief POR: every register to its default, timers and ADC cleared
+   */
+  void powerOnReset();
+
+  const bq25798_sim_state_t& state() const { return _state; }
+
+  /*!
+   * @brief Register access for host code, without bus side effects
+   */
+  uint8_t peek(uint8_t reg) const { return reg < BQ25798_SIM_REGISTERS ? _regs[reg] : 0; }
+
+  // ModbeeNativeI2CDevice
+  void i2cStart(bool read) override;
+  bool i2cWrite(uint8_t data) override;
+  uint8_t i2cRead(bool ack) override;
+
+private:
+  uint8_t _cells;
+  uint8_t _regs[BQ25798_SIM_REGISTERS];
+  uint8_t _pointer;
+  bool _expectPointer;
+
+  BQ25798SimSource* _sources[2];
+  BQ25798SimBattery* _battery;
+  bool _acrb[2];
+  bool _present[2];
+  float _load;
+  float _ambient;
+  float _batteryTemperature;
+
+  uint64_t _time;               // Virtual time the charger has run to (µs)
+  bq25798_sim_state_t _state;
+  uint64_t _solvedUs;           // When _state was last solved
+  bool _dirty;                  // Registers or inputs changed since
+
+  // Charger state
+  bool _done;
+  uint64_t _topoffUs;           // Time left in top-off, 0 = not in top-off
+  uint64_t _chargeUs;           // Fast-charge safety timer
+  uint64_t _prechargeUs;
+  uint64_t _trickleUs;
+  bool _chargeTimerExpired;
+  bool _prechargeTimerExpired;
+  bool _trickleTimerExpired;
+
+  // Watchdog
+  uint64_t _watchdogUs;         // Time since the last reset
+
+  // ADC
+  uint64_t _adcNextUs;          // End of the running conversion cycle, 0 = idle
+  bool _adcOneShotDone;
+
+  // Built-in MPPT
+  uint64_t _vocNextUs;          // Next VOC measurement
+  uint64_t _vocEndUs;           // End of the running measurement, 0 = none
+
+  void writeRegister(uint8_t reg, uint8_t value);
+  uint8_t readRegister(uint8_t reg);
+  uint16_t get16(uint8_t reg) const { return (uint16_t)_regs[reg] << 8 | _regs[reg + 1]; }
+  void set16(uint8_t reg, uint16_t value) { _regs[reg] = value >> 8; _regs[reg + 1] = value & 0xFF; }
+  bool bit(uint8_t reg, uint8_t b) const { return (_regs[reg] >> b) & 1; }
+
+  uint64_t nextEvent() const;
+  void step(uint64_t us);
+  void selectInput();
+  void solve();
+  bool solveInput(BQ25798SimSource* source, float preq, float& v, float& i, bool& vdpm, bool& idpm);
+  void chargeTimers(uint64_t us);
+  void startAdc();
+  void finishAdc();
+  void updateStatus();
+  void watchdogExpired();
+
+  float vacOvp() const;
+  float tsPercent() const;
+};
+
+#endif // BQ25798_SIM_H
@@ -0,0 +1,214 @@
+#include "BQ25798SimPlant.h"
+#include <algorithm>
+#include <math.h>
+
+#define BOLTZMANN_OVER_Q 8.617333e-5f       // k/q (V/K)
+
+// ==================== Chemistry presets ====================
+
+static const bq25798_sim_chemistry_preset_t PRESETS[] = {
+  {"lifepo4", {2.50f, 3.10f, 3.22f, 3.26f, 3.28f, 3.30f, 3.31f, 3.32f, 3.34f, 3.36f, 3.42f},
+   0.25f, 0.15f, 120.0f, 0.995f, 3.60f},
+  {"lipo", {3.00f, 3.45f, 3.60f, 3.68f, 3.74f, 3.79f, 3.85f, 3.93f, 4.01f, 4.09f, 4.19f},
+   0.30f, 0.20f, 60.0f, 0.99f, 4.20f},
+  {"lead", {1.930f, 1.955f, 1.975f, 1.995f, 2.010f, 2.030f, 2.045f, 2.060f, 2.080f, 2.100f, 2.120f},
+   0.25f, 0.30f, 600.0f, 0.90f, 2.40f},
+};
+
+// Charge pushed into a full battery goes into gassing/side reactions: the RC
+// pair resistance rises by this factor so the current tapers at VREG
+#define OVERCHARGE_R1_FACTOR 20.0f
+
+// ==================== Panel ====================
+
+BQ25798SimPanel::BQ25798SimPanel(float vocStc, float iscStc, uint8_t cells)
+  : _vocStc(vocStc), _iscStc(iscStc), _cells(cells) {
+  setConditions(0.0f, 25.0f);
+}
+
+void BQ25798SimPanel::setConditions(float irradiance, float ambient) {
+  _cellTemperature = ambient + max(irradiance, 0.0f) / 800.0f * (BQ25798_SIM_PV_NOCT - 20.0f);
+  float dt = _cellTemperature - 25.0f;
+  _a = BQ25798_SIM_PV_IDEALITY * _cells * BOLTZMANN_OVER_Q * (_cellTemperature + 273.15f);
+  _iph = _iscStc * irradiance / BQ25798_SIM_PV_STC_IRRADIANCE * (1.0f + BQ25798_SIM_PV_ISC_TEMPCO * dt);
+  _voc = 0.0f;
+  _i0 = 0.0f;
+  if (_iph <= 0.0f) {
+    _iph = 0.0f;
+    return;
+  }
+  float voc = _vocStc * (1.0f + BQ25798_SIM_PV_VOC_TEMPCO * dt) +
+              _a * logf(irradiance / BQ25798_SIM_PV_STC_IRRADIANCE);
+  if (voc <= 0.0f) {
+    _iph = 0.0f;
+    return;
+  }
+  _voc = voc;
+  _i0 = _iph / expm1f(_voc / _a);
+}
+
+float BQ25798SimPanel::current(float voltage) {
+  if (voltage >= _voc) return 0.0f;
+  if (voltage <= 0.0f) return _iph;
+  return _iph - _i0 * expm1f(voltage / _a);
+}
+
+float BQ25798SimPanel::maximumPower(float* voltage) {
+  if (_voc <= 0.0f) {
+    if (voltage) *voltage = 0.0f;
+    return 0.0f;
+  }
+  // Golden-section search, P(V) is unimodal on the single-diode curve
+  const float g = 0.618034f;
+  float lo = 0.0f, hi = _voc;
+  float x1 = hi - g * (hi - lo), x2 = lo + g * (hi - lo);
+  float p1 = x1 * current(x1), p2 = x2 * current(x2);
+  for (int i = 0; i < 30; i++) {
+    if (p1 < p2) {
+      lo = x1;
+      x1 = x2;
+      p1 = p2;
+      x2 = lo + g * (hi - lo);
+      p2 = x2 * current(x2);
+    } else {
+      hi = x2;
+      x2 = x1;
+      p2 = p1;
+      x1 = hi - g * (hi - lo);
+      p1 = x1 * current(x1);
+    }
+  }
+  float v = 0.5f * (lo + hi);
+  if (voltage) *voltage = v;
+  return v * current(v);
+}
+
+// ==================== Battery ====================
+
+BQ25798SimCell::BQ25798SimCell(bq25798_sim_chemistry_t chemistry, uint8_t cells, float capacityAh,
+                               float soc)
+  : chemistry(chemistry), cells(cells), capacityAh(capacityAh), soc(constrain(soc, 0.0f, 1.0f)),
+    polarisation(0.0f), chargedAh(0.0), dischargedAh(0.0), _preset(&preset(chemistry)) {}
+
+const bq25798_sim_chemistry_preset_t& BQ25798SimCell::preset(bq25798_sim_chemistry_t chemistry) {
+  return PRESETS[chemistry <= BQ25798_SIM_LEAD_ACID ? chemistry : BQ25798_SIM_LIPO];
+}
+
+bool BQ25798SimCell::parse(const char* name, bq25798_sim_chemistry_t& chemistry) {
+  for (uint8_t i = 0; i < sizeof(PRESETS) / sizeof(PRESETS[0]); i++) {
+    if (!strcasecmp(name, PRESETS[i].name)) {
+      chemistry = (bq25798_sim_chemistry_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+float BQ25798SimCell::restedVoltage() const {
+  float x = soc * (BQ25798_SIM_OCV_POINTS - 1);
+  int i = min((int)x, BQ25798_SIM_OCV_POINTS - 2);
+  const float* ocv = _preset->ocv;
+  return cells * (ocv[i] + (ocv[i + 1] - ocv[i]) * (x - i));
+}
+
+void BQ25798SimCell::step(float current, float seconds) {
+  float r1 = cells * _preset->r1Ah / capacityAh;
+  if (soc >= 1.0f && current > 0.0f) r1 *= OVERCHARGE_R1_FACTOR;
+  float decay = expf(-seconds / _preset->tau);
+  polarisation = polarisation * decay + current * r1 * (1.0f - decay);
+
+  double ah = (double)current * seconds / 3600.0;
+  if (ah > 0.0) {
+    ah *= _preset->efficiency;
+    chargedAh += ah;
+  } else {
+    dischargedAh -= ah;
+  }
+  soc = constrain(soc + (float)(ah / capacityAh), 0.0f, 1.0f);
+}
+
+// ==================== Trace ====================
+
+bool BQ25798SimTrace::load(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) return false;
+  std::vector<bq25798_sim_trace_point_t> points;
+  char line[256];
+  bool ok = true;
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#') continue;
+    bq25798_sim_trace_point_t point;
+    char* p = line;
+    char* end;
+    point.seconds = strtod(p, &end);
+    if (end == p) continue;   // Header or blank line
+    p = end + (*end == ',');
+    point.irradiance = strtof(p, &end);
+    if (end == p) {
+      ok = false;
+      break;
+    }
+    p = end + (*end == ',');
+    point.ambient = strtof(p, &end);
+    if (end == p) point.ambient = 25.0f;
+    p = end + (*end == ',');
+    point.load = strtof(p, &end);
+    if (end == p) point.load = NAN;
+    if (!points.empty() && point.seconds <= points.back().seconds) {
+      ok = false;
+      break;
+    }
+    points.push_back(point);
+  }
+  fclose(file);
+  if (!ok || points.empty()) return false;
+  _points.swap(points);
+  return true;
+}
+
+void BQ25798SimTrace::clearSky(float peak, float ambientMin, float ambientMax, float clouds,
+                               uint32_t seed) {
+  _points.clear();
+  uint32_t state = seed ? seed : 1;
+  float cover = 0.0f;
+  for (int minute = 0; minute <= 24 * 60; minute++) {
+    float hour = minute / 60.0f;
+    float sun = (hour > 6.0f && hour < 18.0f) ? sinf((float)M_PI * (hour - 6.0f) / 12.0f) : 0.0f;
+    // Cloud cover: a smoothed random walk, dimming the sun by up to 75 %
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    cover = 0.85f * cover + 0.15f * ((state >> 8) / 16777216.0f);
+    float dim = 1.0f - constrain(clouds, 0.0f, 1.0f) * 0.75f * min(cover * 2.0f, 1.0f);
+    bq25798_sim_trace_point_t point;
+    point.seconds = minute * 60.0;
+    point.irradiance = peak * sun * dim;
+    // Coldest at 03:00, warmest at 15:00
+    point.ambient = 0.5f * (ambientMin + ambientMax) +
+                    0.5f * (ambientMax - ambientMin) * sinf(2.0f * (float)M_PI * (hour - 9.0f) / 24.0f);
+    point.load = NAN;
+    _points.push_back(point);
+  }
+}
+
+bq25798_sim_trace_point_t BQ25798SimTrace::at(double seconds) const {
+  bq25798_sim_trace_point_t point = {seconds, 0.0f, 25.0f, NAN};
+  if (_points.empty()) return point;
+  double t = period() > 0.0 ? fmod(seconds, period()) : 0.0;
+  auto next = std::upper_bound(_points.begin(), _points.end(), t,
+                               [](double s, const bq25798_sim_trace_point_t& p) { return s < p.seconds; });
+  if (next == _points.begin() || next == _points.end()) {
+    const bq25798_sim_trace_point_t& edge = next == _points.end() ? _points.back() : _points.front();
+    point.irradiance = edge.irradiance;
+    point.ambient = edge.ambient;
+    point.load = edge.load;
+    return point;
+  }
+  const bq25798_sim_trace_point_t& a = *(next - 1);
+  const bq25798_sim_trace_point_t& b = *next;
+  float f = (float)((t - a.seconds) / (b.seconds - a.seconds));
+  point.irradiance = a.irradiance + (b.irradiance - a.irradiance) * f;
+  point.ambient = a.ambient + (b.ambient - a.ambient) * f;
+  point.load = a.load + (b.load - a.load) * f;   // NAN if the trace has no load column
+  return point;
+}
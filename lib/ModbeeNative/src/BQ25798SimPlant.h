@@ -0,0 +1,169 @@
+/*!
+ * @file BQ25798SimPlant.h
+ *
+ * @brief Plant models for the simulated charger: PV panel, battery, conditions
+ *
+ * - BQ25798SimPanel: single-diode PV model, photo current scaled by
+ *   irradiance, VOC and ISC corrected for cell temperature (NOCT model).
+ * - BQ25798SimCell: battery equivalent circuit, rested OCV table per
+ *   chemistry, series resistance and one RC pair, coulombic efficiency.
+ * - BQ25798SimTrace: irradiance, ambient temperature and VSYS load over
+ *   time, from a CSV file or a generated clear-sky day.
+ *
+ * The chemistry presets are the plant's own curves, not the firmware's
+ * ModbeeMpptOcv tables, so SOC estimates are judged against a battery that
+ * does not share the estimator's model.
+ */
+
+#ifndef BQ25798_SIM_PLANT_H
+#define BQ25798_SIM_PLANT_H
+
+#include "BQ25798Sim.h"
+#include <vector>
+
+// PV panel
+#define BQ25798_SIM_PV_IDEALITY 1.3f        // Diode ideality factor
+#define BQ25798_SIM_PV_NOCT 45.0f           // Cell temperature at 800 W/m², 20 °C (°C)
+#define BQ25798_SIM_PV_VOC_TEMPCO -0.0032f  // VOC change per °C (fraction)
+#define BQ25798_SIM_PV_ISC_TEMPCO 0.0005f   // ISC change per °C (fraction)
+#define BQ25798_SIM_PV_STC_IRRADIANCE 1000.0f
+
+#define BQ25798_SIM_OCV_POINTS 11           // Battery OCV table: 0, 10 .. 100 % SOC
+
+typedef enum {
+  BQ25798_SIM_LIFEPO4 = 0,        // Same order as modbee_battery_type_t
+  BQ25798_SIM_LIPO,
+  BQ25798_SIM_LEAD_ACID
+} bq25798_sim_chemistry_t;
+
+typedef struct {
+  const char* name;
+  float ocv[BQ25798_SIM_OCV_POINTS];  // Rested OCV per cell (V)
+  float r0Ah;                         // Series resistance x capacity, per cell (ohm Ah)
+  float r1Ah;                         // RC pair resistance x capacity, per cell (ohm Ah)
+  float tau;                          // RC pair time constant (s)
+  float efficiency;                   // Coulombic efficiency while charging
+  float chargeVoltage;                // Per cell (V)
+} bq25798_sim_chemistry_preset_t;
+
+/*!
+ * @brief PV panel on the single-diode model (no series or shunt resistance)
+ */
+class BQ25798SimPanel : public BQ25798SimSource {
+public:
+  /*!
+   * @param vocStc Open-circuit voltage at STC (1000 W/m², 25 °C cell)
+   * @param iscStc Short-circuit current at STC
+   * @param cells Series cells (36 for a "12 V" panel)
+   */
+  BQ25798SimPanel(float vocStc = 21.6f, float iscStc = 1.22f, uint8_t cells = 36);
+
+  /*!
+   * @brief Set the irradiance (W/m²) and ambient temperature (°C)
+   */
+  void setConditions(float irradiance, float ambient);
+
+  float openCircuitVoltage() override { return _voc; }
+  float current(float voltage) override;
+
+  /*!
+   * @brief Power at the maximum power point
+   * @param voltage Optional, set to the MPP voltage
+   */
+  float maximumPower(float* voltage = nullptr);
+
+  float cellTemperature() const { return _cellTemperature; }
+
+private:
+  float _vocStc;
+  float _iscStc;
+  uint8_t _cells;
+  float _cellTemperature;
+  float _voc;
+  float _iph;                     // Photo current
+  float _i0;                      // Diode saturation current
+  float _a;                       // Modified ideality factor n * Ns * kT/q (V)
+};
+
+/*!
+ * @brief Battery equivalent circuit with chemistry presets
+ *
+ * The terminal voltage is OCV(SOC) + V_RC + I * R0, with the RC pair
+ * integrated exactly over each step. The charger sees OCV + V_RC behind R0.
+ */
+class BQ25798SimCell : public BQ25798SimBattery {
+public:
+  BQ25798SimCell(bq25798_sim_chemistry_t chemistry, uint8_t cells, float capacityAh, float soc);
+
+  float openCircuitVoltage() override { return restedVoltage() + polarisation; }
+  float resistance() override { return cells * _preset->r0Ah / capacityAh; }
+  void step(float current, float seconds) override;
+
+  /*!
+   * @brief OCV of the pack at the present SOC, without polarisation
+   */
+  float restedVoltage() const;
+
+  const bq25798_sim_chemistry_preset_t& preset() const { return *_preset; }
+
+  static const bq25798_sim_chemistry_preset_t& preset(bq25798_sim_chemistry_t chemistry);
+
+  /*!
+   * @brief Chemistry from its preset name ("lifepo4", "lipo", "lead")
+   */
+  static bool parse(const char* name, bq25798_sim_chemistry_t& chemistry);
+
+  bq25798_sim_chemistry_t chemistry;
+  uint8_t cells;
+  float capacityAh;
+  float soc;                      // 0..1
+  float polarisation;             // RC pair voltage (V)
+  double chargedAh;               // Charge in, after coulombic losses
+  double dischargedAh;
+
+private:
+  const bq25798_sim_chemistry_preset_t* _preset;
+};
+
+typedef struct {
+  double seconds;
+  float irradiance;               // W/m²
+  float ambient;                  // °C
+  float load;                     // VSYS load (A), NAN = not in the trace
+} bq25798_sim_trace_point_t;
+
+/*!
+ * @brief Conditions over time, interpolated linearly and repeated
+ *
+ * The trace repeats with a period of its last time stamp, so a one-day
+ * trace replays any number of days.
+ */
+class BQ25798SimTrace {
+public:
+  /*!
+   * @brief Load a CSV trace: seconds,irradiance,ambient[,load]
+   *
+   * Lines starting with '#' and a non-numeric header line are skipped. Time
+   * stamps must increase.
+   */
+  bool load(const char* path);
+
+  /*!
+   * @brief Generate one day at one-minute resolution
+   * @param peak Irradiance at solar noon (W/m²), sunrise 06:00, sunset 18:00
+   * @param ambientMin Temperature at 03:00, rising to ambientMax at 15:00
+   * @param clouds 0 = clear, 1 = heavily overcast; passing clouds dim the sun
+   * @param seed Seed for the cloud pattern, so runs are repeatable
+   */
+  void clearSky(float peak, float ambientMin, float ambientMax, float clouds = 0.0f,
+                uint32_t seed = 1);
+
+  bq25798_sim_trace_point_t at(double seconds) const;
+  double period() const { return _points.empty() ? 0.0 : _points.back().seconds; }
+  bool empty() const { return _points.empty(); }
+
+private:
+  std::vector<bq25798_sim_trace_point_t> _points;
+};
+
+#endif // BQ25798_SIM_PLANT_H
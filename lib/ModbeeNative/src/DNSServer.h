@@ -0,0 +1,22 @@
+/*!
+ * @file DNSServer.h
+ *
+ * @brief Host stand-in for the captive portal DNS server
+ */
+
+#ifndef MODBEE_NATIVE_DNS_SERVER_H
+#define MODBEE_NATIVE_DNS_SERVER_H
+
+#include <WiFi.h>
+
+class DNSServer {
+public:
+  bool start(uint16_t port, const String& domainName, const IPAddress& resolvedIP) {
+    (void)port; (void)domainName; (void)resolvedIP;
+    return true;
+  }
+  void stop() {}
+  void processNextRequest() {}
+};
+
+#endif // MODBEE_NATIVE_DNS_SERVER_H
@@ -0,0 +1,48 @@
+/*!
+ * @file ESP32_SoftWire.h
+ *
+ * @brief Host stand-in for ESP32_SoftWire, on the simulated I2C bus
+ *
+ * Same public interface and timing behaviour as the bit-banged original:
+ * each byte goes out as soon as write() is called, endTransmission()
+ * returns the ACK bit of the last byte (0 = ACK) and requestFrom() always
+ * clocks in the requested length.
+ */
+
+#ifndef MODBEE_NATIVE_ESP32_SOFTWIRE_H
+#define MODBEE_NATIVE_ESP32_SOFTWIRE_H
+
+#include <Arduino.h>
+
+class SoftWire : public Stream {
+  public:
+    SoftWire();
+    bool setPins(int sda, int scl);
+    bool begin(int sda, int scl, uint32_t frequency=0);
+    inline bool begin() { return begin(-1, -1, static_cast<uint32_t>(0)); }
+    bool setClock(uint32_t frequency);
+    uint8_t beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    uint8_t endTransmission(bool sendStop = true);
+    size_t requestFrom(uint8_t address, size_t len, bool stopBit=true);
+    int available(void);
+    int read(void);
+    int peek(void);
+    void flush(void);
+    size_t write(const uint8_t *data, size_t n);
+
+    inline size_t write(const char * s) { return write((uint8_t*) s, strlen(s)); }
+    inline size_t write(unsigned long n) { return write((uint8_t)n); }
+    inline size_t write(long n) { return write((uint8_t)n); }
+    inline size_t write(unsigned int n) { return write((uint8_t)n); }
+    inline size_t write(int n) { return write((uint8_t)n); }
+
+  private:
+    bool _started;
+    uint8_t _data[256];
+    uint8_t _data_len;
+    uint8_t _data_i;
+    uint8_t _ack;
+};
+
+#endif // MODBEE_NATIVE_ESP32_SOFTWIRE_H
@@ -0,0 +1,214 @@
+/*!
+ * @file ESPAsyncWebServer.h
+ *
+ * @brief Host stand-in for ESPAsyncWebServer: routes are accepted, nothing listens
+ *
+ * The web server compiles and links unchanged, and its JSON builders and
+ * message handlers can be called directly from host code. No request ever
+ * arrives; responses are created and dropped so handler code stays safe to
+ * call.
+ */
+
+#ifndef MODBEE_NATIVE_ESP_ASYNC_WEB_SERVER_H
+#define MODBEE_NATIVE_ESP_ASYNC_WEB_SERVER_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include <list>
+#include <memory>
+#include <vector>
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+#define WS_CONNECTED 1
+
+typedef enum {
+  HTTP_GET = 0x01,
+  HTTP_POST = 0x02,
+  HTTP_DELETE = 0x04,
+  HTTP_PUT = 0x08,
+  HTTP_PATCH = 0x10,
+  HTTP_HEAD = 0x20,
+  HTTP_OPTIONS = 0x40,
+  HTTP_ANY = 0x7F
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+
+class AsyncWebParameter {
+public:
+  const String& name() const { return _name; }
+  const String& value() const { return _value; }
+private:
+  String _name;
+  String _value;
+};
+
+class AsyncWebHeader {
+public:
+  const String& name() const { return _name; }
+  const String& value() const { return _value; }
+private:
+  String _name;
+  String _value;
+};
+
+class AsyncWebServerResponse {
+public:
+  virtual ~AsyncWebServerResponse() {}
+  void setCode(int code) { _code = code; }
+  int code() const { return _code; }
+  bool addHeader(const char* name, const char* value, bool replace = true) { (void)name; (void)value; (void)replace; return true; }
+  bool addHeader(const char* name, const String& value, bool replace = true) { return addHeader(name, value.c_str(), replace); }
+  void setContentType(const char* type) { (void)type; }
+protected:
+  int _code = 200;
+};
+
+class AsyncWebServerRequest {
+public:
+  WebRequestMethodComposite method() const { return HTTP_GET; }
+  const String& url() const { return _url; }
+  bool hasParam(const char* name, bool post = false, bool file = false) const { (void)name; (void)post; (void)file; return false; }
+  const AsyncWebParameter* getParam(const char* name, bool post = false, bool file = false) const { (void)name; (void)post; (void)file; return &_empty; }
+  bool hasHeader(const char* name) const { (void)name; return false; }
+  const AsyncWebHeader* getHeader(const char* name) const { (void)name; return &_emptyHeader; }
+  IPAddress client_ip() const { return IPAddress(); }
+
+  void send(AsyncWebServerResponse* response) { delete response; }
+  void send(int code, const char* contentType = "", const char* content = "") { (void)code; (void)contentType; (void)content; }
+  void send(int code, const char* contentType, const String& content) { send(code, contentType, content.c_str()); }
+  void send(int code, const String& contentType, const String& content) { send(code, contentType.c_str(), content.c_str()); }
+  void send(fs::FS& fs, const char* path, const char* contentType = nullptr) { (void)fs; (void)path; (void)contentType; }
+  void redirect(const char* url) { (void)url; }
+
+  AsyncWebServerResponse* beginResponse(int code, const char* contentType, const char* content = "") {
+    (void)contentType; (void)content;
+    AsyncWebServerResponse* response = new AsyncWebServerResponse();
+    response->setCode(code);
+    return response;
+  }
+  AsyncWebServerResponse* beginResponse(int code, const char* contentType, const String& content) {
+    return beginResponse(code, contentType, content.c_str());
+  }
+  AsyncWebServerResponse* beginResponse(const char* contentType, size_t length, AwsResponseFiller filler) {
+    (void)length; (void)filler;
+    return beginResponse(200, contentType, "");
+  }
+  AsyncWebServerResponse* beginChunkedResponse(const char* contentType, AwsResponseFiller filler) {
+    (void)filler;
+    return beginResponse(200, contentType, "");
+  }
+
+private:
+  String _url;
+  AsyncWebParameter _empty;
+  AsyncWebHeader _emptyHeader;
+};
+
+typedef std::function<void(AsyncWebServerRequest*)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest*, const String&, size_t, uint8_t*, size_t, bool)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest*, uint8_t*, size_t, size_t, size_t)> ArBodyHandlerFunction;
+
+class AsyncWebHandler {
+public:
+  virtual ~AsyncWebHandler() {}
+};
+
+class AsyncCallbackWebHandler : public AsyncWebHandler {};
+
+class AsyncStaticWebHandler : public AsyncWebHandler {
+public:
+  AsyncStaticWebHandler& setDefaultFile(const char* filename) { (void)filename; return *this; }
+};
+
+// ==================== WebSocket ====================
+
+typedef enum { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA } AwsEventType;
+typedef enum { WS_CONTINUATION, WS_TEXT, WS_BINARY, WS_DISCONNECT = 0x08, WS_PING, WS_PONG } AwsFrameType;
+
+typedef struct {
+  uint8_t message_opcode;
+  uint32_t num;
+  uint8_t final;
+  uint8_t masked;
+  uint8_t opcode;
+  uint64_t len;
+  uint8_t mask[4];
+  uint64_t index;
+} AwsFrameInfo;
+
+typedef std::shared_ptr<std::vector<uint8_t>> AsyncWebSocketSharedBuffer;
+
+class AsyncWebSocket;
+
+class AsyncWebSocketClient {
+public:
+  uint32_t id() const { return _id; }
+  int status() const { return WS_CONNECTED; }
+  IPAddress remoteIP() const { return IPAddress(); }
+  uint16_t remotePort() const { return 0; }
+  size_t queueLen() const { return 0; }
+  bool queueIsFull() const { return false; }
+  bool canSend() const { return true; }
+  bool text(const char* message, size_t len) { (void)message; (void)len; return true; }
+  bool text(const char* message) { return text(message, strlen(message)); }
+  bool text(const String& message) { return text(message.c_str(), message.length()); }
+  bool text(AsyncWebSocketSharedBuffer buffer) { return buffer && text((const char*)buffer->data(), buffer->size()); }
+  void close(uint16_t code = 0, const char* message = nullptr) { (void)code; (void)message; }
+  void ping() {}
+private:
+  uint32_t _id = 0;
+};
+
+typedef std::function<void(AsyncWebSocket*, AsyncWebSocketClient*, AwsEventType, void*, uint8_t*, size_t)> AwsEventHandler;
+
+class AsyncWebSocket : public AsyncWebHandler {
+public:
+  AsyncWebSocket(const char* url) { (void)url; }
+  void onEvent(AwsEventHandler handler) { _handler = handler; }
+  size_t count() const { return 0; }
+  AsyncWebSocketClient* client(uint32_t id) { (void)id; return nullptr; }
+  void cleanupClients(uint16_t maxClients = 8) { (void)maxClients; }
+  void textAll(const char* message) { (void)message; }
+  void textAll(const String& message) { (void)message; }
+  void textAll(AsyncWebSocketSharedBuffer buffer) { (void)buffer; }
+  void closeAll(uint16_t code = 0, const char* message = nullptr) { (void)code; (void)message; }
+private:
+  AwsEventHandler _handler;
+};
+
+// ==================== Server ====================
+
+class AsyncWebServer {
+public:
+  AsyncWebServer(uint16_t port) { (void)port; }
+  void begin() {}
+  void end() {}
+  AsyncCallbackWebHandler& on(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest) {
+    (void)uri; (void)method; (void)onRequest;
+    return _handler;
+  }
+  AsyncCallbackWebHandler& on(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+                              ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody = nullptr) {
+    (void)onUpload; (void)onBody;
+    return on(uri, method, onRequest);
+  }
+  AsyncStaticWebHandler& serveStatic(const char* uri, fs::FS& fs, const char* path, const char* cacheControl = nullptr) {
+    (void)uri; (void)fs; (void)path; (void)cacheControl;
+    return _static;
+  }
+  AsyncWebHandler& addHandler(AsyncWebHandler* handler) {
+    _handlers.push_back(handler);
+    return *handler;
+  }
+  void onNotFound(ArRequestHandlerFunction onRequest) { (void)onRequest; }
+private:
+  AsyncCallbackWebHandler _handler;
+  AsyncStaticWebHandler _static;
+  std::list<AsyncWebHandler*> _handlers;   // Not owned, as in the library
+};
+
+#endif // MODBEE_NATIVE_ESP_ASYNC_WEB_SERVER_H
@@ -0,0 +1,93 @@
+/*!
+ * @file FS.h
+ *
+ * @brief Host stand-in for the ESP32 FS classes, on plain files
+ *
+ * A File shares one stdio handle between its copies and closes it with the
+ * last one, like the ESP32 core's reference-counted FileImpl.
+ */
+
+#ifndef MODBEE_NATIVE_FS_H
+#define MODBEE_NATIVE_FS_H
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode {
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+class FileImpl;
+
+class File : public Stream {
+public:
+  File() {}
+  File(std::shared_ptr<FileImpl> impl) : _impl(impl) {}
+
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  int available() override;
+  int read() override;
+  int peek() override;
+  void flush() override;
+  size_t read(uint8_t* buffer, size_t size);
+  size_t readBytes(char* buffer, size_t length) { return read((uint8_t*)buffer, length); }
+
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  void close() { _impl.reset(); }
+  operator bool() const { return (bool)_impl; }
+  const char* path() const;
+  const char* name() const;
+  bool isDirectory() const { return false; }
+  File openNextFile(const char* mode = FILE_READ) { (void)mode; return File(); }
+
+private:
+  std::shared_ptr<FileImpl> _impl;
+};
+
+/*!
+ * @brief File system rooted at a host directory
+ */
+class FS {
+public:
+  File open(const char* path, const char* mode = FILE_READ, bool create = false);
+  File open(const String& path, const char* mode = FILE_READ, bool create = false) {
+    return open(path.c_str(), mode, create);
+  }
+  bool exists(const char* path);
+  bool exists(const String& path) { return exists(path.c_str()); }
+  bool remove(const char* path);
+  bool remove(const String& path) { return remove(path.c_str()); }
+  bool rename(const char* from, const char* to);
+  bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+  bool mkdir(const char* path);
+  bool mkdir(const String& path) { return mkdir(path.c_str()); }
+  bool rmdir(const char* path);
+  bool rmdir(const String& path) { return rmdir(path.c_str()); }
+
+protected:
+  std::string hostPath(const char* path) const;
+  std::string _root;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif // MODBEE_NATIVE_FS_H
@@ -0,0 +1,69 @@
+/*!
+ * @file FastLED.h
+ *
+ * @brief Host stand-in for FastLED: colours are kept, nothing is driven
+ */
+
+#ifndef MODBEE_NATIVE_FASTLED_H
+#define MODBEE_NATIVE_FASTLED_H
+
+#include <Arduino.h>
+
+struct CRGB {
+  uint8_t r, g, b;
+
+  enum HTMLColorCode {
+    Black = 0x000000,
+    Blue = 0x0000FF,
+    Cyan = 0x00FFFF,
+    Green = 0x008000,
+    Magenta = 0xFF00FF,
+    Orange = 0xFFA500,
+    Purple = 0x800080,
+    Red = 0xFF0000,
+    White = 0xFFFFFF,
+    Yellow = 0xFFFF00
+  };
+
+  CRGB() : r(0), g(0), b(0) {}
+  CRGB(uint8_t red, uint8_t green, uint8_t blue) : r(red), g(green), b(blue) {}
+  CRGB(uint32_t colorcode) : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF), b(colorcode & 0xFF) {}
+  CRGB(HTMLColorCode colorcode) : CRGB((uint32_t)colorcode) {}
+
+  CRGB& nscale8(uint8_t scale) {
+    r = (uint8_t)(((uint16_t)r * (scale + 1)) >> 8);
+    g = (uint8_t)(((uint16_t)g * (scale + 1)) >> 8);
+    b = (uint8_t)(((uint16_t)b * (scale + 1)) >> 8);
+    return *this;
+  }
+  CRGB& fadeToBlackBy(uint8_t fadefactor) { return nscale8(255 - fadefactor); }
+};
+
+enum EOrder { RGB = 0012, GRB = 0102 };
+template <uint8_t DATA_PIN, EOrder RGB_ORDER = GRB> class WS2812 {};
+
+class CFastLED {
+public:
+  template <template <uint8_t, EOrder> class CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+  CFastLED& addLeds(CRGB* data, int count) {
+    _leds = data;
+    _count = count;
+    return *this;
+  }
+  void show() {}
+  void clear(bool writeData = false) {
+    for (int i = 0; _leds && i < _count; i++) _leds[i] = CRGB();
+    if (writeData) show();
+  }
+  void setBrightness(uint8_t scale) { _brightness = scale; }
+  uint8_t getBrightness() const { return _brightness; }
+
+private:
+  CRGB* _leds = nullptr;
+  int _count = 0;
+  uint8_t _brightness = 255;
+};
+
+extern CFastLED FastLED;
+
+#endif // MODBEE_NATIVE_FASTLED_H
@@ -0,0 +1,183 @@
+#include "LittleFS.h"
+#include "ModbeeNative.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+LittleFSFS LittleFS;
+
+namespace fs {
+
+class FileImpl {
+public:
+  FileImpl(FILE* handle, const std::string& path) : handle(handle), path(path) {
+    size_t slash = path.find_last_of('/');
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+  }
+  ~FileImpl() { fclose(handle); }
+
+  FILE* handle;
+  std::string path;   // As the firmware named it
+  std::string name;
+};
+
+// ==================== File ====================
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+  return _impl ? fwrite(buffer, 1, size, _impl->handle) : 0;
+}
+
+int File::available() {
+  if (!_impl) return 0;
+  long remaining = (long)size() - (long)position();
+  return remaining > 0 ? (int)remaining : 0;
+}
+
+int File::read() {
+  return _impl ? fgetc(_impl->handle) : -1;
+}
+
+int File::peek() {
+  if (!_impl) return -1;
+  int c = fgetc(_impl->handle);
+  if (c != EOF) ungetc(c, _impl->handle);
+  return c;
+}
+
+void File::flush() {
+  if (_impl) fflush(_impl->handle);
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+  return _impl ? fread(buffer, 1, size, _impl->handle) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+  return _impl && fseek(_impl->handle, (long)pos, whence[mode]) == 0;
+}
+
+size_t File::position() const {
+  return _impl ? (size_t)ftell(_impl->handle) : 0;
+}
+
+size_t File::size() const {
+  if (!_impl) return 0;
+  fflush(_impl->handle);
+  struct stat st;
+  return fstat(fileno(_impl->handle), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+const char* File::path() const {
+  return _impl ? _impl->path.c_str() : nullptr;
+}
+
+const char* File::name() const {
+  return _impl ? _impl->name.c_str() : nullptr;
+}
+
+// ==================== FS ====================
+
+std::string FS::hostPath(const char* path) const {
+  std::string p = path ? path : "";
+  if (p.empty() || p[0] != '/') p = "/" + p;
+  return _root + p;
+}
+
+File FS::open(const char* path, const char* mode, bool create) {
+  std::string host = hostPath(path);
+  // LittleFS creates parent directories on open for writing with create set
+  if (create && mode[0] != 'r') {
+    for (size_t slash = host.find('/', _root.size() + 1); slash != std::string::npos;
+         slash = host.find('/', slash + 1)) {
+      ::mkdir(host.substr(0, slash).c_str(), 0755);
+    }
+  }
+  struct stat st;
+  if (stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) return File();
+  std::string hostMode = std::string(mode) + "b";
+  FILE* handle = fopen(host.c_str(), hostMode.c_str());
+  if (!handle) return File();
+  return File(std::make_shared<FileImpl>(handle, path));
+}
+
+bool FS::exists(const char* path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+  return ::unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char* from, const char* to) {
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0 || exists(path);
+}
+
+bool FS::rmdir(const char* path) {
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+} // namespace fs
+
+// ==================== LittleFS ====================
+
+bool LittleFSFS::begin(bool formatOnFail, const char* basePath, uint8_t maxOpenFiles,
+                       const char* partitionLabel) {
+  (void)basePath;
+  (void)maxOpenFiles;
+  (void)partitionLabel;
+  _root = ModbeeNative::dataDir();
+  if (::mkdir(_root.c_str(), 0755) == 0) return true;
+  struct stat st;
+  if (stat(_root.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) return true;
+  return formatOnFail && format();
+}
+
+static void removeTree(const std::string& path) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) return;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") continue;
+    std::string child = path + "/" + name;
+    struct stat st;
+    if (stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      removeTree(child);
+      ::rmdir(child.c_str());
+    } else {
+      ::unlink(child.c_str());
+    }
+  }
+  closedir(dir);
+}
+
+bool LittleFSFS::format() {
+  if (_root.empty()) _root = ModbeeNative::dataDir();
+  removeTree(_root);
+  return ::mkdir(_root.c_str(), 0755) == 0 || access(_root.c_str(), W_OK) == 0;
+}
+
+static size_t treeBytes(const std::string& path) {
+  size_t total = 0;
+  DIR* dir = opendir(path.c_str());
+  if (!dir) return 0;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") continue;
+    std::string child = path + "/" + name;
+    struct stat st;
+    if (stat(child.c_str(), &st) != 0) continue;
+    total += S_ISDIR(st.st_mode) ? treeBytes(child) : (size_t)st.st_size;
+  }
+  closedir(dir);
+  return total;
+}
+
+size_t LittleFSFS::usedBytes() {
+  return treeBytes(_root);
+}
@@ -0,0 +1,27 @@
+/*!
+ * @file LittleFS.h
+ *
+ * @brief Host stand-in for LittleFS: the flash partition is a directory
+ *
+ * The directory is ModbeeNative::dataDir() (--data on the command line), so
+ * config and state files survive between runs like they do in flash.
+ */
+
+#ifndef MODBEE_NATIVE_LITTLEFS_H
+#define MODBEE_NATIVE_LITTLEFS_H
+
+#include <FS.h>
+
+class LittleFSFS : public fs::FS {
+public:
+  bool begin(bool formatOnFail = false, const char* basePath = "/littlefs",
+             uint8_t maxOpenFiles = 10, const char* partitionLabel = "spiffs");
+  void end() {}
+  bool format();
+  size_t totalBytes() { return 0xE0000; }    // Partition size of huge_app.csv
+  size_t usedBytes();
+};
+
+extern LittleFSFS LittleFS;
+
+#endif // MODBEE_NATIVE_LITTLEFS_H
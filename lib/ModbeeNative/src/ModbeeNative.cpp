@@ -0,0 +1,101 @@
+#include "ModbeeNative.h"
+#include "BQ25798Sim.h"
+#include <WiFi.h>
+#include <FastLED.h>
+#include <esp_sleep.h>
+#include <vector>
+
+WiFiClass WiFi;
+CFastLED FastLED;
+
+// ==================== Virtual clock ====================
+
+static uint64_t nowUs = 0;
+static std::string dataPath = "native_data";
+static bool console = true;
+static std::vector<std::function<void(uint64_t)>> tickCallbacks;
+static bool exitRequested = false;
+static int exitCode = 0;
+static BQ25798Sim* simCharger = nullptr;
+
+uint64_t ModbeeNative::now() {
+  return nowUs;
+}
+
+void ModbeeNative::advance(uint64_t us) {
+  nowUs += us;
+}
+
+const char* ModbeeNative::dataDir() {
+  return dataPath.c_str();
+}
+
+bool ModbeeNative::consoleEnabled() {
+  return console;
+}
+
+void ModbeeNative::onTick(std::function<void(uint64_t)> callback) {
+  tickCallbacks.push_back(callback);
+}
+
+void ModbeeNative::requestExit(int code) {
+  exitRequested = true;
+  exitCode = code;
+}
+
+// ==================== Run ====================
+
+void ModbeeNative::setDataDir(const char* dir) {
+  dataPath = dir;
+}
+
+void ModbeeNative::setConsole(bool enabled) {
+  console = enabled;
+}
+
+BQ25798Sim& ModbeeNative::charger() {
+  return *simCharger;
+}
+
+void ModbeeNative::setCharger(BQ25798Sim* charger) {
+  simCharger = charger;
+  ModbeeNativeI2C::attach(BQ25798_SIM_ADDRESS, charger);
+}
+
+int ModbeeNative::run(void (*setup)(), void (*loop)(), uint64_t endUs, uint64_t tickUs) {
+  if (tickUs == 0) tickUs = 1;
+  setup();
+  while (!exitRequested && nowUs < endUs) {
+    loop();
+    advance(tickUs);
+    if (simCharger) simCharger->update();
+    for (auto& callback : tickCallbacks) callback(nowUs);
+  }
+  fflush(stdout);
+  return exitCode;
+}
+
+// ==================== Light sleep ====================
+
+static uint64_t sleepTimerUs = 0;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeUs) {
+  sleepTimerUs = timeUs;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup() {
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t intrType) {
+  (void)gpio;
+  (void)intrType;
+  return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start() {
+  // Nothing presses the button on the host: the timer always wakes us
+  ModbeeNative::advance(sleepTimerUs);
+  return ESP_OK;
+}
@@ -0,0 +1,156 @@
+/*!
+ * @file ModbeeNative.h
+ *
+ * @brief Host platform for running the ModbeeMPPT firmware on a PC
+ *
+ * The native build links the unchanged firmware (src/main.cpp, ModbeeMPPT,
+ * the BQ25798 driver) against this library instead of the ESP32 core. It
+ * provides:
+ * - a virtual clock behind millis()/micros(), advanced by delay(), by bus
+ *   traffic and by the host loop between loop() calls;
+ * - an I2C bus shared by Wire and SoftWire, with simulated devices attached
+ *   at their addresses (a BQ25798Sim at 0x6B by default);
+ * - LittleFS on a host directory, Serial on stdout/stdin, Serial1 idle or
+ *   on a pseudo-terminal (NativeMain.cpp, --rs485);
+ * - no-op web server, DNS and LED drivers, a BLE server no client ever
+ *   connects to, and WiFi whose station only joins with --network, when
+ *   AsyncClient runs on host sockets.
+ *
+ * NativeMain.cpp has the default main(): it parses the command line, builds
+ * the simulated board and runs the sketch's setup() and loop() until the
+ * requested simulated time is up. Host programs with their own main() (the
+ * replay harness in tools/replay) build a board and call run() the same way.
+ */
+
+#ifndef MODBEE_NATIVE_H
+#define MODBEE_NATIVE_H
+
+#include <Arduino.h>
+
+#define MODBEE_NATIVE_I2C_DEVICES 8
+#define MODBEE_NATIVE_I2C_HZ 100000UL      // SoftWire default clock
+#define MODBEE_NATIVE_TICK_US 10000UL      // Clock advance per loop() call
+
+class BQ25798Sim;
+
+/*!
+ * @brief A simulated I2C target, driven byte by byte like the real bus
+ */
+class ModbeeNativeI2CDevice {
+public:
+  virtual ~ModbeeNativeI2CDevice() {}
+
+  /*!
+   * @brief START or repeated START addressed to this device
+   * @param read True for a read transfer
+   */
+  virtual void i2cStart(bool read) = 0;
+
+  /*!
+   * @brief One byte from the controller
+   * @return True to ACK
+   */
+  virtual bool i2cWrite(uint8_t data) = 0;
+
+  /*!
+   * @brief One byte to the controller
+   * @param ack False on the last byte of the transfer
+   */
+  virtual uint8_t i2cRead(bool ack) = 0;
+
+  /*!
+   * @brief STOP condition
+   */
+  virtual void i2cStop() {}
+};
+
+class ModbeeNativeI2C {
+public:
+  /*!
+   * @brief Attach a device at a 7-bit address (nullptr detaches)
+   */
+  static bool attach(uint8_t address, ModbeeNativeI2CDevice* device);
+
+  /*!
+   * @brief Address phase of a transfer
+   * @return True if a device ACKed
+   */
+  static bool start(uint8_t address, bool read);
+  static bool write(uint8_t data);
+  static uint8_t read(bool ack);
+  static void stop();
+
+  /*!
+   * @brief Bus clock used to charge transfer time to the virtual clock
+   */
+  static void setClock(uint32_t hz);
+
+  static uint32_t transfers();      // Address phases since start-up
+  static uint32_t nacks();          // Address phases nobody answered
+
+private:
+  static void byteTime();
+};
+
+namespace ModbeeNative {
+
+/*!
+ * @brief Virtual time since start-up (µs)
+ */
+uint64_t now();
+
+/*!
+ * @brief Move the virtual clock forward
+ */
+void advance(uint64_t us);
+
+/*!
+ * @brief Root directory LittleFS paths are mapped into
+ */
+const char* dataDir();
+
+/*!
+ * @brief True while Serial output goes to stdout (off with --quiet)
+ */
+bool consoleEnabled();
+
+/*!
+ * @brief Hook called after every loop() with the virtual time, for scenarios
+ */
+void onTick(std::function<void(uint64_t)> callback);
+
+/*!
+ * @brief Stop the run after the current loop()
+ */
+void requestExit(int code = 0);
+
+/*!
+ * @brief Directory for LittleFS, before setup() mounts it
+ */
+void setDataDir(const char* dir);
+
+void setConsole(bool enabled);
+
+/*!
+ * @brief Put a charger on the bus at 0x6B; run() keeps it up to date
+ */
+void setCharger(BQ25798Sim* charger);
+
+/*!
+ * @brief The charger setCharger() attached
+ */
+BQ25798Sim& charger();
+
+/*!
+ * @brief Call setup(), then loop() until the clock reaches endUs or an exit is requested
+ *
+ * After each loop() the clock advances by tickUs, the charger catches up and
+ * the onTick() callbacks run.
+ *
+ * @return Exit code from requestExit(), 0 otherwise
+ */
+int run(void (*setup)(), void (*loop)(), uint64_t endUs, uint64_t tickUs = MODBEE_NATIVE_TICK_US);
+
+} // namespace ModbeeNative
+
+#endif // MODBEE_NATIVE_H
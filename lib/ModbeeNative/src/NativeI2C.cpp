@@ -0,0 +1,209 @@
+#include "ModbeeNative.h"
+#include "Wire.h"
+#include "ESP32_SoftWire.h"
+
+TwoWire Wire(0);
+
+// ==================== Bus ====================
+
+static ModbeeNativeI2CDevice* busDevices[128];
+static ModbeeNativeI2CDevice* busTarget = nullptr;
+static uint32_t busHz = MODBEE_NATIVE_I2C_HZ;
+static uint32_t busTransfers = 0;
+static uint32_t busNacks = 0;
+
+bool ModbeeNativeI2C::attach(uint8_t address, ModbeeNativeI2CDevice* device) {
+  if (address > 0x7F) return false;
+  busDevices[address] = device;
+  return true;
+}
+
+void ModbeeNativeI2C::byteTime() {
+  // 8 data bits and the ACK bit
+  ModbeeNative::advance((9ULL * 1000000ULL + busHz - 1) / busHz);
+}
+
+bool ModbeeNativeI2C::start(uint8_t address, bool read) {
+  busTransfers++;
+  byteTime();
+  busTarget = address <= 0x7F ? busDevices[address] : nullptr;
+  if (!busTarget) {
+    busNacks++;
+    return false;
+  }
+  busTarget->i2cStart(read);
+  return true;
+}
+
+bool ModbeeNativeI2C::write(uint8_t data) {
+  byteTime();
+  return busTarget ? busTarget->i2cWrite(data) : false;
+}
+
+uint8_t ModbeeNativeI2C::read(bool ack) {
+  byteTime();
+  // Nobody drives SDA: the pull-up reads as 1s
+  return busTarget ? busTarget->i2cRead(ack) : 0xFF;
+}
+
+void ModbeeNativeI2C::stop() {
+  if (busTarget) busTarget->i2cStop();
+  busTarget = nullptr;
+}
+
+void ModbeeNativeI2C::setClock(uint32_t hz) {
+  if (hz) busHz = hz;
+}
+
+uint32_t ModbeeNativeI2C::transfers() {
+  return busTransfers;
+}
+
+uint32_t ModbeeNativeI2C::nacks() {
+  return busNacks;
+}
+
+// ==================== TwoWire ====================
+
+bool TwoWire::begin(int sda, int scl, uint32_t frequency) {
+  (void)sda;
+  (void)scl;
+  if (frequency) setClock(frequency);
+  return true;
+}
+
+bool TwoWire::setClock(uint32_t frequency) {
+  ModbeeNativeI2C::setClock(frequency);
+  return true;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  _address = address;
+  _txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (_txLength >= I2C_BUFFER_LENGTH) return 0;
+  _txBuffer[_txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t quantity) {
+  size_t n = 0;
+  while (n < quantity && write(data[n])) n++;
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+  // Arduino codes: 2 = NACK on address, 3 = NACK on data
+  uint8_t result = 0;
+  if (!ModbeeNativeI2C::start(_address, false)) {
+    result = 2;
+  } else {
+    for (size_t i = 0; i < _txLength; i++) {
+      if (!ModbeeNativeI2C::write(_txBuffer[i])) {
+        result = 3;
+        break;
+      }
+    }
+  }
+  if (sendStop || result) ModbeeNativeI2C::stop();
+  _txLength = 0;
+  return result;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop) {
+  _rxIndex = 0;
+  _rxLength = 0;
+  if (quantity > I2C_BUFFER_LENGTH) quantity = I2C_BUFFER_LENGTH;
+  if (ModbeeNativeI2C::start(address, true)) {
+    for (uint8_t i = 0; i < quantity; i++) {
+      _rxBuffer[_rxLength++] = ModbeeNativeI2C::read(i + 1 < quantity);
+    }
+  }
+  if (sendStop || !_rxLength) ModbeeNativeI2C::stop();
+  return (uint8_t)_rxLength;
+}
+
+// ==================== SoftWire ====================
+
+SoftWire::SoftWire() {
+  _started = false;
+  _data_len = 0;
+  _data_i = 0;
+  _ack = 0;
+}
+
+bool SoftWire::setPins(int sda, int scl) {
+  return sda >= 0 && sda <= 31 && scl >= 0 && scl <= 31;
+}
+
+bool SoftWire::begin(int sda, int scl, uint32_t frequency) {
+  setPins(sda, scl);
+  setClock(frequency);
+  return true;
+}
+
+bool SoftWire::setClock(uint32_t frequency) {
+  if (frequency == 0) return false;
+  ModbeeNativeI2C::setClock(frequency);
+  return true;
+}
+
+uint8_t SoftWire::beginTransmission(uint8_t address) {
+  _started = true;  // A START while started is a repeated START
+  _ack = ModbeeNativeI2C::start(address, false) ? 0 : 1;
+  return _ack;
+}
+
+size_t SoftWire::write(uint8_t data) {
+  _ack = ModbeeNativeI2C::write(data) ? 0 : 1;
+  return _ack;
+}
+
+size_t SoftWire::write(const uint8_t *data, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    write(data[i]);
+  }
+  return n;
+}
+
+uint8_t SoftWire::endTransmission(bool sendStop) {
+  if (sendStop) {
+    ModbeeNativeI2C::stop();
+    _started = false;
+  }
+  return _ack;
+}
+
+size_t SoftWire::requestFrom(uint8_t address, size_t len, bool stopBit) {
+  _started = true;
+  if (len > sizeof(_data)) len = sizeof(_data);
+  ModbeeNativeI2C::start(address, true);
+  size_t i;
+  for (i = 0; i < len; i++) {
+    _data[i] = ModbeeNativeI2C::read(i + 1 < len);
+  }
+  if (stopBit) {
+    ModbeeNativeI2C::stop();
+    _started = false;
+  }
+  _data_len = (uint8_t)i;
+  _data_i = 0;
+  return i;
+}
+
+int SoftWire::available(void) {
+  return _data_len - _data_i;
+}
+
+int SoftWire::read(void) {
+  return _data_i < _data_len ? _data[_data_i++] : -1;
+}
+
+int SoftWire::peek(void) {
+  return _data_i < _data_len ? _data[_data_i] : -1;
+}
+
+void SoftWire::flush(void) {
+}
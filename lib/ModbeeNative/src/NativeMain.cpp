@@ -0,0 +1,160 @@
+#include "ModbeeNative.h"
+#include "BQ25798SimPlant.h"
+#include <AsyncTCP.h>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Default main() for the native build: the sketch in src/ on a bench supply.
+// A program with its own main() (tools/replay) never pulls this file in.
+
+void setup();
+void loop();
+
+// ==================== main ====================
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --seconds N      simulated run time (default 60)\n"
+          "  --data DIR       directory backing LittleFS (default native_data)\n"
+          "  --tick MS        clock advance per loop() (default %lu)\n"
+          "  --quiet          no Serial output\n"
+          "  --vac1 V[,OHM]   supply on VAC1 (default 21 V behind 2 ohm, 0 = none)\n"
+          "  --vac2 V[,OHM]   supply on VAC2 (default none)\n"
+          "  --acfet          ACFET-RBFET pairs fitted on both inputs\n"
+          "  --chemistry C    lifepo4, lipo or lead (default lipo)\n"
+          "  --cells N        PROG cell count (default 3)\n"
+          "  --capacity AH    battery capacity (default 10)\n"
+          "  --soc PCT        initial state of charge (default 50)\n"
+          "  --load A         system load (default 0.05)\n"
+          "  --temp C         ambient and battery temperature (default 25)\n"
+          "  --realtime       pace the simulated clock to the wall clock\n"
+          "  --rs485          Serial1 (Modbus) on a new pseudo-terminal, implies --realtime\n"
+          "  --network        WiFi station can join, TCP on host sockets, implies --realtime\n",
+          name, MODBEE_NATIVE_TICK_US / 1000);
+}
+
+// Serial1 on a pseudo-terminal: a Modbus master (or any serial tool) opens
+// the printed path as it would a USB-RS485 adapter
+static bool openRs485Pty() {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return false;
+  const char* path = ptsname(master);
+  // Hold the terminal side open in raw mode: no echo or line editing, and
+  // reads keep working while no peer has it open
+  int terminal = path ? open(path, O_RDWR | O_NOCTTY) : -1;
+  if (terminal < 0) return false;
+  struct termios tio;
+  tcgetattr(terminal, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(terminal, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL, 0) | O_NONBLOCK);
+  Serial1.hostAttach(master);
+  fprintf(stderr, "native: RS485 on %s\n", path);
+  return true;
+}
+
+static void parseSupply(const char* arg, float& voltage, float& resistance) {
+  voltage = strtof(arg, nullptr);
+  const char* comma = strchr(arg, ',');
+  if (comma) resistance = strtof(comma + 1, nullptr);
+}
+
+int main(int argc, char** argv) {
+  double seconds = 60.0;
+  uint64_t tickUs = MODBEE_NATIVE_TICK_US;
+  float vac1 = 21.0f, vac1R = 2.0f;
+  float vac2 = 0.0f, vac2R = 2.0f;
+  bool acfet = false;
+  bq25798_sim_chemistry_t chemistry = BQ25798_SIM_LIPO;
+  int cells = 3;
+  float capacity = 10.0f;
+  float soc = 50.0f;
+  float load = 0.05f;
+  float temperature = 25.0f;
+  bool realtime = false;
+  bool rs485 = false;
+  bool network = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char* opt = argv[i];
+    const char* arg = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(opt, "--quiet")) {
+      ModbeeNative::setConsole(false);
+    } else if (!strcmp(opt, "--acfet")) {
+      acfet = true;
+    } else if (!strcmp(opt, "--realtime")) {
+      realtime = true;
+    } else if (!strcmp(opt, "--rs485")) {
+      rs485 = realtime = true;
+    } else if (!strcmp(opt, "--network")) {
+      network = realtime = true;
+    } else if (!arg) {
+      usage(argv[0]);
+      return 2;
+    } else {
+      i++;
+      if (!strcmp(opt, "--seconds")) seconds = atof(arg);
+      else if (!strcmp(opt, "--data")) ModbeeNative::setDataDir(arg);
+      else if (!strcmp(opt, "--tick")) tickUs = (uint64_t)(atof(arg) * 1000.0);
+      else if (!strcmp(opt, "--vac1")) parseSupply(arg, vac1, vac1R);
+      else if (!strcmp(opt, "--vac2")) parseSupply(arg, vac2, vac2R);
+      else if (!strcmp(opt, "--chemistry") && BQ25798SimCell::parse(arg, chemistry)) {}
+      else if (!strcmp(opt, "--cells")) cells = atoi(arg);
+      else if (!strcmp(opt, "--capacity")) capacity = atof(arg);
+      else if (!strcmp(opt, "--soc")) soc = atof(arg);
+      else if (!strcmp(opt, "--load")) load = atof(arg);
+      else if (!strcmp(opt, "--temp")) temperature = atof(arg);
+      else {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+  }
+
+  // The board: a charger with its battery, supplies and load
+  static BQ25798Sim charger(cells);
+  static BQ25798SimSupply supply1(vac1, vac1R);
+  static BQ25798SimSupply supply2(vac2, vac2R);
+  static BQ25798SimCell pack(chemistry, cells, capacity, soc / 100.0f);
+  if (vac1 > 0.0f) charger.attachInput(1, &supply1);
+  if (vac2 > 0.0f) charger.attachInput(2, &supply2);
+  charger.setInputFets(acfet, acfet);
+  charger.attachBattery(&pack);
+  charger.setSystemLoad(load);
+  charger.setTemperature(temperature);
+  ModbeeNative::setCharger(&charger);
+
+  auto started = std::chrono::steady_clock::now();
+  if (rs485) {
+    if (!openRs485Pty()) {
+      fprintf(stderr, "native: no pseudo-terminal for RS485\n");
+      return 1;
+    }
+    ModbeeNative::onTick([](uint64_t) { Serial1.hostPoll(); });
+  }
+  if (network) {
+    // MQTT and the like reach host services (a broker on localhost)
+    WiFi.hostNetwork(true);
+    ModbeeNative::onTick([](uint64_t) { AsyncClient::hostPollAll(); });
+  }
+  if (realtime) {
+    ModbeeNative::onTick([started](uint64_t nowUs) {
+      std::this_thread::sleep_until(started + std::chrono::microseconds(nowUs));
+    });
+  }
+  int exitCode = ModbeeNative::run(setup, loop, (uint64_t)(seconds * 1e6), tickUs);
+
+  double simulated = ModbeeNative::now() / 1e6;
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  const bq25798_sim_state_t& state = charger.state();
+  fprintf(stderr,
+          "native: %.1f s simulated in %.2f s (%.0fx), VBAT %.3f V, IBAT %.3f A, SOC %.1f %%, "
+          "%u I2C transfers\n",
+          simulated, wall, wall > 0.0 ? simulated / wall : 0.0, state.vbat, state.ibat,
+          pack.soc * 100.0f, (unsigned)ModbeeNativeI2C::transfers());
+  return exitCode;
+}
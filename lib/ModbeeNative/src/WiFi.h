@@ -0,0 +1,156 @@
+/*!
+ * @file WiFi.h
+ *
+ * @brief Host stand-in for the ESP32 WiFi library
+ *
+ * Mode changes are remembered so the firmware sees consistent state; the
+ * soft AP has no clients. The station never connects unless hostNetwork()
+ * was called (--network): then the host's own network stack stands in for
+ * the access point, and a join takes typical virtual time: a scan unless
+ * begin() was given a channel and BSSID, and DHCP unless config() set a
+ * static address.
+ */
+
+#ifndef MODBEE_NATIVE_WIFI_H
+#define MODBEE_NATIVE_WIFI_H
+
+#include <Arduino.h>
+
+class IPAddress : public Printable {
+public:
+  IPAddress() : _address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    : _address((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 | (uint32_t)d << 24) {}
+  IPAddress(uint32_t address) : _address(address) {}
+  operator uint32_t() const { return _address; }
+  uint8_t operator[](int index) const { return (uint8_t)(_address >> (8 * index)); }
+  bool operator==(const IPAddress& other) const { return _address == other._address; }
+  bool operator!=(const IPAddress& other) const { return _address != other._address; }
+  String toString() const {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buffer);
+  }
+  size_t printTo(Print& p) const override { return p.print(toString()); }
+private:
+  uint32_t _address;
+};
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+
+// Virtual time of a host join
+#define NATIVE_WIFI_SCAN_MS 1200       // Active scan of all channels
+#define NATIVE_WIFI_ASSOCIATE_MS 150   // Authentication, association and WPA2 handshake
+#define NATIVE_WIFI_DHCP_MS 400
+
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t mode) {
+    _mode = mode;
+    if (!(mode & WIFI_STA)) _joined = false;
+    return true;
+  }
+  wifi_mode_t getMode() const { return _mode; }
+
+  bool softAP(const char* ssid, const char* password = nullptr, int channel = 1, int hidden = 0, int maxConnections = 4) {
+    (void)ssid; (void)password; (void)channel; (void)hidden; (void)maxConnections;
+    _mode = (wifi_mode_t)(_mode | WIFI_AP);
+    return true;
+  }
+  bool softAPdisconnect(bool wifiOff = false) {
+    if (wifiOff) _joined = false;
+    _mode = wifiOff ? WIFI_OFF : (wifi_mode_t)(_mode & ~WIFI_AP);
+    return true;
+  }
+  IPAddress softAPIP() const { return (_mode & WIFI_AP) ? IPAddress(192, 168, 4, 1) : IPAddress(); }
+  uint8_t softAPgetStationNum() const { return 0; }
+
+  wl_status_t begin(const char* ssid, const char* password = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true) {
+    (void)ssid; (void)password;
+    _mode = (wifi_mode_t)(_mode | WIFI_STA);
+    _joined = false;
+    _targeted = channel > 0 && bssid;
+    if (connect) hostConnect();
+    return status();
+  }
+  bool config(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns = IPAddress()) {
+    // 0.0.0.0 goes back to DHCP
+    _staticIp = ip;
+    _gateway = ip ? gateway : IPAddress();
+    _subnet = ip ? subnet : IPAddress();
+    _dns = ip ? dns : IPAddress();
+    return true;
+  }
+  bool disconnect(bool wifiOff = false, bool eraseAp = false) {
+    (void)eraseAp;
+    _joined = false;
+    if (wifiOff) _mode = WIFI_OFF;
+    return true;
+  }
+  wl_status_t status() const { return isConnected() ? WL_CONNECTED : WL_DISCONNECTED; }
+  bool isConnected() const { return _joined && (_mode & WIFI_STA) && millis() >= _joinedAtMs; }
+  IPAddress localIP() const {
+    return !isConnected() ? IPAddress() : _staticIp ? _staticIp : IPAddress(127, 0, 0, 1);
+  }
+  IPAddress gatewayIP() const { return !isConnected() ? IPAddress() : _staticIp ? _gateway : IPAddress(127, 0, 0, 1); }
+  IPAddress subnetMask() const { return !isConnected() ? IPAddress() : _staticIp ? _subnet : IPAddress(255, 0, 0, 0); }
+  IPAddress dnsIP(uint8_t index = 0) const {
+    (void)index;
+    return !isConnected() ? IPAddress() : _staticIp ? _dns : IPAddress(127, 0, 0, 1);
+  }
+  uint8_t* BSSID() {
+    static uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    return isConnected() ? bssid : nullptr;
+  }
+  int32_t channel() const { return isConnected() ? 6 : 0; }
+  int8_t RSSI() const { return 0; }
+  String macAddress() const { return String("C3:EE:0B:0D:0E:00"); }
+
+  bool setSleep(bool enabled) { _sleep = enabled ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE; return true; }
+  bool setSleep(wifi_ps_type_t sleepType) { _sleep = sleepType; return true; }
+  wifi_ps_type_t getSleep() const { return _sleep; }
+  bool setAutoReconnect(bool autoReconnect) { (void)autoReconnect; return true; }
+  bool persistent(bool persistent) { (void)persistent; return true; }
+  bool setHostname(const char* hostname) { (void)hostname; return true; }
+
+  /*!
+   * @brief Let the station join (host side, NativeMain --network)
+   */
+  void hostNetwork(bool enabled) { _network = enabled; }
+
+  /*!
+   * @brief Start the join configured by begin() (esp_wifi_connect())
+   */
+  void hostConnect() {
+    _joined = _network && (_mode & WIFI_STA);
+    _joinedAtMs = millis() + (_targeted ? 0 : NATIVE_WIFI_SCAN_MS) + NATIVE_WIFI_ASSOCIATE_MS +
+                  (_staticIp ? 0 : NATIVE_WIFI_DHCP_MS);
+  }
+
+private:
+  wifi_mode_t _mode = WIFI_OFF;
+  bool _network = false;
+  bool _joined = false;
+  bool _targeted = false;
+  unsigned long _joinedAtMs = 0;
+  IPAddress _staticIp;
+  IPAddress _gateway;
+  IPAddress _subnet;
+  IPAddress _dns;
+  wifi_ps_type_t _sleep = WIFI_PS_MIN_MODEM;
+};
+
+extern WiFiClass WiFi;
+
+#endif // MODBEE_NATIVE_WIFI_H
@@ -0,0 +1,49 @@
+/*!
+ * @file Wire.h
+ *
+ * @brief Host stand-in for the ESP32 Wire library, on the simulated I2C bus
+ *
+ * Buffered like the real TwoWire: a write transfer goes out on
+ * endTransmission(), a read transfer completes inside requestFrom().
+ */
+
+#ifndef MODBEE_NATIVE_WIRE_H
+#define MODBEE_NATIVE_WIRE_H
+
+#include <Arduino.h>
+
+#define I2C_BUFFER_LENGTH 128
+
+class TwoWire : public Stream {
+public:
+  TwoWire(uint8_t bus) : _bus(bus) {}
+
+  bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+  bool end() { return true; }
+  bool setClock(uint32_t frequency);
+
+  void beginTransmission(uint8_t address);
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+
+  using Print::write;
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t* data, size_t quantity) override;
+  int available() override { return _rxLength - _rxIndex; }
+  int read() override { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1; }
+  int peek() override { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex] : -1; }
+  void flush() override {}
+
+private:
+  uint8_t _bus;
+  uint8_t _address = 0;
+  uint8_t _txBuffer[I2C_BUFFER_LENGTH];
+  size_t _txLength = 0;
+  uint8_t _rxBuffer[I2C_BUFFER_LENGTH];
+  size_t _rxLength = 0;
+  size_t _rxIndex = 0;
+};
+
+extern TwoWire Wire;
+
+#endif // MODBEE_NATIVE_WIRE_H
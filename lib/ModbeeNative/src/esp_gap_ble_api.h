@@ -0,0 +1,80 @@
+/*!
+ * @file esp_gap_ble_api.h
+ *
+ * @brief Host stand-in for the Bluedroid security manager: pairing settings and bonds
+ *
+ * There is no client, so nothing pairs on its own; a test pairs the host's
+ * one stand-in client with BLEDevice::hostPair(), which checks the passkey
+ * and IO capability BLESecurity set, and bonds it when bonding was asked for.
+ */
+
+#ifndef MODBEE_NATIVE_ESP_GAP_BLE_API_H
+#define MODBEE_NATIVE_ESP_GAP_BLE_API_H
+
+#include <Arduino.h>
+#include <vector>
+
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef uint8_t esp_ble_auth_req_t;
+#define ESP_LE_AUTH_NO_BOND 0x00
+#define ESP_LE_AUTH_BOND 0x01
+#define ESP_LE_AUTH_REQ_MITM (1 << 2)
+#define ESP_LE_AUTH_REQ_SC_ONLY (1 << 3)
+#define ESP_LE_AUTH_REQ_SC_BOND (ESP_LE_AUTH_REQ_SC_ONLY | ESP_LE_AUTH_BOND)
+#define ESP_LE_AUTH_REQ_SC_MITM (ESP_LE_AUTH_REQ_SC_ONLY | ESP_LE_AUTH_REQ_MITM)
+#define ESP_LE_AUTH_REQ_SC_MITM_BOND (ESP_LE_AUTH_REQ_SC_MITM | ESP_LE_AUTH_BOND)
+
+typedef uint8_t esp_ble_io_cap_t;
+#define ESP_IO_CAP_OUT 0          // Display only: the peer enters the passkey
+#define ESP_IO_CAP_IO 1
+#define ESP_IO_CAP_IN 2
+#define ESP_IO_CAP_NONE 3         // Just Works, never MITM protected
+
+typedef struct {
+  esp_bd_addr_t bd_addr;
+} esp_ble_bond_dev_t;
+
+// Host only: the security manager state behind BLESecurity and the bond list
+struct ModbeeNativeBleSecurity {
+  uint32_t passkey = 0;
+  bool passkeySet = false;
+  esp_ble_io_cap_t ioCap = ESP_IO_CAP_NONE;
+  esp_ble_auth_req_t authReq = ESP_LE_AUTH_NO_BOND;
+  bool linkAuthenticated = false;           // The stand-in client's link is MITM protected
+  std::vector<esp_ble_bond_dev_t> bonds;
+
+  static ModbeeNativeBleSecurity& get() {
+    static ModbeeNativeBleSecurity security;
+    return security;
+  }
+};
+
+// The stand-in client's address
+static const uint8_t MODBEE_NATIVE_BLE_PEER[6] = {0x02, 0x4d, 0x4f, 0x44, 0x42, 0x45};
+
+inline int esp_ble_get_bond_device_num() {
+  return (int)ModbeeNativeBleSecurity::get().bonds.size();
+}
+
+inline esp_err_t esp_ble_get_bond_device_list(int* count, esp_ble_bond_dev_t* list) {
+  const std::vector<esp_ble_bond_dev_t>& bonds = ModbeeNativeBleSecurity::get().bonds;
+  int n = min(*count, (int)bonds.size());
+  for (int i = 0; i < n; i++) list[i] = bonds[i];
+  *count = n;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t address) {
+  ModbeeNativeBleSecurity& security = ModbeeNativeBleSecurity::get();
+  for (size_t i = 0; i < security.bonds.size(); i++) {
+    if (memcmp(security.bonds[i].bd_addr, address, sizeof(esp_bd_addr_t)) != 0) continue;
+    security.bonds.erase(security.bonds.begin() + i);
+    // Bluedroid drops the link's keys with the bond
+    if (memcmp(address, MODBEE_NATIVE_BLE_PEER, sizeof(esp_bd_addr_t)) == 0) security.linkAuthenticated = false;
+    return ESP_OK;
+  }
+  return ESP_FAIL;
+}
+
+#endif // MODBEE_NATIVE_ESP_GAP_BLE_API_H
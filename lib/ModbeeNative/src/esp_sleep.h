@@ -0,0 +1,24 @@
+/*!
+ * @file esp_sleep.h
+ *
+ * @brief Host stand-in for ESP-IDF light sleep: sleeping advances the virtual clock
+ */
+
+#ifndef MODBEE_NATIVE_ESP_SLEEP_H
+#define MODBEE_NATIVE_ESP_SLEEP_H
+
+#include <Arduino.h>
+
+typedef int gpio_num_t;
+typedef enum {
+  GPIO_INTR_DISABLE = 0,
+  GPIO_INTR_LOW_LEVEL = 4,
+  GPIO_INTR_HIGH_LEVEL = 5
+} gpio_int_type_t;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeUs);
+esp_err_t esp_sleep_enable_gpio_wakeup();
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t intrType);
+esp_err_t esp_light_sleep_start();
+
+#endif // MODBEE_NATIVE_ESP_SLEEP_H
@@ -0,0 +1,49 @@
+/*!
+ * @file esp_wifi.h
+ *
+ * @brief Host stand-in for the ESP-IDF WiFi driver calls the firmware makes
+ * beside the Arduino WiFi library
+ */
+
+#ifndef MODBEE_NATIVE_ESP_WIFI_H
+#define MODBEE_NATIVE_ESP_WIFI_H
+
+#include "WiFi.h"
+
+typedef enum { WIFI_IF_STA = 0, WIFI_IF_AP = 1 } wifi_interface_t;
+
+// The members of the station config the firmware touches
+typedef struct {
+  uint8_t ssid[32];
+  uint8_t password[64];
+  uint8_t channel;
+  uint16_t listen_interval;     // In beacon intervals, 0 = driver default (3)
+} wifi_sta_config_t;
+
+typedef union {
+  wifi_sta_config_t sta;
+} wifi_config_t;
+
+inline wifi_config_t& nativeWifiStationConfig() {
+  static wifi_config_t config;
+  return config;
+}
+
+inline esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* config) {
+  if (interface != WIFI_IF_STA) return ESP_FAIL;
+  *config = nativeWifiStationConfig();
+  return ESP_OK;
+}
+
+inline esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config) {
+  if (interface != WIFI_IF_STA) return ESP_FAIL;
+  nativeWifiStationConfig() = *config;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_wifi_connect() {
+  WiFi.hostConnect();
+  return ESP_OK;
+}
+
+#endif // MODBEE_NATIVE_ESP_WIFI_H
@@ -22,12 +22,16 @@ BQ25798::BQ25798(TwoWire *wire) {
   _wire = wire;
   _softWire = NULL;
   _use_soft_i2c = false;
+  _i2c_transactions = 0;
+  _i2c_errors = 0;
 }
 
 BQ25798::BQ25798(SoftWire *wire) {
   _wire = NULL;
   _softWire = wire;
   _use_soft_i2c = true;
+  _i2c_transactions = 0;
+  _i2c_errors = 0;
 }
 
 /*!
@@ -189,8 +193,9 @@ bool BQ25798::setInputLimitV(float voltage) {
     return false;
   }
   
-  // Convert voltage to register value: voltage / 0.1V
-  uint8_t reg_value = (uint8_t)(voltage / 0.1f);
+  // Convert voltage to register value: voltage / 0.1V, rounded so that
+  // a setpoint such as 16.3V (16.2999...f) is not truncated to 16.2V
+  uint8_t reg_value = (uint8_t)lroundf(voltage / 0.1f);
   
   return writeRegister(BQ25798_REG_INPUT_VOLTAGE_LIMIT, reg_value);
 }
@@ -1880,11 +1885,66 @@ float BQ25798::getADCVAC2() {
   return (value & 0x7FFF) * 0.001f; // 1mV per LSB, convert to V
 }
 
+/*!
+ * @brief Read VBUS and IBUS in a single I2C transaction
+ * @param vbus Pointer to store VBUS in volts
+ * @param ibus Pointer to store IBUS in amps
+ * @return True if successful
+ *
+ * IBUS_ADC, IBAT_ADC and VBUS_ADC are contiguous (0x31-0x36), so one
+ * auto-incrementing 6-byte read returns a voltage/current pair from the
+ * same ADC cycle at a third of the bus time of separate reads.
+ */
+bool BQ25798::getADCInputSample(float *vbus, float *ibus) {
+  uint8_t buffer[6];
+  if (!readRegisters(BQ25798_REG_IBUS_ADC, buffer, sizeof(buffer))) {
+    return false;
+  }
+  int16_t ibus_raw = (int16_t)((uint16_t)buffer[0] << 8 | buffer[1]);
+  uint16_t vbus_raw = (uint16_t)buffer[4] << 8 | buffer[5];
+  *ibus = ibus_raw * 0.001f;              // 1mA per LSB, 2's complement
+  *vbus = (vbus_raw & 0x7FFF) * 0.001f;   // 1mV per LSB
+  return true;
+}
+
 /*!
  * @brief Private methods
  */
 
+/*!
+ * @brief Count a bus transaction and its outcome
+ * @param ok Result of the transaction
+ * @return ok, unchanged
+ */
+bool BQ25798::countTransaction(bool ok) {
+  _i2c_transactions++;
+  if (!ok) {
+    _i2c_errors++;
+  }
+  return ok;
+}
+
 bool BQ25798::readRegister(uint8_t reg, uint8_t *value) {
+  return countTransaction(readRegisterBus(reg, value));
+}
+
+bool BQ25798::writeRegister(uint8_t reg, uint8_t value) {
+  return countTransaction(writeRegisterBus(reg, value));
+}
+
+bool BQ25798::readRegister16(uint8_t reg, uint16_t *value) {
+  return countTransaction(readRegister16Bus(reg, value));
+}
+
+bool BQ25798::writeRegister16(uint8_t reg, uint16_t value) {
+  return countTransaction(writeRegister16Bus(reg, value));
+}
+
+bool BQ25798::readRegisters(uint8_t reg, uint8_t *buffer, uint8_t len) {
+  return countTransaction(readRegistersBus(reg, buffer, len));
+}
+
+bool BQ25798::readRegisterBus(uint8_t reg, uint8_t *value) {
   if (_use_soft_i2c) {
     _softWire->beginTransmission(_i2c_addr);
     _softWire->write(reg);
@@ -1915,7 +1975,7 @@ bool BQ25798::readRegister(uint8_t reg, uint8_t *value) {
  * @param value The value to write
  * @return True if successful
  */
-bool BQ25798::writeRegister(uint8_t reg, uint8_t value) {
+bool BQ25798::writeRegisterBus(uint8_t reg, uint8_t value) {
   if (_use_soft_i2c) {
     _softWire->beginTransmission(_i2c_addr);
     _softWire->write(reg);
@@ -1935,7 +1995,7 @@ bool BQ25798::writeRegister(uint8_t reg, uint8_t value) {
  * @param value Pointer to the 16-bit value to store the result
  * @return True if successful
  */
-bool BQ25798::readRegister16(uint8_t reg, uint16_t *value) {
+bool BQ25798::readRegister16Bus(uint8_t reg, uint16_t *value) {
   uint8_t lsb, msb;
   if (_use_soft_i2c) {
     _softWire->beginTransmission(_i2c_addr);
@@ -1964,13 +2024,49 @@ bool BQ25798::readRegister16(uint8_t reg, uint16_t *value) {
   return true;
 }
 
+/*!
+ * @brief Read consecutive registers (register address auto-increments)
+ * @param reg The first register address
+ * @param buffer Destination for len bytes
+ * @param len Number of bytes to read
+ * @return True if successful
+ */
+bool BQ25798::readRegistersBus(uint8_t reg, uint8_t *buffer, uint8_t len) {
+  if (_use_soft_i2c) {
+    _softWire->beginTransmission(_i2c_addr);
+    _softWire->write(reg);
+    if (_softWire->endTransmission() != 0) {
+      return false;
+    }
+    if (_softWire->requestFrom(_i2c_addr, len) != len) {
+      return false;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+      buffer[i] = _softWire->read();
+    }
+  } else {
+    _wire->beginTransmission(_i2c_addr);
+    _wire->write(reg);
+    if (_wire->endTransmission() != 0) {
+      return false;
+    }
+    if (_wire->requestFrom(_i2c_addr, len) != len) {
+      return false;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+      buffer[i] = _wire->read();
+    }
+  }
+  return true;
+}
+
 /*!
  * @brief Write a 16-bit value to a register
  * @param reg The register address
  * @param value The 16-bit value to write
  * @return True if successful
  */
-bool BQ25798::writeRegister16(uint8_t reg, uint16_t value) {
+bool BQ25798::writeRegister16Bus(uint8_t reg, uint16_t value) {
   if (_use_soft_i2c) {
     _softWire->beginTransmission(_i2c_addr);
     _softWire->write(reg);
@@ -2231,3 +2327,19 @@ void BQ25798::printADCValues() {
 bool BQ25798::readRegisterDirect(uint8_t reg, uint8_t *value) {
   return readRegister(reg, value);
 }
+
+/*!
+ * @brief Get the number of I2C transactions since power-up
+ * @return Transaction count (reads and writes)
+ */
+uint32_t BQ25798::getI2CTransactionCount() const {
+  return _i2c_transactions;
+}
+
+/*!
+ * @brief Get the number of failed I2C transactions since power-up
+ * @return Error count (NACK or short read)
+ */
+uint32_t BQ25798::getI2CErrorCount() const {
+  return _i2c_errors;
+}
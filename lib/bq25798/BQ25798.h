@@ -562,10 +562,15 @@ public:
   float getADCTDIE();
   float getADCVAC1();
   float getADCVAC2();
+  bool getADCInputSample(float *vbus, float *ibus);
   
   // Debug functions for register access
   bool readRegisterDirect(uint8_t reg, uint8_t *value);
 
+  // I2C bus statistics
+  uint32_t getI2CTransactionCount() const;
+  uint32_t getI2CErrorCount() const;
+
   // Status and Fault functions
   uint8_t getChargerStatus0();
   uint8_t getChargerStatus1();
@@ -588,11 +593,20 @@ private:
   SoftWire *_softWire;
   uint8_t _i2c_addr;
   bool _use_soft_i2c;
-
+  volatile uint32_t _i2c_transactions;
+  volatile uint32_t _i2c_errors;
+
+  bool countTransaction(bool ok);
+  bool readRegisterBus(uint8_t reg, uint8_t *value);
+  bool writeRegisterBus(uint8_t reg, uint8_t value);
+  bool readRegister16Bus(uint8_t reg, uint16_t *value);
+  bool writeRegister16Bus(uint8_t reg, uint16_t value);
+  bool readRegistersBus(uint8_t reg, uint8_t *buffer, uint8_t len);
   bool readRegister(uint8_t reg, uint8_t *value);
   bool writeRegister(uint8_t reg, uint8_t value);
   bool readRegister16(uint8_t reg, uint16_t *value);
   bool writeRegister16(uint8_t reg, uint16_t value);
+  bool readRegisters(uint8_t reg, uint8_t *buffer, uint8_t len);
   bool readRegisterBits(uint8_t reg, uint8_t *value, uint8_t bits, uint8_t shift);
   bool writeRegisterBits(uint8_t reg, uint8_t value, uint8_t bits, uint8_t shift);
   bool readRegisterBits16(uint8_t reg, uint16_t *value, uint16_t bits, uint8_t shift);
@@ -0,0 +1,91 @@
+/*!
+ * @file ModbeeTest.h
+ *
+ * @brief Checks for the host unit tests in test/native
+ *
+ * Each test_*.cpp builds into one ctest executable linked against the
+ * native modbee_mppt library (see CMakeLists.txt). Its main() runs the
+ * test functions with MODBEE_TEST() and returns ModbeeTest::finish(),
+ * which is non-zero if any check failed. Failed checks print the file,
+ * line and expression; passing ones print nothing.
+ */
+
+#ifndef MODBEE_TEST_H
+#define MODBEE_TEST_H
+
+#include <LittleFS.h>
+#include <ModbeeNative.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+namespace ModbeeTest {
+
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+
+inline bool check(bool ok, const char* expression, const char* file, int line) {
+  if (!ok) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    failures()++;
+  }
+  return ok;
+}
+
+inline bool checkNear(double actual, double expected, double tolerance, const char* expression,
+                      const char* file, int line) {
+  bool ok = fabs(actual - expected) <= tolerance;
+  if (!ok) {
+    fprintf(stderr, "%s:%d: check failed: %s (%g, expected %g +/- %g)\n", file, line, expression,
+            actual, expected, tolerance);
+    failures()++;
+  }
+  return ok;
+}
+
+/*!
+ * @brief Point LittleFS at a new empty directory under /tmp and mount it
+ */
+inline std::string freshDataDir(const char* name) {
+  static std::string dir;
+  dir = std::string("/tmp/modbee_test_") + name + "_" + std::to_string(getpid());
+  ModbeeNative::setDataDir(dir.c_str());
+  LittleFS.begin(true);
+  LittleFS.format();
+  return dir;
+}
+
+/*!
+ * @brief Delete the directory freshDataDir() made
+ */
+inline void removeDataDir() {
+  LittleFS.format();
+  rmdir(ModbeeNative::dataDir());
+}
+
+inline int finish(const char* name) {
+  if (failures()) {
+    fprintf(stderr, "%s: %d check(s) failed\n", name, failures());
+    return 1;
+  }
+  printf("%s: all checks passed\n", name);
+  return 0;
+}
+
+} // namespace ModbeeTest
+
+#define MODBEE_CHECK(expression) ModbeeTest::check((expression), #expression, __FILE__, __LINE__)
+#define MODBEE_CHECK_NEAR(actual, expected, tolerance) \
+  ModbeeTest::checkNear((actual), (expected), (tolerance), #actual " ~ " #expected, __FILE__, __LINE__)
+#define MODBEE_TEST(function) \
+  do { \
+    int before = ModbeeTest::failures(); \
+    function(); \
+    printf("%s %s\n", ModbeeTest::failures() == before ? "ok  " : "FAIL", #function); \
+  } while (0)
+
+#endif // MODBEE_TEST_H
@@ -0,0 +1,262 @@
+/*!
+ * @file test_ble.cpp
+ *
+ * @brief BLE wire formats and the config characteristic: telemetry and
+ * request encoding, history chunking, and settings reads and writes over
+ * a link bonded with the passkey
+ */
+
+#include "ModbeeTest.h"
+#include <BLEDevice.h>
+#include <ModbeeMPPT.h>
+#include <ModbeeMpptBleCodec.h>
+
+static ModbeeMPPT mppt;
+
+// Config field index of a settings key
+static uint8_t fieldIndex(const char* key) {
+  size_t count;
+  const ModbeeMpptConfigField* fields = ModbeeMpptConfig::getFields(count);
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(fields[i].key, key) == 0) return (uint8_t)i;
+  }
+  return 0xFF;
+}
+
+static ModbeeMpptBleConfigResponse configResponse(BLECharacteristic* config) {
+  ModbeeMpptBleConfigResponse response;
+  memset(&response, 0xEE, sizeof(response));
+  std::string value = config->getValue();
+  if (value.size() == sizeof(response)) memcpy(&response, value.data(), sizeof(response));
+  return response;
+}
+
+// ==================== Tests ====================
+
+static void testTelemetry() {
+  modbee_telemetry_t frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.valid = true;
+  frame.sequence = 0x12345;
+  frame.vbus.voltage = 18.25f;
+  frame.vbus.current = 0.5f;
+  frame.battery.voltage = 12.6f;
+  frame.battery.current = -0.25f;
+  frame.system.voltage = 12.4f;
+  frame.fault_status0 = 0x40;
+  frame.fault_status1 = 0x02;
+  frame.die_temperature = 41.6f;
+  frame.battery_temperature = -5.2f;
+  frame.charge_state = MODBEE_CHARGE_FAST_CC;
+
+  ModbeeMpptBleTelemetry out;
+  ModbeeMpptBleCodec::packTelemetry(frame, 87.5f, MODBEE_BLE_FLAG_POWER_SAVE, out);
+  MODBEE_CHECK(out.sequence == 0x2345);
+  MODBEE_CHECK(out.vbus_mv == 18250);
+  MODBEE_CHECK(out.ibus_ma == 500);
+  MODBEE_CHECK(out.vbat_mv == 12600);
+  MODBEE_CHECK(out.ibat_ma == -250);
+  MODBEE_CHECK(out.vsys_mv == 12400);
+  MODBEE_CHECK(out.soc_dpct == 875);
+  MODBEE_CHECK(out.faults == 0x4002);
+  MODBEE_CHECK(out.die_temp_c == 42);
+  MODBEE_CHECK(out.bat_temp_c == -5);
+  MODBEE_CHECK(out.charge_state == MODBEE_CHARGE_FAST_CC);
+  MODBEE_CHECK(out.flags == (MODBEE_BLE_FLAG_VALID | MODBEE_BLE_FLAG_POWER_SAVE));
+
+  // Little-endian on the air
+  const uint8_t* bytes = (const uint8_t*)&out;
+  MODBEE_CHECK(bytes[0] == 0x45 && bytes[1] == 0x23);
+}
+
+static void testConfigRequest() {
+  modbee_ble_config_request_t request;
+  const uint8_t read[] = {MODBEE_BLE_CONFIG_READ, 3};
+  MODBEE_CHECK(ModbeeMpptBleCodec::parseConfigRequest(read, sizeof(read), request));
+  MODBEE_CHECK(request.op == MODBEE_BLE_CONFIG_READ && request.index == 3 && request.value == 0);
+
+  const uint8_t write[] = {MODBEE_BLE_CONFIG_WRITE, 3, 0x18, 0xFC, 0xFF, 0xFF};
+  MODBEE_CHECK(ModbeeMpptBleCodec::parseConfigRequest(write, sizeof(write), request));
+  MODBEE_CHECK(request.value == -1000);
+
+  const uint8_t unknown[] = {7, 3};
+  MODBEE_CHECK(!ModbeeMpptBleCodec::parseConfigRequest(unknown, sizeof(unknown), request));
+  MODBEE_CHECK(!ModbeeMpptBleCodec::parseConfigRequest(write, 5, request));
+  MODBEE_CHECK(!ModbeeMpptBleCodec::parseConfigRequest(read, 1, request));
+
+  MODBEE_CHECK(ModbeeMpptBleCodec::encodeConfigValue(1.25f, MODBEE_CONFIG_FLOAT) == 1250);
+  MODBEE_CHECK(ModbeeMpptBleCodec::encodeConfigValue(3.0f, MODBEE_CONFIG_INT) == 3);
+  MODBEE_CHECK_NEAR(ModbeeMpptBleCodec::decodeConfigValue(1250, MODBEE_CONFIG_FLOAT), 1.25, 1e-6);
+  MODBEE_CHECK_NEAR(ModbeeMpptBleCodec::decodeConfigValue(3, MODBEE_CONFIG_INT), 3.0, 0.0);
+
+  uint32_t from;
+  uint32_t to;
+  const uint8_t range[] = {10, 0, 0, 0, 0, 1, 0, 0};
+  MODBEE_CHECK(ModbeeMpptBleCodec::parseHistoryRequest(range, sizeof(range), from, to));
+  MODBEE_CHECK(from == 10 && to == 256);
+  const uint8_t backwards[] = {0, 1, 0, 0, 10, 0, 0, 0};
+  MODBEE_CHECK(!ModbeeMpptBleCodec::parseHistoryRequest(backwards, sizeof(backwards), from, to));
+}
+
+static void testChunker() {
+  // 100 bytes of 4-byte records in 20-byte chunks: the header takes 5 bytes of the first
+  uint8_t source[100];
+  for (size_t i = 0; i < sizeof(source); i++) source[i] = (uint8_t)i;
+  size_t offset = 0;
+  ModbeeMpptBleChunker chunker;
+  chunker.begin(sizeof(source), 4, [&](uint8_t* buffer, size_t max) {
+    size_t n = min(max, sizeof(source) - offset);
+    memcpy(buffer, source + offset, n);
+    offset += n;
+    return n;
+  });
+
+  std::string received;
+  uint8_t chunk[20];
+  uint16_t expected = 0;
+  bool last = false;
+  size_t n;
+  while ((n = chunker.next(chunk, sizeof(chunk))) > 0) {
+    MODBEE_CHECK(n >= MODBEE_BLE_CHUNK_HEADER && n <= sizeof(chunk));
+    MODBEE_CHECK((uint16_t)(chunk[0] | chunk[1] << 8) == expected);
+    MODBEE_CHECK(((chunk[2] & MODBEE_BLE_CHUNK_FIRST) != 0) == (expected == 0));
+    last = chunk[2] & MODBEE_BLE_CHUNK_LAST;
+    received.append((const char*)chunk + MODBEE_BLE_CHUNK_HEADER, n - MODBEE_BLE_CHUNK_HEADER);
+    expected++;
+  }
+  MODBEE_CHECK(last);
+  MODBEE_CHECK(!chunker.active());
+  MODBEE_CHECK(expected == (5 + 100 + 16) / 17);
+
+  ModbeeMpptBleTransferHeader header;
+  MODBEE_CHECK(received.size() == sizeof(header) + sizeof(source));
+  memcpy(&header, received.data(), sizeof(header));
+  MODBEE_CHECK(header.length == sizeof(source));
+  MODBEE_CHECK(header.recordSize == 4);
+  MODBEE_CHECK(memcmp(received.data() + sizeof(header), source, sizeof(source)) == 0);
+}
+
+static void testConfigWrite() {
+  strcpy(mppt.config.data.ble_passkey, "123456");
+  mppt.config.data.ble_mode = MODBEE_BLE_ALWAYS;
+  MODBEE_CHECK(mppt.ble.start());
+  BLEService* service = BLEDevice::createServer()->getServiceByUUID(MODBEE_BLE_SERVICE_UUID);
+  MODBEE_CHECK(service != nullptr);
+  if (!service) return;
+  BLECharacteristic* config = service->getCharacteristic(MODBEE_BLE_CONFIG_UUID);
+  MODBEE_CHECK(config != nullptr);
+  if (!config) return;
+
+  uint8_t index = fieldIndex("chargeCurrent");
+  MODBEE_CHECK(index != 0xFF);
+  mppt.config.data.charge_current = 1.0f;
+
+  // Before pairing the stack refuses the request, and a wrong passkey does not pair
+  const uint8_t read[] = {MODBEE_BLE_CONFIG_READ, index};
+  MODBEE_CHECK(!config->hostWrite(read, sizeof(read)));
+  mppt.ble.loop();
+  MODBEE_CHECK(mppt.ble.getStatus().configRequests == 0);
+  MODBEE_CHECK(!BLEDevice::hostPair(654321));
+  MODBEE_CHECK(BLEDevice::hostPair(123456));
+  MODBEE_CHECK(esp_ble_get_bond_device_num() == 1);
+
+  // A read answers with the current value
+  MODBEE_CHECK(config->hostWrite(read, sizeof(read)));
+  mppt.ble.loop();
+  ModbeeMpptBleConfigResponse response = configResponse(config);
+  MODBEE_CHECK(response.op == MODBEE_BLE_CONFIG_READ);
+  MODBEE_CHECK(response.index == index);
+  MODBEE_CHECK(response.status == MODBEE_BLE_CONFIG_OK);
+  MODBEE_CHECK(response.type == MODBEE_CONFIG_FLOAT);
+  MODBEE_CHECK(response.value == 1000);
+
+  // A write is answered with the new value and reaches data on the main loop
+  const uint8_t write[] = {MODBEE_BLE_CONFIG_WRITE, index, 0xA0, 0x0F, 0, 0};  // 4000 = 4.0 A
+  MODBEE_CHECK(config->hostWrite(write, sizeof(write)));
+  mppt.ble.loop();
+  response = configResponse(config);
+  MODBEE_CHECK(response.op == MODBEE_BLE_CONFIG_WRITE);
+  MODBEE_CHECK(response.status == MODBEE_BLE_CONFIG_OK);
+  MODBEE_CHECK(response.value == 4000);
+  MODBEE_CHECK(mppt.config.commitPatch());
+  MODBEE_CHECK_NEAR(mppt.config.data.charge_current, 4.0, 1e-6);
+
+  // Out of range, and a bool that is not 0 or 1
+  const uint8_t tooHigh[] = {MODBEE_BLE_CONFIG_WRITE, index, 0x40, 0x9C, 0, 0};  // 40 A
+  config->hostWrite(tooHigh, sizeof(tooHigh));
+  mppt.ble.loop();
+  response = configResponse(config);
+  MODBEE_CHECK(response.status == MODBEE_BLE_CONFIG_BAD_VALUE);
+  MODBEE_CHECK(response.value == 4000);
+  uint8_t boolIndex = fieldIndex("mpptEnable");
+  MODBEE_CHECK(boolIndex != 0xFF);
+  const uint8_t notBool[] = {MODBEE_BLE_CONFIG_WRITE, boolIndex, 2, 0, 0, 0};
+  config->hostWrite(notBool, sizeof(notBool));
+  mppt.ble.loop();
+  MODBEE_CHECK(configResponse(config).status == MODBEE_BLE_CONFIG_BAD_VALUE);
+
+  // Bad requests keep their own status
+  const uint8_t badIndex[] = {MODBEE_BLE_CONFIG_READ, 0xFE};
+  config->hostWrite(badIndex, sizeof(badIndex));
+  mppt.ble.loop();
+  MODBEE_CHECK(configResponse(config).status == MODBEE_BLE_CONFIG_BAD_INDEX);
+  const uint8_t overlong[] = {MODBEE_BLE_CONFIG_WRITE, index, 0, 0, 0, 0, 0, 0, 0};
+  config->hostWrite(overlong, sizeof(overlong));
+  mppt.ble.loop();
+  MODBEE_CHECK(configResponse(config).status == MODBEE_BLE_CONFIG_BAD_REQUEST);
+
+  modbee_ble_status_t status = mppt.ble.getStatus();
+  MODBEE_CHECK(status.configRequests == 6);
+  MODBEE_CHECK(status.configErrors == 4);
+}
+
+static void testPasskeyChange() {
+  BLECharacteristic* config = BLEDevice::createServer()->getServiceByUUID(MODBEE_BLE_SERVICE_UUID)
+                                ->getCharacteristic(MODBEE_BLE_CONFIG_UUID);
+  const uint8_t read[] = {MODBEE_BLE_CONFIG_READ, fieldIndex("chargeCurrent")};
+  MODBEE_CHECK(config->hostWrite(read, sizeof(read)));
+
+  // Six digits or nothing
+  JsonDocument doc;
+  JsonObject errors = doc["errors"].to<JsonObject>();
+  JsonArray changed = doc["changed"].to<JsonArray>();
+  doc["patch"]["blePasskey"] = "12345a";
+  MODBEE_CHECK(!mppt.config.applyPatch(doc["patch"], errors, changed));
+  MODBEE_CHECK(!errors["blePasskey"].isNull());
+
+  // A new passkey removes the bond made with the old one
+  doc["patch"]["blePasskey"] = "246810";
+  MODBEE_CHECK(mppt.config.applyPatch(doc["patch"], errors, changed));
+  MODBEE_CHECK(mppt.config.commitPatch());
+  mppt.ble.loop();
+  MODBEE_CHECK(esp_ble_get_bond_device_num() == 0);
+  MODBEE_CHECK(!config->hostWrite(read, sizeof(read)));
+  MODBEE_CHECK(!BLEDevice::hostPair(123456));
+  MODBEE_CHECK(BLEDevice::hostPair(246810));
+  MODBEE_CHECK(config->hostWrite(read, sizeof(read)));
+
+  // A change while the service is stopped counts at the next start
+  mppt.ble.stop();
+  mppt.config.data.ble_passkey[0] = '\0';
+  mppt.ble.loop();
+  MODBEE_CHECK(mppt.ble.start());
+  MODBEE_CHECK(esp_ble_get_bond_device_num() == 0);
+  MODBEE_CHECK(!BLEDevice::hostPair(246810));
+  MODBEE_CHECK(!config->hostWrite(read, sizeof(read)));
+  mppt.ble.stop();
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("ble");
+  MODBEE_CHECK(mppt.config.begin());
+
+  MODBEE_TEST(testTelemetry);
+  MODBEE_TEST(testConfigRequest);
+  MODBEE_TEST(testChunker);
+  MODBEE_TEST(testConfigWrite);
+  MODBEE_TEST(testPasskeyChange);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_ble");
+}
@@ -0,0 +1,219 @@
+/*!
+ * @file test_charge_profile.cpp
+ *
+ * @brief Multi-stage charge profile: bulk, absorption, equalize and float
+ * on a lead-acid bank, temperature compensation, the registers rewritten
+ * after a charger reset, re-bulk, a LiPo pack terminating instead of
+ * floating, and the registers handed back on disable
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798Sim.h>
+
+// ==================== Helpers ====================
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static uint32_t frameSequence = 0;
+
+// One 1 Hz frame with this charge state and battery reading
+static void feed(modbee_charge_state_t state, float vbat, float ibat, float temperature = 25.0f) {
+  ModbeeNative::advance(1000000ULL);
+  modbee_telemetry_t t;
+  memset(&t, 0, sizeof(t));
+  t.valid = true;
+  t.sequence = ++frameSequence;
+  t.timestamp_ms = millis();
+  t.battery.voltage = vbat;
+  t.battery.current = ibat;
+  t.battery_temperature = temperature;
+  t.charge_state = state;
+  mppt.chargeProfile.update(t);
+}
+
+static void hold(uint32_t seconds, modbee_charge_state_t state, float vbat, float ibat) {
+  for (uint32_t s = 0; s < seconds; s++) feed(state, vbat, ibat);
+}
+
+static modbee_charge_stage_t stage() {
+  return mppt.chargeProfile.getStatus().stage;
+}
+
+// EN_TERM is REG0F bit 1, EN_CHG_TMR is REG0E bit 3
+static bool terminationEnabled() {
+  return charger.peek(0x0F) & 0x02;
+}
+
+static bool timerEnabled() {
+  return charger.peek(0x0E) & 0x08;
+}
+
+// ==================== Tests ====================
+
+static void testBulkToAbsorption() {
+  feed(MODBEE_CHARGE_FAST_CC, 13.0f, 2.0f);
+  modbee_charge_profile_status_t status = mppt.chargeProfile.getStatus();
+  MODBEE_CHECK(status.stage == MODBEE_STAGE_BULK);
+  MODBEE_CHECK(status.cells == 6);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 14.4f, 0.005f);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeCurrent(), 2.0f, 0.005f);
+  MODBEE_CHECK(!terminationEnabled());  // Lead-acid floats, the chip must not terminate
+  MODBEE_CHECK(timerEnabled());
+
+  // The chip in CV has to be confirmed for a minute
+  hold(MODBEE_PROFILE_CONFIRM_S - 1, MODBEE_CHARGE_TAPER_CV, 14.4f, 1.5f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_BULK);
+  feed(MODBEE_CHARGE_TAPER_CV, 14.4f, 1.5f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_ABSORPTION);
+}
+
+static void testDuskIsNotTail() {
+  // The current falls because the input is gone, not because the bank is full
+  hold(10 * 60, MODBEE_CHARGE_NOT_CHARGING, 13.0f, 0.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_ABSORPTION);
+}
+
+static void testTailToFloat() {
+  // Tail is the larger of the termination current and 15 % of 2 A
+  hold(2 * 60, MODBEE_CHARGE_TAPER_CV, 14.4f, 0.4f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_ABSORPTION);
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_TAPER_CV, 14.4f, 0.2f);
+  modbee_charge_profile_status_t status = mppt.chargeProfile.getStatus();
+  MODBEE_CHECK(status.stage == MODBEE_STAGE_FLOAT);
+  MODBEE_CHECK_NEAR(status.voltage, 6 * 2.25f, 1e-4f);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 13.5f, 0.005f);
+  MODBEE_CHECK(!terminationEnabled());
+  MODBEE_CHECK(!timerEnabled());
+}
+
+static void testTemperatureCompensation() {
+  // -3 mV per °C per cell around 25 °C
+  feed(MODBEE_CHARGE_TAPER_CV, 13.5f, 0.1f, 35.0f);
+  modbee_charge_profile_status_t status = mppt.chargeProfile.getStatus();
+  MODBEE_CHECK_NEAR(status.compensation, -0.18f, 1e-4f);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 13.32f, 0.005f);
+
+  // Clamped at 50 °C; a reading with no NTC fitted counts as 25 °C
+  feed(MODBEE_CHARGE_TAPER_CV, 13.5f, 0.1f, 70.0f);
+  MODBEE_CHECK_NEAR(mppt.chargeProfile.getStatus().compensation, -0.45f, 1e-4f);
+  feed(MODBEE_CHARGE_TAPER_CV, 13.5f, 0.1f, -50.0f);
+  MODBEE_CHECK_NEAR(mppt.chargeProfile.getStatus().compensation, 0.0f, 1e-6f);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 13.5f, 0.005f);
+}
+
+static void testChargerReset() {
+  // The chip loses its registers mid-float; the periodic re-apply of the
+  // settings, which leaves VREG and the timer to the profile, must bring
+  // the float values back
+  MODBEE_CHECK(stage() == MODBEE_STAGE_FLOAT);
+  charger.powerOnReset();
+  MODBEE_CHECK(fabsf(mppt.api.getChargeVoltage() - 13.5f) > 0.1f);
+  MODBEE_CHECK(timerEnabled());
+  mppt.applyCriticalSettingsNow();
+  MODBEE_CHECK(mppt.config.applyToMPPT(mppt.api));
+  feed(MODBEE_CHARGE_TAPER_CV, 13.5f, 0.1f);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 13.5f, 0.005f);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeCurrent(), 2.0f, 0.005f);
+  MODBEE_CHECK(!terminationEnabled());
+  MODBEE_CHECK(!timerEnabled());
+}
+
+static void testRebulk() {
+  // A load above the float current drags the bank below 2.10 V/cell
+  hold(2 * 60, MODBEE_CHARGE_FAST_CC, 12.7f, 2.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_FLOAT);
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_FAST_CC, 12.5f, 2.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_BULK);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 14.4f, 0.005f);
+  MODBEE_CHECK(timerEnabled());
+}
+
+static void testEqualize() {
+  mppt.config.data.equalize_days = 1;
+  feed(MODBEE_CHARGE_FAST_CC, 13.0f, 2.0f);
+  uint32_t due = mppt.chargeProfile.getStatus().equalizeDueSeconds;
+  MODBEE_CHECK(due > 0 && due <= 86400);
+  ModbeeNative::advance((uint64_t)due * 1000000ULL);
+
+  // A due equalization follows absorption instead of float
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_TAPER_CV, 14.4f, 1.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_ABSORPTION);
+  MODBEE_CHECK(mppt.chargeProfile.getStatus().equalizeDueSeconds == 0);
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_TAPER_CV, 14.4f, 0.2f);
+  modbee_charge_profile_status_t status = mppt.chargeProfile.getStatus();
+  MODBEE_CHECK(status.stage == MODBEE_STAGE_EQUALIZE);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 15.0f, 0.005f);
+  MODBEE_CHECK(!timerEnabled());
+
+  // Two hours, then float with the next one a day away
+  hold(119 * 60, MODBEE_CHARGE_TAPER_CV, 15.0f, 0.3f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_EQUALIZE);
+  hold(60, MODBEE_CHARGE_TAPER_CV, 15.0f, 0.3f);
+  status = mppt.chargeProfile.getStatus();
+  MODBEE_CHECK(status.stage == MODBEE_STAGE_FLOAT);
+  MODBEE_CHECK(status.equalizeDueSeconds > 86400 - 3 * 3600);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 13.5f, 0.005f);
+}
+
+static void testLipoTerminates() {
+  // A new chemistry starts over from bulk
+  mppt.config.data.battery_type = MODBEE_BATTERY_LIPO;
+  mppt.config.data.charge_voltage = 12.6f;
+  feed(MODBEE_CHARGE_FAST_CC, 11.5f, 2.0f);
+  modbee_charge_profile_status_t status = mppt.chargeProfile.getStatus();
+  MODBEE_CHECK(status.stage == MODBEE_STAGE_BULK);
+  MODBEE_CHECK(status.cells == 3);
+  MODBEE_CHECK(terminationEnabled());
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 12.6f, 0.005f);
+
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_TAPER_CV, 12.6f, 1.0f);
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_TAPER_CV, 12.6f, 0.05f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_DONE);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 12.6f, 0.005f);
+
+  // The chip's own recharge threshold starts the next cycle
+  hold(10 * 60, MODBEE_CHARGE_DONE, 12.4f, 0.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_DONE);
+  hold(MODBEE_PROFILE_CONFIRM_S, MODBEE_CHARGE_FAST_CC, 12.0f, 2.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_BULK);
+}
+
+static void testStopRestoresConfig() {
+  mppt.config.data.charge_voltage = 12.3f;
+  mppt.config.data.profile_enable = false;
+  feed(MODBEE_CHARGE_FAST_CC, 12.0f, 2.0f);
+  MODBEE_CHECK(stage() == MODBEE_STAGE_OFF);
+  MODBEE_CHECK_NEAR(mppt.api.getChargeVoltage(), 12.3f, 0.005f);
+  MODBEE_CHECK(terminationEnabled());
+  MODBEE_CHECK(timerEnabled());
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("charge_profile");
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(mppt.begin());
+  ModbeeMpptConfigData& config = mppt.config.data;
+  config.profile_enable = true;
+  config.battery_type = MODBEE_BATTERY_LEAD_ACID;
+  config.charge_voltage = 14.4f;
+  config.charge_current = 2.0f;
+  config.termination_current = 0.1f;
+  config.absorption_minutes = 0;
+  config.equalize_days = 0;
+  config.fast_charge_timer_enable = true;
+
+  MODBEE_TEST(testBulkToAbsorption);
+  MODBEE_TEST(testDuskIsNotTail);
+  MODBEE_TEST(testTailToFloat);
+  MODBEE_TEST(testTemperatureCompensation);
+  MODBEE_TEST(testChargerReset);
+  MODBEE_TEST(testRebulk);
+  MODBEE_TEST(testEqualize);
+  MODBEE_TEST(testLipoTerminates);
+  MODBEE_TEST(testStopRestoresConfig);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_charge_profile");
+}
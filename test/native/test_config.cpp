@@ -0,0 +1,112 @@
+/*!
+ * @file test_config.cpp
+ *
+ * @brief Settings patches: validated as a whole, saved, and queued field by
+ * field, one patch after another, reaching data only when committed
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMpptConfig.h>
+
+// ==================== Helpers ====================
+
+static ModbeeMpptConfig config;
+
+static bool patch(const char* json, JsonDocument& result) {
+  JsonDocument doc;
+  deserializeJson(doc, json);
+  result.clear();
+  JsonObject errors = result["errors"].to<JsonObject>();
+  JsonArray changed = result["changed"].to<JsonArray>();
+  return config.applyPatch(doc.as<JsonVariantConst>(), errors, changed);
+}
+
+// ==================== Tests ====================
+
+static void testApplyAndSave() {
+  JsonDocument result;
+  MODBEE_CHECK(patch("{\"chargeCurrent\":1.5,\"capacityAh\":20}", result));
+  MODBEE_CHECK(result["changed"].size() == 2);
+  MODBEE_CHECK(config.commitPatch());
+  MODBEE_CHECK_NEAR(config.data.charge_current, 1.5f, 1e-6f);
+
+  // The file holds the patch once applyPatch() returns
+  ModbeeMpptConfig reloaded;
+  MODBEE_CHECK(reloaded.begin());
+  MODBEE_CHECK_NEAR(reloaded.data.charge_current, 1.5f, 1e-6f);
+  MODBEE_CHECK_NEAR(reloaded.data.battery_capacity_ah, 20.0f, 1e-6f);
+
+  // The same values again change nothing
+  MODBEE_CHECK(patch("{\"chargeCurrent\":1.5}", result));
+  MODBEE_CHECK(result["changed"].size() == 0);
+}
+
+static void testRejectWhole() {
+  JsonDocument result;
+  MODBEE_CHECK(!patch("{\"chargeCurrent\":1.0,\"cellCount\":9,\"noSuchKey\":1}", result));
+  MODBEE_CHECK(result["errors"]["cellCount"].is<const char*>());
+  MODBEE_CHECK(result["errors"]["noSuchKey"].is<const char*>());
+  MODBEE_CHECK(result["errors"]["chargeCurrent"].isNull());
+  MODBEE_CHECK(!config.commitPatch());
+  MODBEE_CHECK_NEAR(config.data.charge_current, 1.5f, 1e-6f);
+  MODBEE_CHECK(!patch("[1,2]", result));
+  MODBEE_CHECK(!patch("{\"mqttPort\":\"1883\"}", result));
+}
+
+static void testSecretKept() {
+  JsonDocument result;
+  MODBEE_CHECK(patch("{\"wifiSsid\":\"field\",\"wifiPassword\":\"hunter22\"}", result));
+  MODBEE_CHECK(patch("{\"wifiSsid\":\"field\",\"wifiPassword\":null}", result));
+  MODBEE_CHECK(result["changed"].size() == 0);
+  config.commitPatch();
+  MODBEE_CHECK(!strcmp(config.data.wifi_password, "hunter22"));
+  JsonDocument settings;
+  config.toSettingsJson(settings.to<JsonObject>());
+  MODBEE_CHECK(!strcmp(settings["wifiPassword"] | "?", ""));
+}
+
+static void testSequentialPatches() {
+  // Each patch starts from the one before it, so none is lost
+  JsonDocument result;
+  MODBEE_CHECK(patch("{\"mqttInterval\":30}", result));
+  MODBEE_CHECK(patch("{\"mqttBatch\":2}", result));
+  ModbeeMpptConfig reloaded;
+  MODBEE_CHECK(reloaded.begin());
+  MODBEE_CHECK(reloaded.data.mqtt_interval_s == 30);
+  MODBEE_CHECK(reloaded.data.mqtt_batch == 2);
+  config.commitPatch();
+}
+
+static void testStagedUntilCommit() {
+  // Other tasks patch while the main loop reads data: the patch waits for
+  // commitPatch(), yet the next patch and the settings readers see it
+  JsonDocument result;
+  MODBEE_CHECK(patch("{\"capacityAh\":40}", result));
+  MODBEE_CHECK_NEAR(config.data.battery_capacity_ah, 20.0f, 1e-6f);
+  MODBEE_CHECK(patch("{\"capacityAh\":40,\"chargeCurrent\":2.0}", result));
+  MODBEE_CHECK(result["changed"].size() == 1);
+  JsonDocument settings;
+  config.toSettingsJson(settings.to<JsonObject>());
+  MODBEE_CHECK_NEAR(settings["capacityAh"].as<float>(), 40.0f, 1e-6f);
+  MODBEE_CHECK_NEAR(config.data.charge_current, 1.5f, 1e-6f);
+
+  MODBEE_CHECK(config.commitPatch());
+  MODBEE_CHECK_NEAR(config.data.battery_capacity_ah, 40.0f, 1e-6f);
+  MODBEE_CHECK_NEAR(config.data.charge_current, 2.0f, 1e-6f);
+  MODBEE_CHECK(!config.commitPatch());
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("config");
+  MODBEE_CHECK(config.begin());
+
+  MODBEE_TEST(testApplyAndSave);
+  MODBEE_TEST(testRejectWhole);
+  MODBEE_TEST(testSecretKept);
+  MODBEE_TEST(testSequentialPatches);
+  MODBEE_TEST(testStagedUntilCommit);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_config");
+}
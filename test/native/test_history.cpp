@@ -0,0 +1,190 @@
+/*!
+ * @file test_history.cpp
+ *
+ * @brief History tiers: the 1-minute ring, the hourly LittleFS rollup and
+ * the stream encoder, over a year of simulated uptime
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMpptHistory.h>
+#include <new>
+
+// ==================== Heap accounting ====================
+
+// Every operator new in the process goes through here, so a test can see
+// the most the firmware code held at once. The size is kept in front of
+// the block; not inlined, so the compiler sees plain malloc() and free().
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+static const size_t HEAP_PREFIX = sizeof(max_align_t);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  uintptr_t block = (uintptr_t)malloc(size + HEAP_PREFIX);
+  if (!block) throw std::bad_alloc();
+  *(size_t*)block = size;
+  heapInUse += size;
+  if (heapInUse > heapPeak) heapPeak = heapInUse;
+  return (void*)(block + HEAP_PREFIX);
+}
+
+__attribute__((noinline)) void operator delete(void* pointer) noexcept {
+  if (!pointer) return;
+  uintptr_t block = (uintptr_t)pointer - HEAP_PREFIX;
+  heapInUse -= *(size_t*)block;
+  free((void*)block);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+// ==================== Helpers ====================
+
+static const uint64_t MINUTE_US = 60ULL * 1000000ULL;
+
+static ModbeeMpptHistory history;
+static uint32_t frameSequence = 0;
+
+// One frame per simulated minute: each commits a 1-minute record
+static void runMinutes(uint32_t minutes) {
+  modbee_telemetry_t frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.valid = true;
+  frame.charge_state = MODBEE_CHARGE_FAST_CC;
+  for (uint32_t i = 0; i < minutes; i++) {
+    ModbeeNative::advance(MINUTE_US);
+    frame.sequence = ++frameSequence;
+    frame.vbus.voltage = 18.0f + (frameSequence % 60) * 0.01f;
+    frame.vbus.current = 0.5f;
+    frame.battery.voltage = 12.5f;
+    frame.battery.current = -0.25f;
+    frame.system.voltage = 12.4f;
+    history.sample(frame, 80.0f);
+  }
+}
+
+// Stream a whole range in web-server-sized chunks, checking the binary records
+static uint32_t streamAll(const ModbeeMpptHistorySource& tier, uint32_t from, uint32_t to,
+                          size_t& peakDuring) {
+  size_t base = heapInUse;
+  heapPeak = heapInUse;
+  uint32_t records = 0;
+  uint32_t previous = 0;
+  bool ordered = true;
+  {
+    auto stream = std::make_shared<ModbeeMpptHistoryStream>(tier, MODBEE_HISTORY_BIN, from, to);
+    uint8_t chunk[1436];    // One TCP segment, as AsyncWebServer asks for
+    size_t carry = 0;
+    size_t n;
+    while ((n = stream->fill(chunk + carry, sizeof(chunk) - carry)) > 0) {
+      size_t available = carry + n;
+      size_t whole = available - available % sizeof(ModbeeMpptHistoryRecord);
+      for (size_t offset = 0; offset < whole; offset += sizeof(ModbeeMpptHistoryRecord)) {
+        ModbeeMpptHistoryRecord record;
+        memcpy(&record, chunk + offset, sizeof(record));
+        if (record.timestamp <= previous) ordered = false;
+        previous = record.timestamp;
+        records++;
+      }
+      carry = available - whole;
+      memmove(chunk, chunk + whole, carry);
+    }
+    MODBEE_CHECK(carry == 0);
+    MODBEE_CHECK(records == stream->recordCount());
+  }
+  MODBEE_CHECK(ordered);
+  MODBEE_CHECK(heapInUse == base);
+  peakDuring = heapPeak - base;
+  return records;
+}
+
+// ==================== Tests ====================
+
+static void testMinuteRing() {
+  runMinutes(MODBEE_HISTORY_CAPACITY + 10);
+  MODBEE_CHECK(history.endSequence() - history.firstSequence() == MODBEE_HISTORY_CAPACITY);
+  ModbeeMpptHistoryRecord newest;
+  MODBEE_CHECK(history.read(history.endSequence() - 1, newest));
+  MODBEE_CHECK(newest.timestamp == (uint32_t)(esp_timer_get_time() / 1000000LL));
+  MODBEE_CHECK(newest.vbat_mv == 12500);
+  MODBEE_CHECK(newest.ibat_ma == -250);
+  MODBEE_CHECK(newest.soc == 80);
+
+  // A time range selects just the records inside it
+  uint32_t from = newest.timestamp - 10 * 60;
+  size_t peak;
+  MODBEE_CHECK(streamAll(history, from, newest.timestamp, peak) == 11);
+}
+
+static void testFullYear() {
+  // A year and a day of uptime: well past the 49.7 days after which
+  // millis() / 1000 would have wrapped, and past the rollup capacity
+  uint32_t hours = MODBEE_HISTORY_ROLLUP_CAPACITY + 24;
+  uint32_t done = (uint32_t)(history.endSequence() / MODBEE_HISTORY_ROLLUP_RECORDS);
+  runMinutes((hours - done) * MODBEE_HISTORY_ROLLUP_RECORDS);
+
+  const ModbeeMpptHistoryRollup& rollup = history.rollup;
+  MODBEE_CHECK(rollup.endSequence() == hours);
+  MODBEE_CHECK(rollup.endSequence() - rollup.firstSequence() == MODBEE_HISTORY_ROLLUP_CAPACITY);
+
+  ModbeeMpptHistoryRecord newest;
+  MODBEE_CHECK(rollup.read(rollup.endSequence() - 1, newest));
+  MODBEE_CHECK(newest.timestamp > 4294967UL);  // Where millis() / 1000 tops out
+  MODBEE_CHECK(newest.timestamp <= rollup.clock());
+  MODBEE_CHECK(newest.vbus_mv >= 18000 && newest.vbus_mv <= 18600);
+  MODBEE_CHECK(newest.ibus_ma == 500);
+  MODBEE_CHECK(newest.charge_state == MODBEE_CHARGE_FAST_CC);
+
+  // The whole year streams with memory that does not grow with the range
+  size_t peakYear;
+  size_t peakDay;
+  MODBEE_CHECK(streamAll(rollup, 0, UINT32_MAX, peakYear) == MODBEE_HISTORY_ROLLUP_CAPACITY);
+  MODBEE_CHECK(streamAll(rollup, newest.timestamp - 23 * 3600, UINT32_MAX, peakDay) == 24);
+  printf("stream peak heap: %zu bytes for a year, %zu for a day\n", peakYear, peakDay);
+  MODBEE_CHECK(peakYear <= 2048);
+  MODBEE_CHECK(peakYear == peakDay);
+}
+
+static void testReboot() {
+  // A new boot carries on from the newest record, so timestamps keep increasing
+  ModbeeMpptHistoryRollup reopened;
+  MODBEE_CHECK(reopened.begin());
+  MODBEE_CHECK(reopened.endSequence() == history.rollup.endSequence());
+  ModbeeMpptHistoryRecord newest;
+  MODBEE_CHECK(reopened.read(reopened.endSequence() - 1, newest));
+  MODBEE_CHECK(reopened.clock() >= newest.timestamp + esp_timer_get_time() / 1000000LL);
+
+  ModbeeMpptHistoryRecord minute;
+  memset(&minute, 0, sizeof(minute));
+  for (uint32_t i = 1; i <= MODBEE_HISTORY_ROLLUP_RECORDS; i++) {
+    minute.timestamp = i * 60;    // Uptime of the new boot
+    reopened.add(minute);
+  }
+  ModbeeMpptHistoryRecord next;
+  MODBEE_CHECK(reopened.read(reopened.endSequence() - 1, next));
+  MODBEE_CHECK(next.timestamp == newest.timestamp + 3600);
+}
+
+static void testInvalidFile() {
+  File file = LittleFS.open(MODBEE_HISTORY_ROLLUP_FILE, "r+");
+  file.write((const uint8_t*)"junk", 4);
+  file.close();
+  ModbeeMpptHistoryRollup damaged;
+  MODBEE_CHECK(!damaged.begin());
+  MODBEE_CHECK(damaged.endSequence() == 0);
+  MODBEE_CHECK(!LittleFS.exists(MODBEE_HISTORY_ROLLUP_FILE));
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("history");
+  history.begin();
+
+  MODBEE_TEST(testMinuteRing);
+  MODBEE_TEST(testFullYear);
+  MODBEE_TEST(testReboot);
+  MODBEE_TEST(testInvalidFile);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_history");
+}
@@ -0,0 +1,263 @@
+/*!
+ * @file test_modbus.cpp
+ *
+ * @brief Modbus RTU slave over a pseudo-terminal, driven by a reference
+ * master in this file: CRC16 against a bitwise implementation, input
+ * registers served from the cached telemetry frame without I2C, holding
+ * register reads and writes, exceptions, and frame boundaries from the
+ * T3.5 gap
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798SimPlant.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+// ==================== Helpers ====================
+
+static const uint8_t SLAVE = 7;
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static BQ25798SimPanel panel;
+static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 20.0f, 0.3f);
+static int line = -1;   // The master's end of the pty
+
+typedef std::vector<uint8_t> Frame;
+
+// Serial1 on the pty's master side, as "modbee_native --rs485" does; the
+// test talks on the terminal side like a USB-RS485 adapter
+static bool openLine() {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return false;
+  const char* path = ptsname(master);
+  line = path ? open(path, O_RDWR | O_NOCTTY | O_NONBLOCK) : -1;
+  if (line < 0) return false;
+  struct termios tio;
+  tcgetattr(line, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(line, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL, 0) | O_NONBLOCK);
+  Serial1.hostAttach(master);
+  return true;
+}
+
+// Reference CRC: bit by bit, straight from the Modbus over serial line spec
+static uint16_t referenceCrc(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+static Frame request(uint8_t address, std::initializer_list<uint8_t> pdu) {
+  Frame frame;
+  frame.reserve(pdu.size() + 3);
+  frame.push_back(address);
+  for (uint8_t b : pdu) frame.push_back(b);
+  uint16_t crc = referenceCrc(frame.data(), frame.size());
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  return frame;
+}
+
+static void send(const Frame& frame) {
+  MODBEE_CHECK(write(line, frame.data(), frame.size()) == (ssize_t)frame.size());
+}
+
+// Poll the UART until the line has been quiet for 20 ms after a reply, or
+// 100 ms with none; an empty frame means no reply
+static Frame receive() {
+  Frame reply;
+  uint8_t buffer[256];
+  for (int quiet = 0; quiet < (reply.empty() ? 100 : 20); quiet++) {
+    Serial1.hostPoll();
+    ssize_t n = read(line, buffer, sizeof(buffer));
+    if (n > 0) {
+      reply.insert(reply.end(), buffer, buffer + n);
+      quiet = 0;
+    }
+    usleep(1000);
+  }
+  return reply;
+}
+
+static Frame transact(const Frame& frame) {
+  send(frame);
+  return receive();
+}
+
+static bool crcOk(const Frame& reply) {
+  return reply.size() >= 4 &&
+         referenceCrc(reply.data(), reply.size() - 2) == (reply[reply.size() - 2] | reply[reply.size() - 1] << 8);
+}
+
+static uint16_t word(const Frame& reply, size_t index) {
+  return (uint16_t)(reply[3 + index * 2] << 8 | reply[4 + index * 2]);
+}
+
+// An exception reply: function with the top bit set, and the code
+static bool isException(const Frame& reply, uint8_t function, uint8_t code) {
+  return reply.size() == 5 && crcOk(reply) && reply[0] == SLAVE && reply[1] == (function | 0x80) && reply[2] == code;
+}
+
+static void run(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += 20) {
+    mppt.loop();
+    ModbeeNative::advance(20000);
+  }
+}
+
+// ==================== Tests ====================
+
+static void testCrc() {
+  // The catalogue check value of CRC-16/MODBUS
+  MODBEE_CHECK(ModbeeMpptModbus::crc16((const uint8_t*)"123456789", 9) == 0x4B37);
+  uint8_t data[256];
+  uint32_t seed = 1;
+  for (size_t length = 0; length <= sizeof(data); length += 17) {
+    for (size_t i = 0; i < length; i++) data[i] = (uint8_t)((seed = seed * 1103515245 + 12345) >> 16);
+    MODBEE_CHECK(ModbeeMpptModbus::crc16(data, length) == referenceCrc(data, length));
+  }
+}
+
+static void testInputRegisters() {
+  // The whole map in one read, served from the cached frame: no I2C at all
+  modbee_telemetry_t t = mppt.api.getTelemetry();
+  MODBEE_CHECK(t.valid && t.battery.voltage > 9.0f);
+  uint32_t transfers = ModbeeNativeI2C::transfers();
+  Frame reply = transact(request(SLAVE, {0x04, 0x00, 0x00, 0x00, MODBEE_MODBUS_IR_COUNT}));
+  MODBEE_CHECK(ModbeeNativeI2C::transfers() == transfers);
+  MODBEE_CHECK(reply.size() == 5u + MODBEE_MODBUS_IR_COUNT * 2);
+  if (reply.size() != 5u + MODBEE_MODBUS_IR_COUNT * 2) return;
+  MODBEE_CHECK(crcOk(reply));
+  MODBEE_CHECK(reply[0] == SLAVE && reply[1] == 0x04 && reply[2] == MODBEE_MODBUS_IR_COUNT * 2);
+
+  MODBEE_CHECK(word(reply, MODBEE_MODBUS_IR_VBUS_MV) == lroundf(t.vbus.voltage * 1000.0f));
+  MODBEE_CHECK(word(reply, MODBEE_MODBUS_IR_VBAT_MV) == lroundf(t.battery.voltage * 1000.0f));
+  MODBEE_CHECK((int16_t)word(reply, MODBEE_MODBUS_IR_IBAT_MA) == lroundf(t.battery.current * 1000.0f));
+  MODBEE_CHECK(word(reply, MODBEE_MODBUS_IR_VAC1_MV) == lroundf(t.vac1.voltage * 1000.0f));
+  MODBEE_CHECK(word(reply, MODBEE_MODBUS_IR_CHARGE_STATE) == t.charge_state);
+  MODBEE_CHECK(word(reply, MODBEE_MODBUS_IR_SEQUENCE) == (uint16_t)t.sequence);
+  MODBEE_CHECK(word(reply, MODBEE_MODBUS_IR_FRAME_AGE_MS) < 1000);
+  uint32_t uptime = (uint32_t)word(reply, MODBEE_MODBUS_IR_UPTIME_HI) << 16 | word(reply, MODBEE_MODBUS_IR_UPTIME_LO);
+  MODBEE_CHECK(uptime == millis() / 1000);
+
+  // A window inside the map, and one running past its end
+  reply = transact(request(SLAVE, {0x04, 0x00, MODBEE_MODBUS_IR_VBAT_MV, 0x00, 0x02}));
+  MODBEE_CHECK(reply.size() == 9 && word(reply, 0) == lroundf(t.battery.voltage * 1000.0f));
+  reply = transact(request(SLAVE, {0x04, 0x00, MODBEE_MODBUS_IR_UPTIME_LO, 0x00, 0x02}));
+  MODBEE_CHECK(isException(reply, 0x04, 0x02));
+}
+
+static void testHoldingRegisters() {
+  // chargeCurrent is config field 3: registers 6 and 7, milliamps
+  mppt.config.data.charge_current = 1.0f;
+  Frame reply = transact(request(SLAVE, {0x03, 0x00, 0x06, 0x00, 0x02}));
+  MODBEE_CHECK(reply.size() == 9 && crcOk(reply));
+  if (reply.size() != 9) return;
+  MODBEE_CHECK(word(reply, 0) == 0 && word(reply, 1) == 1000);
+
+  // Function 16 over the whole field, echoed as start and count
+  Frame frame = request(SLAVE, {0x10, 0x00, 0x06, 0x00, 0x02, 0x04, 0x00, 0x00, 0x05, 0xDC});
+  reply = transact(frame);
+  MODBEE_CHECK(reply.size() == 8 && crcOk(reply) && memcmp(reply.data(), frame.data(), 6) == 0);
+
+  // Read back at once, before the main loop has committed the write
+  MODBEE_CHECK_NEAR(mppt.config.data.charge_current, 1.0f, 1e-6f);
+  reply = transact(request(SLAVE, {0x03, 0x00, 0x06, 0x00, 0x02}));
+  MODBEE_CHECK(reply.size() == 9 && word(reply, 1) == 1500);
+  run(20);
+  MODBEE_CHECK_NEAR(mppt.config.data.charge_current, 1.5f, 1e-6f);
+
+  // Function 06 on the low word, echoed whole
+  frame = request(SLAVE, {0x06, 0x00, 0x07, 0x04, 0xB0});
+  reply = transact(frame);
+  MODBEE_CHECK(reply == frame);
+  run(20);
+  MODBEE_CHECK_NEAR(mppt.config.data.charge_current, 1.2f, 1e-6f);
+
+  // Out of range, half a field, and a request where one of two fields is
+  // bad: each refused, nothing written
+  reply = transact(request(SLAVE, {0x06, 0x00, 0x07, 0x27, 0x10}));   // 10 A
+  MODBEE_CHECK(isException(reply, 0x06, 0x03));
+  reply = transact(request(SLAVE, {0x06, 0x00, 0x06, 0x00, 0x01}));
+  MODBEE_CHECK(isException(reply, 0x06, 0x02));
+  reply = transact(request(SLAVE, {0x10, 0x00, 0x06, 0x00, 0x04, 0x08,
+                                   0x00, 0x00, 0x07, 0xD0, 0x00, 0x00, 0xC3, 0x50}));  // 2 A, 50 V
+  MODBEE_CHECK(isException(reply, 0x10, 0x03));
+  run(20);
+  MODBEE_CHECK_NEAR(mppt.config.data.charge_current, 1.2f, 1e-6f);
+
+  // A function the slave does not have
+  reply = transact(request(SLAVE, {0x2B, 0x0E, 0x01, 0x00}));
+  MODBEE_CHECK(isException(reply, 0x2B, 0x01));
+}
+
+static void testFraming() {
+  modbee_modbus_status_t before = mppt.modbus.getStatus();
+
+  // A corrupted CRC and another slave's request go unanswered
+  Frame frame = request(SLAVE, {0x04, 0x00, 0x00, 0x00, 0x01});
+  frame.back() ^= 0x01;
+  MODBEE_CHECK(transact(frame).empty());
+  MODBEE_CHECK(transact(request(SLAVE + 1, {0x04, 0x00, 0x00, 0x00, 0x01})).empty());
+
+  // A broadcast write is applied, never answered
+  MODBEE_CHECK(transact(request(0, {0x06, 0x00, 0x07, 0x03, 0xE8})).empty());
+  run(20);
+  MODBEE_CHECK_NEAR(mppt.config.data.charge_current, 1.0f, 1e-6f);
+
+  // A gap longer than T3.5 inside a request ends the frame: two bad halves
+  frame = request(SLAVE, {0x04, 0x00, 0x00, 0x00, 0x01});
+  send(Frame(frame.begin(), frame.begin() + 3));
+  for (int i = 0; i < 10; i++) {
+    Serial1.hostPoll();
+    usleep(1000);
+  }
+  MODBEE_CHECK(transact(Frame(frame.begin() + 3, frame.end())).empty());
+
+  // The line is usable straight after
+  Frame reply = transact(frame);
+  MODBEE_CHECK(reply.size() == 7 && crcOk(reply));
+
+  modbee_modbus_status_t after = mppt.modbus.getStatus();
+  MODBEE_CHECK(after.crcErrors == before.crcErrors + 3);
+  MODBEE_CHECK(after.otherSlaves == before.otherSlaves + 1);
+  MODBEE_CHECK(after.requests == before.requests + 2);
+  MODBEE_CHECK(after.exceptions == before.exceptions);
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("modbus");
+  panel.setConditions(1000.0f, 25.0f);
+  charger.attachInput(1, &panel);
+  charger.attachBattery(&battery);
+  charger.setTemperature(25.0f);
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(openLine());
+  MODBEE_CHECK(mppt.begin());
+
+  // 115200 8N1: T3.5 is 1.75 ms
+  ModbeeMpptConfigData& config = mppt.config.data;
+  config.modbus_enable = true;
+  config.modbus_address = SLAVE;
+  config.modbus_baud = 115200;
+  config.modbus_parity = 0;
+  run(3000);
+  MODBEE_CHECK(mppt.modbus.getStatus().running);
+
+  MODBEE_TEST(testCrc);
+  MODBEE_TEST(testInputRegisters);
+  MODBEE_TEST(testHoldingRegisters);
+  MODBEE_TEST(testFraming);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_modbus");
+}
@@ -0,0 +1,283 @@
+/*!
+ * @file test_modbus_master.cpp
+ *
+ * @brief Modbus RTU master against simulated slaves on a pseudo-terminal:
+ * the fleet table, per-peer adaptive timeouts, the bus turnaround gap, a
+ * dead peer going offline and retried only every few cycles, and the
+ * totals with this unit included
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798SimPlant.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+// ==================== Helpers ====================
+
+static const uint64_t STEP_US = 1000ULL;
+static const uint8_t FIRST_PEER = 2;
+static const uint8_t PEERS = 3;
+
+// One peer on the line: answers its polls after a latency, or not at all
+struct SimSlave {
+  uint8_t address;
+  uint32_t latencyUs;
+  bool alive;
+  uint16_t powerCw;             // Input power (0.01 W)
+  uint16_t faults;
+  uint32_t polls;
+  bool corruptNext;             // Flip a CRC bit in the next reply
+};
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 20.0f, 0.5f);
+static int line = -1;           // The slaves' end of the pty
+static std::vector<uint8_t> pending;
+
+static SimSlave slaves[PEERS] = {
+  {2, 5000, true, 1000, 0x0000, 0, false},
+  {3, 40000, true, 1250, 0x0100, 0, false},
+  {4, 5000, false, 800, 0x0000, 0, false},
+};
+
+// Reply queued for its latency
+static std::vector<uint8_t> reply;
+static uint64_t replyAtUs = 0;
+
+// Bus gaps: from the end of a reply to the next request on the line
+static uint64_t lastReplyUs = 0;
+static uint64_t minGapUs = UINT64_MAX;
+
+static bool openLine() {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return false;
+  const char* path = ptsname(master);
+  line = path ? open(path, O_RDWR | O_NOCTTY | O_NONBLOCK) : -1;
+  if (line < 0) return false;
+  struct termios tio;
+  tcgetattr(line, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(line, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL, 0) | O_NONBLOCK);
+  Serial1.hostAttach(master);
+  return true;
+}
+
+static uint16_t referenceCrc(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+static SimSlave* slaveAt(uint8_t address) {
+  for (SimSlave& slave : slaves) {
+    if (slave.address == address) return &slave;
+  }
+  return nullptr;
+}
+
+static void putWord(std::vector<uint8_t>& frame, uint16_t value) {
+  frame.push_back(value >> 8);
+  frame.push_back(value & 0xFF);
+}
+
+// Input registers 0..15 of a peer: fixed values around its input power
+static std::vector<uint8_t> pollReply(const SimSlave& slave) {
+  std::vector<uint8_t> frame = {slave.address, 0x04, MODBEE_MODBUS_POLL_REGISTERS * 2};
+  uint16_t regs[MODBEE_MODBUS_POLL_REGISTERS] = {0};
+  regs[MODBEE_MODBUS_IR_VBUS_MV] = 18000;
+  regs[MODBEE_MODBUS_IR_VBUS_CW] = slave.powerCw;
+  regs[MODBEE_MODBUS_IR_VBAT_MV] = 12600;
+  regs[MODBEE_MODBUS_IR_IBAT_MA] = (uint16_t)(int16_t)-250;
+  regs[MODBEE_MODBUS_IR_VBAT_CW] = (uint16_t)(int16_t)-315;
+  regs[MODBEE_MODBUS_IR_CHARGE_STATE] = MODBEE_CHARGE_FAST_CC;
+  regs[MODBEE_MODBUS_IR_FAULTS] = slave.faults;
+  regs[MODBEE_MODBUS_IR_SOC_DPCT] = 100 * slave.address;
+  regs[MODBEE_MODBUS_IR_SEQUENCE] = (uint16_t)slave.polls;
+  for (uint16_t value : regs) putWord(frame, value);
+  uint16_t crc = referenceCrc(frame.data(), frame.size());
+  frame.push_back(crc & 0xFF);
+  frame.push_back((crc >> 8) ^ (slave.corruptNext ? 0x01 : 0x00));
+  return frame;
+}
+
+// The line from the slaves' side: take requests, send due replies
+static void serviceSlaves() {
+  uint64_t now = ModbeeNative::now();
+  uint8_t buffer[64];
+  ssize_t n;
+  while ((n = read(line, buffer, sizeof(buffer))) > 0) pending.insert(pending.end(), buffer, buffer + n);
+  while (pending.size() >= 8) {
+    MODBEE_CHECK(referenceCrc(pending.data(), 6) == (pending[6] | pending[7] << 8));
+    MODBEE_CHECK(pending[1] == 0x04 && pending[3] == 0 && pending[5] == MODBEE_MODBUS_POLL_REGISTERS);
+    if (lastReplyUs && now - lastReplyUs < minGapUs) minGapUs = now - lastReplyUs;
+    lastReplyUs = 0;
+    SimSlave* slave = slaveAt(pending[0]);
+    if (slave) {
+      slave->polls++;
+      if (slave->alive) {
+        reply = pollReply(*slave);
+        slave->corruptNext = false;
+        replyAtUs = now + slave->latencyUs;
+      }
+    }
+    pending.erase(pending.begin(), pending.begin() + 8);
+  }
+  if (!reply.empty() && now >= replyAtUs) {
+    MODBEE_CHECK(write(line, reply.data(), reply.size()) == (ssize_t)reply.size());
+    reply.clear();
+    lastReplyUs = now;
+    // The UART takes the bytes in, then reports the frame once the line
+    // has been quiet for T3.5, in wall time
+    Serial1.hostPoll();
+    usleep(2500);
+    Serial1.hostPoll();
+  }
+}
+
+static void run(uint32_t ms) {
+  for (uint64_t t = 0; t < ms * 1000ULL; t += STEP_US) {
+    mppt.loop();
+    serviceSlaves();
+    ModbeeNative::advance(STEP_US);
+  }
+}
+
+static modbee_fleet_unit_t unit(uint8_t address) {
+  modbee_fleet_unit_t units[MODBEE_MODBUS_MAX_PEERS];
+  size_t count = mppt.modbus.master.getUnits(units);
+  for (size_t i = 0; i < count; i++) {
+    if (units[i].address == address) return units[i];
+  }
+  modbee_fleet_unit_t none;
+  memset(&none, 0, sizeof(none));
+  return none;
+}
+
+// ==================== Tests ====================
+
+static void testFleetTable() {
+  run(5000);
+  modbee_fleet_unit_t fast = unit(2);
+  MODBEE_CHECK(fast.online && fast.valid);
+  MODBEE_CHECK_NEAR(fast.inputPower, 10.0f, 1e-4f);
+  MODBEE_CHECK_NEAR(fast.vbusVoltage, 18.0f, 1e-4f);
+  MODBEE_CHECK_NEAR(fast.batteryVoltage, 12.6f, 1e-4f);
+  MODBEE_CHECK_NEAR(fast.batteryCurrent, -0.25f, 1e-4f);
+  MODBEE_CHECK_NEAR(fast.batteryPower, -3.15f, 1e-4f);
+  MODBEE_CHECK_NEAR(fast.soc, 20.0f, 1e-4f);
+  MODBEE_CHECK(fast.chargeState == MODBEE_CHARGE_FAST_CC);
+  MODBEE_CHECK(fast.sequence == (uint16_t)slaves[0].polls);
+  MODBEE_CHECK(fast.timeouts == 0 && fast.errors == 0);
+
+  modbee_fleet_unit_t slow = unit(3);
+  MODBEE_CHECK(slow.online && slow.faults == 0x0100);
+
+  // The dead peer is given up on after three misses
+  modbee_fleet_unit_t dead = unit(4);
+  MODBEE_CHECK(!dead.online && !dead.valid);
+  MODBEE_CHECK(dead.misses >= MODBEE_MODBUS_OFFLINE_MISSES);
+  MODBEE_CHECK(dead.timeouts == dead.polls);
+}
+
+static void testAdaptiveTimeouts() {
+  // Each live peer's timeout follows its own response time, well under the
+  // initial one; the dead peer's has backed off to the maximum
+  modbee_fleet_unit_t fast = unit(2);
+  modbee_fleet_unit_t slow = unit(3);
+  modbee_fleet_unit_t dead = unit(4);
+  MODBEE_CHECK(fast.srttUs >= 5000 && fast.srttUs < 8000);
+  MODBEE_CHECK(slow.srttUs >= 40000 && slow.srttUs < 43000);
+  MODBEE_CHECK(fast.timeoutUs >= fast.srttUs + MODBEE_MODBUS_TIMEOUT_MARGIN_US);
+  MODBEE_CHECK(slow.timeoutUs >= slow.srttUs + MODBEE_MODBUS_TIMEOUT_MARGIN_US);
+  MODBEE_CHECK(fast.timeoutUs < slow.timeoutUs);
+  MODBEE_CHECK(slow.timeoutUs < MODBEE_MODBUS_TIMEOUT_INITIAL_US);
+  MODBEE_CHECK(dead.timeoutUs == MODBEE_MODBUS_TIMEOUT_MAX_US);
+}
+
+static void testTurnaround() {
+  // No request goes out before T3.5 plus the turnaround gap after a reply
+  MODBEE_CHECK(minGapUs != UINT64_MAX);
+  MODBEE_CHECK(minGapUs >= 1750 + MODBEE_MODBUS_TURNAROUND_US);
+}
+
+static void testOfflineRetry() {
+  // The dead peer gets one poll in MODBEE_MODBUS_RETRY_CYCLES, so the cycle
+  // keeps its period for the live ones
+  uint32_t deadPolls = slaves[2].polls;
+  uint32_t fastPolls = slaves[0].polls;
+  uint32_t cycles = mppt.modbus.master.getSummary().cycles;
+  run(20 * MODBEE_MODBUS_CYCLE_MS);
+  MODBEE_CHECK(slaves[0].polls - fastPolls >= 19);
+  MODBEE_CHECK(mppt.modbus.master.getSummary().cycles - cycles >= 19);
+  uint32_t retries = slaves[2].polls - deadPolls;
+  MODBEE_CHECK(retries >= 1 && retries <= 3);
+  MODBEE_CHECK(unit(2).timeouts == 0);
+}
+
+static void testBadReply() {
+  // A corrupted reply is an error, not a timeout, and one does not take the peer offline
+  slaves[1].corruptNext = true;
+  run(2 * MODBEE_MODBUS_CYCLE_MS);
+  modbee_fleet_unit_t slow = unit(3);
+  MODBEE_CHECK(slow.errors == 1 && slow.timeouts == 0);
+  MODBEE_CHECK(slow.online && slow.misses == 0);
+}
+
+static void testRecovery() {
+  // The dead peer comes up: its next retry finds it
+  slaves[2].alive = true;
+  run((MODBEE_MODBUS_RETRY_CYCLES + 1) * MODBEE_MODBUS_CYCLE_MS);
+  modbee_fleet_unit_t revived = unit(4);
+  MODBEE_CHECK(revived.online && revived.valid && revived.misses == 0);
+  MODBEE_CHECK(revived.timeoutUs < MODBEE_MODBUS_TIMEOUT_INITIAL_US);
+
+  // Totals over every unit online, this one included
+  modbee_fleet_summary_t summary = mppt.modbus.master.getSummary();
+  modbee_telemetry_t own = mppt.api.getTelemetry();
+  MODBEE_CHECK(summary.running && summary.peers == PEERS);
+  MODBEE_CHECK(summary.online == PEERS + (own.valid ? 1 : 0));
+  MODBEE_CHECK(summary.faulted == 1);
+  MODBEE_CHECK_NEAR(summary.inputPower, 10.0f + 12.5f + 8.0f + (own.valid ? own.vbus.power : 0.0f), 0.01f);
+
+  // Energy is integrated over the replies of each peer
+  modbee_fleet_unit_t fast = unit(2);
+  MODBEE_CHECK(fast.energyWh > 0.0f);
+  MODBEE_CHECK(fast.energyWh < 10.0f * millis() / 3600000.0f);
+  MODBEE_CHECK(summary.energyWh >= fast.energyWh + unit(3).energyWh);
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("modbus_master");
+  charger.attachBattery(&battery);
+  charger.setTemperature(25.0f);
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(openLine());
+  MODBEE_CHECK(mppt.begin());
+
+  ModbeeMpptConfigData& config = mppt.config.data;
+  config.modbus_enable = true;
+  config.modbus_master = true;
+  config.modbus_peer_first = FIRST_PEER;
+  config.modbus_peer_count = PEERS;
+  config.modbus_baud = 115200;
+  config.modbus_parity = 0;
+
+  MODBEE_TEST(testFleetTable);
+  MODBEE_TEST(testAdaptiveTimeouts);
+  MODBEE_TEST(testTurnaround);
+  MODBEE_TEST(testOfflineRetry);
+  MODBEE_TEST(testBadReply);
+  MODBEE_TEST(testRecovery);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_modbus_master");
+}
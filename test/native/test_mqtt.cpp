@@ -0,0 +1,430 @@
+/*!
+ * @file test_mqtt.cpp
+ *
+ * @brief MQTT publisher against a minimal broker on a localhost socket: the
+ * LittleFS spool (order, wrap, dropping the oldest, reopen, a bad header),
+ * batching, one session per batch when it cannot linger, replay in order
+ * after an outage, and the packet identifier wrapping to 1
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798SimPlant.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// ==================== Helpers ====================
+
+static const uint64_t STEP_US = 10000ULL;
+
+class ModbeeMpptMqttTest {
+public:
+  static void setPacketId(ModbeeMpptMqtt& mqtt, uint16_t id) { mqtt._packetId = id; }
+};
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 20.0f, 0.8f);  // Well above power save
+
+// One PUBLISH as the broker received it
+struct Received {
+  std::string topic;
+  uint8_t flags;
+  uint16_t id;
+  std::string payload;
+};
+
+// The broker: one session at a time, accepts any CONNECT, acknowledges
+// every QoS 1 PUBLISH (after ackDelayUs) and answers PINGREQ
+static int listener = -1;
+static int session = -1;
+static uint16_t brokerPort = 0;
+static std::vector<uint8_t> inbound;
+static std::vector<Received> received;
+static uint32_t connects = 0;
+static uint32_t disconnects = 0;
+static uint64_t ackDelayUs = 0;
+static std::vector<std::pair<uint64_t, uint16_t>> acks;  // Due time, packet identifier
+
+static bool brokerUp() {
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) return false;
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(brokerPort);  // 0 the first time: any free port
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1) != 0 ||
+      getsockname(listener, (struct sockaddr*)&address, &length) != 0) {
+    close(listener);
+    listener = -1;
+    return false;
+  }
+  brokerPort = ntohs(address.sin_port);
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+  return true;
+}
+
+static void endBrokerSession() {
+  if (session >= 0) close(session);
+  session = -1;
+  inbound.clear();
+  acks.clear();
+}
+
+static void brokerDown() {
+  endBrokerSession();
+  if (listener >= 0) close(listener);
+  listener = -1;
+}
+
+static void brokerSend(const uint8_t* data, size_t length) {
+  if (session >= 0 && send(session, data, length, MSG_NOSIGNAL) != (ssize_t)length) endBrokerSession();
+}
+
+static void brokerHandle(uint8_t type, const uint8_t* body, size_t length) {
+  switch (type & 0xF0) {
+    case 0x10: {  // CONNECT
+      connects++;
+      const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+      brokerSend(connack, sizeof(connack));
+      break;
+    }
+    case 0x30: {  // PUBLISH
+      Received publish;
+      size_t topicLength = body[0] << 8 | body[1];
+      publish.topic.assign((const char*)body + 2, topicLength);
+      publish.flags = type & 0x0F;
+      size_t offset = 2 + topicLength;
+      publish.id = 0;
+      if (publish.flags & 0x06) {
+        publish.id = body[offset] << 8 | body[offset + 1];
+        offset += 2;
+        acks.push_back(std::make_pair(ModbeeNative::now() + ackDelayUs, publish.id));
+      }
+      publish.payload.assign((const char*)body + offset, length - offset);
+      received.push_back(publish);
+      break;
+    }
+    case 0xC0: {  // PINGREQ
+      const uint8_t pingresp[] = {0xD0, 0x00};
+      brokerSend(pingresp, sizeof(pingresp));
+      break;
+    }
+    case 0xE0:  // DISCONNECT
+      disconnects++;
+      endBrokerSession();
+      break;
+  }
+}
+
+static void brokerPoll() {
+  if (listener >= 0 && session < 0) {
+    session = accept(listener, nullptr, nullptr);
+    if (session >= 0) fcntl(session, F_SETFL, fcntl(session, F_GETFL, 0) | O_NONBLOCK);
+  }
+  uint8_t buffer[4096];
+  bool closed = false;
+  while (session >= 0) {
+    ssize_t n = recv(session, buffer, sizeof(buffer), 0);
+    if (n > 0) inbound.insert(inbound.end(), buffer, buffer + n);
+    closed = n == 0;
+    if (n <= 0) break;
+  }
+
+  // Whole packets: the type byte and the remaining length (variable byte integer)
+  while (session >= 0 && inbound.size() >= 2) {
+    size_t remaining = 0;
+    size_t used = 1;
+    bool complete = false;
+    for (int shift = 0; used < 5 && used < inbound.size(); shift += 7) {
+      uint8_t b = inbound[used++];
+      remaining |= (size_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || inbound.size() < used + remaining) break;
+    std::vector<uint8_t> packet(inbound.begin(), inbound.begin() + used + remaining);
+    inbound.erase(inbound.begin(), inbound.begin() + used + remaining);
+    brokerHandle(packet[0], packet.data() + used, remaining);
+  }
+  if (closed) endBrokerSession();
+
+  while (session >= 0 && !acks.empty() && acks.front().first <= ModbeeNative::now()) {
+    uint16_t id = acks.front().second;
+    acks.erase(acks.begin());
+    const uint8_t puback[] = {0x40, 0x02, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+    brokerSend(puback, sizeof(puback));
+  }
+}
+
+static void run(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += STEP_US / 1000) {
+    mppt.loop();
+    AsyncClient::hostPollAll();
+    brokerPoll();
+    AsyncClient::hostPollAll();
+    ModbeeNative::advance(STEP_US);
+  }
+}
+
+// Run until the broker holds this many publishes and the last PUBACK is
+// taken, at most timeoutMs
+static bool runUntilReceived(size_t count, uint32_t timeoutMs) {
+  for (uint32_t t = 0; t < timeoutMs && received.size() < count; t += STEP_US / 1000) run(STEP_US / 1000);
+  run(100);
+  return received.size() >= count;
+}
+
+static bool endsWith(const std::string& text, const char* suffix) {
+  size_t length = strlen(suffix);
+  return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Batch sequence number and sample count of a telemetry publish
+static long batchSequence(const Received& publish, size_t* samples = nullptr) {
+  JsonDocument doc;
+  if (deserializeJson(doc, publish.payload)) return -1;
+  if (samples) *samples = doc["samples"].size();
+  return doc["seq"] | -1L;
+}
+
+// Spool payloads that say which push they were
+static size_t spoolPayload(uint32_t index, size_t length, char* payload) {
+  for (size_t i = 0; i < length; i++) payload[i] = 'a' + (index + i) % 26;
+  snprintf(payload, length, "%lu", (unsigned long)index);
+  payload[strlen(payload)] = ':';
+  return length;
+}
+
+static bool spoolHeadIs(ModbeeMpptMqttSpool& spool, uint32_t index, size_t length, uint8_t kind) {
+  static char expected[MODBEE_MQTT_PAYLOAD_MAX];
+  static char payload[MODBEE_MQTT_PAYLOAD_MAX];
+  uint8_t headKind = 0xFF;
+  spoolPayload(index, length, expected);
+  return spool.peek(headKind, payload) == length && headKind == kind && memcmp(payload, expected, length) == 0;
+}
+
+// ==================== Tests ====================
+
+static void testSpoolOrder() {
+  static char payload[MODBEE_MQTT_PAYLOAD_MAX];
+  ModbeeMpptMqttSpool spool;
+  MODBEE_CHECK(spool.begin());
+  MODBEE_CHECK(spool.count() == 0 && spool.bytes() == 0);
+  MODBEE_CHECK(!spool.push(MODBEE_MQTT_TELEMETRY, payload, 0));
+  MODBEE_CHECK(!spool.push(MODBEE_MQTT_TELEMETRY, payload, MODBEE_MQTT_PAYLOAD_MAX + 1));
+
+  for (uint32_t i = 0; i < 3; i++) {
+    MODBEE_CHECK(spool.push(i % 2, payload, spoolPayload(i, 100 + i, payload)));
+  }
+  MODBEE_CHECK(spool.count() == 3);
+  MODBEE_CHECK(spool.bytes() == 3 * 3 + 100 + 101 + 102);
+  for (uint32_t i = 0; i < 3; i++) {
+    MODBEE_CHECK(spoolHeadIs(spool, i, 100 + i, i % 2));
+    spool.pop();
+  }
+  MODBEE_CHECK(spool.count() == 0 && spool.bytes() == 0);
+  uint8_t kind;
+  MODBEE_CHECK(spool.peek(kind, payload) == 0);
+}
+
+static void testSpoolWraps() {
+  // Lengths that put record headers and payloads across the end of the ring
+  static char payload[MODBEE_MQTT_PAYLOAD_MAX];
+  ModbeeMpptMqttSpool spool;
+  MODBEE_CHECK(spool.begin());
+  MODBEE_CHECK(spool.push(MODBEE_MQTT_TELEMETRY, payload, spoolPayload(0, 1500, payload)));
+  bool ordered = true;
+  for (uint32_t i = 1; i < 200; i++) {
+    size_t length = 1 + (i * 677) % MODBEE_MQTT_PAYLOAD_MAX;
+    if (length < 8) length = 8;
+    ordered = spool.push(MODBEE_MQTT_TELEMETRY, payload, spoolPayload(i, length, payload)) && ordered;
+    size_t previous = i == 1 ? 1500 : 1 + ((i - 1) * 677) % MODBEE_MQTT_PAYLOAD_MAX;
+    if (previous < 8) previous = 8;
+    ordered = spoolHeadIs(spool, i - 1, previous, MODBEE_MQTT_TELEMETRY) && ordered;
+    spool.pop();
+  }
+  MODBEE_CHECK(ordered);
+  MODBEE_CHECK(spool.count() == 1);
+  MODBEE_CHECK(spool.dropped() == 0);
+  spool.pop();
+}
+
+static void testSpoolDropsOldest() {
+  static char payload[MODBEE_MQTT_PAYLOAD_MAX];
+  ModbeeMpptMqttSpool spool;
+  MODBEE_CHECK(spool.begin());
+  for (uint32_t i = 0; i < 40; i++) {
+    MODBEE_CHECK(spool.push(MODBEE_MQTT_TELEMETRY, payload, spoolPayload(i, 2000, payload)));
+  }
+  uint32_t kept = MODBEE_MQTT_SPOOL_BYTES / 2003;
+  MODBEE_CHECK(spool.count() == kept);
+  MODBEE_CHECK(spool.dropped() == 40 - kept);
+  MODBEE_CHECK(spool.bytes() <= MODBEE_MQTT_SPOOL_BYTES);
+  MODBEE_CHECK(spoolHeadIs(spool, 40 - kept, 2000, MODBEE_MQTT_TELEMETRY));
+}
+
+static void testSpoolReopens() {
+  // What the last one left is still there after a restart, oldest first
+  ModbeeMpptMqttSpool spool;
+  MODBEE_CHECK(spool.begin());
+  uint32_t kept = MODBEE_MQTT_SPOOL_BYTES / 2003;
+  MODBEE_CHECK(spool.count() == kept);
+  MODBEE_CHECK(spool.dropped() == 40 - kept);
+  MODBEE_CHECK(spoolHeadIs(spool, 40 - kept, 2000, MODBEE_MQTT_TELEMETRY));
+  spool.pop();
+  MODBEE_CHECK(spoolHeadIs(spool, 41 - kept, 2000, MODBEE_MQTT_TELEMETRY));
+}
+
+static void testSpoolBadHeader() {
+  File file = LittleFS.open(MODBEE_MQTT_SPOOL_FILE, "r+");
+  MODBEE_CHECK(file);
+  const uint8_t zeros[4] = {0, 0, 0, 0};
+  file.write(zeros, sizeof(zeros));
+  file.close();
+
+  static char payload[MODBEE_MQTT_PAYLOAD_MAX];
+  ModbeeMpptMqttSpool spool;
+  MODBEE_CHECK(!spool.begin());
+  MODBEE_CHECK(spool.count() == 0 && spool.bytes() == 0);
+  MODBEE_CHECK(spool.push(MODBEE_MQTT_DAILY, payload, spoolPayload(7, 50, payload)));
+  MODBEE_CHECK(spoolHeadIs(spool, 7, 50, MODBEE_MQTT_DAILY));
+  LittleFS.remove(MODBEE_MQTT_SPOOL_FILE);
+}
+
+static void testBatching() {
+  // Three one-second samples per QoS 1 publish, the first with identifier 1
+  MODBEE_CHECK(runUntilReceived(1, 10000));
+  const Received& first = received[0];
+  size_t samples = 0;
+  MODBEE_CHECK(first.topic.compare(0, 14, "modbee/modbee-") == 0);
+  MODBEE_CHECK(endsWith(first.topic, "/telemetry"));
+  MODBEE_CHECK(first.flags == 0x02);
+  MODBEE_CHECK(first.id == 1);
+  MODBEE_CHECK(batchSequence(first, &samples) == 0);
+  MODBEE_CHECK(samples == 3);
+
+  // The next batch is due within the keep-alive: the session stays up
+  MODBEE_CHECK(runUntilReceived(3, 8000));
+  modbee_mqtt_status_t status = mppt.mqtt.getStatus();
+  MODBEE_CHECK(status.state == MODBEE_MQTT_ONLINE);
+  MODBEE_CHECK(status.sessions == 1 && connects == 1);
+  MODBEE_CHECK(status.published == received.size());
+  MODBEE_CHECK(status.spooled == 0);
+  MODBEE_CHECK(batchSequence(received[2]) == 2);
+  MODBEE_CHECK(received[2].id == 3);
+}
+
+static void testSessionPerBatch() {
+  // Twelve seconds to the next batch is past the 10 s keep-alive: each
+  // batch gets its own session and the radio goes off in between
+  mppt.config.data.mqtt_interval_s = 2;
+  mppt.config.data.mqtt_batch = 6;
+  size_t before = received.size();
+  MODBEE_CHECK(runUntilReceived(before + 1, 30000));
+  run(500);
+  uint32_t ended = disconnects;
+  MODBEE_CHECK(mppt.mqtt.getStatus().state == MODBEE_MQTT_IDLE);
+  MODBEE_CHECK(!mppt.station.isConnected());
+  uint32_t sessions = mppt.mqtt.getStatus().sessions;
+  MODBEE_CHECK(runUntilReceived(before + 2, 30000));
+  run(500);
+  modbee_mqtt_status_t status = mppt.mqtt.getStatus();
+  MODBEE_CHECK(status.sessions == sessions + 1);
+  MODBEE_CHECK(status.state == MODBEE_MQTT_IDLE);
+  MODBEE_CHECK(disconnects == ended + 1);
+  size_t samples = 0;
+  batchSequence(received.back(), &samples);
+  MODBEE_CHECK(samples == 6);
+  mppt.config.data.mqtt_interval_s = 1;
+  mppt.config.data.mqtt_batch = 3;
+}
+
+static void testReplayAfterOutage() {
+  // Let the batch of six under way close, then take the broker away
+  size_t before = received.size();
+  MODBEE_CHECK(runUntilReceived(before + 1, 30000));
+  run(3000);
+  brokerDown();
+  long last = batchSequence(received.back());
+  run(20000);
+  modbee_mqtt_status_t status = mppt.mqtt.getStatus();
+  MODBEE_CHECK(status.failures >= 1);
+  MODBEE_CHECK(status.lastError != nullptr);
+  MODBEE_CHECK(status.spooled >= 5);
+  MODBEE_CHECK(LittleFS.exists(MODBEE_MQTT_SPOOL_FILE));
+
+  // Back up, slow to acknowledge: the spool goes out first, then what
+  // came into the outbox meanwhile, in order
+  uint32_t spooled = status.spooled;
+  before = received.size();
+  ackDelayUs = 1000000ULL;
+  MODBEE_CHECK(brokerUp());
+  MODBEE_CHECK(runUntilReceived(before + spooled + 3, 120000));
+  ackDelayUs = 0;
+  run(2000);
+  status = mppt.mqtt.getStatus();
+  MODBEE_CHECK(status.spooled == 0);
+  MODBEE_CHECK(status.replayed >= spooled);
+  bool ordered = true;
+  for (size_t i = before; i < received.size(); i++) {
+    long sequence = batchSequence(received[i]);
+    ordered = ordered && sequence == last + 1;
+    last = sequence;
+  }
+  MODBEE_CHECK(ordered);
+}
+
+static void testPacketIdWraps() {
+  // 65535 is followed by 1: 0 is not a valid QoS 1 identifier
+  ModbeeMpptMqttTest::setPacketId(mppt.mqtt, 0xFFFE);
+  size_t before = received.size();
+  MODBEE_CHECK(runUntilReceived(before + 2, 20000));
+  MODBEE_CHECK(received[before].id == 0xFFFF);
+  MODBEE_CHECK(received[before + 1].id == 1);
+  MODBEE_CHECK(mppt.mqtt.getStatus().published >= received.size());
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("mqtt");
+
+  MODBEE_TEST(testSpoolOrder);
+  MODBEE_TEST(testSpoolWraps);
+  MODBEE_TEST(testSpoolDropsOldest);
+  MODBEE_TEST(testSpoolReopens);
+  MODBEE_TEST(testSpoolBadHeader);
+
+  MODBEE_CHECK(brokerUp());
+  WiFi.hostNetwork(true);
+  charger.attachBattery(&battery);
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(mppt.begin());
+  ModbeeMpptConfigData& config = mppt.config.data;
+  snprintf(config.wifi_ssid, sizeof(config.wifi_ssid), "bench");
+  snprintf(config.mqtt_host, sizeof(config.mqtt_host), "127.0.0.1");
+  config.mqtt_port = brokerPort;
+  config.mqtt_interval_s = 1;
+  config.mqtt_batch = 3;
+  config.mqtt_keepalive_s = 10;
+  config.mqtt_enable = true;
+
+  MODBEE_TEST(testBatching);
+  MODBEE_TEST(testSessionPerBatch);
+  MODBEE_TEST(testReplayAfterOutage);
+  MODBEE_TEST(testPacketIdWraps);
+
+  brokerDown();
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_mqtt");
+}
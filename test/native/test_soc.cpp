@@ -0,0 +1,119 @@
+/*!
+ * @file test_soc.cpp
+ *
+ * @brief SOC estimator: coulomb counting over the measured frame interval,
+ * at the normal 1 Hz and at the BLE beacon's sparse frames, and rested OCV
+ * through an uploaded custom curve
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+
+// ==================== Helpers ====================
+
+static const float CAPACITY_AH = 10.0f;
+static const float LIPO_EFFICIENCY = 0.99f;
+
+static ModbeeMPPT mppt;
+static uint32_t frameSequence = 0;
+
+static modbee_telemetry_t frame(float current) {
+  modbee_telemetry_t t;
+  memset(&t, 0, sizeof(t));
+  t.valid = true;
+  t.sequence = ++frameSequence;
+  t.timestamp_ms = millis();
+  t.charge_state = current > 0.0f ? MODBEE_CHARGE_FAST_CC : MODBEE_CHARGE_NOT_CHARGING;
+  t.battery.voltage = 11.4f;
+  t.battery.current = current;
+  t.battery_temperature = 25.0f;
+  return t;
+}
+
+// Frames every periodMs for seconds of constant current
+static void run(float current, uint32_t seconds, uint32_t periodMs) {
+  for (uint32_t elapsed = 0; elapsed < seconds * 1000UL; elapsed += periodMs) {
+    ModbeeNative::advance(periodMs * 1000ULL);
+    mppt.socEstimator.sample(frame(current));
+  }
+}
+
+// ==================== Tests ====================
+
+static void testOneHertz() {
+  float before = mppt.socEstimator.getStatus().ahSinceAnchor;
+  run(2.0f, 1800, 1000);
+  MODBEE_CHECK_NEAR(mppt.socEstimator.getStatus().ahSinceAnchor - before, 1.0f * LIPO_EFFICIENCY, 0.005f);
+}
+
+static void testBeaconFrames() {
+  // One frame per beacon period counts the whole period, not one second
+  float before = mppt.socEstimator.getStatus().ahSinceAnchor;
+  run(2.0f, 1800, MODBEE_BLE_BEACON_PERIOD_MS);
+  MODBEE_CHECK_NEAR(mppt.socEstimator.getStatus().ahSinceAnchor - before, 1.0f * LIPO_EFFICIENCY, 0.02f);
+}
+
+static void testRepeatedFrame() {
+  modbee_telemetry_t t = frame(2.0f);
+  mppt.socEstimator.sample(t);
+  float before = mppt.socEstimator.getStatus().ahSinceAnchor;
+  mppt.socEstimator.sample(t);
+  MODBEE_CHECK(mppt.socEstimator.getStatus().ahSinceAnchor == before);
+}
+
+static void testLongGap() {
+  float before = mppt.socEstimator.getStatus().ahSinceAnchor;
+  run(2.0f, 60, 60000);
+  float counted = 2.0f * MODBEE_SOC_MAX_DT_S / 3600.0f * LIPO_EFFICIENCY;
+  MODBEE_CHECK_NEAR(mppt.socEstimator.getStatus().ahSinceAnchor - before, counted, 1e-4f);
+}
+
+static void testRestAtBeaconFrames() {
+  // The rest period is timed in seconds, so the OCV reading still comes
+  // after MODBEE_SOC_REST_S when no frame lands on it exactly
+  run(0.0f, MODBEE_SOC_REST_S - 60, MODBEE_BLE_BEACON_PERIOD_MS);
+  modbee_soc_status_t waiting = mppt.socEstimator.getStatus();
+  MODBEE_CHECK(waiting.restSeconds >= MODBEE_SOC_REST_S - 60 - MODBEE_BLE_BEACON_PERIOD_MS / 1000);
+  MODBEE_CHECK(waiting.restSeconds < MODBEE_SOC_REST_S);
+  run(0.0f, 120, MODBEE_BLE_BEACON_PERIOD_MS);
+  modbee_soc_status_t rested = mppt.socEstimator.getStatus();
+  MODBEE_CHECK(rested.restSeconds >= MODBEE_SOC_REST_S);
+  MODBEE_CHECK(rested.sigma < waiting.sigma);
+}
+
+static void testCustomCurve() {
+  // A custom battery is corrected at rest through its uploaded curve
+  ModbeeMpptConfigData& config = mppt.config.data;
+  config.battery_type = MODBEE_BATTERY_CUSTOM;
+  config.ocv_custom = *ModbeeMpptOcv::getCurve(MODBEE_BATTERY_LIPO);
+  config.soc_ekf = true;  // No chemistry parameters: stays on counting
+  run(2.0f, 600, 1000);
+  modbee_soc_status_t charged = mppt.socEstimator.getStatus();
+  MODBEE_CHECK(!charged.ekf);
+  run(0.0f, MODBEE_SOC_REST_S, 1000);
+  modbee_soc_status_t rested = mppt.socEstimator.getStatus();
+  MODBEE_CHECK(rested.sigma < charged.sigma);
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("soc");
+  ModbeeMpptConfigData& config = mppt.config.data;
+  config.battery_type = MODBEE_BATTERY_LIPO;
+  config.battery_cell_count = 3;
+  config.battery_capacity_ah = CAPACITY_AH;
+  config.soc_ekf = false;
+  ModbeeNative::advance(1000000ULL);
+  mppt.socEstimator.sample(frame(0.0f));
+  MODBEE_CHECK(mppt.socEstimator.isValid());
+
+  MODBEE_TEST(testOneHertz);
+  MODBEE_TEST(testBeaconFrames);
+  MODBEE_TEST(testRepeatedFrame);
+  MODBEE_TEST(testLongGap);
+  MODBEE_TEST(testRestAtBeaconFrames);
+  MODBEE_TEST(testCustomCurve);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_soc");
+}
@@ -0,0 +1,200 @@
+/*!
+ * @file test_source_arbiter.cpp
+ *
+ * @brief VAC1/VAC2 source arbitration on the simulated charger: a panel on
+ * VAC1 and a current-limited adapter on VAC2 through failover, cheapest,
+ * prefer-solar and max-power, each input's limits applied with its FET
+ * and the latency from condition onset to switch
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798SimPlant.h>
+
+// ==================== Helpers ====================
+
+static const uint64_t TICK_US = 20000ULL;
+static const uint32_t DWELL_S = 10;
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static BQ25798SimPanel panel;
+static BQ25798SimSupply adapter(15.0f);
+static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 20.0f, 0.3f);
+
+static void run(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += TICK_US / 1000) {
+    mppt.loop();
+    ModbeeNative::advance(TICK_US);
+  }
+}
+
+static bool patch(const char* json) {
+  JsonDocument doc;
+  deserializeJson(doc, json);
+  JsonDocument result;
+  JsonObject errors = result["errors"].to<JsonObject>();
+  JsonArray changed = result["changed"].to<JsonArray>();
+  return mppt.config.applyPatch(doc.as<JsonVariantConst>(), errors, changed);
+}
+
+// Run until the arbiter has switched inputs, at most timeoutMs; false on timeout
+static bool runUntilSwitch(uint32_t timeoutMs) {
+  uint32_t switches = mppt.sourceArbiter.getStatus().switches;
+  for (uint32_t t = 0; t < timeoutMs; t += TICK_US / 1000) {
+    mppt.loop();
+    ModbeeNative::advance(TICK_US);
+    if (mppt.sourceArbiter.getStatus().switches != switches) return true;
+  }
+  return false;
+}
+
+// The arbiter, the chip's FETs and the input limits all agree on this input
+static bool onInput(uint8_t input, float voltageLimit, float currentLimit) {
+  modbee_source_status_t status = mppt.sourceArbiter.getStatus();
+  return status.active == input && charger.state().input == input &&
+         fabsf(mppt.api.getInputVoltageLimit() - voltageLimit) < 0.05f &&
+         fabsf(mppt.api.getInputCurrentLimit() - currentLimit) < 0.005f;
+}
+
+// ==================== Tests ====================
+
+static void testStartsOnPrimary() {
+  MODBEE_CHECK(patch("{\"sourcePolicy\":4,\"sourcePrimary\":1,\"sourceDwell\":10}"));
+  run(3000);
+  modbee_source_status_t status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(status.hardware);
+  MODBEE_CHECK(status.sources[0].present && status.sources[1].present);
+  MODBEE_CHECK(onInput(1, 15.0f, 3.0f));
+  MODBEE_CHECK(charger.state().chargeState == MODBEE_CHARGE_FAST_CC);
+}
+
+static void testFailoverOnLoss() {
+  // Losing the active input switches on the frame that shows it
+  charger.attachInput(1, nullptr);
+  MODBEE_CHECK(runUntilSwitch(2000));
+  run(2000);
+  modbee_source_status_t status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(strcmp(status.reason, "lost") == 0);
+  MODBEE_CHECK(onInput(2, 12.0f, 0.5f));
+  MODBEE_CHECK(status.maxLossLatencyMs < 1000);
+  MODBEE_CHECK(charger.state().ibus <= 0.5f);
+
+  // The primary coming back is a voluntary switch: it waits out the dwell
+  uint32_t switches = status.switches;
+  charger.attachInput(1, &panel);
+  run((DWELL_S - 2) * 1000);
+  MODBEE_CHECK(mppt.sourceArbiter.getStatus().switches == switches);
+  MODBEE_CHECK(runUntilSwitch(4000));
+  run(2000);
+  status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(strcmp(status.reason, "failover") == 0);
+  MODBEE_CHECK(status.lastLatencyMs >= DWELL_S * 1000 && status.lastLatencyMs < (DWELL_S + 2) * 1000);
+  MODBEE_CHECK(onInput(1, 15.0f, 3.0f));
+}
+
+static void testCheapest() {
+  MODBEE_CHECK(patch("{\"sourcePolicy\":3,\"vac1Cost\":0.30,\"vac2Cost\":0.10}"));
+  MODBEE_CHECK(runUntilSwitch((DWELL_S + 2) * 1000));
+  run(2000);
+  MODBEE_CHECK(strcmp(mppt.sourceArbiter.getStatus().reason, "cheapest") == 0);
+  MODBEE_CHECK(onInput(2, 12.0f, 0.5f));
+}
+
+static void testPreferSolar() {
+  // Fresh power from the panel brings it back after the dwell
+  MODBEE_CHECK(patch("{\"sourcePolicy\":1}"));
+  MODBEE_CHECK(runUntilSwitch((DWELL_S + 2) * 1000));
+  run(2000);
+  MODBEE_CHECK(strcmp(mppt.sourceArbiter.getStatus().reason, "prefer-solar") == 0);
+  MODBEE_CHECK(onInput(1, 15.0f, 3.0f));
+
+  // Dusk: the smoothed power takes some 20 s to fall below the minimum,
+  // then the adapter takes over after the dwell
+  run(5000);
+  panel.setConditions(20.0f, 25.0f);
+  MODBEE_CHECK(runUntilSwitch((DWELL_S + 30) * 1000));
+  run(2000);
+  modbee_source_status_t status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(strcmp(status.reason, "prefer-solar") == 0);
+  MODBEE_CHECK(status.sources[0].power < MODBEE_SOURCE_SOLAR_MIN_W);
+  MODBEE_CHECK(onInput(2, 12.0f, 0.5f));
+
+  // Dawn is only seen by going to look: the panel's reading goes stale and
+  // a probe finds it delivering again, where the arbiter stays
+  uint32_t switches = status.switches;
+  panel.setConditions(1000.0f, 25.0f);
+  run((MODBEE_SOURCE_STALE_S - 30) * 1000);
+  MODBEE_CHECK(mppt.sourceArbiter.getStatus().switches == switches);
+  MODBEE_CHECK(runUntilSwitch(60000));
+  status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(strcmp(status.reason, "probe") == 0);
+  MODBEE_CHECK(status.probing);
+  run((MODBEE_SOURCE_PROBE_S + 2) * 1000);
+  status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(!status.probing);
+  MODBEE_CHECK(status.switches == switches + 1);
+  MODBEE_CHECK(status.sources[0].power > 5.0f);
+  MODBEE_CHECK(onInput(1, 15.0f, 3.0f));
+}
+
+static void testMaxPower() {
+  // The adapter's reading from before the probe is still fresh: about 7 W
+  MODBEE_CHECK(patch("{\"sourcePolicy\":2}"));
+  run((DWELL_S + 2) * 1000);
+  modbee_source_status_t status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(status.active == 1);
+  MODBEE_CHECK(status.sources[1].measured);
+  float adapterPower = status.sources[1].power;
+  MODBEE_CHECK(adapterPower > 5.0f && adapterPower < status.sources[0].power);
+
+  // Haze takes the panel below the adapter by more than the margin
+  panel.setConditions(250.0f, 25.0f);
+  MODBEE_CHECK(runUntilSwitch((DWELL_S + 30) * 1000));
+  run(2000);
+  status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(strcmp(status.reason, "max-power") == 0);
+  MODBEE_CHECK(adapterPower > status.sources[0].power * (1.0f + MODBEE_SOURCE_MARGIN));
+  MODBEE_CHECK(onInput(2, 12.0f, 0.5f));
+}
+
+static void testStopRestoresConfig() {
+  // The limits go back to the config values; the input in use stays on
+  MODBEE_CHECK(patch("{\"sourcePolicy\":0}"));
+  run(2000);
+  modbee_source_status_t status = mppt.sourceArbiter.getStatus();
+  MODBEE_CHECK(status.active == 0);
+  MODBEE_CHECK(status.switches == 0);
+  MODBEE_CHECK(charger.state().input == 2);
+  MODBEE_CHECK_NEAR(mppt.api.getInputVoltageLimit(), 5.0f, 0.05f);
+  MODBEE_CHECK_NEAR(mppt.api.getInputCurrentLimit(), 3.0f, 0.005f);
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("source_arbiter");
+  panel.setConditions(1000.0f, 25.0f);
+  charger.setInputFets(true, true);
+  charger.attachInput(1, &panel);
+  charger.attachInput(2, &adapter);
+  charger.attachBattery(&battery);
+  charger.setTemperature(25.0f);
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(mppt.begin());
+  ModbeeNative::advance(2000000ULL);  // Past the first 15 bit sweeps
+
+  // Static limits: the panel held at 15 V, the adapter at 0.5 A
+  MODBEE_CHECK(patch("{\"mpptEnable\":false,\"chargeCurrent\":1.0,\"inputVoltage\":5.0,"
+                     "\"inputCurrent\":3.0,\"vac1VoltageLimit\":15.0,\"vac1CurrentLimit\":3.0,"
+                     "\"vac2VoltageLimit\":12.0,\"vac2CurrentLimit\":0.5}"));
+
+  MODBEE_TEST(testStartsOnPrimary);
+  MODBEE_TEST(testFailoverOnLoss);
+  MODBEE_TEST(testCheapest);
+  MODBEE_TEST(testPreferSolar);
+  MODBEE_TEST(testMaxPower);
+  MODBEE_TEST(testStopRestoresConfig);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_source_arbiter");
+}
@@ -0,0 +1,86 @@
+/*!
+ * @file test_tbv.cpp
+ *
+ * @brief True battery voltage burst: the relaxation fit, and a burst on the
+ * simulated charger reading a new ADC sweep with every sample
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798Sim.h>
+
+// ==================== Helpers ====================
+
+// A battery still settling fast: every conversion sees a different voltage
+class RampBattery : public BQ25798SimBattery {
+public:
+  float openCircuitVoltage() override { return voltage; }
+  float resistance() override { return 0.05f; }
+  void step(float, float seconds) override { voltage -= 0.5f * seconds; }
+
+  float voltage = 12.0f;
+};
+
+static ModbeeMPPT mppt;
+
+// V(t) = ocv + amplitude * exp(-t / tau), at the burst's sample period
+static void relaxation(float* samples, uint8_t count, float ocv, float amplitude, float tau) {
+  for (uint8_t k = 0; k < count; k++) {
+    samples[k] = ocv + amplitude * expf(-(k * MODBEE_TBV_SAMPLE_MS / 1000.0f) / tau);
+  }
+}
+
+// ==================== Tests ====================
+
+static void testFit() {
+  float samples[MODBEE_TBV_MAX_SAMPLES];
+  relaxation(samples, MODBEE_TBV_MAX_SAMPLES, 12.0f, 0.3f, 0.2f);
+  MODBEE_CHECK_NEAR(ModbeeMpptAPI::extrapolateRelaxation(samples, MODBEE_TBV_MAX_SAMPLES), 12.0f, 0.002f);
+  relaxation(samples, MODBEE_TBV_MIN_SAMPLES, 12.0f, 0.3f, 0.2f);
+  MODBEE_CHECK_NEAR(ModbeeMpptAPI::extrapolateRelaxation(samples, MODBEE_TBV_MIN_SAMPLES), 12.0f, 0.002f);
+}
+
+static void testNoFit() {
+  // Too few samples, flat, or not decaying: the last sample stands
+  float samples[MODBEE_TBV_MAX_SAMPLES];
+  relaxation(samples, 2, 12.0f, 0.3f, 0.2f);
+  MODBEE_CHECK(ModbeeMpptAPI::extrapolateRelaxation(samples, 2) == samples[1]);
+  for (uint8_t k = 0; k < 5; k++) samples[k] = 12.1f;
+  MODBEE_CHECK(ModbeeMpptAPI::extrapolateRelaxation(samples, 5) == 12.1f);
+  for (uint8_t k = 0; k < 5; k++) samples[k] = 12.1f + 0.01f * (1 << k);
+  MODBEE_CHECK(ModbeeMpptAPI::extrapolateRelaxation(samples, 5) == samples[4]);
+}
+
+static void testBurstSamplesNewSweeps() {
+  // A sample taken before the next sweep finished would repeat the last
+  // conversion, look flat and end the burst early
+  modbee_tbv_status_t before = mppt.api.getTrueBatteryVoltageStatus();
+  mppt.api.updateTrueBatteryVoltage();
+  for (uint32_t ms = 0; mppt.api.isTrueBatteryVoltageBusy() && ms < 2000; ms += 5) {
+    ModbeeNative::advance(5000);
+    mppt.api.update();
+  }
+  modbee_tbv_status_t after = mppt.api.getTrueBatteryVoltageStatus();
+  MODBEE_CHECK(!mppt.api.isTrueBatteryVoltageBusy());
+  MODBEE_CHECK(after.count == before.count + 1);
+  MODBEE_CHECK(after.samples == MODBEE_TBV_MAX_SAMPLES);
+  MODBEE_CHECK(!after.stable);
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("tbv");
+  static BQ25798Sim charger(3);
+  static RampBattery battery;
+  charger.attachBattery(&battery);
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(mppt.begin());
+  ModbeeNative::advance(2000000ULL);  // Past the first 15 bit sweeps
+
+  MODBEE_TEST(testFit);
+  MODBEE_TEST(testNoFit);
+  MODBEE_TEST(testBurstSamplesNewSweeps);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_tbv");
+}
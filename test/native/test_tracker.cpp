@@ -0,0 +1,307 @@
+/*!
+ * @file test_tracker.cpp
+ *
+ * @brief Firmware P&O tracker on the simulated charger: settling on the
+ * maximum power point of a panel, following it when the panel warms,
+ * holding it over a true battery voltage measurement, the energy of a
+ * changing day against the charger's built-in VOC MPPT, the global sweep
+ * finding the higher of two peaks of a shaded panel, and the sweep keeping
+ * the ADC from, or giving way to, a true battery voltage measurement
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798SimPlant.h>
+
+// ==================== Helpers ====================
+
+static const uint64_t TICK_US = 20000ULL;
+
+// Half the panel shaded behind its bypass diode: a local maximum near Voc
+// carried by the shaded half, the global one at about half the voltage
+class ShadedPanel : public BQ25798SimSource {
+public:
+  float openCircuitVoltage() override { return 21.0f; }
+  float current(float voltage) override {
+    float shaded = voltage < 21.0f ? 0.4f * (1.0f - expf((voltage - 21.0f) / 0.8f)) : 0.0f;
+    float bypassed = voltage < 10.5f ? 1.2f * (1.0f - expf((voltage - 10.5f) / 0.6f)) : 0.0f;
+    return max(shaded, bypassed);
+  }
+
+  // Voltage of the highest power between minVoltage and maxVoltage, on a 10 mV grid
+  float maximumPowerVoltage(float minVoltage, float maxVoltage) {
+    float best = minVoltage;
+    for (float v = minVoltage; v <= maxVoltage; v += 0.01f) {
+      if (v * current(v) > best * current(best)) best = v;
+    }
+    return best;
+  }
+};
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static BQ25798SimPanel panel;
+static ShadedPanel shaded;
+static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 20.0f, 0.3f);
+
+static void run(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += TICK_US / 1000) {
+    mppt.loop();
+    ModbeeNative::advance(TICK_US);
+  }
+}
+
+static bool patch(const char* json) {
+  JsonDocument doc;
+  deserializeJson(doc, json);
+  JsonDocument result;
+  JsonObject errors = result["errors"].to<JsonObject>();
+  JsonArray changed = result["changed"].to<JsonArray>();
+  return mppt.config.applyPatch(doc.as<JsonVariantConst>(), errors, changed);
+}
+
+// A 20 minute day: clear and cool, the panel warming, passing clouds, haze
+static const uint32_t DAY_S = 1200;
+
+static void dayConditions(uint32_t s) {
+  if (s < 300) {
+    panel.setConditions(1000.0f, 20.0f);
+  } else if (s < 600) {
+    panel.setConditions(1000.0f, 20.0f + 25.0f * (s - 300) / 300.0f);
+  } else if (s < 900) {
+    panel.setConditions((s / 20) % 2 ? 450.0f : 950.0f, 45.0f);
+  } else {
+    panel.setConditions(700.0f, 35.0f);
+  }
+}
+
+// Input energy (Wh) the charger took over the day, what the panel had at
+// its maximum power point, and what the sim's built-in MPPT would take
+// with VINDPM at this fraction of the momentary VOC
+struct Harvest {
+  float energy;
+  float available;
+  float vocModel;
+};
+
+static Harvest runDay(float vocFraction) {
+  Harvest h = {0.0f, 0.0f, 0.0f};
+  for (uint32_t s = 0; s < DAY_S; s++) {
+    dayConditions(s);
+    float vindpm = panel.openCircuitVoltage() * vocFraction;
+    h.available += panel.maximumPower() / 3600.0f;
+    h.vocModel += vindpm * panel.current(vindpm) / 3600.0f;
+    for (uint32_t ms = 0; ms < 1000; ms += TICK_US / 1000) {
+      mppt.loop();
+      ModbeeNative::advance(TICK_US);
+      const bq25798_sim_state_t& state = charger.state();
+      h.energy += state.vbus * state.ibus * (TICK_US / 1e6f) / 3600.0f;
+    }
+  }
+  return h;
+}
+
+// ADC_SAMPLE, REG2E bits 5:4: 0 = 15 bit ... 3 = 12 bit
+static uint8_t adcBits() {
+  return 15 - ((charger.peek(0x2E) >> 4) & 0x03);
+}
+
+// Run until the tracker is sweeping, at most timeoutMs
+static bool runUntilSweeping(uint32_t timeoutMs) {
+  for (uint32_t t = 0; t < timeoutMs && !mppt.tracker.isSweeping(); t += TICK_US / 1000) run(TICK_US / 1000);
+  return mppt.tracker.isSweeping();
+}
+
+// Input power as the charger sees it, against what the panel could give
+static float harvestRatio() {
+  const bq25798_sim_state_t& s = charger.state();
+  return s.vbus * s.ibus / panel.maximumPower();
+}
+
+// ==================== Tests ====================
+
+static void testConverges() {
+  MODBEE_CHECK(patch("{\"mpptEnable\":true,\"mpptMode\":1}"));
+  run(60000);
+  modbee_tracker_status_t status = mppt.tracker.getStatus();
+  MODBEE_CHECK(status.state == MODBEE_TRACKER_TRACKING);
+  MODBEE_CHECK(status.sweeps == 1);    // The one a start asks for
+  MODBEE_CHECK(status.iterations > 10);
+
+  float vmp;
+  panel.maximumPower(&vmp);
+  MODBEE_CHECK_NEAR(status.vref, vmp, 0.5f);
+  MODBEE_CHECK(harvestRatio() > 0.97f);
+
+  // Every 100 mV step reaches the register, none is truncated away
+  MODBEE_CHECK(charger.peek(0x05) == lroundf(status.vref * 10.0f));
+}
+
+static void testFollowsWarming() {
+  // A hotter panel has its maximum power point about 2 V lower
+  float coldVmp;
+  panel.maximumPower(&coldVmp);
+  uint32_t sweeps = mppt.tracker.getStatus().sweeps;
+  panel.setConditions(1000.0f, 45.0f);
+  charger.setTemperature(45.0f);
+  float hotVmp;
+  panel.maximumPower(&hotVmp);
+  MODBEE_CHECK(coldVmp - hotVmp > 1.5f);
+
+  // Hill climbing alone gets there, well before the next global sweep
+  run(60000);
+  modbee_tracker_status_t status = mppt.tracker.getStatus();
+  MODBEE_CHECK(status.sweeps == sweeps);
+  MODBEE_CHECK_NEAR(status.vref, hotVmp, 0.5f);
+  MODBEE_CHECK(harvestRatio() > 0.97f);
+}
+
+static void testHoldsThroughTbv() {
+  // The converter stops for the measurement; what P&O sees meanwhile is
+  // not the panel, so it waits and carries on from where it was
+  float vmp;
+  panel.maximumPower(&vmp);
+  mppt.api.updateTrueBatteryVoltage();
+  MODBEE_CHECK(mppt.api.isTrueBatteryVoltageBusy());
+  for (uint32_t ms = 0; ms < 10000; ms += TICK_US / 1000) {
+    mppt.loop();
+    ModbeeNative::advance(TICK_US);
+    MODBEE_CHECK_NEAR(mppt.tracker.getStatus().vref, vmp, 0.6f);
+  }
+  MODBEE_CHECK(!mppt.api.isTrueBatteryVoltageBusy());
+  MODBEE_CHECK(harvestRatio() > 0.97f);
+}
+
+static void testAgainstBuiltInMppt() {
+  // The same day under the charger's own VOC sampling at 81.25 %, about
+  // this panel's Vmp/Voc, and then under P&O
+  MODBEE_CHECK(patch("{\"mpptMode\":0,\"vocPercent\":4}"));
+  run(5000);
+  MODBEE_CHECK(mppt.tracker.getStatus().state == MODBEE_TRACKER_OFF);
+  MODBEE_CHECK(charger.peek(0x15) & 0x01);  // EN_MPPT
+  Harvest voc = runDay(0.8125f);
+  MODBEE_CHECK(patch("{\"mpptMode\":1}"));
+  run(5000);
+  MODBEE_CHECK(!(charger.peek(0x15) & 0x01));
+  Harvest po = runDay(0.8125f);
+
+  // VOC sampling stays just below its model: it stops the converter to
+  // measure and holds VINDPM between measurements while clouds and heat
+  // move Vmp. The periodic config re-apply must not take VINDPM from it
+  MODBEE_CHECK(voc.energy < voc.vocModel);
+  MODBEE_CHECK(voc.energy > 0.97f * voc.vocModel);
+
+  // P&O follows the maximum power point between sweeps
+  MODBEE_CHECK(po.energy > 0.98f * po.available);
+  MODBEE_CHECK(po.energy > voc.energy);
+}
+
+static void testSweepFindsGlobalPeak() {
+  // Hill climbing from the old operating point settles on the local peak
+  charger.attachInput(1, &shaded);
+  run(30000);
+  float localVmp = shaded.maximumPowerVoltage(15.0f, 21.0f);
+  float globalVmp = shaded.maximumPowerVoltage(MODBEE_MIN_INPUT_VOLTAGE, 15.0f);
+  MODBEE_CHECK(globalVmp * shaded.current(globalVmp) > 1.2f * localVmp * shaded.current(localVmp));
+  modbee_tracker_status_t status = mppt.tracker.getStatus();
+  MODBEE_CHECK_NEAR(status.vref, localVmp, 0.5f);
+
+  // A sweep moves it to the global one, where P&O carries on
+  uint32_t sweeps = status.sweeps;
+  mppt.tracker.requestSweep();
+  run(10000);
+  status = mppt.tracker.getStatus();
+  MODBEE_CHECK(status.sweeps == sweeps + 1);
+  modbee_pv_curve_t curve;
+  MODBEE_CHECK(mppt.tracker.getLastCurve(curve));
+  MODBEE_CHECK(curve.count >= 20);
+  MODBEE_CHECK_NEAR(curve.voc, 21.0f, 0.3f);
+  bool descending = curve.points[0].voltage < curve.voc;
+  for (uint8_t k = 1; k < curve.count; k++) {
+    if (curve.points[k].voltage >= curve.points[k - 1].voltage) descending = false;
+  }
+  MODBEE_CHECK(descending);   // Each point a new conversion at a lower VINDPM
+  MODBEE_CHECK_NEAR(curve.vmp, globalVmp, 0.6f);
+  run(30000);
+  status = mppt.tracker.getStatus();
+  MODBEE_CHECK(status.state == MODBEE_TRACKER_TRACKING);
+  MODBEE_CHECK_NEAR(status.vref, globalVmp, 0.5f);
+  const bq25798_sim_state_t& s = charger.state();
+  MODBEE_CHECK(s.vbus * s.ibus > 0.97f * globalVmp * shaded.current(globalVmp));
+}
+
+static void testSweepOwnsAdc() {
+  // Sweeps back to back over two minutes: neither the periodic true
+  // battery voltage measurement nor the critical settings re-apply (both
+  // every 60 s) may take the 12 bit ADC or VINDPM from one
+  bool owned = true;
+  uint32_t sweeps = mppt.tracker.getStatus().sweeps;
+  for (uint32_t ms = 0; ms < 130000; ms += TICK_US / 1000) {
+    if (!mppt.tracker.isSweeping()) mppt.tracker.requestSweep();
+    mppt.loop();
+    ModbeeNative::advance(TICK_US);
+    if (mppt.tracker.isSweeping()) {
+      owned = owned && adcBits() == 12 && !mppt.api.isTrueBatteryVoltageBusy();
+    }
+  }
+  MODBEE_CHECK(owned);
+  MODBEE_CHECK(mppt.tracker.getStatus().sweeps > sweeps + 20);
+  run(5000);
+  MODBEE_CHECK(!mppt.tracker.isSweeping());
+  MODBEE_CHECK(adcBits() == 15);
+}
+
+static void testTbvInterruptsSweep() {
+  // A measurement started directly mid-sweep has the ADC at 13 bit; the
+  // sweep gives way and is repeated in full once it is done
+  uint32_t sweeps = mppt.tracker.getStatus().sweeps;
+  mppt.tracker.requestSweep();
+  MODBEE_CHECK(runUntilSweeping(5000));
+  run(500);
+  MODBEE_CHECK(mppt.tracker.isSweeping());
+  mppt.api.updateTrueBatteryVoltage();
+  bool held = true;
+  while (mppt.api.isTrueBatteryVoltageBusy()) {
+    mppt.loop();
+    ModbeeNative::advance(TICK_US);
+    if (mppt.api.isTrueBatteryVoltageBusy()) {
+      held = held && !mppt.tracker.isSweeping() && adcBits() == 13;
+    }
+  }
+  MODBEE_CHECK(held);
+  MODBEE_CHECK(mppt.tracker.getStatus().sweeps == sweeps);
+
+  run(10000);
+  modbee_tracker_status_t status = mppt.tracker.getStatus();
+  MODBEE_CHECK(status.sweeps == sweeps + 1);
+  MODBEE_CHECK(status.state == MODBEE_TRACKER_TRACKING);
+  modbee_pv_curve_t curve;
+  MODBEE_CHECK(mppt.tracker.getLastCurve(curve));
+  MODBEE_CHECK(curve.count >= 20);
+  MODBEE_CHECK_NEAR(curve.voc, 21.0f, 0.3f);
+  MODBEE_CHECK(adcBits() == 15);
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("tracker");
+  panel.setConditions(1000.0f, 20.0f);
+  charger.attachInput(1, &panel);
+  charger.attachBattery(&battery);
+  charger.setTemperature(20.0f);
+  ModbeeNative::setCharger(&charger);
+  MODBEE_CHECK(mppt.begin());
+  ModbeeNative::advance(2000000ULL);  // Past the first 15 bit sweeps
+  MODBEE_CHECK(patch("{\"chargeCurrent\":3.0,\"inputCurrent\":3.0,\"inputVoltage\":22.0}"));
+
+  MODBEE_TEST(testConverges);
+  MODBEE_TEST(testFollowsWarming);
+  MODBEE_TEST(testHoldsThroughTbv);
+  MODBEE_TEST(testAgainstBuiltInMppt);
+  MODBEE_TEST(testSweepFindsGlobalPeak);
+  MODBEE_TEST(testSweepOwnsAdc);
+  MODBEE_TEST(testTbvInterruptsSweep);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_tracker");
+}
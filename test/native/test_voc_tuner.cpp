@@ -0,0 +1,223 @@
+/*!
+ * @file test_voc_tuner.cpp
+ *
+ * @brief Adaptive VOC rate: levels chosen from input power variability,
+ * fast to react to clouds and slow to relax, VOC measurement dips and the
+ * night ignored, the rate/delay registers written to match, and clear sky
+ * and cumulus traces replayed through the plant and the firmware loop
+ */
+
+#include "ModbeeTest.h"
+#include <ModbeeMPPT.h>
+#include <BQ25798SimPlant.h>
+
+// ==================== Helpers ====================
+
+static ModbeeMPPT mppt;
+static BQ25798Sim charger(3);
+static BQ25798SimPanel panel;
+static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 20.0f, 0.3f);
+static uint32_t frameSequence = 0;
+
+// One 1 Hz frame with this input power
+static void feed(float power) {
+  ModbeeNative::advance(1000000ULL);
+  modbee_telemetry_t t;
+  memset(&t, 0, sizeof(t));
+  t.valid = true;
+  t.sequence = ++frameSequence;
+  t.timestamp_ms = millis();
+  t.vbus.voltage = 17.0f;
+  t.vbus.current = power / 17.0f;
+  t.vbus.power = power;
+  mppt.vocTuner.sample(t);
+}
+
+static void steady(float power, uint32_t seconds) {
+  for (uint32_t s = 0; s < seconds; s++) feed(power);
+}
+
+// Passing clouds: the input swings between full and 60 % every few seconds
+static void clouds(uint32_t seconds) {
+  for (uint32_t s = 0; s < seconds; s++) feed((s / 3) % 2 ? 6.0f : 10.0f);
+}
+
+// Run the firmware on a stretch of a trace as tools/replay does, the tuner
+// sampling real telemetry; returns the highest level it reached
+static modbee_voc_level_t replay(const BQ25798SimTrace& trace, uint32_t fromS, uint32_t toS) {
+  modbee_voc_level_t highest = MODBEE_VOC_LEVEL_STABLE;
+  for (uint32_t s = fromS; s < toS; s++) {
+    bq25798_sim_trace_point_t point = trace.at(s);
+    panel.setConditions(point.irradiance, point.ambient);
+    charger.setTemperature(point.ambient);
+    for (uint32_t ms = 0; ms < 1000; ms += 20) {
+      mppt.loop();
+      ModbeeNative::advance(20000ULL);
+    }
+    highest = max(highest, mppt.vocTuner.getStatus().level);
+  }
+  return highest;
+}
+
+// An hour of cumulus as a trace CSV (seconds,irradiance,ambient) at 10 s:
+// sun for one to four minutes, then a shadow of 20 to 60 s at 300 W/m²
+static std::string writeCumulusTrace() {
+  std::string path = std::string(ModbeeNative::dataDir()) + "/cumulus.csv";
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) return "";
+  fprintf(file, "seconds,irradiance,ambient\n");
+  uint32_t state = 7;
+  uint32_t next = 0;
+  bool shade = false;
+  for (uint32_t s = 0; s <= 3600; s += 10) {
+    if (s >= next) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      shade = !shade;
+      next = s + (shade ? 20 + state % 5 * 10 : 60 + state % 19 * 10);
+    }
+    fprintf(file, "%u,%d,25\n", s, shade ? 300 : 950);
+  }
+  fclose(file);
+  return path;
+}
+
+static modbee_voc_level_t level() {
+  return mppt.vocTuner.getStatus().level;
+}
+
+// REG15 (MPPT control) holds what the level asks for: VOC_DLY in bits 4:3, VOC_RATE in 2:1
+static bool registersAre(modbee_voc_rate_t rate, modbee_voc_delay_t delay) {
+  uint8_t reg = charger.peek(0x15);
+  return ((reg >> 1) & 0x03) == rate && ((reg >> 3) & 0x03) == delay;
+}
+
+// ==================== Tests ====================
+
+static void testStartsModerate() {
+  feed(10.0f);
+  modbee_voc_tuner_status_t status = mppt.vocTuner.getStatus();
+  MODBEE_CHECK(status.active);
+  MODBEE_CHECK(status.level == MODBEE_VOC_LEVEL_MODERATE);
+  MODBEE_CHECK_NEAR(status.meanPower, 10.0f, 1e-4f);
+  MODBEE_CHECK(registersAre(MODBEE_VOC_RATE_2MIN, MODBEE_VOC_DELAY_300MS));
+}
+
+static void testClearSkyRelaxesSlowly() {
+  // Variability is zero at once, but a level is only left downwards after its dwell
+  steady(10.0f, MODBEE_VOC_TUNER_DOWN_DWELL_MS / 1000 - 10);
+  MODBEE_CHECK(level() == MODBEE_VOC_LEVEL_MODERATE);
+  steady(10.0f, 20);
+  MODBEE_CHECK(level() == MODBEE_VOC_LEVEL_STABLE);
+  MODBEE_CHECK(mppt.vocTuner.getStatus().changes == 1);
+  MODBEE_CHECK(registersAre(MODBEE_VOC_RATE_10MIN, MODBEE_VOC_DELAY_300MS));
+}
+
+static void testVocDipsIgnored() {
+  // The chip's own VOC measurement shows as one frame with no input power
+  for (uint32_t k = 0; k < 10; k++) {
+    steady(10.0f, 59);
+    feed(0.2f);
+  }
+  modbee_voc_tuner_status_t status = mppt.vocTuner.getStatus();
+  MODBEE_CHECK(status.level == MODBEE_VOC_LEVEL_STABLE);
+  MODBEE_CHECK(status.variability < MODBEE_VOC_TUNER_MODERATE_DOWN);
+  MODBEE_CHECK_NEAR(status.meanPower, 10.0f, 0.01f);
+}
+
+static void testCloudsReactFast() {
+  // The stable level is past its up dwell, so only the estimate holds the move back
+  clouds(60);
+  MODBEE_CHECK(level() == MODBEE_VOC_LEVEL_FAST);
+  MODBEE_CHECK(mppt.vocTuner.getStatus().variability > MODBEE_VOC_TUNER_FAST_UP);
+  MODBEE_CHECK(registersAre(MODBEE_VOC_RATE_30S, MODBEE_VOC_DELAY_50MS));
+
+  // Hysteresis: two minutes of clear sky drop the estimate below FAST_UP
+  // but not below FAST_DOWN, which keeps the level
+  clouds(600);
+  uint32_t changes = mppt.vocTuner.getStatus().changes;
+  steady(10.0f, 120);
+  modbee_voc_tuner_status_t status = mppt.vocTuner.getStatus();
+  MODBEE_CHECK(status.variability < MODBEE_VOC_TUNER_FAST_UP);
+  MODBEE_CHECK(status.variability > MODBEE_VOC_TUNER_FAST_DOWN);
+  MODBEE_CHECK(status.level == MODBEE_VOC_LEVEL_FAST);
+  MODBEE_CHECK(status.changes == changes);
+}
+
+static void testNightHoldsLevel() {
+  // Once the mean is below the minimum the estimate and the level freeze
+  while (mppt.vocTuner.getStatus().meanPower >= MODBEE_VOC_TUNER_MIN_POWER) feed(0.0f);
+  modbee_voc_tuner_status_t dusk = mppt.vocTuner.getStatus();
+  for (uint32_t s = 0; s < 8 * 3600; s++) feed(s % 7 ? 0.0f : 0.3f);
+  modbee_voc_tuner_status_t night = mppt.vocTuner.getStatus();
+  MODBEE_CHECK(night.level == dusk.level);
+  MODBEE_CHECK(night.variability == dusk.variability);
+  MODBEE_CHECK(night.changes == dusk.changes);
+}
+
+static void testCost() {
+  // Each level is charged its delay / rate share of every second spent in it
+  modbee_voc_tuner_status_t status = mppt.vocTuner.getStatus();
+  const modbee_voc_level_stats_t& stable = status.levels[MODBEE_VOC_LEVEL_STABLE];
+  const modbee_voc_level_stats_t& fast = status.levels[MODBEE_VOC_LEVEL_FAST];
+  MODBEE_CHECK(stable.seconds > 0 && fast.seconds > 0);
+  MODBEE_CHECK_NEAR(stable.lostSeconds, stable.seconds * 0.3f / 600.0f, 0.01f);
+  MODBEE_CHECK_NEAR(fast.lostSeconds, fast.seconds * 0.05f / 30.0f, 0.01f);
+}
+
+static void testReplay() {
+  // A clear hour, after one to settle: the chip's own VOC samples, charge
+  // current steps and config re-applies must not read as clouds
+  BQ25798SimTrace clear;
+  clear.clearSky(1000.0f, 15.0f, 30.0f);
+  replay(clear, 9 * 3600, 10 * 3600);
+  uint32_t changes = mppt.vocTuner.getStatus().changes;
+  MODBEE_CHECK(replay(clear, 10 * 3600, 11 * 3600) == MODBEE_VOC_LEVEL_STABLE);
+  MODBEE_CHECK(mppt.vocTuner.getStatus().changes == changes);
+  MODBEE_CHECK(mppt.vocTuner.getStatus().variability < MODBEE_VOC_TUNER_MODERATE_DOWN);
+
+  // Cumulus, loaded as tools/replay --trace does: fast, then back to
+  // stable once the sky clears
+  BQ25798SimTrace cumulus;
+  MODBEE_CHECK(cumulus.load(writeCumulusTrace().c_str()));
+  MODBEE_CHECK(replay(cumulus, 0, 3600) == MODBEE_VOC_LEVEL_FAST);
+  replay(clear, 11 * 3600, 12 * 3600);
+  MODBEE_CHECK(level() == MODBEE_VOC_LEVEL_STABLE);
+}
+
+static void testStopRestoresConfig() {
+  mppt.config.data.mppt_voc_adaptive = false;
+  feed(10.0f);
+  MODBEE_CHECK(!mppt.vocTuner.getStatus().active);
+  MODBEE_CHECK(registersAre(mppt.config.data.mppt_voc_rate, mppt.config.data.mppt_voc_delay));
+}
+
+int main() {
+  ModbeeNative::setConsole(false);
+  ModbeeTest::freshDataDir("voc_tuner");
+  panel.setConditions(0.0f, 20.0f);
+  charger.attachInput(1, &panel);
+  charger.attachBattery(&battery);
+  ModbeeNative::setCharger(&charger);
+  mppt.initializeLEDs();
+  MODBEE_CHECK(mppt.begin());
+  ModbeeMpptConfigData& config = mppt.config.data;
+  config.mppt_enable = true;
+  config.mppt_mode = MODBEE_MPPT_MODE_VOC;
+  config.mppt_voc_adaptive = true;
+  config.mppt_voc_rate = MODBEE_VOC_RATE_30MIN;
+  config.mppt_voc_delay = MODBEE_VOC_DELAY_2S;
+
+  MODBEE_TEST(testStartsModerate);
+  MODBEE_TEST(testClearSkyRelaxesSlowly);
+  MODBEE_TEST(testVocDipsIgnored);
+  MODBEE_TEST(testCloudsReactFast);
+  MODBEE_TEST(testNightHoldsLevel);
+  MODBEE_TEST(testCost);
+  MODBEE_TEST(testReplay);
+  MODBEE_TEST(testStopRestoresConfig);
+
+  ModbeeTest::removeDataDir();
+  return ModbeeTest::finish("test_voc_tuner");
+}
@@ -0,0 +1,135 @@
+/*!
+ * @file modbee_beacondecode.cpp
+ *
+ * @brief Decodes ModbeeMPPT beacon advertisements (bleMode beacon)
+ *
+ * Takes the manufacturer data as hex, one advertisement per argument or
+ * per stdin line:
+ * - with the company ID first, as printed by the "ble" serial command or
+ *   shown raw by a phone scanner app;
+ * - without it, as btmon ("Data:") and bluetoothctl ("Value:") show it;
+ * - or a full advertising payload (length/type AD structures), whose
+ *   manufacturer-specific structure is used.
+ *
+ *   modbee_beacondecode FFFF11A0...
+ *
+ * Separators (spaces, ':', '-') and a leading 0x are ignored. The layout
+ * comes from ModbeeMpptBeacon.h, the same constexpr schema the firmware
+ * packs with.
+ *
+ * --json prints one JSON object per advertisement instead of name=value.
+ */
+
+#include "ModbeeMpptBeacon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+
+using namespace ModbeeMpptBeacon;
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [--json] [HEX ...]\n"
+          "  HEX      manufacturer data (with or without the company ID) or advertising payload;\n"
+          "           read from stdin, one per line, when none are given\n"
+          "  --json   print JSON objects instead of name=value\n",
+          name);
+}
+
+static bool parseHex(const char* text, std::string& bytes) {
+  bytes.clear();
+  if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) text += 2;
+  int high = -1;
+  for (; *text; text++) {
+    if (*text == ' ' || *text == ':' || *text == '-' || *text == '\n' || *text == '\r') continue;
+    if (!isxdigit((unsigned char)*text)) return false;
+    int digit = isdigit((unsigned char)*text) ? *text - '0' : tolower((unsigned char)*text) - 'a' + 10;
+    if (high < 0) {
+      high = digit;
+    } else {
+      bytes += (char)(high << 4 | digit);
+      high = -1;
+    }
+  }
+  return high < 0 && !bytes.empty();
+}
+
+// Manufacturer data itself, with the company ID added if it was left off, or
+// the manufacturer-specific AD structure of a payload
+static std::string manufacturerData(const std::string& bytes) {
+  if (bytes.size() >= 2 && (uint16_t)((uint8_t)bytes[0] | (uint8_t)bytes[1] << 8) == COMPANY_ID) return bytes;
+  if (bytes.size() == PAYLOAD_BYTES) return std::string("\xFF\xFF", 2) + bytes;
+  for (size_t i = 0; i + 1 < bytes.size();) {
+    size_t length = (uint8_t)bytes[i];
+    if (length == 0 || i + 1 + length > bytes.size()) break;
+    if ((uint8_t)bytes[i + 1] == 0xFF) return bytes.substr(i + 2, length - 1);
+    i += 1 + length;
+  }
+  return std::string();
+}
+
+static bool decodeLine(const char* text, bool json) {
+  std::string bytes;
+  if (!parseHex(text, bytes)) {
+    fprintf(stderr, "beacondecode: not hex: %s\n", text);
+    return false;
+  }
+  std::string data = manufacturerData(bytes);
+  float values[FIELD_COUNT];
+  if (!decode((const uint8_t*)data.data(), data.size(), values)) {
+    fprintf(stderr, "beacondecode: not a version %u ModbeeMPPT beacon (%zu bytes)\n", VERSION, bytes.size());
+    return false;
+  }
+
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    const Field& f = FIELDS[i];
+    // Integer steps print as integers, the faults register in hex
+    char value[24];
+    if (i == FIELD_FAULTS) {
+      snprintf(value, sizeof(value), json ? "%u" : "0x%04x", (unsigned)values[i]);
+    } else if (f.step >= 1.0f) {
+      snprintf(value, sizeof(value), "%ld", (long)values[i]);
+    } else {
+      snprintf(value, sizeof(value), "%.*f", f.step >= 0.1f ? 1 : 2, values[i]);
+    }
+    if (json) {
+      printf("%s\"%s\":%s", i ? "," : "{", f.name, value);
+    } else {
+      printf("%s%s=%s%s", i ? " " : "", f.name, value, f.unit);
+    }
+  }
+  printf(json ? "}\n" : "\n");
+  return true;
+}
+
+int main(int argc, char** argv) {
+  bool json = false;
+  int first = argc;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--json")) {
+      json = true;
+    } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+      usage(argv[0]);
+      return 2;
+    } else if (first == argc) {
+      first = i;
+    }
+  }
+
+  bool ok = true;
+  if (first < argc) {
+    for (int i = first; i < argc; i++) {
+      if (strcmp(argv[i], "--json")) ok = decodeLine(argv[i], json) && ok;
+    }
+    return ok ? 0 : 1;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), stdin)) {
+    if (line[0] == '\n' || line[0] == '\r' || line[0] == '#') continue;
+    ok = decodeLine(line, json) && ok;
+  }
+  return ok ? 0 : 1;
+}
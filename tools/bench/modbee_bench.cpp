@@ -0,0 +1,398 @@
+/*!
+ * @file modbee_bench.cpp
+ *
+ * @brief Microbenchmarks for the telemetry and serialization hot paths
+ *
+ * Runs ModbeeMPPT on the native build against a BQ25798Sim, lets it settle
+ * for a few simulated seconds, then times each case on the host clock. Per
+ * call it also counts what matters on the ESP32-C3 regardless of host speed:
+ * - I2C address phases, and the bus time they take at the simulated clock;
+ * - heap allocations and bytes requested (malloc and operator new on glibc,
+ *   operator new only elsewhere).
+ *
+ * Results are one JSON document. --compare reads an earlier result and
+ * fails when a case got slower than --threshold or does more bus transfers
+ * or allocations than before, so a change can be checked against the
+ * previous commit:
+ *
+ *   modbee_bench --out base.json          (on the old commit)
+ *   modbee_bench --compare base.json      (on the new one)
+ */
+
+#include <ModbeeMPPT.h>
+#include <ModbeeMpptWebServer.h>
+#include <ModbeeNative.h>
+#include <BQ25798SimPlant.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <vector>
+
+#define BENCH_SETTLE_US 5000000ULL          // Simulated run before timing starts
+#define BENCH_MIN_TIME_MS 200               // Host time per case
+#define BENCH_EPOCHS 5                      // Timed batches per case, median reported
+#define BENCH_THRESHOLD_PCT 20.0            // --compare: allowed slow-down
+
+// ==================== Allocation counting ====================
+
+// Counted from every thread; the native build runs the firmware on one
+static uint64_t allocCount = 0;
+static uint64_t allocBytes = 0;
+
+static inline void countAlloc(size_t size) {
+  allocCount++;
+  allocBytes += size;
+}
+
+#ifdef __GLIBC__
+// ArduinoJson allocates with malloc(): wrap the C allocator itself
+extern "C" {
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+  countAlloc(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  countAlloc(count * size);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  countAlloc(size);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  __libc_free(ptr);
+}
+}
+#define BENCH_COUNT_NEW(size)       // Already counted by malloc()
+#else
+// Elsewhere only operator new is counted, so ArduinoJson's pool is not
+#define BENCH_COUNT_NEW(size) countAlloc(size)
+#endif
+
+void* operator new(size_t size) {
+  BENCH_COUNT_NEW(size);
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+  (void)size;
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t size) noexcept {
+  (void)size;
+  free(ptr);
+}
+
+// ==================== Cases ====================
+
+static ModbeeMPPT mppt;
+
+// Reaches the web server's private builders and handlers
+class ModbeeMpptBench {
+public:
+  static String systemData() { return mppt._webServer->getSystemData(); }
+  static String debugData() { return mppt._webServer->getDebugData(); }
+  static void message(const String& text) {
+    static AsyncWebSocketClient client;
+    mppt._webServer->handleWebSocketMessage(&client, text);
+  }
+};
+
+typedef struct {
+  const char* name;
+  std::function<void()> run;
+} bench_case_t;
+
+static String sink;                         // Keeps results alive so calls are not elided
+static uint32_t toggle = 0;
+static ModbeeMpptBleTelemetry bleRecord;
+static uint8_t bleChunk[MODBEE_BLE_CHUNK_MAX];
+static uint8_t bleBeacon[ModbeeMpptBeacon::MANUFACTURER_BYTES];
+static modbee_telemetry_t socFrame;
+
+// One SOC estimator frame, a second after the last so each call counts
+static void socSample(bool ekf) {
+  if (!socFrame.valid) socFrame = mppt.api.getTelemetry();
+  socFrame.timestamp_ms += 1000;
+  mppt.config.data.soc_ekf = ekf;
+  mppt.socEstimator.sample(socFrame);
+}
+
+static const bench_case_t CASES[] = {
+  {"api.updateStats", [] { mppt.api.updateStats(); }},
+  {"web.getSystemData", [] { sink = ModbeeMpptBench::systemData(); }},
+  {"web.getDebugData", [] { sink = ModbeeMpptBench::debugData(); }},
+  {"config.saveConfig", [] { mppt.config.saveConfig(); }},
+  // Parse and dispatch only: sweepNow just raises a flag
+  {"ws.parse", [] { ModbeeMpptBench::message("{\"command\":\"sweepNow\"}"); }},
+  // The settings page's save: parse, validate, apply to the charger, write flash
+  {"ws.saveSettings", [] {
+     ModbeeMpptBench::message((toggle++ & 1)
+       ? "{\"command\":\"saveSettings\",\"settings\":{\"vocPercent\":5,\"chargeCurrent\":1.0}}"
+       : "{\"command\":\"saveSettings\",\"settings\":{\"vocPercent\":6,\"chargeCurrent\":1.2}}");
+   }},
+  {"ble.packTelemetry", [] {
+     ModbeeMpptBleCodec::packTelemetry(mppt.api.getTelemetry(), mppt._cachedSOC, 0, bleRecord);
+   }},
+  {"ble.packBeacon", [] {
+     ModbeeMpptBleCodec::packBeacon(mppt.api.getTelemetry(), mppt._cachedSOC, mppt.daily.today().inputWh, 0, 0,
+                                    bleBeacon);
+   }},
+  // A full history ring (1440 records) cut into chunks at the largest MTU
+  {"ble.chunkHistory", [] {
+     ModbeeMpptBleChunker chunker;
+     chunker.begin(MODBEE_HISTORY_CAPACITY * sizeof(ModbeeMpptHistoryRecord), sizeof(ModbeeMpptHistoryRecord),
+                   [](uint8_t* buffer, size_t max) { memset(buffer, 0x5A, max); return max; });
+     while (chunker.next(bleChunk, sizeof(bleChunk))) {}
+   }},
+  {"soc.coulomb", [] { socSample(false); }},
+  // Kalman filter predict, OCV lookup and correct
+  {"soc.ekf", [] { socSample(true); }},
+};
+
+typedef struct {
+  const char* name;
+  uint64_t iterations;
+  double nsPerOp;                   // Median over the epochs
+  double nsPerOpMin;
+  double i2cPerOp;
+  double busUsPerOp;                // Simulated bus time
+  double allocsPerOp;
+  double bytesPerOp;
+} bench_result_t;
+
+static double hostNs() {
+  return std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bench_result_t measure(const bench_case_t& c, uint32_t minTimeMs) {
+  bench_result_t r;
+  memset(&r, 0, sizeof(r));
+  r.name = c.name;
+
+  // Size the batch so one epoch takes its share of the time
+  c.run();
+  uint64_t batch = 1;
+  double epochNs = minTimeMs * 1e6 / BENCH_EPOCHS;
+  for (;;) {
+    double start = hostNs();
+    for (uint64_t i = 0; i < batch; i++) c.run();
+    double elapsed = hostNs() - start;
+    if (elapsed >= epochNs / 4 || batch >= (1ULL << 24)) {
+      batch = max<uint64_t>(1, (uint64_t)(batch * epochNs / max(elapsed, 1.0)));
+      break;
+    }
+    batch *= 4;
+  }
+
+  std::vector<double> perOp;
+  uint32_t transfers = ModbeeNativeI2C::transfers();
+  uint64_t busUs = ModbeeNative::now();
+  uint64_t allocs = allocCount;
+  uint64_t bytes = allocBytes;
+  for (int epoch = 0; epoch < BENCH_EPOCHS; epoch++) {
+    double start = hostNs();
+    for (uint64_t i = 0; i < batch; i++) c.run();
+    perOp.push_back((hostNs() - start) / batch);
+  }
+  uint64_t n = batch * BENCH_EPOCHS;
+  std::sort(perOp.begin(), perOp.end());
+  r.iterations = n;
+  r.nsPerOp = perOp[perOp.size() / 2];
+  r.nsPerOpMin = perOp.front();
+  r.i2cPerOp = (double)(ModbeeNativeI2C::transfers() - transfers) / n;
+  r.busUsPerOp = (double)(ModbeeNative::now() - busUs) / n;
+  r.allocsPerOp = (double)(allocCount - allocs) / n;
+  r.bytesPerOp = (double)(allocBytes - bytes) / n;
+  return r;
+}
+
+// ==================== Compare ====================
+
+/*!
+ * @brief Print old vs new per case
+ * @return False if any case regressed
+ */
+static bool compare(const char* path, const std::vector<bench_result_t>& results, double threshold) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    fprintf(stderr, "bench: cannot read %s\n", path);
+    return false;
+  }
+  std::string text;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) text.append(buffer, n);
+  fclose(in);
+
+  JsonDocument base;
+  if (deserializeJson(base, text)) {
+    fprintf(stderr, "bench: %s is not a result file\n", path);
+    return false;
+  }
+
+  bool ok = true;
+  fprintf(stderr, "%-20s %12s %12s %8s %8s %8s\n", "case", "old min ns", "new min ns", "change", "i2c", "allocs");
+  for (const bench_result_t& r : results) {
+    JsonObject old;
+    for (JsonObject b : base["benchmarks"].as<JsonArray>()) {
+      if (!strcmp(b["name"] | "", r.name)) old = b;
+    }
+    if (old.isNull()) {
+      fprintf(stderr, "%-20s %12s %12.0f %8s\n", r.name, "-", r.nsPerOpMin, "new");
+      continue;
+    }
+    // The fastest epoch is the least disturbed by the rest of the host
+    double oldNs = old["nsPerOpMin"] | 0.0;
+    double change = oldNs > 0.0 ? (r.nsPerOpMin / oldNs - 1.0) * 100.0 : 0.0;
+    double i2cDelta = r.i2cPerOp - (old["i2cPerOp"] | 0.0);
+    double allocDelta = r.allocsPerOp - (old["allocsPerOp"] | 0.0);
+    // Bus and heap counts barely move between runs: a whole extra transfer
+    // or allocation per call is a regression
+    bool regressed = change > threshold || i2cDelta >= 0.5 || allocDelta >= 0.5;
+    fprintf(stderr, "%-20s %12.0f %12.0f %+7.1f%% %+8.2f %+8.2f%s\n", r.name, oldNs, r.nsPerOpMin,
+            change, i2cDelta, allocDelta, regressed ? "  REGRESSED" : "");
+    if (regressed) ok = false;
+  }
+  return ok;
+}
+
+// ==================== Main ====================
+
+static void setup() {
+  mppt.initializeLEDs();
+  mppt.begin();
+  mppt.initWebServer();
+}
+
+static void loop() {
+  mppt.loop();
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --filter TEXT       only cases whose name contains TEXT\n"
+          "  --min-time MS       host time per case (default %d)\n"
+          "  --out FILE          write the JSON results here (default stdout)\n"
+          "  --compare FILE      compare with earlier results, exit 1 on a regression\n"
+          "  --threshold PCT     --compare: allowed slow-down (default %.0f)\n"
+          "  --data DIR          flash directory, wiped first (default bench_data)\n"
+          "  --list              print the case names\n",
+          name, BENCH_MIN_TIME_MS, BENCH_THRESHOLD_PCT);
+}
+
+int main(int argc, char** argv) {
+  const char* filter = nullptr;
+  uint32_t minTimeMs = BENCH_MIN_TIME_MS;
+  const char* outPath = nullptr;
+  const char* comparePath = nullptr;
+  double threshold = BENCH_THRESHOLD_PCT;
+  const char* dataDir = "bench_data";
+
+  for (int i = 1; i < argc; i++) {
+    const char* opt = argv[i];
+    if (!strcmp(opt, "--list")) {
+      for (const bench_case_t& c : CASES) printf("%s\n", c.name);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    const char* arg = argv[++i];
+    if (!strcmp(opt, "--filter")) filter = arg;
+    else if (!strcmp(opt, "--min-time")) minTimeMs = strtoul(arg, nullptr, 10);
+    else if (!strcmp(opt, "--out")) outPath = arg;
+    else if (!strcmp(opt, "--compare")) comparePath = arg;
+    else if (!strcmp(opt, "--threshold")) threshold = atof(arg);
+    else if (!strcmp(opt, "--data")) dataDir = arg;
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  // The board: a 3S battery at 60 % charging from a bench supply
+  ModbeeNative::setDataDir(dataDir);
+  ModbeeNative::setConsole(false);
+  LittleFS.format();
+  static BQ25798Sim charger(3);
+  static BQ25798SimSupply supply(21.0f, 2.0f);
+  static BQ25798SimCell battery(BQ25798_SIM_LIPO, 3, 10.0f, 0.6f);
+  charger.attachInput(1, &supply);
+  charger.attachBattery(&battery);
+  ModbeeNative::setCharger(&charger);
+  ModbeeNative::run(setup, loop, BENCH_SETTLE_US);
+
+  std::vector<bench_result_t> results;
+  for (const bench_case_t& c : CASES) {
+    if (filter && !strstr(c.name, filter)) continue;
+    results.push_back(measure(c, minTimeMs));
+  }
+
+  JsonDocument doc;
+  JsonObject context = doc["context"].to<JsonObject>();
+  context["compiler"] = __VERSION__;
+#ifdef NDEBUG
+  context["assertions"] = false;
+#else
+  context["assertions"] = true;
+#endif
+  context["minTimeMs"] = minTimeMs;
+  context["epochs"] = BENCH_EPOCHS;
+  JsonArray list = doc["benchmarks"].to<JsonArray>();
+  for (const bench_result_t& r : results) {
+    JsonObject b = list.add<JsonObject>();
+    b["name"] = r.name;
+    b["iterations"] = r.iterations;
+    b["nsPerOp"] = r.nsPerOp;
+    b["nsPerOpMin"] = r.nsPerOpMin;
+    b["i2cPerOp"] = r.i2cPerOp;
+    b["busUsPerOp"] = r.busUsPerOp;
+    b["allocsPerOp"] = r.allocsPerOp;
+    b["bytesPerOp"] = r.bytesPerOp;
+  }
+
+  String text;
+  serializeJsonPretty(doc, text);
+  FILE* out = outPath ? fopen(outPath, "w") : (comparePath ? nullptr : stdout);
+  if (outPath && !out) {
+    fprintf(stderr, "bench: cannot write %s\n", outPath);
+    return 2;
+  }
+  if (out) {
+    fprintf(out, "%s\n", text.c_str());
+    if (out != stdout) fclose(out);
+  }
+
+  if (comparePath) return compare(comparePath, results, threshold) ? 0 : 1;
+  return 0;
+}
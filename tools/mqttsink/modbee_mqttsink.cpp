@@ -0,0 +1,201 @@
+/*!
+ * @file modbee_mqttsink.cpp
+ *
+ * @brief Minimal MQTT 3.1.1 broker stand-in that prints what it receives
+ *
+ * Accepts any CONNECT, acknowledges QoS 1 PUBLISHes, answers PINGREQ and
+ * prints one line per publish (topic, then payload), so the MQTT client of
+ * a native instance can be exercised without a real broker:
+ *
+ *   modbee_mqttsink --port 1883
+ *   modbee_native --network --data unit ...   (mqttHost 127.0.0.1, mqttEnable on)
+ *
+ * Stopping the sink makes the firmware spool; starting it again shows the
+ * spooled publishes replayed, oldest first. There are no subscriptions and
+ * nothing is forwarded; use mosquitto for that.
+ *
+ * --brief prints the topic and payload size instead of the payload.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+struct Connection {
+  int fd;
+  std::string in;
+  std::string clientId;
+};
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [--port N] [--brief]\n"
+          "  --port N   TCP port to listen on (default 1883)\n"
+          "  --brief    print payload sizes instead of payloads\n",
+          name);
+}
+
+static void stamp() {
+  char text[16];
+  time_t now = time(nullptr);
+  strftime(text, sizeof(text), "%H:%M:%S", localtime(&now));
+  printf("%s ", text);
+}
+
+static uint16_t readU16(const std::string& data, size_t offset) {
+  return (uint8_t)data[offset] << 8 | (uint8_t)data[offset + 1];
+}
+
+static void reply(Connection& c, uint8_t type, const uint8_t* body, size_t length) {
+  uint8_t packet[4] = {type, (uint8_t)length};
+  memcpy(packet + 2, body, length);
+  send(c.fd, packet, 2 + length, MSG_NOSIGNAL);
+}
+
+// Handles one complete packet; false closes the connection
+static bool handle(Connection& c, uint8_t type, const std::string& body, bool brief) {
+  switch (type & 0xF0) {
+    case 0x10: {  // CONNECT: protocol name, level, flags, keep-alive, client id
+      if (body.size() < 12) return false;
+      size_t nameLength = readU16(body, 0);
+      size_t offset = 2 + nameLength + 4;
+      if (offset + 2 > body.size()) return false;
+      size_t idLength = readU16(body, offset);
+      c.clientId = body.substr(offset + 2, idLength);
+      stamp();
+      printf("CONNECT %s (keep-alive %u s)\n", c.clientId.c_str(), readU16(body, 2 + nameLength + 2));
+      const uint8_t connack[2] = {0, 0};
+      reply(c, 0x20, connack, 2);
+      return true;
+    }
+    case 0x30: {  // PUBLISH: topic, packet id if QoS > 0, payload
+      if (body.size() < 2) return false;
+      size_t topicLength = readU16(body, 0);
+      uint8_t qos = (type >> 1) & 0x03;
+      size_t offset = 2 + topicLength + (qos ? 2 : 0);
+      if (offset > body.size()) return false;
+      std::string topic = body.substr(2, topicLength);
+      stamp();
+      if (brief) {
+        printf("PUBLISH %s%s %zu bytes\n", topic.c_str(), (type & 0x01) ? " (retained)" : "",
+               body.size() - offset);
+      } else {
+        printf("PUBLISH %s%s %s\n", topic.c_str(), (type & 0x01) ? " (retained)" : "",
+               body.substr(offset).c_str());
+      }
+      if (qos == 1) {
+        const uint8_t puback[2] = {(uint8_t)body[2 + topicLength], (uint8_t)body[3 + topicLength]};
+        reply(c, 0x40, puback, 2);
+      }
+      return true;
+    }
+    case 0xC0:    // PINGREQ
+      reply(c, 0xD0, nullptr, 0);
+      return true;
+    case 0xE0:    // DISCONNECT
+      stamp();
+      printf("DISCONNECT %s\n", c.clientId.c_str());
+      return false;
+    default:
+      stamp();
+      printf("unexpected packet 0x%02x from %s\n", type, c.clientId.c_str());
+      return false;
+  }
+}
+
+// Splits c.in into packets; false closes the connection
+static bool process(Connection& c, bool brief) {
+  for (;;) {
+    size_t remaining = 0;
+    size_t used = 1;
+    bool complete = false;
+    for (int shift = 0; used < 5 && used < c.in.size(); shift += 7) {
+      uint8_t b = c.in[used++];
+      remaining |= (size_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || c.in.size() < used + remaining) return true;
+    uint8_t type = c.in[0];
+    std::string body = c.in.substr(used, remaining);
+    c.in.erase(0, used + remaining);
+    if (!handle(c, type, body, brief)) return false;
+  }
+}
+
+int main(int argc, char** argv) {
+  int port = 1883;
+  bool brief = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--brief")) {
+      brief = true;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listener, 8) != 0) {
+    fprintf(stderr, "mqttsink: cannot listen on port %d: %s\n", port, strerror(errno));
+    return 1;
+  }
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  fprintf(stderr, "mqttsink: listening on port %d\n", port);
+
+  std::vector<Connection> connections;
+  for (;;) {
+    std::vector<struct pollfd> fds;
+    fds.push_back({listener, POLLIN, 0});
+    for (const Connection& c : connections) fds.push_back({c.fd, POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listener, nullptr, nullptr);
+      if (fd >= 0) connections.push_back({fd, std::string(), std::string("?")});
+    }
+    for (size_t i = connections.size(); i-- > 0;) {
+      if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+      Connection& c = connections[i];
+      char buffer[4096];
+      ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+      bool keep = n > 0;
+      if (keep) {
+        c.in.append(buffer, n);
+        keep = process(c, brief);
+      } else {
+        stamp();
+        printf("closed %s\n", c.clientId.c_str());
+      }
+      if (!keep) {
+        close(c.fd);
+        connections.erase(connections.begin() + i);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,348 @@
+/*!
+ * @file modbee_replay.cpp
+ *
+ * @brief Long-horizon replay of ModbeeMPPT against a PV panel and battery plant
+ *
+ * Runs ModbeeMPPT::begin()/loop() on the native build's virtual clock with a
+ * BQ25798Sim fed by a BQ25798SimPanel on VAC1 and a BQ25798SimCell battery.
+ * Irradiance, ambient temperature and load come from a BQ25798SimTrace (a CSV
+ * file or a generated day). The firmware's config is patched to match the
+ * plant (chemistry, cells, capacity, charge voltage) plus any --config JSON.
+ *
+ * The result is one JSON report: harvested vs available energy, the
+ * firmware's SOC estimate against the plant's true SOC, and charge
+ * interruptions by cause. Each run starts from blank flash in --data.
+ */
+
+#include <ModbeeMPPT.h>
+#include <ModbeeNative.h>
+#include <BQ25798SimPlant.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <chrono>
+
+#define REPLAY_TICK_US 20000ULL             // Clock advance per loop()
+#define REPLAY_CONDITIONS_US 1000000ULL     // Trace and MPP update period
+#define REPLAY_SOC_SAMPLE_US 60000000ULL    // SOC error sample period
+#define REPLAY_BATTERY_TAU_S 1800.0f        // Battery temperature lag behind ambient
+#define REPLAY_AVAILABLE_W 0.5f             // Panel MPP above which charging is expected
+
+static ModbeeMPPT mppt;
+static JsonDocument configPatch;
+
+typedef enum {
+  CAUSE_VOC_SAMPLING = 0,
+  CAUSE_HIZ,
+  CAUSE_DISABLED,
+  CAUSE_TIMER,
+  CAUSE_TEMPERATURE,
+  CAUSE_INPUT_LIMIT,
+  CAUSE_OTHER,
+  CAUSE_COUNT
+} interruption_cause_t;
+
+static const char* const CAUSE_NAMES[CAUSE_COUNT] = {
+  "vocSampling", "hiz", "chargeDisabled", "safetyTimer", "temperature", "inputLimit", "other"
+};
+
+typedef struct {
+  double availableWh;
+  double harvestedWh;
+  double limitedAvailableWh;          // While the input limits charging: the MPPT's share
+  double limitedHarvestedWh;
+  double limitedSeconds;
+  double batteryInWh;
+  double batteryOutWh;
+  double loadWh;
+  double socSquareSum;
+  float socMaxError;
+  uint32_t socSamples;
+  uint32_t interruptions[CAUSE_COUNT];
+  double interruptedSeconds;
+  uint32_t terminations;
+  uint32_t vocSamples;
+  double vocSampleSeconds;
+} replay_metrics_t;
+
+static void setup() {
+  mppt.initializeLEDs();
+  mppt.begin();
+
+  JsonDocument result;
+  JsonObject errors = result["errors"].to<JsonObject>();
+  JsonArray changed = result["changed"].to<JsonArray>();
+  if (!mppt.config.applyPatch(configPatch.as<JsonVariantConst>(), errors, changed)) {
+    String text;
+    serializeJson(errors, text);
+    fprintf(stderr, "replay: config patch rejected: %s\n", text.c_str());
+    ModbeeNative::requestExit(2);
+  }
+}
+
+static void loop() {
+  mppt.loop();
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --days N            simulated days (default 1)\n"
+          "  --trace FILE        CSV seconds,irradiance,ambient[,load] (default: generated day)\n"
+          "  --peak W            generated day: noon irradiance W/m2 (default 1000)\n"
+          "  --ambient MIN,MAX   generated day: temperature range (default 15,30)\n"
+          "  --clouds F          generated day: 0 clear .. 1 overcast (default 0)\n"
+          "  --seed N            generated day: cloud pattern (default 1)\n"
+          "  --panel VOC,ISC     panel at STC (default 21.6,1.22)\n"
+          "  --chemistry C       lifepo4, lipo or lead (default lipo)\n"
+          "  --cells N           series cells (default 3)\n"
+          "  --capacity AH       battery capacity (default 10)\n"
+          "  --soc PCT           initial state of charge (default 50)\n"
+          "  --load A            VSYS load when the trace has none (default 0.05)\n"
+          "  --config JSON       extra config patch, /api/config keys\n"
+          "  --tick MS           clock advance per loop() (default %llu)\n"
+          "  --data DIR          flash directory, wiped first (default replay_data)\n"
+          "  --report FILE       write the JSON report here (default stdout)\n"
+          "  --verbose           firmware Serial output on stdout\n",
+          name, REPLAY_TICK_US / 1000);
+}
+
+static bool parsePair(const char* arg, float& a, float& b) {
+  char* end;
+  a = strtof(arg, &end);
+  if (end == arg || *end != ',') return false;
+  b = strtof(end + 1, nullptr);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  double days = 1.0;
+  const char* tracePath = nullptr;
+  float peak = 1000.0f, ambientMin = 15.0f, ambientMax = 30.0f, clouds = 0.0f;
+  uint32_t seed = 1;
+  float panelVoc = 21.6f, panelIsc = 1.22f;
+  bq25798_sim_chemistry_t chemistry = BQ25798_SIM_LIPO;
+  int cells = 3;
+  float capacity = 10.0f;
+  float soc = 50.0f;
+  float baseLoad = 0.05f;
+  const char* config = nullptr;
+  uint64_t tickUs = REPLAY_TICK_US;
+  const char* dataDir = "replay_data";
+  const char* reportPath = nullptr;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char* opt = argv[i];
+    const char* arg = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+    if (!strcmp(opt, "--verbose")) {
+      verbose = true;
+      continue;
+    }
+    if (!arg) ok = false;
+    else if (!strcmp(opt, "--days")) days = atof(arg);
+    else if (!strcmp(opt, "--trace")) tracePath = arg;
+    else if (!strcmp(opt, "--peak")) peak = atof(arg);
+    else if (!strcmp(opt, "--ambient")) ok = parsePair(arg, ambientMin, ambientMax);
+    else if (!strcmp(opt, "--clouds")) clouds = atof(arg);
+    else if (!strcmp(opt, "--seed")) seed = strtoul(arg, nullptr, 0);
+    else if (!strcmp(opt, "--panel")) ok = parsePair(arg, panelVoc, panelIsc);
+    else if (!strcmp(opt, "--chemistry")) ok = BQ25798SimCell::parse(arg, chemistry);
+    else if (!strcmp(opt, "--cells")) cells = atoi(arg);
+    else if (!strcmp(opt, "--capacity")) capacity = atof(arg);
+    else if (!strcmp(opt, "--soc")) soc = atof(arg);
+    else if (!strcmp(opt, "--load")) baseLoad = atof(arg);
+    else if (!strcmp(opt, "--config")) config = arg;
+    else if (!strcmp(opt, "--tick")) tickUs = (uint64_t)(atof(arg) * 1000.0);
+    else if (!strcmp(opt, "--data")) dataDir = arg;
+    else if (!strcmp(opt, "--report")) reportPath = arg;
+    else ok = false;
+    if (!ok || cells < 1 || cells > 4 || capacity <= 0.0f) {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  BQ25798SimTrace trace;
+  if (tracePath) {
+    if (!trace.load(tracePath)) {
+      fprintf(stderr, "replay: cannot read trace %s\n", tracePath);
+      return 2;
+    }
+  } else {
+    trace.clearSky(peak, ambientMin, ambientMax, clouds, seed);
+  }
+
+  // Firmware config to match the plant, then the user's patch on top
+  const bq25798_sim_chemistry_preset_t& preset = BQ25798SimCell::preset(chemistry);
+  if (config) {
+    DeserializationError error = deserializeJson(configPatch, config);
+    if (error || !configPatch.is<JsonObject>()) {
+      fprintf(stderr, "replay: --config is not a JSON object\n");
+      return 2;
+    }
+  }
+  if (!configPatch.is<JsonObject>()) configPatch.to<JsonObject>();
+  JsonObject patch = configPatch.as<JsonObject>();
+  if (patch["batteryType"].isNull()) patch["batteryType"] = (int)chemistry;
+  if (patch["cellCount"].isNull()) patch["cellCount"] = cells;
+  if (patch["capacityAh"].isNull()) patch["capacityAh"] = capacity;
+  if (patch["chargeVoltage"].isNull()) patch["chargeVoltage"] = preset.chargeVoltage * cells;
+
+  // The board
+  ModbeeNative::setDataDir(dataDir);
+  ModbeeNative::setConsole(verbose);
+  LittleFS.format();
+  static BQ25798Sim charger(cells);
+  static BQ25798SimPanel panel(panelVoc, panelIsc);
+  static BQ25798SimCell battery(chemistry, cells, capacity, soc / 100.0f);
+  bq25798_sim_trace_point_t start = trace.at(0.0);
+  panel.setConditions(start.irradiance, start.ambient);
+  charger.attachInput(1, &panel);
+  charger.attachBattery(&battery);
+  charger.setTemperature(start.ambient);
+  charger.setSystemLoad(isnan(start.load) ? baseLoad : start.load);
+  ModbeeNative::setCharger(&charger);
+
+  replay_metrics_t m;
+  memset(&m, 0, sizeof(m));
+  uint64_t lastUs = 0;
+  uint64_t conditionsUs = 0;
+  uint64_t socUs = REPLAY_SOC_SAMPLE_US;
+  float pmp = 0.0f;
+  float load = baseLoad;
+  float batteryTemperature = start.ambient;
+  bool wasCharging = false;
+  bool wasSampling = false;
+
+  ModbeeNative::onTick([&](uint64_t nowUs) {
+    double dt = (nowUs - lastUs) / 3.6e9;   // Hours
+    lastUs = nowUs;
+
+    if (nowUs >= conditionsUs) {
+      conditionsUs = nowUs + REPLAY_CONDITIONS_US;
+      bq25798_sim_trace_point_t point = trace.at(nowUs / 1e6);
+      panel.setConditions(point.irradiance, point.ambient);
+      pmp = panel.maximumPower();
+      load = isnan(point.load) ? baseLoad : point.load;
+      batteryTemperature += (point.ambient - batteryTemperature) *
+                            (1.0f - expf(-(REPLAY_CONDITIONS_US / 1e6f) / REPLAY_BATTERY_TAU_S));
+      charger.setTemperature(point.ambient);
+      charger.setBatteryTemperature(batteryTemperature);
+      charger.setSystemLoad(load);
+    }
+
+    const bq25798_sim_state_t& s = charger.state();
+    m.availableWh += pmp * dt;
+    m.harvestedWh += s.vbus * s.ibus * dt;
+    if (s.converter && (s.vindpm || s.iindpm)) {
+      m.limitedAvailableWh += pmp * dt;
+      m.limitedHarvestedWh += s.vbus * s.ibus * dt;
+      m.limitedSeconds += dt * 3600.0;
+    }
+    if (s.ibat > 0.0f) m.batteryInWh += s.vbat * s.ibat * dt;
+    else m.batteryOutWh -= s.vbat * s.ibat * dt;
+    m.loadWh += s.vsys * load * dt;
+
+    if (s.vocSampling && !wasSampling) m.vocSamples++;
+    if (s.vocSampling) m.vocSampleSeconds += dt * 3600.0;
+    wasSampling = s.vocSampling;
+
+    // Charging stopped while the sun was up and the battery was not done
+    bool charging = s.chargeState >= 1 && s.chargeState <= 6;
+    bool expected = pmp > REPLAY_AVAILABLE_W && s.chargeState != 7 && battery.soc < 0.999f;
+    if (wasCharging && !charging && expected) {
+      interruption_cause_t cause = CAUSE_OTHER;
+      uint8_t ctrl0 = charger.peek(0x0F);
+      if (s.vocSampling) cause = CAUSE_VOC_SAMPLING;
+      else if (ctrl0 & 0x04) cause = CAUSE_HIZ;
+      else if (!(ctrl0 & 0x20)) cause = CAUSE_DISABLED;
+      else if (charger.peek(0x1E) & 0x0E) cause = CAUSE_TIMER;
+      else if (charger.peek(0x1F) & 0x09) cause = CAUSE_TEMPERATURE;
+      else if (s.vindpm || s.iindpm) cause = CAUSE_INPUT_LIMIT;
+      m.interruptions[cause]++;
+    }
+    if (!charging && expected && s.input) m.interruptedSeconds += dt * 3600.0;
+    if (s.chargeState == 7 && wasCharging) m.terminations++;
+    wasCharging = charging;
+
+    if (nowUs >= socUs) {
+      socUs = nowUs + REPLAY_SOC_SAMPLE_US;
+      if (mppt.socEstimator.isValid()) {
+        float error = mppt.socEstimator.getSoc() - battery.soc * 100.0f;
+        m.socSquareSum += (double)error * error;
+        m.socMaxError = max(m.socMaxError, fabsf(error));
+        m.socSamples++;
+      }
+    }
+  });
+
+  auto started = std::chrono::steady_clock::now();
+  int exitCode = ModbeeNative::run(setup, loop, (uint64_t)(days * 86400e6), tickUs);
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  double simulated = ModbeeNative::now() / 1e6;
+
+  JsonDocument report;
+  report["simulatedSeconds"] = simulated;
+  report["wallSeconds"] = wall;
+  report["speedup"] = wall > 0.0 ? simulated / wall : 0.0;
+  JsonObject scenario = report["scenario"].to<JsonObject>();
+  scenario["trace"] = tracePath ? tracePath : "generated";
+  scenario["chemistry"] = preset.name;
+  scenario["cells"] = cells;
+  scenario["capacityAh"] = capacity;
+  scenario["panelVoc"] = panelVoc;
+  scenario["panelIsc"] = panelIsc;
+  scenario["tickMs"] = tickUs / 1000.0;
+  scenario["config"] = configPatch;
+
+  JsonObject energy = report["energy"].to<JsonObject>();
+  energy["availableWh"] = m.availableWh;
+  energy["harvestedWh"] = m.harvestedWh;
+  // Outside input-limited time the battery, not the MPPT, sets the harvest
+  energy["inputLimitedSeconds"] = m.limitedSeconds;
+  energy["trackingEfficiency"] =
+      m.limitedAvailableWh > 0.0 ? m.limitedHarvestedWh / m.limitedAvailableWh : 0.0;
+  energy["batteryInWh"] = m.batteryInWh;
+  energy["batteryOutWh"] = m.batteryOutWh;
+  energy["loadWh"] = m.loadWh;
+
+  JsonObject socReport = report["soc"].to<JsonObject>();
+  socReport["initial"] = soc;
+  socReport["final"] = battery.soc * 100.0f;
+  socReport["estimateFinal"] = mppt.socEstimator.getSoc();
+  socReport["samples"] = m.socSamples;
+  socReport["rmsError"] = m.socSamples ? sqrt(m.socSquareSum / m.socSamples) : 0.0;
+  socReport["maxError"] = m.socMaxError;
+
+  JsonObject charge = report["charge"].to<JsonObject>();
+  uint32_t interruptions = 0;
+  JsonObject causes = charge["causes"].to<JsonObject>();
+  for (uint8_t i = 0; i < CAUSE_COUNT; i++) {
+    interruptions += m.interruptions[i];
+    causes[CAUSE_NAMES[i]] = m.interruptions[i];
+  }
+  charge["interruptions"] = interruptions;
+  charge["interruptedSeconds"] = m.interruptedSeconds;
+  charge["terminations"] = m.terminations;
+  charge["vocSamples"] = m.vocSamples;
+  charge["vocSampleSeconds"] = m.vocSampleSeconds;
+  charge["chargedAh"] = battery.chargedAh;
+  charge["dischargedAh"] = battery.dischargedAh;
+
+  JsonObject i2c = report["i2c"].to<JsonObject>();
+  i2c["transfers"] = ModbeeNativeI2C::transfers();
+  i2c["nacks"] = ModbeeNativeI2C::nacks();
+
+  String text;
+  serializeJsonPretty(report, text);
+  FILE* out = reportPath ? fopen(reportPath, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "replay: cannot write %s\n", reportPath);
+    return 2;
+  }
+  fprintf(out, "%s\n", text.c_str());
+  if (out != stdout) fclose(out);
+  return exitCode;
+}
@@ -0,0 +1,114 @@
+/*!
+ * @file modbee_rs485bus.cpp
+ *
+ * @brief Shared RS485 line between native firmware instances
+ *
+ * Opens the pseudo-terminals printed by "modbee_native --rs485" and copies
+ * whatever one instance sends to all the others, as a two-wire RS485 bus
+ * does. A sender does not get its own bytes back (the native UART has no
+ * transceiver echo), and bytes sent at the same time by two instances
+ * simply interleave, like a real collision.
+ *
+ *   modbee_native --rs485 --data master ...   ->  native: RS485 on /dev/pts/3
+ *   modbee_native --rs485 --data unit2 ...    ->  native: RS485 on /dev/pts/5
+ *   modbee_rs485bus /dev/pts/3 /dev/pts/5
+ *
+ * --drop PCT discards that share of chunks (per receiver), to exercise
+ * timeouts and retries on a noisy line.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [--drop PCT] [--verbose] PTY PTY [PTY...]\n"
+          "  --drop PCT   lose this percentage of chunks on the way to each receiver\n"
+          "  --verbose    print every chunk in hex\n",
+          name);
+}
+
+static int openPort(const char* path) {
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return -1;
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+int main(int argc, char** argv) {
+  double dropPct = 0.0;
+  bool verbose = false;
+  std::vector<const char*> paths;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--drop") && i + 1 < argc) {
+      dropPct = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--verbose")) {
+      verbose = true;
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+      return 2;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.size() < 2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<struct pollfd> ports(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    ports[i].fd = openPort(paths[i]);
+    ports[i].events = POLLIN;
+    if (ports[i].fd < 0) {
+      fprintf(stderr, "rs485bus: %s: %s\n", paths[i], strerror(errno));
+      return 1;
+    }
+  }
+  fprintf(stderr, "rs485bus: %zu ports connected\n", ports.size());
+
+  srand(1);
+  uint8_t buffer[256];
+  for (;;) {
+    if (poll(ports.data(), ports.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("rs485bus: poll");
+      return 1;
+    }
+    for (size_t i = 0; i < ports.size(); i++) {
+      if (ports[i].revents & (POLLHUP | POLLERR)) {
+        fprintf(stderr, "rs485bus: %s closed\n", paths[i]);
+        return 0;
+      }
+      if (!(ports[i].revents & POLLIN)) continue;
+      ssize_t n = read(ports[i].fd, buffer, sizeof(buffer));
+      if (n <= 0) continue;
+      if (verbose) {
+        fprintf(stderr, "%s:", paths[i]);
+        for (ssize_t b = 0; b < n; b++) fprintf(stderr, " %02x", buffer[b]);
+        fprintf(stderr, "\n");
+      }
+      for (size_t j = 0; j < ports.size(); j++) {
+        if (j == i) continue;
+        if (dropPct > 0.0 && rand() % 10000 < dropPct * 100.0) continue;
+        // A full receiver loses the bytes, as a UART without room would
+        if (write(ports[j].fd, buffer, (size_t)n) < 0 && errno != EAGAIN) {
+          fprintf(stderr, "rs485bus: %s: %s\n", paths[j], strerror(errno));
+        }
+      }
+    }
+  }
+}